@@ -0,0 +1,482 @@
+/* pkbench.c - Driver for the poke benchmarks.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program runs the benchmarks that need to be driven from C,
+   like the time it takes to bootstrap a compiler or to load a
+   pickle, and then the Poke benchmarks in the files given in the
+   command line, each one in a fresh compiler.  The Poke benchmarks
+   are written using the pkbench pickle.
+
+   The results are printed in the same format used by pkbench:
+
+     Benchmark<name> <TAB> <iterations> <TAB> <ns> ns/op [<TAB> <n> MB/s]
+
+   Every benchmark runs for at least the number of milliseconds in
+   the PKBENCH_TIME environment variable, 500 by default.  The exit
+   status is 1 if some benchmark failed, 0 otherwise.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "libpoke.h"
+
+#if POKE_MI
+# include "pk-mi-msg.h"
+# include "pk-mi-json.h"
+# include "pk-mi-cbor.h"
+#endif
+
+/* Terminal interface.  The output of the Poke benchmarks is written
+   to the standard output without styling.  */
+
+static void
+bench_term_flush (void)
+{
+  fflush (stdout);
+}
+
+static void
+bench_term_puts (const char *str)
+{
+  fputs (str, stdout);
+}
+
+__attribute__ ((__format__ (__printf__, 1, 2)))
+static void
+bench_term_printf (const char *format, ...)
+{
+  va_list ap;
+
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+}
+
+static void
+bench_term_indent (unsigned int lvl, unsigned int step)
+{
+  printf ("\n%*s", (step * lvl), "");
+}
+
+static void
+bench_term_class (const char *class)
+{
+}
+
+static int
+bench_term_end_class (const char *class)
+{
+  return 1;
+}
+
+static void
+bench_term_hyperlink (const char *url, const char *id)
+{
+}
+
+static int
+bench_term_end_hyperlink (void)
+{
+  return 1;
+}
+
+static struct pk_color
+bench_term_get_color (void)
+{
+  struct pk_color none = {-1, -1, -1};
+  return none;
+}
+
+static void
+bench_term_set_color (struct pk_color color)
+{
+}
+
+static struct pk_term_if bench_term_if =
+  {
+    .flush_fn = bench_term_flush,
+    .puts_fn = bench_term_puts,
+    .printf_fn = bench_term_printf,
+    .indent_fn = bench_term_indent,
+    .class_fn = bench_term_class,
+    .end_class_fn = bench_term_end_class,
+    .hyperlink_fn = bench_term_hyperlink,
+    .end_hyperlink_fn = bench_term_end_hyperlink,
+    .get_color_fn = bench_term_get_color,
+    .get_bgcolor_fn = bench_term_get_color,
+    .set_color_fn = bench_term_set_color,
+    .set_bgcolor_fn = bench_term_set_color,
+  };
+
+/* Timing.
+
+   A benchmark function performs the operation being measured N
+   times, and returns 0 if it fails.  It can exclude some work from
+   the measure, like setting up a fresh compiler, by enclosing it in
+   calls to bench_stop and bench_start.  */
+
+typedef int (*bench_fn) (uint64_t n, const void *arg);
+
+static uint64_t bench_min_ns = 500 * 1000000UL;
+static uint64_t bench_elapsed;
+static uint64_t bench_started;
+static int bench_ok = 1;
+
+static uint64_t
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+bench_start (void)
+{
+  bench_started = bench_now ();
+}
+
+static void
+bench_stop (void)
+{
+  bench_elapsed += bench_now () - bench_started;
+}
+
+/* Run the benchmark NAME, calling FN with ARG and 1, 2, 4, ...
+   iterations until it takes at least bench_min_ns nanoseconds, and
+   print the results.  If BYTES is not zero, it is the number of
+   bytes processed per iteration.  */
+
+static void
+bench_run (const char *name, bench_fn fn, const void *arg, uint64_t bytes)
+{
+  uint64_t n = 1;
+
+  while (1)
+    {
+      bench_elapsed = 0;
+      bench_start ();
+      if (!fn (n, arg))
+        {
+          printf ("# Benchmark%s failed\n", name);
+          bench_ok = 0;
+          return;
+        }
+      bench_stop ();
+
+      if (bench_elapsed >= bench_min_ns || n >= (UINT64_C (1) << 40))
+        break;
+      n *= 2;
+    }
+
+  printf ("Benchmark%s\t%" PRIu64 "\t%" PRIu64 " ns/op",
+          name, n, bench_elapsed / n);
+  if (bytes != 0 && bench_elapsed != 0)
+    printf ("\t%" PRIu64 " MB/s", bytes * n * 1000 / bench_elapsed);
+  putchar ('\n');
+  fflush (stdout);
+}
+
+/* The benchmarks run in this compiler, unless they need a fresh
+   one.  */
+
+static pk_compiler bench_pkc;
+
+static int
+bench_bootstrap (uint64_t n, const void *arg)
+{
+  uint64_t i;
+
+  for (i = 0; i < n; ++i)
+    {
+      pk_compiler pkc = pk_compiler_new (&bench_term_if);
+
+      if (!pkc)
+        return 0;
+      bench_stop ();
+      pk_compiler_free (pkc);
+      bench_start ();
+    }
+
+  return 1;
+}
+
+/* Load the pickle ARG in a fresh compiler.  */
+
+static int
+bench_load (uint64_t n, const void *arg)
+{
+  const char *module = arg;
+  uint64_t i;
+
+  for (i = 0; i < n; ++i)
+    {
+      pk_compiler pkc;
+      int ret;
+
+      bench_stop ();
+      pkc = pk_compiler_new (&bench_term_if);
+      if (!pkc)
+        return 0;
+      bench_start ();
+
+      ret = pk_load (pkc, module);
+
+      bench_stop ();
+      pk_compiler_free (pkc);
+      bench_start ();
+
+      if (ret != PK_OK)
+        return 0;
+    }
+
+  return 1;
+}
+
+/* Compile and run the expression ARG.  */
+
+static int
+bench_compile (uint64_t n, const void *arg)
+{
+  const char *expr = arg;
+  pk_val val;
+  uint64_t i;
+
+  for (i = 0; i < n; ++i)
+    if (pk_compile_expression (bench_pkc, expr, NULL, &val) != PK_OK)
+      return 0;
+
+  return 1;
+}
+
+/* Call the closure resulting from the expression ARG, which takes
+   two integers.  */
+
+static int
+bench_call (uint64_t n, const void *arg)
+{
+  const char *expr = arg;
+  pk_val cls, val;
+  uint64_t i;
+
+  bench_stop ();
+  if (pk_compile_expression (bench_pkc, expr, NULL, &cls) != PK_OK)
+    return 0;
+  bench_start ();
+
+  for (i = 0; i < n; ++i)
+    if (pk_call (bench_pkc, cls, &val, pk_make_int (i, 32),
+                 pk_make_int (1, 32), PK_NULL) != PK_OK)
+      return 0;
+
+  return 1;
+}
+
+/* Generate all the completions of the text ARG with the elf and
+   dwarf pickles loaded, the way readline does.  */
+
+static int
+bench_complete (uint64_t n, const void *arg)
+{
+  const char *text = arg;
+  pk_compiler pkc;
+  uint64_t i;
+
+  bench_stop ();
+  pkc = pk_compiler_new (&bench_term_if);
+  if (!pkc
+      || pk_load (pkc, "elf") != PK_OK
+      || pk_load (pkc, "dwarf") != PK_OK)
+    {
+      if (pkc)
+        pk_compiler_free (pkc);
+      return 0;
+    }
+  bench_start ();
+
+  for (i = 0; i < n; ++i)
+    {
+      char *completion;
+      int state = 0;
+
+      while ((completion = pk_completion_function (pkc, text, state++)))
+        free (completion);
+    }
+
+  bench_stop ();
+  pk_compiler_free (pkc);
+  bench_start ();
+  return 1;
+}
+
+#if POKE_MI
+
+/* Buffer collecting the output of the CBOR encoder.  */
+
+struct bench_buffer
+{
+  char *data;
+  size_t size;
+};
+
+static void
+bench_buffer_write (const void *buf, size_t size, void *data)
+{
+  struct bench_buffer *buffer = data;
+  char *new_data = realloc (buffer->data, buffer->size + size);
+
+  if (!new_data)
+    abort ();
+  buffer->data = new_data;
+  memcpy (buffer->data + buffer->size, buf, size);
+  buffer->size += size;
+}
+
+/* Encode MSG in the MI encoding ARG and decode it back.  Return the
+   decoded message, or NULL on error.  */
+
+static pk_mi_msg
+bench_mi_transfer (pk_mi_msg msg, const char *encoding)
+{
+  pk_mi_msg ret;
+
+  if (strcmp (encoding, "cbor") == 0)
+    {
+      struct bench_buffer buffer = { NULL, 0 };
+
+      pk_mi_msg_to_cbor (msg, bench_buffer_write, &buffer);
+      ret = pk_mi_cbor_to_msg (buffer.data, buffer.size);
+      free (buffer.data);
+    }
+  else
+    {
+      const char *json = pk_mi_msg_to_json (msg);
+
+      ret = json ? pk_mi_json_to_msg (json) : NULL;
+    }
+
+  pk_mi_msg_free (msg);
+  return ret;
+}
+
+/* Perform the MI round trip of a VALUE request, in the encoding ARG:
+   the request is encoded and decoded, the expression is evaluated,
+   and the response is encoded and decoded.  The transport is not
+   included.  */
+
+static int
+bench_mi_value (uint64_t n, const void *arg)
+{
+  const char *encoding = arg;
+  uint64_t i;
+
+  for (i = 0; i < n; ++i)
+    {
+      pk_mi_msg req, resp;
+      pk_val val;
+
+      req = pk_mi_make_req_value ("[1, 2, 3, 4, 5, 6, 7, 8]", NULL);
+      if (!req || !(req = bench_mi_transfer (req, encoding)))
+        return 0;
+
+      if (pk_compile_expression (bench_pkc, pk_mi_msg_req_value_expr (req),
+                                 NULL, &val) != PK_OK)
+        return 0;
+      resp = pk_mi_make_resp_value (pk_mi_msg_number (req), 1, NULL, val,
+                                    pk_mi_msg_req_value_params (req));
+      pk_mi_msg_free (req);
+      if (!resp || !(resp = bench_mi_transfer (resp, encoding)))
+        return 0;
+      pk_mi_msg_free (resp);
+    }
+
+  return 1;
+}
+
+#endif /* POKE_MI */
+
+/* Run the Poke benchmarks in FILENAME in a fresh compiler.  */
+
+static void
+bench_file (const char *filename)
+{
+  pk_compiler pkc = pk_compiler_new (&bench_term_if);
+  pk_val ok;
+  int exit_status;
+
+  printf ("# %s\n", filename);
+  fflush (stdout);
+
+  if (!pkc
+      || pk_compile_file (pkc, filename, &exit_status) != PK_OK
+      || (ok = pk_decl_val (pkc, "pkbench_ok")) == PK_NULL
+      || !pk_int_value (ok))
+    {
+      printf ("# %s failed\n", filename);
+      bench_ok = 0;
+    }
+
+  if (pkc)
+    pk_compiler_free (pkc);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *min_time = getenv ("PKBENCH_TIME");
+  int i;
+
+  if (min_time)
+    bench_min_ns = strtoull (min_time, NULL, 10) * 1000000UL;
+
+  bench_pkc = pk_compiler_new (&bench_term_if);
+  if (!bench_pkc)
+    {
+      fprintf (stderr, "pkbench: error creating the compiler\n");
+      return 1;
+    }
+
+  bench_run ("Compile/bootstrap", bench_bootstrap, NULL, 0);
+  bench_run ("Compile/expression", bench_compile,
+             "2 + 3 * 4", 0);
+  bench_run ("Compile/function", bench_compile,
+             "lambda (int a, int b) int: { return a * b + 1; }", 0);
+  bench_run ("Call/closure", bench_call,
+             "lambda (int a, int b) int: { return a - b; }", 0);
+  bench_run ("Load/elf", bench_load, "elf", 0);
+  bench_run ("Load/dwarf", bench_load, "dwarf", 0);
+  bench_run ("Complete/global", bench_complete, "Elf64_R", 0);
+#if POKE_MI
+  bench_run ("MI/value-json", bench_mi_value, "json", 0);
+  bench_run ("MI/value-cbor", bench_mi_value, "cbor", 0);
+#endif
+
+  for (i = 1; i < argc; ++i)
+    bench_file (argv[i]);
+
+  pk_compiler_free (bench_pkc);
+  return bench_ok ? 0 : 1;
+}
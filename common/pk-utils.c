@@ -181,6 +181,33 @@ pk_str_replace (const char *in, const char *search, const char *replace)
   return out;
 }
 
+int
+pk_mkdir_p (const char *dir, mode_t mode)
+{
+  char *path = strdup (dir);
+  char *p;
+  int ret = 1;
+
+  if (!path)
+    return 0;
+
+  for (p = path + 1; ret && *p; ++p)
+    {
+      if (*p == '/')
+        {
+          *p = '\0';
+          ret = mkdir (path, mode) == 0 || errno == EEXIST;
+          *p = '/';
+        }
+    }
+
+  if (ret)
+    ret = mkdir (path, mode) == 0 || errno == EEXIST;
+
+  free (path);
+  return ret;
+}
+
 void
 pk_str_trim (char **str)
 {
@@ -23,6 +23,7 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 /* Macros to avoid using strcmp directly.  */
 
@@ -59,4 +60,9 @@ char *pk_str_replace (const char *in, const char *search, const char *replace);
 /* Left and rigth trim the given string from whitespaces.  */
 void pk_str_trim (char **str);
 
+/* Create the directory DIR with permissions MODE, and its parents,
+   if they don't exist.  Return 0 if DIR couldn't be created, 1
+   otherwise.  */
+int pk_mkdir_p (const char *dir, mode_t mode);
+
 #endif /* ! PK_UTILS_H */
@@ -84,7 +84,7 @@
 ;; from libpoke/pkl-lex.l
 (defconst poke-keywords
   '("pinned" "struct" "union" "else" "while" "until" "for" "in" "where" "if"
-    "sizeof" "fun" "method" "type" "var" "unit" "break" "return"
+    "sizeof" "fun" "method" "memo" "type" "var" "unit" "break" "return"
     "as" "try" "catch" "raise" "any" "print" "printf" "isa"
     "unmap" "big" "little" "load")
   "List of the main keywords of the Poke language.")
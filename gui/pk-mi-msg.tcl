@@ -25,10 +25,16 @@ set MI_MSG_TYPE_EVENT 2
 # Request types
 
 set MI_REQ_TYPE_EXIT 0
+set MI_REQ_TYPE_IOS_STATS 1
+set MI_REQ_TYPE_ENCODING 2
+set MI_REQ_TYPE_VALUE 3
 
 # Response types
 
 set MI_RESP_TYPE_EXIT 0
+set MI_RESP_TYPE_IOS_STATS 1
+set MI_RESP_TYPE_ENCODING 2
+set MI_RESP_TYPE_VALUE 3
 
 # Event types
 
@@ -108,19 +108,23 @@ set poke_pid {}
 
 set poke_in_msg_size {}
 set poke_in_msg {}
+set poke_in_frame {}
 
 set poke_in_msg_size_bytes_read 0
 set poke_in_msg_bytes_read 0
 
 set poke_msg_size 0
+set poke_msg_more_p 0
 
 proc pk_read_from_poke {} {
     global poke_channel
     global poke_in_msg_size
     global poke_in_msg
+    global poke_in_frame
     global poke_in_msg_size_bytes_read
     global poke_in_msg_bytes_read
     global poke_msg_size
+    global poke_msg_more_p
 
     if { [eof $poke_channel] } {
         catch {close $poke_channel}
@@ -139,9 +143,12 @@ proc pk_read_from_poke {} {
 
     } else {
 
-        binary scan $poke_in_msg_size {c c c c} b3 b2 b1 b0
+        # The most significant bit of the size tells whether more
+        # frames follow with the rest of the message.
+        binary scan $poke_in_msg_size {cu cu cu cu} b3 b2 b1 b0
+        set poke_msg_more_p [expr ($b3 >> 7) & 1]
         set poke_msg_size \
-            [expr ($b3 << 24) | ($b2 << 16) | ($b1 << 8) | $b0]
+            [expr (($b3 & 0x7f) << 24) | ($b2 << 16) | ($b1 << 8) | $b0]
 
         if {[expr $poke_msg_size > 2048]} {
             # XXX protocol error
@@ -152,28 +159,33 @@ proc pk_read_from_poke {} {
                       [expr $poke_msg_size - $poke_in_msg_bytes_read]]
         set nbytes [string length $data]
 
-        set poke_in_msg \
-            [string cat $poke_in_msg $data]
+        set poke_in_frame \
+            [string cat $poke_in_frame $data]
         incr poke_in_msg_bytes_read $nbytes
     }
 
     if {[expr $poke_in_msg_bytes_read != 0 \
              && $poke_in_msg_bytes_read == $poke_msg_size]} {
 
-        global poke_confirmed_exit
+        set poke_in_msg [string cat $poke_in_msg $poke_in_frame]
 
-        # Frame message is ready.  Process it.
-        pk_dispatch_msg_frame ${poke_in_msg}
-        if {$poke_confirmed_exit} {
-            catch {close $poke_channel}
-            return
+        if {!$poke_msg_more_p} {
+            global poke_confirmed_exit
+
+            # Message is ready.  Process it.
+            pk_dispatch_msg_frame ${poke_in_msg}
+            if {$poke_confirmed_exit} {
+                catch {close $poke_channel}
+                return
+            }
+            set poke_in_msg {}
         }
 
-        # Prepare to receive another message.
+        # Prepare to receive another frame message.
         set poke_in_msg_size_bytes_read 0
         set poke_in_msg_bytes_read 0
         set poke_msg_size 0
-        set poke_in_msg {}
+        set poke_in_frame {}
         set poke_in_msg_size {}
     }
 }
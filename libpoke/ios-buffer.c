@@ -24,35 +24,45 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-#define IOB_CHUNK_SIZE          2048
-#define IOB_BUCKET_COUNT        8
+/* The buffer is made of chunks of CHUNK_SIZE bytes each, numbered
+   consecutively from the beginning of the buffered device.
 
-#define IOB_CHUNK_OFFSET(offset)        \
-  ((offset) % IOB_CHUNK_SIZE)
+   The chunks which have not been forgotten, i.e. the chunks
+   FIRST_CHUNK_NO to NEXT_CHUNK_NO - 1, are stored in the ring of
+   chunk pointers CHUNKS, which has RING_SIZE entries.  The chunk
+   number N lives at the entry N % RING_SIZE, so chunks are looked up
+   in constant time.  RING_SIZE is always a power of two, and it is
+   doubled whenever there are more chunks than entries.
 
-#define IOB_CHUNK_NO(offset)            \
-  ((offset) / IOB_CHUNK_SIZE)
+   begin_offset is the first offset that's not yet flushed, initilized as 0.
+   end_offset of an instream is the next byte to read to.  end_offset of an
+   outstream is the successor of the greatest offset that is written to.
 
-#define IOB_BUCKET_NO(chunk_no)         \
-  ((chunk_no) % IOB_BUCKET_COUNT)
+   MAX_NCHUNKS is the maximum number of chunks that have been in the
+   buffer at the same time.  */
 
-struct ios_buffer_chunk
-{
-  uint8_t bytes[IOB_CHUNK_SIZE];
-  int chunk_no;
-  struct ios_buffer_chunk *next;
-};
+#define IOB_DEFAULT_CHUNK_SIZE  2048
+#define IOB_INITIAL_RING_SIZE   8
 
-/* begin_offset is the first offset that's not yet flushed, initilized as 0.
-   end_offset of an instream is the next byte to read to.  end_offset of an
-   outstream is the successor of the greatest offset that is written to.  */
+#define IOB_CHUNK_OFFSET(buffer, offset)        \
+  ((offset) % (buffer)->chunk_size)
+
+#define IOB_CHUNK_NO(buffer, offset)            \
+  ((offset) / (buffer)->chunk_size)
+
+#define IOB_RING_INDEX(buffer, chunk_no)        \
+  ((chunk_no) & ((buffer)->ring_size - 1))
 
 struct ios_buffer
 {
-  struct ios_buffer_chunk* chunks[IOB_BUCKET_COUNT];
+  uint8_t **chunks;
+  size_t ring_size;
+  size_t chunk_size;
+  ios_dev_off first_chunk_no;
+  ios_dev_off next_chunk_no;
+  ios_dev_off max_nchunks;
   ios_dev_off begin_offset;
   ios_dev_off end_offset;
-  int next_chunk_no;
 };
 
 ios_dev_off
@@ -66,68 +76,109 @@ ios_buffer_get_end_offset (struct ios_buffer *buffer) {
 }
 
 struct ios_buffer *
-ios_buffer_init ()
+ios_buffer_init (size_t chunk_size)
 {
   struct ios_buffer *bio = calloc (1, sizeof (struct ios_buffer));
+
+  if (bio == NULL)
+    return NULL;
+
+  bio->chunks = calloc (IOB_INITIAL_RING_SIZE, sizeof (uint8_t *));
+  if (bio->chunks == NULL)
+    {
+      free (bio);
+      return NULL;
+    }
+
+  bio->ring_size = IOB_INITIAL_RING_SIZE;
+  bio->chunk_size = chunk_size ? chunk_size : IOB_DEFAULT_CHUNK_SIZE;
   return bio;
 }
 
 void
 ios_buffer_free (struct ios_buffer *buffer)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-
   if (buffer == NULL)
     return;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
-    {
-      chunk = buffer->chunks[i];
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          free (chunk);
-          chunk = chunk_next;
-        }
-    }
+  for (ios_dev_off chunk_no = buffer->first_chunk_no;
+       chunk_no < buffer->next_chunk_no;
+       chunk_no++)
+    free (buffer->chunks[IOB_RING_INDEX (buffer, chunk_no)]);
 
+  free (buffer->chunks);
   free (buffer);
   return;
 }
 
-struct ios_buffer_chunk*
-ios_buffer_get_chunk (struct ios_buffer *buffer, int chunk_no)
+void
+ios_buffer_get_stats (struct ios_buffer *buffer, uint64_t *chunk_size,
+                      uint64_t *nchunks, uint64_t *max_nchunks)
 {
-  int bucket_no = IOB_BUCKET_NO (chunk_no);
-  struct ios_buffer_chunk *chunk = buffer->chunks[bucket_no];
+  *chunk_size = buffer->chunk_size;
+  *nchunks = buffer->next_chunk_no - buffer->first_chunk_no;
+  *max_nchunks = buffer->max_nchunks;
+}
+
+uint8_t *
+ios_buffer_get_chunk (struct ios_buffer *buffer, ios_dev_off chunk_no)
+{
+  if (chunk_no < buffer->first_chunk_no
+      || chunk_no >= buffer->next_chunk_no)
+    return NULL;
+
+  return buffer->chunks[IOB_RING_INDEX (buffer, chunk_no)];
+}
+
+/* Double the size of the ring of BUFFER.  Return IOD_OK on success,
+   IOD_ERROR otherwise.  */
+
+static int
+ios_buffer_grow_ring (struct ios_buffer *buffer)
+{
+  size_t new_ring_size = buffer->ring_size * 2;
+  uint8_t **chunks = calloc (new_ring_size, sizeof (uint8_t *));
+
+  if (!chunks)
+    return IOD_ERROR;
 
-  for ( ; chunk; chunk = chunk->next)
-    if (chunk->chunk_no == chunk_no)
-      return chunk;
+  for (ios_dev_off chunk_no = buffer->first_chunk_no;
+       chunk_no < buffer->next_chunk_no;
+       chunk_no++)
+    chunks[chunk_no & (new_ring_size - 1)]
+      = buffer->chunks[IOB_RING_INDEX (buffer, chunk_no)];
 
-  return NULL;
+  free (buffer->chunks);
+  buffer->chunks = chunks;
+  buffer->ring_size = new_ring_size;
+  return IOD_OK;
 }
 
 int
-ios_buffer_allocate_new_chunk (struct ios_buffer *buffer, int final_chunk_no,
-                               struct ios_buffer_chunk **final_chunk)
+ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
+                               ios_dev_off final_chunk_no,
+                               uint8_t **final_chunk)
 {
-  struct ios_buffer_chunk *chunk;
-  int bucket_no;
+  uint8_t *chunk;
+  ios_dev_off nchunks;
 
   assert (buffer->next_chunk_no <= final_chunk_no);
 
   do
     {
-      chunk = calloc (1, sizeof (struct ios_buffer_chunk));
+      nchunks = buffer->next_chunk_no - buffer->first_chunk_no;
+      if (nchunks == buffer->ring_size
+          && ios_buffer_grow_ring (buffer) != IOD_OK)
+        return IOD_ERROR;
+
+      chunk = calloc (1, buffer->chunk_size);
       if (!chunk)
         return IOD_ERROR;
       /* Place the new chunk into the buffer.  */
-      chunk->chunk_no = buffer->next_chunk_no;
-      bucket_no = IOB_BUCKET_NO (chunk->chunk_no);
-      chunk->next = buffer->chunks[bucket_no];
-      buffer->chunks[bucket_no] = chunk;
+      buffer->chunks[IOB_RING_INDEX (buffer, buffer->next_chunk_no)] = chunk;
       buffer->next_chunk_no++;
+      if (nchunks + 1 > buffer->max_nchunks)
+        buffer->max_nchunks = nchunks + 1;
     }
   while (buffer->next_chunk_no <= final_chunk_no);
 
@@ -145,30 +196,30 @@ int
 ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                   ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
+  ios_dev_off chunk_no;
+  uint8_t *chunk;
   ios_dev_off chunk_offset;
   size_t already_read_count = 0,
          to_be_read_count = 0;
 
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
+  chunk_no = IOB_CHUNK_NO (buffer, offset);
+  chunk_offset = IOB_CHUNK_OFFSET (buffer, offset);
   chunk = ios_buffer_get_chunk (buffer, chunk_no);
   if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
     return IOD_ERROR;
 
   /* The amount we read from this chunk is the maximum of
      the COUNT requested and the size of the rest of this chunk. */
-  to_be_read_count = IOB_CHUNK_SIZE - chunk_offset > count
+  to_be_read_count = buffer->chunk_size - chunk_offset > count
                      ? count
-                     : IOB_CHUNK_SIZE - chunk_offset;
+                     : buffer->chunk_size - chunk_offset;
 
-  memcpy (buf, (void *) chunk + chunk_offset, to_be_read_count);
+  memcpy (buf, chunk + chunk_offset, to_be_read_count);
 
   while ((already_read_count += to_be_read_count) < count)
     {
-      to_be_read_count = count - already_read_count > IOB_CHUNK_SIZE
-                         ? IOB_CHUNK_SIZE
+      to_be_read_count = count - already_read_count > buffer->chunk_size
+                         ? buffer->chunk_size
                          : count - already_read_count;
 
       chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
@@ -188,30 +239,30 @@ int
 ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
                    ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
+  ios_dev_off chunk_no;
+  uint8_t *chunk;
   ios_dev_off chunk_offset;
   size_t already_written_count = 0,
          to_be_written_count = 0;
 
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
+  chunk_no = IOB_CHUNK_NO (buffer, offset);
+  chunk_offset = IOB_CHUNK_OFFSET (buffer, offset);
   chunk = ios_buffer_get_chunk (buffer, chunk_no);
   if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
     return IOD_ERROR;
 
   /* The amount we write to this chunk is the maximum of the COUNT requested
      and the size of the rest of this chunk. */
-  to_be_written_count = IOB_CHUNK_SIZE - chunk_offset > count
+  to_be_written_count = buffer->chunk_size - chunk_offset > count
                         ? count
-                        : IOB_CHUNK_SIZE - chunk_offset;
+                        : buffer->chunk_size - chunk_offset;
 
-  memcpy ((void *) chunk + chunk_offset, buf, to_be_written_count);
+  memcpy (chunk + chunk_offset, buf, to_be_written_count);
 
   while ((already_written_count += to_be_written_count) < count)
     {
-      to_be_written_count = count - already_written_count > IOB_CHUNK_SIZE
-                            ? IOB_CHUNK_SIZE
+      to_be_written_count = count - already_written_count > buffer->chunk_size
+                            ? buffer->chunk_size
                             : count - already_written_count;
 
       chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
@@ -231,28 +282,22 @@ ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
 int
 ios_buffer_forget_till (struct ios_buffer *buffer, ios_dev_off offset)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-  int chunk_no = IOB_CHUNK_NO (offset);
+  ios_dev_off chunk_no = IOB_CHUNK_NO (buffer, offset);
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
+  for (; buffer->first_chunk_no < chunk_no
+         && buffer->first_chunk_no < buffer->next_chunk_no;
+       buffer->first_chunk_no++)
     {
-      chunk = buffer->chunks[i];
-      buffer->chunks[i] = NULL;
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          if (chunk->chunk_no >= chunk_no)
-            {
-              chunk->next = buffer->chunks[i];
-              buffer->chunks[i] = chunk;
-            }
-          else
-            free (chunk);
-          chunk = chunk_next;
-        }
+      size_t index = IOB_RING_INDEX (buffer, buffer->first_chunk_no);
+
+      free (buffer->chunks[index]);
+      buffer->chunks[index] = NULL;
     }
 
-  buffer->begin_offset = chunk_no * IOB_CHUNK_SIZE;
+  if (buffer->first_chunk_no < chunk_no)
+    buffer->first_chunk_no = buffer->next_chunk_no = chunk_no;
+
+  buffer->begin_offset = chunk_no * buffer->chunk_size;
   assert (buffer->end_offset >= buffer->begin_offset);
   assert (buffer->begin_offset <= offset);
   return 0;
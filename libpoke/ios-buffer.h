@@ -18,7 +18,10 @@
 
 struct ios_buffer;
 
-struct ios_buffer *ios_buffer_init ();
+/* Create a new buffer made of chunks of CHUNK_SIZE bytes.  If
+   CHUNK_SIZE is zero a default chunk size is used.  */
+
+struct ios_buffer *ios_buffer_init (size_t chunk_size);
 
 void ios_buffer_free (struct ios_buffer *buffer);
 
@@ -26,12 +29,19 @@ ios_dev_off ios_buffer_get_begin_offset (struct ios_buffer *buffer);
 
 ios_dev_off ios_buffer_get_end_offset (struct ios_buffer *buffer);
 
-struct ios_buffer_chunk *ios_buffer_get_chunk (struct ios_buffer *buffer,
-                                               int chunk_no);
+/* Get the size of the chunks of BUFFER, the number of chunks
+   currently in it, and the maximum number of chunks it has ever
+   held.  */
+
+void ios_buffer_get_stats (struct ios_buffer *buffer, uint64_t *chunk_size,
+                           uint64_t *nchunks, uint64_t *max_nchunks);
+
+uint8_t *ios_buffer_get_chunk (struct ios_buffer *buffer,
+                               ios_dev_off chunk_no);
 
 int ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
-                                   int final_chunk_no,
-                                   struct ios_buffer_chunk **final_chunk);
+                                   ios_dev_off final_chunk_no,
+                                   uint8_t **final_chunk);
 
 int ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                       ios_dev_off offset);
@@ -0,0 +1,364 @@
+/* ios-cache.c - Page cache for IO spaces.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-cache.h"
+
+/* A page in the cache.
+
+   DATA is a buffer of PAGE_SIZE bytes, allocated the first time the
+   page is used.  PAGE_NO is the number of the cached page, and COUNT
+   is the number of bytes of data in it.  USED_P is false if the page
+   doesn't hold any data.
+
+   HNEXT links the pages in the same bucket of the hash table.
+   PREV and NEXT link the pages in the LRU list.  */
+
+struct ios_cache_page
+{
+  uint8_t *data;
+  ios_dev_off page_no;
+  size_t count;
+  int used_p;
+  struct ios_cache_page *hnext;
+  struct ios_cache_page *prev;
+  struct ios_cache_page *next;
+};
+
+/* PAGES is an array of NPAGES pages.  The used pages are looked up
+   through the hash table BUCKETS, which has NBUCKETS entries.
+
+   All the pages are in the LRU list, which starts at the most
+   recently used page LRU_HEAD and ends at LRU_TAIL.  Unused pages are
+   always at the end of the list.
+
+   HITS and MISSES count the lookups in the cache.  */
+
+struct ios_cache
+{
+  size_t page_size;
+  size_t npages;
+  struct ios_cache_page *pages;
+  struct ios_cache_page **buckets;
+  size_t nbuckets;
+  struct ios_cache_page *lru_head;
+  struct ios_cache_page *lru_tail;
+  uint64_t hits;
+  uint64_t misses;
+};
+
+#define IOS_CACHE_BUCKET(cache, page_no)        \
+  ((page_no) & ((cache)->nbuckets - 1))
+
+static void
+ios_cache_lru_unlink (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  if (page->prev)
+    page->prev->next = page->next;
+  else
+    cache->lru_head = page->next;
+
+  if (page->next)
+    page->next->prev = page->prev;
+  else
+    cache->lru_tail = page->prev;
+
+  page->prev = page->next = NULL;
+}
+
+static void
+ios_cache_lru_push_head (struct ios_cache *cache,
+                         struct ios_cache_page *page)
+{
+  page->prev = NULL;
+  page->next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->prev = page;
+  else
+    cache->lru_tail = page;
+  cache->lru_head = page;
+}
+
+static void
+ios_cache_lru_push_tail (struct ios_cache *cache,
+                         struct ios_cache_page *page)
+{
+  page->next = NULL;
+  page->prev = cache->lru_tail;
+  if (cache->lru_tail)
+    cache->lru_tail->next = page;
+  else
+    cache->lru_head = page;
+  cache->lru_tail = page;
+}
+
+static struct ios_cache_page *
+ios_cache_find (struct ios_cache *cache, ios_dev_off page_no)
+{
+  struct ios_cache_page *page;
+
+  for (page = cache->buckets[IOS_CACHE_BUCKET (cache, page_no)];
+       page;
+       page = page->hnext)
+    if (page->page_no == page_no)
+      return page;
+
+  return NULL;
+}
+
+/* Remove the used PAGE from the hash table of CACHE, and move it to
+   the end of the LRU list.  */
+
+static void
+ios_cache_drop (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  struct ios_cache_page **p;
+
+  for (p = &cache->buckets[IOS_CACHE_BUCKET (cache, page->page_no)];
+       *p != page;
+       p = &(*p)->hnext)
+    ;
+  *p = page->hnext;
+  page->hnext = NULL;
+  page->used_p = 0;
+
+  ios_cache_lru_unlink (cache, page);
+  ios_cache_lru_push_tail (cache, page);
+}
+
+struct ios_cache *
+ios_cache_new (size_t page_size, size_t npages)
+{
+  struct ios_cache *cache = calloc (1, sizeof (struct ios_cache));
+  size_t i;
+
+  if (cache == NULL)
+    return NULL;
+
+  cache->page_size = page_size;
+  cache->npages = npages;
+
+  for (cache->nbuckets = 1; cache->nbuckets < npages; cache->nbuckets *= 2)
+    ;
+
+  cache->pages = calloc (npages, sizeof (struct ios_cache_page));
+  cache->buckets = calloc (cache->nbuckets, sizeof (struct ios_cache_page *));
+  if (cache->pages == NULL || cache->buckets == NULL)
+    {
+      free (cache->pages);
+      free (cache->buckets);
+      free (cache);
+      return NULL;
+    }
+
+  for (i = 0; i < npages; i++)
+    ios_cache_lru_push_tail (cache, &cache->pages[i]);
+
+  return cache;
+}
+
+void
+ios_cache_free (struct ios_cache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  for (size_t i = 0; i < cache->npages; i++)
+    free (cache->pages[i].data);
+  free (cache->pages);
+  free (cache->buckets);
+  free (cache);
+}
+
+size_t
+ios_cache_page_size (struct ios_cache *cache)
+{
+  return cache->page_size;
+}
+
+uint8_t *
+ios_cache_lookup (struct ios_cache *cache, ios_dev_off page_no,
+                  size_t min_count, size_t *count)
+{
+  struct ios_cache_page *page = ios_cache_find (cache, page_no);
+
+  if (page == NULL || page->count < min_count)
+    {
+      cache->misses++;
+      return NULL;
+    }
+
+  cache->hits++;
+  if (page != cache->lru_head)
+    {
+      ios_cache_lru_unlink (cache, page);
+      ios_cache_lru_push_head (cache, page);
+    }
+
+  *count = page->count;
+  return page->data;
+}
+
+int
+ios_cache_present_p (struct ios_cache *cache, ios_dev_off page_no)
+{
+  return ios_cache_find (cache, page_no) != NULL;
+}
+
+const uint8_t *
+ios_cache_peek (struct ios_cache *cache, ios_dev_off page_no,
+                size_t *count)
+{
+  struct ios_cache_page *page = ios_cache_find (cache, page_no);
+
+  if (page == NULL)
+    return NULL;
+
+  *count = page->count;
+  return page->data;
+}
+
+static int
+ios_cache_page_no_cmp (const void *a, const void *b)
+{
+  ios_dev_off x = *(const ios_dev_off *) a, y = *(const ios_dev_off *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+ios_dev_off *
+ios_cache_pages (struct ios_cache *cache, size_t *npages)
+{
+  ios_dev_off *page_nos = malloc ((cache->npages + 1) * sizeof (ios_dev_off));
+  size_t i, n = 0;
+
+  if (page_nos == NULL)
+    return NULL;
+
+  for (i = 0; i < cache->npages; i++)
+    if (cache->pages[i].used_p)
+      page_nos[n++] = cache->pages[i].page_no;
+
+  qsort (page_nos, n, sizeof (ios_dev_off), ios_cache_page_no_cmp);
+  *npages = n;
+  return page_nos;
+}
+
+uint8_t *
+ios_cache_insert (struct ios_cache *cache, ios_dev_off page_no,
+                  size_t count)
+{
+  struct ios_cache_page *page = ios_cache_find (cache, page_no);
+
+  if (page == NULL)
+    {
+      /* Replace the least recently used page.  */
+      page = cache->lru_tail;
+      if (page->used_p)
+        ios_cache_drop (cache, page);
+
+      if (page->data == NULL
+          && (page->data = malloc (cache->page_size)) == NULL)
+        return NULL;
+
+      page->page_no = page_no;
+      page->used_p = 1;
+      page->hnext = cache->buckets[IOS_CACHE_BUCKET (cache, page_no)];
+      cache->buckets[IOS_CACHE_BUCKET (cache, page_no)] = page;
+    }
+
+  page->count = count;
+  ios_cache_lru_unlink (cache, page);
+  ios_cache_lru_push_head (cache, page);
+  return page->data;
+}
+
+void
+ios_cache_write (struct ios_cache *cache, const void *buf,
+                 size_t count, ios_dev_off offset)
+{
+  ios_dev_off page_no;
+
+  for (page_no = offset / cache->page_size;
+       page_no * cache->page_size < offset + count;
+       page_no++)
+    {
+      struct ios_cache_page *page = ios_cache_find (cache, page_no);
+      ios_dev_off page_begin = page_no * cache->page_size;
+      ios_dev_off begin, end;
+
+      if (page == NULL)
+        continue;
+
+      /* Only the bytes already in the page are updated.  */
+      begin = offset > page_begin ? offset : page_begin;
+      end = offset + count;
+      if (end > page_begin + page->count)
+        end = page_begin + page->count;
+
+      if (begin < end)
+        memcpy (page->data + (begin - page_begin),
+                (const uint8_t *) buf + (begin - offset),
+                end - begin);
+    }
+}
+
+void
+ios_cache_invalidate (struct ios_cache *cache, ios_dev_off offset,
+                      size_t count)
+{
+  ios_dev_off page_no;
+
+  for (page_no = offset / cache->page_size;
+       page_no * cache->page_size < offset + count;
+       page_no++)
+    {
+      struct ios_cache_page *page = ios_cache_find (cache, page_no);
+
+      if (page)
+        ios_cache_drop (cache, page);
+    }
+}
+
+void
+ios_cache_clear (struct ios_cache *cache)
+{
+  for (size_t i = 0; i < cache->npages; i++)
+    if (cache->pages[i].used_p)
+      ios_cache_drop (cache, &cache->pages[i]);
+}
+
+void
+ios_cache_get_stats (struct ios_cache *cache, uint64_t *hits,
+                     uint64_t *misses)
+{
+  *hits = cache->hits;
+  *misses = cache->misses;
+}
+
+void
+ios_cache_reset_stats (struct ios_cache *cache)
+{
+  cache->hits = 0;
+  cache->misses = 0;
+}
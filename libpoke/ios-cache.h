@@ -0,0 +1,108 @@
+/* ios-cache.h - Page cache for IO spaces.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOS_CACHE_H
+#define IOS_CACHE_H
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* A page cache holds copies of fixed-size pages of device data.  The
+   number of pages in the cache is bounded, and the least recently
+   used page is replaced when a new page is inserted in a full
+   cache.
+
+   Pages are numbered from the beginning of the device.  The last
+   page of a device may contain less than a full page of data.  */
+
+struct ios_cache;
+
+/* Create a new cache holding up to NPAGES pages of PAGE_SIZE
+   bytes.  Return NULL if there is not enough memory.  */
+
+struct ios_cache *ios_cache_new (size_t page_size, size_t npages);
+
+/* Free all the resources used by CACHE.  */
+
+void ios_cache_free (struct ios_cache *cache);
+
+/* Return the size of the pages of CACHE, in bytes.  */
+
+size_t ios_cache_page_size (struct ios_cache *cache);
+
+/* Return the data of the page PAGE_NO, and set COUNT to the number of
+   bytes in it, if the page is in CACHE and it contains at least
+   MIN_COUNT bytes.  Return NULL otherwise.  This updates the hit and
+   miss counters of the cache.  */
+
+uint8_t *ios_cache_lookup (struct ios_cache *cache, ios_dev_off page_no,
+                           size_t min_count, size_t *count);
+
+/* Return true iff the page PAGE_NO is in CACHE.  This doesn't update
+   the counters of the cache.  */
+
+int ios_cache_present_p (struct ios_cache *cache, ios_dev_off page_no);
+
+/* Likewise, but return the data of the page PAGE_NO and set COUNT to
+   the number of bytes in it if the page is in CACHE, or NULL
+   otherwise.  */
+
+const uint8_t *ios_cache_peek (struct ios_cache *cache, ios_dev_off page_no,
+                               size_t *count);
+
+/* Return an array with the numbers of the pages in CACHE, in
+   ascending order, and set NPAGES to its length.  The caller shall
+   free the array.  Return NULL if there is not enough memory.  */
+
+ios_dev_off *ios_cache_pages (struct ios_cache *cache, size_t *npages);
+
+/* Insert the page PAGE_NO in CACHE, holding COUNT bytes, and return
+   a buffer where the caller shall store the data of the page.
+   Return NULL if there is not enough memory.  */
+
+uint8_t *ios_cache_insert (struct ios_cache *cache, ios_dev_off page_no,
+                           size_t count);
+
+/* Update the pages of CACHE overlapping the COUNT bytes starting at
+   the device offset OFFSET with the data in BUF.  */
+
+void ios_cache_write (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset);
+
+/* Remove from CACHE the pages overlapping the COUNT bytes starting at
+   the device offset OFFSET.  */
+
+void ios_cache_invalidate (struct ios_cache *cache, ios_dev_off offset,
+                           size_t count);
+
+/* Remove all the pages from CACHE.  */
+
+void ios_cache_clear (struct ios_cache *cache);
+
+/* Get the number of lookups in CACHE that found the requested page,
+   and the number of them that didn't.  */
+
+void ios_cache_get_stats (struct ios_cache *cache, uint64_t *hits,
+                          uint64_t *misses);
+
+/* Set the above numbers to zero.  */
+
+void ios_cache_reset_stats (struct ios_cache *cache);
+
+#endif /* ! IOS_CACHE_H */
@@ -28,19 +28,43 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#if HAVE_SYS_SENDFILE_H && HAVE_SENDFILE
+#  include <sys/sendfile.h>
+#  define IOS_DEV_FILE_SENDFILE 1
+#endif
+#if HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#  include <limits.h>
+#endif
 
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with a file device.  */
+/* State associated with a file device.
+
+   Regular files are watched for modifications made by other
+   programs, if the system supports it.  WATCH_FD is the inotify
+   descriptor delivering the events, or -1 if the file is not being
+   watched, and WATCH_WD is the watch of the file in it.  SIZE is the
+   size of the file when it was last checked for modifications.  */
 
 struct ios_dev_file
 {
   FILE *file;
   char *filename;
   uint64_t flags;
+  int watch_fd;
+  int watch_wd;
+  ios_dev_off size;
 };
 
+#if HAVE_SYS_INOTIFY_H
+#  define IOS_DEV_FILE_WATCH_EVENTS                             \
+  (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+static ios_dev_off ios_dev_file_size (void *iod);
+
 static char *
 ios_dev_file_get_if_name () {
   return "FILE";
@@ -117,6 +141,28 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error)
 
   fio->file = f;
   fio->flags = flags;
+  fio->watch_fd = -1;
+  fio->watch_wd = -1;
+  fio->size = ios_dev_file_size (fio);
+
+#if HAVE_SYS_INOTIFY_H
+  {
+    struct stat st;
+
+    /* Watching is best effort, the device works without it.  */
+    if (fstat (fileno (f), &st) == 0 && S_ISREG (st.st_mode)
+        && (fio->watch_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) != -1)
+      {
+        fio->watch_wd = inotify_add_watch (fio->watch_fd, handler,
+                                           IOS_DEV_FILE_WATCH_EVENTS);
+        if (fio->watch_wd == -1)
+          {
+            close (fio->watch_fd);
+            fio->watch_fd = -1;
+          }
+      }
+  }
+#endif
 
   if (error)
     *error = IOD_OK;
@@ -150,6 +196,9 @@ ios_dev_file_close (void *iod)
 {
   struct ios_dev_file *fio = iod;
 
+  if (fio->watch_fd != -1)
+    close (fio->watch_fd);
+
   if (fclose (fio->file) == 0)
     {
       free (fio->filename);
@@ -178,20 +227,39 @@ static int
 ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
+  size_t ret, total = 0;
 
   /* We are using FILE* for buffering, rather than low-level fd, so we
      have to fake low-level pread by using fseeko.  */
   if (fseeko (fio->file, offset, SEEK_SET) == -1)
     return IOD_EOF;
-  ret = fread (buf, 1, count, fio->file);
 
-  /* XXX As long as count <= 9 because the ios layer reads at most an
-     unaligned uint64_t, we are unlikely to hit short reads.  But if
-     future code adds in large buffer reads, we may want to retry on
-     short reads rather than giving up right away. */
-  return ret == count ? 0 : IOD_EOF;
+  /* The IOS layer may read big blocks, so retry on short reads
+     rather than giving up right away.  */
+  do
+    {
+      ret = fread ((char *) buf + total, 1, count - total, fio->file);
+      total += ret;
+    }
+  while (total < count && ret > 0);
+
+  return total == count ? 0 : IOD_EOF;
+}
+
+#if HAVE_POSIX_FADVISE
+static int
+ios_dev_file_prefetch (void *iod, ios_dev_off offset, uint64_t count)
+{
+  struct ios_dev_file *fio = iod;
+
+  /* The kernel reads the data into its page cache asynchronously, so
+     the following freads don't wait for the device.  */
+  if (posix_fadvise (fileno (fio->file), offset, count,
+                     POSIX_FADV_WILLNEED) != 0)
+    return IOD_ERROR;
+  return IOD_OK;
 }
+#endif
 
 static int
 ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
@@ -209,6 +277,77 @@ ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
   return ret == count ? 0 : IOD_EOF;
 }
 
+static int
+ios_dev_file_pwritev (void *iod, const struct iovec *iov, int iovcnt,
+                      ios_dev_off offset)
+{
+  struct ios_dev_file *fio = iod;
+  int i;
+
+  /* The buffers are written at consecutive positions, so a single
+     seek is enough.  */
+  if (fseeko (fio->file, offset, SEEK_SET))
+    return IOD_EOF;
+
+  for (i = 0; i < iovcnt; i++)
+    if (fwrite (iov[i].iov_base, 1, iov[i].iov_len, fio->file)
+        != iov[i].iov_len)
+      return IOD_EOF;
+
+  return 0;
+}
+
+#if defined HAVE_COPY_FILE_RANGE || defined IOS_DEV_FILE_SENDFILE
+static int
+ios_dev_file_copy (void *iod, ios_dev_off offset,
+                   void *dst_iod, ios_dev_off dst_offset, uint64_t count)
+{
+  struct ios_dev_file *fio = iod;
+  struct ios_dev_file *dst_fio = dst_iod;
+  int in_fd = fileno (fio->file), out_fd = fileno (dst_fio->file);
+  off_t in_off = offset, out_off = dst_offset;
+  ssize_t ret = -1;
+
+  /* The copy operates on the file descriptors, so make sure the data
+     buffered by stdio is in the files.  Flushing also discards the
+     buffered input, which would become stale.  */
+  if (fflush (fio->file) != 0 || fflush (dst_fio->file) != 0)
+    return IOD_ERROR;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while (count > 0)
+    {
+      ret = copy_file_range (in_fd, &in_off, out_fd, &out_off, count, 0);
+      if (ret <= 0)
+        break;
+      count -= ret;
+    }
+#endif
+
+#ifdef IOS_DEV_FILE_SENDFILE
+  /* copy_file_range doesn't work across file systems in some
+     kernels, but sendfile does.  sendfile writes at the current
+     position of the output file.  The stdio functions used by the
+     other operations of this device always seek before accessing the
+     file, so moving the position is harmless.  */
+  if (count > 0 && ret != 0
+      && lseek (out_fd, out_off, SEEK_SET) == out_off)
+    while (count > 0)
+      {
+        ret = sendfile (out_fd, in_fd, &in_off, count);
+        if (ret <= 0)
+          break;
+        count -= ret;
+      }
+#endif
+
+  /* Let the IOS layer do the copy if the file systems don't support
+     any of the above, or if we hit the end of the origin file.  In
+     the second case the error will be reported there.  */
+  return count == 0 ? IOD_OK : IOD_ERROR;
+}
+#endif
+
 static ios_dev_off
 ios_dev_file_size (void *iod)
 {
@@ -219,6 +358,60 @@ ios_dev_file_size (void *iod)
   return st.st_size;
 }
 
+#if HAVE_SYS_INOTIFY_H
+static int
+ios_dev_file_changed (void *iod, ios_dev_off *old_size)
+{
+  struct ios_dev_file *fio = iod;
+  char buf[sizeof (struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct stat st, fst;
+  int changed_p = 0;
+
+  if (fio->watch_fd == -1)
+    return IOD_ERROR;
+
+  /* Consume all the pending events.  Their details don't matter,
+     since they don't tell what was modified.  */
+  while (read (fio->watch_fd, buf, sizeof buf) > 0)
+    changed_p = 1;
+
+  if (!changed_p)
+    return 0;
+
+  /* Files are often replaced by writing a new file and renaming it
+     over the old one.  Follow the name in that case.  */
+  if (stat (fio->filename, &st) == 0
+      && fstat (fileno (fio->file), &fst) == 0
+      && (st.st_dev != fst.st_dev || st.st_ino != fst.st_ino))
+    {
+      FILE *f = fopen (fio->filename,
+                       fio->flags & IOS_F_WRITE ? "r+b" : "rb");
+
+      if (f != NULL)
+        {
+          fclose (fio->file);
+          fio->file = f;
+          inotify_rm_watch (fio->watch_fd, fio->watch_wd);
+          fio->watch_wd = inotify_add_watch (fio->watch_fd, fio->filename,
+                                             IOS_DEV_FILE_WATCH_EVENTS);
+        }
+    }
+
+  *old_size = fio->size;
+  fio->size = ios_dev_file_size (fio);
+  return 1;
+}
+
+static int
+ios_dev_file_get_change_fd (void *iod)
+{
+  struct ios_dev_file *fio = iod;
+
+  return fio->watch_fd;
+}
+#endif
+
 static int
 ios_dev_file_flush (void *iod, ios_dev_off offset)
 {
@@ -233,6 +426,17 @@ struct ios_dev_if ios_dev_file =
    .close = ios_dev_file_close,
    .pread = ios_dev_file_pread,
    .pwrite = ios_dev_file_pwrite,
+   .pwritev = ios_dev_file_pwritev,
+#if defined HAVE_COPY_FILE_RANGE || defined IOS_DEV_FILE_SENDFILE
+   .copy = ios_dev_file_copy,
+#endif
+#if HAVE_POSIX_FADVISE
+   .prefetch = ios_dev_file_prefetch,
+#endif
+#if HAVE_SYS_INOTIFY_H
+   .changed = ios_dev_file_changed,
+   .get_change_fd = ios_dev_file_get_change_fd,
+#endif
    .get_flags = ios_dev_file_get_flags,
    .size = ios_dev_file_size,
    .flush = ios_dev_file_flush
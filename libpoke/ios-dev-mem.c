@@ -20,20 +20,57 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State asociated with a memory device.  */
+/* State asociated with a memory device.
+
+   The contents of the device are stored either in a flat buffer, or
+   in a sparse set of chunks.
+
+   In the flat representation POINTER is a buffer of CAPACITY bytes,
+   which grows geometrically as data is written at the end of the
+   device, so appending data takes amortized linear time.
+
+   Devices opened with IOS_F_MEM_SPARSE can be written at any offset.
+   Writing far past the end of a flat device switches it to the
+   sparse representation.  In that case CHUNKS is an open addressing
+   hash table of NSLOTS entries, a power of two, which maps chunk
+   indexes to chunks of MEM_CHUNK_SIZE bytes.  NCHUNKS is the number
+   of allocated chunks.  Chunks which have never been written are not
+   in the table and read as zeros.  This way the memory used is
+   proportional to the amount of data actually written, no matter
+   how far it is written.
+
+   SIZE is the size of the device, which is always a multiple of
+   MEM_STEP.  */
+
+struct ios_dev_mem_chunk
+{
+  size_t index;
+  char *data;
+};
 
 struct ios_dev_mem
 {
   char *pointer;
+  size_t capacity;
+  struct ios_dev_mem_chunk *chunks;
+  size_t nslots;
+  size_t nchunks;
   size_t size;
   uint64_t flags;
 };
 
 #define MEM_STEP (512 * 8)
+#define MEM_CHUNK_SIZE (64 * 1024)
+#define MEM_MIN_SLOTS 16
+
+/* Writes leaving a gap of more than MEM_SPARSE_GAP bytes past the end
+   of a flat device switch it to the sparse representation.  */
+#define MEM_SPARSE_GAP (16 * MEM_CHUNK_SIZE)
 
 static char *
 ios_dev_mem_get_if_name () {
@@ -74,6 +111,10 @@ ios_dev_mem_open (const char *handler, uint64_t flags, int *error)
       goto err;
     }
 
+  mio->capacity = MEM_STEP;
+  mio->chunks = NULL;
+  mio->nslots = 0;
+  mio->nchunks = 0;
   mio->size = MEM_STEP;
   mio->flags = flags;
 
@@ -94,6 +135,9 @@ ios_dev_mem_close (void *iod)
   struct ios_dev_mem *mio = iod;
 
   free (mio->pointer);
+  for (size_t i = 0; i < mio->nslots; ++i)
+    free (mio->chunks[i].data);
+  free (mio->chunks);
   free (mio);
 
   return IOD_OK;
@@ -107,15 +151,150 @@ ios_dev_mem_get_flags (void *iod)
   return mio->flags;
 }
 
+/* Return the slot of the CHUNKS table, having NSLOTS slots, where the chunk with
+   the given INDEX is, or should be inserted.  The table shall have
+   at least a free slot.  */
+
+static struct ios_dev_mem_chunk *
+ios_dev_mem_slot (struct ios_dev_mem_chunk *chunks, size_t nslots,
+                  size_t index)
+{
+  size_t i = (index * (size_t) 0x9e3779b97f4a7c15ULL) & (nslots - 1);
+
+  while (chunks[i].data && chunks[i].index != index)
+    i = (i + 1) & (nslots - 1);
+  return &chunks[i];
+}
+
+/* Return the chunk of MIO with the given INDEX, or NULL if it has
+   never been written.  */
+
+static char *
+ios_dev_mem_chunk (struct ios_dev_mem *mio, size_t index)
+{
+  return ios_dev_mem_slot (mio->chunks, mio->nslots, index)->data;
+}
+
+/* Return the chunk of MIO with the given INDEX, allocating it if
+   it doesn't exist yet.  Return NULL if there is not enough
+   memory.  */
+
+static char *
+ios_dev_mem_add_chunk (struct ios_dev_mem *mio, size_t index)
+{
+  struct ios_dev_mem_chunk *slot;
+
+  if (mio->nslots > 0)
+    {
+      slot = ios_dev_mem_slot (mio->chunks, mio->nslots, index);
+      if (slot->data)
+        return slot->data;
+    }
+
+  /* Keep the load factor of the table below 1/2.  */
+  if (2 * (mio->nchunks + 1) > mio->nslots)
+    {
+      size_t nslots = mio->nslots ? mio->nslots * 2 : MEM_MIN_SLOTS;
+      struct ios_dev_mem_chunk *chunks;
+
+      if (nslots > SIZE_MAX / sizeof (struct ios_dev_mem_chunk))
+        return NULL;
+      chunks = calloc (nslots, sizeof (struct ios_dev_mem_chunk));
+      if (!chunks)
+        return NULL;
+
+      for (size_t i = 0; i < mio->nslots; ++i)
+        if (mio->chunks[i].data)
+          *ios_dev_mem_slot (chunks, nslots, mio->chunks[i].index)
+            = mio->chunks[i];
+
+      free (mio->chunks);
+      mio->chunks = chunks;
+      mio->nslots = nslots;
+    }
+
+  slot = ios_dev_mem_slot (mio->chunks, mio->nslots, index);
+  slot->data = calloc (MEM_CHUNK_SIZE, 1);
+  if (!slot->data)
+    return NULL;
+  slot->index = index;
+  mio->nchunks++;
+  return slot->data;
+}
+
+/* Switch MIO to the sparse representation.  Return IOD_OK on
+   success, IOD_ERROR otherwise, in which case MIO is left
+   untouched.  */
+
+static int
+ios_dev_mem_make_sparse (struct ios_dev_mem *mio)
+{
+  size_t nchunks = (mio->size + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+  size_t i;
+
+  for (i = 0; i < nchunks; ++i)
+    {
+      size_t count = mio->size - i * MEM_CHUNK_SIZE;
+      char *chunk;
+
+      if (count > MEM_CHUNK_SIZE)
+        count = MEM_CHUNK_SIZE;
+
+      chunk = ios_dev_mem_add_chunk (mio, i);
+      if (!chunk)
+        {
+          for (i = 0; i < mio->nslots; ++i)
+            free (mio->chunks[i].data);
+          free (mio->chunks);
+          mio->chunks = NULL;
+          mio->nslots = 0;
+          mio->nchunks = 0;
+          return IOD_ERROR;
+        }
+      memcpy (chunk, &mio->pointer[i * MEM_CHUNK_SIZE], count);
+    }
+
+  free (mio->pointer);
+  mio->pointer = NULL;
+  mio->capacity = 0;
+  return IOD_OK;
+}
+
 static int
 ios_dev_mem_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_mem *mio = iod;
+  char *p = buf;
 
-  if (offset + count > mio->size)
+  if (offset > mio->size || count > mio->size - offset)
     return IOD_EOF;
 
-  memcpy (buf, &mio->pointer[offset], count);
+  if (mio->pointer)
+    {
+      memcpy (buf, &mio->pointer[offset], count);
+      return 0;
+    }
+
+  while (count > 0)
+    {
+      size_t index = offset / MEM_CHUNK_SIZE;
+      size_t chunk_offset = offset % MEM_CHUNK_SIZE;
+      size_t n = MEM_CHUNK_SIZE - chunk_offset;
+      char *chunk = ios_dev_mem_chunk (mio, index);
+
+      if (n > count)
+        n = count;
+
+      if (chunk)
+        memcpy (p, &chunk[chunk_offset], n);
+      else
+        memset (p, 0, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
   return 0;
 }
 
@@ -125,30 +304,96 @@ ios_dev_mem_pwrite (void *iod, const void *buf, size_t count,
 
 {
   struct ios_dev_mem *mio = iod;
+  const char *p = buf;
+  ios_dev_off end = offset + count;
 
-  if (offset + count > mio->size + MEM_STEP)
+  if (end < offset || end > SIZE_MAX - MEM_STEP)
     return IOD_EOF;
 
-  if (offset + count > mio->size)
-    {
-      void *pointer_bak = mio->pointer;
+  /* Unless the device is sparse, only allow it to grow by MEM_STEP
+     bytes past its end at a time, so a single write can't allocate
+     an arbitrary amount of memory.  */
+  if (!(mio->flags & IOS_F_MEM_SPARSE) && offset >= mio->size + MEM_STEP)
+    return IOD_EOF;
+
+  if (mio->pointer
+      && offset > mio->size
+      && offset - mio->size > MEM_SPARSE_GAP
+      && ios_dev_mem_make_sparse (mio) != IOD_OK)
+    return IOD_ERROR;
 
-      mio->pointer = realloc (mio->pointer, mio->size + MEM_STEP);
-      if (!mio->pointer)
+  if (mio->pointer)
+    {
+      if (end > mio->capacity)
         {
-          /* Restore pointer after failed realloc and return error. */
-          mio->pointer = pointer_bak;
-          return IOD_ERROR;
+          size_t new_capacity = mio->capacity * 2;
+          char *pointer;
+
+          if (new_capacity < end)
+            new_capacity = (end + MEM_STEP - 1) / MEM_STEP * MEM_STEP;
+
+          pointer = realloc (mio->pointer, new_capacity);
+          if (!pointer)
+            return IOD_ERROR;
+
+          memset (&pointer[mio->capacity], 0, new_capacity - mio->capacity);
+          mio->pointer = pointer;
+          mio->capacity = new_capacity;
         }
 
-      memset (&mio->pointer[mio->size], 0, MEM_STEP);
-      mio->size += MEM_STEP;
+      memcpy (&mio->pointer[offset], buf, count);
+    }
+  else
+    {
+      while (count > 0)
+        {
+          size_t index = offset / MEM_CHUNK_SIZE;
+          size_t chunk_offset = offset % MEM_CHUNK_SIZE;
+          size_t n = MEM_CHUNK_SIZE - chunk_offset;
+          char *chunk = ios_dev_mem_add_chunk (mio, index);
+
+          if (!chunk)
+            return IOD_ERROR;
+          if (n > count)
+            n = count;
+
+          memcpy (&chunk[chunk_offset], p, n);
+          p += n;
+          offset += n;
+          count -= n;
+        }
     }
 
-  memcpy (&mio->pointer[offset], buf, count);
+  if (end > mio->size)
+    mio->size = (end + MEM_STEP - 1) / MEM_STEP * MEM_STEP;
+
   return 0;
 }
 
+static void *
+ios_dev_mem_get_pointer (void *iod, ios_dev_off offset, size_t count,
+                         int write_p)
+{
+  struct ios_dev_mem *mio = iod;
+  size_t chunk_offset;
+  char *chunk;
+
+  if (offset > mio->size || count > mio->size - offset)
+    return NULL;
+
+  if (mio->pointer)
+    return &mio->pointer[offset];
+
+  /* In the sparse representation only data within a single, already
+     allocated, chunk is directly accessible.  */
+  chunk = ios_dev_mem_chunk (mio, offset / MEM_CHUNK_SIZE);
+  chunk_offset = offset % MEM_CHUNK_SIZE;
+  if (!chunk || count > MEM_CHUNK_SIZE - chunk_offset)
+    return NULL;
+
+  return &chunk[chunk_offset];
+}
+
 static ios_dev_off
 ios_dev_mem_size (void *iod)
 {
@@ -159,7 +404,7 @@ ios_dev_mem_size (void *iod)
 static int
 ios_dev_mem_flush (void *iod, ios_dev_off offset)
 {
-  return IOS_OK;
+  return IOD_OK;
 }
 
 struct ios_dev_if ios_dev_mem =
@@ -170,6 +415,7 @@ struct ios_dev_if ios_dev_mem =
    .close = ios_dev_mem_close,
    .pread = ios_dev_mem_pread,
    .pwrite = ios_dev_mem_pwrite,
+   .get_pointer = ios_dev_mem_get_pointer,
    .get_flags = ios_dev_mem_get_flags,
    .size = ios_dev_mem_size,
    .flush = ios_dev_mem_flush,
@@ -0,0 +1,717 @@
+/* ios-dev-mmap.c - Memory-mapped file IO devices.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This device operates on regular files by mapping them in memory.
+   This way reads and writes are plain memory copies, and the kernel
+   page cache does all the buffering.
+
+   Files that cannot be mapped, like non-seekable or special files,
+   or empty files, are not recognized by this device, and are handled
+   by the FILE* based device in ios-dev-file.c instead.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#if HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#  include <limits.h>
+#endif
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "pk-thread.h"
+
+/* State associated with a mmap device.
+
+   FD is the file descriptor of the mapped file.
+
+   ADDR is the address where the file is mapped, and SIZE is the size
+   of the mapping in bytes, which is the size of the file.  If the
+   file becomes empty the mapping is dropped, in which case ADDR is
+   NULL and SIZE is zero.
+
+   Read-only files are mapped privately.  Read-write files are mapped
+   shared, so the written data reaches the file.
+
+   WATCH_FD is the inotify descriptor delivering the modifications
+   made to the file by other programs, or -1 if the file is not being
+   watched, and WATCH_WD is the watch of the file in it.
+
+   PATCHED_P is set by the SIGBUS handler when pages of the mapping
+   have been replaced by pages of zeros, see below.
+
+   NEXT is the next device in the list of open devices.  */
+
+struct ios_dev_mmap
+{
+  int fd;
+  char *filename;
+  uint8_t *addr;
+  size_t size;
+  uint64_t flags;
+  int watch_fd;
+  int watch_wd;
+  volatile sig_atomic_t patched_p;
+  struct ios_dev_mmap *next;
+};
+
+/* Accessing the mapped pages past the end of the file raises SIGBUS,
+   and the file may be truncated by another program at any time.
+   Checking the size of the file before every access would cost a
+   system call per access, and it would not prevent the truncations
+   happening in between.  Instead, the faults in the mappings of the
+   devices are caught by a SIGBUS handler.
+
+   The accesses done by the device itself are guarded: the handler
+   jumps back to IOS_DEV_MMAP_GUARD, set by sigsetjmp right before
+   the access, and the operation fails with IOD_EOF.  The accesses
+   done through the pointers returned by get_pointer can't be
+   guarded.  In that case the handler replaces the faulting page by a
+   page of zeros, so the access reads zeros and the written data is
+   lost, and marks the device as patched so the next operation on it
+   updates the mapping to the new size of the file.  Note that only
+   whole pages past the end of the file fault, the rest of the last
+   page reads as zeros.
+
+   IOS_DEV_MMAP_DEVICES is the list of open devices, which the
+   handler uses to find the device of the faulting address.  It is
+   modified with IOS_DEV_MMAP_LOCK held and SIGBUS blocked.  Faults
+   outside the mappings of the devices are passed on to the handler
+   that was installed before.  */
+
+static PK_THREAD_LOCAL sigjmp_buf *volatile ios_dev_mmap_guard;
+static struct ios_dev_mmap *volatile ios_dev_mmap_devices;
+static struct sigaction ios_dev_mmap_old_action;
+static size_t ios_dev_mmap_page_size;
+PK_LOCK_DEFINE (ios_dev_mmap_lock);
+PK_ONCE_DEFINE (ios_dev_mmap_once);
+
+#if HAVE_PTHREAD
+#  define IOS_DEV_MMAP_SIGMASK pthread_sigmask
+#else
+#  define IOS_DEV_MMAP_SIGMASK sigprocmask
+#endif
+
+static void
+ios_dev_mmap_sigbus (int sig, siginfo_t *info, void *context)
+{
+  uint8_t *addr = info->si_addr;
+  struct ios_dev_mmap *mio;
+
+  for (mio = ios_dev_mmap_devices; mio != NULL; mio = mio->next)
+    if (mio->addr != NULL
+        && addr >= mio->addr && addr < mio->addr + mio->size)
+      break;
+
+  if (mio == NULL)
+    {
+      struct sigaction *old = &ios_dev_mmap_old_action;
+
+      /* Restoring the default action makes the faulting access
+         deliver the signal again, this time fatally.  */
+      if (old->sa_flags & SA_SIGINFO)
+        old->sa_sigaction (sig, info, context);
+      else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN)
+        old->sa_handler (sig);
+      else
+        sigaction (SIGBUS, old, NULL);
+      return;
+    }
+
+  if (ios_dev_mmap_guard != NULL)
+    siglongjmp (*ios_dev_mmap_guard, 1);
+
+  /* The mapping is page-aligned.  */
+  addr = mio->addr + ((addr - mio->addr)
+                      / ios_dev_mmap_page_size * ios_dev_mmap_page_size);
+  if (mmap (addr, ios_dev_mmap_page_size,
+            (mio->flags & IOS_F_WRITE
+             ? PROT_READ | PROT_WRITE : PROT_READ),
+            MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+    sigaction (SIGBUS, &ios_dev_mmap_old_action, NULL);
+  else
+    mio->patched_p = 1;
+}
+
+static void
+ios_dev_mmap_install_handler (void)
+{
+  struct sigaction action;
+
+  ios_dev_mmap_page_size = sysconf (_SC_PAGESIZE);
+
+  /* The handler may jump out of itself, and sigsetjmp doesn't save
+     the signal mask, so SIGBUS is not blocked while handling it.  */
+  memset (&action, 0, sizeof action);
+  action.sa_sigaction = ios_dev_mmap_sigbus;
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset (&action.sa_mask);
+  sigaction (SIGBUS, &action, &ios_dev_mmap_old_action);
+}
+
+/* Add MIO to the list of open devices if REGISTER_P, remove it from
+   the list otherwise.  */
+
+static void
+ios_dev_mmap_register (struct ios_dev_mmap *mio, int register_p)
+{
+  sigset_t set, old_set;
+
+  PK_ONCE (ios_dev_mmap_once, ios_dev_mmap_install_handler);
+
+  sigemptyset (&set);
+  sigaddset (&set, SIGBUS);
+  PK_LOCK (ios_dev_mmap_lock);
+  IOS_DEV_MMAP_SIGMASK (SIG_BLOCK, &set, &old_set);
+
+  if (register_p)
+    {
+      mio->next = ios_dev_mmap_devices;
+      ios_dev_mmap_devices = mio;
+    }
+  else
+    {
+      struct ios_dev_mmap *volatile *p;
+
+      for (p = &ios_dev_mmap_devices; *p != mio; p = &(*p)->next)
+        ;
+      *p = mio->next;
+    }
+
+  IOS_DEV_MMAP_SIGMASK (SIG_SETMASK, &old_set, NULL);
+  PK_UNLOCK (ios_dev_mmap_lock);
+}
+
+#if HAVE_SYS_INOTIFY_H
+#  define IOS_DEV_MMAP_WATCH_EVENTS                             \
+  (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+static char *
+ios_dev_mmap_get_if_name () {
+  /* This is just a different way of operating on files, so report
+     the same name than the FILE* device.  */
+  return "FILE";
+}
+
+static char *
+ios_dev_mmap_handler_normalize (const char *handler, uint64_t flags,
+                                int* error)
+{
+  char *new_handler = NULL;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  struct stat st;
+
+  if (error)
+    *error = IOD_OK;
+
+  /* Creating and truncating files is left to the FILE* device.  */
+  if (flags_mode & (IOS_F_CREATE | IOS_F_TRUNCATE))
+    return NULL;
+
+  /* Only non-empty regular files can be mapped.  */
+  if (stat (handler, &st) != 0
+      || !S_ISREG (st.st_mode)
+      || st.st_size == 0
+      || (uintmax_t) st.st_size > SIZE_MAX)
+    return NULL;
+
+  IOS_FILE_HANDLER_NORMALIZE (handler, new_handler);
+  if (new_handler == NULL && error)
+    *error = IOD_ENOMEM;
+
+  return new_handler;
+}
+
+static void *
+ios_dev_mmap_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_mmap *mio = NULL;
+  int fd = -1, prot, internal_error = IOD_ERROR;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  void *addr = MAP_FAILED;
+  struct stat st;
+
+  if (flags_mode == IOS_F_READ)
+    fd = open (handler, O_RDONLY);
+  else if (flags_mode == (IOS_F_READ | IOS_F_WRITE))
+    fd = open (handler, O_RDWR);
+  else if (flags_mode == 0)
+    {
+      /* Try read-write initially.
+         If that fails, then try read-only. */
+      fd = open (handler, O_RDWR);
+      flags |= (IOS_F_READ | IOS_F_WRITE);
+      if (fd == -1)
+        {
+          fd = open (handler, O_RDONLY);
+          flags &= ~IOS_F_WRITE;
+        }
+    }
+  else
+    {
+      internal_error = IOD_EFLAGS;
+      goto err;
+    }
+
+  if (fd == -1 || fstat (fd, &st) != 0)
+    goto err;
+
+  if (flags & IOS_F_WRITE)
+    prot = PROT_READ | PROT_WRITE;
+  else
+    prot = PROT_READ;
+
+  addr = mmap (NULL, st.st_size, prot,
+               flags & IOS_F_WRITE ? MAP_SHARED : MAP_PRIVATE,
+               fd, 0);
+  if (addr == MAP_FAILED)
+    goto err;
+
+  mio = malloc (sizeof (struct ios_dev_mmap));
+  if (!mio)
+    goto err;
+
+  mio->filename = strdup (handler);
+  if (!mio->filename)
+    goto err;
+
+  mio->fd = fd;
+  mio->addr = addr;
+  mio->size = st.st_size;
+  mio->flags = flags;
+  mio->watch_fd = -1;
+  mio->watch_wd = -1;
+  mio->patched_p = 0;
+
+#if HAVE_SYS_INOTIFY_H
+  /* Watching is best effort, the device works without it.  */
+  mio->watch_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (mio->watch_fd != -1)
+    {
+      mio->watch_wd = inotify_add_watch (mio->watch_fd, handler,
+                                         IOS_DEV_MMAP_WATCH_EVENTS);
+      if (mio->watch_wd == -1)
+        {
+          close (mio->watch_fd);
+          mio->watch_fd = -1;
+        }
+    }
+#endif
+
+  ios_dev_mmap_register (mio, 1);
+
+  if (error)
+    *error = IOD_OK;
+  return mio;
+
+err:
+  if (mio)
+    free (mio->filename);
+  free (mio);
+
+  if (addr != MAP_FAILED)
+    munmap (addr, st.st_size);
+  if (fd != -1)
+    close (fd);
+
+  if (error)
+    {
+      if (internal_error != IOD_ERROR)
+        *error = internal_error;
+      else if (errno == ENOMEM)
+        *error = IOD_ENOMEM;
+      else if (errno == EINVAL)
+        *error = IOD_EINVAL;
+      else
+        *error = IOD_ERROR;
+    }
+  return NULL;
+}
+
+static int
+ios_dev_mmap_close (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+  int ret = IOD_OK;
+
+  ios_dev_mmap_register (mio, 0);
+
+  if (mio->watch_fd != -1)
+    close (mio->watch_fd);
+
+  if ((mio->addr != NULL && munmap (mio->addr, mio->size) != 0)
+      || close (mio->fd) != 0)
+    {
+      perror (mio->filename);
+      ret = IOD_ERROR;
+    }
+
+  free (mio->filename);
+  free (mio);
+  return ret;
+}
+
+static uint64_t
+ios_dev_mmap_get_flags (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->flags;
+}
+
+/* Map the SIZE bytes of the file FD in place of the mapping of MIO,
+   and make FD the file of MIO.  Return IOD_OK on success, or
+   IOD_ERROR if the file can't be mapped, in which case MIO is left
+   untouched.  */
+
+static int
+ios_dev_mmap_replace (struct ios_dev_mmap *mio, int fd, size_t size)
+{
+  void *addr = mmap (NULL, size,
+                     (mio->flags & IOS_F_WRITE
+                      ? PROT_READ | PROT_WRITE : PROT_READ),
+                     mio->flags & IOS_F_WRITE ? MAP_SHARED : MAP_PRIVATE,
+                     fd, 0);
+
+  if (addr == MAP_FAILED)
+    return IOD_ERROR;
+
+  if (mio->addr != NULL)
+    munmap (mio->addr, mio->size);
+  if (fd != mio->fd)
+    close (mio->fd);
+
+  mio->fd = fd;
+  mio->addr = addr;
+  mio->size = size;
+  return IOD_OK;
+}
+
+/* Update the mapping of MIO after the file has been truncated by
+   another program, shrinking it, or dropping it if the file is now
+   empty.  This also gets rid of the pages of zeros put in the
+   mapping by the SIGBUS handler.  Growths of the file are left to
+   ios_dev_mmap_changed.  Return IOD_OK on success, or IOD_ERROR if
+   the size of the file can't be determined or the file can't be
+   remapped.
+
+   This costs a system call, so it is only done when an access to the
+   mapping has faulted and on explicit flushes.  */
+
+static int
+ios_dev_mmap_check_size (struct ios_dev_mmap *mio)
+{
+  struct stat st;
+  size_t size;
+
+  if (fstat (mio->fd, &st) != 0)
+    return IOD_ERROR;
+
+  if (!mio->patched_p && (uintmax_t) st.st_size >= mio->size)
+    return IOD_OK;
+
+  if (st.st_size == 0)
+    {
+      if (mio->addr != NULL)
+        munmap (mio->addr, mio->size);
+      mio->addr = NULL;
+      mio->size = 0;
+      mio->patched_p = 0;
+      return IOD_OK;
+    }
+
+  size = (uintmax_t) st.st_size < mio->size ? st.st_size : mio->size;
+  if (ios_dev_mmap_replace (mio, mio->fd, size) != IOD_OK)
+    return IOD_ERROR;
+  mio->patched_p = 0;
+  return IOD_OK;
+}
+
+/* Copy COUNT bytes from FROM to TO, one of them being in the mapping
+   of MIO, guarding against the file having been truncated.  If TO is
+   NULL only the byte at FROM is read, to check it is still backed by
+   the file.  Return IOD_OK on success, or IOD_EOF if the access
+   faulted, in which case the mapping is updated to the new size of
+   the file.  */
+
+static int
+ios_dev_mmap_copy (struct ios_dev_mmap *mio,
+                   void *to, const void *from, size_t count)
+{
+  sigjmp_buf guard;
+
+  /* Not saving the signal mask spares a system call.  */
+  if (sigsetjmp (guard, 0) != 0)
+    {
+      ios_dev_mmap_guard = NULL;
+      ios_dev_mmap_check_size (mio);
+      return IOD_EOF;
+    }
+
+  ios_dev_mmap_guard = &guard;
+  if (to == NULL)
+    (void) *(volatile const uint8_t *) from;
+  else
+    memcpy (to, from, count);
+  ios_dev_mmap_guard = NULL;
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_mmap_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (mio->patched_p && ios_dev_mmap_check_size (mio) != IOD_OK)
+    return IOD_ERROR;
+  if (offset > mio->size || count > mio->size - offset)
+    return IOD_EOF;
+
+  return ios_dev_mmap_copy (mio, buf, mio->addr + offset, count);
+}
+
+/* Extend the file operated by MIO so it has at least SIZE bytes, and
+   remap it.  Return IOD_OK on success, an error code otherwise.  */
+
+static int
+ios_dev_mmap_grow (struct ios_dev_mmap *mio, size_t size)
+{
+  void *addr;
+
+  if (ftruncate (mio->fd, size) != 0)
+    return IOD_EOF;
+
+  if (mio->addr == NULL)
+    return ios_dev_mmap_replace (mio, mio->fd, size);
+
+#ifdef HAVE_MREMAP
+  addr = mremap (mio->addr, mio->size, size, MREMAP_MAYMOVE);
+#else
+  addr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               mio->fd, 0);
+  if (addr != MAP_FAILED)
+    munmap (mio->addr, mio->size);
+#endif
+  if (addr == MAP_FAILED)
+    return IOD_ERROR;
+
+  mio->addr = addr;
+  mio->size = size;
+  return IOD_OK;
+}
+
+static int
+ios_dev_mmap_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+  int ret, try;
+
+  if (!(mio->flags & IOS_F_WRITE))
+    return IOD_EOF;
+  if (mio->patched_p && ios_dev_mmap_check_size (mio) != IOD_OK)
+    return IOD_ERROR;
+
+  /* If the file is truncated under the write the mapping is shrunk,
+     and the write is tried again, extending the file.  */
+  for (try = 0; try < 2; try++)
+    {
+      /* Writing past the end of the file extends it, like in the
+         FILE* device.  */
+      if (offset + count > mio->size)
+        {
+          ret = ios_dev_mmap_grow (mio, offset + count);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      ret = ios_dev_mmap_copy (mio, mio->addr + offset, buf, count);
+      if (ret != IOD_EOF)
+        break;
+    }
+
+  return ret;
+}
+
+static void *
+ios_dev_mmap_get_pointer (void *iod, ios_dev_off offset, size_t count,
+                          int write_p)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  /* Read-only files are mapped without write permission.  */
+  if (write_p && !(mio->flags & IOS_F_WRITE))
+    return NULL;
+
+  if (mio->patched_p && ios_dev_mmap_check_size (mio) != IOD_OK)
+    return NULL;
+  if (offset > mio->size || count > mio->size - offset)
+    return NULL;
+
+  /* Files are truncated from the end, so if the last byte of the
+     range is still backed by the file then so is the rest.  The
+     caller falls back to pread otherwise, which fails.  */
+  if (count > 0
+      && ios_dev_mmap_copy (mio, NULL,
+                            mio->addr + offset + count - 1, 1) != IOD_OK)
+    return NULL;
+
+  return mio->addr + offset;
+}
+
+#if HAVE_MADVISE
+static int
+ios_dev_mmap_prefetch (void *iod, ios_dev_off offset, uint64_t count)
+{
+  struct ios_dev_mmap *mio = iod;
+  size_t page_size = sysconf (_SC_PAGESIZE);
+  ios_dev_off begin = offset / page_size * page_size;
+
+  if (offset >= mio->size)
+    return IOD_OK;
+  if (count > mio->size - offset)
+    count = mio->size - offset;
+
+  /* Otherwise the pages would be read by the page faults, one at a
+     time.  */
+  if (madvise (mio->addr + begin, offset + count - begin,
+               MADV_WILLNEED) != 0)
+    return IOD_ERROR;
+  return IOD_OK;
+}
+#endif
+
+#if HAVE_SYS_INOTIFY_H
+static int
+ios_dev_mmap_changed (void *iod, ios_dev_off *old_size)
+{
+  struct ios_dev_mmap *mio = iod;
+  char buf[sizeof (struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct stat st, fst;
+  int changed_p = 0;
+
+  if (mio->watch_fd == -1)
+    return IOD_ERROR;
+
+  /* Consume all the pending events.  Their details don't matter,
+     since they don't tell what was modified.  */
+  while (read (mio->watch_fd, buf, sizeof buf) > 0)
+    changed_p = 1;
+
+  if (!changed_p)
+    return 0;
+
+  *old_size = mio->size;
+  if (stat (mio->filename, &st) != 0 || fstat (mio->fd, &fst) != 0)
+    return 1;
+
+  /* Files are often replaced by writing a new file and renaming it
+     over the old one.  Follow the name in that case.  Otherwise the
+     mapping shall follow the size of the file, since accessing the
+     mapped pages past its end is fatal.  Empty files can't be
+     mapped, and keep the old mapping.  */
+  if (st.st_dev != fst.st_dev || st.st_ino != fst.st_ino)
+    {
+      int fd = open (mio->filename,
+                     mio->flags & IOS_F_WRITE ? O_RDWR : O_RDONLY);
+
+      if (fd != -1
+          && fstat (fd, &st) == 0
+          && S_ISREG (st.st_mode)
+          && st.st_size > 0
+          && (uintmax_t) st.st_size <= SIZE_MAX
+          && ios_dev_mmap_replace (mio, fd, st.st_size) == IOD_OK)
+        {
+          inotify_rm_watch (mio->watch_fd, mio->watch_wd);
+          mio->watch_wd = inotify_add_watch (mio->watch_fd, mio->filename,
+                                             IOS_DEV_MMAP_WATCH_EVENTS);
+        }
+      else if (fd != -1)
+        close (fd);
+    }
+  else if ((uintmax_t) fst.st_size != mio->size
+           && fst.st_size > 0
+           && (uintmax_t) fst.st_size <= SIZE_MAX)
+    ios_dev_mmap_replace (mio, mio->fd, fst.st_size);
+
+  return 1;
+}
+
+static int
+ios_dev_mmap_get_change_fd (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->watch_fd;
+}
+#endif
+
+static ios_dev_off
+ios_dev_mmap_size (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->size;
+}
+
+static int
+ios_dev_mmap_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  /* The data is written to the file by the kernel, but this is a good
+     moment to notice the file has been truncated.  */
+  return ios_dev_mmap_check_size (mio);
+}
+
+struct ios_dev_if ios_dev_mmap =
+  {
+   .get_if_name = ios_dev_mmap_get_if_name,
+   .handler_normalize = ios_dev_mmap_handler_normalize,
+   .open = ios_dev_mmap_open,
+   .close = ios_dev_mmap_close,
+   .pread = ios_dev_mmap_pread,
+   .pwrite = ios_dev_mmap_pwrite,
+   .get_pointer = ios_dev_mmap_get_pointer,
+#if HAVE_MADVISE
+   .prefetch = ios_dev_mmap_prefetch,
+#endif
+#if HAVE_SYS_INOTIFY_H
+   .changed = ios_dev_mmap_changed,
+   .get_change_fd = ios_dev_mmap_get_change_fd,
+#endif
+   .get_flags = ios_dev_mmap_get_flags,
+   .size = ios_dev_mmap_size,
+   .flush = ios_dev_mmap_flush
+  };
@@ -28,7 +28,47 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with an NBD device.  */
+/* Data read from the NBD server is cached in blocks of NBD_BLOCK_SIZE
+   bytes.  The cache holds up to NBD_CACHE_NBLOCKS blocks, and it is
+   replaced in LRU order.
+
+   Whenever a block is accessed, the NBD_READ_AHEAD blocks following
+   it are requested asynchronously, so sequential scans keep several
+   requests in flight and don't pay a round trip per block.
+
+   Writes go straight to the server, updating the cached blocks.  */
+
+#define NBD_BLOCK_SIZE (64 * 1024)
+#define NBD_CACHE_NBLOCKS 64
+#define NBD_READ_AHEAD 8
+
+/* A block in the cache.
+
+   DATA is a buffer of NBD_BLOCK_SIZE bytes, or NULL if the block has
+   never been used.  BLOCK_NO is the number of the cached block.
+
+   COOKIE identifies the asynchronous read of the block if it is in
+   flight, and it is 0 otherwise.  VALID_P is true if DATA contains
+   the contents of the block.
+
+   STAMP is the value of the access counter of the device the last
+   time the block was accessed.  */
+
+struct ios_dev_nbd_block
+{
+  uint8_t *data;
+  ios_dev_off block_no;
+  int64_t cookie;
+  bool valid_p;
+  uint64_t stamp;
+};
+
+/* State associated with an NBD device.
+
+   BLOCKS is the block cache.  STAMP is a counter incremented in every
+   access to the cache.  LAST_BLOCK_NO is the number of the block
+   accessed most recently, which is used to avoid issuing read-ahead
+   requests more than once for the same block.  */
 
 struct ios_dev_nbd
 {
@@ -36,6 +76,9 @@ struct ios_dev_nbd
   char *uri;
   ios_dev_off size;
   uint64_t flags;
+  struct ios_dev_nbd_block blocks[NBD_CACHE_NBLOCKS];
+  uint64_t stamp;
+  ios_dev_off last_block_no;
 };
 
 static bool
@@ -122,6 +165,9 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error)
   nio->nbd = nbd;
   nio->size = size;
   nio->flags = flags;
+  memset (nio->blocks, 0, sizeof (nio->blocks));
+  nio->stamp = 0;
+  nio->last_block_no = (ios_dev_off) -1;
 
   if (error)
     *error = IOD_OK;
@@ -146,6 +192,11 @@ ios_dev_nbd_close (void *iod)
 
   /* Should this flush when possible?  */
   nbd_close (nio->nbd);
+
+  /* Closing the handle retires the commands in flight, so the block
+     buffers can be freed now.  */
+  for (int i = 0; i < NBD_CACHE_NBLOCKS; i++)
+    free (nio->blocks[i].data);
   free (nio->uri);
   free (nio);
 
@@ -160,12 +211,203 @@ ios_dev_nbd_get_flags (void *iod)
   return nio->flags;
 }
 
+/* Return the cached block BLOCK_NO of NIO, or NULL if it is neither
+   cached nor in flight.  */
+
+static struct ios_dev_nbd_block *
+ios_dev_nbd_cache_lookup (struct ios_dev_nbd *nio, ios_dev_off block_no)
+{
+  for (int i = 0; i < NBD_CACHE_NBLOCKS; i++)
+    {
+      struct ios_dev_nbd_block *block = &nio->blocks[i];
+
+      if ((block->valid_p || block->cookie != 0)
+          && block->block_no == block_no)
+        return block;
+    }
+
+  return NULL;
+}
+
+/* Wait for the asynchronous read of BLOCK to complete, if it is in
+   flight.  Return IOD_OK if the data of the block is valid, an error
+   code otherwise.  */
+
+static int
+ios_dev_nbd_cache_wait (struct ios_dev_nbd *nio,
+                        struct ios_dev_nbd_block *block)
+{
+  while (block->cookie != 0)
+    {
+      int ret = nbd_aio_command_completed (nio->nbd, block->cookie);
+
+      if (ret == 1)
+        {
+          block->cookie = 0;
+          block->valid_p = true;
+        }
+      else if (ret == -1)
+        {
+          block->cookie = 0;
+          return IOD_EOF;
+        }
+      else if (nbd_poll (nio->nbd, -1) == -1)
+        return IOD_ERROR;
+    }
+
+  return block->valid_p ? IOD_OK : IOD_EOF;
+}
+
+/* Start an asynchronous read of the block BLOCK_NO of NIO into the
+   cache, evicting the least recently used block not in flight.
+   Return the block, or NULL on error.  */
+
+static struct ios_dev_nbd_block *
+ios_dev_nbd_cache_fetch (struct ios_dev_nbd *nio, ios_dev_off block_no)
+{
+  struct ios_dev_nbd_block *block = NULL;
+  ios_dev_off offset = block_no * NBD_BLOCK_SIZE;
+  size_t count;
+
+  for (int i = 0; i < NBD_CACHE_NBLOCKS; i++)
+    {
+      struct ios_dev_nbd_block *b = &nio->blocks[i];
+
+      if (b->cookie != 0)
+        continue;
+      if (!b->valid_p)
+        {
+          block = b;
+          break;
+        }
+      if (block == NULL || b->stamp < block->stamp)
+        block = b;
+    }
+
+  if (block == NULL)
+    return NULL;
+
+  if (block->data == NULL
+      && (block->data = malloc (NBD_BLOCK_SIZE)) == NULL)
+    return NULL;
+
+  count = (nio->size - offset < NBD_BLOCK_SIZE
+           ? nio->size - offset : NBD_BLOCK_SIZE);
+
+  block->valid_p = false;
+  block->block_no = block_no;
+  block->stamp = nio->stamp;
+  block->cookie = nbd_aio_pread (nio->nbd, block->data, count, offset,
+                                 NBD_NULL_COMPLETION, 0);
+  if (block->cookie == -1)
+    {
+      block->cookie = 0;
+      return NULL;
+    }
+
+  return block;
+}
+
+/* Return the block BLOCK_NO of NIO, reading it if it is not cached,
+   and requesting the blocks following it.  Return NULL on error.  */
+
+static struct ios_dev_nbd_block *
+ios_dev_nbd_cache_get (struct ios_dev_nbd *nio, ios_dev_off block_no)
+{
+  struct ios_dev_nbd_block *block;
+
+  nio->stamp++;
+
+  block = ios_dev_nbd_cache_lookup (nio, block_no);
+  if (block == NULL)
+    block = ios_dev_nbd_cache_fetch (nio, block_no);
+  if (block == NULL)
+    return NULL;
+  block->stamp = nio->stamp;
+
+  /* Issue the read-ahead requests before waiting, so they are
+     served while we wait.  Failing to issue them is not an error.  */
+  if (block_no != nio->last_block_no)
+    {
+      nio->last_block_no = block_no;
+      for (ios_dev_off n = block_no + 1;
+           n <= block_no + NBD_READ_AHEAD
+             && n < (nio->size + NBD_BLOCK_SIZE - 1) / NBD_BLOCK_SIZE;
+           n++)
+        if (ios_dev_nbd_cache_lookup (nio, n) == NULL
+            && ios_dev_nbd_cache_fetch (nio, n) == NULL)
+          break;
+    }
+
+  if (ios_dev_nbd_cache_wait (nio, block) != IOD_OK)
+    return NULL;
+
+  return block;
+}
+
+/* Update the cached blocks of NIO with the COUNT bytes in BUF, which
+   have been written at OFFSET.  */
+
+static void
+ios_dev_nbd_cache_update (struct ios_dev_nbd *nio, const void *buf,
+                          size_t count, ios_dev_off offset)
+{
+  for (int i = 0; i < NBD_CACHE_NBLOCKS; i++)
+    {
+      struct ios_dev_nbd_block *block = &nio->blocks[i];
+      ios_dev_off block_begin = block->block_no * NBD_BLOCK_SIZE;
+      ios_dev_off block_end = block_begin + NBD_BLOCK_SIZE;
+      ios_dev_off begin, end;
+
+      if (!(block->valid_p || block->cookie != 0)
+          || offset >= block_end || offset + count <= block_begin)
+        continue;
+
+      /* A read in flight may bring stale data.  */
+      if (ios_dev_nbd_cache_wait (nio, block) != IOD_OK)
+        continue;
+
+      begin = offset > block_begin ? offset : block_begin;
+      end = offset + count < block_end ? offset + count : block_end;
+      memcpy (block->data + (begin - block_begin),
+              (const uint8_t *) buf + (begin - offset),
+              end - begin);
+    }
+}
+
 static int
 ios_dev_nbd_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  uint8_t *p = buf;
+
+  if (offset > nio->size || count > nio->size - offset)
+    return IOD_EOF;
 
-  return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  while (count > 0)
+    {
+      ios_dev_off block_no = offset / NBD_BLOCK_SIZE;
+      size_t block_offset = offset % NBD_BLOCK_SIZE;
+      size_t n = NBD_BLOCK_SIZE - block_offset;
+      struct ios_dev_nbd_block *block;
+
+      if (n > count)
+        n = count;
+
+      /* Fall back to a synchronous read if the block can't be
+         cached.  */
+      block = ios_dev_nbd_cache_get (nio, block_no);
+      if (block)
+        memcpy (p, block->data + block_offset, n);
+      else if (nbd_pread (nio->nbd, p, n, offset, 0) == -1)
+        return IOD_EOF;
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return 0;
 }
 
 static int
@@ -174,7 +416,31 @@ ios_dev_nbd_pwrite (void *iod, const void *buf, size_t count,
 {
   struct ios_dev_nbd *nio = iod;
 
-  return nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  if (nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1)
+    return IOD_EOF;
+
+  ios_dev_nbd_cache_update (nio, buf, count, offset);
+  return 0;
+}
+
+static int
+ios_dev_nbd_pwritev (void *iod, const struct iovec *iov, int iovcnt,
+                     ios_dev_off offset)
+{
+  struct ios_dev_nbd *nio = iod;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (nbd_pwrite (nio->nbd, iov[i].iov_base, iov[i].iov_len,
+                      offset, 0) == -1)
+        return IOD_EOF;
+      ios_dev_nbd_cache_update (nio, iov[i].iov_base, iov[i].iov_len,
+                                offset);
+      offset += iov[i].iov_len;
+    }
+
+  return 0;
 }
 
 static ios_dev_off
@@ -199,6 +465,7 @@ struct ios_dev_if ios_dev_nbd =
    .close = ios_dev_nbd_close,
    .pread = ios_dev_nbd_pread,
    .pwrite = ios_dev_nbd_pwrite,
+   .pwritev = ios_dev_nbd_pwritev,
    .get_flags = ios_dev_nbd_get_flags,
    .size = ios_dev_nbd_size,
    .flush = ios_dev_nbd_flush,
@@ -0,0 +1,466 @@
+/* ios-dev-overlay.c - Copy-on-write overlay IO devices.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An overlay device is stacked on top of another IO space, called
+   the base.  Reading from the overlay reads from the base, but the
+   data written to the overlay is kept in memory and the base is left
+   untouched, until the overlay is either committed, which writes the
+   data to the base, or discarded.
+
+   The handler of an overlay is `overlay://ID', where ID is the id of
+   the base IO space, optionally followed by `/NAME' in order to open
+   several overlays on the same base.  */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define OVERLAY_PREFIX "overlay://"
+#define OVERLAY_CHUNK_SIZE 4096
+
+/* State associated with an overlay device.
+
+   BASE_ID is the id of the base IO space.  It is looked up whenever
+   the device is accessed, so closing the base doesn't leave a
+   dangling pointer behind.
+
+   CHUNKS is an array of NCHUNKS written chunks, out of CHUNKS_SIZE
+   allocated, sorted by INDEX.  The chunk with index I holds the
+   OVERLAY_CHUNK_SIZE bytes starting at the byte offset I *
+   OVERLAY_CHUNK_SIZE.  A chunk is filled with the contents of the
+   base the first time it is written, so partial writes are
+   supported.
+
+   SIZE is the offset following the last byte written to the device,
+   which can be past the end of the base.  */
+
+struct ios_dev_overlay_chunk
+{
+  uint64_t index;
+  uint8_t *data;
+};
+
+struct ios_dev_overlay
+{
+  int base_id;
+  struct ios_dev_overlay_chunk *chunks;
+  size_t nchunks;
+  size_t chunks_size;
+  ios_dev_off size;
+  uint64_t flags;
+};
+
+static char *
+ios_dev_overlay_get_if_name () {
+  return "OVERLAY";
+}
+
+/* Parse the id of the base IO space out of HANDLER and store it in
+   *BASE_ID.  Return 1 if HANDLER is an overlay handler, 0
+   otherwise.  */
+
+static int
+ios_dev_overlay_parse (const char *handler, int *base_id)
+{
+  const char *p;
+  char *end;
+  long id;
+
+  if (strncmp (handler, OVERLAY_PREFIX, strlen (OVERLAY_PREFIX)) != 0)
+    return 0;
+
+  p = handler + strlen (OVERLAY_PREFIX);
+  if (*p < '0' || *p > '9')
+    return 0;
+
+  id = strtol (p, &end, 10);
+  if ((*end != '\0' && *end != '/') || id > INT32_MAX)
+    return 0;
+
+  *base_id = id;
+  return 1;
+}
+
+static char *
+ios_dev_overlay_handler_normalize (const char *handler, uint64_t flags,
+                                   int *error)
+{
+  char *new_handler = NULL;
+  int base_id;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (ios_dev_overlay_parse (handler, &base_id))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+static void *
+ios_dev_overlay_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_overlay *ovl;
+  int base_id;
+
+  if (!ios_dev_overlay_parse (handler, &base_id)
+      || ios_search_by_id (base_id) == NULL)
+    {
+      if (error)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  ovl = malloc (sizeof (struct ios_dev_overlay));
+  if (!ovl)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
+  /* The point of an overlay is to be written, no matter the mode of
+     the base.  */
+  if ((flags & IOS_FLAGS_MODE) == 0)
+    flags |= IOS_M_RDWR;
+
+  ovl->base_id = base_id;
+  ovl->chunks = NULL;
+  ovl->nchunks = 0;
+  ovl->chunks_size = 0;
+  ovl->size = 0;
+  ovl->flags = flags;
+
+  if (error)
+    *error = IOD_OK;
+  return ovl;
+}
+
+/* Free the chunks of OVL, dropping all the data written to it.  */
+
+static void
+ios_dev_overlay_free_chunks (struct ios_dev_overlay *ovl)
+{
+  for (size_t i = 0; i < ovl->nchunks; ++i)
+    free (ovl->chunks[i].data);
+  free (ovl->chunks);
+  ovl->chunks = NULL;
+  ovl->nchunks = 0;
+  ovl->chunks_size = 0;
+  ovl->size = 0;
+}
+
+static int
+ios_dev_overlay_close (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+
+  ios_dev_overlay_free_chunks (ovl);
+  free (ovl);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_overlay_get_flags (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+
+  return ovl->flags;
+}
+
+/* Return the size of the base of OVL in bytes, or 0 if it has been
+   closed.  */
+
+static ios_dev_off
+ios_dev_overlay_base_size (struct ios_dev_overlay *ovl, ios *base)
+{
+  *base = ios_search_by_id (ovl->base_id);
+  return *base ? ios_size (*base) / 8 : 0;
+}
+
+static ios_dev_off
+ios_dev_overlay_size (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios base;
+  ios_dev_off base_size = ios_dev_overlay_base_size (ovl, &base);
+
+  return ovl->size > base_size ? ovl->size : base_size;
+}
+
+/* Return the position in the chunks array of OVL of the first chunk
+   whose index is not less than INDEX.  */
+
+static size_t
+ios_dev_overlay_lookup (struct ios_dev_overlay *ovl, uint64_t index)
+{
+  size_t lo = 0, hi = ovl->nchunks;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (ovl->chunks[mid].index < index)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Read COUNT bytes at the byte offset OFFSET of the base BASE, whose
+   size is BASE_SIZE, into BUF.  The bytes past the end of the base
+   read as zeros.  */
+
+static int
+ios_dev_overlay_read_base (ios base, ios_dev_off base_size,
+                           uint8_t *buf, size_t count, ios_dev_off offset)
+{
+  size_t n = 0;
+
+  if (offset < base_size)
+    {
+      n = base_size - offset < count ? base_size - offset : count;
+      if (ios_base_pread (base, buf, n, offset) != IOD_OK)
+        return IOD_EOF;
+    }
+
+  memset (buf + n, 0, count - n);
+  return IOD_OK;
+}
+
+static int
+ios_dev_overlay_pread (void *iod, void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  struct ios_dev_overlay *ovl = iod;
+  uint8_t *p = buf;
+  ios base;
+  ios_dev_off base_size = ios_dev_overlay_base_size (ovl, &base);
+  ios_dev_off size = ovl->size > base_size ? ovl->size : base_size;
+  size_t pos;
+
+  if (base == NULL || offset > size || count > size - offset)
+    return IOD_EOF;
+
+  pos = ios_dev_overlay_lookup (ovl, offset / OVERLAY_CHUNK_SIZE);
+  while (count > 0)
+    {
+      uint64_t index = offset / OVERLAY_CHUNK_SIZE;
+      size_t n;
+
+      if (pos < ovl->nchunks && ovl->chunks[pos].index == index)
+        {
+          size_t chunk_offset = offset % OVERLAY_CHUNK_SIZE;
+
+          n = OVERLAY_CHUNK_SIZE - chunk_offset;
+          if (n > count)
+            n = count;
+          memcpy (p, ovl->chunks[pos].data + chunk_offset, n);
+          pos++;
+        }
+      else
+        {
+          /* Read everything up to the next written chunk from the
+             base in one go.  */
+          n = count;
+          if (pos < ovl->nchunks
+              && ovl->chunks[pos].index * OVERLAY_CHUNK_SIZE - offset < n)
+            n = ovl->chunks[pos].index * OVERLAY_CHUNK_SIZE - offset;
+
+          if (ios_dev_overlay_read_base (base, base_size,
+                                         p, n, offset) != IOD_OK)
+            return IOD_EOF;
+        }
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+/* Return the data of the chunk with index INDEX of OVL, creating it
+   at position POS of the chunks array if it doesn't exist.  Return
+   NULL if there is not enough memory or if the base can't be
+   read.  */
+
+static uint8_t *
+ios_dev_overlay_get_chunk (struct ios_dev_overlay *ovl, size_t pos,
+                           uint64_t index, ios base, ios_dev_off base_size)
+{
+  uint8_t *data;
+
+  if (pos < ovl->nchunks && ovl->chunks[pos].index == index)
+    return ovl->chunks[pos].data;
+
+  if (ovl->nchunks == ovl->chunks_size)
+    {
+      size_t new_size = ovl->chunks_size ? ovl->chunks_size * 2 : 16;
+      struct ios_dev_overlay_chunk *chunks
+        = realloc (ovl->chunks, new_size * sizeof (*chunks));
+
+      if (!chunks)
+        return NULL;
+      ovl->chunks = chunks;
+      ovl->chunks_size = new_size;
+    }
+
+  data = malloc (OVERLAY_CHUNK_SIZE);
+  if (!data
+      || ios_dev_overlay_read_base (base, base_size, data,
+                                    OVERLAY_CHUNK_SIZE,
+                                    index * OVERLAY_CHUNK_SIZE) != IOD_OK)
+    {
+      free (data);
+      return NULL;
+    }
+
+  memmove (&ovl->chunks[pos + 1], &ovl->chunks[pos],
+           (ovl->nchunks - pos) * sizeof (ovl->chunks[0]));
+  ovl->chunks[pos].index = index;
+  ovl->chunks[pos].data = data;
+  ovl->nchunks++;
+  return data;
+}
+
+static int
+ios_dev_overlay_pwrite (void *iod, const void *buf, size_t count,
+                        ios_dev_off offset)
+{
+  struct ios_dev_overlay *ovl = iod;
+  const uint8_t *p = buf;
+  ios_dev_off end = offset + count;
+  ios base;
+  ios_dev_off base_size = ios_dev_overlay_base_size (ovl, &base);
+  size_t pos;
+
+  if (end < offset || base == NULL)
+    return IOD_EOF;
+
+  pos = ios_dev_overlay_lookup (ovl, offset / OVERLAY_CHUNK_SIZE);
+  while (count > 0)
+    {
+      uint64_t index = offset / OVERLAY_CHUNK_SIZE;
+      size_t chunk_offset = offset % OVERLAY_CHUNK_SIZE;
+      size_t n = OVERLAY_CHUNK_SIZE - chunk_offset;
+      uint8_t *data;
+
+      if (n > count)
+        n = count;
+
+      data = ios_dev_overlay_get_chunk (ovl, pos, index, base, base_size);
+      if (data == NULL)
+        return IOD_ERROR;
+
+      memcpy (data + chunk_offset, p, n);
+      pos++;
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  if (end > ovl->size)
+    ovl->size = end;
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_overlay_prefetch (void *iod, ios_dev_off offset, uint64_t count)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios base = ios_search_by_id (ovl->base_id);
+
+  /* The written chunks are in memory already, but finding the gaps
+     between them is not worth it for a hint.  */
+  if (base == NULL)
+    return IOD_OK;
+  return ios_base_prefetch (base, offset, count);
+}
+
+static int
+ios_dev_overlay_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+/* The following two functions are used by ios_overlay_commit and
+   ios_overlay_discard.  */
+
+int
+ios_dev_overlay_commit (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios base;
+  ios_dev_off size = ios_dev_overlay_base_size (ovl, &base);
+
+  if (base == NULL)
+    return IOD_ERROR;
+  if (ovl->size > size)
+    size = ovl->size;
+
+  for (size_t i = 0; i < ovl->nchunks; ++i)
+    {
+      ios_dev_off begin = ovl->chunks[i].index * OVERLAY_CHUNK_SIZE;
+      size_t n = OVERLAY_CHUNK_SIZE;
+
+      /* Bytes past the end of the overlay were never written.  */
+      if (begin >= size)
+        break;
+      if (size - begin < n)
+        n = size - begin;
+
+      if (ios_base_pwrite (base, ovl->chunks[i].data, n, begin) != IOD_OK)
+        return IOD_ERROR;
+    }
+
+  ios_dev_overlay_free_chunks (ovl);
+  return IOD_OK;
+}
+
+void
+ios_dev_overlay_discard (void *iod)
+{
+  ios_dev_overlay_free_chunks (iod);
+}
+
+struct ios_dev_if ios_dev_overlay =
+  {
+   .get_if_name = ios_dev_overlay_get_if_name,
+   .handler_normalize = ios_dev_overlay_handler_normalize,
+   .open = ios_dev_overlay_open,
+   .close = ios_dev_overlay_close,
+   .pread = ios_dev_overlay_pread,
+   .pwrite = ios_dev_overlay_pwrite,
+   .prefetch = ios_dev_overlay_prefetch,
+   .get_flags = ios_dev_overlay_get_flags,
+   .size = ios_dev_overlay_size,
+   .flush = ios_dev_overlay_flush,
+  };
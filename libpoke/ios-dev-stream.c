@@ -22,6 +22,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #include "ios.h"
 #include "ios-dev.h"
@@ -32,7 +36,49 @@
 #define IOS_STDOUT_HANDLER      ("<stdout>")
 #define IOS_STDERR_HANDLER      ("<stderr>")
 
-/* State associated with a stream device.  */
+#if HAVE_PTHREAD
+
+/* State associated with the background reader of an input stream.
+
+   THREAD reads the file descriptor FD and appends the read data to
+   BUFFER, until the buffer holds HIGH_WATER bytes past its beginning
+   and the data up to WANTED_OFFSET is available.  Then it waits for
+   the buffer to be flushed, or for the consumer to want more data.
+
+   MUTEX protects all the fields below it, including the contents of
+   BUFFER.  COND is signaled whenever data is added to the buffer,
+   the buffer is flushed, more data is wanted, or the stream is
+   closed.
+
+   EOF_P is set when the reader finds the end of the file, or an
+   error.  CLOSING_P is set when the stream is closed.
+
+   The reader state, including the buffer, is shared by the stream
+   device and the thread, and is freed by the last of them to drop
+   its reference in REFCOUNT.  */
+
+#define IOS_STREAM_READER_BUF_SIZE 4096
+
+struct ios_dev_stream_reader
+{
+  pthread_t thread;
+  int fd;
+  size_t high_water;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct ios_buffer *buffer;
+  ios_dev_off wanted_offset;
+  int eof_p;
+  int closing_p;
+  int refcount;
+};
+
+#endif /* HAVE_PTHREAD */
+
+/* State associated with a stream device.
+
+   READER is the background reader of an input stream, or NULL if
+   the stream is read synchronously.  */
 
 struct ios_dev_stream
 {
@@ -44,8 +90,116 @@ struct ios_dev_stream
       struct ios_buffer *buffer;
       uint64_t write_offset;
     };
+#if HAVE_PTHREAD
+  struct ios_dev_stream_reader *reader;
+#endif
 };
 
+#if HAVE_PTHREAD
+
+/* Drop a reference to the reader R, freeing it if it was the last
+   one.  This function shall be called with the mutex of R locked,
+   and it unlocks it.  */
+
+static void
+ios_dev_stream_reader_release (struct ios_dev_stream_reader *r)
+{
+  int last_p = (--r->refcount == 0);
+
+  pthread_mutex_unlock (&r->mutex);
+  if (last_p)
+    {
+      pthread_mutex_destroy (&r->mutex);
+      pthread_cond_destroy (&r->cond);
+      ios_buffer_free (r->buffer);
+      free (r);
+    }
+}
+
+static void *
+ios_dev_stream_reader_run (void *data)
+{
+  struct ios_dev_stream_reader *r = data;
+  uint8_t buf[IOS_STREAM_READER_BUF_SIZE];
+  ssize_t count;
+
+  pthread_mutex_lock (&r->mutex);
+  while (!r->closing_p)
+    {
+      ios_dev_off begin = ios_buffer_get_begin_offset (r->buffer);
+      ios_dev_off end = ios_buffer_get_end_offset (r->buffer);
+
+      if (end - begin >= r->high_water && end >= r->wanted_offset)
+        {
+          pthread_cond_wait (&r->cond, &r->mutex);
+          continue;
+        }
+
+      /* Do not hold the lock while blocked in read, so the consumer
+         can use the data already in the buffer.  */
+      pthread_mutex_unlock (&r->mutex);
+      do
+        count = read (r->fd, buf, sizeof (buf));
+      while (count == -1 && errno == EINTR);
+      pthread_mutex_lock (&r->mutex);
+
+      if (count <= 0
+          || (!r->closing_p
+              && ios_buffer_pwrite (r->buffer, buf, count,
+                                    ios_buffer_get_end_offset (r->buffer))
+                 != IOD_OK))
+        {
+          r->eof_p = 1;
+          pthread_cond_broadcast (&r->cond);
+          break;
+        }
+
+      pthread_cond_broadcast (&r->cond);
+    }
+
+  ios_dev_stream_reader_release (r);
+  return NULL;
+}
+
+/* Start a background reader for the input stream SIO, which will
+   keep up to HIGH_WATER bytes buffered.  Return IOD_OK on success,
+   an error code otherwise.  */
+
+static int
+ios_dev_stream_reader_start (struct ios_dev_stream *sio, size_t high_water)
+{
+  struct ios_dev_stream_reader *r = malloc (sizeof (*r));
+
+  if (!r)
+    return IOD_ENOMEM;
+
+  r->fd = fileno (sio->file);
+  r->high_water = high_water;
+  r->buffer = sio->buffer;
+  r->wanted_offset = 0;
+  r->eof_p = 0;
+  r->closing_p = 0;
+  r->refcount = 2;
+  pthread_mutex_init (&r->mutex, NULL);
+  pthread_cond_init (&r->cond, NULL);
+
+  if (pthread_create (&r->thread, NULL, ios_dev_stream_reader_run, r) != 0)
+    {
+      pthread_mutex_destroy (&r->mutex);
+      pthread_cond_destroy (&r->cond);
+      free (r);
+      return IOD_ERROR;
+    }
+
+  /* The thread may be blocked reading when the stream is closed, so
+     it is never joined.  It frees its resources when it ends.  */
+  pthread_detach (r->thread);
+  sio->reader = r;
+  return IOD_OK;
+}
+
+#endif /* HAVE_PTHREAD */
+
 static char *
 ios_dev_stream_get_dev_if_name () {
   return "STREAM";
@@ -74,6 +228,25 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error)
 {
   struct ios_dev_stream *sio;
   int internal_error = IOD_ERROR;
+  int chunk_log = ((flags & IOS_F_STREAM_CHUNK_MASK)
+                   >> IOS_F_STREAM_CHUNK_SHIFT);
+  int reader_log = ((flags & IOS_F_STREAM_READER_MASK)
+                    >> IOS_F_STREAM_READER_SHIFT);
+
+  if ((chunk_log != 0
+       && (chunk_log < IOS_STREAM_CHUNK_LOG_MIN
+           || chunk_log > IOS_STREAM_CHUNK_LOG_MAX))
+      || (reader_log != 0
+#if HAVE_PTHREAD
+          && (reader_log < IOS_STREAM_READER_LOG_MIN
+              || reader_log > IOS_STREAM_READER_LOG_MAX)
+#endif
+          ))
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
 
   sio = malloc (sizeof (struct ios_dev_stream));
   if (!sio)
@@ -82,6 +255,9 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error)
       goto err;
     }
 
+#if HAVE_PTHREAD
+  sio->reader = NULL;
+#endif
   sio->handler = strdup (handler);
   if (!sio->handler)
     {
@@ -93,12 +269,24 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error)
     {
       sio->file = stdin;
       sio->flags = IOS_F_READ;
-      sio->buffer = ios_buffer_init ();
+      sio->buffer = ios_buffer_init (chunk_log
+                                     ? (size_t) 1 << chunk_log : 0);
       if (!sio->buffer)
         {
           internal_error = IOD_ENOMEM;
           goto err;
         }
+
+#if HAVE_PTHREAD
+      if (reader_log != 0
+          && (internal_error
+              = ios_dev_stream_reader_start (sio, (size_t) 1 << reader_log))
+             != IOD_OK)
+        {
+          ios_buffer_free (sio->buffer);
+          goto err;
+        }
+#endif
     }
   else if (STREQ (handler, IOS_STDOUT_HANDLER))
     {
@@ -137,6 +325,17 @@ ios_dev_stream_close (void *iod)
   /* Do not close std IO files.
      The user may be in interactive mode.  */
 
+#if HAVE_PTHREAD
+  if (sio->reader)
+    {
+      /* The buffer is owned by the reader.  */
+      pthread_mutex_lock (&sio->reader->mutex);
+      sio->reader->closing_p = 1;
+      pthread_cond_broadcast (&sio->reader->cond);
+      ios_dev_stream_reader_release (sio->reader);
+    }
+  else
+#endif
   if (sio->flags & IOS_F_READ)
     ios_buffer_free (sio->buffer);
   free (sio->handler);
@@ -163,6 +362,34 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   if (sio->flags & IOS_F_WRITE)
     return IOD_ERROR;
 
+#if HAVE_PTHREAD
+  if (sio->reader)
+    {
+      struct ios_dev_stream_reader *r = sio->reader;
+      int ret;
+
+      pthread_mutex_lock (&r->mutex);
+      if (r->wanted_offset < offset + count)
+        {
+          r->wanted_offset = offset + count;
+          pthread_cond_broadcast (&r->cond);
+        }
+
+      while (ios_buffer_get_end_offset (buffer) < offset + count
+             && !r->eof_p)
+        pthread_cond_wait (&r->cond, &r->mutex);
+
+      if (ios_buffer_get_begin_offset (buffer) > offset
+          || ios_buffer_get_end_offset (buffer) < offset + count)
+        ret = IOD_EOF;
+      else
+        ret = ios_buffer_pread (buffer, buf, count, offset);
+      pthread_mutex_unlock (&r->mutex);
+
+      return ret;
+    }
+#endif
+
   /* If the beginning of the buffer is discarded, return EOF. */
   if (ios_buffer_get_begin_offset (buffer) > offset)
     return IOD_EOF;
@@ -188,8 +415,8 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   do
     {
       read_count = fread (buf + total_read_count,
-                          count - total_read_count,
                           1,
+                          count - total_read_count,
                           sio->file);
       total_read_count += read_count;
     }
@@ -231,12 +458,47 @@ ios_dev_stream_pwrite (void *iod, const void *buf, size_t count,
   return IOS_OK;
 }
 
+static int
+ios_dev_stream_get_buffer_stats (void *iod, uint64_t *chunk_size,
+                                 uint64_t *nchunks, uint64_t *max_nchunks)
+{
+  struct ios_dev_stream *sio = iod;
+
+  /* Only input streams are buffered.  */
+  if (!(sio->flags & IOS_F_READ))
+    return IOD_ERROR;
+
+#if HAVE_PTHREAD
+  if (sio->reader)
+    pthread_mutex_lock (&sio->reader->mutex);
+#endif
+  ios_buffer_get_stats (sio->buffer, chunk_size, nchunks, max_nchunks);
+#if HAVE_PTHREAD
+  if (sio->reader)
+    pthread_mutex_unlock (&sio->reader->mutex);
+#endif
+  return IOD_OK;
+}
+
 static ios_dev_off
 ios_dev_stream_size (void *iod)
 {
   struct ios_dev_stream *sio = iod;
   if (sio->flags & IOS_F_READ)
-    return ios_buffer_get_end_offset (sio->buffer);
+    {
+      ios_dev_off size;
+
+#if HAVE_PTHREAD
+      if (sio->reader)
+        pthread_mutex_lock (&sio->reader->mutex);
+#endif
+      size = ios_buffer_get_end_offset (sio->buffer);
+#if HAVE_PTHREAD
+      if (sio->reader)
+        pthread_mutex_unlock (&sio->reader->mutex);
+#endif
+      return size;
+    }
   else
     return sio->write_offset;
 }
@@ -245,12 +507,27 @@ static int
 ios_dev_stream_flush (void *iod, ios_dev_off offset)
 {
   struct ios_dev_stream *sio = iod;
-  if (sio->flags & IOS_F_READ
-      && offset > ios_buffer_get_begin_offset (sio->buffer)
-      && offset <= ios_buffer_get_end_offset (sio->buffer))
-    return ios_buffer_forget_till (sio->buffer, offset);
-  else
+  int ret = IOS_OK;
+
+  if (!(sio->flags & IOS_F_READ))
     return IOS_OK;
+
+#if HAVE_PTHREAD
+  if (sio->reader)
+    pthread_mutex_lock (&sio->reader->mutex);
+#endif
+  if (offset > ios_buffer_get_begin_offset (sio->buffer)
+      && offset <= ios_buffer_get_end_offset (sio->buffer))
+    ret = ios_buffer_forget_till (sio->buffer, offset);
+#if HAVE_PTHREAD
+  if (sio->reader)
+    {
+      /* There may be room in the buffer now.  */
+      pthread_cond_broadcast (&sio->reader->cond);
+      pthread_mutex_unlock (&sio->reader->mutex);
+    }
+#endif
+  return ret;
 }
 
 struct ios_dev_if ios_dev_stream =
@@ -261,6 +538,7 @@ struct ios_dev_if ios_dev_stream =
    .close = ios_dev_stream_close,
    .pread = ios_dev_stream_pread,
    .pwrite = ios_dev_stream_pwrite,
+   .get_buffer_stats = ios_dev_stream_get_buffer_stats,
    .get_flags = ios_dev_stream_get_flags,
    .size = ios_dev_stream_size,
    .flush = ios_dev_stream_flush
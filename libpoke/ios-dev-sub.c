@@ -0,0 +1,241 @@
+/* ios-dev-sub.c - IO devices for windows of other IO spaces.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A sub device exposes a window of another IO space, called the
+   base, as an IO space of its own.  The data is not copied: the
+   accesses to the sub device are translated to accesses to the base,
+   and they are not allowed to go past the end of the window.
+
+   The handler of a sub device is `sub://ID/START/SIZE', where ID is
+   the id of the base IO space, and START and SIZE are the byte offset
+   of the window in the base and its size in bytes, optionally
+   followed by `/NAME' in order to open several windows on the same
+   range.  START and SIZE can be given in decimal, or in hexadecimal
+   with a `0x' prefix.  */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define SUB_PREFIX "sub://"
+
+/* State associated with a sub device.
+
+   BASE_ID is the id of the base IO space.  It is looked up whenever
+   the device is accessed, so closing the base doesn't leave a
+   dangling pointer behind.
+
+   START and SIZE delimit the window, in bytes.  */
+
+struct ios_dev_sub
+{
+  int base_id;
+  ios_dev_off start;
+  ios_dev_off size;
+  uint64_t flags;
+};
+
+static char *
+ios_dev_sub_get_if_name () {
+  return "SUB";
+}
+
+/* Parse an unsigned number at *P, and advance *P past it.  Return
+   1 on success, 0 otherwise.  */
+
+static int
+ios_dev_sub_parse_num (const char **p, uint64_t *num)
+{
+  char *end;
+
+  if (**p < '0' || **p > '9')
+    return 0;
+
+  *num = strtoull (*p, &end, 0);
+  *p = end;
+  return 1;
+}
+
+/* Parse HANDLER into the fields of SUB.  Return 1 if HANDLER is a
+   sub handler, 0 otherwise.  */
+
+static int
+ios_dev_sub_parse (const char *handler, struct ios_dev_sub *sub)
+{
+  const char *p;
+  uint64_t id;
+
+  if (strncmp (handler, SUB_PREFIX, strlen (SUB_PREFIX)) != 0)
+    return 0;
+
+  p = handler + strlen (SUB_PREFIX);
+  if (!ios_dev_sub_parse_num (&p, &id) || id > INT32_MAX || *p++ != '/'
+      || !ios_dev_sub_parse_num (&p, &sub->start) || *p++ != '/'
+      || !ios_dev_sub_parse_num (&p, &sub->size)
+      || (*p != '\0' && *p != '/'))
+    return 0;
+
+  /* The window can't wrap around.  */
+  if (sub->start + sub->size < sub->start)
+    return 0;
+
+  sub->base_id = id;
+  return 1;
+}
+
+static char *
+ios_dev_sub_handler_normalize (const char *handler, uint64_t flags,
+                               int *error)
+{
+  struct ios_dev_sub sub;
+  char *new_handler = NULL;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (ios_dev_sub_parse (handler, &sub))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+static void *
+ios_dev_sub_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_sub *sub = malloc (sizeof (struct ios_dev_sub));
+  ios base;
+
+  if (!sub)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
+  if (!ios_dev_sub_parse (handler, sub)
+      || (base = ios_search_by_id (sub->base_id)) == NULL)
+    {
+      free (sub);
+      if (error)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  /* By default the window can be accessed like the base.  Writing
+     to a base that can't be written fails anyway.  */
+  if ((flags & IOS_FLAGS_MODE) == 0)
+    flags |= ios_flags (base) & (IOS_F_READ | IOS_F_WRITE);
+  sub->flags = flags;
+
+  if (error)
+    *error = IOD_OK;
+  return sub;
+}
+
+static int
+ios_dev_sub_close (void *iod)
+{
+  free (iod);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_sub_get_flags (void *iod)
+{
+  struct ios_dev_sub *sub = iod;
+
+  return sub->flags;
+}
+
+static int
+ios_dev_sub_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_sub *sub = iod;
+  ios base = ios_search_by_id (sub->base_id);
+
+  if (base == NULL
+      || offset > sub->size || count > sub->size - offset)
+    return IOD_EOF;
+
+  return ios_base_pread (base, buf, count, sub->start + offset);
+}
+
+static int
+ios_dev_sub_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_sub *sub = iod;
+  ios base = ios_search_by_id (sub->base_id);
+
+  if (base == NULL
+      || offset > sub->size || count > sub->size - offset)
+    return IOD_EOF;
+
+  return ios_base_pwrite (base, buf, count, sub->start + offset);
+}
+
+static int
+ios_dev_sub_prefetch (void *iod, ios_dev_off offset, uint64_t count)
+{
+  struct ios_dev_sub *sub = iod;
+  ios base = ios_search_by_id (sub->base_id);
+
+  if (base == NULL || offset >= sub->size)
+    return IOD_OK;
+  if (count > sub->size - offset)
+    count = sub->size - offset;
+
+  return ios_base_prefetch (base, sub->start + offset, count);
+}
+
+static ios_dev_off
+ios_dev_sub_size (void *iod)
+{
+  struct ios_dev_sub *sub = iod;
+
+  return sub->size;
+}
+
+static int
+ios_dev_sub_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_sub =
+  {
+   .get_if_name = ios_dev_sub_get_if_name,
+   .handler_normalize = ios_dev_sub_handler_normalize,
+   .open = ios_dev_sub_open,
+   .close = ios_dev_sub_close,
+   .pread = ios_dev_sub_pread,
+   .pwrite = ios_dev_sub_pwrite,
+   .prefetch = ios_dev_sub_prefetch,
+   .get_flags = ios_dev_sub_get_flags,
+   .size = ios_dev_sub_size,
+   .flush = ios_dev_sub_flush,
+  };
@@ -0,0 +1,623 @@
+/* ios-dev-zlib.c - IO devices for compressed data.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A zlib device is stacked on top of another IO space, called the
+   base, containing data compressed in the zlib or gzip formats, and
+   provides read-only random access to the decompressed data, without
+   ever decompressing all of it in memory.
+
+   The handler of a zlib device is `zlib://ID', where ID is the id of
+   the base IO space, optionally followed by `/NAME'.  The compressed
+   data must start at the beginning of the base, even if it is
+   followed by other data.  A sub IO space can be used as the base to
+   decompress data stored somewhere else, like in the middle of an ELF
+   section.
+
+   When the device is opened all the data is decompressed once, in
+   order to determine its size and to build an index of restart
+   points.  Every ZLIB_SPAN bytes of decompressed data, at the
+   boundary of a deflate block, the position in the compressed data
+   is recorded along with the ZLIB_WINDOW_SIZE bytes of decompressed
+   data preceding it, which is what the decompressor needs in order
+   to continue from there.  The index needs about 1/32 of the size of
+   the decompressed data.
+
+   Reads are then served from a small cache of decompressed blocks of
+   ZLIB_BLOCK_SIZE bytes.  Blocks not in the cache are decompressed
+   starting at the last restart point preceding them, unless the
+   decompressor is already positioned before them, which makes
+   sequential reads cheap.  */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define ZLIB_PREFIX "zlib://"
+
+#define ZLIB_WINDOW_SIZE 32768
+#define ZLIB_SPAN (1024 * 1024)
+#define ZLIB_IN_SIZE 16384
+#define ZLIB_BLOCK_SIZE (64 * 1024)
+#define ZLIB_NBLOCKS 8
+
+/* A restart point.  OUT is the offset of the point in the
+   decompressed data, and IN is the offset of the first byte of
+   compressed data following it.  If BITS is not zero then the point
+   starts at that many bits before IN.  WINDOW holds the
+   ZLIB_WINDOW_SIZE bytes of decompressed data preceding the point,
+   or zeros if there are not that many.  */
+
+struct ios_dev_zlib_point
+{
+  ios_dev_off out;
+  ios_dev_off in;
+  int bits;
+  uint8_t *window;
+};
+
+/* A block of the cache.  DATA holds ZLIB_BLOCK_SIZE bytes of
+   decompressed data starting at the offset NUM * ZLIB_BLOCK_SIZE, or
+   fewer for the last block.  LAST_USE is used to evict the least
+   recently used block.  NUM is -1 if the block is not in use.  */
+
+struct ios_dev_zlib_block
+{
+  int64_t num;
+  uint64_t last_use;
+  uint8_t *data;
+};
+
+/* State associated with a zlib device.
+
+   BASE_ID is the id of the base IO space.  It is looked up whenever
+   the device is accessed, so closing the base doesn't leave a
+   dangling pointer behind.
+
+   SIZE is the size of the decompressed data.
+
+   POINTS is the index of NPOINTS restart points, sorted by OUT.
+
+   STRM is the decompressor, positioned at the offset CUR_OUT of the
+   decompressed data and at the offset CUR_IN of the compressed data,
+   past the compressed data buffered in INBUF.  CUR_VALID_P is zero if
+   STRM is not positioned anywhere.
+
+   BLOCKS is the cache of decompressed blocks, and USE_COUNT is
+   incremented every time a block is used.  */
+
+struct ios_dev_zlib
+{
+  int base_id;
+  ios_dev_off size;
+  uint64_t flags;
+
+  struct ios_dev_zlib_point *points;
+  size_t npoints;
+  size_t points_size;
+
+  z_stream strm;
+  int strm_init_p;
+  int cur_valid_p;
+  ios_dev_off cur_out;
+  ios_dev_off cur_in;
+  uint8_t inbuf[ZLIB_IN_SIZE];
+
+  struct ios_dev_zlib_block blocks[ZLIB_NBLOCKS];
+  uint64_t use_count;
+};
+
+static char *
+ios_dev_zlib_get_if_name () {
+  return "ZLIB";
+}
+
+/* Parse the id of the base IO space out of HANDLER and store it in
+   *BASE_ID.  Return 1 if HANDLER is a zlib handler, 0 otherwise.  */
+
+static int
+ios_dev_zlib_parse (const char *handler, int *base_id)
+{
+  const char *p;
+  char *end;
+  long id;
+
+  if (strncmp (handler, ZLIB_PREFIX, strlen (ZLIB_PREFIX)) != 0)
+    return 0;
+
+  p = handler + strlen (ZLIB_PREFIX);
+  if (*p < '0' || *p > '9')
+    return 0;
+
+  id = strtol (p, &end, 10);
+  if ((*end != '\0' && *end != '/') || id > INT32_MAX)
+    return 0;
+
+  *base_id = id;
+  return 1;
+}
+
+static char *
+ios_dev_zlib_handler_normalize (const char *handler, uint64_t flags,
+                                int *error)
+{
+  char *new_handler = NULL;
+  int base_id;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (ios_dev_zlib_parse (handler, &base_id))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+/* Feed the decompressor of ZIO with more compressed data from the
+   base BASE, whose size is BASE_SIZE.  Return IOD_OK on success,
+   IOD_EOF if there is no more data, or an error code.  */
+
+static int
+ios_dev_zlib_fill (struct ios_dev_zlib *zio, ios base, ios_dev_off base_size)
+{
+  size_t n = ZLIB_IN_SIZE;
+  int ret;
+
+  if (zio->cur_in >= base_size)
+    return IOD_EOF;
+  if (base_size - zio->cur_in < n)
+    n = base_size - zio->cur_in;
+
+  ret = ios_base_pread (base, zio->inbuf, n, zio->cur_in);
+  if (ret != IOD_OK)
+    return ret;
+
+  zio->strm.next_in = zio->inbuf;
+  zio->strm.avail_in = n;
+  zio->cur_in += n;
+  return IOD_OK;
+}
+
+/* Add a restart point to the index of ZIO.  WINDOW is the circular
+   buffer of decompressed data, whose next LEFT bytes are the oldest
+   ones.  Return IOD_OK on success, IOD_ENOMEM otherwise.  */
+
+static int
+ios_dev_zlib_add_point (struct ios_dev_zlib *zio, int bits,
+                        ios_dev_off in, ios_dev_off out,
+                        const uint8_t *window, size_t left)
+{
+  struct ios_dev_zlib_point *point;
+
+  if (zio->npoints == zio->points_size)
+    {
+      size_t new_size = zio->points_size ? zio->points_size * 2 : 16;
+      struct ios_dev_zlib_point *points
+        = realloc (zio->points, new_size * sizeof (*points));
+
+      if (!points)
+        return IOD_ENOMEM;
+      zio->points = points;
+      zio->points_size = new_size;
+    }
+
+  point = &zio->points[zio->npoints];
+  point->window = malloc (ZLIB_WINDOW_SIZE);
+  if (!point->window)
+    return IOD_ENOMEM;
+
+  memcpy (point->window, window + ZLIB_WINDOW_SIZE - left, left);
+  memcpy (point->window + left, window, ZLIB_WINDOW_SIZE - left);
+  point->bits = bits;
+  point->in = in;
+  point->out = out;
+  zio->npoints++;
+  return IOD_OK;
+}
+
+/* Decompress all the data in the base BASE, whose size is BASE_SIZE,
+   building the index of ZIO and determining its size.  Return IOD_OK
+   on success, or an error code.  */
+
+static int
+ios_dev_zlib_build_index (struct ios_dev_zlib *zio, ios base,
+                          ios_dev_off base_size)
+{
+  z_stream *strm = &zio->strm;
+  uint8_t *window = calloc (ZLIB_WINDOW_SIZE, 1);
+  ios_dev_off totin = 0, totout = 0, last = 0;
+  int ret = IOD_OK, zret = Z_OK;
+
+  if (!window)
+    return IOD_ENOMEM;
+
+  /* Accept both the zlib and the gzip formats.  */
+  if (inflateInit2 (strm, 15 + 32) != Z_OK)
+    {
+      free (window);
+      return IOD_ENOMEM;
+    }
+  zio->strm_init_p = 1;
+  strm->avail_out = 0;
+  zio->cur_in = 0;
+
+  do
+    {
+      if (strm->avail_in == 0
+          && (ret = ios_dev_zlib_fill (zio, base, base_size)) != IOD_OK)
+        break;
+
+      do
+        {
+          if (strm->avail_out == 0)
+            {
+              strm->avail_out = ZLIB_WINDOW_SIZE;
+              strm->next_out = window;
+            }
+
+          totin += strm->avail_in;
+          totout += strm->avail_out;
+          zret = inflate (strm, Z_BLOCK);
+          totin -= strm->avail_in;
+          totout -= strm->avail_out;
+
+          if (zret == Z_MEM_ERROR)
+            ret = IOD_ENOMEM;
+          else if (zret == Z_NEED_DICT || zret == Z_DATA_ERROR)
+            ret = IOD_EINVAL;
+          if (ret != IOD_OK || zret == Z_STREAM_END)
+            break;
+
+          /* Restart points can only be at the end of deflate blocks
+             which are not the last one.  */
+          if ((strm->data_type & 128) && !(strm->data_type & 64)
+              && (totout == 0 || totout - last > ZLIB_SPAN))
+            {
+              ret = ios_dev_zlib_add_point (zio, strm->data_type & 7,
+                                            totin, totout, window,
+                                            strm->avail_out);
+              if (ret != IOD_OK)
+                break;
+              last = totout;
+            }
+        }
+      while (strm->avail_in != 0);
+    }
+  while (ret == IOD_OK && zret != Z_STREAM_END);
+
+  /* Truncated data is an error.  */
+  if (ret == IOD_EOF)
+    ret = IOD_EINVAL;
+
+  zio->size = totout;
+  free (window);
+  return ret;
+}
+
+/* Position the decompressor of ZIO at the restart point POINT.
+   Return IOD_OK on success, or an error code.  */
+
+static int
+ios_dev_zlib_restart (struct ios_dev_zlib *zio,
+                      struct ios_dev_zlib_point *point,
+                      ios base, ios_dev_off base_size)
+{
+  z_stream *strm = &zio->strm;
+  int ret;
+
+  zio->cur_valid_p = 0;
+  if (zio->strm_init_p)
+    inflateEnd (strm);
+  zio->strm_init_p = 0;
+
+  memset (strm, 0, sizeof (*strm));
+  if (inflateInit2 (strm, -15) != Z_OK)
+    return IOD_ENOMEM;
+  zio->strm_init_p = 1;
+
+  zio->cur_in = point->in - (point->bits ? 1 : 0);
+  if ((ret = ios_dev_zlib_fill (zio, base, base_size)) != IOD_OK)
+    return ret == IOD_EOF ? IOD_EINVAL : ret;
+
+  if (point->bits)
+    {
+      int ch = *strm->next_in;
+
+      strm->next_in++;
+      strm->avail_in--;
+      inflatePrime (strm, point->bits, ch >> (8 - point->bits));
+    }
+
+  inflateSetDictionary (strm, point->window, ZLIB_WINDOW_SIZE);
+  zio->cur_out = point->out;
+  zio->cur_valid_p = 1;
+  return IOD_OK;
+}
+
+/* Decompress the next COUNT bytes from the current position of the
+   decompressor of ZIO into BUF.  If BUF is NULL the decompressed
+   data is discarded.  Return IOD_OK on success, or an error code,
+   in which case the decompressor is not positioned anymore.  */
+
+static int
+ios_dev_zlib_inflate (struct ios_dev_zlib *zio, uint8_t *buf, size_t count,
+                      ios base, ios_dev_off base_size)
+{
+  z_stream *strm = &zio->strm;
+  uint8_t discard[4096];
+  int ret, zret;
+
+  while (count > 0)
+    {
+      size_t n = count;
+
+      if (buf == NULL && n > sizeof (discard))
+        n = sizeof (discard);
+
+      strm->next_out = buf ? buf : discard;
+      strm->avail_out = n;
+      while (strm->avail_out != 0)
+        {
+          if (strm->avail_in == 0
+              && (ret = ios_dev_zlib_fill (zio, base, base_size)) != IOD_OK)
+            goto error;
+
+          zret = inflate (strm, Z_NO_FLUSH);
+          if (zret == Z_STREAM_END && strm->avail_out != 0)
+            {
+              ret = IOD_EOF;
+              goto error;
+            }
+          if (zret != Z_OK && zret != Z_STREAM_END)
+            {
+              ret = zret == Z_MEM_ERROR ? IOD_ENOMEM : IOD_ERROR;
+              goto error;
+            }
+        }
+
+      zio->cur_out += n;
+      count -= n;
+      if (buf)
+        buf += n;
+    }
+
+  return IOD_OK;
+
+ error:
+  zio->cur_valid_p = 0;
+  return ret;
+}
+
+/* Return the block of ZIO with number NUM, decompressing it if it is
+   not in the cache.  Return NULL in case of error.  */
+
+static struct ios_dev_zlib_block *
+ios_dev_zlib_get_block (struct ios_dev_zlib *zio, int64_t num,
+                        ios base, ios_dev_off base_size)
+{
+  struct ios_dev_zlib_block *block = &zio->blocks[0];
+  ios_dev_off begin = num * ZLIB_BLOCK_SIZE;
+  size_t count = ZLIB_BLOCK_SIZE, lo = 0, hi = zio->npoints;
+  struct ios_dev_zlib_point *point;
+
+  for (int i = 0; i < ZLIB_NBLOCKS; ++i)
+    {
+      if (zio->blocks[i].num == num)
+        {
+          zio->blocks[i].last_use = ++zio->use_count;
+          return &zio->blocks[i];
+        }
+      if (zio->blocks[i].last_use < block->last_use)
+        block = &zio->blocks[i];
+    }
+
+  if (zio->size - begin < count)
+    count = zio->size - begin;
+
+  /* Find the last restart point before the block.  There is always
+     one at the beginning of the data.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (zio->points[mid].out <= begin)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == 0)
+    return NULL;
+  point = &zio->points[lo - 1];
+
+  /* Restart the decompression unless the decompressor is already
+     between the restart point and the block.  */
+  if (!zio->cur_valid_p || zio->cur_out > begin || zio->cur_out < point->out)
+    {
+      if (ios_dev_zlib_restart (zio, point, base, base_size) != IOD_OK)
+        return NULL;
+    }
+
+  if (!block->data && !(block->data = malloc (ZLIB_BLOCK_SIZE)))
+    return NULL;
+
+  block->num = -1;
+  if (ios_dev_zlib_inflate (zio, NULL, begin - zio->cur_out,
+                            base, base_size) != IOD_OK
+      || ios_dev_zlib_inflate (zio, block->data, count,
+                               base, base_size) != IOD_OK)
+    return NULL;
+
+  block->num = num;
+  block->last_use = ++zio->use_count;
+  return block;
+}
+
+static int
+ios_dev_zlib_close (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+
+  if (zio->strm_init_p)
+    inflateEnd (&zio->strm);
+  for (size_t i = 0; i < zio->npoints; ++i)
+    free (zio->points[i].window);
+  free (zio->points);
+  for (int i = 0; i < ZLIB_NBLOCKS; ++i)
+    free (zio->blocks[i].data);
+  free (zio);
+  return IOD_OK;
+}
+
+static void *
+ios_dev_zlib_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_zlib *zio;
+  int base_id, ret;
+  ios base;
+
+  if (!ios_dev_zlib_parse (handler, &base_id)
+      || (base = ios_search_by_id (base_id)) == NULL)
+    {
+      if (error)
+        *error = IOD_EINVAL;
+      return NULL;
+    }
+
+  /* The decompressed data can't be written.  */
+  if (flags & (IOS_F_WRITE | IOS_F_TRUNCATE | IOS_F_CREATE))
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  zio = calloc (1, sizeof (struct ios_dev_zlib));
+  if (!zio)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
+  zio->base_id = base_id;
+  zio->flags = flags | IOS_F_READ;
+  for (int i = 0; i < ZLIB_NBLOCKS; ++i)
+    zio->blocks[i].num = -1;
+
+  ret = ios_dev_zlib_build_index (zio, base, ios_size (base) / 8);
+  if (ret == IOD_OK && zio->npoints == 0)
+    /* The data doesn't have any deflate block.  */
+    ret = IOD_EINVAL;
+  if (ret != IOD_OK)
+    {
+      ios_dev_zlib_close (zio);
+      if (error)
+        *error = ret;
+      return NULL;
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return zio;
+}
+
+static uint64_t
+ios_dev_zlib_get_flags (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+
+  return zio->flags;
+}
+
+static int
+ios_dev_zlib_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_zlib *zio = iod;
+  ios base = ios_search_by_id (zio->base_id);
+  ios_dev_off base_size;
+  uint8_t *p = buf;
+
+  if (base == NULL || offset > zio->size || count > zio->size - offset)
+    return IOD_EOF;
+
+  base_size = ios_size (base) / 8;
+  while (count > 0)
+    {
+      int64_t num = offset / ZLIB_BLOCK_SIZE;
+      size_t block_offset = offset % ZLIB_BLOCK_SIZE;
+      size_t n = ZLIB_BLOCK_SIZE - block_offset;
+      struct ios_dev_zlib_block *block;
+
+      if (n > count)
+        n = count;
+
+      block = ios_dev_zlib_get_block (zio, num, base, base_size);
+      if (block == NULL)
+        return IOD_ERROR;
+
+      memcpy (p, block->data + block_offset, n);
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_zlib_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  return IOD_ERROR;
+}
+
+static ios_dev_off
+ios_dev_zlib_size (void *iod)
+{
+  struct ios_dev_zlib *zio = iod;
+
+  return zio->size;
+}
+
+static int
+ios_dev_zlib_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_zlib =
+  {
+   .get_if_name = ios_dev_zlib_get_if_name,
+   .handler_normalize = ios_dev_zlib_handler_normalize,
+   .open = ios_dev_zlib_open,
+   .close = ios_dev_zlib_close,
+   .pread = ios_dev_zlib_pread,
+   .pwrite = ios_dev_zlib_pwrite,
+   .get_flags = ios_dev_zlib_get_flags,
+   .size = ios_dev_zlib_size,
+   .flush = ios_dev_zlib_flush,
+  };
@@ -26,6 +26,8 @@
 
    IOD offsets shall always be interpreted as numbers of bytes.  */
 
+#include <sys/uio.h>
+
 typedef uint64_t ios_dev_off;
 
 /* The following macros are part of the device interface.  */
@@ -71,8 +73,10 @@ struct ios_dev_if
 
   int (*close) (void *dev);
 
-  /* Read a small byte buffer from the given device at the given byte offset.
-     Return 0 on success, or IOD_EOF on error, including on short reads.  */
+  /* Read a byte buffer from the given device at the given byte offset.
+     Note that the IOS layer may request big buffers, typically in
+     order to fill its read-ahead window.  Return 0 on success, or
+     IOD_EOF on error, including on short reads.  */
 
   int (*pread) (void *dev, void *buf, size_t count, ios_dev_off offset);
 
@@ -81,6 +85,88 @@ struct ios_dev_if
 
   int (*pwrite) (void *dev, const void *buf, size_t count, ios_dev_off offset);
 
+  /* Write the IOVCNT buffers described by IOV to the given device, at
+     consecutive positions starting at the given byte offset.
+
+     This operation is optional.  The IOS layer coalesces and buffers
+     the writes to devices providing it, and calls it when the
+     buffered data has to be written out.  Devices for which writing
+     is cheap, or for which writes shall not be delayed, should set
+     this to NULL.  Return 0 on success, or IOD_EOF on error,
+     including short writes.  */
+
+  int (*pwritev) (void *dev, const struct iovec *iov, int iovcnt,
+                  ios_dev_off offset);
+
+  /* Return a pointer to the COUNT bytes of the device starting at the
+     given byte offset, if they are stored contiguously in memory.  If
+     WRITE_P is not zero the bytes are going to be modified through
+     the returned pointer.  The pointer is only valid until the next
+     operation on the device.
+
+     This operation is optional, and it is used by the IOS layer to
+     access the data of memory-like devices without copying it.
+     Return NULL if the bytes are not available in memory.  */
+
+  void * (*get_pointer) (void *dev, ios_dev_off offset, size_t count,
+                         int write_p);
+
+  /* Get statistics about the buffer used by the given device: the
+     size of the chunks of the buffer in bytes, the number of chunks
+     currently in the buffer, and the maximum number of chunks the
+     buffer has ever held.
+
+     This operation is optional.  Return IOD_ERROR if the device
+     doesn't buffer data, IOD_OK otherwise.  */
+
+  int (*get_buffer_stats) (void *dev, uint64_t *chunk_size,
+                           uint64_t *nchunks, uint64_t *max_nchunks);
+
+  /* Copy COUNT bytes from the given byte offset of the device to the
+     byte offset DST_OFFSET of the device DST_DEV, which is handled by
+     the same interface, without transferring the data through the
+     IOS layer.  The ranges won't overlap if both devices are the
+     same.
+
+     This operation is optional.  Return IOD_OK on success, or
+     IOD_ERROR if the device can't copy the data, in which case the IOS
+     layer copies it by reading and writing it.  */
+
+  int (*copy) (void *dev, ios_dev_off offset,
+               void *dst_dev, ios_dev_off dst_offset, uint64_t count);
+
+  /* Announce that the COUNT bytes of the device starting at the given
+     byte offset are going to be read soon.  The device may start
+     reading them in the background, so they are already available
+     when they are requested.  This shall not block, and the range
+     may extend past the end of the device.
+
+     This operation is optional, and it is only a hint.  Return IOD_OK
+     on success, or IOD_ERROR if the hint can't be honored.  */
+
+  int (*prefetch) (void *dev, ios_dev_off offset, uint64_t count);
+
+  /* Return whether the device has been modified by other programs
+     since the last call, without blocking.  If it has, set OLD_SIZE
+     to the size of the device at the time of the last call, in bytes,
+     and return 1.  Return 0 otherwise.  The device doesn't know what
+     was modified.
+
+     This operation is optional.  Return IOD_ERROR if the device can't
+     tell.  */
+
+  int (*changed) (void *dev, ios_dev_off *old_size);
+
+  /* Return a file descriptor that becomes ready for reading when the
+     device is modified by other programs, so the changes can be
+     waited for with select or poll.  The descriptor is only to be
+     waited for, the changes are consumed by the `changed' operation.
+
+     This operation is optional.  Return -1 if the device is not being
+     watched.  */
+
+  int (*get_change_fd) (void *dev);
+
   /* Return the flags of the device, as it was opened.  */
 
   uint64_t (*get_flags) (void *dev);
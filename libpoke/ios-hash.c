@@ -0,0 +1,359 @@
+/* ios-hash.c - Checksums and hashes of IO space ranges.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256.h"
+
+#include "ios.h"
+#include "ios-hash.h"
+#include "pk-thread.h"
+
+/* The data is read from the IO space in blocks of this size.  */
+
+#define IOS_HASH_CHUNK_SIZE (1024 * 1024)
+
+/* Feed the COUNT bytes located at OFFSET in IO to the function
+   UPDATE, a block at a time.  CTX is passed to UPDATE.  */
+
+typedef void (*ios_hash_update_fn) (void *ctx, const uint8_t *data,
+                                    size_t count);
+
+static int
+ios_hash_data (ios io, ios_off offset, uint64_t count,
+               ios_hash_update_fn update, void *ctx)
+{
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  buf = malloc (count < IOS_HASH_CHUNK_SIZE ? count : IOS_HASH_CHUNK_SIZE);
+  if (buf == NULL && count > 0)
+    return IOS_ENOMEM;
+
+  while (count > 0)
+    {
+      size_t n = count < IOS_HASH_CHUNK_SIZE ? count : IOS_HASH_CHUNK_SIZE;
+
+      ret = ios_read_raw (io, offset, 0, buf, n);
+      if (ret != IOS_OK)
+        break;
+      update (ctx, buf, n);
+
+      offset += n * 8;
+      count -= n;
+    }
+
+  free (buf);
+  return ret;
+}
+
+static inline uint32_t
+ios_hash_load32le (const uint8_t *p)
+{
+  return ((uint32_t) p[0] | (uint32_t) p[1] << 8
+          | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+ios_hash_load64le (const uint8_t *p)
+{
+  return ios_hash_load32le (p) | (uint64_t) ios_hash_load32le (p + 4) << 32;
+}
+
+static inline uint64_t
+ios_hash_rotl64 (uint64_t x, int n)
+{
+  return (x << n) | (x >> (64 - n));
+}
+
+/* CRC-32.
+
+   The CRC is computed eight bytes at a time, using the
+   slicing-by-8 algorithm.  CRC32_TABLE[0] is the classic table of
+   the CRC of the bytes, and CRC32_TABLE[K] contains the CRC of the
+   bytes followed by K zero bytes.  The tables are computed the first
+   time they are needed.  */
+
+static uint32_t crc32_table[8][256];
+PK_ONCE_DEFINE (crc32_table_once);
+
+static void
+crc32_init_table (void)
+{
+  uint32_t i, k;
+
+  for (i = 0; i < 256; i++)
+    {
+      uint32_t c = i;
+
+      for (k = 0; k < 8; k++)
+        c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+      crc32_table[0][i] = c;
+    }
+
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc32_table[k][i] = ((crc32_table[k - 1][i] >> 8)
+                           ^ crc32_table[0][crc32_table[k - 1][i] & 0xff]);
+}
+
+static void
+crc32_update (void *ctx, const uint8_t *p, size_t count)
+{
+  uint32_t crc = *(uint32_t *) ctx;
+
+  for (; count >= 8; p += 8, count -= 8)
+    {
+      uint32_t lo = crc ^ ios_hash_load32le (p);
+      uint32_t hi = ios_hash_load32le (p + 4);
+
+      crc = (crc32_table[7][lo & 0xff]
+             ^ crc32_table[6][(lo >> 8) & 0xff]
+             ^ crc32_table[5][(lo >> 16) & 0xff]
+             ^ crc32_table[4][lo >> 24]
+             ^ crc32_table[3][hi & 0xff]
+             ^ crc32_table[2][(hi >> 8) & 0xff]
+             ^ crc32_table[1][(hi >> 16) & 0xff]
+             ^ crc32_table[0][hi >> 24]);
+    }
+
+  for (; count > 0; p++, count--)
+    crc = crc32_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+  *(uint32_t *) ctx = crc;
+}
+
+int
+ios_hash_crc32 (ios io, ios_off offset, uint64_t count, uint32_t *crc)
+{
+  uint32_t c = *crc ^ 0xffffffffU;
+  int ret;
+
+  PK_ONCE (crc32_table_once, crc32_init_table);
+
+  ret = ios_hash_data (io, offset, count, crc32_update, &c);
+  if (ret == IOS_OK)
+    *crc = c ^ 0xffffffffU;
+  return ret;
+}
+
+/* Adler-32.
+
+   The sums are reduced modulo ADLER32_BASE only every ADLER32_NMAX
+   bytes, which is the largest number of bytes that can be added
+   without overflowing 32 bits.  */
+
+#define ADLER32_BASE 65521U
+#define ADLER32_NMAX 5552
+
+static void
+adler32_update (void *ctx, const uint8_t *p, size_t count)
+{
+  uint32_t a = *(uint32_t *) ctx & 0xffff;
+  uint32_t b = *(uint32_t *) ctx >> 16;
+
+  while (count > 0)
+    {
+      size_t n = count < ADLER32_NMAX ? count : ADLER32_NMAX;
+
+      count -= n;
+      for (; n > 0; p++, n--)
+        {
+          a += *p;
+          b += a;
+        }
+      a %= ADLER32_BASE;
+      b %= ADLER32_BASE;
+    }
+
+  *(uint32_t *) ctx = b << 16 | a;
+}
+
+int
+ios_hash_adler32 (ios io, ios_off offset, uint64_t count,
+                  uint32_t *adler)
+{
+  return ios_hash_data (io, offset, count, adler32_update, adler);
+}
+
+/* xxHash, 64-bit variant.
+
+   The data is processed in stripes of 32 bytes, using four
+   accumulators.  The bytes that don't fill a stripe are kept in
+   BUF until more data arrives or the hash is finished.  */
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+struct xxh64_state
+{
+  uint64_t total;
+  uint64_t v[4];
+  uint8_t buf[32];
+  size_t nbuf;
+};
+
+static inline uint64_t
+xxh64_round (uint64_t acc, uint64_t input)
+{
+  acc += input * XXH_PRIME64_2;
+  acc = ios_hash_rotl64 (acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round (uint64_t acc, uint64_t val)
+{
+  acc ^= xxh64_round (0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline void
+xxh64_stripe (struct xxh64_state *s, const uint8_t *p)
+{
+  s->v[0] = xxh64_round (s->v[0], ios_hash_load64le (p));
+  s->v[1] = xxh64_round (s->v[1], ios_hash_load64le (p + 8));
+  s->v[2] = xxh64_round (s->v[2], ios_hash_load64le (p + 16));
+  s->v[3] = xxh64_round (s->v[3], ios_hash_load64le (p + 24));
+}
+
+static void
+xxh64_update (void *ctx, const uint8_t *p, size_t count)
+{
+  struct xxh64_state *s = ctx;
+
+  s->total += count;
+
+  if (s->nbuf > 0)
+    {
+      size_t n = sizeof (s->buf) - s->nbuf;
+
+      if (n > count)
+        n = count;
+      memcpy (s->buf + s->nbuf, p, n);
+      s->nbuf += n;
+      p += n;
+      count -= n;
+
+      if (s->nbuf < sizeof (s->buf))
+        return;
+      xxh64_stripe (s, s->buf);
+      s->nbuf = 0;
+    }
+
+  for (; count >= 32; p += 32, count -= 32)
+    xxh64_stripe (s, p);
+
+  memcpy (s->buf, p, count);
+  s->nbuf = count;
+}
+
+static uint64_t
+xxh64_finish (struct xxh64_state *s, uint64_t seed)
+{
+  const uint8_t *p = s->buf;
+  size_t count = s->nbuf;
+  uint64_t h;
+
+  if (s->total >= 32)
+    {
+      h = (ios_hash_rotl64 (s->v[0], 1) + ios_hash_rotl64 (s->v[1], 7)
+           + ios_hash_rotl64 (s->v[2], 12) + ios_hash_rotl64 (s->v[3], 18));
+      h = xxh64_merge_round (h, s->v[0]);
+      h = xxh64_merge_round (h, s->v[1]);
+      h = xxh64_merge_round (h, s->v[2]);
+      h = xxh64_merge_round (h, s->v[3]);
+    }
+  else
+    h = seed + XXH_PRIME64_5;
+
+  h += s->total;
+
+  for (; count >= 8; p += 8, count -= 8)
+    {
+      h ^= xxh64_round (0, ios_hash_load64le (p));
+      h = ios_hash_rotl64 (h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+  if (count >= 4)
+    {
+      h ^= (uint64_t) ios_hash_load32le (p) * XXH_PRIME64_1;
+      h = ios_hash_rotl64 (h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+      p += 4;
+      count -= 4;
+    }
+  for (; count > 0; p++, count--)
+    {
+      h ^= *p * XXH_PRIME64_5;
+      h = ios_hash_rotl64 (h, 11) * XXH_PRIME64_1;
+    }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+int
+ios_hash_xxh64 (ios io, ios_off offset, uint64_t count,
+                uint64_t seed, uint64_t *hash)
+{
+  struct xxh64_state s;
+  int ret;
+
+  s.total = 0;
+  s.nbuf = 0;
+  s.v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+  s.v[1] = seed + XXH_PRIME64_2;
+  s.v[2] = seed;
+  s.v[3] = seed - XXH_PRIME64_1;
+
+  ret = ios_hash_data (io, offset, count, xxh64_update, &s);
+  if (ret == IOS_OK)
+    *hash = xxh64_finish (&s, seed);
+  return ret;
+}
+
+/* SHA-256.  The implementation is provided by gnulib.  */
+
+static void
+sha256_update (void *ctx, const uint8_t *p, size_t count)
+{
+  sha256_process_bytes (p, count, ctx);
+}
+
+int
+ios_hash_sha256 (ios io, ios_off offset, uint64_t count,
+                 uint8_t *digest)
+{
+  struct sha256_ctx ctx;
+  int ret;
+
+  sha256_init_ctx (&ctx);
+  ret = ios_hash_data (io, offset, count, sha256_update, &ctx);
+  if (ret == IOS_OK)
+    sha256_finish_ctx (&ctx, digest);
+  return ret;
+}
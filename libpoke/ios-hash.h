@@ -0,0 +1,72 @@
+/* ios-hash.h - Checksums and hashes of IO space ranges.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOS_HASH_H
+#define IOS_HASH_H
+
+#include <config.h>
+#include <stdint.h>
+
+#include "ios.h"
+
+/* Identifiers of the functions below, used by the iohash PVM
+   instruction.  */
+
+#define IOS_HASH_CRC32   0
+#define IOS_HASH_ADLER32 1
+#define IOS_HASH_XXH64   2
+#define IOS_HASH_SHA256  3
+
+/* The following functions compute a checksum or a hash of the COUNT
+   bytes located at the given OFFSET of the IO space IO.  OFFSET
+   doesn't need to be aligned to a byte boundary.  The data is read
+   in big blocks.
+
+   They return IOS_OK on success, IOS_EIOFF if the range is not
+   fully contained in the IO space, or another IOS error code.  */
+
+/* Compute the CRC-32 of ISO 3309 and ITU-T V.42, the one used by
+   zlib, PNG and gzip among others, and put it in *CRC.  The initial
+   value of *CRC is the CRC of the preceding data, or zero, so the
+   CRC of some data can be computed in several steps.  */
+
+int ios_hash_crc32 (ios io, ios_off offset, uint64_t count,
+                    uint32_t *crc);
+
+/* Compute the Adler-32 checksum of RFC 1950 and put it in *ADLER.
+   The initial value of *ADLER is the checksum of the preceding data,
+   or one.  */
+
+int ios_hash_adler32 (ios io, ios_off offset, uint64_t count,
+                      uint32_t *adler);
+
+/* Compute the 64-bit xxHash (XXH64) of the data using the given SEED
+   and put it in *HASH.  */
+
+int ios_hash_xxh64 (ios io, ios_off offset, uint64_t count,
+                    uint64_t seed, uint64_t *hash);
+
+/* Compute the SHA-256 digest of the data and put it in the 32 bytes
+   pointed by DIGEST.  */
+
+#define IOS_HASH_SHA256_SIZE 32
+
+int ios_hash_sha256 (ios io, ios_off offset, uint64_t count,
+                     uint8_t *digest);
+
+#endif /* ! IOS_HASH_H */
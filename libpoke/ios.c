@@ -23,19 +23,24 @@
 #include <stdio.h>
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
+#include <inttypes.h>
 #define _(str) gettext (str)
 #include <streq.h>
 
 #include "byteswap.h"
+#include "timespec.h"
 
 #include "pk-utils.h"
+#include "pk-thread.h"
 #include "ios.h"
 #include "ios-dev.h"
+#include "ios-cache.h"
 
 #define IOS_GET_C_ERR_CHCK(c, io, off)                                \
   {                                                                \
     uint8_t ch;                                                        \
-    int ret = (io)->dev_if->pread ((io)->dev, &ch, 1, off);         \
+    int ret = ios_read_bytes ((io), &ch, 1, off, flags);            \
     if (ret == IOD_EOF)                                                \
       return IOS_EIOFF;                                                \
     (c) = ch;                                                        \
@@ -43,11 +48,96 @@
 
 #define IOS_PUT_C_ERR_CHCK(c, io, len, off)                \
   {                                                        \
-    if ((io)->dev_if->pwrite ((io)->dev, c, len, off)      \
+    if (ios_write_bytes ((io), c, len, off, flags)         \
         == IOD_EOF)                                        \
       return IOS_EIOFF;                                    \
   }
 
+/* Reads of device bytes are served from a per-IOS page cache, which
+   is filled with device preads covering several consecutive pages.
+   This way small reads, like the ones performed when mapping arrays
+   of scalars, don't result in a device call each.  Devices storing
+   their data in memory, i.e. providing a get_pointer operation,
+   don't use the cache.
+
+   The size of the pages and the total size of the cache are the same
+   for all the IO spaces of an IO context, and can be changed at any
+   time.  Requests
+   bigger than a page bypass the cache.
+
+   IOS_CACHE_READ_AHEAD is the maximum number of pages read from the
+   device on a cache miss.
+
+   When the pages are read sequentially, devices providing a prefetch
+   operation are asked to read the IOS_PREFETCH_SIZE bytes following
+   them in the background, so the device is kept busy while the data
+   is decoded.  */
+
+#define IOS_CACHE_DEFAULT_PAGE_SIZE 4096
+#define IOS_CACHE_DEFAULT_SIZE (64 * IOS_CACHE_DEFAULT_PAGE_SIZE)
+#define IOS_CACHE_MIN_PAGE_SIZE 512
+#define IOS_CACHE_MAX_PAGE_SIZE (1024 * 1024)
+#define IOS_CACHE_READ_AHEAD 4
+#define IOS_PREFETCH_SIZE (1024 * 1024)
+
+/* Unaligned raw reads are performed in blocks of IOS_RAW_CHUNK_SIZE
+   bytes.  */
+
+#define IOS_RAW_CHUNK_SIZE 4096
+
+/* ios_copy transfers the data in blocks of IOS_COPY_CHUNK_SIZE
+   bytes, unless the devices can copy it by themselves.  */
+
+#define IOS_COPY_CHUNK_SIZE (1024 * 1024)
+
+/* Likewise, ios_scan scans the data in blocks of
+   IOS_SCAN_CHUNK_SIZE bytes.  */
+
+#define IOS_SCAN_CHUNK_SIZE (1024 * 1024)
+
+/* Writes to devices providing a pwritev operation are coalesced in a
+   per-IOS write buffer, which holds a single contiguous dirty range
+   of device bytes.  The buffer is written out with a single call to
+   pwritev whenever a write is not adjacent to the dirty range, when
+   it is full, and when the IO space is flushed or closed.
+
+   The buffered bytes are stored in chunks of IOS_WB_CHUNK_SIZE
+   bytes, allocated as the dirty range grows.  IOS_WB_NCHUNKS is the
+   maximum number of chunks in the buffer.  */
+
+#define IOS_WB_CHUNK_SIZE 4096
+#define IOS_WB_NCHUNKS 64
+#define IOS_WB_SIZE (IOS_WB_CHUNK_SIZE * IOS_WB_NCHUNKS)
+
+/* Every IO space keeps a generation number, which is increased by
+   every write to the space, and a log of the device ranges written by
+   the last writes.  This allows telling whether some range of the IO
+   space has been written since a given generation.  Adjacent or
+   overlapping writes are coalesced in the same entry of the log.
+
+   IOS_WLOG_SIZE is the number of entries in the log.  */
+
+#define IOS_WLOG_SIZE 32
+
+struct ios_wlog_entry
+{
+  uint64_t generation;
+  ios_dev_off begin;
+  ios_dev_off end;
+};
+
+/* Every IO space also keeps the set of device ranges written since
+   the set was last cleared, as a sorted array of disjoint and non
+   adjacent ranges.  Each range records the generation of the last
+   write touching it.  */
+
+struct ios_dirty_range
+{
+  ios_dev_off begin;
+  ios_dev_off end;
+  uint64_t generation;
+};
+
 /* The following struct implements an instance of an IO space.
 
    `ID' is an unique integer identifying the IO space.
@@ -57,6 +147,34 @@
    DEV is the device operated by the IO space.
    DEV_IF is the interface to use when operating the device.
 
+   CACHE is the page cache of the IO space, or NULL if it hasn't been
+   used yet.  CACHE_BUF is a buffer of IOS_CACHE_READ_AHEAD pages
+   where the data read from the device on cache misses is stored
+   before being inserted in the cache.
+
+   WB_CHUNKS are the chunks of the write buffer.  WB_BEGIN is the
+   device offset of the first byte in the dirty range, and WB_COUNT
+   is the number of bytes in it.  A WB_COUNT of zero means there is
+   no buffered data.
+
+   STATS are the statistics about the accesses to the IO space.
+   DEV_NEXT is the device offset following the last byte accessed by
+   the last device call, and is used to count seeks.  PREFETCH_END is
+   the device offset following the last byte the device was asked to
+   prefetch by the cache.
+
+   GENERATION is the current generation of the IO space.  WLOG is the
+   log of written ranges, used as a ring whose most recent entry is at
+   WLOG_LAST.  WLOG_COUNT is the number of entries in use.
+   WLOG_OLDEST is the oldest generation whose writes are all in the
+   log.
+
+   DIRTY is the set of ranges written in the IO space, which has
+   NDIRTY ranges in use out of DIRTY_SIZE allocated.  If there was
+   not enough memory to record a written range then the whole IO
+   space is considered dirty, and DIRTY_ALL is the generation of the
+   last write.  Otherwise DIRTY_ALL is zero.
+
    NEXT is a pointer to the next open IO space, or NULL.
 
    XXX: add status, saved or not saved.
@@ -70,17 +188,88 @@ struct ios
   struct ios_dev_if *dev_if;
   ios_off bias;
 
+  struct ios_cache *cache;
+  uint8_t *cache_buf;
+
+  uint8_t *wb_chunks[IOS_WB_NCHUNKS];
+  ios_dev_off wb_begin;
+  size_t wb_count;
+
+  struct ios_stats stats;
+  ios_dev_off dev_next;
+  ios_dev_off prefetch_end;
+
+  uint64_t generation;
+  struct ios_wlog_entry wlog[IOS_WLOG_SIZE];
+  int wlog_last;
+  int wlog_count;
+  uint64_t wlog_oldest;
+
+  struct ios_dirty_range *dirty;
+  size_t ndirty;
+  size_t dirty_size;
+  uint64_t dirty_all;
+
   struct ios *next;
 };
 
-/* Next available IOS id.  */
+/* An IO context is a collection of IO spaces, along with the
+   parameters of their caches.
+
+   NEXT_ID is the next available IOS id.
+
+   IO_LIST is the list of IO spaces, and CUR_IO is a pointer to the
+   current one.
 
-static int ios_next_id = 0;
+   CACHE_PAGE_SIZE_BYTES and CACHE_SIZE_BYTES are the size of the
+   pages of the caches and the total size of every cache.
 
-/* List of IO spaces, and pointer to the current one.  */
+   If SHARED_P is set then the context is being used by several
+   threads at the same time, and the accesses to the devices, caches
+   and write buffers of its IO spaces are serialized with LOCK.
 
-static struct ios *io_list;
-static struct ios *cur_io;
+   TRACE is the file where the accesses to the IO spaces are logged,
+   or NULL if they are not traced.  */
+
+struct ios_context
+{
+  int next_id;
+  struct ios *io_list;
+  struct ios *cur_io;
+  size_t cache_page_size_bytes;
+  uint64_t cache_size_bytes;
+  int shared_p;
+  pk_lock_t lock;
+  FILE *trace;
+};
+
+#define IOS_CTX_LOCK()                          \
+  do                                            \
+    {                                           \
+      if (ios_ctx->shared_p)                    \
+        PK_LOCK (ios_ctx->lock);                \
+    }                                           \
+  while (0)
+
+#define IOS_CTX_UNLOCK()                        \
+  do                                            \
+    {                                           \
+      if (ios_ctx->shared_p)                    \
+        PK_UNLOCK (ios_ctx->lock);              \
+    }                                           \
+  while (0)
+
+/* The context used by threads that didn't set one, and the current
+   context of the running thread.  */
+
+static struct ios_context ios_default_context =
+  {
+    0, NULL, NULL,
+    IOS_CACHE_DEFAULT_PAGE_SIZE, IOS_CACHE_DEFAULT_SIZE,
+    0, PK_LOCK_INITIALIZER, NULL
+  };
+
+static PK_THREAD_LOCAL struct ios_context *ios_ctx = &ios_default_context;
 
 /* The available backends are implemented in their own files, and
    provide the following interfaces.  */
@@ -91,19 +280,402 @@ extern struct ios_dev_if ios_dev_stream; /* ios-dev-stream.c */
 #ifdef HAVE_LIBNBD
 extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 #endif
+#if defined HAVE_SYS_MMAN_H && defined HAVE_MMAP
+extern struct ios_dev_if ios_dev_mmap; /* ios-dev-mmap.c */
+#endif
+extern struct ios_dev_if ios_dev_overlay; /* ios-dev-overlay.c */
+extern struct ios_dev_if ios_dev_sub; /* ios-dev-sub.c */
+#ifdef HAVE_ZLIB
+extern struct ios_dev_if ios_dev_zlib; /* ios-dev-zlib.c */
+#endif
+
+int ios_dev_overlay_commit (void *iod);
+void ios_dev_overlay_discard (void *iod);
 
 static struct ios_dev_if *ios_dev_ifs[] =
   {
    &ios_dev_mem,
    &ios_dev_stream,
+   &ios_dev_overlay,
+   &ios_dev_sub,
+#ifdef HAVE_ZLIB
+   &ios_dev_zlib,
+#endif
 #ifdef HAVE_LIBNBD
    &ios_dev_nbd,
+#endif
+#if defined HAVE_SYS_MMAN_H && defined HAVE_MMAP
+   /* Files that can't be mapped are handled by ios_dev_file.  */
+   &ios_dev_mmap,
 #endif
    /* File must be last */
    &ios_dev_file,
    NULL,
   };
 
+/* Return 1 if IO operates on top of another IO space, 0
+   otherwise.  */
+
+static int
+ios_stacked_p (ios io)
+{
+  return (io->dev_if == &ios_dev_overlay
+          || io->dev_if == &ios_dev_sub
+#ifdef HAVE_ZLIB
+          || io->dev_if == &ios_dev_zlib
+#endif
+          );
+}
+
+/* Copy to BUF the bytes of the write buffer of IO overlapping the
+   COUNT bytes starting at the device offset OFFSET.  The rest of BUF
+   is left untouched.  */
+
+static void
+ios_wb_copy_out (ios io, void *buf, size_t count, ios_dev_off offset)
+{
+  ios_dev_off begin, end, wb_end = io->wb_begin + io->wb_count;
+
+  if (io->wb_count == 0
+      || offset >= wb_end || offset + count <= io->wb_begin)
+    return;
+
+  begin = offset > io->wb_begin ? offset : io->wb_begin;
+  end = offset + count < wb_end ? offset + count : wb_end;
+
+  while (begin < end)
+    {
+      size_t pos = begin - io->wb_begin;
+      size_t chunk_offset = pos % IOS_WB_CHUNK_SIZE;
+      size_t n = IOS_WB_CHUNK_SIZE - chunk_offset;
+
+      if (n > end - begin)
+        n = end - begin;
+      memcpy ((uint8_t *) buf + (begin - offset),
+              io->wb_chunks[pos / IOS_WB_CHUNK_SIZE] + chunk_offset, n);
+      begin += n;
+    }
+}
+
+/* Copy the COUNT bytes in BUF into the write buffer of IO, at the
+   device offset OFFSET, which shall be within the capacity of the
+   buffer.  Return IOD_OK on success, IOD_ENOMEM otherwise.  */
+
+static int
+ios_wb_copy_in (ios io, const void *buf, size_t count, ios_dev_off offset)
+{
+  const uint8_t *p = buf;
+  size_t pos = offset - io->wb_begin;
+
+  assert (pos + count <= IOS_WB_SIZE);
+
+  while (count > 0)
+    {
+      uint8_t **chunk = &io->wb_chunks[pos / IOS_WB_CHUNK_SIZE];
+      size_t chunk_offset = pos % IOS_WB_CHUNK_SIZE;
+      size_t n = IOS_WB_CHUNK_SIZE - chunk_offset;
+
+      if (*chunk == NULL
+          && (*chunk = malloc (IOS_WB_CHUNK_SIZE)) == NULL)
+        return IOD_ENOMEM;
+
+      if (n > count)
+        n = count;
+      memcpy (*chunk + chunk_offset, p, n);
+      p += n;
+      pos += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+/* Log an access of COUNT bytes at the device offset OFFSET to the
+   trace file of the IO context, if any.  OP is the kind of access:
+   "read" and "write" for the accesses requested to the IO space, and
+   "pread" and "pwrite" for the ones performed on its device.  */
+
+static inline void
+ios_trace (ios io, const char *op, size_t count, ios_dev_off offset)
+{
+  if (ios_ctx->trace)
+    fprintf (ios_ctx->trace, "%d %s 0x%" PRIx64 " %zu\n",
+             io->id, op, (uint64_t) offset, count);
+}
+
+/* Update the statistics of IO after a request to read or write COUNT
+   bytes at the device offset OFFSET.  */
+
+static inline void
+ios_account (ios io, int write_p, size_t count, ios_dev_off offset)
+{
+  if (write_p)
+    {
+      io->stats.writes++;
+      io->stats.written_bytes += count;
+    }
+  else
+    {
+      io->stats.reads++;
+      io->stats.read_bytes += count;
+    }
+
+  ios_trace (io, write_p ? "write" : "read", count, offset);
+}
+
+/* Record in the log of IO a write of COUNT bytes at the device
+   offset OFFSET, starting a new generation.  */
+
+static void
+ios_wlog_add (ios io, size_t count, ios_dev_off offset)
+{
+  struct ios_wlog_entry *last = &io->wlog[io->wlog_last];
+
+  io->generation++;
+
+  if (io->wlog_count > 0
+      && offset <= last->end && offset + count >= last->begin)
+    {
+      if (offset < last->begin)
+        last->begin = offset;
+      if (offset + count > last->end)
+        last->end = offset + count;
+      last->generation = io->generation;
+      return;
+    }
+
+  io->wlog_last = (io->wlog_last + 1) % IOS_WLOG_SIZE;
+  last = &io->wlog[io->wlog_last];
+
+  /* The evicted entry is forgotten, so its writes can't be told
+     apart anymore.  */
+  if (io->wlog_count == IOS_WLOG_SIZE)
+    io->wlog_oldest = last->generation;
+  else
+    io->wlog_count++;
+
+  last->generation = io->generation;
+  last->begin = offset;
+  last->end = offset + count;
+}
+
+/* Add the COUNT bytes at the device offset OFFSET to the set of
+   dirty ranges of IO.  This must be called after ios_wlog_add, so
+   the range gets the generation of the write.  */
+
+static void
+ios_dirty_add (ios io, size_t count, ios_dev_off offset)
+{
+  ios_dev_off begin = offset, end = offset + count;
+  size_t lo = 0, hi = io->ndirty, i, j;
+
+  if (count == 0)
+    return;
+
+  if (io->dirty_all)
+    {
+      io->dirty_all = io->generation;
+      return;
+    }
+
+  /* Find the first range not ending before BEGIN.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (io->dirty[mid].end < begin)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Merge the ranges overlapping, or adjacent to, the new one.  */
+  for (i = j = lo; j < io->ndirty && io->dirty[j].begin <= end; ++j)
+    {
+      if (io->dirty[j].begin < begin)
+        begin = io->dirty[j].begin;
+      if (io->dirty[j].end > end)
+        end = io->dirty[j].end;
+    }
+
+  if (i == j)
+    {
+      if (io->ndirty == io->dirty_size)
+        {
+          size_t size = io->dirty_size ? io->dirty_size * 2 : 16;
+          struct ios_dirty_range *dirty
+            = realloc (io->dirty, size * sizeof (struct ios_dirty_range));
+
+          if (dirty == NULL)
+            {
+              /* Out of memory.  Grow a neighbour range to cover the
+                 new one, which still gives a superset of the written
+                 data.  If there is none, consider the whole IO space
+                 as dirty.  */
+              if (io->ndirty == 0)
+                {
+                  io->dirty_all = io->generation;
+                  return;
+                }
+              if (i == io->ndirty)
+                i--;
+              if (io->dirty[i].begin < begin)
+                begin = io->dirty[i].begin;
+              if (io->dirty[i].end > end)
+                end = io->dirty[i].end;
+              j = i + 1;
+              goto merge;
+            }
+
+          io->dirty = dirty;
+          io->dirty_size = size;
+        }
+
+      memmove (&io->dirty[i + 1], &io->dirty[i],
+               (io->ndirty - i) * sizeof (struct ios_dirty_range));
+      io->ndirty++;
+      j = i + 1;
+    }
+
+ merge:
+  io->dirty[i].begin = begin;
+  io->dirty[i].end = end;
+  io->dirty[i].generation = io->generation;
+
+  if (j > i + 1)
+    {
+      memmove (&io->dirty[i + 1], &io->dirty[j],
+               (io->ndirty - j) * sizeof (struct ios_dirty_range));
+      io->ndirty -= j - i - 1;
+    }
+}
+
+/* Record a write of COUNT bytes at the device offset OFFSET of IO.  */
+
+static void
+ios_written (ios io, size_t count, ios_dev_off offset)
+{
+  ios_wlog_add (io, count, offset);
+  ios_dirty_add (io, count, offset);
+}
+
+/* Update the statistics of IO after a device call accessing COUNT
+   bytes at the device offset OFFSET, which started at START and
+   returned RET.  */
+
+static void
+ios_dev_account (ios io, int write_p, size_t count, ios_dev_off offset,
+                 struct timespec start, int ret)
+{
+  struct timespec elapsed = timespec_sub (current_timespec (), start);
+
+  if (write_p)
+    {
+      io->stats.dev_writes++;
+      if (ret == IOD_OK)
+        io->stats.dev_written_bytes += count;
+    }
+  else
+    {
+      io->stats.dev_reads++;
+      if (ret == IOD_OK)
+        io->stats.dev_read_bytes += count;
+    }
+
+  if (offset != io->dev_next)
+    io->stats.dev_seeks++;
+  io->dev_next = offset + count;
+  io->stats.dev_nsecs += ((uint64_t) elapsed.tv_sec * 1000000000
+                          + elapsed.tv_nsec);
+
+  ios_trace (io, write_p ? "pwrite" : "pread", count, offset);
+}
+
+/* The following functions perform the device calls of IO, keeping
+   its statistics.  */
+
+static int
+ios_dev_prefetch (ios io, ios_dev_off offset, uint64_t count)
+{
+  ios_trace (io, "prefetch", count, offset);
+  return io->dev_if->prefetch (io->dev, offset, count);
+}
+
+static int
+ios_dev_pread (ios io, void *buf, size_t count, ios_dev_off offset)
+{
+  struct timespec start = current_timespec ();
+  int ret = io->dev_if->pread (io->dev, buf, count, offset);
+
+  ios_dev_account (io, 0 /* write_p */, count, offset, start, ret);
+  return ret;
+}
+
+static int
+ios_dev_pwrite (ios io, const void *buf, size_t count, ios_dev_off offset)
+{
+  struct timespec start = current_timespec ();
+  int ret = io->dev_if->pwrite (io->dev, buf, count, offset);
+
+  ios_dev_account (io, 1 /* write_p */, count, offset, start, ret);
+  return ret;
+}
+
+static int
+ios_dev_pwritev (ios io, const struct iovec *iov, int iovcnt,
+                 ios_dev_off offset)
+{
+  struct timespec start = current_timespec ();
+  size_t count = 0;
+  int i, ret;
+
+  for (i = 0; i < iovcnt; ++i)
+    count += iov[i].iov_len;
+
+  ret = io->dev_if->pwritev (io->dev, iov, iovcnt, offset);
+  ios_dev_account (io, 1 /* write_p */, count, offset, start, ret);
+  return ret;
+}
+
+/* Write out the data in the write buffer of IO, if any.  Return
+   IOD_OK on success, or the error code returned by the device.  */
+
+static int
+ios_wb_flush (ios io)
+{
+  struct iovec iov[IOS_WB_NCHUNKS];
+  size_t remaining = io->wb_count;
+  int i;
+
+  if (io->wb_count == 0)
+    return IOD_OK;
+
+  for (i = 0; remaining > 0; i++)
+    {
+      iov[i].iov_base = io->wb_chunks[i];
+      iov[i].iov_len = (remaining < IOS_WB_CHUNK_SIZE
+                        ? remaining : IOS_WB_CHUNK_SIZE);
+      remaining -= iov[i].iov_len;
+    }
+
+  /* The buffer is emptied even if the write fails, since there is
+     no way to recover from it.  The error is reported to the
+     caller.  */
+  io->wb_count = 0;
+  return ios_dev_pwritev (io, iov, i, io->wb_begin);
+}
+
+/* Return true iff the COUNT bytes starting at the device offset
+   OFFSET overlap the dirty range in the write buffer of IO.  */
+
+static inline bool
+ios_wb_overlap_p (ios io, size_t count, ios_dev_off offset)
+{
+  return (io->wb_count != 0
+          && offset < io->wb_begin + io->wb_count
+          && offset + count > io->wb_begin);
+}
+
 void
 ios_init (void)
 {
@@ -114,8 +686,66 @@ void
 ios_shutdown (void)
 {
   /* Close and free all open IO spaces.  */
-  while (io_list)
-    ios_close (io_list);
+  while (ios_ctx->io_list)
+    ios_close (ios_ctx->io_list);
+}
+
+ios_context
+ios_context_new (void)
+{
+  ios_context ctx = malloc (sizeof (struct ios_context));
+
+  if (ctx)
+    {
+      ctx->next_id = 0;
+      ctx->io_list = NULL;
+      ctx->cur_io = NULL;
+      ctx->cache_page_size_bytes = IOS_CACHE_DEFAULT_PAGE_SIZE;
+      ctx->cache_size_bytes = IOS_CACHE_DEFAULT_SIZE;
+      ctx->shared_p = 0;
+      PK_LOCK_INIT (ctx->lock);
+      ctx->trace = NULL;
+    }
+
+  return ctx;
+}
+
+void
+ios_context_free (ios_context ctx)
+{
+  ios_context saved_ctx = ios_ctx;
+
+  if (!ctx)
+    return;
+
+  ios_ctx = ctx;
+  ios_shutdown ();
+  ios_set_trace_file (NULL);
+  ios_ctx = (saved_ctx == ctx ? &ios_default_context : saved_ctx);
+
+  PK_LOCK_DESTROY (ctx->lock);
+  free (ctx);
+}
+
+ios_context
+ios_context_cur (void)
+{
+  return ios_ctx;
+}
+
+void
+ios_context_set_cur (ios_context ctx)
+{
+  ios_ctx = ctx ? ctx : &ios_default_context;
+}
+
+int
+ios_context_set_shared (ios_context ctx, int shared_p)
+{
+  int prev = ctx->shared_p;
+
+  ctx->shared_p = shared_p;
+  return prev;
 }
 
 int
@@ -132,6 +762,23 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
 
   io->next = NULL;
   io->bias = 0;
+  io->cache = NULL;
+  io->cache_buf = NULL;
+  io->wb_begin = 0;
+  io->wb_count = 0;
+  for (int i = 0; i < IOS_WB_NCHUNKS; ++i)
+    io->wb_chunks[i] = NULL;
+  memset (&io->stats, 0, sizeof (struct ios_stats));
+  io->dev_next = 0;
+  io->prefetch_end = 0;
+  io->generation = 1;
+  io->wlog_last = 0;
+  io->wlog_count = 0;
+  io->wlog_oldest = io->generation;
+  io->dirty = NULL;
+  io->ndirty = 0;
+  io->dirty_size = 0;
+  io->dirty_all = 0;
 
   /* Look for a device interface suitable to operate on the given
      handler.  */
@@ -150,7 +797,7 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
   io->dev_if = *dev_if;
 
   /* Do not re-open an already-open IO space.  */
-  for (ios i = io_list; i; i = i->next)
+  for (ios i = ios_ctx->io_list; i; i = i->next)
     if (STREQ (i->handler, io->handler))
       {
         error = IOS_EOPEN;
@@ -163,15 +810,15 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
     goto error;
 
   /* Increment the id counter after all possible errors are avoided.  */
-  io->id = ios_next_id++;
+  io->id = ios_ctx->next_id++;
 
   /* Add the newly created space to the list, and update the current
      space.  */
-  io->next = io_list;
-  io_list = io;
+  io->next = ios_ctx->io_list;
+  ios_ctx->io_list = io;
 
-  if (!cur_io || set_cur == 1)
-    cur_io = io;
+  if (!ios_ctx->cur_io || set_cur == 1)
+    ios_ctx->cur_io = io;
 
   return io->id;
 
@@ -190,29 +837,40 @@ int
 ios_close (ios io)
 {
   struct ios *tmp;
-  int ret;
+  int ret, wb_ret;
 
   /* XXX: if not saved, ask before closing.  */
 
+  /* Write out any buffered data before closing the device.  */
+  wb_ret = ios_wb_flush (io);
+
   /* Close the device operated by the IO space.
      XXX: Errors may be received from fclose.  What do we do in that case?  */
   ret = io->dev_if->close (io->dev);
+  if (ret == IOD_OK)
+    ret = wb_ret;
 
   /* Unlink the IOS from the list.  */
-  assert (io_list != NULL); /* The list contains at least this IO space.  */
-  if (io_list == io)
-    io_list = io_list->next;
+  /* The list contains at least this IO space.  */
+  assert (ios_ctx->io_list != NULL);
+  if (ios_ctx->io_list == io)
+    ios_ctx->io_list = ios_ctx->io_list->next;
   else
     {
-      for (tmp = io_list; tmp->next != io; tmp = tmp->next)
+      for (tmp = ios_ctx->io_list; tmp->next != io; tmp = tmp->next)
         ;
       tmp->next = io->next;
     }
 
   /* Set the new current IO.  */
-  if (io == cur_io)
-    cur_io = io_list;
-
+  if (io == ios_ctx->cur_io)
+    ios_ctx->cur_io = ios_ctx->io_list;
+
+  ios_cache_free (io->cache);
+  free (io->cache_buf);
+  free (io->dirty);
+  for (int i = 0; i < IOS_WB_NCHUNKS; ++i)
+    free (io->wb_chunks[i]);
   free (io);
 
   return IOD_ERROR_TO_IOS_ERROR (ret);
@@ -233,13 +891,13 @@ ios_handler (ios io)
 ios
 ios_cur (void)
 {
-  return cur_io;
+  return ios_ctx->cur_io;
 }
 
 void
 ios_set_cur (ios io)
 {
-  cur_io = io;
+  ios_ctx->cur_io = io;
 }
 
 ios
@@ -247,7 +905,7 @@ ios_search (const char *handler)
 {
   ios io;
 
-  for (io = io_list; io; io = io->next)
+  for (io = ios_ctx->io_list; io; io = io->next)
     if (STREQ (io->handler, handler))
       break;
 
@@ -259,7 +917,7 @@ ios_search_by_id (int id)
 {
   ios io;
 
-  for (io = io_list; io; io = io->next)
+  for (io = ios_ctx->io_list; io; io = io->next)
     if (io->id == id)
       break;
 
@@ -288,73 +946,520 @@ void
 ios_set_bias (ios io, ios_off bias)
 {
   io->bias = bias;
+
+  /* Every offset in the IO space refers to different data now.  */
+  io->generation++;
+  io->wlog_count = 0;
+  io->wlog_oldest = io->generation;
 }
 
-ios
-ios_begin (void)
+uint64_t
+ios_generation (ios io)
 {
-  return io_list;
+  return io->generation;
 }
 
-bool
-ios_end (const ios io)
+void
+ios_map_dirty (ios io, uint64_t generation, ios_range_fn cb, void *data)
 {
-  return (io == NULL);
+  size_t i;
+
+  if (io->dirty_all)
+    {
+      if (io->dirty_all > generation)
+        cb (0, UINT64_MAX, data);
+      return;
+    }
+
+  for (i = 0; i < io->ndirty; ++i)
+    if (io->dirty[i].generation > generation)
+      cb (io->dirty[i].begin, io->dirty[i].end - io->dirty[i].begin, data);
 }
 
-ios
-ios_next (const ios io)
+void
+ios_clear_dirty (ios io)
 {
-  return io->next;
+  IOS_CTX_LOCK ();
+  io->ndirty = 0;
+  io->dirty_all = 0;
+  IOS_CTX_UNLOCK ();
 }
 
-void
-ios_map (ios_map_fn cb, void *data)
+int
+ios_written_since_p (ios io, uint64_t generation,
+                     ios_off offset, ios_off size)
 {
-  ios io;
+  ios_dev_off begin, end;
+  int i, n, written_p = 0;
 
-  for (io = io_list; io; io = io->next)
-    (*cb) (io, data);
-}
+  /* The IO space below stacked IO spaces can be written without
+     going through them.  */
+  if (ios_stacked_p (io))
+    return 1;
 
-/* Set all except the lowest SIGNIFICANT_BITS of VALUE to zero.  */
-#define IOS_CHAR_GET_LSB(value, significant_bits)                \
-  (*(value) &= 0xFFU >> (CHAR_BIT - (significant_bits)))
+  IOS_CTX_LOCK ();
 
-/* Set all except the highest SIGNIFICANT_BITS of the lowest
-   significant byte of VALUE to zero.  */
-#define IOS_CHAR_GET_MSB(value, significant_bits)                \
-  (*(value) &= 0xFFU << (CHAR_BIT - (significant_bits)))
+  if (generation == io->generation)
+    goto done;
 
-static inline int
-ios_read_int_common (ios io, ios_off offset, int flags,
-                     int bits,
-                     enum ios_endian endian,
-                     uint64_t *value)
-{
-  /* 64 bits might span at most 9 bytes.  */
-  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  written_p = 1;
+  if (generation < io->wlog_oldest)
+    goto done;
 
-  /* Number of signifcant bits in the first byte.  */
-  int firstbyte_bits = 8 - (offset % 8);
+  offset += io->bias;
+  begin = offset / 8;
+  end = (offset + size + 7) / 8;
 
-  /* (Total number of bytes that need to be read) - 1.  */
-  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
+  for (i = io->wlog_last, n = 0; n < io->wlog_count;
+       i = (i + IOS_WLOG_SIZE - 1) % IOS_WLOG_SIZE, ++n)
+    {
+      struct ios_wlog_entry *entry = &io->wlog[i];
 
-  /* Number of significant bits in the last byte.  */
-  int lastbyte_bits = (bits + (offset % 8)) % 8;
-  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+      if (entry->generation > generation
+          && entry->begin < end && begin < entry->end)
+        goto done;
+    }
 
-  /* Read the bytes and clear the unused bits.  */
-  if (io->dev_if->pread (io->dev, c, bytes_minus1 + 1, offset / 8) == IOD_EOF)
-    return IOS_EIOFF;
-  IOS_CHAR_GET_LSB(&c[0], firstbyte_bits);
+  written_p = 0;
 
-  switch (bytes_minus1)
-  {
-  case 0:
-    *value = c[0] >> (8 - lastbyte_bits);
-    return IOS_OK;
+ done:
+  IOS_CTX_UNLOCK ();
+  return written_p;
+}
+
+int
+ios_refresh (ios io)
+{
+  ios_dev_off old_size, size, end, begin = 0, *page_nos = NULL;
+  size_t npages = 0, page_size = 0, i;
+  int ret;
+
+  if (io->dev_if->changed == NULL)
+    return IOS_OK;
+
+  IOS_CTX_LOCK ();
+  ret = io->dev_if->changed (io->dev, &old_size);
+  if (ret != 1)
+    {
+      IOS_CTX_UNLOCK ();
+      return ret == 0 ? IOS_OK : IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  size = io->dev_if->size (io->dev);
+  end = size > old_size ? size : old_size;
+
+  /* The device doesn't know what was modified, but the pages in the
+     cache can be compared with the new contents of the device.  Only
+     the pages that differ are dropped, and everything else is assumed
+     to be modified.  */
+  if (io->cache != NULL)
+    {
+      page_size = ios_cache_page_size (io->cache);
+      page_nos = ios_cache_pages (io->cache, &npages);
+      if (page_nos == NULL)
+        ios_cache_clear (io->cache);
+    }
+
+  for (i = 0; i < npages; ++i)
+    {
+      ios_dev_off page_begin = page_nos[i] * page_size;
+      size_t count, new_count = 0;
+      const uint8_t *data = ios_cache_peek (io->cache, page_nos[i], &count);
+
+      if (page_begin < size)
+        new_count = (size - page_begin < page_size
+                     ? size - page_begin : page_size);
+
+      if (new_count == count
+          && ios_dev_pread (io, io->cache_buf, count, page_begin) == IOD_OK)
+        {
+          ios_wb_copy_out (io, io->cache_buf, count, page_begin);
+          if (memcmp (data, io->cache_buf, count) == 0)
+            {
+              if (begin < page_begin)
+                ios_written (io, page_begin - begin, begin);
+              begin = page_begin + count;
+              continue;
+            }
+        }
+
+      ios_cache_invalidate (io->cache, page_begin, page_size);
+    }
+  free (page_nos);
+
+  if (begin < end)
+    ios_written (io, end - begin, begin);
+
+  IOS_CTX_UNLOCK ();
+  return IOS_OK;
+}
+
+int
+ios_get_change_fd (ios io)
+{
+  if (io->dev_if->get_change_fd == NULL)
+    return -1;
+  return io->dev_if->get_change_fd (io->dev);
+}
+
+ios
+ios_begin (void)
+{
+  return ios_ctx->io_list;
+}
+
+bool
+ios_end (const ios io)
+{
+  return (io == NULL);
+}
+
+ios
+ios_next (const ios io)
+{
+  return io->next;
+}
+
+void
+ios_map (ios_map_fn cb, void *data)
+{
+  ios io;
+
+  for (io = ios_ctx->io_list; io; io = io->next)
+    (*cb) (io, data);
+}
+
+/* Return the page cache of IO, creating it if needed.  Return NULL
+   if IO doesn't use a cache, or if there is not enough memory.  */
+
+static struct ios_cache *
+ios_cache_get (ios io)
+{
+  size_t npages;
+
+  if (io->cache != NULL)
+    return io->cache;
+
+  if (ios_ctx->cache_size_bytes == 0 || io->dev_if->get_pointer != NULL)
+    return NULL;
+
+  /* Stacked devices read through the cache of the IO space below
+     them, which may be written behind their back.  */
+  if (ios_stacked_p (io))
+    return NULL;
+
+  npages = ios_ctx->cache_size_bytes / ios_ctx->cache_page_size_bytes;
+  if (npages == 0)
+    npages = 1;
+
+  io->cache_buf = malloc (IOS_CACHE_READ_AHEAD * ios_ctx->cache_page_size_bytes);
+  io->cache = ios_cache_new (ios_ctx->cache_page_size_bytes, npages);
+  if (io->cache_buf == NULL || io->cache == NULL)
+    {
+      ios_cache_free (io->cache);
+      free (io->cache_buf);
+      io->cache = NULL;
+      io->cache_buf = NULL;
+    }
+
+  return io->cache;
+}
+
+/* Read the page PAGE_NO from the device of IO into its cache, along
+   with the following pages not in the cache, up to
+   IOS_CACHE_READ_AHEAD pages.  Return the data of the page, or NULL
+   if the device doesn't have at least MIN_COUNT bytes in it.
+
+   The pages never extend past the current size of the device, so
+   devices like streams are never asked for data they don't have
+   yet.  */
+
+static uint8_t *
+ios_cache_fill (ios io, ios_dev_off page_no, size_t min_count)
+{
+  struct ios_cache *cache = io->cache;
+  ios_dev_off begin = page_no * ios_ctx->cache_page_size_bytes;
+  ios_dev_off dev_size = io->dev_if->size (io->dev);
+  size_t page_size = ios_ctx->cache_page_size_bytes;
+  size_t npages, read_count, i;
+  uint8_t *data = NULL;
+  int sequential_p = (begin == io->dev_next);
+
+  if (begin > dev_size || min_count > dev_size - begin)
+    return NULL;
+
+  for (npages = 1;
+       (npages < IOS_CACHE_READ_AHEAD
+        && begin + npages * page_size < dev_size
+        && !ios_cache_present_p (cache, page_no + npages));
+       npages++)
+    ;
+
+  read_count = (dev_size - begin < npages * page_size
+                ? dev_size - begin : npages * page_size);
+  if (ios_dev_pread (io, io->cache_buf, read_count, begin) != IOD_OK)
+    return NULL;
+  ios_wb_copy_out (io, io->cache_buf, read_count, begin);
+
+  /* Keep the prefetched data at least half the prefetch window ahead
+     of the reads, with one device call per half window.  */
+  if (sequential_p
+      && io->dev_if->prefetch != NULL
+      && begin + read_count + IOS_PREFETCH_SIZE / 2 > io->prefetch_end)
+    {
+      ios_dev_off from = begin + read_count;
+
+      if (io->prefetch_end > from)
+        from = io->prefetch_end;
+      io->prefetch_end = begin + read_count + IOS_PREFETCH_SIZE;
+      ios_dev_prefetch (io, from, io->prefetch_end - from);
+    }
+
+  /* Insert the pages in reverse order, so the requested page is the
+     most recently used one and is not replaced by the others.  */
+  for (i = npages; i-- > 0;)
+    {
+      size_t n = (read_count - i * page_size < page_size
+                  ? read_count - i * page_size : page_size);
+
+      data = ios_cache_insert (cache, page_no + i, n);
+      if (data == NULL)
+        return NULL;
+      memcpy (data, io->cache_buf + i * page_size, n);
+    }
+
+  return data;
+}
+
+/* Read COUNT bytes at the device offset OFFSET into BUF through the
+   page cache of IO.  Return IOD_OK on success, IOD_ERROR otherwise.  */
+
+static int
+ios_cache_read (ios io, void *buf, size_t count, ios_dev_off offset)
+{
+  size_t page_size = ios_ctx->cache_page_size_bytes;
+  ios_dev_off end = offset + count;
+  uint8_t *p = buf;
+
+  while (offset < end)
+    {
+      ios_dev_off page_no = offset / page_size;
+      ios_dev_off page_begin = page_no * page_size;
+      size_t needed = (end - page_begin < page_size
+                       ? end - page_begin : page_size);
+      size_t page_count, skip;
+      uint8_t *data;
+
+      data = ios_cache_lookup (io->cache, page_no, needed, &page_count);
+      if (data == NULL
+          && (data = ios_cache_fill (io, page_no, needed)) == NULL)
+        return IOD_ERROR;
+
+      skip = offset - page_begin;
+      memcpy (p, data + skip, needed - skip);
+      p += needed - skip;
+      offset = page_begin + needed;
+    }
+
+  return IOD_OK;
+}
+
+/* Read COUNT bytes at the device offset OFFSET into BUF, serving
+   them from the write buffer or the page cache of IO whenever
+   possible.  Return IOD_OK on success, or the error code returned by
+   the device.  */
+
+static int
+ios_read_bytes_1 (ios io, void *buf, size_t count, ios_dev_off offset,
+                  int flags)
+{
+  int ret;
+
+  /* Data that has not been written out yet can't be read from the
+     device.  */
+  if (io->wb_count != 0
+      && offset >= io->wb_begin
+      && offset + count <= io->wb_begin + io->wb_count)
+    {
+      ios_wb_copy_out (io, buf, count, offset);
+      return IOD_OK;
+    }
+
+  if (!(flags & IOS_F_BYPASS_CACHE)
+      && count <= ios_ctx->cache_page_size_bytes
+      && ios_cache_get (io) != NULL
+      && ios_cache_read (io, buf, count, offset) == IOD_OK)
+    return IOD_OK;
+
+  /* Fall back to read directly from the device.  If that fails
+     because the requested data is partially buffered, write it out
+     and try again.  */
+  ret = ios_dev_pread (io, buf, count, offset);
+  if (ret != IOD_OK && ios_wb_overlap_p (io, count, offset))
+    {
+      ret = ios_wb_flush (io);
+      if (ret == IOD_OK)
+        ret = ios_dev_pread (io, buf, count, offset);
+    }
+  else if (ret == IOD_OK)
+    ios_wb_copy_out (io, buf, count, offset);
+
+  return ret;
+}
+
+/* Write COUNT bytes from BUF at the device offset OFFSET, keeping
+   the page cache of IO coherent with the written data.  The
+   data is buffered if the device supports it.  Return IOD_OK on
+   success, or the error code returned by the device.  */
+
+static int
+ios_write_bytes_1 (ios io, const void *buf, size_t count,
+                   ios_dev_off offset, int flags)
+{
+  int ret;
+
+  if (io->dev_if->pwritev
+      && !(flags & IOS_F_BYPASS_CACHE)
+      && count <= IOS_WB_SIZE
+      && (io->dev_if->get_flags (io->dev) & IOS_F_WRITE))
+    {
+      /* Start a new dirty range unless the written data is adjacent
+         to, or overlaps, the current one and fits in the buffer.  */
+      if (io->wb_count != 0
+          && !(offset >= io->wb_begin
+               && offset <= io->wb_begin + io->wb_count
+               && offset + count - io->wb_begin <= IOS_WB_SIZE))
+        {
+          ret = ios_wb_flush (io);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      if (io->wb_count == 0)
+        io->wb_begin = offset;
+
+      ret = ios_wb_copy_in (io, buf, count, offset);
+      if (ret == IOD_OK)
+        {
+          if (offset + count - io->wb_begin > io->wb_count)
+            io->wb_count = offset + count - io->wb_begin;
+        }
+      else
+        {
+          /* Out of memory.  Write out the buffer and proceed
+             without it.  */
+          ret = ios_wb_flush (io);
+          if (ret == IOD_OK)
+            ret = ios_dev_pwrite (io, buf, count, offset);
+        }
+    }
+  else
+    {
+      /* Buffered data can't be written after this.  */
+      ret = IOD_OK;
+      if (ios_wb_overlap_p (io, count, offset))
+        ret = ios_wb_flush (io);
+      if (ret == IOD_OK)
+        ret = ios_dev_pwrite (io, buf, count, offset);
+    }
+
+  if (ret == IOD_OK && io->cache != NULL)
+    ios_cache_write (io->cache, buf, count, offset);
+
+  return ret;
+}
+
+/* The following two functions are the entry points to the above,
+   and serialize the accesses to IO when its context is shared.  */
+
+static int
+ios_read_bytes (ios io, void *buf, size_t count, ios_dev_off offset,
+                int flags)
+{
+  int ret;
+
+  IOS_CTX_LOCK ();
+  ios_account (io, 0 /* write_p */, count, offset);
+  ret = ios_read_bytes_1 (io, buf, count, offset, flags);
+  IOS_CTX_UNLOCK ();
+  return ret;
+}
+
+static int
+ios_write_bytes (ios io, const void *buf, size_t count, ios_dev_off offset,
+                 int flags)
+{
+  int ret;
+
+  IOS_CTX_LOCK ();
+  ios_account (io, 1 /* write_p */, count, offset);
+  ios_written (io, count, offset);
+  ret = ios_write_bytes_1 (io, buf, count, offset, flags);
+  IOS_CTX_UNLOCK ();
+  return ret;
+}
+
+int
+ios_base_pread (ios io, void *buf, size_t count, uint64_t offset)
+{
+  ios_account (io, 0 /* write_p */, count, offset);
+  return ios_read_bytes_1 (io, buf, count, offset, 0);
+}
+
+int
+ios_base_prefetch (ios io, uint64_t offset, uint64_t count)
+{
+  if (io->dev_if->prefetch == NULL)
+    return IOD_OK;
+  return ios_dev_prefetch (io, offset, count);
+}
+
+int
+ios_base_pwrite (ios io, const void *buf, size_t count, uint64_t offset)
+{
+  ios_account (io, 1 /* write_p */, count, offset);
+  ios_written (io, count, offset);
+  return ios_write_bytes_1 (io, buf, count, offset, 0);
+}
+
+/* Set all except the lowest SIGNIFICANT_BITS of VALUE to zero.  */
+#define IOS_CHAR_GET_LSB(value, significant_bits)                \
+  (*(value) &= 0xFFU >> (CHAR_BIT - (significant_bits)))
+
+/* Set all except the highest SIGNIFICANT_BITS of the lowest
+   significant byte of VALUE to zero.  */
+#define IOS_CHAR_GET_MSB(value, significant_bits)                \
+  (*(value) &= 0xFFU << (CHAR_BIT - (significant_bits)))
+
+static inline int
+ios_read_int_common (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     uint64_t *value)
+{
+  /* 64 bits might span at most 9 bytes.  */
+  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  /* Number of signifcant bits in the first byte.  */
+  int firstbyte_bits = 8 - (offset % 8);
+
+  /* (Total number of bytes that need to be read) - 1.  */
+  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
+
+  /* Number of significant bits in the last byte.  */
+  int lastbyte_bits = (bits + (offset % 8)) % 8;
+  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+
+  /* Read the bytes and clear the unused bits.  */
+  if (ios_read_bytes (io, c, bytes_minus1 + 1, offset / 8, flags) == IOD_EOF)
+    return IOS_EIOFF;
+  IOS_CHAR_GET_LSB(&c[0], firstbyte_bits);
+
+  switch (bytes_minus1)
+  {
+  case 0:
+    *value = c[0] >> (8 - lastbyte_bits);
+    return IOS_OK;
 
   case 1:
     IOS_CHAR_GET_MSB(&c[1], lastbyte_bits);
@@ -689,6 +1794,83 @@ ios_read_int_common (ios io, ios_off offset, int flags,
   }
 }
 
+/* Byte endianness of the host.  */
+
+#ifdef WORDS_BIGENDIAN
+# define IOS_ENDIAN_HOST IOS_ENDIAN_MSB
+#else
+# define IOS_ENDIAN_HOST IOS_ENDIAN_LSB
+#endif
+
+/* Read an unsigned integer of 8, 16, 32 or 64 BITS at the byte
+   aligned device OFFSET, and put its value in VALUE.  The bytes are
+   accessed in place if the device stores them in memory, and are
+   decoded with a single load plus a byte swap if ENDIAN is not the
+   endianness of the host.
+
+   This is the fast path for the integers most commonly found in
+   binary formats.  */
+
+static inline int
+ios_read_uint_aligned (ios io, ios_dev_off offset, int flags,
+                       int bits, enum ios_endian endian, uint64_t *value)
+{
+  uint8_t buf[8];
+  const uint8_t *p = NULL;
+
+  if (io->dev_if->get_pointer != NULL
+      && !ios_wb_overlap_p (io, bits / 8, offset))
+    p = io->dev_if->get_pointer (io->dev, offset, bits / 8, 0);
+
+  if (p == NULL)
+    {
+      if (ios_read_bytes (io, buf, bits / 8, offset, flags) == IOD_EOF)
+        return IOS_EIOFF;
+      p = buf;
+    }
+  else
+    ios_account (io, 0 /* write_p */, bits / 8, offset);
+
+  switch (bits)
+    {
+    case 8:
+      *value = p[0];
+      break;
+    case 16:
+      {
+        uint16_t v;
+
+        memcpy (&v, p, sizeof (v));
+        *value = endian == IOS_ENDIAN_HOST ? v : bswap_16 (v);
+        break;
+      }
+    case 32:
+      {
+        uint32_t v;
+
+        memcpy (&v, p, sizeof (v));
+        *value = endian == IOS_ENDIAN_HOST ? v : bswap_32 (v);
+        break;
+      }
+    case 64:
+      {
+        uint64_t v;
+
+        memcpy (&v, p, sizeof (v));
+        *value = endian == IOS_ENDIAN_HOST ? v : bswap_64 (v);
+        break;
+      }
+    default:
+      assert (0);
+    }
+
+  return IOS_OK;
+}
+
+#define IOS_ALIGNED_KERNEL_P(offset, bits)                      \
+  ((offset) % 8 == 0                                            \
+   && ((bits) == 8 || (bits) == 16 || (bits) == 32 || (bits) == 64))
+
 int
 ios_read_int (ios io, ios_off offset, int flags,
               int bits,
@@ -699,11 +1881,23 @@ ios_read_int (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
+  /* Fastest track for byte-aligned integers of the usual sizes.  */
+  if (IOS_ALIGNED_KERNEL_P (offset, bits))
+    {
+      uint64_t u;
+      int ret = ios_read_uint_aligned (io, offset / 8, flags, bits,
+                                       endian, &u);
+
+      if (ret == IOS_OK)
+        *value = (int64_t) (u << (64 - bits)) >> (64 - bits);
+      return ret;
+    }
+
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
     {
       uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
+      if (ios_read_bytes (io, c, bits / 8, offset / 8, flags) == IOD_EOF)
         return IOS_EIOFF;
 
       switch (bits) {
@@ -823,11 +2017,16 @@ ios_read_uint (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
+  /* Fastest track for byte-aligned integers of the usual sizes.  */
+  if (IOS_ALIGNED_KERNEL_P (offset, bits))
+    return ios_read_uint_aligned (io, offset / 8, flags, bits, endian,
+                                  value);
+
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
     {
       uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
+      if (ios_read_bytes (io, c, bits / 8, offset / 8, flags) == IOD_EOF)
         return IOS_EIOFF;
 
       switch (bits) {
@@ -917,67 +2116,135 @@ static int realloc_string (char **str, size_t newsize)
   return IOS_OK;
 }
 
-int
-ios_read_string (ios io, ios_off offset, int flags, char **value)
+/* Read COUNT bytes starting at the bit OFFSET of IO into DATA.  The
+   IOS bias shall be already applied to OFFSET.  */
+
+static int
+ios_read_bits (ios io, ios_off offset, int flags, void *data,
+               uint64_t count)
 {
-  char *str = NULL;
-  size_t i = 0;
+  uint8_t *p = data;
   int ret;
 
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
-
   if (offset % 8 == 0)
     {
-      /* This is the fast case: the string is aligned to a byte
-         boundary.  We just read bytes from the IOD until either EOF
-         or a NULL byte.  */
-
-      do
-        {
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
-
-          if (io->dev_if->pread (io->dev, &str[i], 1,
-                                 offset / 8 + i) == IOD_EOF)
-            {
-              ret = IOS_EIOFF;
-              goto error;
-            }
-        }
-      while (str[i++] != '\0');
+      /* This is the fast case: the data is aligned to a byte
+         boundary.  Big requests go to the device in one go.  */
+      ret = ios_read_bytes (io, p, count, offset / 8, flags);
+      if (ret == IOD_EOF)
+        return IOS_EIOFF;
+      return IOD_ERROR_TO_IOS_ERROR (ret);
     }
   else
     {
-      /* The string is not aligned to a byte boundary.  Instead of
-         reading bytes from the IOD, we use the IOS to read 8-byte
-         unsigned integers.  */
-
-      do
+      /* The data is not aligned to a byte boundary.  Read it in
+         blocks having an extra trailing byte, and shift the bits in
+         place, a 64-bit word at a time.  */
+      uint8_t c[IOS_RAW_CHUNK_SIZE + 1];
+      int shift = offset % 8;
+      ios_dev_off off = offset / 8;
+
+      while (count > 0)
         {
-          uint64_t abyte;
+          size_t n = count < IOS_RAW_CHUNK_SIZE ? count : IOS_RAW_CHUNK_SIZE;
+          size_t i;
+
+          ret = ios_read_bytes (io, c, n + 1, off, flags);
+          if (ret == IOD_EOF)
+            return IOS_EIOFF;
+          if (ret != IOD_OK)
+            return IOD_ERROR_TO_IOS_ERROR (ret);
 
-          if (i % 128 == 0)
+          for (i = 0; i + 8 <= n; i += 8)
             {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
+              uint64_t w;
+
+              memcpy (&w, c + i, sizeof (w));
+              if (IOS_ENDIAN_HOST == IOS_ENDIAN_LSB)
+                w = bswap_64 (w);
+              w = (w << shift) | (c[i + 8] >> (8 - shift));
+              if (IOS_ENDIAN_HOST == IOS_ENDIAN_LSB)
+                w = bswap_64 (w);
+              memcpy (p + i, &w, sizeof (w));
             }
+          for (; i < n; i++)
+            p[i] = (c[i] << shift) | (c[i + 1] >> (8 - shift));
 
-          ret = ios_read_uint (io, offset, flags, 8,
-                               IOS_ENDIAN_MSB, /* Arbitrary.  */
-                               &abyte);
-          if (ret == IOS_EIOFF)
+          p += n;
+          off += n;
+          count -= n;
+        }
+    }
+
+  return IOS_OK;
+}
+
+/* Strings are read in blocks, starting with IOS_STRING_BLOCK_MIN
+   bytes and doubling the size of the block up to
+   IOS_STRING_BLOCK_MAX bytes, so short strings don't read much more
+   data than needed and long strings are read in a few device
+   accesses.  */
+
+#define IOS_STRING_BLOCK_MIN 64
+#define IOS_STRING_BLOCK_MAX 4096
+
+int
+ios_read_string (ios io, ios_off offset, int flags, char **value)
+{
+  char *str = NULL, *nul;
+  size_t len = 0, size = 0, block = IOS_STRING_BLOCK_MIN;
+  int ret;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  for (;;)
+    {
+      /* Bytes needed to read N bytes at OFFSET, besides N.  */
+      uint64_t extra = offset % 8 != 0;
+      uint64_t io_size = ios_size (io) / 8;
+      uint64_t byte = offset / 8;
+      size_t n = block;
+
+      /* Don't read past the end of the IO space, unless there is
+         nothing left there.  It is up to the device to either
+         provide more data, like streams do, or to fail.  */
+      if (byte + extra < io_size)
+        {
+          if (io_size - byte - extra < n)
+            n = io_size - byte - extra;
+        }
+      else
+        n = 1;
+
+      if (len + n > size)
+        {
+          size = size + n > 2 * size ? size + n : 2 * size;
+          if ((ret = realloc_string (&str, size)) < 0)
             goto error;
+        }
 
-          str[i] = (char) abyte;
-          offset += 8;
+      ret = ios_read_bits (io, offset, flags, str + len, n);
+      if (ret != IOS_OK)
+        goto error;
+
+      nul = memchr (str + len, '\0', n);
+      if (nul != NULL)
+        {
+          len = nul - str + 1;
+          break;
         }
-      while (str[i++] != '\0');
+
+      len += n;
+      offset += n * 8;
+      if (block < IOS_STRING_BLOCK_MAX)
+        block *= 2;
     }
 
+  /* Don't waste the memory of the bytes read past the string.  */
+  if (len < size)
+    realloc_string (&str, len);
+
   *value = str;
   return IOS_OK;
 
@@ -986,6 +2253,168 @@ error:
   return ret;
 }
 
+int
+ios_read_raw (ios io, ios_off offset, int flags, void *data, uint64_t count)
+{
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  return ios_read_bits (io, offset, flags, data, count);
+}
+
+/* Gather the 7-bit groups of the eight LEB128 bytes in W, the first
+   byte being the least significant one, into a 56-bit value.  */
+
+static inline uint64_t
+ios_leb128_gather (uint64_t w)
+{
+  w &= 0x7f7f7f7f7f7f7f7fULL;
+  w = (w & 0x007f007f007f007fULL) | ((w & 0x7f007f007f007f00ULL) >> 1);
+  w = (w & 0x00003fff00003fffULL) | ((w & 0x3fff00003fff0000ULL) >> 2);
+  w = (w & 0x000000000fffffffULL) | ((w & 0x0fffffff00000000ULL) >> 4);
+  return w;
+}
+
+int
+ios_read_leb128 (ios io, ios_off offset, int flags, int signed_p,
+                 uint64_t *value, uint64_t *size)
+{
+  /* The zeroes past the read bytes have the continuation bit
+     clear.  */
+  uint8_t c[IOS_LEB128_MAX_BYTES] = {0};
+  uint64_t extra, io_size, byte, n = IOS_LEB128_MAX_BYTES;
+  uint64_t w, stop, res;
+  int ret, len, i;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  /* Don't read past the end of the IO space, as encoded values are
+     usually much shorter than the maximum.  */
+  extra = offset % 8 != 0;
+  io_size = ios_size (io) / 8;
+  byte = offset / 8;
+  if (byte + extra < io_size)
+    {
+      if (io_size - byte - extra < n)
+        n = io_size - byte - extra;
+    }
+  else
+    n = 1;
+
+  ret = ios_read_bits (io, offset, flags, c, n);
+  if (ret != IOS_OK)
+    return ret;
+
+  /* Look for the last byte, which is the first one having the
+     continuation bit clear, in the first eight bytes at once.  */
+  w = 0;
+  for (i = 7; i >= 0; i--)
+    w = (w << 8) | c[i];
+  stop = ~w & 0x8080808080808080ULL;
+
+  if (stop != 0)
+    {
+#if defined __GNUC__
+      len = __builtin_ctzll (stop) / 8 + 1;
+#else
+      for (len = 1; c[len - 1] & 0x80; len++)
+        ;
+#endif
+      if (len < 8)
+        w &= (UINT64_C (1) << (len * 8)) - 1;
+      res = ios_leb128_gather (w);
+
+      if (signed_p && (c[len - 1] & 0x40))
+        res |= ~UINT64_C (0) << (len * 7);
+    }
+  else if (!(c[8] & 0x80))
+    {
+      /* Nine bytes encode 63 bits.  */
+      len = 9;
+      res = ios_leb128_gather (w) | ((uint64_t) c[8] << 56);
+      if (signed_p && (c[8] & 0x40))
+        res |= UINT64_C (1) << 63;
+    }
+  else if (!(c[9] & 0x80))
+    {
+      /* Only one bit of the tenth byte fits in 64 bits.  In signed
+         values the rest of the bits are copies of it.  */
+      len = 10;
+      if (signed_p ? (c[9] != 0 && c[9] != 0x7f) : c[9] > 1)
+        return IOS_EINVAL;
+      res = (ios_leb128_gather (w)
+             | ((uint64_t) (c[8] & 0x7f) << 56)
+             | ((uint64_t) (c[9] & 1) << 63));
+    }
+  else
+    return IOS_EINVAL;
+
+  /* The last byte is past the end of the IO space.  */
+  if (len > n)
+    return IOS_EIOFF;
+
+  *value = res;
+  *size = len;
+  return IOS_OK;
+}
+
+/* Convert between the 16 bytes encoding an unsigned 128-bit integer
+   with the ENDIAN byte endianness and its two 64-bit limbs, the most
+   significant first.  */
+
+static inline void
+ios_uint128_from_bytes (const uint8_t c[16], enum ios_endian endian,
+                        uint64_t value[2])
+{
+  uint64_t w0, w1;
+
+  memcpy (&w0, c, sizeof (w0));
+  memcpy (&w1, c + 8, sizeof (w1));
+  if (endian != IOS_ENDIAN_HOST)
+    {
+      w0 = bswap_64 (w0);
+      w1 = bswap_64 (w1);
+    }
+
+  value[0] = endian == IOS_ENDIAN_MSB ? w0 : w1;
+  value[1] = endian == IOS_ENDIAN_MSB ? w1 : w0;
+}
+
+static inline void
+ios_uint128_to_bytes (const uint64_t value[2], enum ios_endian endian,
+                      uint8_t c[16])
+{
+  uint64_t w0 = endian == IOS_ENDIAN_MSB ? value[0] : value[1];
+  uint64_t w1 = endian == IOS_ENDIAN_MSB ? value[1] : value[0];
+
+  if (endian != IOS_ENDIAN_HOST)
+    {
+      w0 = bswap_64 (w0);
+      w1 = bswap_64 (w1);
+    }
+  memcpy (c, &w0, sizeof (w0));
+  memcpy (c + 8, &w1, sizeof (w1));
+}
+
+int
+ios_read_uint128 (ios io, ios_off offset, int flags,
+                  enum ios_endian endian, uint64_t value[2])
+{
+  uint8_t c[16];
+  int ret;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  ret = ios_read_bits (io, offset, flags, c, sizeof (c));
+  if (ret != IOS_OK)
+    return ret;
+
+  ios_uint128_from_bytes (c, endian, value);
+  return IOS_OK;
+}
+
 static inline int
 ios_write_int_fast (ios io, ios_off offset, int flags,
                     int bits,
@@ -1138,7 +2567,7 @@ ios_write_int_fast (ios io, ios_off offset, int flags,
       break;
     }
 
-  if (io->dev_if->pwrite (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
+  if (ios_write_bytes (io, c, bits / 8, offset / 8, flags) == IOD_EOF)
     return IOS_EIOFF;
   return IOS_OK;
 }
@@ -1446,6 +2875,160 @@ ios_write_int_common (ios io, ios_off offset, int flags,
   }
 }
 
+int
+ios_get_buffer_stats (ios io, uint64_t *chunk_size, uint64_t *nchunks,
+                      uint64_t *max_nchunks)
+{
+  if (io->dev_if->get_buffer_stats == NULL)
+    return IOS_ERROR;
+
+  return IOD_ERROR_TO_IOS_ERROR (io->dev_if->get_buffer_stats (io->dev,
+                                                               chunk_size,
+                                                               nchunks,
+                                                               max_nchunks));
+}
+
+/* Free the page caches of all the open IO spaces, so they get created
+   again with the current cache parameters.  */
+
+static void
+ios_cache_reset (void)
+{
+  for (ios io = ios_ctx->io_list; io; io = io->next)
+    {
+      ios_cache_free (io->cache);
+      free (io->cache_buf);
+      io->cache = NULL;
+      io->cache_buf = NULL;
+    }
+}
+
+uint64_t
+ios_get_cache_size (void)
+{
+  return ios_ctx->cache_size_bytes;
+}
+
+void
+ios_set_cache_size (uint64_t size)
+{
+  ios_ctx->cache_size_bytes = size;
+  ios_cache_reset ();
+}
+
+uint64_t
+ios_get_cache_page_size (void)
+{
+  return ios_ctx->cache_page_size_bytes;
+}
+
+int
+ios_set_cache_page_size (uint64_t size)
+{
+  if (size < IOS_CACHE_MIN_PAGE_SIZE
+      || size > IOS_CACHE_MAX_PAGE_SIZE
+      || (size & (size - 1)) != 0)
+    return IOS_EINVAL;
+
+  ios_ctx->cache_page_size_bytes = size;
+  ios_cache_reset ();
+  return IOS_OK;
+}
+
+int
+ios_get_cache_stats (ios io, uint64_t *hits, uint64_t *misses)
+{
+  if (io->cache == NULL)
+    {
+      *hits = *misses = 0;
+      return ios_ctx->cache_size_bytes == 0 || io->dev_if->get_pointer != NULL
+        ? IOS_ERROR : IOS_OK;
+    }
+
+  ios_cache_get_stats (io->cache, hits, misses);
+  return IOS_OK;
+}
+
+void
+ios_get_stats (ios io, struct ios_stats *stats)
+{
+  IOS_CTX_LOCK ();
+  *stats = io->stats;
+  if (io->cache != NULL)
+    ios_cache_get_stats (io->cache, &stats->cache_hits,
+                         &stats->cache_misses);
+  else
+    stats->cache_hits = stats->cache_misses = 0;
+  IOS_CTX_UNLOCK ();
+}
+
+void
+ios_reset_stats (ios io)
+{
+  IOS_CTX_LOCK ();
+  memset (&io->stats, 0, sizeof (struct ios_stats));
+  if (io->cache != NULL)
+    ios_cache_reset_stats (io->cache);
+  IOS_CTX_UNLOCK ();
+}
+
+int
+ios_set_trace_file (const char *filename)
+{
+  FILE *trace = NULL;
+
+  if (filename)
+    {
+      trace = fopen (filename, "w");
+      if (trace == NULL)
+        return IOS_ERROR;
+    }
+
+  IOS_CTX_LOCK ();
+  if (ios_ctx->trace)
+    fclose (ios_ctx->trace);
+  ios_ctx->trace = trace;
+  IOS_CTX_UNLOCK ();
+
+  return IOS_OK;
+}
+
+void *
+ios_direct_pointer (ios io, ios_off offset, size_t count, int write_p)
+{
+  ios_dev_off dev_offset;
+  void *ptr;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  if (io->dev_if->get_pointer == NULL || offset % 8 != 0)
+    return NULL;
+
+  dev_offset = offset / 8;
+
+  /* Buffered data has not reached the device yet.  */
+  if (ios_wb_overlap_p (io, count, dev_offset))
+    return NULL;
+
+  /* The page cache would get out of sync with the modified
+     bytes.  */
+  if (write_p && io->cache != NULL)
+    ios_cache_invalidate (io->cache, dev_offset, count);
+
+  ptr = io->dev_if->get_pointer (io->dev, dev_offset, count, write_p);
+  if (ptr)
+    {
+      ios_account (io, write_p, count, dev_offset);
+
+      /* The data is assumed to be written as soon as the pointer is
+         handed out.  */
+      if (write_p)
+        ios_written (io, count, dev_offset);
+    }
+  return ptr;
+}
+
 int
 ios_write_int (ios io, ios_off offset, int flags,
                int bits,
@@ -1502,8 +3085,8 @@ ios_write_string (ios io, ios_off offset, int flags,
       p = value;
       do
         {
-          if (io->dev_if->pwrite (io->dev, p, 1,
-                                  offset / 8 + p - value) == IOD_EOF)
+          if (ios_write_bytes (io, p, 1, offset / 8 + p - value,
+                               flags) == IOD_EOF)
             return IOS_EIOFF;
         }
       while (*(p++) != '\0');
@@ -1532,14 +3115,630 @@ ios_write_string (ios io, ios_off offset, int flags,
   return IOS_OK;
 }
 
+/* Write COUNT bytes from DATA starting at the bit OFFSET of IO.  The
+   IOS bias shall be already applied to OFFSET.  */
+
+static int
+ios_write_bits (ios io, ios_off offset, int flags, const void *data,
+                uint64_t count)
+{
+  const uint8_t *p = data;
+  uint64_t i;
+  int ret;
+
+  if (offset % 8 == 0)
+    {
+      ret = ios_write_bytes (io, p, count, offset / 8, flags);
+      if (ret == IOD_EOF)
+        return IOS_EIOFF;
+      return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  /* The data is not aligned to a byte boundary.  Write it a 64-bit
+     word at a time.  */
+  for (i = 0; i + 8 <= count; i += 8)
+    {
+      uint64_t w;
+
+      memcpy (&w, p + i, sizeof (w));
+      if (IOS_ENDIAN_HOST == IOS_ENDIAN_LSB)
+        w = bswap_64 (w);
+      ret = ios_write_int_common (io, offset + i * 8, flags, 64,
+                                  IOS_ENDIAN_MSB, w);
+      if (ret != IOS_OK)
+        return ret;
+    }
+  for (; i < count; i++)
+    {
+      ret = ios_write_int_common (io, offset + i * 8, flags, 8,
+                                  IOS_ENDIAN_MSB, p[i]);
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  return IOS_OK;
+}
+
+int
+ios_write_uint128 (ios io, ios_off offset, int flags,
+                   enum ios_endian endian, const uint64_t value[2])
+{
+  uint8_t c[16];
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  ios_uint128_to_bytes (value, endian, c);
+  return ios_write_bits (io, offset, flags, c, sizeof (c));
+}
+
+int
+ios_copy (ios from, ios_off from_offset, ios to, ios_off to_offset,
+          uint64_t count)
+{
+  uint8_t *buf;
+  uint64_t done;
+  int backwards_p, ret;
+
+  /* Apply the IOS biases.  */
+  from_offset += ios_get_bias (from);
+  to_offset += ios_get_bias (to);
+
+  if (count == 0 || (from == to && from_offset == to_offset))
+    return IOS_OK;
+
+  /* Overlapping ranges in the same IO space are copied starting from
+     the end if the destination follows the origin, like memmove
+     does.  */
+  backwards_p = (from == to
+                 && to_offset > from_offset
+                 && to_offset < from_offset + count * 8);
+
+  /* Let the device copy the data without transferring it, if
+     possible.  */
+  if (from->dev_if == to->dev_if
+      && from->dev_if->copy != NULL
+      && from_offset % 8 == 0 && to_offset % 8 == 0
+      && !(from == to
+           && from_offset < to_offset + count * 8
+           && to_offset < from_offset + count * 8))
+    {
+      ret = ios_wb_flush (from);
+      if (ret == IOD_OK)
+        ret = ios_wb_flush (to);
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+
+      if (from->dev_if->copy (from->dev, from_offset / 8,
+                              to->dev, to_offset / 8, count) == IOD_OK)
+        {
+          ios_written (to, count, to_offset / 8);
+          if (to->cache != NULL)
+            ios_cache_clear (to->cache);
+          return IOS_OK;
+        }
+    }
+
+  buf = malloc (count < IOS_COPY_CHUNK_SIZE ? count : IOS_COPY_CHUNK_SIZE);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  ret = IOS_OK;
+  for (done = 0; done < count; )
+    {
+      uint64_t n = count - done;
+      uint64_t pos;
+
+      if (n > IOS_COPY_CHUNK_SIZE)
+        n = IOS_COPY_CHUNK_SIZE;
+      pos = backwards_p ? count - done - n : done;
+
+      ret = ios_read_bits (from, from_offset + pos * 8, 0, buf, n);
+      if (ret != IOS_OK)
+        break;
+      ret = ios_write_bits (to, to_offset + pos * 8, 0, buf, n);
+      if (ret != IOS_OK)
+        break;
+
+      done += n;
+    }
+
+  free (buf);
+  return ret;
+}
+
+/* Reverse the order of the bytes of the COUNT / WIDTH words of WIDTH
+   bytes located at SRC, and put them in DST.  WIDTH is 2, 4 or 8.
+   DST and SRC can be the same buffer.  The loops are simple enough
+   for the C compilers to vectorize them into byte shuffles.  */
+
+static void
+ios_swap_block (uint8_t *dst, const uint8_t *src, uint64_t count,
+                int width)
+{
+  uint64_t i;
+
+  switch (width)
+    {
+    case 2:
+      for (i = 0; i + 2 <= count; i += 2)
+        {
+          uint16_t v;
+
+          memcpy (&v, src + i, 2);
+          v = bswap_16 (v);
+          memcpy (dst + i, &v, 2);
+        }
+      break;
+    case 4:
+      for (i = 0; i + 4 <= count; i += 4)
+        {
+          uint32_t v;
+
+          memcpy (&v, src + i, 4);
+          v = bswap_32 (v);
+          memcpy (dst + i, &v, 4);
+        }
+      break;
+    case 8:
+      for (i = 0; i + 8 <= count; i += 8)
+        {
+          uint64_t v;
+
+          memcpy (&v, src + i, 8);
+          v = bswap_64 (v);
+          memcpy (dst + i, &v, 8);
+        }
+      break;
+    default:
+      assert (0);
+    }
+}
+
+/* Plan of a scrabble.  Every group of IN_LEN entities of the origin
+   becomes OUT_LEN entities in the destination, the Jth of which is
+   the entity MAP[J] of the group.  If SWAP_WIDTH is not zero, the
+   plan amounts to reversing the bytes of words of SWAP_WIDTH bytes,
+   which is done by ios_swap_block.  */
+
+struct ios_scrabble_plan
+{
+  uint64_t in_len;
+  uint64_t out_len;
+  uint64_t *map;
+  int swap_width;
+};
+
+static int
+ios_scrabble_plan (struct ios_scrabble_plan *plan, uint64_t ent_size,
+                   const char *from_pattern, const char *to_pattern)
+{
+  uint64_t first[256];
+  uint64_t i, j;
+  int width;
+
+  plan->in_len = strlen (from_pattern);
+  plan->out_len = 0;
+  plan->swap_width = 0;
+  plan->map = malloc ((strlen (to_pattern) + 1) * sizeof (uint64_t));
+  if (plan->map == NULL)
+    return IOS_ENOMEM;
+
+  /* Entities are looked up by the first occurrence of their
+     character in FROM_PATTERN.  The characters of TO_PATTERN not
+     appearing in it are ignored.  */
+  for (i = 0; i < 256; i++)
+    first[i] = plan->in_len;
+  for (i = plan->in_len; i > 0; i--)
+    first[(uint8_t) from_pattern[i - 1]] = i - 1;
+  for (i = 0; to_pattern[i] != '\0'; i++)
+    if (first[(uint8_t) to_pattern[i]] != plan->in_len)
+      plan->map[plan->out_len++] = first[(uint8_t) to_pattern[i]];
+
+  if (ent_size != 1 || plan->out_len != plan->in_len)
+    return IOS_OK;
+
+  for (width = 8; width >= 2; width /= 2)
+    {
+      if (plan->in_len % width != 0)
+        continue;
+      for (j = 0; j < plan->out_len; j++)
+        if (plan->map[j] != j - j % width + width - 1 - j % width)
+          break;
+      if (j == plan->out_len)
+        {
+          plan->swap_width = width;
+          break;
+        }
+    }
+
+  return IOS_OK;
+}
+
+/* Apply PLAN to the NGROUPS groups of entities of ENT_SIZE bytes at
+   IN, and put the result in OUT.  */
+
+static void
+ios_scrabble_block (const struct ios_scrabble_plan *plan,
+                    uint64_t ent_size, const uint8_t *in, uint8_t *out,
+                    uint64_t ngroups)
+{
+  uint64_t g, j;
+
+  if (plan->swap_width != 0)
+    {
+      ios_swap_block (out, in, ngroups * plan->in_len, plan->swap_width);
+      return;
+    }
+
+  for (g = 0; g < ngroups; g++)
+    {
+      if (ent_size == 1)
+        for (j = 0; j < plan->out_len; j++)
+          out[j] = in[plan->map[j]];
+      else
+        for (j = 0; j < plan->out_len; j++)
+          memcpy (out + j * ent_size, in + plan->map[j] * ent_size, ent_size);
+
+      in += plan->in_len * ent_size;
+      out += plan->out_len * ent_size;
+    }
+}
+
+int
+ios_scrabble (ios from, ios_off from_offset, ios to, ios_off to_offset,
+              uint64_t count, uint64_t ent_size,
+              const char *from_pattern, const char *to_pattern)
+{
+  struct ios_scrabble_plan plan;
+  uint64_t in_size, out_size, ngroups, chunk, done;
+  uint8_t *in, *out;
+  int ret;
+
+  if (ent_size == 0)
+    return IOS_EINVAL;
+
+  ret = ios_scrabble_plan (&plan, ent_size, from_pattern, to_pattern);
+  if (ret != IOS_OK)
+    return ret;
+
+  if (plan.in_len == 0 || plan.out_len == 0)
+    {
+      free (plan.map);
+      return IOS_OK;
+    }
+
+  /* Apply the IOS biases.  */
+  from_offset += ios_get_bias (from);
+  to_offset += ios_get_bias (to);
+
+  /* The last group is scrabbled whole even if it extends past the end
+     of the range.  */
+  in_size = plan.in_len * ent_size;
+  out_size = plan.out_len * ent_size;
+  ngroups = (count + in_size - 1) / in_size;
+
+  /* The groups are transformed in blocks of about IOS_COPY_CHUNK_SIZE
+     bytes.  If the result could overwrite origin data that is not
+     read yet, they are transformed one by one instead.  */
+  chunk = IOS_COPY_CHUNK_SIZE / (in_size > out_size ? in_size : out_size);
+  if (chunk == 0
+      || (from == to
+          && (out_size > in_size || to_offset > from_offset)))
+    chunk = 1;
+  if (chunk > ngroups)
+    chunk = ngroups;
+
+  in = malloc (chunk * in_size);
+  out = plan.swap_width != 0 ? in : malloc (chunk * out_size);
+  if (in == NULL || out == NULL)
+    {
+      free (in);
+      if (out != in)
+        free (out);
+      free (plan.map);
+      return IOS_ENOMEM;
+    }
+
+  for (done = 0; done < ngroups; done += chunk)
+    {
+      if (chunk > ngroups - done)
+        chunk = ngroups - done;
+
+      ret = ios_read_bits (from, from_offset + done * in_size * 8, 0,
+                           in, chunk * in_size);
+      if (ret != IOS_OK)
+        break;
+      ios_scrabble_block (&plan, ent_size, in, out, chunk);
+      ret = ios_write_bits (to, to_offset + done * out_size * 8, 0,
+                            out, chunk * out_size);
+      if (ret != IOS_OK)
+        break;
+    }
+
+  if (out != in)
+    free (out);
+  free (in);
+  free (plan.map);
+  return ret;
+}
+
+int
+ios_byteswap (ios io, ios_off offset, uint64_t count, int width)
+{
+  uint64_t done, chunk;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if ((width != 2 && width != 4 && width != 8) || count % width != 0)
+    return IOS_EINVAL;
+  if (count == 0)
+    return IOS_OK;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  chunk = count < IOS_COPY_CHUNK_SIZE ? count : IOS_COPY_CHUNK_SIZE;
+  buf = malloc (chunk);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  /* IOS_COPY_CHUNK_SIZE is a multiple of every width, so the words
+     never cross the blocks.  */
+  for (done = 0; done < count; done += chunk)
+    {
+      if (chunk > count - done)
+        chunk = count - done;
+
+      ret = ios_read_bits (io, offset + done * 8, 0, buf, chunk);
+      if (ret != IOS_OK)
+        break;
+      ios_swap_block (buf, buf, chunk, width);
+      ret = ios_write_bits (io, offset + done * 8, 0, buf, chunk);
+      if (ret != IOS_OK)
+        break;
+    }
+
+  free (buf);
+  return ret;
+}
+
+/* Return how many of the COUNT bytes located at the given bit
+   OFFSET of IO can be read, given that reading all of them failed
+   because of the end of the IO space.  The IOS bias shall be already
+   applied to OFFSET.  */
+
+static uint64_t
+ios_readable_bytes (ios io, ios_off offset, uint64_t count)
+{
+  uint64_t lo = 0, hi = count;
+
+  /* Bisect the position of the first unreadable byte, which is in
+     [lo, hi].  */
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      uint8_t c;
+
+      if (ios_read_bits (io, offset + mid * 8, 0, &c, 1) == IOS_OK)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Return the index of the first match of the pattern in the COUNT
+   bytes of BUF, or -1 if there is none.  A match at index I is
+   considered only if BASE + I is a multiple of ALIGN.  */
+
+static int64_t
+ios_scan_block (const uint8_t *buf, uint64_t count,
+                  const uint8_t *pattern, const uint8_t *mask,
+                  uint64_t len, uint64_t align, uint64_t base)
+{
+  uint64_t i, j, anchor;
+
+  if (count < len)
+    return -1;
+
+  /* The common case of looking for some unaligned magic is best
+     handled by memmem.  */
+  if (mask == NULL && align == 1)
+    {
+      const uint8_t *p = memmem (buf, count, pattern, len);
+      return p == NULL ? -1 : p - buf;
+    }
+
+  /* Look for a byte of the pattern that is not masked, to use memchr
+     to skip quickly over the bytes that can't start a match.  */
+  for (anchor = 0; anchor < len; anchor++)
+    if (mask == NULL || mask[anchor] == 0xff)
+      break;
+
+  i = 0;
+  while (i <= count - len)
+    {
+      if (anchor < len)
+        {
+          const uint8_t *p = memchr (buf + i + anchor, pattern[anchor],
+                                     count - len + 1 - i);
+          if (p == NULL)
+            break;
+          i = p - buf - anchor;
+        }
+
+      if (align > 1 && (base + i) % align != 0)
+        {
+          /* Skip to the next aligned position.  */
+          i += align - (base + i) % align;
+          continue;
+        }
+
+      if (mask == NULL)
+        {
+          if (memcmp (buf + i, pattern, len) == 0)
+            return i;
+        }
+      else
+        {
+          for (j = 0; j < len; j++)
+            if ((buf[i + j] & mask[j]) != (pattern[j] & mask[j]))
+              break;
+          if (j == len)
+            return i;
+        }
+
+      i += (anchor < len) ? 1 : align;
+    }
+
+  return -1;
+}
+
+int
+ios_scan (ios io, ios_off from, ios_off to,
+          const void *pattern, const void *mask, uint64_t len,
+          uint64_t align, ios_off *result)
+{
+  ios_off bias = ios_get_bias (io);
+  uint64_t pos, end;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if (len == 0)
+    return IOS_EINVAL;
+  if (align == 0)
+    align = 1;
+
+  /* The search is byte-oriented.  */
+  pos = (from + 7) / 8;
+  end = to / 8;
+  *result = to;
+
+  buf = malloc (IOS_SCAN_CHUNK_SIZE + len - 1);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  /* Consecutive blocks overlap by LEN - 1 bytes, so matches crossing
+     the boundaries are found as well.  */
+  while (pos + len <= end)
+    {
+      uint64_t count = end - pos;
+      int64_t idx;
+      int eof_p = 0;
+
+      if (count > IOS_SCAN_CHUNK_SIZE + len - 1)
+        count = IOS_SCAN_CHUNK_SIZE + len - 1;
+
+      ret = ios_read_bits (io, pos * 8 + bias, 0, buf, count);
+      if (ret == IOS_EIOFF)
+        {
+          count = ios_readable_bytes (io, pos * 8 + bias, count);
+          eof_p = 1;
+          ret = IOS_OK;
+        }
+      else if (ret != IOS_OK)
+        break;
+
+      idx = ios_scan_block (buf, count, pattern, mask, len, align, pos);
+      if (idx != -1)
+        {
+          *result = (pos + idx) * 8;
+          break;
+        }
+
+      if (eof_p)
+        break;
+      pos += IOS_SCAN_CHUNK_SIZE;
+    }
+
+  free (buf);
+  return ret;
+}
+
 uint64_t
 ios_size (ios io)
 {
-  return io->dev_if->size (io->dev) * 8;
+  ios_dev_off dev_size = io->dev_if->size (io->dev);
+
+  /* Buffered writes may extend the device.  */
+  if (io->wb_count != 0 && io->wb_begin + io->wb_count > dev_size)
+    dev_size = io->wb_begin + io->wb_count;
+
+  return dev_size * 8;
+}
+
+int
+ios_volatile_p (ios io)
+{
+  return io->dev_if == &ios_dev_stream;
+}
+
+int
+ios_prefetch (ios io, ios_off offset, uint64_t count)
+{
+  int ret;
+
+  offset += io->bias;
+  if (count == 0)
+    return IOS_OK;
+
+  IOS_CTX_LOCK ();
+  ret = ios_base_prefetch (io, offset / 8, count);
+  IOS_CTX_UNLOCK ();
+  return IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+int
+ios_overlay_commit (ios io)
+{
+  int ret;
+
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_EINVAL;
+
+  IOS_CTX_LOCK ();
+  ret = ios_dev_overlay_commit (io->dev);
+  IOS_CTX_UNLOCK ();
+  return IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+int
+ios_overlay_discard (ios io)
+{
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_EINVAL;
+
+  IOS_CTX_LOCK ();
+  ios_dev_overlay_discard (io->dev);
+
+  /* The contents of the overlay changed without being written.  */
+  io->generation++;
+  io->wlog_count = 0;
+  io->wlog_oldest = io->generation;
+  IOS_CTX_UNLOCK ();
+  return IOS_OK;
 }
 
 int
 ios_flush (ios io, ios_off offset)
 {
-  return io->dev_if->flush (io->dev, offset / 8);
+  int ret;
+
+  IOS_CTX_LOCK ();
+  ret = ios_wb_flush (io);
+  if (ret != IOD_OK)
+    {
+      IOS_CTX_UNLOCK ();
+      return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  /* The device may discard buffered data, so invalidate the page
+     cache.  */
+  if (io->cache != NULL)
+    ios_cache_clear (io->cache);
+  ret = io->dev_if->flush (io->dev, offset / 8);
+  IOS_CTX_UNLOCK ();
+  return ret;
 }
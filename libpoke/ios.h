@@ -22,9 +22,11 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* The following two functions intialize and shutdown the IO poke
-   subsystem.  */
+   subsystem.  ios_shutdown closes all the IO spaces of the current
+   IO context.  */
 
 void ios_init (void);
 
@@ -126,11 +128,43 @@ typedef int64_t ios_off;
 #define IOS_M_WRONLY (IOS_F_WRITE)
 #define IOS_M_RDWR (IOS_F_READ | IOS_F_WRITE)
 
+/* IOD-specific flags for stream devices.
+
+   N << IOS_F_STREAM_CHUNK_SHIFT, for N between
+   IOS_STREAM_CHUNK_LOG_MIN and IOS_STREAM_CHUNK_LOG_MAX, selects
+   chunks of 2**N bytes for the buffer of input streams.  If N is
+   zero a default chunk size is used.  */
+
+#define IOS_F_STREAM_CHUNK_SHIFT 32
+#define IOS_F_STREAM_CHUNK_MASK ((uint64_t) 0x3f << IOS_F_STREAM_CHUNK_SHIFT)
+#define IOS_STREAM_CHUNK_LOG_MIN 4
+#define IOS_STREAM_CHUNK_LOG_MAX 30
+
+/* N << IOS_F_STREAM_READER_SHIFT, for N between
+   IOS_STREAM_READER_LOG_MIN and IOS_STREAM_READER_LOG_MAX, makes
+   input streams to be read by a background thread, which keeps up
+   to 2**N bytes buffered ahead of the last flushed offset.  This is
+   only supported if libpoke is built with POSIX threads.  */
+
+#define IOS_F_STREAM_READER_SHIFT 40
+#define IOS_F_STREAM_READER_MASK ((uint64_t) 0x3f << IOS_F_STREAM_READER_SHIFT)
+#define IOS_STREAM_READER_LOG_MIN 12
+#define IOS_STREAM_READER_LOG_MAX 40
+
+/* IOD-specific flags for memory devices.
+
+   IOS_F_MEM_SPARSE allows writing to memory devices at any offset,
+   not just next to their current end.  Data written far away from
+   the rest is stored in separated chunks, so the memory used is
+   proportional to the amount of data actually written.  */
+
+#define IOS_F_MEM_SPARSE ((uint64_t) 1 << 32)
+
 /* **************** IO space collection API ****************
 
-   The collection of open IO spaces are organized in a global list.
-   At every moment some given space is the "current space", unless
-   there are no spaces open:
+   The collection of open IO spaces are organized in a list, which
+   belongs to an IO context (see below).  At every moment some given
+   space is the "current space", unless there are no spaces open:
 
           space1  ->  space2  ->  ...  ->  spaceN
 
@@ -140,7 +174,42 @@ typedef int64_t ios_off;
                       current
 
    The functions declared below are used to manage this
-   collection.  */
+   collection.
+
+   Each thread operates on its current IO context, which initially is
+   a default context shared by the whole process.  IO spaces opened
+   in one context are not visible in the others, and two threads
+   shall not operate on the same context at the same time.  */
+
+typedef struct ios_context *ios_context;
+
+/* Create a new IO context, with no open IO spaces.  Return NULL if
+   there is not enough memory.  */
+
+ios_context ios_context_new (void);
+
+/* Close all the IO spaces of the given context and free all the
+   resources used by it.  If CTX is the current context of the
+   calling thread, the thread is switched to the default context.  */
+
+void ios_context_free (ios_context ctx);
+
+/* Return the current IO context of the calling thread.  */
+
+ios_context ios_context_cur (void);
+
+/* Make CTX the current IO context of the calling thread.  If CTX is
+   NULL, the default context is used.  */
+
+void ios_context_set_cur (ios_context ctx);
+
+/* Set or clear the shared mode of CTX.  While a context is shared,
+   several threads can read and write the IO spaces in it at the same
+   time, and their accesses are serialized.  IO spaces shall not be
+   opened, closed or copied, nor the cache parameters changed, while
+   the context is shared.  Return the previous mode.  */
+
+int ios_context_set_shared (ios_context ctx, int shared_p);
 
 
 /* Open an IO space using a handler and if set_cur is set to 1, make
@@ -225,6 +294,12 @@ void ios_map (ios_map_fn cb, void *data);
 
 uint64_t ios_size (ios io);
 
+/* Return 1 if data read from the given IO space may become
+   unavailable afterwards, like in streams once they are flushed.
+   Return 0 otherwise.  */
+
+int ios_volatile_p (ios io);
+
 /* The IOS bias is added to every offset used in a read/write
    operation.  It is signed and measured in bits.  By default it is
    zero, i.e. no bias is applied.
@@ -236,6 +311,70 @@ ios_off ios_get_bias (ios io);
 
 void ios_set_bias (ios io, ios_off bias);
 
+/* Every write to an IO space starts a new generation of it.  Mapped
+   values remember the generation of their IO space at the time they
+   were mapped, and need to be mapped again only if the data they were
+   mapped from has been written since then.
+
+   Return the current generation of IO.  Generation numbers are
+   always bigger than zero.  */
+
+uint64_t ios_generation (ios io);
+
+/* Return 1 if the SIZE bits at OFFSET in IO may have been written
+   after the generation GENERATION of IO.  Return 0 otherwise.
+
+   IO spaces remember only the last writes, so this may return 1 for
+   ranges that haven't been written, but never the other way around.
+   Changing the bias of IO counts as writing all of it, and IO spaces
+   stacked on top of other IO spaces, like overlays and sub IO spaces,
+   are always considered written.  */
+
+int ios_written_since_p (ios io, uint64_t generation,
+                         ios_off offset, ios_off size);
+
+/* IO spaces also keep the set of device ranges that have been written
+   since the set was last cleared.  Adjacent and overlapping ranges
+   are merged.
+
+   Call CB for every range in the set of IO that has been written
+   after the generation GENERATION, in ascending order, passing its
+   device offset and size in bytes, and DATA.  If GENERATION is 0
+   then CB is called for all the ranges.  CB shall not write to IO.
+
+   If there was not enough memory to record the written ranges then
+   CB is called once with an offset of 0 and a size of UINT64_MAX,
+   meaning the whole IO space.  */
+
+typedef void (*ios_range_fn) (uint64_t offset, uint64_t count,
+                              void *data);
+
+void ios_map_dirty (ios io, uint64_t generation,
+                    ios_range_fn cb, void *data);
+
+/* Empty the set of written ranges of IO.  */
+
+void ios_clear_dirty (ios io);
+
+/* Some devices, like files, can tell when they are modified by other
+   programs.  Check whether the device of IO has been modified, and if
+   so, drop the pages of the cache of IO whose data changed and record
+   the modified ranges as written, so the values mapped from them are
+   mapped again.  The devices don't tell what was modified, so the
+   data not in the cache is recorded as written.
+
+   Return IOS_OK if the check was done or the device can't tell, and
+   an error code otherwise.  */
+
+int ios_refresh (ios io);
+
+/* Return a file descriptor that becomes ready for reading when the
+   device of IO is modified by other programs, after which
+   ios_refresh shall be called.  Return -1 if the device of IO can't
+   tell.  */
+
+int ios_get_change_fd (ios io);
+
 /* **************** Object read/write API ****************  */
 
 /* An integer with flags is passed to the read/write operations,
@@ -311,6 +450,134 @@ int ios_read_uint (ios io, ios_off offset, int flags,
 
 int ios_read_string (ios io, ios_off offset, int flags, char **value);
 
+/* Read COUNT bytes located at the given OFFSET, and put them in the
+   buffer pointed by DATA, which should be big enough to hold them.
+   OFFSET doesn't need to be aligned to a byte boundary.  This is
+   much faster than reading the bytes one by one.  */
+
+int ios_read_raw (ios io, ios_off offset, int flags, void *data,
+                  uint64_t count);
+
+/* Read a LEB128 encoded integer located at the given OFFSET, and put
+   its value in VALUE and the number of bytes it occupies in SIZE.
+   If SIGNED_P is set the integer is read as a SLEB128, and VALUE
+   holds the two's complement of its value.
+
+   Return IOS_EINVAL if the value doesn't fit in 64 bits, which are
+   encoded in at most IOS_LEB128_MAX_BYTES bytes.  */
+
+#define IOS_LEB128_MAX_BYTES 10
+
+int ios_read_leb128 (ios io, ios_off offset, int flags, int signed_p,
+                     uint64_t *value, uint64_t *size);
+
+/* Read an unsigned 128-bit integer located at the given OFFSET, and
+   put its most significant 64 bits in VALUE[0] and its least
+   significant 64 bits in VALUE[1].  It is assumed the integer is
+   encoded using the ENDIAN byte endianness.  */
+
+int ios_read_uint128 (ios io, ios_off offset, int flags,
+                      enum ios_endian endian, uint64_t value[2]);
+
+/* Get statistics about the buffer used by the device of IO: the size
+   of the chunks of the buffer in bytes, the number of chunks
+   currently in the buffer, and the maximum number of chunks the
+   buffer has ever held.  Return IOS_ERROR if the device doesn't
+   buffer data, IOS_OK otherwise.  */
+
+int ios_get_buffer_stats (ios io, uint64_t *chunk_size, uint64_t *nchunks,
+                          uint64_t *max_nchunks);
+
+/* Reads of small amounts of data are served from a page cache
+   maintained for each IO space.  The following functions get and set
+   the parameters of the caches, which are shared by all the IO
+   spaces.  Changing them discards the contents of the caches.
+
+   The cache size is the maximum number of bytes stored in the cache
+   of each IO space.  A size of zero disables the caches.
+
+   The page size is the number of bytes read from the devices into
+   each cache entry.  It shall be a power of two between 512 bytes
+   and 1MiB.  ios_set_cache_page_size returns IOS_EINVAL if SIZE is
+   not a valid page size, IOS_OK otherwise.  */
+
+uint64_t ios_get_cache_size (void);
+void ios_set_cache_size (uint64_t size);
+uint64_t ios_get_cache_page_size (void);
+int ios_set_cache_page_size (uint64_t size);
+
+/* Get the number of reads in IO that were found in its page cache in
+   HITS, and the number of them that had to read from the device in
+   MISSES.  Return IOS_ERROR if IO doesn't use a cache, IOS_OK
+   otherwise.  */
+
+int ios_get_cache_stats (ios io, uint64_t *hits, uint64_t *misses);
+
+/* Statistics about the accesses performed in an IO space.
+
+   READS and READ_BYTES are the number of read requests served by the
+   IO space and the number of bytes requested by them.  WRITES and
+   WRITTEN_BYTES are the same for write requests.
+
+   DEV_READS, DEV_READ_BYTES, DEV_WRITES and DEV_WRITTEN_BYTES are
+   the number of calls to the underlying device to read and write
+   data, and the number of bytes transferred by them.  DEV_SEEKS is
+   the number of device calls not starting where the previous one
+   ended, and DEV_NSECS is the total time spent in device calls, in
+   nanoseconds.
+
+   CACHE_HITS and CACHE_MISSES are the same numbers returned by
+   ios_get_cache_stats.  */
+
+struct ios_stats
+{
+  uint64_t reads;
+  uint64_t read_bytes;
+  uint64_t writes;
+  uint64_t written_bytes;
+  uint64_t dev_reads;
+  uint64_t dev_read_bytes;
+  uint64_t dev_writes;
+  uint64_t dev_written_bytes;
+  uint64_t dev_seeks;
+  uint64_t dev_nsecs;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+};
+
+/* Get the statistics of IO in STATS.  */
+
+void ios_get_stats (ios io, struct ios_stats *stats);
+
+/* Set all the statistics of IO to zero.  */
+
+void ios_reset_stats (ios io);
+
+/* Log all the accesses to the IO spaces of the current context to
+   the file FILENAME, which is created or truncated.  Every access is
+   logged in a line with the id of the IO space, the kind of access, a
+   byte offset in hexadecimal and a number of bytes.  The kind of
+   access is one of "read" and "write", for the requests served by
+   the IO space, or "pread", "pwrite" and "prefetch" for the calls to
+   the underlying device.
+
+   If FILENAME is NULL then stop logging.  Return IOS_ERROR if the
+   file can't be opened, IOS_OK otherwise.  */
+
+int ios_set_trace_file (const char *filename);
+
+/* Return a pointer to the COUNT bytes located at the given OFFSET, if
+   the device of IO stores them contiguously in memory.  If WRITE_P
+   is not zero the bytes are going to be modified through the
+   returned pointer.  OFFSET shall be aligned to a byte boundary.
+
+   The pointer is valid only until the next operation on IO.  Return
+   NULL if the bytes can't be accessed directly, in which case the
+   regular read and write functions shall be used instead.  */
+
+void *ios_direct_pointer (ios io, ios_off offset, size_t count,
+                          int write_p);
+
 /* Write the signed integer of size BITS in VALUE to the space IO, at
    the given OFFSET.  Use the byte endianness ENDIAN and encoding NENC
    when writing the value.  */
@@ -335,6 +602,74 @@ int ios_write_uint (ios io, ios_off offset, int flags,
 
 int ios_write_string (ios io, ios_off offset, int flags, const char *value);
 
+/* Write the unsigned 128-bit integer whose most and least significant
+   64 bits are VALUE[0] and VALUE[1] to the space IO, at the given
+   OFFSET.  Use the byte endianness ENDIAN when writing the value.  */
+
+int ios_write_uint128 (ios io, ios_off offset, int flags,
+                       enum ios_endian endian, const uint64_t value[2]);
+
+/* Copy the COUNT bytes located at FROM_OFFSET in the space FROM to
+   TO_OFFSET in the space TO.  The offsets don't need to be aligned to
+   a byte boundary.  FROM and TO can be the same space, and the ranges
+   can overlap.
+
+   The data is copied in big blocks, or directly by the devices when
+   they support it, which is much faster than copying the bytes one
+   by one.  Return IOS_OK on success, or an IOS error code.  In case of
+   error part of the data may have been copied.  */
+
+int ios_copy (ios from, ios_off from_offset, ios to, ios_off to_offset,
+              uint64_t count);
+
+/* Rearrange the entities of ENT_SIZE bytes of the range of COUNT
+   bytes located at FROM_OFFSET in the space FROM, and write the
+   result at TO_OFFSET in the space TO.  Each character of
+   FROM_PATTERN names an entity, and the range is processed in groups
+   of as many entities as characters it has.  Every group is written
+   as the entities named by the characters of TO_PATTERN, which are
+   ignored if they don't appear in FROM_PATTERN.  The last group is
+   processed whole even if it extends past the end of the range.  The
+   offsets don't need to be aligned to a byte boundary.
+
+   The patterns are compiled into a plan only once, and the data is
+   transferred in big blocks.  Plans swapping the bytes of 16, 32 or
+   64-bit words are executed by specialized kernels.  Return IOS_OK on
+   success, or an IOS error code.  */
+
+int ios_scrabble (ios from, ios_off from_offset, ios to, ios_off to_offset,
+                  uint64_t count, uint64_t ent_size,
+                  const char *from_pattern, const char *to_pattern);
+
+/* Reverse, in place, the order of the bytes of every word of WIDTH
+   bytes in the range of COUNT bytes located at OFFSET in IO.  This
+   converts arrays of 16, 32 or 64-bit integers between big and
+   little endian.  The offset doesn't need to be aligned to a byte
+   boundary.  Return IOS_EINVAL if WIDTH is not 2, 4 or 8, or if COUNT
+   is not a multiple of it.  Otherwise return IOS_OK on success, or an
+   IOS error code.  The data is transferred in big blocks and swapped
+   by a specialized kernel, which is much faster than reading and
+   writing the integers one by one.  */
+
+int ios_byteswap (ios io, ios_off offset, uint64_t count, int width);
+
+/* Search the LEN bytes of PATTERN in the range of IO going from the
+   offset FROM up to, and not including, the offset TO.  The search is
+   byte-oriented: FROM is rounded up and TO is rounded down to bytes.
+   If MASK is not NULL it should point to LEN bytes, and only the bits
+   set in them are compared.  If ALIGN is greater than one, only
+   matches located at byte offsets that are multiple of ALIGN are
+   considered.  The search stops at the end of the IO space.
+
+   Return IOS_OK and set *RESULT to the offset of the first match, or
+   to TO if the pattern is not found.  Return an IOS error code
+   otherwise.  The data is read in big blocks, so this is much faster
+   than reading the bytes one by one.  */
+
+int ios_scan (ios io, ios_off from, ios_off to,
+              const void *pattern, const void *mask, uint64_t len,
+              uint64_t align, ios_off *result);
+
 /* If the current IOD is a write stream, write out the data in the buffer
    till OFFSET.  If the current IOD is a stream IOD, free (if allowed by the
    embedded buffering strategy) bytes up to OFFSET.  This function has no
@@ -342,6 +677,15 @@ int ios_write_string (ios io, ios_off offset, int flags, const char *value);
 
 int ios_flush (ios io, ios_off offset);
 
+/* Announce that the COUNT bytes starting at OFFSET in IO are going to
+   be read soon, so the device may start reading them in the
+   background.  This is only a hint: it doesn't block and it doesn't
+   check the range.  Return IOS_OK on success, or IOS_ERROR if the
+   device couldn't honor it.  Devices that don't support prefetching
+   ignore the hint.  */
+
+int ios_prefetch (ios io, ios_off offset, uint64_t count);
+
 /* **************** Update API **************** */
 
 /* XXX: writeme.  */
@@ -351,6 +695,38 @@ int ios_flush (ios io, ios_off offset);
 
 /* **************** Transaction API **************** */
 
-/* XXX: writeme.  */
+/* Overlay IO spaces, opened with handlers like `overlay://ID', keep
+   the data written to them in memory, and read the rest from the IO
+   space with id ID, called their base.  This allows trying changes
+   to the base without modifying it.
+
+   ios_overlay_commit writes the data kept by the overlay IO space IO
+   to its base, and ios_overlay_discard drops it.  In both cases the
+   overlay reflects the contents of the base afterwards.  Return
+   IOS_EINVAL if IO is not an overlay, IOS_OK on success, and an
+   error code otherwise, in which case some of the data may have been
+   written to the base already.  */
+
+int ios_overlay_commit (ios io);
+int ios_overlay_discard (ios io);
+
+/* **************** Stacked devices API **************** */
+
+/* The following functions are used by IO devices that operate on top
+   of other IO spaces to access the COUNT bytes at the device offset
+   OFFSET of IO.  The bias of IO is not applied, and the data goes
+   through its cache and write buffer, so every IO space on top of IO
+   sees the same contents.  Since the device operations are invoked
+   with the IOS context locked, these functions don't lock it.
+   Return IOD_OK on success, or the error code returned by the device
+   of IO.  */
+
+int ios_base_pread (ios io, void *buf, size_t count, uint64_t offset);
+int ios_base_pwrite (ios io, const void *buf, size_t count,
+                     uint64_t offset);
+
+/* Likewise, but for ios_prefetch.  */
+
+int ios_base_prefetch (ios io, uint64_t offset, uint64_t count);
 
 #endif /* ! IOS_H */
@@ -21,28 +21,113 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "pkt.h"
+#include "pk-thread.h"
+#include "pk-utils.h"
 #include "pkl.h"
 #include "pkl-ast.h" /* XXX */
 #include "pkl-env.h" /* XXX */
 #include "pvm.h"
 #include "pvm-val.h" /* XXX */
+#include "pvm-alloc.h"
 #include "libpoke.h"
 
 struct pk_compiler
 {
   pkl_compiler compiler;
   pvm vm;
+  struct pk_term_if term_if;
 
+  /* State of the completion functions.
+
+     COMPLETE_NAMES is the index of the names of the global
+     declarations, and COMPLETE_FIELDS holds the names of the fields
+     and methods of the struct type COMPLETE_TYPE, sorted
+     alphabetically.  Both are kept between completions.  */
+  pkl_env_names complete_names;
   pkl_ast_node complete_type;
+  const char **complete_fields;
+  size_t complete_num_fields;
+  size_t complete_idx;
+  ios complete_io;
+
+  /* Modules loaded in the background by pk_load_async.
+
+     ASYNC_MODULES holds the NUM_ASYNC modules queued since the last
+     wait, of which the first ASYNC_NEXT have been taken by the loader
+     thread.  LOADER_RUNNING_P is set while the loader thread takes
+     modules, and LOADER_JOINABLE_P until it is joined.  These fields
+     are protected by LOADER_LOCK.  ASYNC_STATUS is PK_ERROR if some
+     module failed to load, and is only accessed by the loader thread
+     until it is joined.  */
+  char **async_modules;
+  size_t num_async;
+  size_t async_next;
+  int async_status;
+#if HAVE_PTHREAD
+  pk_lock_t loader_lock;
+  pthread_t loader;
+  int loader_running_p;
+  int loader_joinable_p;
+#endif
+
   int status;  /* Status of last API function call. Initialized with PK_OK */
 };
 
-struct pk_term_if libpoke_term_if;
+static void pk_wait_loads (pk_compiler pkc);
+static pkl_env pk_compiler_env (pk_compiler pkc);
+
+/* Terminal interface of the compiler being operated by the running
+   thread.  */
+
+PK_THREAD_LOCAL struct pk_term_if *libpoke_term_if;
 
 #define PK_RETURN(code) do { return pkc->status = (code); } while (0)
 
+/* Make PKC the compiler operated by the running thread.  This
+   registers the thread in the garbage collector if needed, and makes
+   the terminal interface and the IO spaces of PKC the ones used by
+   the thread.  Every API function that may run Poke code, allocate
+   values, print or operate on IO spaces must begin with
+   PK_ENTER.  This also waits for the modules being loaded in the
+   background, which use the compiler in the meanwhile.  */
+
+#define PK_ENTER(pkc)                                           \
+  do                                                            \
+    {                                                           \
+      pk_wait_loads (pkc);                                      \
+      pvm_alloc_register_thread ();                             \
+      libpoke_term_if = &(pkc)->term_if;                        \
+      ios_context_set_cur (pvm_ios_context ((pkc)->vm));        \
+    }                                                           \
+  while (0)
+
+/* Return the directory where the compiler caches the code generated
+   for its run-time support files, or NULL if the code shall not be
+   cached.  The directory is POKECACHEDIR if it is set, which disables
+   the cache if it is the empty string, or the poke/bytecode
+   subdirectory of the user's cache directory otherwise, following
+   the XDG Base Directory Specification.  The returned string shall be
+   freed by the caller.  */
+
+static char *
+pk_bytecode_cache_dir (void)
+{
+  const char *dir = getenv ("POKECACHEDIR");
+
+  if (dir != NULL)
+    return *dir ? strdup (dir) : NULL;
+
+  if ((dir = getenv ("XDG_CACHE_HOME")) != NULL && *dir)
+    return pk_str_concat (dir, "/poke/bytecode", NULL);
+  if ((dir = getenv ("HOME")) != NULL && *dir)
+    return pk_str_concat (dir, "/.cache/poke/bytecode", NULL);
+
+  return NULL;
+}
+
 pk_compiler
 pk_compiler_new (struct pk_term_if *term_if)
 {
@@ -61,19 +146,39 @@ pk_compiler_new (struct pk_term_if *term_if)
     {
       /* Determine the path to the compiler's runtime files.  */
       const char *libpoke_datadir = getenv ("POKEDATADIR");
+      char *cache_dir;
+
       if (libpoke_datadir == NULL)
         libpoke_datadir = PKGDATADIR;
 
-      libpoke_term_if = *term_if;
+      pkc->term_if = *term_if;
+      pkc->async_modules = NULL;
+      pkc->num_async = 0;
+      pkc->async_next = 0;
+      pkc->async_status = PK_OK;
+#if HAVE_PTHREAD
+      PK_LOCK_INIT (pkc->loader_lock);
+      pkc->loader_running_p = 0;
+      pkc->loader_joinable_p = 0;
+#endif
 
       pkc->vm = pvm_init ();
       if (pkc->vm == NULL)
         goto error;
+      PK_ENTER (pkc);
+      cache_dir = pk_bytecode_cache_dir ();
       pkc->compiler = pkl_new (pkc->vm,
-                               libpoke_datadir);
+                               libpoke_datadir,
+                               cache_dir);
+      free (cache_dir);
       if (pkc->compiler == NULL)
         goto error;
+      pkc->complete_names = pkl_env_names_new ();
       pkc->complete_type = NULL;
+      pkc->complete_fields = NULL;
+      pkc->complete_num_fields = 0;
+      pkc->complete_idx = 0;
+      pkc->complete_io = NULL;
       pkc->status = PK_OK;
 
       pvm_set_compiler (pkc->vm, pkc->compiler);
@@ -91,13 +196,58 @@ pk_compiler_free (pk_compiler pkc)
 {
   if (pkc)
     {
+      PK_ENTER (pkc);
+      pkl_env_names_free (pkc->complete_names);
+      pkl_ast_node_free (pkc->complete_type);
+      free (pkc->complete_fields);
       pkl_free (pkc->compiler);
       pvm_shutdown (pkc->vm);
+      libpoke_term_if = NULL;
+      free (pkc->async_modules);
+#if HAVE_PTHREAD
+      PK_LOCK_DESTROY (pkc->loader_lock);
+#endif
     }
 
   free (pkc);
 }
 
+/* Set *DATA if IO is a stream IO space.  */
+
+static void
+pk_stream_ios_fn (ios io, void *data)
+{
+  if (strcmp (ios_get_dev_if_name (io), "STREAM") == 0)
+    *(int *) data = 1;
+}
+
+pid_t
+pk_compiler_fork (pk_compiler pkc)
+{
+#if HAVE_FORK
+  int stream_p = 0;
+  pid_t pid;
+
+  PK_ENTER (pkc);
+  ios_map (pk_stream_ios_fn, &stream_p);
+  if (stream_p)
+    {
+      pkc->status = PK_ERROR;
+      return -1;
+    }
+
+  /* Don't output the pending output in both processes.  */
+  pk_term_flush ();
+
+  pid = fork ();
+  pkc->status = pid == -1 ? PK_ERROR : PK_OK;
+  return pid;
+#else
+  pkc->status = PK_ERROR;
+  return -1;
+#endif
+}
+
 int
 pk_errno (pk_compiler pkc)
 {
@@ -110,6 +260,7 @@ int
 pk_compile_file (pk_compiler pkc, const char *filename,
                  int *exit_status)
 {
+  PK_ENTER (pkc);
   PK_RETURN (pkl_execute_file (pkc->compiler, filename, exit_status)
                  ? PK_OK
                  : PK_ERROR);
@@ -119,6 +270,7 @@ int
 pk_compile_buffer (pk_compiler pkc, const char *buffer,
                    const char **end)
 {
+  PK_ENTER (pkc);
   PK_RETURN (pkl_execute_buffer (pkc->compiler, buffer, end) ? PK_OK
                                                              : PK_ERROR);
 }
@@ -129,6 +281,7 @@ pk_compile_statement (pk_compiler pkc, const char *buffer,
 {
   pvm_val val;
 
+  PK_ENTER (pkc);
   if (!pkl_execute_statement (pkc->compiler, buffer, end, &val))
     PK_RETURN (PK_ERROR);
 
@@ -144,6 +297,7 @@ pk_compile_expression (pk_compiler pkc, const char *buffer,
 {
   pvm_val val;
 
+  PK_ENTER (pkc);
   if (!pkl_execute_expression (pkc->compiler, buffer, end, &val))
     PK_RETURN (PK_ERROR);
 
@@ -156,9 +310,142 @@ pk_compile_expression (pk_compiler pkc, const char *buffer,
 int
 pk_load (pk_compiler pkc, const char *module)
 {
+  PK_ENTER (pkc);
   PK_RETURN (pkl_load (pkc->compiler, module) == 0 ? PK_OK : PK_ERROR);
 }
 
+/* The compiler can't be used by several threads at the same time, so
+   the modules queued by pk_load_async are compiled one after the
+   other by a single loader thread, while the thread of the client
+   goes on with other work.  Every API function using the compiler
+   waits for the loader thread to finish first, except when called by
+   the loader thread itself, like from the terminal interface.  */
+
+#if HAVE_PTHREAD
+
+static PK_THREAD_LOCAL int pk_loader_thread_p;
+
+static void *
+pk_loader_thread (void *data)
+{
+  pk_compiler pkc = data;
+
+  pk_loader_thread_p = 1;
+  pvm_alloc_register_thread ();
+  libpoke_term_if = &pkc->term_if;
+  ios_context_set_cur (pvm_ios_context (pkc->vm));
+
+  while (1)
+    {
+      char *module;
+
+      PK_LOCK (pkc->loader_lock);
+      if (pkc->async_next == pkc->num_async)
+        {
+          pkc->loader_running_p = 0;
+          PK_UNLOCK (pkc->loader_lock);
+          break;
+        }
+      module = pkc->async_modules[pkc->async_next++];
+      PK_UNLOCK (pkc->loader_lock);
+
+      if (!pkl_load (pkc->compiler, module))
+        pkc->async_status = PK_ERROR;
+      free (module);
+    }
+
+  return NULL;
+}
+
+#endif
+
+static void
+pk_wait_loads (pk_compiler pkc)
+{
+#if HAVE_PTHREAD
+  if (pk_loader_thread_p || !pkc->loader_joinable_p)
+    return;
+
+  pthread_join (pkc->loader, NULL);
+  pkc->loader_joinable_p = 0;
+#endif
+}
+
+/* Return the environment of the compiler of PKC, once the modules
+   being loaded in the background are loaded.  */
+
+static pkl_env
+pk_compiler_env (pk_compiler pkc)
+{
+  pk_wait_loads (pkc);
+  return pkl_get_env (pkc->compiler);
+}
+
+int
+pk_load_async (pk_compiler pkc, const char *module)
+{
+#if HAVE_PTHREAD
+  char *copy = strdup (module);
+  char **modules;
+  int started_p;
+
+  if (copy == NULL)
+    PK_RETURN (PK_ENOMEM);
+
+  PK_LOCK (pkc->loader_lock);
+  modules = realloc (pkc->async_modules,
+                     (pkc->num_async + 1) * sizeof (char *));
+  if (modules == NULL)
+    {
+      PK_UNLOCK (pkc->loader_lock);
+      free (copy);
+      PK_RETURN (PK_ENOMEM);
+    }
+  pkc->async_modules = modules;
+  pkc->async_modules[pkc->num_async++] = copy;
+
+  /* A running loader thread takes the module.  Otherwise start a new
+     one, once the previous one is gone.  */
+  if (!pkc->loader_running_p)
+    {
+      if (pkc->loader_joinable_p)
+        pthread_join (pkc->loader, NULL);
+
+      pkc->loader_running_p
+        = (pthread_create (&pkc->loader, NULL, pk_loader_thread, pkc) == 0);
+      pkc->loader_joinable_p = pkc->loader_running_p;
+    }
+
+  started_p = pkc->loader_joinable_p;
+  if (!started_p)
+    pkc->num_async--;
+  PK_UNLOCK (pkc->loader_lock);
+
+  if (started_p)
+    PK_RETURN (PK_OK);
+  free (copy);
+#endif
+
+  /* The module is loaded right away if threads can't be used.  */
+  PK_ENTER (pkc);
+  if (!pkl_load (pkc->compiler, module))
+    pkc->async_status = PK_ERROR;
+  PK_RETURN (PK_OK);
+}
+
+int
+pk_load_wait (pk_compiler pkc)
+{
+  int status;
+
+  PK_ENTER (pkc);
+  status = pkc->async_status;
+
+  pkc->async_status = PK_OK;
+  pkc->num_async = pkc->async_next = 0;
+  PK_RETURN (status);
+}
+
 void
 pk_set_quiet_p (pk_compiler pkc, int quiet_p)
 {
@@ -166,6 +453,45 @@ pk_set_quiet_p (pk_compiler pkc, int quiet_p)
   pkc->status = PK_OK;
 }
 
+void
+pk_set_time_passes_p (pk_compiler pkc, int time_passes_p)
+{
+  pkl_set_time_passes_p (pkc->compiler, time_passes_p);
+  pkc->status = PK_OK;
+}
+
+int
+pk_peephole_p (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pkl_peephole_p (pkc->compiler);
+}
+
+void
+pk_set_peephole_p (pk_compiler pkc, int peephole_p)
+{
+  pkl_set_peephole_p (pkc->compiler, peephole_p);
+  pkc->status = PK_OK;
+}
+
+int
+pk_inline_threshold (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pkl_inline_threshold (pkc->compiler);
+}
+
+int
+pk_set_inline_threshold (pk_compiler pkc, int threshold)
+{
+  if (threshold < 0)
+    PK_RETURN (PK_EINVAL);
+
+  pkl_set_inline_threshold (pkc->compiler, threshold);
+  pkc->status = PK_OK;
+  return PK_OK;
+}
+
 void
 pk_set_lexical_cuckolding_p (pk_compiler pkc, int lexical_cuckolding_p)
 {
@@ -180,23 +506,75 @@ pk_set_alien_token_fn (pk_compiler pkc, pk_alien_token_handler_fn cb)
   pkc->status = PK_OK;
 }
 
+static int
+cmp_field_names (const void *a, const void *b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Cache the names of the fields and methods of the struct type TYPE
+   in PKC, sorted alphabetically, unless they are already there.  */
+
+static void
+complete_struct_fields (pk_compiler pkc, pkl_ast_node type)
+{
+  pkl_ast_node t;
+  size_t n = 0;
+
+  if (type == pkc->complete_type)
+    return;
+
+  pkl_ast_node_free (pkc->complete_type);
+  free (pkc->complete_fields);
+  pkc->complete_type = NULL;
+  pkc->complete_num_fields = 0;
+
+  for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+    n++;
+  pkc->complete_fields = malloc (n * sizeof (const char *));
+  if (pkc->complete_fields == NULL)
+    return;
+  pkc->complete_type = ASTREF (type);
+
+  n = 0;
+  for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+    {
+      pkl_ast_node ename;
+
+      if (PKL_AST_CODE (t) == PKL_AST_STRUCT_TYPE_FIELD)
+        ename = PKL_AST_STRUCT_TYPE_FIELD_NAME (t);
+      else if (PKL_AST_CODE (t) == PKL_AST_DECL
+               && PKL_AST_DECL_KIND (t) == PKL_AST_DECL_KIND_FUNC
+               && PKL_AST_FUNC_METHOD_P (PKL_AST_DECL_INITIAL (t)))
+        ename = PKL_AST_DECL_NAME (t);
+      else
+        continue;
+
+      pkc->complete_fields[n++]
+        = ename ? PKL_AST_IDENTIFIER_POINTER (ename) : "<unnamed field>";
+    }
+
+  qsort (pkc->complete_fields, n, sizeof (const char *), cmp_field_names);
+  pkc->complete_num_fields = n;
+}
+
 static char *
 complete_struct (pk_compiler pkc,
-                 int *idx, const char *x, size_t len, int state)
+                 size_t *idx, const char *x, size_t len, int state)
 {
-  char *ret = NULL;
-  pkl_ast_node type = pkc->complete_type;
-  pkl_ast_node t;
-  size_t trunk_len;
-  int j;
+  const char *field;
+  char *name;
+  size_t trunk_len = len - strlen (strrchr (x, '.')) + 1;
 
   if (state == 0)
     {
       pkl_env compiler_env;
+      pkl_ast_node type;
       int back, over;
       char *base;
+      size_t lo, hi;
 
-      compiler_env = pkl_get_env (pkc->compiler);
+      compiler_env = pk_compiler_env (pkc);
       base = strndup (x, len - strlen (strchr (x, '.')));
 
       type = pkl_env_lookup (compiler_env, PKL_ENV_NS_MAIN,
@@ -210,58 +588,40 @@ complete_struct (pk_compiler pkc,
       type = pkl_struct_type_traverse (type, x);
       if (type == NULL)
         {
-          ret = NULL;
-          goto exit;
+          *idx = pkc->complete_num_fields = 0;
+          return NULL;
         }
-    }
-
-  trunk_len = len - strlen (strrchr (x, '.')) + 1;
-
-  t = PKL_AST_TYPE_S_ELEMS (type);
 
-  for (j = 0; j < (*idx); j++)
-    t = PKL_AST_CHAIN (t);
-
-  for (; t; t = PKL_AST_CHAIN (t), (*idx)++)
-    {
-      pkl_ast_node ename;
-      char *elem;
+      complete_struct_fields (pkc, type);
 
-      if (PKL_AST_CODE (t) == PKL_AST_STRUCT_TYPE_FIELD
-          || (PKL_AST_CODE (t) == PKL_AST_DECL
-              && PKL_AST_DECL_KIND (t) == PKL_AST_DECL_KIND_FUNC
-              && PKL_AST_FUNC_METHOD_P (PKL_AST_DECL_INITIAL (t))))
+      /* Find the first field not less than the field being
+         completed.  */
+      lo = 0;
+      hi = pkc->complete_num_fields;
+      while (lo < hi)
         {
-          if (PKL_AST_CODE (t) == PKL_AST_STRUCT_TYPE_FIELD)
-            ename = PKL_AST_STRUCT_TYPE_FIELD_NAME (t);
-          else
-            ename = PKL_AST_DECL_NAME (t);
+          size_t mid = lo + (hi - lo) / 2;
 
-          if (ename)
-            elem = PKL_AST_IDENTIFIER_POINTER (ename);
+          if (strcmp (pkc->complete_fields[mid], x + trunk_len) < 0)
+            lo = mid + 1;
           else
-            elem = "<unnamed field>";
-
-          if (strncmp (x + trunk_len, elem, len - trunk_len) == 0)
-            {
-              char *name;
-
-              if (asprintf (&name, "%.*s%s", (int) trunk_len, x, elem) == -1)
-                {
-                  ret = NULL;
-                  goto exit;
-                }
-
-              (*idx)++;
-              ret = name;
-              goto exit;
-            }
+            hi = mid;
         }
+      *idx = lo;
     }
 
- exit:
-  pkc->complete_type = type;
-  return ret;
+  if (*idx >= pkc->complete_num_fields)
+    return NULL;
+
+  field = pkc->complete_fields[*idx];
+  if (strncmp (field, x + trunk_len, len - trunk_len) != 0)
+    return NULL;
+
+  if (asprintf (&name, "%.*s%s", (int) trunk_len, x, field) == -1)
+    return NULL;
+
+  (*idx)++;
+  return name;
 }
 
 /* This function is called repeatedly by the readline library, when
@@ -277,30 +637,18 @@ char *
 pk_completion_function (pk_compiler pkc,
                         const char *text, int state)
 {
-  char *function_name;
-  static int idx = 0;
-  static struct pkl_ast_node_iter iter;
-  pkl_env env = pkl_get_env (pkc->compiler);
-  if (state == 0)
-    {
-      pkl_env_iter_begin (env, &iter);
-      idx = 0;
-    }
-  else
-    {
-      if (pkl_env_iter_end (env, &iter))
-        idx++;
-      else
-        pkl_env_iter_next (env, &iter);
-    }
+  size_t *idx = &pkc->complete_idx;
+  pkl_env env = pk_compiler_env (pkc);
 
-  size_t len = strlen (text);
+  PK_ENTER (pkc);
 
   if ((text[0] != '.') && (strchr (text, '.') != NULL))
-    return complete_struct (pkc, &idx, text, len, state);
+    return complete_struct (pkc, idx, text, strlen (text), state);
 
-  function_name = pkl_env_get_next_matching_decl (env, &iter, text, len);
-  return function_name;
+  if (state == 0)
+    *idx = pkl_env_names_search (pkc->complete_names, env, text);
+
+  return pkl_env_names_next (pkc->complete_names, env, idx, text);
 }
 
 /* This function provides command line completion when the tag of an
@@ -314,17 +662,19 @@ pk_completion_function (pk_compiler pkc,
    indicate that there are no more such tags.
  */
 char *
-pk_ios_completion_function (pk_compiler pkc __attribute__ ((unused)),
+pk_ios_completion_function (pk_compiler pkc,
                             const char *text, int state)
 {
-  static ios io;
+  ios io;
+
+  PK_ENTER (pkc);
   if (state == 0)
     {
       io = ios_begin ();
     }
   else
     {
-      io = ios_next (io);
+      io = ios_next (pkc->complete_io);
     }
 
   int len  = strlen (text);
@@ -337,11 +687,15 @@ pk_ios_completion_function (pk_compiler pkc __attribute__ ((unused)),
       snprintf (buf, 16, "#%d", ios_get_id (io));
 
       if (strncmp (buf, text, len) == 0)
-        return strdup (buf);
+        {
+          pkc->complete_io = io;
+          return strdup (buf);
+        }
 
       io = ios_next (io);
     }
 
+  pkc->complete_io = io;
   return NULL;
 }
 
@@ -351,6 +705,7 @@ pk_disassemble_function_val (pk_compiler pkc,
 {
   pvm_program program;
 
+  PK_ENTER (pkc);
   if (!PVM_IS_CLS (val))
     PK_RETURN (PK_ERROR);
 
@@ -370,7 +725,7 @@ pk_disassemble_function (pk_compiler pkc,
   int back, over;
   pvm_val val;
 
-  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_env compiler_env = pk_compiler_env (pkc);
   pvm_env runtime_env = pvm_get_env (pkc->vm);
 
   pkl_ast_node decl = pkl_env_lookup (compiler_env,
@@ -396,6 +751,7 @@ pk_disassemble_expression (pk_compiler pkc, const char *str,
 
   pvm_program program;
 
+  PK_ENTER (pkc);
   program_string = str;
   program = pkl_compile_expression (pkc->compiler,
                                     program_string, &end);
@@ -421,18 +777,91 @@ pk_disassemble_expression (pk_compiler pkc, const char *str,
 void
 pk_print_profile (pk_compiler pkc)
 {
+  PK_ENTER (pkc);
   pvm_print_profile (pkc->vm);
 }
 
 void
 pk_reset_profile (pk_compiler pkc)
 {
+  PK_ENTER (pkc);
   pvm_reset_profile (pkc->vm);
 }
 
+void
+pk_set_profile_functions (pk_compiler pkc, int profile_p)
+{
+  PK_ENTER (pkc);
+  pvm_set_profile_functions (pkc->vm, profile_p);
+}
+
+int
+pk_profile_functions_p (pk_compiler pkc)
+{
+  return pvm_profile_functions_p (pkc->vm);
+}
+
+void
+pk_print_function_profile (pk_compiler pkc, int folded_p)
+{
+  PK_ENTER (pkc);
+  pvm_print_function_profile (pkc->vm, folded_p);
+}
+
+void
+pk_set_budget (pk_compiler pkc, uint64_t budget,
+               pk_budget_fn fn, void *data)
+{
+  pvm_set_budget (pkc->vm, budget, fn, data);
+  pkc->status = PK_OK;
+}
+
+void
+pk_interrupt (pk_compiler pkc)
+{
+  /* This may be called from a thread other than the one running PKC,
+     so it doesn't enter PKC.  */
+  pvm_interrupt (pkc->vm);
+}
+
+void
+pk_compile_stats (pk_compiler pkc, struct pk_compile_stats *stats)
+{
+  const struct pkl_compile_stats *s = pkl_compile_stats (pkc->compiler);
+
+  stats->compilations = s->compilations;
+  stats->parse_time = s->stage_times[PKL_STAGE_PARSE];
+  stats->frontend_time = s->stage_times[PKL_STAGE_FRONTEND];
+  stats->middleend_time = s->stage_times[PKL_STAGE_MIDDLEEND];
+  stats->backend_time = s->stage_times[PKL_STAGE_BACKEND];
+  stats->jitter_time = s->stage_times[PKL_STAGE_JITTER];
+  stats->ast_nodes = s->ast_nodes;
+  stats->routines = s->routines;
+  stats->insns = s->insns;
+  stats->max_routine_insns = s->max_routine_insns;
+  stats->bytes_allocated = s->bytes_allocated;
+
+  pkc->status = PK_OK;
+}
+
+void
+pk_reset_compile_stats (pk_compiler pkc)
+{
+  pkl_reset_compile_stats (pkc->compiler);
+  pkc->status = PK_OK;
+}
+
+const char *
+pk_vm_dispatch (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_dispatch_name ();
+}
+
 pk_ios
 pk_ios_cur (pk_compiler pkc)
 {
+  PK_ENTER (pkc);
   pkc->status = PK_OK;
   return (pk_ios) ios_cur ();
 }
@@ -440,7 +869,7 @@ pk_ios_cur (pk_compiler pkc)
 void
 pk_ios_set_cur (pk_compiler pkc, pk_ios io)
 {
-  /* XXX use pkc */
+  PK_ENTER (pkc);
   ios_set_cur ((ios) io);
   pkc->status = PK_OK;
 }
@@ -457,51 +886,147 @@ pk_ios_flags (pk_ios io)
   return ios_flags ((ios) io);
 }
 
+int
+pk_ios_buffer_stats (pk_ios io, uint64_t *chunk_size, uint64_t *nchunks,
+                     uint64_t *max_nchunks)
+{
+  if (ios_get_buffer_stats ((ios) io, chunk_size, nchunks,
+                            max_nchunks) != IOS_OK)
+    return PK_ERROR;
+
+  return PK_OK;
+}
+
+int
+pk_ios_cache_stats (pk_ios io, uint64_t *hits, uint64_t *misses)
+{
+  if (ios_get_cache_stats ((ios) io, hits, misses) != IOS_OK)
+    return PK_ERROR;
+
+  return PK_OK;
+}
+
+void
+pk_ios_stats (pk_ios io, struct pk_ios_stats *stats)
+{
+  struct ios_stats s;
+
+  ios_get_stats ((ios) io, &s);
+  stats->reads = s.reads;
+  stats->read_bytes = s.read_bytes;
+  stats->writes = s.writes;
+  stats->written_bytes = s.written_bytes;
+  stats->dev_reads = s.dev_reads;
+  stats->dev_read_bytes = s.dev_read_bytes;
+  stats->dev_writes = s.dev_writes;
+  stats->dev_written_bytes = s.dev_written_bytes;
+  stats->dev_seeks = s.dev_seeks;
+  stats->dev_nsecs = s.dev_nsecs;
+  stats->cache_hits = s.cache_hits;
+  stats->cache_misses = s.cache_misses;
+}
+
+void
+pk_ios_reset_stats (pk_ios io)
+{
+  ios_reset_stats ((ios) io);
+}
+
+uint64_t
+pk_ios_generation (pk_ios io)
+{
+  return ios_generation ((ios) io);
+}
+
+void
+pk_ios_dirty_ranges (pk_ios io, uint64_t generation,
+                     pk_ios_range_fn cb, void *data)
+{
+  ios_map_dirty ((ios) io, generation, cb, data);
+}
+
+void
+pk_ios_clear_dirty (pk_ios io)
+{
+  ios_clear_dirty ((ios) io);
+}
+
+int
+pk_ios_refresh (pk_compiler pkc, pk_ios io)
+{
+  PK_ENTER (pkc);
+  return ios_refresh ((ios) io) == IOS_OK ? PK_OK : PK_ERROR;
+}
+
+int
+pk_ios_change_fd (pk_ios io)
+{
+  return ios_get_change_fd ((ios) io);
+}
+
+int
+pk_ios_set_trace (pk_compiler pkc, const char *filename)
+{
+  PK_ENTER (pkc);
+  if (ios_set_trace_file (filename) != IOS_OK)
+    return PK_ERROR;
+
+  return PK_OK;
+}
+
 pk_ios
 pk_ios_search (pk_compiler pkc, const char *handler)
 {
+  PK_ENTER (pkc);
   pkc->status = PK_OK;
-  /* XXX use pkc */
   return (pk_ios) ios_search (handler);
 }
 
 pk_ios
 pk_ios_search_by_id (pk_compiler pkc, int id)
 {
+  PK_ENTER (pkc);
   pkc->status = PK_OK;
-  /* XXX use pkc */
   return (pk_ios) ios_search_by_id (id);
 }
 
+/* Translate an error code returned by ios_open to a PK_* error
+   code.  */
+
+static int
+pk_ios_error (int ret)
+{
+  switch (ret)
+    {
+    case IOS_ENOMEM: return PK_ENOMEM;
+    case IOS_EOF: return PK_EEOF;
+    case IOS_EINVAL:
+    case IOS_EOPEN:
+      return PK_EINVAL;
+    case IOS_ERROR:
+    default:
+      return PK_ERROR;
+    }
+}
+
 int
 pk_ios_open (pk_compiler pkc,
              const char *handler, uint64_t flags, int set_cur_p)
 {
   int ret;
 
-  /* XXX use pkc */
+  PK_ENTER (pkc);
   if ((ret = ios_open (handler, flags, set_cur_p)) >= 0)
     return ret;
 
-  switch (ret)
-    {
-    case IOS_ERROR: pkc->status = PK_ERROR; break;
-    case IOS_ENOMEM: pkc->status = PK_ENOMEM; break;
-    case IOS_EOF: pkc->status = PK_EEOF; break;
-    case IOS_EINVAL:
-    case IOS_EOPEN:
-      pkc->status = PK_EINVAL;
-      break;
-    default:
-      pkc->status = PK_ERROR;
-    }
+  pkc->status = pk_ios_error (ret);
   return PK_IOS_NOID;
 }
 
 void
 pk_ios_close (pk_compiler pkc, pk_ios io)
 {
-  /* XXX use pkc */
+  PK_ENTER (pkc);
   ios_close ((ios) io);
   pkc->status = PK_OK;
 }
@@ -542,7 +1067,7 @@ pk_ios_map (pk_compiler pkc,
             pk_ios_map_fn cb, void *data)
 {
   struct ios_map_fn_payload payload = { cb, data };
-  /* XXX use pkc */
+  PK_ENTER (pkc);
   ios_map (my_ios_map_fn, (void *) &payload);
   pkc->status = PK_OK;
 }
@@ -601,7 +1126,7 @@ pk_decl_map (pk_compiler pkc, int kind,
              pk_map_decl_fn handler, void *data)
 {
   struct decl_map_fn_payload payload = { handler, data };
-  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_env compiler_env = pk_compiler_env (pkc);
   int pkl_kind;
 
   pkc->status = PK_OK;
@@ -622,7 +1147,7 @@ pk_decl_map (pk_compiler pkc, int kind,
 int
 pk_decl_p (pk_compiler pkc, const char *name, int kind)
 {
-  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_env compiler_env = pk_compiler_env (pkc);
   pkl_ast_node decl = pkl_env_lookup (compiler_env,
                                       PKL_ENV_NS_MAIN,
                                       name,
@@ -649,7 +1174,7 @@ pk_decl_p (pk_compiler pkc, const char *name, int kind)
 pk_val
 pk_decl_val (pk_compiler pkc, const char *name)
 {
-  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_env compiler_env = pk_compiler_env (pkc);
   pvm_env runtime_env = pvm_get_env (pkc->vm);
   int back, over;
   pkl_ast_node decl = pkl_env_lookup (compiler_env,
@@ -670,7 +1195,7 @@ pk_decl_val (pk_compiler pkc, const char *name)
 void
 pk_decl_set_val (pk_compiler pkc, const char *name, pk_val val)
 {
-  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_env compiler_env = pk_compiler_env (pkc);
   pvm_env runtime_env = pvm_get_env (pkc->vm);
   int back, over;
   pkl_ast_node decl = pkl_env_lookup (compiler_env,
@@ -693,6 +1218,7 @@ pk_defvar (pk_compiler pkc, const char *varname, pk_val val)
 {
   pvm_env runtime_env = pvm_get_env (pkc->vm);
 
+  PK_ENTER (pkc);
   if (!pkl_defvar (pkc->compiler, varname, val))
     PK_RETURN (PK_ERROR);
   pvm_env_register (runtime_env, val);
@@ -700,28 +1226,496 @@ pk_defvar (pk_compiler pkc, const char *varname, pk_val val)
   PK_RETURN (PK_OK);
 }
 
+/* Number of arguments to pk_call that are collected without
+   allocating memory.  */
+
+#define PK_CALL_STACK_ARGS 16
+
+/* Call CLS with the arguments in AP, terminated by PVM_NULL.  */
+
+static int
+pk_call_va (pk_compiler pkc, pvm_val cls, pvm_val *ret, va_list ap)
+{
+  pvm_val stack_args[PK_CALL_STACK_ARGS];
+  pvm_val *args = stack_args;
+  size_t i, nargs = 0;
+  enum pvm_exit_code rret;
+  va_list aq;
+
+  PK_ENTER (pkc);
+
+  va_copy (aq, ap);
+  while (va_arg (aq, pvm_val) != PVM_NULL)
+    nargs++;
+  va_end (aq);
+
+  if (nargs > PK_CALL_STACK_ARGS)
+    {
+      args = malloc (nargs * sizeof (pvm_val));
+      if (!args)
+        PK_RETURN (PK_ENOMEM);
+    }
+
+  for (i = 0; i < nargs; ++i)
+    args[i] = va_arg (ap, pvm_val);
+
+  /* The closure is called through a trampoline of the PVM, so no
+     code is compiled here.  */
+  rret = pvm_call_closure_args (pkc->vm, cls, nargs, args, ret);
+
+  if (args != stack_args)
+    free (args);
+  PK_RETURN (rret == PVM_EXIT_OK ? PK_OK : PK_ERROR);
+}
+
 int
 pk_call (pk_compiler pkc, pk_val cls, pk_val *ret, ...)
 {
-  pvm_program program;
   va_list ap;
-  enum pvm_exit_code rret;
+  int status;
+
+  va_start (ap, ret);
+  status = pk_call_va (pkc, cls, ret, ap);
+  va_end (ap);
+  return status;
+}
+
+/* A declaration handle caches the lexical address of the variable or
+   function NAME in the global environment, which is valid as long as
+   the version of the environment is VERSION.  KIND is the kind of the
+   declaration, or -1 if there is no variable or function with that
+   name.  */
+
+struct pk_decl_handle
+{
+  pk_compiler pkc;
+  char *name;
+  int version;
+  int kind;
+  int back;
+  int over;
+};
+
+/* Look up the declaration of HANDLE again if the global environment
+   has changed since the last time.  Return 1 if it refers to a
+   variable or a function, 0 otherwise.  */
+
+static int
+pk_decl_handle_resolve (pk_decl_handle handle)
+{
+  pkl_env compiler_env = pkl_get_env (handle->pkc->compiler);
+  int version = pkl_env_version (compiler_env);
+
+  if (handle->version != version)
+    {
+      pkl_ast_node decl = pkl_env_lookup (compiler_env,
+                                          PKL_ENV_NS_MAIN,
+                                          handle->name,
+                                          &handle->back, &handle->over);
+
+      if (decl
+          && (PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_VAR
+              || PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_FUNC))
+        handle->kind = PKL_AST_DECL_KIND (decl);
+      else
+        handle->kind = -1;
+      handle->version = version;
+    }
+
+  return handle->kind != -1;
+}
+
+pk_decl_handle
+pk_decl_handle_new (pk_compiler pkc, const char *name)
+{
+  pk_decl_handle handle = malloc (sizeof (struct pk_decl_handle));
+
+  pkc->status = PK_OK;
+
+  if (!handle || !(handle->name = strdup (name)))
+    {
+      free (handle);
+      pkc->status = PK_ENOMEM;
+      return NULL;
+    }
+
+  handle->pkc = pkc;
+  handle->version = -1;
+  pk_decl_handle_resolve (handle);
+  return handle;
+}
+
+void
+pk_decl_handle_free (pk_decl_handle handle)
+{
+  if (handle)
+    {
+      free (handle->name);
+      free (handle);
+    }
+}
+
+pk_val
+pk_decl_handle_val (pk_decl_handle handle)
+{
+  handle->pkc->status = PK_OK;
+
+  if (!pk_decl_handle_resolve (handle))
+    return PK_NULL;
+
+  return pvm_env_lookup (pvm_get_env (handle->pkc->vm),
+                         handle->back, handle->over);
+}
+
+void
+pk_decl_handle_set_val (pk_decl_handle handle, pk_val val)
+{
+  handle->pkc->status = PK_OK;
+
+  if (!pk_decl_handle_resolve (handle))
+    return;
+
+  pvm_env_set_var (pvm_get_env (handle->pkc->vm),
+                   handle->back, handle->over, val);
+}
+
+int
+pk_decl_handle_call (pk_decl_handle handle, pk_val *ret, ...)
+{
+  pk_compiler pkc = handle->pkc;
+  pvm_val cls;
+  va_list ap;
+  int status;
+
+  if (!pk_decl_handle_resolve (handle))
+    PK_RETURN (PK_EINVAL);
+
+  cls = pvm_env_lookup (pvm_get_env (pkc->vm), handle->back, handle->over);
+  if (!PVM_IS_CLS (cls))
+    PK_RETURN (PK_EINVAL);
 
-  /* Compile a program that calls the function.  */
   va_start (ap, ret);
-  program = pkl_compile_call (pkc->compiler, cls, ret, ap);
+  status = pk_call_va (pkc, cls, ret, ap);
   va_end (ap);
-  if (!program)
+  return status;
+}
+
+/* A prepared expression is a closure for a function whose body
+   returns the expression, along with a program that calls it with
+   the arguments stored in ARGS.  */
+
+struct pk_prepared
+{
+  pk_compiler pkc;
+  pvm_val cls;
+  pvm_val args;
+  pvm_program program;
+};
+
+int
+pk_prepare_expression (pk_compiler pkc, const char *params,
+                       const char *expr, pk_prepared *prepared)
+{
+  struct pk_prepared *prep;
+  char *source;
+  pvm_val cls;
+  int ret;
+
+  PK_ENTER (pkc);
+  if (params && *params != '\0')
+    ret = asprintf (&source, "lambda (%s) any: { return %s; }",
+                    params, expr);
+  else
+    ret = asprintf (&source, "lambda any: { return %s; }", expr);
+  if (ret == -1)
+    PK_RETURN (PK_ENOMEM);
+
+  ret = pkl_execute_expression (pkc->compiler, source, NULL, &cls);
+  free (source);
+  if (!ret)
     PK_RETURN (PK_ERROR);
 
-  /* Run the program in the poke VM.  */
-  pvm_program_make_executable (program);
-  rret = pvm_run (pkc->vm, program, ret);
+  prep = malloc (sizeof (struct pk_prepared));
+  if (!prep)
+    PK_RETURN (PK_ENOMEM);
+
+  prep->pkc = pkc;
+  prep->cls = cls;
+  prep->args = PVM_NULL;
+  prep->program = NULL;
+  pvm_alloc_add_gc_roots (&prep->cls, 1);
+  pvm_alloc_add_gc_roots (&prep->args, 1);
+  pvm_alloc_add_gc_roots (&prep->program, 1);
 
-  pvm_destroy_program (program);
+  *prepared = prep;
+  PK_RETURN (PK_OK);
+}
+
+int
+pk_run_prepared (pk_prepared prepared, pk_val *ret, ...)
+{
+  pk_compiler pkc = prepared->pkc;
+  pvm_val args = prepared->args;
+  uint64_t i, nargs = 0;
+  enum pvm_exit_code rret;
+  va_list ap;
+
+  PK_ENTER (pkc);
+
+  va_start (ap, ret);
+  while (va_arg (ap, pvm_val) != PVM_NULL)
+    nargs++;
+  va_end (ap);
+
+  /* The program calling the closure is compiled the first time, and
+     every time the number of arguments changes.  */
+  if (prepared->program == NULL
+      || nargs != PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (args)))
+    {
+      pvm_program program;
+
+      args = pvm_make_array (pvm_make_ulong (0, 64),
+                             pvm_make_array_type (pvm_make_any_type (),
+                                                  PVM_NULL));
+      if (nargs > 0)
+        pvm_array_insert (args, pvm_make_ulong (nargs - 1, 64),
+                          pvm_make_int (0, 32));
+
+      program = pkl_compile_call_args (pkc->compiler, prepared->cls, args);
+      if (!program)
+        PK_RETURN (PK_ERROR);
+      pvm_program_make_executable (program);
+
+      if (prepared->program)
+        pvm_destroy_program (prepared->program);
+      prepared->program = program;
+      prepared->args = args;
+    }
+
+  /* Store the arguments where the program expects them.  ARGS is an
+     unmapped array of `any' values, so there are no element offsets
+     to keep up to date.  */
+  va_start (ap, ret);
+  for (i = 0; i < nargs; ++i)
+    PVM_VAL_ARR_ELEM_VALUE (args, i) = va_arg (ap, pvm_val);
+  va_end (ap);
+
+  rret = pvm_run (pkc->vm, prepared->program, ret);
   PK_RETURN (rret == PVM_EXIT_OK ? PK_OK : PK_ERROR);
 }
 
+void
+pk_prepared_free (pk_prepared prepared)
+{
+  if (prepared == NULL)
+    return;
+
+  if (prepared->program)
+    pvm_destroy_program (prepared->program);
+  pvm_alloc_remove_gc_roots (&prepared->cls, 1);
+  pvm_alloc_remove_gc_roots (&prepared->args, 1);
+  pvm_alloc_remove_gc_roots (&prepared->program, 1);
+  free (prepared);
+}
+
+/* A batch is run by a set of workers, each one having its own PVM
+   and IO context.  Every worker takes the next pending job, until
+   there are no more jobs.  NEXT_JOB is protected by LOCK.
+
+   The values returned by the jobs, and the exceptions raised by
+   them, are collected in VALUES, which is allocated in the
+   garbage-collected heap, and copied to the results once the batch
+   is done.  */
+
+#define PK_BATCH_MAX_THREADS 64
+
+struct pk_batch
+{
+  pk_compiler pkc;
+  pvm_program program;
+  const char **handlers;
+  size_t njobs;
+  size_t next_job;
+  pk_lock_t lock;
+  int *status;
+  pvm_val *values;
+};
+
+struct pk_batch_worker
+{
+  struct pk_batch *batch;
+  pvm vm;
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+};
+
+static void
+pk_batch_work (struct pk_batch_worker *w)
+{
+  struct pk_batch *batch = w->batch;
+
+  ios_context_set_cur (pvm_ios_context (w->vm));
+  libpoke_term_if = &batch->pkc->term_if;
+
+  while (1)
+    {
+      size_t job;
+      pvm_val val;
+      int id;
+
+      PK_LOCK (batch->lock);
+      job = batch->next_job++;
+      PK_UNLOCK (batch->lock);
+
+      if (job >= batch->njobs)
+        break;
+
+      id = ios_open (batch->handlers[job], 0, 1 /* set_cur */);
+      if (id < 0)
+        {
+          batch->status[job] = pk_ios_error (id);
+          continue;
+        }
+
+      if (pvm_apply (w->vm, batch->program, pvm_make_int (id, 32), &val)
+          == PVM_EXIT_OK)
+        {
+          batch->status[job] = PK_OK;
+          batch->values[2 * job] = val;
+        }
+      else
+        {
+          batch->status[job] = PK_ERROR;
+          batch->values[2 * job + 1] = val;
+        }
+
+      /* The function may have closed the IO space already.  */
+      {
+        ios io = ios_search_by_id (id);
+
+        if (io)
+          ios_close (io);
+      }
+    }
+}
+
+#if HAVE_PTHREAD
+
+static void *
+pk_batch_thread (void *data)
+{
+  pvm_alloc_register_thread ();
+  pk_batch_work (data);
+  return NULL;
+}
+
+#endif
+
+int
+pk_batch_run (pk_compiler pkc, pk_val cls, const char *handlers[],
+              size_t n, unsigned int nthreads,
+              struct pk_batch_result *results)
+{
+  struct pk_batch batch;
+  struct pk_batch_worker workers[PK_BATCH_MAX_THREADS];
+  unsigned int t, nworkers = 0;
+  size_t i;
+
+  PK_ENTER (pkc);
+  if (!PVM_IS_CLS (cls))
+    PK_RETURN (PK_EINVAL);
+
+#if HAVE_PTHREAD
+  if (nthreads == 0)
+    {
+      long nprocs = sysconf (_SC_NPROCESSORS_ONLN);
+      nthreads = nprocs > 0 ? nprocs : 1;
+    }
+#else
+  nthreads = 1;
+#endif
+
+  if (nthreads > PK_BATCH_MAX_THREADS)
+    nthreads = PK_BATCH_MAX_THREADS;
+  if (nthreads > n)
+    nthreads = n > 0 ? n : 1;
+
+  batch.pkc = pkc;
+  batch.handlers = handlers;
+  batch.njobs = n;
+  batch.next_job = 0;
+  batch.status = calloc (n > 0 ? n : 1, sizeof (int));
+  batch.values = pvm_alloc (sizeof (pvm_val) * 2 * (n > 0 ? n : 1));
+  if (!batch.status || !batch.values)
+    {
+      free (batch.status);
+      PK_RETURN (PK_ENOMEM);
+    }
+  for (i = 0; i < 2 * n; ++i)
+    batch.values[i] = PVM_NULL;
+  PK_LOCK_INIT (batch.lock);
+
+  /* The program calling the function is compiled once, and shared by
+     all the workers.  */
+  batch.program = pvm_make_apply_program (pkc->vm, cls);
+
+  for (t = 0; t < nthreads; ++t)
+    {
+      workers[t].batch = &batch;
+      workers[t].vm = pvm_worker_new (pkc->vm, 0 /* share_ios_p */);
+      if (!workers[t].vm)
+        break;
+      nworkers++;
+    }
+
+  if (nworkers == 0)
+    {
+      pvm_destroy_program (batch.program);
+      PK_LOCK_DESTROY (batch.lock);
+      free (batch.status);
+      PK_RETURN (PK_ENOMEM);
+    }
+
+#if HAVE_PTHREAD
+  for (t = 1; t < nworkers; ++t)
+    if (pthread_create (&workers[t].thread, NULL,
+                        pk_batch_thread, &workers[t]) != 0)
+      {
+        /* The other workers will take the jobs.  */
+        pvm_worker_free (workers[t].vm);
+        workers[t].vm = NULL;
+      }
+#endif
+
+  pk_batch_work (&workers[0]);
+
+#if HAVE_PTHREAD
+  for (t = 1; t < nworkers; ++t)
+    if (workers[t].vm)
+      pthread_join (workers[t].thread, NULL);
+#endif
+
+  for (t = 0; t < nworkers; ++t)
+    if (workers[t].vm)
+      pvm_worker_free (workers[t].vm);
+
+  for (i = 0; i < n; ++i)
+    {
+      results[i].status = batch.status[i];
+      results[i].value = batch.values[2 * i];
+      results[i].exception = batch.values[2 * i + 1];
+    }
+
+  pvm_destroy_program (batch.program);
+  PK_LOCK_DESTROY (batch.lock);
+  free (batch.status);
+
+  /* Freeing the workers changed the current IO context.  */
+  PK_ENTER (pkc);
+  PK_RETURN (PK_OK);
+}
+
 int
 pk_obase (pk_compiler pkc)
 {
@@ -915,9 +1909,107 @@ pk_set_pretty_print (pk_compiler pkc, int pretty_print_p)
   pkc->status = PK_OK;
 }
 
+uint64_t
+pk_ios_cache_size (pk_compiler pkc)
+{
+  PK_ENTER (pkc);
+  pkc->status = PK_OK;
+  return ios_get_cache_size ();
+}
+
+void
+pk_set_ios_cache_size (pk_compiler pkc, uint64_t size)
+{
+  PK_ENTER (pkc);
+  ios_set_cache_size (size);
+  pkc->status = PK_OK;
+}
+
+uint64_t
+pk_ios_cache_page_size (pk_compiler pkc)
+{
+  PK_ENTER (pkc);
+  pkc->status = PK_OK;
+  return ios_get_cache_page_size ();
+}
+
+int
+pk_set_ios_cache_page_size (pk_compiler pkc, uint64_t size)
+{
+  PK_ENTER (pkc);
+  if (ios_set_cache_page_size (size) != IOS_OK)
+    PK_RETURN (PK_EINVAL);
+
+  pkc->status = PK_OK;
+  return PK_OK;
+}
+
+int
+pk_gc_incremental (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_alloc_incremental_p ();
+}
+
+int
+pk_set_gc_incremental (pk_compiler pkc, int incremental_p)
+{
+  if (incremental_p)
+    pvm_alloc_enable_incremental ();
+  else if (pvm_alloc_incremental_p ())
+    PK_RETURN (PK_EINVAL);
+
+  pkc->status = PK_OK;
+  return PK_OK;
+}
+
+uint64_t
+pk_gc_free_space_divisor (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_alloc_free_space_divisor ();
+}
+
+int
+pk_set_gc_free_space_divisor (pk_compiler pkc, uint64_t divisor)
+{
+  if (divisor == 0)
+    PK_RETURN (PK_EINVAL);
+
+  pvm_alloc_set_free_space_divisor (divisor);
+  pkc->status = PK_OK;
+  return PK_OK;
+}
+
+void
+pk_gc_stats (pk_compiler pkc, struct pk_gc_stats *stats)
+{
+  struct pvm_alloc_stats s;
+  struct pvm_val_stats v;
+
+  pvm_alloc_stats (&s);
+  stats->heap_size = s.heap_size;
+  stats->free_bytes = s.free_bytes;
+  stats->bytes_since_gc = s.bytes_since_gc;
+  stats->total_bytes = s.total_bytes;
+  stats->collections = s.collections;
+  stats->live_bytes = s.live_bytes;
+  stats->pause_time = s.pause_time;
+  stats->max_pause_time = s.max_pause_time;
+
+  pvm_val_stats (&v);
+  stats->strings = v.strings;
+  stats->offsets = v.offsets;
+  stats->arrays = v.arrays;
+  stats->structs = v.structs;
+  stats->other_vals = v.others;
+  pkc->status = PK_OK;
+}
+
 void
 pk_print_val (pk_compiler pkc, pk_val val)
 {
+  PK_ENTER (pkc);
   pvm_print_val (pkc->vm, val);
   pkc->status = PK_OK;
 }
@@ -928,6 +2020,7 @@ pk_print_val_with_params (pk_compiler pkc, pk_val val,
                           int indent, int acutoff,
                           uint32_t flags)
 {
+  PK_ENTER (pkc);
   pvm_print_val_with_params (pkc->vm, val,
                              depth, mode, base,
                              indent, acutoff, flags);
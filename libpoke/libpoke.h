@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 #if defined BUILDING_LIBPOKE && HAVE_VISIBILITY
 #define LIBPOKE_API __attribute__ ((visibility ("default")))
@@ -28,8 +29,38 @@
 #define LIBPOKE_API
 #endif
 
+/* Thread safety.
+
+   Several compilers can be created, used and freed concurrently in
+   different threads of the same process.  Each compiler has its own
+   collection of IO spaces, its own Poke environment and its own
+   terminal interface, and these are not shared with the other
+   compilers.  The following rules apply:
+
+   - A given compiler can be used from any thread, but by only one
+     thread at a time.  Its IO spaces, values and prepared
+     expressions are subject to the same rule.
+
+   - Values shall not be passed from one compiler to another.
+
+   - A thread shall call some function taking a pk_compiler before it
+     calls any of the pk_make_* functions.  This registers the thread
+     in the garbage collector.
+
+   - The library settings related to the garbage collector, i.e.
+     pk_set_gc_incremental and pk_set_gc_free_space_divisor, affect
+     the whole process.
+
+   - The terminal interface callbacks of a compiler are invoked in the
+     thread operating the compiler.
+
+   If libpoke is built without POSIX threads support, or the garbage
+   collector doesn't support registering threads, then only one
+   thread shall use libpoke.  */
+
 typedef struct pk_compiler *pk_compiler;
 typedef struct pk_ios *pk_ios;
+typedef struct pk_prepared *pk_prepared;
 typedef uint64_t pk_val;
 
 /* The following status codes are returned by pk_errno function.  */
@@ -114,6 +145,28 @@ pk_compiler pk_compiler_new (struct pk_term_if *term_if) LIBPOKE_API;
 
 void pk_compiler_free (pk_compiler pkc) LIBPOKE_API;
 
+/* Fork the calling process, in order to start a worker process from
+   the state of the compiler PKC.
+
+   The child process gets a copy of PKC as it is in the parent, with
+   the compiler bootstrapped, its pickles loaded and its IO spaces
+   open, so it doesn't have to create a new compiler and load the
+   pickles again.  Since the memory of both processes is shared copy
+   on write, this is much faster than creating the compiler in the
+   child.
+
+   The modules being loaded in the background by pk_load_async are
+   loaded before forking.  No other thread shall be using PKC.  Since
+   streams are read by background threads, which don't exist in the
+   child process, this fails if PKC has stream IO spaces open, like
+   <stdin>.
+
+   Return the process ID of the child in the parent process, and 0 in
+   the child process.  On error, return -1 and set the status of PKC
+   to PK_ERROR.  */
+
+pid_t pk_compiler_fork (pk_compiler pkc) LIBPOKE_API;
+
 /* Error code of last operation.
 
    This function returns the status corresponding to the given PK
@@ -173,6 +226,25 @@ int pk_compile_expression (pk_compiler pkc, const char *buffer,
 
 int pk_load (pk_compiler pkc, const char *module) LIBPOKE_API;
 
+/* Like pk_load, but load the module in the background, while the
+   caller goes on with other work.  Return PK_ENOMEM if there is not
+   enough memory, PK_OK otherwise.
+
+   The modules are loaded in the order they are queued by this
+   function, one at a time, by a thread of the compiler.  Until all of
+   them are loaded, the functions using the compiler wait for them
+   to be loaded first, so they can be used as usual.  If threads are
+   not supported the module is loaded right away.  */
+
+int pk_load_async (pk_compiler pkc, const char *module) LIBPOKE_API;
+
+/* Wait for the modules queued by pk_load_async to be loaded.  Return
+   PK_OK if all the modules queued since the last call to this
+   function were loaded, or PK_ERROR if some of them couldn't be
+   loaded.  */
+
+int pk_load_wait (pk_compiler pkc) LIBPOKE_API;
+
 /* Print a disassembly of a named function.
 
    FNAME is the name of the function to disassemble.  It should be
@@ -218,16 +290,147 @@ int pk_disassemble_expression (pk_compiler pkc, const char *str,
 
 void pk_print_profile (pk_compiler pkc) LIBPOKE_API;
 
-/* Reset the profiling counters.  If the PVM hasn't been compiled with
-   profiling support this is a no-operation.  */
+/* Reset the profiling counters, and the data collected by the
+   function profiler.  The PVM counters are only available if the PVM
+   has been compiled with profiling support.  */
 
 void pk_reset_profile (pk_compiler pkc) LIBPOKE_API;
 
+/* Enable or disable the function profiler.  When enabled, the calls
+   to every Poke function, including the mappers, writers and
+   constructors of types, are counted along with the time spent in
+   them, for every chain of calls leading to them.  The function
+   profiler is available even if the PVM hasn't been compiled with
+   profiling support, and it is disabled by default.  */
+
+void pk_set_profile_functions (pk_compiler pkc, int profile_p) LIBPOKE_API;
+int pk_profile_functions_p (pk_compiler pkc) LIBPOKE_API;
+
+/* Print the data collected by the function profiler.  Functions are
+   identified by their name and the location where they are defined.
+
+   If FOLDED_P is set, print one line per chain of calls, with the
+   names of the functions separated by semicolons, followed by the
+   time spent in the last function in microseconds.  This format is
+   understood by flame graph generators.  Otherwise, print a table
+   with the time spent in every function, both by itself and
+   including the functions it calls, and the number of calls.  */
+
+void pk_print_function_profile (pk_compiler pkc, int folded_p) LIBPOKE_API;
+
+/* Cooperative preemption.
+
+   The Poke programs run by the compiler reach a safepoint at every
+   iteration of a loop, including the ones mapping, writing and
+   constructing the elements of arrays.  The execution budget is the number of safepoints that can be reached
+   before FN is called with DATA, and it is renewed every time FN
+   returns a non-zero value.  When FN returns zero, or if it is NULL,
+   the execution is interrupted by raising E_signal, as when the user
+   presses Ctrl-C.  Unwinding the stack through the exception handlers
+   leaves the state of the Poke program consistent.
+
+   FN can be used to process the events of the application, report
+   progress or enforce a deadline while a long operation is running.
+   It shall not use PKC to compile or run Poke code.
+
+   Every compilation or call by the application starts with a full
+   budget.  A BUDGET of zero, which is the default, means no
+   budget.  */
+
+typedef int (*pk_budget_fn) (void *data);
+
+void pk_set_budget (pk_compiler pkc, uint64_t budget,
+                    pk_budget_fn fn, void *data) LIBPOKE_API;
+
+/* Interrupt the Poke program being run by PKC at the next safepoint,
+   by raising E_signal.  If PKC is not running anything, the next
+   program run is interrupted.  This function can be called from any
+   thread, and from the budget function.  */
+
+void pk_interrupt (pk_compiler pkc) LIBPOKE_API;
+
+/* Statistics about the compilations performed by the incremental
+   compiler.
+
+   COMPILATIONS is the number of successful compilations.
+
+   PARSE_TIME, FRONTEND_TIME, MIDDLEEND_TIME, BACKEND_TIME and
+   JITTER_TIME are the wall times, in seconds, spent parsing, in the
+   passes of the compiler and generating native code.
+
+   AST_NODES is the number of AST nodes created.
+
+   ROUTINES is the number of PVM routines (functions, mappers,
+   writers, constructors and top-level programs) assembled.  INSNS is
+   the total number of PVM instructions in these routines and
+   MAX_ROUTINE_INSNS the number of instructions in the biggest one.
+
+   BYTES_ALLOCATED is the amount of memory, in bytes, allocated in the
+   garbage-collected heap while compiling.  */
+
+struct pk_compile_stats
+{
+  uint64_t compilations;
+  double parse_time;
+  double frontend_time;
+  double middleend_time;
+  double backend_time;
+  double jitter_time;
+  uint64_t ast_nodes;
+  uint64_t routines;
+  uint64_t insns;
+  uint64_t max_routine_insns;
+  uint64_t bytes_allocated;
+};
+
+/* Fill STATS with the statistics accumulated since the creation of
+   the compiler, or since the last call to pk_reset_compile_stats.
+   Note that this includes the compilation of the run-time and the
+   standard library.  */
+
+void pk_compile_stats (pk_compiler pkc,
+                       struct pk_compile_stats *stats) LIBPOKE_API;
+
+/* Reset the compilation statistics.  */
+
+void pk_reset_compile_stats (pk_compiler pkc) LIBPOKE_API;
+
+/* Return the name of the dispatch model used by the virtual machine
+   executing the compiled programs: "switch", "direct-threading",
+   "minimal-threading" or "no-threading".  This is chosen when
+   building libpoke.  */
+
+const char *pk_vm_dispatch (pk_compiler pkc) LIBPOKE_API;
+
 /* Set the QUIET_P flag in the compiler.  If this flag is set, the
    incremental compiler emits as few output as possible.  */
 
 void pk_set_quiet_p (pk_compiler pkc, int quiet_p) LIBPOKE_API;
 
+/* Set the TIME_PASSES_P flag in the compiler.  If this flag is set,
+   the incremental compiler prints the time spent in each of its
+   passes after every compilation.  */
+
+void pk_set_time_passes_p (pk_compiler pkc, int time_passes_p) LIBPOKE_API;
+
+/* Get and set the PEEPHOLE_P flag in the compiler.  If this flag is
+   set, which is the default, the programs generated by the
+   incremental compiler are optimized before being executed.  This
+   can be disabled in order to debug the code generator.  */
+
+int pk_peephole_p (pk_compiler pkc) LIBPOKE_API;
+void pk_set_peephole_p (pk_compiler pkc, int peephole_p) LIBPOKE_API;
+
+/* Get and set the inline threshold of the compiler.  Calls to small
+   functions and methods whose body is a single return statement are
+   replaced by the returned expression, if it has at most THRESHOLD
+   nodes.  A THRESHOLD of zero disables inlining.
+   pk_set_inline_threshold returns PK_EINVAL if THRESHOLD is
+   negative.  */
+
+int pk_inline_threshold (pk_compiler pkc) LIBPOKE_API;
+int pk_set_inline_threshold (pk_compiler pkc, int threshold) LIBPOKE_API;
+
 /* Install a handler for alien tokens in the incremental compiler.
    The handler gets a string with the token identifier (for $foo it
    would get `foo') and should return a string containing the
@@ -323,6 +526,152 @@ uint64_t pk_ios_size (pk_ios ios) LIBPOKE_API;
 
 uint64_t pk_ios_flags (pk_ios ios) LIBPOKE_API;
 
+/* IOD-specific flags for stream IO spaces.
+
+   N << PK_IOS_F_STREAM_CHUNK_SHIFT, for N between 4 and 30, makes
+   input streams buffer the read data in chunks of 2**N bytes.  */
+
+#define PK_IOS_F_STREAM_CHUNK_SHIFT 32
+
+/* N << PK_IOS_F_STREAM_READER_SHIFT, for N between 12 and 40, makes
+   input streams to be read by a background thread, which keeps up
+   to 2**N bytes buffered ahead of the last flushed offset.  */
+
+#define PK_IOS_F_STREAM_READER_SHIFT 40
+
+/* Get statistics about the buffer used by the given IO space.
+
+   CHUNK_SIZE is set to the size in bytes of the chunks of the
+   buffer.  NCHUNKS is set to the number of chunks currently in the
+   buffer, and MAX_NCHUNKS to the maximum number of chunks the buffer
+   has ever held.
+
+   Return PK_ERROR if the IO space doesn't buffer data, PK_OK
+   otherwise.  */
+
+int pk_ios_buffer_stats (pk_ios ios, uint64_t *chunk_size,
+                         uint64_t *nchunks,
+                         uint64_t *max_nchunks) LIBPOKE_API;
+
+/* Get statistics about the page cache used by the given IO space.
+
+   HITS is set to the number of reads served from the cache, and
+   MISSES to the number of reads that had to access the underlying
+   device.
+
+   Return PK_ERROR if the IO space doesn't use a cache, PK_OK
+   otherwise.  */
+
+int pk_ios_cache_stats (pk_ios ios, uint64_t *hits,
+                        uint64_t *misses) LIBPOKE_API;
+
+/* Statistics about the accesses performed in an IO space.
+
+   READS and READ_BYTES are the number of read requests served by the
+   IO space and the number of bytes requested by them.  WRITES and
+   WRITTEN_BYTES are the same for write requests.
+
+   DEV_READS, DEV_READ_BYTES, DEV_WRITES and DEV_WRITTEN_BYTES are
+   the number of calls to the underlying device to read and write
+   data, and the number of bytes transferred by them.  DEV_SEEKS is
+   the number of device calls that didn't start where the previous
+   one ended.  DEV_NSECS is the total time spent in device calls, in
+   nanoseconds.
+
+   CACHE_HITS and CACHE_MISSES are the statistics of the page cache
+   of the IO space, as returned by pk_ios_cache_stats.  */
+
+struct pk_ios_stats
+{
+  uint64_t reads;
+  uint64_t read_bytes;
+  uint64_t writes;
+  uint64_t written_bytes;
+  uint64_t dev_reads;
+  uint64_t dev_read_bytes;
+  uint64_t dev_writes;
+  uint64_t dev_written_bytes;
+  uint64_t dev_seeks;
+  uint64_t dev_nsecs;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+};
+
+/* Get the statistics of the given IO space in STATS.  */
+
+void pk_ios_stats (pk_ios ios, struct pk_ios_stats *stats) LIBPOKE_API;
+
+/* Set the statistics of the given IO space to zero.  */
+
+void pk_ios_reset_stats (pk_ios ios) LIBPOKE_API;
+
+/* Every write to an IO space starts a new generation of it.  Return
+   the current generation of the given IO space, which is always
+   bigger than zero.  */
+
+uint64_t pk_ios_generation (pk_ios ios) LIBPOKE_API;
+
+/* IO spaces keep the set of byte ranges written in them since the set
+   was last cleared, which allows clients to update only the parts of
+   their views that have changed, or to save only the modified data.
+
+   Call CB for every range of the given IO space that has been
+   written after the generation GENERATION, as returned by
+   pk_ios_generation, passing it the byte offset and size of the
+   range, and DATA.  If GENERATION is 0 then CB is called for all the
+   ranges.  The ranges are passed in ascending order and never
+   overlap.
+
+   If there was not enough memory to record the written ranges then
+   CB is called once with an offset of 0 and a size of UINT64_MAX,
+   which covers the whole IO space.
+
+   The offsets are relative to the underlying device, and are the
+   same as the offsets in the IO space unless the IO space has a
+   bias.  */
+
+typedef void (*pk_ios_range_fn) (uint64_t offset, uint64_t size,
+                                 void *data);
+void pk_ios_dirty_ranges (pk_ios ios, uint64_t generation,
+                          pk_ios_range_fn cb, void *data) LIBPOKE_API;
+
+/* Empty the set of written ranges of the given IO space.  */
+
+void pk_ios_clear_dirty (pk_ios ios) LIBPOKE_API;
+
+/* IO spaces whose files are modified by other programs keep stale
+   data.  Check whether the device of the given IO space has been
+   modified, and if so, record the modified ranges as written, so the
+   values mapped from them are mapped again and they are reported by
+   pk_ios_dirty_ranges.  The devices don't tell what was modified,
+   so any data not in the cache of the IO space is considered
+   modified.  Return PK_OK on success, PK_ERROR otherwise.  */
+
+int pk_ios_refresh (pk_compiler pkc, pk_ios ios) LIBPOKE_API;
+
+/* Return a file descriptor that becomes ready for reading when the
+   device of the given IO space is modified by other programs, so
+   clients can wait for it with select or poll and then call
+   pk_ios_refresh.  Return -1 if the device can't tell.  */
+
+int pk_ios_change_fd (pk_ios ios) LIBPOKE_API;
+
+/* Log the accesses to the IO spaces of the compiler to the file
+   FILENAME, which is created or truncated.  Every access is logged
+   in a line like:
+
+     IOS_ID KIND OFFSET COUNT
+
+   where KIND is either "read" or "write" for the requests served by
+   the IO space, or "pread" or "pwrite" for the calls to the
+   underlying device, OFFSET is a byte offset in hexadecimal with a
+   0x prefix and COUNT is a number of bytes.
+
+   If FILENAME is NULL then stop logging.  Return PK_ERROR if the
+   file can't be opened, PK_OK otherwise.  */
+
+int pk_ios_set_trace (pk_compiler pkc, const char *filename) LIBPOKE_API;
+
 /* Open an IO space using a handler and if set_cur is set to 1, make
    the newly opened IO space the current space.  Return PK_IOS_NOID
    if there is an error opening the space (such as an unrecognized
@@ -398,6 +747,55 @@ pk_val pk_decl_val (pk_compiler pkc, const char *name) LIBPOKE_API;
 void pk_decl_set_val (pk_compiler pkc, const char *name, pk_val val)
   LIBPOKE_API;
 
+/* Handles for declarations.
+
+   Looking up a declaration by name in `pk_decl_val' and
+   `pk_decl_set_val' involves hashing the name and searching the
+   global environment of the compiler.  Applications that access the
+   same variables or call the same functions repeatedly can instead
+   get a handle for the declaration, which caches its location.
+
+   The handle remains valid when the declaration is redefined, like
+   when a pickle is loaded again: the cached location is checked
+   against the version of the global environment, and the name is
+   looked up again only if some variable or function has been
+   declared since the last access.  The name doesn't need to be
+   declared at the time the handle is created.
+
+   Return NULL if there is not enough memory to create the handle.
+   The handle shall be freed with `pk_decl_handle_free' before the
+   compiler is freed.  */
+
+typedef struct pk_decl_handle *pk_decl_handle;
+
+pk_decl_handle pk_decl_handle_new (pk_compiler pkc, const char *name)
+  LIBPOKE_API;
+
+void pk_decl_handle_free (pk_decl_handle handle) LIBPOKE_API;
+
+/* Return the value of the variable or function referred by HANDLE,
+   like `pk_decl_val'.  If there is no such variable or function,
+   return PK_NULL.  */
+
+pk_val pk_decl_handle_val (pk_decl_handle handle) LIBPOKE_API;
+
+/* Set a new value to the variable referred by HANDLE, like
+   `pk_decl_set_val'.  If there is no such variable, then this is a
+   no-operation.  */
+
+void pk_decl_handle_set_val (pk_decl_handle handle, pk_val val)
+  LIBPOKE_API;
+
+/* Call the function referred by HANDLE, like `pk_call'.  The
+   arguments follow RET, terminated by PK_NULL.
+
+   Return PK_EINVAL if HANDLE doesn't refer to a function, or to a
+   variable whose value is a closure.  Otherwise return the same
+   values than `pk_call'.  */
+
+int pk_decl_handle_call (pk_decl_handle handle, pk_val *ret, ...)
+  LIBPOKE_API;
+
 /* Declare a variable in the global environment of the given
    incremental compiler.
 
@@ -422,6 +820,89 @@ int pk_defvar (pk_compiler pkc, const char *varname, pk_val val) LIBPOKE_API;
 
 int pk_call (pk_compiler pkc, pk_val cls, pk_val *ret, ...) LIBPOKE_API;
 
+/* Prepare a Poke expression to be evaluated many times.
+
+   EXPR is a Poke expression that may refer to the parameters
+   declared in PARAMS, which is a string with the formal arguments of
+   a Poke function, like "int i, string s".  PARAMS can be NULL or an
+   empty string if the expression has no parameters.
+
+   The expression is compiled only once, in the global environment of
+   the compiler, and a handle is stored in *PREPARED that can then be
+   evaluated with `pk_run_prepared'.
+
+   Return PK_ERROR if the expression or the parameters don't compile.
+   Return PK_OK otherwise.  */
+
+int pk_prepare_expression (pk_compiler pkc, const char *params,
+                           const char *expr, pk_prepared *prepared)
+  LIBPOKE_API;
+
+/* Evaluate a prepared expression.
+
+   RET is set to the value of the expression.
+
+   A variable number of arguments follow, terminated by PK_NULL, whose
+   values are bound to the parameters of the expression.  As in
+   `pk_call', the arguments shall be of the same types than the
+   corresponding parameters, since no conversions are performed.
+
+   Evaluating a prepared expression doesn't involve compiling
+   anything, except the very first time it is evaluated with a given
+   number of arguments.
+
+   Return PK_ERROR if there is a problem performing the operation, or
+   if the evaluation of the expression results in an unhandled
+   exception.  Return PK_OK otherwise.  */
+
+int pk_run_prepared (pk_prepared prepared, pk_val *ret, ...) LIBPOKE_API;
+
+/* Free the resources used by a prepared expression.  */
+
+void pk_prepared_free (pk_prepared prepared) LIBPOKE_API;
+
+/* Run a Poke function on many IO spaces.
+
+   CLS is the closure of a function compiled in PKC, which gets an
+   int<32> argument.  For every handler in HANDLERS, which has N
+   entries, the corresponding IO space is opened and made the current
+   one, and the function is called with its id.  The IO space is
+   closed once the function returns.
+
+   The jobs are distributed among NTHREADS threads, or as many threads
+   as online processors if NTHREADS is 0.  Every thread takes the
+   next pending job as soon as it is done with the previous one, and
+   has its own VM state and IO spaces.  All of them share the global
+   variables of PKC, so the function should not modify them.  When
+   libpoke is built without threads support the jobs are run in the
+   calling thread.
+
+   The outcome of the job processing HANDLERS[I] is stored in
+   RESULTS[I]:
+
+   STATUS is PK_OK if the function returned, PK_ERROR if it raised
+   an exception, or the error code of `pk_ios_open' if the IO space
+   couldn't be opened.
+
+   VALUE is the value returned by the function, or PK_NULL.
+
+   EXCEPTION is the exception raised by the function, or PK_NULL.
+
+   Return PK_EINVAL if CLS is not a closure, and PK_ENOMEM if there
+   is not enough memory to run the batch.  Return PK_OK otherwise, no
+   matter the outcome of the jobs.  */
+
+struct pk_batch_result
+{
+  int status;
+  pk_val value;
+  pk_val exception;
+};
+
+int pk_batch_run (pk_compiler pkc, pk_val cls, const char *handlers[],
+                  size_t n, unsigned int nthreads,
+                  struct pk_batch_result *results) LIBPOKE_API;
+
 /* Get and set properties of the incremental compiler.  */
 
 int pk_obase (pk_compiler pkc) LIBPOKE_API;
@@ -473,6 +954,82 @@ void pk_set_nenc (pk_compiler pkc, enum pk_nenc nenc) LIBPOKE_API;
 int pk_pretty_print (pk_compiler pkc) LIBPOKE_API;
 void pk_set_pretty_print (pk_compiler pkc, int pretty_print_p) LIBPOKE_API;
 
+/* Get and set the parameters of the page caches used by the IO
+   spaces.
+
+   The cache size is the maximum number of bytes cached for each IO
+   space.  Zero disables caching.
+
+   The page size shall be a power of two between 512 and 1048576.
+   pk_set_ios_cache_page_size returns PK_EINVAL if it is not.  */
+
+uint64_t pk_ios_cache_size (pk_compiler pkc) LIBPOKE_API;
+void pk_set_ios_cache_size (pk_compiler pkc, uint64_t size) LIBPOKE_API;
+
+uint64_t pk_ios_cache_page_size (pk_compiler pkc) LIBPOKE_API;
+int pk_set_ios_cache_page_size (pk_compiler pkc,
+                                uint64_t size) LIBPOKE_API;
+
+/* Get and set the parameters of the garbage collector.
+
+   When incremental collection is enabled the collector does its work
+   in small steps while allocating, avoiding long pauses.  Note that
+   the collector is shared by all the incremental compilers in the
+   process, and that once enabled incremental collection can't be
+   disabled: pk_set_gc_incremental returns PK_EINVAL in that case.
+
+   The free space divisor determines how the heap grows.  The
+   collector runs, instead of expanding the heap, once the number of
+   bytes allocated since the last collection exceeds the size of the
+   heap divided by the divisor.  Bigger divisors mean a smaller heap
+   and more frequent collections.  pk_set_gc_free_space_divisor
+   returns PK_EINVAL if DIVISOR is zero.  */
+
+int pk_gc_incremental (pk_compiler pkc) LIBPOKE_API;
+int pk_set_gc_incremental (pk_compiler pkc, int incremental_p) LIBPOKE_API;
+
+uint64_t pk_gc_free_space_divisor (pk_compiler pkc) LIBPOKE_API;
+int pk_set_gc_free_space_divisor (pk_compiler pkc,
+                                  uint64_t divisor) LIBPOKE_API;
+
+/* Statistics about the garbage-collected heap.
+
+   HEAP_SIZE is the size of the heap and FREE_BYTES the number of
+   bytes in it that are free.  BYTES_SINCE_GC is the number of bytes
+   allocated since the last collection, TOTAL_BYTES the number of bytes
+   allocated since libpoke was loaded, and COLLECTIONS the number of
+   collections performed.
+
+   LIVE_BYTES approximates the number of bytes that survived the last
+   collection.  PAUSE_TIME is the time spent in collections and
+   MAX_PAUSE_TIME the longest of them, in seconds, or -1 if the
+   collector doesn't support measuring them.
+
+   STRINGS, OFFSETS, ARRAYS and STRUCTS are the number of values of
+   each kind allocated since libpoke was loaded, and OTHER_VALS the
+   number of types, closures and dictionaries.  These counts are shared
+   by all the compilers of the process, and they are approximate when
+   several threads run Poke code at the same time.  */
+
+struct pk_gc_stats
+{
+  uint64_t heap_size;
+  uint64_t free_bytes;
+  uint64_t bytes_since_gc;
+  uint64_t total_bytes;
+  uint64_t collections;
+  uint64_t live_bytes;
+  double pause_time;
+  double max_pause_time;
+  uint64_t strings;
+  uint64_t offsets;
+  uint64_t arrays;
+  uint64_t structs;
+  uint64_t other_vals;
+};
+
+void pk_gc_stats (pk_compiler pkc, struct pk_gc_stats *stats) LIBPOKE_API;
+
 /*** API for manipulating Poke values.  ***/
 
 /* PK_NULL is an invalid pk_val.
@@ -676,7 +1233,8 @@ pk_val pk_array_nelem (pk_val array) LIBPOKE_API;
    ARRAY is the array value.
    IDX is the index of the element in the array.
 
-   If IDX is invalid, PK_NULL is returned. */
+   If IDX is invalid, or ARRAY is mapped and the element can't be
+   read from IO, PK_NULL is returned. */
 
 pk_val pk_array_elem_val (pk_val array, uint64_t idx) LIBPOKE_API;
 
@@ -718,6 +1276,61 @@ void pk_array_set_elem (pk_val array, uint64_t idx, pk_val val) LIBPOKE_API;
 
 pk_val pk_array_elem_boffset (pk_val array, uint64_t idx) LIBPOKE_API;
 
+/* Copy the values of COUNT elements of an array, starting at the
+   element IDX, to the buffer BUF, which shall have room for COUNT
+   elements.
+
+   The elements of ARRAY shall be integral, signed or unsigned, of
+   any size.  The values are copied as 64-bit integers:
+   pk_array_get_int64s sign-extends the values of signed elements,
+   and pk_array_get_uint64s returns their two's complement
+   representation.  Elements of mapped arrays are peeked from IO as
+   needed.
+
+   This is equivalent to, but much faster than, calling
+   pk_array_elem_val and pk_int_value or pk_uint_value for each
+   element.
+
+   Return PK_EINVAL if the elements of ARRAY are not integral, or if
+   the range of elements is not within the boundaries of ARRAY.
+   Return PK_OK otherwise.  */
+
+int pk_array_get_uint64s (pk_val array, uint64_t idx, uint64_t count,
+                          uint64_t *buf) LIBPOKE_API;
+int pk_array_get_int64s (pk_val array, uint64_t idx, uint64_t count,
+                         int64_t *buf) LIBPOKE_API;
+
+/* Set the values of COUNT elements of an array, starting at the
+   element IDX, to the values in the buffer BUF, truncated to the size
+   of the elements.
+
+   Like pk_array_set_elem, this doesn't change the contents of the IO
+   space where ARRAY may be mapped.
+
+   Return like pk_array_get_uint64s.  */
+
+int pk_array_set_uint64s (pk_val array, uint64_t idx, uint64_t count,
+                          const uint64_t *buf) LIBPOKE_API;
+int pk_array_set_int64s (pk_val array, uint64_t idx, uint64_t count,
+                         const int64_t *buf) LIBPOKE_API;
+
+/* Return a pointer to the contents of an array of integral elements
+   stored contiguously by libpoke, allowing to access them without
+   copying.  The elements are stored as native unsigned integers of
+   *ELEM_SIZE bytes, which is 1, 2, 4 or 8, holding the two's
+   complement representation of their values truncated to the size of
+   the elements.  Elements of mapped arrays not peeked so far are
+   peeked from IO, and the ones that can't be read are zero.
+
+   The returned pointer is valid until ARRAY is modified, and
+   modifying the contents of the buffer modifies ARRAY.
+
+   Return NULL if the elements of ARRAY are not stored contiguously,
+   which may happen even if they are integral.  In that case use
+   pk_array_get_uint64s or pk_array_get_int64s instead.  */
+
+void *pk_array_data (pk_val array, size_t *elem_size) LIBPOKE_API;
+
 /* Integral types.  */
 
 /* Build and return an integral type.
@@ -893,6 +1506,10 @@ pk_val pk_val_offset (pk_val val) LIBPOKE_API;
 
 /* Other operations on values.  */
 
+/* Return the size of the given value, in bits.  */
+
+uint64_t pk_sizeof (pk_val val) LIBPOKE_API;
+
 /* Return the type of the given value.  */
 
 pk_val pk_typeof (pk_val val) LIBPOKE_API;
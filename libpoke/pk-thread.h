@@ -0,0 +1,97 @@
+/* pk-thread.h - Thread support for libpoke.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PK_THREAD_H
+#define PK_THREAD_H
+
+#include <config.h>
+
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+/* libpoke supports several compilers running concurrently in
+   different threads.  The little state that is shared among all the
+   compilers of a process is protected by the locks defined below.
+   When poke is built without POSIX threads support these macros
+   expand to nothing.
+
+   PK_THREAD_LOCAL qualifies a variable having one instance per
+   thread.  */
+
+#if defined __STDC_VERSION__ && __STDC_VERSION__ >= 201112L
+#  define PK_THREAD_LOCAL _Thread_local
+#else
+#  define PK_THREAD_LOCAL __thread
+#endif
+
+/* PK_LOCK_DEFINE (NAME) defines a static lock called NAME, which is
+   acquired with PK_LOCK (NAME) and released with PK_UNLOCK (NAME).
+   Locks are not recursive.
+
+   Locks that are not static, like the ones stored in structs, have
+   type pk_lock_t.  They are initialized either with
+   PK_LOCK_INITIALIZER or with PK_LOCK_INIT (LOCK), and the latter
+   must be destroyed with PK_LOCK_DESTROY (LOCK).
+
+   PK_ONCE_DEFINE (NAME) defines a static flag to be used with
+   PK_ONCE (NAME, FN), which calls FN once in the lifetime of the
+   process, no matter how many threads execute it.  */
+
+#if HAVE_PTHREAD
+
+#  define PK_LOCK_DEFINE(NAME)                                  \
+  static pthread_mutex_t NAME = PTHREAD_MUTEX_INITIALIZER
+#  define PK_LOCK(NAME) pthread_mutex_lock (&(NAME))
+#  define PK_UNLOCK(NAME) pthread_mutex_unlock (&(NAME))
+
+typedef pthread_mutex_t pk_lock_t;
+#  define PK_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#  define PK_LOCK_INIT(LOCK) pthread_mutex_init (&(LOCK), NULL)
+#  define PK_LOCK_DESTROY(LOCK) pthread_mutex_destroy (&(LOCK))
+
+#  define PK_ONCE_DEFINE(NAME)                  \
+  static pthread_once_t NAME = PTHREAD_ONCE_INIT
+#  define PK_ONCE(NAME,FN) pthread_once (&(NAME), (FN))
+
+#else
+
+#  define PK_LOCK_DEFINE(NAME) extern int NAME ## _unused_lock
+#  define PK_LOCK(NAME) do {} while (0)
+#  define PK_UNLOCK(NAME) do {} while (0)
+
+typedef int pk_lock_t;
+#  define PK_LOCK_INITIALIZER 0
+#  define PK_LOCK_INIT(LOCK) do {} while (0)
+#  define PK_LOCK_DESTROY(LOCK) do {} while (0)
+
+#  define PK_ONCE_DEFINE(NAME) static int NAME
+#  define PK_ONCE(NAME,FN)                      \
+  do                                            \
+    {                                           \
+      if (!(NAME))                              \
+        {                                       \
+          (FN) ();                              \
+          (NAME) = 1;                           \
+        }                                       \
+    }                                           \
+  while (0)
+
+#endif /* ! HAVE_PTHREAD */
+
+#endif /* ! PK_THREAD_H */
@@ -165,6 +165,12 @@ pk_val_offset (pk_val val)
                             pvm_make_ulong (1, 32));
 }
 
+uint64_t
+pk_sizeof (pk_val val)
+{
+  return pvm_sizeof (val);
+}
+
 int
 pk_type_code (pk_val val)
 {
@@ -249,7 +255,10 @@ pk_val pk_struct_field_value (pk_val sct, uint64_t idx)
 void pk_struct_set_field_value (pk_val sct, uint64_t idx, pk_val value)
 {
   if (idx < pk_uint_value (pk_struct_nfields (sct)))
-    PVM_VAL_SCT_FIELD_VALUE (sct, idx) = value;
+    {
+      PVM_VAL_SCT_FIELD_VALUE (sct, idx) = value;
+      pvm_struct_memo_flush (sct);
+    }
 }
 
 pk_val
@@ -402,7 +411,7 @@ pk_val
 pk_array_elem_val (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_VALUE (array, idx);
+    return pvm_array_elem_value (array, idx);
   else
     return PK_NULL;
 }
@@ -423,14 +432,62 @@ pk_val
 pk_array_elem_boffset (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_OFFSET (array, idx);
+    return pvm_array_elem_offset (array, idx);
   else
     return PK_NULL;
 }
 
+int
+pk_array_get_uint64s (pk_val array, uint64_t idx, uint64_t count,
+                      uint64_t *buf)
+{
+  return (pvm_array_get_integrals (array, idx, count, buf)
+          ? PK_OK : PK_EINVAL);
+}
+
+int
+pk_array_get_int64s (pk_val array, uint64_t idx, uint64_t count,
+                     int64_t *buf)
+{
+  return (pvm_array_get_integrals (array, idx, count, (uint64_t *) buf)
+          ? PK_OK : PK_EINVAL);
+}
+
+int
+pk_array_set_uint64s (pk_val array, uint64_t idx, uint64_t count,
+                      const uint64_t *buf)
+{
+  return (pvm_array_set_integrals (array, idx, count, buf)
+          ? PK_OK : PK_EINVAL);
+}
+
+int
+pk_array_set_int64s (pk_val array, uint64_t idx, uint64_t count,
+                     const int64_t *buf)
+{
+  return (pvm_array_set_integrals (array, idx, count,
+                                   (const uint64_t *) buf)
+          ? PK_OK : PK_EINVAL);
+}
+
+void *
+pk_array_data (pk_val array, size_t *elem_size)
+{
+  int width;
+  void *data = pvm_array_packed_data (array, &width);
+
+  if (data)
+    *elem_size = width;
+  return data;
+}
+
 void
 pk_array_set_elem_boffset (pk_val array, uint64_t idx, pk_val boffset)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    PVM_VAL_ARR_ELEM_OFFSET (array, idx) = boffset;
+    {
+      pvm_array_materialize (array);
+      pvm_array_unshare (array);
+      PVM_VAL_ARR_ELEM_OFFSET (array, idx) = boffset;
+    }
 }
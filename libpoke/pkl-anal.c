@@ -371,6 +371,50 @@ PKL_PHASE_BEGIN_HANDLER (pkl_anal1_ps_func)
         }
     }
 
+  /* The results of memoized methods are cached by argument, so they
+     can take at most one argument, which should be of a type whose
+     values can be compared: an integral, offset or string type.
+     Also, they should return a value.  */
+  if (PKL_AST_FUNC_MEMO_P (func))
+    {
+      pkl_ast_node args = PKL_AST_FUNC_ARGS (func);
+      pkl_ast_node ret_type = PKL_AST_FUNC_RET_TYPE (func);
+
+      if (PKL_AST_TYPE_CODE (ret_type) == PKL_TYPE_VOID)
+        {
+          PKL_ERROR (PKL_AST_LOC (func),
+                     "memo methods should return a value");
+          PKL_ANAL_PAYLOAD->errors++;
+          PKL_PASS_ERROR;
+        }
+
+      if (args && PKL_AST_CHAIN (args))
+        {
+          PKL_ERROR (PKL_AST_LOC (PKL_AST_CHAIN (args)),
+                     "memo methods can take at most one argument");
+          PKL_ANAL_PAYLOAD->errors++;
+          PKL_PASS_ERROR;
+        }
+
+      if (args)
+        {
+          pkl_ast_node arg_type = PKL_AST_FUNC_ARG_TYPE (args);
+          int arg_type_code = PKL_AST_TYPE_CODE (arg_type);
+
+          if (PKL_AST_FUNC_ARG_VARARG (args)
+              || (arg_type_code != PKL_TYPE_INTEGRAL
+                  && arg_type_code != PKL_TYPE_OFFSET
+                  && arg_type_code != PKL_TYPE_STRING))
+            {
+              PKL_ERROR (PKL_AST_LOC (args),
+                         "invalid argument in memo method\n"
+                         "expected integral, offset or string");
+              PKL_ANAL_PAYLOAD->errors++;
+              PKL_PASS_ERROR;
+            }
+        }
+    }
+
   if (PKL_AST_FUNC_METHOD_P (PKL_PASS_NODE))
     PKL_ANAL_POP_CONTEXT;
 }
@@ -670,6 +714,17 @@ PKL_PHASE_BEGIN_HANDLER (pkl_anal1_ps_cons)
           PKL_PASS_ERROR;
         }
       break;
+    case PKL_TYPE_DICT:
+      /* Dict constructors create empty dicts, and accept no
+         arguments.  */
+      if (cons_value)
+        {
+          PKL_ERROR (PKL_AST_LOC (cons),
+                     "dict constructor doesn't accept arguments");
+          PKL_ANAL_PAYLOAD->errors++;
+          PKL_PASS_ERROR;
+        }
+      break;
     default:
       assert (0);
     }
@@ -86,6 +86,7 @@ struct pkl_asm_level
   pkl_ast_node node1;
   pkl_ast_node node2;
   int int1;
+  int int2;
 
   pvm_program_label break_label;
   pvm_program_label continue_label;
@@ -102,7 +103,9 @@ struct pkl_asm_level
    AST is for creating ast nodes whenever needed.
 
    ERROR_LABEL marks the generic error handler defined in the standard
-   prologue.  */
+   prologue.
+
+   NUM_INSNS is the number of PVM instructions appended to PROGRAM.  */
 
 #define PKL_ASM_LEVEL(PASM) ((PASM)->level)
 
@@ -113,6 +116,7 @@ struct pkl_asm
   struct pkl_asm_level *level;
   pkl_ast ast;
   pvm_program_label error_label;
+  size_t num_insns;
 };
 
 /* Return a PVM value to hold an integral value VALUE of size SIZE and
@@ -867,9 +871,20 @@ pkl_asm_insn_cmp (pkl_asm pasm,
     }
   else if (PKL_AST_TYPE_CODE (type) == PKL_TYPE_ARRAY)
     {
+      pkl_ast_node etype = PKL_AST_TYPE_A_ETYPE (type);
+
       assert (insn == PKL_INSN_EQ || insn == PKL_INSN_NE);
 
-      RAS_MACRO_EQA (PKL_AST_TYPE_A_ETYPE (type));
+      /* Arrays of integers and strings, like magic numbers and
+         digests, are compared natively.  The elements of other
+         arrays are compared one by one in the generated code, since
+         the equality of structs and offsets is not the identity of
+         their values.  */
+      if (PKL_AST_TYPE_CODE (etype) == PKL_TYPE_INTEGRAL
+          || PKL_AST_TYPE_CODE (etype) == PKL_TYPE_STRING)
+        pkl_asm_insn (pasm, PKL_INSN_AEQ);
+      else
+        RAS_MACRO_EQA (etype);
       if (insn == PKL_INSN_NE)
         {
           pkl_asm_insn (pasm, PKL_INSN_NOT);
@@ -920,19 +935,6 @@ pkl_asm_insn_sseti (pkl_asm pasm, pkl_ast_node struct_type)
   RAS_MACRO_SSETI (struct_type);
 }
 
-/* Macro-instruction: ACONC array_elem_type
-   ( ARR ARR -- ARR ARR ARR )
-
-   Given two arrays of the same type (but with potentially different
-   bounds) generate code to push a new array value with the
-   concatenation of the elements of both arrays.  */
-
-static void
-pkl_asm_insn_aconc (pkl_asm pasm)
-{
-  RAS_MACRO_ACONC;
-}
-
 /* Macro-instruction: AFILL
    ( ARR VAL -- ARR VAL )
 
@@ -1135,6 +1137,11 @@ pkl_asm_new (pkl_ast ast, pkl_compiler compiler,
   pasm->error_label = pvm_program_fresh_label (program);
   pasm->program = program;
 
+  /* The items of the programs recorded in the bytecode cache are
+     needed after the programs are made executable.  */
+  if (pkl_keep_programs_p (compiler))
+    pvm_program_keep_items (program);
+
   if (prologue)
     {
       /* Standard prologue.  */
@@ -1208,6 +1215,11 @@ pkl_asm_finish (pkl_asm pasm, int epilogue)
   /* Free the first level.  */
   pkl_asm_poplevel (pasm);
 
+  if (pkl_peephole_p (pasm->compiler))
+    pvm_program_optimize (program);
+
+  pkl_compile_stats_add_routine (pasm->compiler, pasm->num_insns);
+
   /* Free the assembler instance and return the assembled program to
      the user.  */
   return program;
@@ -1245,6 +1257,7 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
       va_end (valist);
 
       pvm_program_append_push_instruction (pasm->program, val);
+      pasm->num_insns++;
     }
   else if (insn < PKL_INSN_MACRO)
     {
@@ -1255,6 +1268,7 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
       const char *p;
 
       pvm_program_append_instruction (pasm->program, insn_name);
+      pasm->num_insns++;
 
       va_start (valist, insn);
       for (p = insn_args[insn]; *p != '\0'; ++p)
@@ -1550,9 +1564,6 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
         case PKL_INSN_WRITE:
           pkl_asm_insn_write (pasm);
           break;
-        case PKL_INSN_ACONC:
-          pkl_asm_insn_aconc (pasm);
-          break;
         case PKL_INSN_AFILL:
           pkl_asm_insn_afill (pasm);
           break;
@@ -1937,7 +1948,7 @@ pkl_asm_for_endloop (pkl_asm pasm)
 
 void
 pkl_asm_for_in (pkl_asm pasm, int container_type,
-                pkl_ast_node selector)
+                pkl_ast_node selector, int bounds_check_p)
 {
   pkl_asm_pushlevel (pasm, PKL_ASM_ENV_FOR_IN_LOOP);
 
@@ -1952,6 +1963,7 @@ pkl_asm_for_in (pkl_asm pasm, int container_type,
   assert (container_type == PKL_TYPE_ARRAY
           || container_type == PKL_TYPE_STRING);
   pasm->level->int1 = container_type;
+  pasm->level->int2 = bounds_check_p;
 }
 
 void
@@ -1978,9 +1990,11 @@ pkl_asm_for_in_where (pkl_asm pasm)
   pkl_asm_insn (pasm, PKL_INSN_ROT);
   pkl_asm_insn (pasm, PKL_INSN_ROT);
   if (pasm->level->int1 == PKL_TYPE_ARRAY)
-    pkl_asm_insn (pasm, PKL_INSN_AREF);
+    pkl_asm_insn (pasm,
+                  pasm->level->int2 ? PKL_INSN_AREF : PKL_INSN_AREFNB);
   else
-    pkl_asm_insn (pasm, PKL_INSN_STRREF);
+    pkl_asm_insn (pasm,
+                  pasm->level->int2 ? PKL_INSN_STRREF : PKL_INSN_STRREFNB);
   pkl_asm_insn (pasm, PKL_INSN_POPVAR, 0, 0);
   pkl_asm_insn (pasm, PKL_INSN_ROT);
 
@@ -180,7 +180,7 @@ void pkl_asm_for_endloop (pkl_asm pasm);
 
 /* For-in-where loops.
  *
- * pkl_asm_for_in (pasm, container_type, selector)
+ * pkl_asm_for_in (pasm, container_type, selector, bounds_check_p)
  *
  * ... container ...
  *
@@ -196,10 +196,14 @@ void pkl_asm_for_endloop (pkl_asm pasm);
  *
  * Note that the SELECTOR expression can be of any integral type. The
  * macro-assembler will generate the right code for the specific type.
+ *
+ * If BOUNDS_CHECK_P is 0, the elements of the container are accessed
+ * without checking the index against its bounds.  This is only
+ * correct if the container can't shrink while the loop runs.
  */
 
 void pkl_asm_for_in (pkl_asm pasm, int container_type,
-                     pkl_ast_node selector);
+                     pkl_ast_node selector, int bounds_check_p);
 
 void pkl_asm_for_in_where (pkl_asm pasm);
 
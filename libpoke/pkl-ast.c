@@ -29,8 +29,101 @@
 #include "pvm.h"
 #include "pvm-alloc.h" /* For pvm_alloc_{add/remove}_gc_roots */
 #include "pk-utils.h"
+#include "pk-thread.h"
 #include "pkl-ast.h"
 
+/* AST nodes are not allocated individually.  Instead, they are
+   carved out of blocks of PKL_AST_NODE_BLOCK_SIZE nodes, and freed
+   nodes are kept in a free list to be reused by subsequent
+   allocations.  Compiling a big program thus performs a few big
+   allocations instead of tens of thousands of small ones.
+
+   Nodes outlive the AST in which they are created if they are
+   referenced from the compile-time environment, so the blocks are
+   shared by all the ASTs, and they are released all at once when the
+   last node is freed.  */
+
+#define PKL_AST_NODE_BLOCK_SIZE 512
+
+struct pkl_ast_node_block
+{
+  struct pkl_ast_node_block *next;
+  union pkl_ast_node nodes[PKL_AST_NODE_BLOCK_SIZE];
+};
+
+/* BLOCKS is the list of allocated blocks, the first one being the
+   newest.  BLOCK_USED is the number of nodes of the newest block that
+   have been handed out so far.  FREE_LIST is the list of freed nodes,
+   linked by their chain field.  LIVE_NODES is the number of nodes
+   currently in use.
+
+   The pool is shared by all the compilers of the process, and it is
+   protected by PKL_AST_NODE_LOCK.  */
+
+PK_LOCK_DEFINE (pkl_ast_node_lock);
+
+static struct pkl_ast_node_block *pkl_ast_node_blocks;
+static size_t pkl_ast_node_block_used;
+static pkl_ast_node pkl_ast_node_free_list;
+static size_t pkl_ast_live_nodes;
+
+static pkl_ast_node
+pkl_ast_alloc_node (void)
+{
+  pkl_ast_node node;
+
+  PK_LOCK (pkl_ast_node_lock);
+  if (pkl_ast_node_free_list != NULL)
+    {
+      node = pkl_ast_node_free_list;
+      pkl_ast_node_free_list = PKL_AST_CHAIN (node);
+    }
+  else
+    {
+      if (pkl_ast_node_blocks == NULL
+          || pkl_ast_node_block_used == PKL_AST_NODE_BLOCK_SIZE)
+        {
+          struct pkl_ast_node_block *block
+            = xmalloc (sizeof (struct pkl_ast_node_block));
+
+          block->next = pkl_ast_node_blocks;
+          pkl_ast_node_blocks = block;
+          pkl_ast_node_block_used = 0;
+        }
+
+      node = &pkl_ast_node_blocks->nodes[pkl_ast_node_block_used++];
+    }
+  pkl_ast_live_nodes++;
+  PK_UNLOCK (pkl_ast_node_lock);
+
+  memset (node, 0, sizeof (union pkl_ast_node));
+  return node;
+}
+
+static void
+pkl_ast_dealloc_node (pkl_ast_node node)
+{
+  PK_LOCK (pkl_ast_node_lock);
+  PKL_AST_CHAIN (node) = pkl_ast_node_free_list;
+  pkl_ast_node_free_list = node;
+
+  if (--pkl_ast_live_nodes == 0)
+    {
+      struct pkl_ast_node_block *block, *next;
+
+      for (block = pkl_ast_node_blocks; block; block = next)
+        {
+          next = block->next;
+          free (block);
+        }
+
+      pkl_ast_node_blocks = NULL;
+      pkl_ast_node_block_used = 0;
+      pkl_ast_node_free_list = NULL;
+    }
+  PK_UNLOCK (pkl_ast_node_lock);
+}
+
 /* Allocate and return a new AST node, with the given CODE.  The rest
    of the node is initialized to zero.  */
 
@@ -40,7 +133,7 @@ pkl_ast_make_node (pkl_ast ast,
 {
   pkl_ast_node node;
 
-  node = xzalloc (sizeof (union pkl_ast_node));
+  node = pkl_ast_alloc_node ();
   PKL_AST_AST (node) = ast;
   PKL_AST_CODE (node) = code;
   PKL_AST_UID (node) = ast->uid++;
@@ -533,6 +626,24 @@ pkl_ast_make_any_type (pkl_ast ast)
   return type;
 }
 
+pkl_ast_node
+pkl_ast_make_dict_type (pkl_ast ast,
+                        pkl_ast_node ktype,
+                        pkl_ast_node vtype)
+{
+  pkl_ast_node type = pkl_ast_make_type (ast);
+
+  assert (ktype && vtype);
+
+  PKL_AST_TYPE_CODE (type) = PKL_TYPE_DICT;
+  PKL_AST_TYPE_COMPLETE (type)
+    = PKL_AST_TYPE_COMPLETE_NO;
+  PKL_AST_TYPE_D_KTYPE (type) = ASTREF (ktype);
+  PKL_AST_TYPE_D_VTYPE (type) = ASTREF (vtype);
+
+  return type;
+}
+
 pkl_ast_node
 pkl_ast_make_func_type_arg (pkl_ast ast, pkl_ast_node type,
                             pkl_ast_node name)
@@ -658,6 +769,17 @@ pkl_ast_dup_type (pkl_ast_node type)
       PKL_AST_TYPE_F_VARARG (new)
         = PKL_AST_TYPE_F_VARARG (type);
       break;
+    case PKL_TYPE_DICT:
+      {
+        pkl_ast_node ktype
+          = pkl_ast_dup_type (PKL_AST_TYPE_D_KTYPE (type));
+        pkl_ast_node vtype
+          = pkl_ast_dup_type (PKL_AST_TYPE_D_VTYPE (type));
+
+        PKL_AST_TYPE_D_KTYPE (new) = ASTREF (ktype);
+        PKL_AST_TYPE_D_VTYPE (new) = ASTREF (vtype);
+        break;
+      }
     case PKL_TYPE_OFFSET:
       /* Fallthrough.  */
     case PKL_TYPE_STRING:
@@ -676,13 +798,13 @@ pkl_ast_dup_type (pkl_ast_node type)
 pkl_ast_node
 pkl_struct_type_traverse (pkl_ast_node type, const char *path)
 {
-  char *trunk, *sub, *base;
+  char *trunk, *sub, *base, *saveptr;
 
   if (PKL_AST_TYPE_CODE (type) != PKL_TYPE_STRUCT)
     return NULL;
 
   trunk = strndup (path, strlen (path) - strlen (strrchr (path, '.')));
-  base = strtok (trunk, ".");
+  base = strtok_r (trunk, ".", &saveptr);
 
   /* Node in the form XX. Check to silence the compiler about base not used */
   if (base == NULL)
@@ -691,7 +813,7 @@ pkl_struct_type_traverse (pkl_ast_node type, const char *path)
       return type;
     }
 
-  while ((sub = strtok (NULL, ".")) != NULL)
+  while ((sub = strtok_r (NULL, ".", &saveptr)) != NULL)
     {
       pkl_ast_node ename;
       pkl_ast_node etype, t;
@@ -864,6 +986,12 @@ pkl_ast_type_equal_p (pkl_ast_node a, pkl_ast_node b)
                                            PKL_AST_TYPE_O_BASE_TYPE (b)));
       }
       break;
+    case PKL_TYPE_DICT:
+      return (pkl_ast_type_equal_p (PKL_AST_TYPE_D_KTYPE (a),
+                                    PKL_AST_TYPE_D_KTYPE (b))
+              && pkl_ast_type_equal_p (PKL_AST_TYPE_D_VTYPE (a),
+                                       PKL_AST_TYPE_D_VTYPE (b)));
+      break;
     case PKL_TYPE_STRING:
       /* Fallthrough.  */
     default:
@@ -1075,6 +1203,62 @@ pkl_ast_type_mappable_p (pkl_ast_node type)
   return 0;
 }
 
+/* Return 1 if printing a value of the given TYPE may involve calling
+   a pretty-printer, i.e. a _print method of some struct type.  This
+   is also the case if the type of some part of the value can't be
+   determined at compile-time.  Return 0 otherwise.  */
+
+int
+pkl_ast_type_pretty_printed_p (pkl_ast_node type)
+{
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+    case PKL_TYPE_STRING:
+    case PKL_TYPE_OFFSET:
+    case PKL_TYPE_FUNCTION:
+      return 0;
+    case PKL_TYPE_DICT:
+      /* Dicts are always printed natively.  Their values are printed
+         without using pretty-printers.  */
+      return 0;
+    case PKL_TYPE_ARRAY:
+      return pkl_ast_type_pretty_printed_p (PKL_AST_TYPE_A_ETYPE (type));
+    case PKL_TYPE_STRUCT:
+      {
+        pkl_ast_node elem;
+
+        for (elem = PKL_AST_TYPE_S_ELEMS (type);
+             elem;
+             elem = PKL_AST_CHAIN (elem))
+          {
+            if (PKL_AST_CODE (elem) == PKL_AST_STRUCT_TYPE_FIELD)
+              {
+                pkl_ast_node elem_type
+                  = PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem);
+
+                if (pkl_ast_type_pretty_printed_p (elem_type))
+                  return 1;
+              }
+            else if (PKL_AST_CODE (elem) == PKL_AST_DECL
+                     && PKL_AST_DECL_KIND (elem) == PKL_AST_DECL_KIND_FUNC)
+              {
+                pkl_ast_node decl_name = PKL_AST_DECL_NAME (elem);
+
+                if (STREQ (PKL_AST_IDENTIFIER_POINTER (decl_name), "_print"))
+                  return 1;
+              }
+          }
+
+        return 0;
+      }
+    default:
+      break;
+    }
+
+  return 1;
+}
+
 /* Return PKL_AST_TYPE_COMPLETE_YES if the given TYPE is a complete
    type.  Return PKL_AST_TYPE_COMPLETE_NO otherwise.  This function
    assumes that the children of TYPE have correct completeness
@@ -1098,6 +1282,7 @@ pkl_ast_type_is_complete (pkl_ast_node type)
     case PKL_TYPE_ANY:
     case PKL_TYPE_VOID:
     case PKL_TYPE_STRING:
+    case PKL_TYPE_DICT:
       complete = PKL_AST_TYPE_COMPLETE_NO;
       break;
       /* Struct types are complete if their fields are also of
@@ -1295,6 +1480,15 @@ pkl_type_append_to (pkl_ast_node type, int use_given_name,
         sb_append (buffer, ">");
         break;
       }
+    case PKL_TYPE_DICT:
+      sb_append (buffer, "dict<");
+      pkl_type_append_to (PKL_AST_TYPE_D_KTYPE (type), use_given_name,
+                          buffer);
+      sb_append (buffer, ",");
+      pkl_type_append_to (PKL_AST_TYPE_D_VTYPE (type), use_given_name,
+                          buffer);
+      sb_append (buffer, ">");
+      break;
     case PKL_TYPE_NOTYPE:
     default:
       assert (0);
@@ -1592,6 +1786,28 @@ pkl_ast_make_var (pkl_ast ast, pkl_ast_node name,
   return var;
 }
 
+/* Mark the variables referred in the lvalue LVALUE as assigned.  */
+
+static void
+pkl_ast_mark_assigned (pkl_ast_node lvalue)
+{
+  switch (PKL_AST_CODE (lvalue))
+    {
+    case PKL_AST_VAR:
+      PKL_AST_DECL_ASSIGNED_P (PKL_AST_VAR_DECL (lvalue)) = 1;
+      break;
+    case PKL_AST_EXP:
+      if (PKL_AST_EXP_CODE (lvalue) == PKL_AST_OP_BCONC)
+        {
+          pkl_ast_mark_assigned (PKL_AST_EXP_OPERAND (lvalue, 0));
+          pkl_ast_mark_assigned (PKL_AST_EXP_OPERAND (lvalue, 1));
+        }
+      break;
+    default:
+      break;
+    }
+}
+
 /* Build and return an AST node for an incrdecr expression.  */
 
 pkl_ast_node
@@ -1606,6 +1822,7 @@ pkl_ast_make_incrdecr (pkl_ast ast,
   assert (exp);
 
   PKL_AST_INCRDECR_EXP (incrdecr) = ASTREF (exp);
+  pkl_ast_mark_assigned (exp);
   PKL_AST_INCRDECR_ORDER (incrdecr) = order;
   PKL_AST_INCRDECR_SIGN (incrdecr) = sign;
 
@@ -1664,6 +1881,7 @@ pkl_ast_make_ass_stmt (pkl_ast ast, pkl_ast_node lvalue,
 
   PKL_AST_ASS_STMT_LVALUE (ass_stmt) = ASTREF (lvalue);
   PKL_AST_ASS_STMT_EXP (ass_stmt) = ASTREF (exp);
+  pkl_ast_mark_assigned (lvalue);
 
   return ass_stmt;
 }
@@ -2025,6 +2243,10 @@ pkl_ast_node_free (pkl_ast_node ast)
           pkl_ast_node_free (PKL_AST_TYPE_O_UNIT (ast));
           pkl_ast_node_free (PKL_AST_TYPE_O_BASE_TYPE (ast));
           break;
+        case PKL_TYPE_DICT:
+          pkl_ast_node_free (PKL_AST_TYPE_D_KTYPE (ast));
+          pkl_ast_node_free (PKL_AST_TYPE_D_VTYPE (ast));
+          break;
         case PKL_TYPE_INTEGRAL:
         case PKL_TYPE_STRING:
         default:
@@ -2310,7 +2532,7 @@ pkl_ast_node_free (pkl_ast_node ast)
     }
 
   pkl_ast_node_free (PKL_AST_TYPE (ast));
-  free (ast);
+  pkl_ast_dealloc_node (ast);
 }
 
 /* Allocate and initialize a new AST and return it.  */
@@ -2580,12 +2802,13 @@ pkl_ast_lvalue_p (pkl_ast_node node)
       break;
     case PKL_AST_INDEXER:
       /* An indexer can be used as a l-value if the referred entity is
-         an array, and it is itself a l-value.  */
+         an array or a dict, and it is itself a l-value.  */
       {
         pkl_ast_node entity = PKL_AST_INDEXER_ENTITY (node);
         pkl_ast_node entity_type = PKL_AST_TYPE (entity);
 
-        if (PKL_AST_TYPE_CODE (entity_type) == PKL_TYPE_ARRAY)
+        if (PKL_AST_TYPE_CODE (entity_type) == PKL_TYPE_ARRAY
+            || PKL_AST_TYPE_CODE (entity_type) == PKL_TYPE_DICT)
           return pkl_ast_lvalue_p (entity);
 
         break;
@@ -2836,6 +3059,7 @@ pkl_ast_print_1 (FILE *fp, pkl_ast_node ast, int indent)
             case PKL_TYPE_STRUCT: IPRINTF ("  struct\n"); break;
             case PKL_TYPE_FUNCTION: IPRINTF ("  function\n"); break;
             case PKL_TYPE_OFFSET: IPRINTF ("  offset\n"); break;
+            case PKL_TYPE_DICT: IPRINTF ("  dict\n"); break;
             default:
               IPRINTF (" unknown (%d)\n", PKL_AST_TYPE_CODE (ast));
               break;
@@ -2870,6 +3094,10 @@ pkl_ast_print_1 (FILE *fp, pkl_ast_node ast, int indent)
               PRINT_AST_SUBAST (base_type, TYPE_O_BASE_TYPE);
               PRINT_AST_SUBAST (unit, TYPE_O_UNIT);
               break;
+            case PKL_TYPE_DICT:
+              PRINT_AST_SUBAST (ktype, TYPE_D_KTYPE);
+              PRINT_AST_SUBAST (vtype, TYPE_D_VTYPE);
+              break;
             case PKL_TYPE_STRING:
             case PKL_TYPE_ANY:
             default:
@@ -2923,6 +3151,7 @@ pkl_ast_print_1 (FILE *fp, pkl_ast_node ast, int indent)
       PRINT_COMMON_FIELDS;
       PRINT_AST_IMM (nargs, FUNC_NARGS, "%d");
       PRINT_AST_IMM (method_p, FUNC_METHOD_P, "%d");
+      PRINT_AST_IMM (memo_p, FUNC_MEMO_P, "%d");
       PRINT_AST_SUBAST (ret_type, FUNC_RET_TYPE);
       PRINT_AST_SUBAST_CHAIN (FUNC_ARGS);
       PRINT_AST_SUBAST (first_opt_arg, FUNC_FIRST_OPT_ARG);
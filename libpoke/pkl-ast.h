@@ -161,6 +161,7 @@ enum pkl_ast_type_code
   PKL_TYPE_FUNCTION,
   PKL_TYPE_OFFSET,
   PKL_TYPE_ANY,
+  PKL_TYPE_DICT,
   PKL_TYPE_NOTYPE,
 };
 
@@ -593,7 +594,10 @@ pkl_ast_node pkl_ast_make_enum (pkl_ast ast,
    function.
 
    If the function is a method defined in a struct type, then METHOD_P
-   is not 0.  */
+   is not 0.
+
+   If the function is a memoized method, then MEMO_P is not 0.  The
+   results of memoized methods are cached in the struct values.  */
 
 #define PKL_AST_FUNC_RET_TYPE(AST) ((AST)->func.ret_type)
 #define PKL_AST_FUNC_ARGS(AST) ((AST)->func.args)
@@ -603,6 +607,7 @@ pkl_ast_node pkl_ast_make_enum (pkl_ast ast,
 #define PKL_AST_FUNC_NAME(AST) ((AST)->func.name)
 #define PKL_AST_FUNC_NARGS(AST) ((AST)->func.nargs)
 #define PKL_AST_FUNC_METHOD_P(AST) ((AST)->func.method_p)
+#define PKL_AST_FUNC_MEMO_P(AST) ((AST)->func.memo_p)
 #define PKL_AST_FUNC_PROGRAM(AST) ((AST)->func.program)
 
 struct pkl_ast_func
@@ -618,6 +623,7 @@ struct pkl_ast_func
   int nframes;
   char *name;
   int method_p;
+  int memo_p;
   pvm_program program;
 };
 
@@ -708,16 +714,22 @@ pkl_ast_node pkl_ast_make_trimmer (pkl_ast ast,
    BASE must point to a PKL_AST_ARRAY node.
 
    INDEX must point to an expression whose evaluation is the offset of
-   the element into the field, in units of the field's SIZE.  */
+   the element into the field, in units of the field's SIZE.
+
+   NO_BOUNDS_CHECK_P is a boolean indicating whether INDEX is known
+   to be within the bounds of the entity, so it doesn't need to be
+   checked at run-time.  See trans4.  */
 
 #define PKL_AST_INDEXER_ENTITY(AST) ((AST)->indexer.entity)
 #define PKL_AST_INDEXER_INDEX(AST) ((AST)->indexer.index)
+#define PKL_AST_INDEXER_NO_BOUNDS_CHECK_P(AST) ((AST)->indexer.no_bounds_check_p)
 
 struct pkl_ast_indexer
 {
   struct pkl_ast_common common;
   union pkl_ast_node *entity;
   union pkl_ast_node *index;
+  int no_bounds_check_p;
 };
 
 pkl_ast_node pkl_ast_make_indexer (pkl_ast ast,
@@ -879,6 +891,9 @@ pkl_ast_node pkl_ast_make_func_type_arg (pkl_ast ast,
    has an associated initial, this is NULL.  VARARG is 1 if the
    function takes a variable number of arguments.  0 otherwise.
 
+   In dict types, KTYPE is the type of the keys, which is either
+   integral or a string, and VTYPE is the type of the values.
+
    When the size of a value of a given type can be determined at
    compile time, we say that such type is "complete".  Otherwise, we
    say that the type is "incomplete" and should be completed at
@@ -917,6 +932,8 @@ pkl_ast_node pkl_ast_make_func_type_arg (pkl_ast ast,
 #define PKL_AST_TYPE_F_ARGS(AST) ((AST)->type.val.fun.args)
 #define PKL_AST_TYPE_F_VARARG(AST) ((AST)->type.val.fun.vararg)
 #define PKL_AST_TYPE_F_FIRST_OPT_ARG(AST) ((AST)->type.val.fun.first_opt_arg)
+#define PKL_AST_TYPE_D_KTYPE(AST) ((AST)->type.val.dict.ktype)
+#define PKL_AST_TYPE_D_VTYPE(AST) ((AST)->type.val.dict.vtype)
 
 #define PKL_AST_TYPE_COMPLETE_UNKNOWN 0
 #define PKL_AST_TYPE_COMPLETE_YES 1
@@ -982,6 +999,12 @@ struct pkl_ast_type
       union pkl_ast_node *first_opt_arg;
     } fun;
 
+    struct
+    {
+      union pkl_ast_node *ktype;
+      union pkl_ast_node *vtype;
+    } dict;
+
   } val;
 };
 
@@ -1009,12 +1032,17 @@ pkl_ast_node pkl_ast_make_function_type (pkl_ast ast, pkl_ast_node rtype,
 
 pkl_ast_node pkl_ast_make_any_type (pkl_ast);
 
+pkl_ast_node pkl_ast_make_dict_type (pkl_ast ast, pkl_ast_node ktype,
+                                     pkl_ast_node vtype);
+
 pkl_ast_node pkl_ast_dup_type (pkl_ast_node type);
 
 int pkl_ast_type_equal_p (pkl_ast_node t1, pkl_ast_node t2);
 
 int pkl_ast_type_mappable_p (pkl_ast_node type);
 
+int pkl_ast_type_pretty_printed_p (pkl_ast_node type);
+
 int pkl_ast_type_is_exception (pkl_ast_node type);
 
 int pkl_ast_type_promoteable_p (pkl_ast_node ft, pkl_ast_node tt,
@@ -1064,7 +1092,22 @@ pkl_ast_node pkl_ast_type_incr_step (pkl_ast ast, pkl_ast_node type);
    whatever.
 
    STRUCT_FIELD_P indicates whether this declaration is for a variable
-   corresponding to a struct field.  */
+   corresponding to a struct field.
+
+   UNBOXED_OFFSET_P indicates whether the value of this variable,
+   which is of type offset<uint<64>,1>, is stored in the run-time
+   environment unboxed, i.e. as an ulong<64> with the magnitude of
+   the offset.  The offset is boxed whenever the variable is
+   referenced.  This is used for variables updated very frequently
+   by generated code, like OFFSET in struct mappers.
+
+   LOCAL_P indicates whether this declaration is for a variable
+   declared out of the top-level environment, so all the references
+   to the variable are in the same compilation unit.
+
+   ASSIGNED_P indicates whether the variable is the target of some
+   assignment or increment/decrement.  It is set when the assignment
+   is built.  */
 
 #define PKL_AST_DECL_KIND(AST) ((AST)->decl.kind)
 #define PKL_AST_DECL_NAME(AST) ((AST)->decl.name)
@@ -1074,6 +1117,9 @@ pkl_ast_node pkl_ast_type_incr_step (pkl_ast ast, pkl_ast_node type);
 #define PKL_AST_DECL_SOURCE(AST) ((AST)->decl.source)
 #define PKL_AST_DECL_STRUCT_FIELD_P(AST) ((AST)->decl.struct_field_p)
 #define PKL_AST_DECL_IN_STRUCT_P(AST) ((AST)->decl.in_struct_p)
+#define PKL_AST_DECL_UNBOXED_OFFSET_P(AST) ((AST)->decl.unboxed_offset_p)
+#define PKL_AST_DECL_LOCAL_P(AST) ((AST)->decl.local_p)
+#define PKL_AST_DECL_ASSIGNED_P(AST) ((AST)->decl.assigned_p)
 
 #define PKL_AST_DECL_KIND_ANY 0
 #define PKL_AST_DECL_KIND_VAR 1
@@ -1088,6 +1134,9 @@ struct pkl_ast_decl
   int kind;
   int struct_field_p;
   int in_struct_p;
+  int unboxed_offset_p;
+  int local_p;
+  int assigned_p;
   char *source;
   union pkl_ast_node *name;
   union pkl_ast_node *initial;
@@ -1215,7 +1264,9 @@ pkl_ast_node pkl_ast_make_map (pkl_ast ast,
    must always be present.
 
    For array constructors, VALUE is either NULL or the value that will
-   be used as elements of the constructed array.  */
+   be used as elements of the constructed array.
+
+   For dict constructors, VALUE is always NULL.  */
 
 #define PKL_AST_CONS_KIND(AST) ((AST)->cons.kind)
 #define PKL_AST_CONS_TYPE(AST) ((AST)->cons.type)
@@ -1224,6 +1275,7 @@ pkl_ast_node pkl_ast_make_map (pkl_ast ast,
 #define PKL_AST_CONS_KIND_UNKNOWN 0
 #define PKL_AST_CONS_KIND_STRUCT 1
 #define PKL_AST_CONS_KIND_ARRAY 2
+#define PKL_AST_CONS_KIND_DICT 3
 
 struct pkl_ast_cons
 {
@@ -1242,11 +1294,16 @@ pkl_ast_node pkl_ast_make_cons (pkl_ast ast, pkl_ast_node type,
    FUNCTION is a variable with the function being invoked.
    ARGS is a chain of PKL_AST_FUNCALL_ARG nodes.
 
-   NARG is the number of arguments in the funcall.  */
+   NARG is the number of arguments in the funcall.
+
+   INLINE, if not NULL, is the PKL_AST_FUNC of the function being
+   invoked, and it means the call can be replaced by the body of the
+   function.  See trans4.  Note this is not a reference.  */
 
 #define PKL_AST_FUNCALL_ARGS(AST) ((AST)->funcall.args)
 #define PKL_AST_FUNCALL_FUNCTION(AST) ((AST)->funcall.function)
 #define PKL_AST_FUNCALL_NARG(AST) ((AST)->funcall.narg)
+#define PKL_AST_FUNCALL_INLINE(AST) ((AST)->funcall.inline_func)
 
 struct pkl_ast_funcall
 {
@@ -1255,6 +1312,7 @@ struct pkl_ast_funcall
   int narg;
   union pkl_ast_node *function;
   union pkl_ast_node *args;
+  union pkl_ast_node *inline_func;
 };
 
 pkl_ast_node pkl_ast_make_funcall (pkl_ast ast,
@@ -1433,6 +1491,36 @@ pkl_ast_node pkl_ast_make_incrdecr (pkl_ast ast,
 #define PKL_AST_BUILTIN_TERM_END_CLASS 20
 #define PKL_AST_BUILTIN_TERM_BEGIN_HYPERLINK 21
 #define PKL_AST_BUILTIN_TERM_END_HYPERLINK 22
+#define PKL_AST_BUILTIN_IOCOPY 23
+#define PKL_AST_BUILTIN_IODUMP 24
+#define PKL_AST_BUILTIN_IOSEARCH 25
+#define PKL_AST_BUILTIN_IOCRC32 26
+#define PKL_AST_BUILTIN_IOADLER32 27
+#define PKL_AST_BUILTIN_IOXXH64 28
+#define PKL_AST_BUILTIN_IOSHA256 29
+#define PKL_AST_BUILTIN_ASORT 30
+#define PKL_AST_BUILTIN_PMAP 31
+#define PKL_AST_BUILTIN_IOULEB128 32
+#define PKL_AST_BUILTIN_IOSLEB128 33
+#define PKL_AST_BUILTIN_DREMOVE 34
+#define PKL_AST_BUILTIN_IODIRTY 35
+#define PKL_AST_BUILTIN_IOCOMMIT 36
+#define PKL_AST_BUILTIN_IODISCARD 37
+#define PKL_AST_BUILTIN_IOPREFETCH 38
+#define PKL_AST_BUILTIN_CATOS 39
+#define PKL_AST_BUILTIN_STOCA 40
+#define PKL_AST_BUILTIN_ATOI 41
+#define PKL_AST_BUILTIN_LTOS 42
+#define PKL_AST_BUILTIN_STRCHR 43
+#define PKL_AST_BUILTIN_LTRIM 44
+#define PKL_AST_BUILTIN_RTRIM 45
+#define PKL_AST_BUILTIN_REVERSE 46
+#define PKL_AST_BUILTIN_IOGETU128 47
+#define PKL_AST_BUILTIN_IOSETU128 48
+#define PKL_AST_BUILTIN_U128OP 49
+#define PKL_AST_BUILTIN_U128TOS 50
+#define PKL_AST_BUILTIN_IOSCRABBLE 51
+#define PKL_AST_BUILTIN_BYTESWAP 52
 
 struct pkl_ast_comp_stmt
 {
@@ -1527,7 +1615,12 @@ int pkl_ast_lvalue_p (pkl_ast_node node);
    TAIL is a list of statements, to be executed at the end of the loop
    body.  This is only used in FOR loops.
 
-   BODY is a statement, which is the body of the loop.  */
+   BODY is a statement, which is the body of the loop.
+
+   NO_BOUNDS_CHECK_P is a boolean indicating whether the elements of
+   the container of a FOR-IN loop can be accessed without checking
+   the bounds of the container, because it can't shrink while the
+   loop runs.  See trans4.  */
 
 #define PKL_AST_LOOP_STMT_ITERATOR(AST) ((AST)->loop_stmt.iterator)
 #define PKL_AST_LOOP_STMT_CONDITION(AST) ((AST)->loop_stmt.condition)
@@ -1535,6 +1628,7 @@ int pkl_ast_lvalue_p (pkl_ast_node node);
 #define PKL_AST_LOOP_STMT_TAIL(AST) ((AST)->loop_stmt.tail)
 #define PKL_AST_LOOP_STMT_HEAD(AST) ((AST)->loop_stmt.head)
 #define PKL_AST_LOOP_STMT_KIND(AST) ((AST)->loop_stmt.kind)
+#define PKL_AST_LOOP_STMT_NO_BOUNDS_CHECK_P(AST) ((AST)->loop_stmt.no_bounds_check_p)
 
 #define PKL_AST_LOOP_STMT_KIND_WHILE  0
 #define PKL_AST_LOOP_STMT_KIND_FOR    1
@@ -1545,6 +1639,7 @@ struct pkl_ast_loop_stmt
   struct pkl_ast_common COMMON;
 
   int kind;
+  int no_bounds_check_p;
   union pkl_ast_node *iterator;
   union pkl_ast_node *condition;
   union pkl_ast_node *body;
@@ -1595,12 +1690,17 @@ pkl_ast_node pkl_ast_make_loop_stmt_iterator (pkl_ast ast,
    from the function.
 
    FUNCTION is the PKL_AST_FUNCTION containing this return
-   statement. */
+   statement.
+
+   FUNCTION_BACK is the lexical nest level of the statement with
+   respect the beginning of FUNCTION.  This is used by the code
+   generator to access the arguments of the function.  */
 
 #define PKL_AST_RETURN_STMT_EXP(AST) ((AST)->return_stmt.exp)
 #define PKL_AST_RETURN_STMT_NFRAMES(AST) ((AST)->return_stmt.nframes)
 #define PKL_AST_RETURN_STMT_NDROPS(AST) ((AST)->return_stmt.ndrops)
 #define PKL_AST_RETURN_STMT_FUNCTION(AST) ((AST)->return_stmt.function)
+#define PKL_AST_RETURN_STMT_FUNCTION_BACK(AST) ((AST)->return_stmt.function_back)
 
 struct pkl_ast_return_stmt
 {
@@ -1610,6 +1710,7 @@ struct pkl_ast_return_stmt
   union pkl_ast_node *function;
   int nframes;
   int ndrops;
+  int function_back;
 };
 
 pkl_ast_node pkl_ast_make_return_stmt (pkl_ast ast, pkl_ast_node exp);
@@ -1925,6 +2026,9 @@ ASTDEREF (pkl_ast_node ast)
    AST contains the tree of linked nodes, starting with a
    PKL_AST_PROGRAM node.
 
+   PASS_DISPATCH is used by the pass manager while the AST is being
+   traversed.  See pkl-pass.c.
+
    `pkl_ast_init' allocates and initializes a new AST and returns a
    pointer to it.
 
@@ -1935,8 +2039,7 @@ ASTDEREF (pkl_ast_node ast)
    node in the AST and its descendants.  This function is used by the
    bison parser.  */
 
-#define HASH_TABLE_SIZE 1008
-typedef pkl_ast_node pkl_hash[HASH_TABLE_SIZE];
+struct pkl_pass_dispatch; /* Forward declaration.  */
 
 struct pkl_ast
 {
@@ -1946,6 +2049,8 @@ struct pkl_ast
   char *buffer;
   FILE *file;
   char *filename;
+
+  struct pkl_pass_dispatch *pass_dispatch;
 };
 
 pkl_ast pkl_ast_init (void);
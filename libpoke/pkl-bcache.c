@@ -0,0 +1,1611 @@
+/* pkl-bcache.c - Cache of the compiled run-time of the compiler.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha256.h"
+#include "xalloc.h"
+
+#include "pk-utils.h"
+
+#include "pkl.h"
+#include "pkl-ast.h"
+#include "pkl-asm.h"
+#include "pkl-pass.h"
+#include "pkl-bcache.h"
+#include "pvm.h"
+#include "pvm-alloc.h"
+#include "pvm-val.h"
+#include "pkl-bcache-id.h"
+
+/* The code generated for a module consists of its PVM program, plus
+   the closures that the code generator installs in the AST nodes of
+   the types and functions declared in the module: the mappers,
+   writers, etc of the types, and the programs implementing the
+   functions.  These are used when compiling later code that refers
+   to the declarations of the module.
+
+   When a module is restored from the cache, its AST is traversed in
+   order to find these nodes, and the closures are installed back in
+   them.  The nodes are identified by their unique identifiers and
+   the order in which they are found, which don't change as long as
+   the source of the module and the compiler don't change.
+
+   Cache files are named after the SHA-256 hash of the version of the
+   compiler, the checksum of its sources PKL_BCACHE_BUILD_ID, its
+   instruction set, some properties of the host, and the names and
+   contents of the cached modules, followed by the extension .pkbc.
+   They contain the magic line PKL_BCACHE_MAGIC followed by a
+   sequence of records.  Every record starts with a byte telling its kind:
+
+   'v' is a PVM value.  It is followed by a byte with one of the
+       PKL_BCACHE_VAL_* codes below, and the components of the value.
+
+   'p' is a PVM program.  It is followed by the name and location of
+       the program, the number of labels in the program and its
+       items.  See `pkl_bcache_write_item'.
+
+   'm' is a module.  It is followed by the number of its program, the
+       number of AST nodes found in the module and, for every node,
+       its unique identifier, a byte with one of the PKL_BCACHE_NODE_*
+       codes below and the closures installed in the node.
+
+   'e' marks the end of the file.
+
+   Values and programs are numbered in the order in which they
+   appear, and records only refer to values and programs appearing
+   before them, by number.  Every value is written only once, so the
+   sharing between values is preserved.  The null value is written as
+   PKL_BCACHE_NULL.  Integers are written in the byte order of the
+   host, and strings are written as their length followed by their
+   contents.  Absent strings are written as PKL_BCACHE_NULL.
+
+   The closures in the cache are written before the programs they are
+   part of are run, so their environment is always null: it is set by
+   the `pec' instructions when the programs run.  */
+
+/* The number in the magic line is the version of the format of the
+   cache files, to be increased whenever the format changes.  */
+
+#define PKL_BCACHE_MAGIC "poke-bytecode-cache 1\n"
+
+#define PKL_BCACHE_NULL 0xffffffffU
+
+#define PKL_BCACHE_VAL_INT       0
+#define PKL_BCACHE_VAL_LONG      1
+#define PKL_BCACHE_VAL_ULONG     2
+#define PKL_BCACHE_VAL_STRING    3
+#define PKL_BCACHE_VAL_OFFSET    4
+#define PKL_BCACHE_VAL_TYPE      5
+#define PKL_BCACHE_VAL_CLOSURE   6
+#define PKL_BCACHE_VAL_EXCEPTION 7
+
+#define PKL_BCACHE_NODE_ARRAY  0
+#define PKL_BCACHE_NODE_STRUCT 1
+#define PKL_BCACHE_NODE_FUNC   2
+
+/* Maximum number of closures installed in an AST node.  */
+#define PKL_BCACHE_MAX_SLOTS 5
+
+/* Names and arguments of the PVM instructions.  Instructions are
+   written as their index in these tables.  */
+
+static const char *pkl_bcache_insn_names[] =
+  {
+#define PKL_DEF_INSN(SYM, ARGS, NAME) NAME,
+#  include "pkl-insn.def"
+#undef PKL_DEF_INSN
+  };
+
+static const char *pkl_bcache_insn_args[] =
+  {
+#define PKL_DEF_INSN(SYM, ARGS, NAME) ARGS,
+#  include "pkl-insn.def"
+#undef PKL_DEF_INSN
+  };
+
+/* Growable buffers, used to build the contents of cache files.  */
+
+struct pkl_bcache_buffer
+{
+  char *data;
+  size_t size;
+  size_t allocated;
+};
+
+static void
+pkl_bcache_put (struct pkl_bcache_buffer *buf, const void *p, size_t n)
+{
+  if (buf->size + n > buf->allocated)
+    {
+      buf->allocated = 2 * (buf->size + n) + 256;
+      buf->data = xrealloc (buf->data, buf->allocated);
+    }
+
+  memcpy (buf->data + buf->size, p, n);
+  buf->size += n;
+}
+
+static void
+pkl_bcache_put_u8 (struct pkl_bcache_buffer *buf, uint8_t n)
+{
+  pkl_bcache_put (buf, &n, sizeof (n));
+}
+
+static void
+pkl_bcache_put_u32 (struct pkl_bcache_buffer *buf, uint32_t n)
+{
+  pkl_bcache_put (buf, &n, sizeof (n));
+}
+
+static void
+pkl_bcache_put_u64 (struct pkl_bcache_buffer *buf, uint64_t n)
+{
+  pkl_bcache_put (buf, &n, sizeof (n));
+}
+
+static void
+pkl_bcache_put_string (struct pkl_bcache_buffer *buf, const char *str)
+{
+  if (str == NULL)
+    pkl_bcache_put_u32 (buf, PKL_BCACHE_NULL);
+  else
+    {
+      size_t len = strlen (str);
+
+      pkl_bcache_put_u32 (buf, len);
+      pkl_bcache_put (buf, str, len);
+    }
+}
+
+/* Readers of the contents of cache files.  The get functions below
+   return 0 if there is not enough data left, 1 otherwise.  */
+
+struct pkl_bcache_reader
+{
+  const char *p;
+  const char *end;
+};
+
+static int
+pkl_bcache_get (struct pkl_bcache_reader *r, void *p, size_t n)
+{
+  if ((size_t) (r->end - r->p) < n)
+    return 0;
+
+  memcpy (p, r->p, n);
+  r->p += n;
+  return 1;
+}
+
+static int
+pkl_bcache_get_u8 (struct pkl_bcache_reader *r, uint8_t *n)
+{
+  return pkl_bcache_get (r, n, sizeof (*n));
+}
+
+static int
+pkl_bcache_get_u32 (struct pkl_bcache_reader *r, uint32_t *n)
+{
+  return pkl_bcache_get (r, n, sizeof (*n));
+}
+
+static int
+pkl_bcache_get_u64 (struct pkl_bcache_reader *r, uint64_t *n)
+{
+  return pkl_bcache_get (r, n, sizeof (*n));
+}
+
+/* Read a string into *STR, which should be freed by the caller.  */
+
+static int
+pkl_bcache_get_string (struct pkl_bcache_reader *r, char **str)
+{
+  uint32_t len;
+
+  if (!pkl_bcache_get_u32 (r, &len))
+    return 0;
+
+  if (len == PKL_BCACHE_NULL)
+    {
+      *str = NULL;
+      return 1;
+    }
+
+  if ((size_t) (r->end - r->p) < len)
+    return 0;
+
+  *str = xmalloc (len + 1);
+  memcpy (*str, r->p, len);
+  (*str)[len] = '\0';
+  r->p += len;
+  return 1;
+}
+
+/* Maps from 64-bit keys to indexes, used to number the values,
+   programs and instruction names written in the cache file.  These
+   are open-addressing hash tables whose size is always a power of
+   two.  A zero index denotes an empty slot, so the indexes are
+   stored plus one.
+
+   The keys are allocated in the GC heap, so the values and programs
+   in the maps are not collected and their addresses are not reused
+   while the cache is being written.  */
+
+struct pkl_bcache_map
+{
+  uint64_t *keys;
+  uint32_t *indexes;
+  size_t size;
+  size_t count;
+};
+
+static size_t
+pkl_bcache_map_slot (struct pkl_bcache_map *map, uint64_t key)
+{
+  size_t slot = (key * 0x9e3779b97f4a7c15ULL >> 32) & (map->size - 1);
+
+  while (map->indexes[slot] != 0 && map->keys[slot] != key)
+    slot = (slot + 1) & (map->size - 1);
+  return slot;
+}
+
+static int
+pkl_bcache_map_lookup (struct pkl_bcache_map *map, uint64_t key,
+                       uint32_t *index)
+{
+  size_t slot;
+
+  if (map->size == 0)
+    return 0;
+
+  slot = pkl_bcache_map_slot (map, key);
+  if (map->indexes[slot] == 0)
+    return 0;
+
+  *index = map->indexes[slot] - 1;
+  return 1;
+}
+
+static void
+pkl_bcache_map_insert (struct pkl_bcache_map *map, uint64_t key,
+                       uint32_t index)
+{
+  size_t slot;
+
+  if (2 * (map->count + 1) > map->size)
+    {
+      uint64_t *keys = map->keys;
+      uint32_t *indexes = map->indexes;
+      size_t i, size = map->size;
+
+      map->size = size == 0 ? 1024 : 2 * size;
+      map->keys = pvm_alloc (map->size * sizeof (uint64_t));
+      map->indexes = xcalloc (map->size, sizeof (uint32_t));
+
+      for (i = 0; i < size; ++i)
+        if (indexes[i] != 0)
+          {
+            slot = pkl_bcache_map_slot (map, keys[i]);
+            map->keys[slot] = keys[i];
+            map->indexes[slot] = indexes[i];
+          }
+
+      free (indexes);
+    }
+
+  slot = pkl_bcache_map_slot (map, key);
+  map->keys[slot] = key;
+  map->indexes[slot] = index + 1;
+  map->count++;
+}
+
+static void
+pkl_bcache_map_free (struct pkl_bcache_map *map)
+{
+  free (map->indexes);
+  memset (map, 0, sizeof (struct pkl_bcache_map));
+}
+
+/* Traversal of the AST of a module, collecting the nodes in which
+   code generation installs closures.  Every node is visited only
+   once, even if it is shared.  */
+
+struct pkl_bcache_walk
+{
+  struct pkl_bcache_map seen;
+  pkl_ast_node *nodes;
+  size_t num_nodes;
+  size_t allocated;
+};
+
+/* A module read from a cache file.  PROGRAM is the number of its
+   program, and it owns the programs numbered from FIRST_PROGRAM to
+   LAST_PROGRAM - 1.  NODES are the AST nodes in which closures are
+   installed.  */
+
+struct pkl_bcache_node
+{
+  uint64_t uid;
+  uint8_t kind;
+  uint32_t slots[PKL_BCACHE_MAX_SLOTS];
+};
+
+struct pkl_bcache_module
+{
+  uint32_t program;
+  uint32_t first_program;
+  uint32_t last_program;
+  uint32_t num_nodes;
+  struct pkl_bcache_node *nodes;
+};
+
+/* The bytecode cache.
+
+   FILENAME is the name of the cache file, in the directory DIR.
+   NUM_MODULES is the number
+   of modules in the cache, and NEXT_MODULE is the index of the module
+   that will be passed to the next call to `pkl_bcache_restore'.
+
+   If RECORDING_P is set then the modules are being recorded in OUT.
+   NUM_RECORDED is the number of modules recorded so far.  VALS,
+   PROGRAMS and INSNS number the values, programs and instructions
+   written in OUT.  WALK contains the AST nodes of the module being
+   compiled, as found by `pkl_bcache_restore'.
+
+   Otherwise the modules have been read from the cache file into
+   MODULES.  The values and programs read from the file are in
+   VALUES and PROGS, and PROG_INSNS contains the number of
+   instructions of each program.  */
+
+struct pkl_bcache
+{
+  pkl_compiler compiler;
+  char *dir;
+  char *filename;
+  int num_modules;
+  int next_module;
+
+  int recording_p;
+  int num_recorded;
+  struct pkl_bcache_buffer out;
+  struct pkl_bcache_map vals;
+  struct pkl_bcache_map programs;
+  struct pkl_bcache_map insns;
+  struct pkl_bcache_walk walk;
+  int walk_p;
+
+  struct pkl_bcache_module *modules;
+  pvm_val *values;
+  uint32_t num_values;
+  pvm_program *progs;
+  size_t *prog_insns;
+  uint32_t num_progs;
+};
+
+#define PKL_BCACHE_WALK ((struct pkl_bcache_walk *) PKL_PASS_PAYLOAD)
+
+/* Add NODE to WALK.  Return 0 if NODE had already been visited, 1
+   otherwise.  */
+
+static int
+pkl_bcache_walk_add (struct pkl_bcache_walk *walk, pkl_ast_node node)
+{
+  uint32_t index;
+
+  if (pkl_bcache_map_lookup (&walk->seen, (uintptr_t) node, &index))
+    return 0;
+  pkl_bcache_map_insert (&walk->seen, (uintptr_t) node, 0);
+
+  if (PKL_AST_CODE (node) == PKL_AST_TYPE
+      && PKL_AST_TYPE_CODE (node) != PKL_TYPE_ARRAY
+      && PKL_AST_TYPE_CODE (node) != PKL_TYPE_STRUCT)
+    return 1;
+
+  if (walk->num_nodes == walk->allocated)
+    {
+      walk->allocated = 2 * walk->allocated + 256;
+      walk->nodes = xrealloc (walk->nodes,
+                              walk->allocated * sizeof (pkl_ast_node));
+    }
+
+  walk->nodes[walk->num_nodes++] = node;
+  return 1;
+}
+
+PKL_PHASE_BEGIN_HANDLER (pkl_bcache_pr_node)
+{
+  if (!pkl_bcache_walk_add (PKL_BCACHE_WALK, PKL_PASS_NODE))
+    PKL_PASS_BREAK;
+}
+PKL_PHASE_END_HANDLER
+
+static struct pkl_phase pkl_phase_bcache =
+  {
+   PKL_PHASE_PR_HANDLER (PKL_AST_TYPE, pkl_bcache_pr_node),
+   PKL_PHASE_PR_HANDLER (PKL_AST_FUNC, pkl_bcache_pr_node),
+  };
+
+static int
+pkl_bcache_walk (pkl_bcache bcache, pkl_ast ast,
+                 struct pkl_bcache_walk *walk)
+{
+  struct pkl_phase *phases[] = { &pkl_phase_bcache, NULL };
+  void *payloads[] = { walk };
+
+  memset (walk, 0, sizeof (struct pkl_bcache_walk));
+  return pkl_do_pass (bcache->compiler, ast, phases, payloads,
+                      PKL_PASS_F_TYPES, 0);
+}
+
+static void
+pkl_bcache_walk_free (struct pkl_bcache_walk *walk)
+{
+  pkl_bcache_map_free (&walk->seen);
+  free (walk->nodes);
+}
+
+/* Return the kind of the AST node NODE, and store pointers to its
+   closures in SLOTS, returning their number in *NUM_SLOTS.  The
+   program of functions is handled separately.  */
+
+static int
+pkl_bcache_node_slots (pkl_ast_node node, pvm_val **slots, int *num_slots)
+{
+  if (PKL_AST_CODE (node) == PKL_AST_FUNC)
+    {
+      *num_slots = 0;
+      return PKL_BCACHE_NODE_FUNC;
+    }
+  else if (PKL_AST_TYPE_CODE (node) == PKL_TYPE_ARRAY)
+    {
+      slots[0] = &PKL_AST_TYPE_A_MAPPER (node);
+      slots[1] = &PKL_AST_TYPE_A_WRITER (node);
+      slots[2] = &PKL_AST_TYPE_A_BOUNDER (node);
+      slots[3] = &PKL_AST_TYPE_A_CONSTRUCTOR (node);
+      *num_slots = 4;
+      return PKL_BCACHE_NODE_ARRAY;
+    }
+  else
+    {
+      slots[0] = &PKL_AST_TYPE_S_MAPPER (node);
+      slots[1] = &PKL_AST_TYPE_S_WRITER (node);
+      slots[2] = &PKL_AST_TYPE_S_CONSTRUCTOR (node);
+      slots[3] = &PKL_AST_TYPE_S_COMPARATOR (node);
+      slots[4] = &PKL_AST_TYPE_S_INTEGRATOR (node);
+      *num_slots = 5;
+      return PKL_BCACHE_NODE_STRUCT;
+    }
+}
+
+/* **************** Writing cache files ****************  */
+
+static int pkl_bcache_write_program (pkl_bcache bcache,
+                                     pvm_program program,
+                                     uint32_t *index);
+
+/* Write the value VAL in the cache, unless it was already written,
+   and store its number in *INDEX.  Return 0 if VAL can't be
+   written, 1 otherwise.  */
+
+static int
+pkl_bcache_write_val (pkl_bcache bcache, pvm_val val, uint32_t *index)
+{
+  struct pkl_bcache_buffer rec = { 0 };
+  uint32_t a, b;
+
+  if (val == PVM_NULL)
+    {
+      *index = PKL_BCACHE_NULL;
+      return 1;
+    }
+
+  if (pkl_bcache_map_lookup (&bcache->vals, val, index))
+    return 1;
+
+  pkl_bcache_put_u8 (&rec, 'v');
+
+  if (PVM_IS_INT (val) || PVM_IS_UINT (val))
+    {
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_INT);
+      pkl_bcache_put_u64 (&rec, val);
+    }
+  else if (PVM_IS_LONG (val))
+    {
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_LONG);
+      pkl_bcache_put_u64 (&rec, PVM_VAL_LONG (val));
+      pkl_bcache_put_u8 (&rec, PVM_VAL_LONG_SIZE (val));
+    }
+  else if (PVM_IS_ULONG (val))
+    {
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_ULONG);
+      pkl_bcache_put_u64 (&rec, PVM_VAL_ULONG (val));
+      pkl_bcache_put_u8 (&rec, PVM_VAL_ULONG_SIZE (val));
+    }
+  else if (PVM_IS_STR (val))
+    {
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_STRING);
+      pkl_bcache_put_u8 (&rec, pvm_string_atom_p (val));
+      pkl_bcache_put_string (&rec, PVM_VAL_STR (val));
+    }
+  else if (PVM_IS_OFF (val))
+    {
+      if (!pkl_bcache_write_val (bcache, PVM_VAL_OFF_MAGNITUDE (val), &a)
+          || !pkl_bcache_write_val (bcache, PVM_VAL_OFF_UNIT (val), &b))
+        goto error;
+
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_OFFSET);
+      pkl_bcache_put_u32 (&rec, a);
+      pkl_bcache_put_u32 (&rec, b);
+    }
+  else if (PVM_IS_TYP (val))
+    {
+      uint32_t *elems = NULL;
+      size_t i, num_elems = 0;
+
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_TYPE);
+      pkl_bcache_put_u8 (&rec, PVM_VAL_TYP_CODE (val));
+
+      switch (PVM_VAL_TYP_CODE (val))
+        {
+        case PVM_TYPE_STRING:
+        case PVM_TYPE_ANY:
+        case PVM_TYPE_VOID:
+          break;
+        case PVM_TYPE_INTEGRAL:
+          if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_I_SIZE (val), &a)
+              || !pkl_bcache_write_val (bcache,
+                                        PVM_VAL_TYP_I_SIGNED_P (val), &b))
+            goto error;
+          pkl_bcache_put_u32 (&rec, a);
+          pkl_bcache_put_u32 (&rec, b);
+          break;
+        case PVM_TYPE_OFFSET:
+          if (!pkl_bcache_write_val (bcache,
+                                     PVM_VAL_TYP_O_BASE_TYPE (val), &a)
+              || !pkl_bcache_write_val (bcache, PVM_VAL_TYP_O_UNIT (val), &b))
+            goto error;
+          pkl_bcache_put_u32 (&rec, a);
+          pkl_bcache_put_u32 (&rec, b);
+          break;
+        case PVM_TYPE_ARRAY:
+          if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_A_ETYPE (val), &a)
+              || !pkl_bcache_write_val (bcache, PVM_VAL_TYP_A_BOUND (val), &b))
+            goto error;
+          pkl_bcache_put_u32 (&rec, a);
+          pkl_bcache_put_u32 (&rec, b);
+          break;
+        case PVM_TYPE_DICT:
+          if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_D_KTYPE (val), &a)
+              || !pkl_bcache_write_val (bcache, PVM_VAL_TYP_D_VTYPE (val), &b))
+            goto error;
+          pkl_bcache_put_u32 (&rec, a);
+          pkl_bcache_put_u32 (&rec, b);
+          break;
+        case PVM_TYPE_STRUCT:
+          {
+            pvm_val nfields = PVM_VAL_TYP_S_NFIELDS (val);
+
+            if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_S_NAME (val), &a)
+                || !pkl_bcache_write_val (bcache, nfields, &b))
+              goto error;
+            pkl_bcache_put_u32 (&rec, a);
+            pkl_bcache_put_u32 (&rec, b);
+
+            num_elems = 2 * PVM_VAL_ULONG (nfields);
+            elems = xmalloc (num_elems * sizeof (uint32_t) + 1);
+            for (i = 0; i < num_elems / 2; ++i)
+              if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_S_FNAME (val, i),
+                                         &elems[2 * i])
+                  || !pkl_bcache_write_val (bcache,
+                                            PVM_VAL_TYP_S_FTYPE (val, i),
+                                            &elems[2 * i + 1]))
+                {
+                  free (elems);
+                  goto error;
+                }
+            break;
+          }
+        case PVM_TYPE_CLOSURE:
+          {
+            pvm_val nargs = PVM_VAL_TYP_C_NARGS (val);
+
+            if (!pkl_bcache_write_val (bcache,
+                                       PVM_VAL_TYP_C_RETURN_TYPE (val), &a)
+                || !pkl_bcache_write_val (bcache, nargs, &b))
+              goto error;
+            pkl_bcache_put_u32 (&rec, a);
+            pkl_bcache_put_u32 (&rec, b);
+
+            num_elems = PVM_VAL_ULONG (nargs);
+            elems = xmalloc (num_elems * sizeof (uint32_t) + 1);
+            for (i = 0; i < num_elems; ++i)
+              if (!pkl_bcache_write_val (bcache, PVM_VAL_TYP_C_ATYPE (val, i),
+                                         &elems[i]))
+                {
+                  free (elems);
+                  goto error;
+                }
+            break;
+          }
+        default:
+          goto error;
+        }
+
+      for (i = 0; i < num_elems; ++i)
+        pkl_bcache_put_u32 (&rec, elems[i]);
+      free (elems);
+    }
+  else if (PVM_IS_CLS (val))
+    {
+      if (!pkl_bcache_write_program (bcache, PVM_VAL_CLS_PROGRAM (val), &a))
+        goto error;
+
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_CLOSURE);
+      pkl_bcache_put_u32 (&rec, a);
+    }
+  else if (pvm_exception_p (val))
+    {
+      pvm_val code = PVM_VAL_SCT_FIELD_VALUE (val, 0);
+      pvm_val msg = PVM_VAL_SCT_FIELD_VALUE (val, 1);
+      pvm_val exit_status = PVM_VAL_SCT_FIELD_VALUE (val, 2);
+
+      if (!PVM_IS_INT (code) || !PVM_IS_STR (msg) || !PVM_IS_INT (exit_status)
+          || !pkl_bcache_write_val (bcache, msg, &a))
+        goto error;
+
+      pkl_bcache_put_u8 (&rec, PKL_BCACHE_VAL_EXCEPTION);
+      pkl_bcache_put_u32 (&rec, PVM_VAL_INT (code));
+      pkl_bcache_put_u32 (&rec, a);
+      pkl_bcache_put_u32 (&rec, PVM_VAL_INT (exit_status));
+    }
+  else
+    /* Arrays, structs other than exceptions and dictionaries are never
+       literals in compiled code.  */
+    goto error;
+
+  pkl_bcache_put (&bcache->out, rec.data, rec.size);
+  free (rec.data);
+
+  *index = bcache->vals.count;
+  pkl_bcache_map_insert (&bcache->vals, val, *index);
+  return 1;
+
+ error:
+  free (rec.data);
+  return 0;
+}
+
+/* State of `pkl_bcache_write_item'.  REC is the record of the
+   program being written, and ARGS are the arguments of its last
+   instruction that have not been written yet.  */
+
+struct pkl_bcache_items
+{
+  pkl_bcache bcache;
+  struct pkl_bcache_buffer *rec;
+  const char *args;
+};
+
+/* Return the index of the instruction INSN_NAME in
+   pkl_bcache_insn_names, or -1 if there is no such instruction.  */
+
+static int
+pkl_bcache_insn_index (pkl_bcache bcache, const char *insn_name)
+{
+  uint32_t index;
+  int i;
+
+  if (pkl_bcache_map_lookup (&bcache->insns, (uintptr_t) insn_name, &index))
+    return index;
+
+  for (i = 0; i < PKL_INSN_MACRO; ++i)
+    if (STREQ (pkl_bcache_insn_names[i], insn_name))
+      {
+        pkl_bcache_map_insert (&bcache->insns, (uintptr_t) insn_name, i);
+        return i;
+      }
+
+  return -1;
+}
+
+/* Items are written as a byte telling their kind, followed by:
+
+   'l' a label: the number of the label.
+   'i' an instruction: the index of the instruction, followed by its
+       parameters.  Value parameters are written as the number of the
+       value, and the other parameters as the literal, register or
+       label.
+   'P' a push instruction: the number of the pushed value.
+   'e' the end of the program.  */
+
+static int
+pkl_bcache_write_item (enum pvm_program_item_kind kind,
+                       const char *insn_name, pvm_val val,
+                       unsigned int n, void *data)
+{
+  struct pkl_bcache_items *items = data;
+  struct pkl_bcache_buffer *rec = items->rec;
+  uint32_t index;
+  int insn;
+
+  switch (kind)
+    {
+    case PVM_PROGRAM_ITEM_LABEL:
+      if (*items->args != '\0')
+        return PVM_EINVAL;
+      pkl_bcache_put_u8 (rec, 'l');
+      pkl_bcache_put_u32 (rec, n);
+      break;
+    case PVM_PROGRAM_ITEM_INSN:
+      insn = pkl_bcache_insn_index (items->bcache, insn_name);
+      if (*items->args != '\0' || insn == -1)
+        return PVM_EINVAL;
+      pkl_bcache_put_u8 (rec, 'i');
+      pkl_bcache_put_u32 (rec, insn);
+      items->args = pkl_bcache_insn_args[insn];
+      break;
+    case PVM_PROGRAM_ITEM_PUSH:
+      if (*items->args != '\0'
+          || !pkl_bcache_write_val (items->bcache, val, &index))
+        return PVM_EINVAL;
+      pkl_bcache_put_u8 (rec, 'P');
+      pkl_bcache_put_u32 (rec, index);
+      break;
+    case PVM_PROGRAM_ITEM_VAL_PARAM:
+      if (*items->args != 'v'
+          || !pkl_bcache_write_val (items->bcache, val, &index))
+        return PVM_EINVAL;
+      pkl_bcache_put_u32 (rec, index);
+      items->args++;
+      break;
+    case PVM_PROGRAM_ITEM_UNSIGNED_PARAM:
+    case PVM_PROGRAM_ITEM_REGISTER_PARAM:
+    case PVM_PROGRAM_ITEM_LABEL_PARAM:
+      if (*items->args
+          != (kind == PVM_PROGRAM_ITEM_UNSIGNED_PARAM ? 'n'
+              : kind == PVM_PROGRAM_ITEM_REGISTER_PARAM ? 'r' : 'l'))
+        return PVM_EINVAL;
+      pkl_bcache_put_u32 (rec, n);
+      items->args++;
+      break;
+    default:
+      return PVM_EINVAL;
+    }
+
+  return PVM_OK;
+}
+
+/* Write PROGRAM in the cache, unless it was already written, and
+   store its number in *INDEX.  Return 0 if PROGRAM can't be
+   written, 1 otherwise.  */
+
+static int
+pkl_bcache_write_program (pkl_bcache bcache, pvm_program program,
+                          uint32_t *index)
+{
+  struct pkl_bcache_buffer rec = { 0 };
+  struct pkl_bcache_items items;
+
+  if (pkl_bcache_map_lookup (&bcache->programs, (uintptr_t) program, index))
+    return 1;
+
+  pkl_bcache_put_u8 (&rec, 'p');
+  pkl_bcache_put_string (&rec, pvm_program_name (program));
+  pkl_bcache_put_string (&rec, pvm_program_location (program));
+  pkl_bcache_put_u32 (&rec, pvm_program_num_labels (program));
+
+  items.bcache = bcache;
+  items.rec = &rec;
+  items.args = "";
+  if (pvm_program_map_items (program, pkl_bcache_write_item,
+                             &items) != PVM_OK
+      || *items.args != '\0')
+    {
+      free (rec.data);
+      return 0;
+    }
+  pkl_bcache_put_u8 (&rec, 'e');
+
+  pkl_bcache_put (&bcache->out, rec.data, rec.size);
+  free (rec.data);
+
+  *index = bcache->programs.count;
+  pkl_bcache_map_insert (&bcache->programs, (uintptr_t) program, *index);
+  return 1;
+}
+
+void
+pkl_bcache_record (pkl_bcache bcache, pkl_ast ast, pvm_program program)
+{
+  struct pkl_bcache_buffer rec = { 0 };
+  struct pkl_bcache_walk *walk = &bcache->walk;
+  uint32_t index;
+  size_t i;
+
+  if (bcache == NULL || !bcache->recording_p)
+    return;
+
+  if (!bcache->walk_p
+      || !pkl_bcache_write_program (bcache, program, &index))
+    goto error;
+
+  pkl_bcache_put_u8 (&rec, 'm');
+  pkl_bcache_put_u32 (&rec, index);
+  pkl_bcache_put_u32 (&rec, walk->num_nodes);
+
+  for (i = 0; i < walk->num_nodes; ++i)
+    {
+      pkl_ast_node node = walk->nodes[i];
+      pvm_val *slots[PKL_BCACHE_MAX_SLOTS];
+      int j, num_slots;
+      int kind = pkl_bcache_node_slots (node, slots, &num_slots);
+
+      pkl_bcache_put_u64 (&rec, PKL_AST_UID (node));
+      pkl_bcache_put_u8 (&rec, kind);
+
+      if (kind == PKL_BCACHE_NODE_FUNC)
+        {
+          index = PKL_BCACHE_NULL;
+          if (PKL_AST_FUNC_PROGRAM (node)
+              && !pkl_bcache_write_program (bcache,
+                                            PKL_AST_FUNC_PROGRAM (node),
+                                            &index))
+            goto error;
+          pkl_bcache_put_u32 (&rec, index);
+        }
+
+      for (j = 0; j < num_slots; ++j)
+        {
+          if (!pkl_bcache_write_val (bcache, *slots[j], &index))
+            goto error;
+          pkl_bcache_put_u32 (&rec, index);
+        }
+    }
+
+  pkl_bcache_put (&bcache->out, rec.data, rec.size);
+  free (rec.data);
+  bcache->num_recorded++;
+  return;
+
+ error:
+  /* The module can't be cached.  Stop recording.  */
+  free (rec.data);
+  bcache->recording_p = 0;
+}
+
+/* Write the cache file.  The cache file is written in a temporary
+   file which is then renamed, so concurrent processes never see
+   partially written cache files.  Failing to write the cache file is
+   not an error.  */
+
+static void
+pkl_bcache_save (pkl_bcache bcache)
+{
+  char *tmpname;
+  FILE *fp;
+  int fd, write_ok;
+
+  if (!pk_mkdir_p (bcache->dir, 0700))
+    return;
+
+  tmpname = pk_str_concat (bcache->filename, ".XXXXXX", NULL);
+  if (!tmpname)
+    return;
+
+  fd = mkstemp (tmpname);
+  if (fd == -1)
+    {
+      free (tmpname);
+      return;
+    }
+
+  fp = fdopen (fd, "wb");
+  if (!fp)
+    {
+      close (fd);
+      goto error;
+    }
+
+  fputs (PKL_BCACHE_MAGIC, fp);
+  fwrite (bcache->out.data, 1, bcache->out.size, fp);
+  fputc ('e', fp);
+
+  write_ok = !ferror (fp);
+  if (fclose (fp) == EOF)
+    write_ok = 0;
+  if (!write_ok || rename (tmpname, bcache->filename) != 0)
+    goto error;
+
+  free (tmpname);
+  return;
+
+ error:
+  unlink (tmpname);
+  free (tmpname);
+}
+
+/* **************** Reading cache files ****************  */
+
+/* Store in *VAL the value numbered INDEX.  */
+
+static int
+pkl_bcache_get_val (pkl_bcache bcache, uint32_t index, pvm_val *val)
+{
+  if (index == PKL_BCACHE_NULL)
+    *val = PVM_NULL;
+  else if (index < bcache->num_values)
+    *val = bcache->values[index];
+  else
+    return 0;
+
+  return 1;
+}
+
+static int
+pkl_bcache_read_val_index (pkl_bcache bcache,
+                           struct pkl_bcache_reader *r, pvm_val *val)
+{
+  uint32_t index;
+
+  return (pkl_bcache_get_u32 (r, &index)
+          && pkl_bcache_get_val (bcache, index, val));
+}
+
+/* Read the components of a type.  */
+
+static int
+pkl_bcache_read_type (pkl_bcache bcache, struct pkl_bcache_reader *r,
+                      pvm_val *val)
+{
+  pvm_val a, b, *elems, *elems2;
+  uint64_t i, n;
+  uint8_t code;
+
+  if (!pkl_bcache_get_u8 (r, &code))
+    return 0;
+
+  switch (code)
+    {
+    case PVM_TYPE_STRING:
+      *val = pvm_make_string_type ();
+      return 1;
+    case PVM_TYPE_ANY:
+      *val = pvm_make_any_type ();
+      return 1;
+    case PVM_TYPE_VOID:
+      *val = pvm_make_void_type ();
+      return 1;
+    default:
+      break;
+    }
+
+  if (!pkl_bcache_read_val_index (bcache, r, &a)
+      || !pkl_bcache_read_val_index (bcache, r, &b))
+    return 0;
+
+  switch (code)
+    {
+    case PVM_TYPE_INTEGRAL:
+      if (!PVM_IS_ULONG (a) || !(PVM_IS_INT (b) || PVM_IS_UINT (b)))
+        return 0;
+      *val = pvm_make_integral_type (a, b);
+      break;
+    case PVM_TYPE_OFFSET:
+      *val = pvm_make_offset_type (a, b);
+      break;
+    case PVM_TYPE_ARRAY:
+      *val = pvm_make_array_type (a, b);
+      break;
+    case PVM_TYPE_DICT:
+      *val = pvm_make_dict_type (a, b);
+      break;
+    case PVM_TYPE_STRUCT:
+    case PVM_TYPE_CLOSURE:
+      if (!PVM_IS_ULONG (b))
+        return 0;
+
+      n = PVM_VAL_ULONG (b);
+      if (n > (uint64_t) (r->end - r->p) / sizeof (uint32_t))
+        return 0;
+
+      if (code == PVM_TYPE_STRUCT)
+        {
+          pvm_allocate_struct_attrs (b, &elems, &elems2);
+          for (i = 0; i < n; ++i)
+            if (!pkl_bcache_read_val_index (bcache, r, &elems[i])
+                || !pkl_bcache_read_val_index (bcache, r, &elems2[i]))
+              return 0;
+          *val = pvm_make_struct_type (b, a, elems, elems2);
+        }
+      else
+        {
+          pvm_allocate_closure_attrs (b, &elems);
+          for (i = 0; i < n; ++i)
+            if (!pkl_bcache_read_val_index (bcache, r, &elems[i]))
+              return 0;
+          *val = pvm_make_closure_type (a, b, elems);
+        }
+      break;
+    default:
+      return 0;
+    }
+
+  return 1;
+}
+
+/* Read a 'v' record.  */
+
+static int
+pkl_bcache_read_val (pkl_bcache bcache, struct pkl_bcache_reader *r)
+{
+  pvm_val val, a, b;
+  uint64_t n;
+  uint32_t code, exit_status;
+  uint8_t kind, size;
+  char *str;
+
+  if (!pkl_bcache_get_u8 (r, &kind))
+    return 0;
+
+  switch (kind)
+    {
+    case PKL_BCACHE_VAL_INT:
+      if (!pkl_bcache_get_u64 (r, &n)
+          || !(PVM_IS_INT (n) || PVM_IS_UINT (n)))
+        return 0;
+      val = n;
+      break;
+    case PKL_BCACHE_VAL_LONG:
+    case PKL_BCACHE_VAL_ULONG:
+      if (!pkl_bcache_get_u64 (r, &n)
+          || !pkl_bcache_get_u8 (r, &size)
+          || size < 1 || size > 64)
+        return 0;
+      val = (kind == PKL_BCACHE_VAL_LONG
+             ? pvm_make_long (n, size) : pvm_make_ulong (n, size));
+      break;
+    case PKL_BCACHE_VAL_STRING:
+      if (!pkl_bcache_get_u8 (r, &size)
+          || !pkl_bcache_get_string (r, &str)
+          || str == NULL)
+        return 0;
+      val = size ? pvm_make_string_atom (str) : pvm_make_string (str);
+      free (str);
+      break;
+    case PKL_BCACHE_VAL_OFFSET:
+      if (!pkl_bcache_read_val_index (bcache, r, &a)
+          || !pkl_bcache_read_val_index (bcache, r, &b)
+          || !PVM_IS_INTEGRAL (a) || !PVM_IS_ULONG (b))
+        return 0;
+      val = pvm_make_offset (a, b);
+      break;
+    case PKL_BCACHE_VAL_TYPE:
+      if (!pkl_bcache_read_type (bcache, r, &val))
+        return 0;
+      break;
+    case PKL_BCACHE_VAL_CLOSURE:
+      if (!pkl_bcache_get_u32 (r, &code)
+          || code >= bcache->num_progs)
+        return 0;
+      val = pvm_make_cls (bcache->progs[code]);
+      break;
+    case PKL_BCACHE_VAL_EXCEPTION:
+      if (!pkl_bcache_get_u32 (r, &code)
+          || !pkl_bcache_read_val_index (bcache, r, &a)
+          || !pkl_bcache_get_u32 (r, &exit_status)
+          || !PVM_IS_STR (a))
+        return 0;
+      val = pvm_make_exception ((int32_t) code, PVM_VAL_STR (a),
+                                (int32_t) exit_status);
+      break;
+    default:
+      return 0;
+    }
+
+  bcache->values = pvm_realloc (bcache->values,
+                                (bcache->num_values + 1) * sizeof (pvm_val));
+  bcache->values[bcache->num_values++] = val;
+  return 1;
+}
+
+/* Read a 'p' record.  */
+
+static int
+pkl_bcache_read_program (pkl_bcache bcache, struct pkl_bcache_reader *r)
+{
+  pvm_program program = pvm_program_new ();
+  char *name = NULL, *location = NULL;
+  size_t num_insns = 0;
+  uint32_t i, num_labels, n;
+  uint8_t kind;
+  pvm_val val;
+
+  if (!pkl_bcache_get_string (r, &name)
+      || !pkl_bcache_get_string (r, &location)
+      || !pkl_bcache_get_u32 (r, &num_labels)
+      || num_labels > (size_t) (r->end - r->p))
+    goto error;
+
+  pvm_program_set_name (program, name, location);
+  for (i = 0; i < num_labels; ++i)
+    pvm_program_fresh_label (program);
+
+  while (1)
+    {
+      const char *args;
+
+      if (!pkl_bcache_get_u8 (r, &kind))
+        goto error;
+
+      if (kind == 'e')
+        break;
+
+      switch (kind)
+        {
+        case 'l':
+          if (!pkl_bcache_get_u32 (r, &n) || n >= num_labels)
+            goto error;
+          pvm_program_append_label (program, n);
+          break;
+        case 'P':
+          if (!pkl_bcache_read_val_index (bcache, r, &val))
+            goto error;
+          pvm_program_append_push_instruction (program, val);
+          num_insns++;
+          break;
+        case 'i':
+          if (!pkl_bcache_get_u32 (r, &n)
+              || n >= PKL_INSN_MACRO || n == PKL_INSN_PUSH)
+            goto error;
+
+          pvm_program_append_instruction (program,
+                                          pkl_bcache_insn_names[n]);
+          num_insns++;
+
+          for (args = pkl_bcache_insn_args[n]; *args; ++args)
+            {
+              switch (*args)
+                {
+                case 'v':
+                  if (!pkl_bcache_read_val_index (bcache, r, &val))
+                    goto error;
+                  pvm_program_append_val_parameter (program, val);
+                  break;
+                case 'n':
+                  if (!pkl_bcache_get_u32 (r, &n))
+                    goto error;
+                  pvm_program_append_unsigned_parameter (program, n);
+                  break;
+                case 'r':
+                  if (!pkl_bcache_get_u32 (r, &n))
+                    goto error;
+                  pvm_program_append_register_parameter (program, n);
+                  break;
+                case 'l':
+                  if (!pkl_bcache_get_u32 (r, &n) || n >= num_labels)
+                    goto error;
+                  pvm_program_append_label_parameter (program, n);
+                  break;
+                default:
+                  goto error;
+                }
+            }
+          break;
+        default:
+          goto error;
+        }
+    }
+
+  free (name);
+  free (location);
+  pvm_program_make_executable (program);
+
+  bcache->progs = pvm_realloc (bcache->progs,
+                               (bcache->num_progs + 1) * sizeof (pvm_program));
+  bcache->prog_insns = xrealloc (bcache->prog_insns,
+                                 (bcache->num_progs + 1) * sizeof (size_t));
+  bcache->progs[bcache->num_progs] = program;
+  bcache->prog_insns[bcache->num_progs++] = num_insns;
+  return 1;
+
+ error:
+  free (name);
+  free (location);
+  pvm_destroy_program (program);
+  return 0;
+}
+
+/* Read a 'm' record.  */
+
+static int
+pkl_bcache_read_module (pkl_bcache bcache, struct pkl_bcache_reader *r)
+{
+  struct pkl_bcache_module *module;
+  uint32_t i;
+  int j;
+
+  bcache->modules = xrealloc (bcache->modules,
+                              ((bcache->num_modules + 1)
+                               * sizeof (struct pkl_bcache_module)));
+  module = &bcache->modules[bcache->num_modules];
+  module->nodes = NULL;
+  module->first_program = (bcache->num_modules == 0
+                           ? 0 : module[-1].last_program);
+  module->last_program = bcache->num_progs;
+
+  if (!pkl_bcache_get_u32 (r, &module->program)
+      || module->program >= bcache->num_progs
+      || module->program < module->first_program
+      || !pkl_bcache_get_u32 (r, &module->num_nodes)
+      || module->num_nodes > (size_t) (r->end - r->p))
+    return 0;
+
+  bcache->num_modules++;
+  module->nodes = xmalloc (module->num_nodes * sizeof (struct pkl_bcache_node)
+                           + 1);
+
+  for (i = 0; i < module->num_nodes; ++i)
+    {
+      struct pkl_bcache_node *node = &module->nodes[i];
+      int num_slots;
+
+      if (!pkl_bcache_get_u64 (r, &node->uid)
+          || !pkl_bcache_get_u8 (r, &node->kind))
+        return 0;
+
+      switch (node->kind)
+        {
+        case PKL_BCACHE_NODE_ARRAY: num_slots = 4; break;
+        case PKL_BCACHE_NODE_STRUCT: num_slots = 5; break;
+        case PKL_BCACHE_NODE_FUNC: num_slots = 1; break;
+        default:
+          return 0;
+        }
+
+      for (j = 0; j < num_slots; ++j)
+        {
+          pvm_val val;
+
+          if (!pkl_bcache_get_u32 (r, &node->slots[j]))
+            return 0;
+
+          if (node->kind == PKL_BCACHE_NODE_FUNC)
+            {
+              if (node->slots[j] != PKL_BCACHE_NULL
+                  && node->slots[j] >= bcache->num_progs)
+                return 0;
+            }
+          else if (!pkl_bcache_get_val (bcache, node->slots[j], &val)
+                   || (val != PVM_NULL && !PVM_IS_CLS (val)))
+            return 0;
+        }
+    }
+
+  return 1;
+}
+
+/* Read the cache file.  Return 0 if it doesn't exist or it is not
+   valid, 1 otherwise.  */
+
+static int
+pkl_bcache_load (pkl_bcache bcache, int num_files)
+{
+  struct pkl_bcache_reader r;
+  char *data = NULL;
+  size_t size = 0, allocated = 0;
+  int ret = 0;
+  FILE *fp;
+
+  fp = fopen (bcache->filename, "rb");
+  if (!fp)
+    return 0;
+
+  while (1)
+    {
+      size_t n;
+
+      if (size == allocated)
+        {
+          allocated = 2 * allocated + 65536;
+          data = xrealloc (data, allocated);
+        }
+
+      n = fread (data + size, 1, allocated - size, fp);
+      size += n;
+      if (n == 0)
+        break;
+    }
+
+  if (ferror (fp)
+      || size < strlen (PKL_BCACHE_MAGIC)
+      || strncmp (data, PKL_BCACHE_MAGIC, strlen (PKL_BCACHE_MAGIC)) != 0)
+    goto done;
+
+  r.p = data + strlen (PKL_BCACHE_MAGIC);
+  r.end = data + size;
+
+  while (1)
+    {
+      uint8_t kind;
+
+      if (!pkl_bcache_get_u8 (&r, &kind))
+        goto done;
+
+      if (kind == 'e')
+        break;
+      else if (kind == 'v')
+        {
+          if (!pkl_bcache_read_val (bcache, &r))
+            goto done;
+        }
+      else if (kind == 'p')
+        {
+          if (!pkl_bcache_read_program (bcache, &r))
+            goto done;
+        }
+      else if (kind == 'm')
+        {
+          if (!pkl_bcache_read_module (bcache, &r))
+            goto done;
+        }
+      else
+        goto done;
+    }
+
+  ret = (r.p == r.end && bcache->num_modules == num_files);
+
+ done:
+  fclose (fp);
+  free (data);
+  return ret;
+}
+
+/* **************** Opening and closing the cache ****************  */
+
+/* Compute the hash of the cached modules in DIGEST.  Return 0 if
+   some file can't be read, 1 otherwise.  */
+
+static int
+pkl_bcache_hash (const char **files, int nfiles, unsigned char *digest)
+{
+  static const uint32_t byte_order = 0x01020304;
+  struct sha256_ctx ctx;
+  char buf[4096];
+  uint32_t sizes[2] = { sizeof (pvm_val), sizeof (void *) };
+  int i;
+
+  sha256_init_ctx (&ctx);
+  sha256_process_bytes (PKL_BCACHE_MAGIC PACKAGE_VERSION PKL_BCACHE_BUILD_ID,
+                        strlen (PKL_BCACHE_MAGIC PACKAGE_VERSION
+                                PKL_BCACHE_BUILD_ID) + 1,
+                        &ctx);
+  sha256_process_bytes (&byte_order, sizeof (byte_order), &ctx);
+  sha256_process_bytes (sizes, sizeof (sizes), &ctx);
+
+  /* Instructions are written as their index in the tables of
+     instructions.  */
+  for (i = 0; i < PKL_INSN_MACRO; ++i)
+    {
+      sha256_process_bytes (pkl_bcache_insn_names[i],
+                            strlen (pkl_bcache_insn_names[i]) + 1, &ctx);
+      sha256_process_bytes (pkl_bcache_insn_args[i],
+                            strlen (pkl_bcache_insn_args[i]) + 1, &ctx);
+    }
+
+  for (i = 0; i < nfiles; ++i)
+    {
+      FILE *fp = fopen (files[i], "rb");
+      size_t n;
+
+      if (!fp)
+        return 0;
+
+      /* The name of the file is part of the location of the programs
+         in the cache.  */
+      sha256_process_bytes (files[i], strlen (files[i]) + 1, &ctx);
+
+      while ((n = fread (buf, 1, sizeof (buf), fp)) > 0)
+        sha256_process_bytes (buf, n, &ctx);
+
+      if (ferror (fp))
+        {
+          fclose (fp);
+          return 0;
+        }
+      fclose (fp);
+
+      /* Separate the contents of the files.  */
+      sha256_process_bytes ("", 1, &ctx);
+    }
+
+  sha256_finish_ctx (&ctx, digest);
+  return 1;
+}
+
+/* The tables of values and programs, and the keys of the maps, are
+   regular C pointers to memory allocated in the GC heap.  */
+
+#define PKL_BCACHE_ROOTS(BCACHE, FN)                    \
+  do                                                    \
+    {                                                   \
+      FN (&(BCACHE)->values, 1);                        \
+      FN (&(BCACHE)->progs, 1);                         \
+      FN (&(BCACHE)->vals.keys, 1);                     \
+      FN (&(BCACHE)->programs.keys, 1);                 \
+    }                                                   \
+  while (0)
+
+pkl_bcache
+pkl_bcache_open (pkl_compiler compiler, const char *dir,
+                 const char **files, int nfiles)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  pkl_bcache bcache;
+  uint32_t j;
+  int i;
+
+  if (!pkl_bcache_hash (files, nfiles, digest))
+    return NULL;
+
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    sprintf (hex + 2 * i, "%02x", digest[i]);
+
+  bcache = xzalloc (sizeof (struct pkl_bcache));
+  bcache->compiler = compiler;
+  bcache->dir = xstrdup (dir);
+  bcache->filename = pk_str_concat (dir, "/", hex, ".pkbc", NULL);
+  if (!bcache->filename)
+    {
+      free (bcache->dir);
+      free (bcache);
+      return NULL;
+    }
+
+  PKL_BCACHE_ROOTS (bcache, pvm_alloc_add_gc_roots);
+
+  if (!pkl_bcache_load (bcache, nfiles))
+    {
+      /* Record the modules while they are compiled, in order to
+         write the cache file.  */
+      for (i = 0; i < bcache->num_modules; ++i)
+        free (bcache->modules[i].nodes);
+      for (j = 0; j < bcache->num_progs; ++j)
+        pvm_destroy_program (bcache->progs[j]);
+      free (bcache->modules);
+      free (bcache->prog_insns);
+      bcache->modules = NULL;
+      bcache->values = NULL;
+      bcache->progs = NULL;
+      bcache->prog_insns = NULL;
+      bcache->num_values = 0;
+      bcache->num_progs = 0;
+      bcache->recording_p = 1;
+    }
+
+  bcache->num_modules = nfiles;
+  return bcache;
+}
+
+int
+pkl_bcache_recording_p (pkl_bcache bcache)
+{
+  return bcache != NULL && bcache->recording_p;
+}
+
+pvm_program
+pkl_bcache_restore (pkl_bcache bcache, pkl_ast ast)
+{
+  struct pkl_bcache_module *module;
+  struct pkl_bcache_walk *walk = &bcache->walk;
+  size_t i;
+
+  if (bcache->next_module >= bcache->num_modules)
+    return NULL;
+
+  /* The AST nodes of the module are collected before generating code
+     for it, so they can be compared with the ones found when
+     restoring it.  */
+  if (bcache->walk_p)
+    pkl_bcache_walk_free (walk);
+  bcache->walk_p = pkl_bcache_walk (bcache, ast, walk);
+
+  if (bcache->recording_p || !bcache->walk_p)
+    goto error;
+
+  module = &bcache->modules[bcache->next_module++];
+  if (walk->num_nodes != module->num_nodes)
+    goto error;
+
+  for (i = 0; i < walk->num_nodes; ++i)
+    {
+      pvm_val *slots[PKL_BCACHE_MAX_SLOTS];
+      int num_slots;
+
+      if (PKL_AST_UID (walk->nodes[i]) != module->nodes[i].uid
+          || (pkl_bcache_node_slots (walk->nodes[i], slots, &num_slots)
+              != module->nodes[i].kind))
+        goto error;
+    }
+
+  /* The AST corresponds to the cached module.  Install the closures
+     in it.  */
+  for (i = 0; i < walk->num_nodes; ++i)
+    {
+      struct pkl_bcache_node *node = &module->nodes[i];
+      pvm_val *slots[PKL_BCACHE_MAX_SLOTS];
+      int j, num_slots;
+
+      pkl_bcache_node_slots (walk->nodes[i], slots, &num_slots);
+      if (node->kind == PKL_BCACHE_NODE_FUNC)
+        PKL_AST_FUNC_PROGRAM (walk->nodes[i])
+          = (node->slots[0] == PKL_BCACHE_NULL
+             ? NULL : bcache->progs[node->slots[0]]);
+
+      for (j = 0; j < num_slots; ++j)
+        pkl_bcache_get_val (bcache, node->slots[j], slots[j]);
+    }
+
+  for (i = module->first_program; i < module->last_program; ++i)
+    pkl_compile_stats_add_routine (bcache->compiler, bcache->prog_insns[i]);
+
+  return bcache->progs[module->program];
+
+ error:
+  /* The code generated for the next modules may refer to values in
+     the code of this module, so they can't be restored either.  */
+  if (!bcache->recording_p)
+    bcache->next_module = bcache->num_modules;
+  return NULL;
+}
+
+void
+pkl_bcache_close (pkl_bcache bcache)
+{
+  int i;
+
+  if (bcache == NULL)
+    return;
+
+  if (bcache->recording_p
+      && bcache->num_recorded == bcache->num_modules)
+    pkl_bcache_save (bcache);
+
+  PKL_BCACHE_ROOTS (bcache, pvm_alloc_remove_gc_roots);
+
+  if (bcache->walk_p)
+    pkl_bcache_walk_free (&bcache->walk);
+  if (bcache->modules)
+    for (i = 0; i < bcache->num_modules; ++i)
+      free (bcache->modules[i].nodes);
+  free (bcache->modules);
+  free (bcache->prog_insns);
+  free (bcache->out.data);
+  pkl_bcache_map_free (&bcache->vals);
+  pkl_bcache_map_free (&bcache->programs);
+  pkl_bcache_map_free (&bcache->insns);
+  free (bcache->dir);
+  free (bcache->filename);
+  free (bcache);
+}
@@ -0,0 +1,80 @@
+/* pkl-bcache.h - Cache of the compiled run-time of the compiler.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PKL_BCACHE_H
+#define PKL_BCACHE_H
+
+#include <config.h>
+
+#include "pkl.h"
+#include "pkl-ast.h"
+#include "pvm.h"
+
+/* The bytecode cache stores the code generated for the modules
+   compiled while bootstrapping the compiler, i.e. pkl-rt.pk and
+   std.pk, so the next compilers created with the same sources don't
+   have to generate it again.
+
+   The modules are still parsed and go through the front-end and the
+   middle-end, since their declarations are needed in the
+   compile-time environment.  Only the code generation and the
+   assembly of their PVM programs are skipped.  */
+
+typedef struct pkl_bcache *pkl_bcache;
+
+/* Open the bytecode cache for the modules in the files FILES, which
+   is an array of NFILES file names in the order in which the modules
+   are compiled.  The cache file is located in the directory DIR.
+
+   If the cache file exists and is valid then the compiled modules
+   are loaded from it.  Otherwise, the programs assembled by COMPILER
+   will be recorded, and the cache file will be written by
+   `pkl_bcache_close'.
+
+   Return NULL if the files can't be read.  */
+
+pkl_bcache pkl_bcache_open (pkl_compiler compiler, const char *dir,
+                            const char **files, int nfiles);
+
+/* Return whether the programs assembled by the compiler shall keep
+   their items, so they can be recorded in BCACHE.  */
+
+int pkl_bcache_recording_p (pkl_bcache bcache);
+
+/* Return the cached program of the next module, whose AST has been
+   processed by the front-end and the middle-end, and install the
+   closures of its types and functions in AST.  If the module is not
+   in the cache, or AST doesn't correspond to it, return NULL.  In
+   that case code shall be generated for the module as usual and
+   passed to `pkl_bcache_record'.  */
+
+pvm_program pkl_bcache_restore (pkl_bcache bcache, pkl_ast ast);
+
+/* Record PROGRAM, the program generated for the module whose AST is
+   AST, in BCACHE.  This function shall be called before PROGRAM is
+   run.  */
+
+void pkl_bcache_record (pkl_bcache bcache, pkl_ast ast,
+                        pvm_program program);
+
+/* Write the cache file if all the modules have been recorded, and
+   free the resources used by BCACHE.  */
+
+void pkl_bcache_close (pkl_bcache bcache);
+
+#endif /* ! PKL_BCACHE_H */
@@ -29,107 +29,238 @@
 #include "pkl-ast.h"
 #include "pkl-env.h"
 
-/* The declarations are organized in a hash table, chained in their
-   buckes through CHAIN2.
-
-   There are two namespaces in Poke:
+/* The declarations are organized in tables.  There are two
+   namespaces in Poke:
 
    - A main namespace, shared by types, variables and functions.
-     HASH_TABLE is used to store declarations for these entities.
+     TABLE is used to store declarations for these entities.
 
-   - A separated namespace for offset units.  UNITS_HASH_TABLE is used
-     to store declarations for these.
+   - A separated namespace for offset units.  UNITS_TABLE is used to
+     store declarations for these.
 
    UP is a link to the immediately enclosing frame.  This is NULL for
    the top-level frame.  */
 
-#define HASH_TABLE_SIZE 1008
-typedef pkl_ast_node pkl_hash[HASH_TABLE_SIZE];
+/* Tables store their declarations in DECLS, in registration order,
+   along with the hashes of their names in HASHES.  NUM_DECLS is the
+   number of declarations in the table, and SIZE the number of
+   allocated entries in DECLS and HASHES.
+
+   Most frames, like the ones of function bodies, contain just a few
+   declarations.  These are stored in INLINE_DECLS and INLINE_HASHES,
+   and looked up linearly.  Bigger tables have an INDEX, which is an
+   open-addressing hash table with linear probing of INDEX_SIZE slots,
+   a power of two.  Each slot holds the position in DECLS of a
+   declaration plus one, or zero if the slot is empty.  The index is
+   kept at most half full.
+
+   Declarations are never removed from a table.  When a top-level
+   declaration is redefined the name of the old declaration is changed
+   to "" instead, so it stays where it was and doesn't match any
+   lookup.  */
+
+#define PKL_ENV_INLINE_DECLS 8
+
+struct pkl_env_table
+{
+  size_t num_decls;
+  size_t size;
+  pkl_ast_node *decls;
+  uint32_t *hashes;
+  size_t index_size;
+  uint32_t *index;
+  pkl_ast_node inline_decls[PKL_ENV_INLINE_DECLS];
+  uint32_t inline_hashes[PKL_ENV_INLINE_DECLS];
+};
 
 struct pkl_env
 {
-  pkl_hash hash_table;
-  pkl_hash units_hash_table;
+  struct pkl_env_table table;
+  struct pkl_env_table units_table;
 
   int num_types;
   int num_vars;
   int num_units;
 
+  int recording_p;
+  size_t num_lookups;
+  size_t lookups_size;
+  struct pkl_env_lookup *lookups;
+
   struct pkl_env *up;
 };
 
-/* The hash tables above are handled using the following
-   functions.  */
-#ifdef __clang__
-__attribute__ ((no_sanitize ("integer")))
-#endif
-static int
+/* The tables above are handled using the following functions.  */
+
+/* Names are hashed using the 32-bit FNV-1a function.  */
+
+static uint32_t
 hash_string (const char *name)
 {
-  size_t len;
-  int hash;
-  int i;
-
-  len = strlen (name);
-  hash = len;
-  for (i = 0; i < len; i++)
-    hash = ((hash * (size_t)613) + (unsigned)(name[i]));
+  uint32_t hash = 2166136261U;
 
-#define HASHBITS 30
-  hash &= (1 << HASHBITS) - 1;
-  hash %= HASH_TABLE_SIZE;
-#undef HASHBITS
+  for (; *name != '\0'; name++)
+    {
+      hash ^= (unsigned char) *name;
+      hash *= 16777619U;
+    }
 
   return hash;
 }
 
 static void
-free_hash_table (pkl_hash hash_table)
+init_table (struct pkl_env_table *table)
+{
+  table->num_decls = 0;
+  table->size = PKL_ENV_INLINE_DECLS;
+  table->decls = table->inline_decls;
+  table->hashes = table->inline_hashes;
+  table->index_size = 0;
+  table->index = NULL;
+}
+
+static void
+free_table (struct pkl_env_table *table)
 {
   size_t i;
-  pkl_ast_node t, n;
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
-    if (hash_table[i])
-      for (t = hash_table[i]; t; t = n)
-        {
-          n = PKL_AST_CHAIN2 (t);
-          pkl_ast_node_free (t);
-        }
+  for (i = 0; i < table->num_decls; ++i)
+    pkl_ast_node_free (table->decls[i]);
+
+  if (table->decls != table->inline_decls)
+    {
+      free (table->decls);
+      free (table->hashes);
+    }
+  free (table->index);
+}
+
+/* Add the declaration at position POS in TABLE to its index.  */
+
+static void
+index_decl (struct pkl_env_table *table, size_t pos)
+{
+  size_t mask = table->index_size - 1;
+  size_t i;
+
+  for (i = table->hashes[pos] & mask;
+       table->index[i] != 0;
+       i = (i + 1) & mask)
+    ;
+  table->index[i] = pos + 1;
+}
+
+/* Rebuild the index of TABLE so it has room for at least NUM_DECLS
+   declarations.  */
+
+static void
+reindex_table (struct pkl_env_table *table, size_t num_decls)
+{
+  size_t index_size = 4 * PKL_ENV_INLINE_DECLS;
+  size_t i;
+
+  while (index_size < 2 * num_decls)
+    index_size *= 2;
+
+  free (table->index);
+  table->index = xcalloc (index_size, sizeof (uint32_t));
+  table->index_size = index_size;
+
+  for (i = 0; i < table->num_decls; ++i)
+    index_decl (table, i);
 }
 
 static pkl_ast_node
-get_registered (pkl_hash hash_table, const char *name)
+get_registered (struct pkl_env_table *table, const char *name)
 {
-  pkl_ast_node t;
-  int hash;
+  uint32_t hash;
+  size_t i;
 
   if (STREQ (name, ""))
     return NULL;
 
   hash = hash_string (name);
-  for (t = hash_table[hash]; t != NULL; t = PKL_AST_CHAIN2 (t))
+
+  if (table->index == NULL)
+    {
+      for (i = 0; i < table->num_decls; ++i)
+        {
+          pkl_ast_node decl = table->decls[i];
+
+          if (table->hashes[i] == hash
+              && STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (decl)),
+                        name))
+            return decl;
+        }
+    }
+  else
     {
-      pkl_ast_node t_name = PKL_AST_DECL_NAME (t);
+      size_t mask = table->index_size - 1;
+
+      for (i = hash & mask; table->index[i] != 0; i = (i + 1) & mask)
+        {
+          size_t pos = table->index[i] - 1;
+          pkl_ast_node decl = table->decls[pos];
 
-      if (STREQ (PKL_AST_IDENTIFIER_POINTER (t_name),
-                 name))
-        return t;
+          if (table->hashes[pos] == hash
+              && STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (decl)),
+                        name))
+            return decl;
+        }
     }
 
   return NULL;
 }
 
+/* Add DECL, with a name hashing to HASH, at the end of TABLE.  */
+
+static void
+append_decl (struct pkl_env_table *table, pkl_ast_node decl,
+             uint32_t hash)
+{
+  if (table->num_decls == table->size)
+    {
+      size_t size = 2 * table->size;
+
+      if (table->decls == table->inline_decls)
+        {
+          table->decls = xmalloc (size * sizeof (pkl_ast_node));
+          table->hashes = xmalloc (size * sizeof (uint32_t));
+          memcpy (table->decls, table->inline_decls,
+                  table->num_decls * sizeof (pkl_ast_node));
+          memcpy (table->hashes, table->inline_hashes,
+                  table->num_decls * sizeof (uint32_t));
+        }
+      else
+        {
+          table->decls = xrealloc (table->decls,
+                                   size * sizeof (pkl_ast_node));
+          table->hashes = xrealloc (table->hashes,
+                                    size * sizeof (uint32_t));
+        }
+
+      table->size = size;
+    }
+
+  table->decls[table->num_decls] = decl;
+  table->hashes[table->num_decls] = hash;
+  table->num_decls++;
+
+  if (table->index != NULL && 2 * table->num_decls <= table->index_size)
+    index_decl (table, table->num_decls - 1);
+  else if (table->num_decls > PKL_ENV_INLINE_DECLS)
+    reindex_table (table, table->num_decls);
+}
+
 static int
 register_decl (int top_level_p,
-               pkl_hash hash_table,
+               struct pkl_env_table *table,
                const char *name,
                pkl_ast_node decl)
 {
-  int hash;
   pkl_ast_node found_decl;
 
-  /* Check if DECL is already registered in the given hash table.
+  /* Check if DECL is already registered in the given table.
 
      If we are in the global environment and the declaration is for a
      variable, funcion, or an unit, then we allow "redefining" by
@@ -137,7 +268,7 @@ register_decl (int top_level_p,
 
      Otherwise we don't register DECL, as it is already defined.  */
 
-  found_decl = get_registered (hash_table, name);
+  found_decl = get_registered (table, name);
   if (found_decl != NULL)
     {
       int decl_kind = PKL_AST_DECL_KIND (decl);
@@ -156,26 +287,23 @@ register_decl (int top_level_p,
         return 0;
     }
 
-  /* Add the declaration to the hash table.  */
-  hash = hash_string (name);
-  PKL_AST_CHAIN2 (decl) = hash_table[hash];
-  hash_table[hash] = ASTREF (decl);
-
+  /* Add the declaration to the table.  */
+  append_decl (table, ASTREF (decl), hash_string (name));
   return 1;
 }
 
-static pkl_hash *
+static struct pkl_env_table *
 get_ns_table (pkl_env env, int namespace)
 {
-  pkl_hash *table = NULL;
+  struct pkl_env_table *table = NULL;
 
   switch (namespace)
     {
     case PKL_ENV_NS_MAIN:
-      table = &env->hash_table;
+      table = &env->table;
       break;
     case PKL_ENV_NS_UNITS:
-      table = &env->units_hash_table;
+      table = &env->units_table;
       break;
     default:
       assert (0);
@@ -189,7 +317,11 @@ get_ns_table (pkl_env env, int namespace)
 pkl_env
 pkl_env_new ()
 {
-  return xzalloc (sizeof (struct pkl_env));
+  pkl_env env = xzalloc (sizeof (struct pkl_env));
+
+  init_table (&env->table);
+  init_table (&env->units_table);
+  return env;
 }
 
 void
@@ -198,8 +330,9 @@ pkl_env_free (pkl_env env)
   if (env)
     {
       pkl_env_free (env->up);
-      free_hash_table (env->hash_table);
-      free_hash_table (env->units_hash_table);
+      free_table (&env->table);
+      free_table (&env->units_table);
+      pkl_env_free_lookups (env->lookups, env->num_lookups);
       free (env);
     }
 }
@@ -232,9 +365,9 @@ pkl_env_register (pkl_env env,
                   const char *name,
                   pkl_ast_node decl)
 {
-  pkl_hash *table = get_ns_table (env, namespace);
+  struct pkl_env_table *table = get_ns_table (env, namespace);
 
-  if (register_decl (env->up == NULL, *table, name, decl))
+  if (register_decl (env->up == NULL, table, name, decl))
     {
       switch (PKL_AST_DECL_KIND (decl))
         {
@@ -257,6 +390,68 @@ pkl_env_register (pkl_env env,
   return 0;
 }
 
+/* Record a lookup of NAME in NAMESPACE that reached the top-level
+   environment ENV, and resolved to DECL.  */
+
+static void
+record_lookup (pkl_env env, int namespace, const char *name,
+               pkl_ast_node decl)
+{
+  struct pkl_env_lookup *lookup;
+  size_t i;
+
+  for (i = 0; i < env->num_lookups; i++)
+    if (env->lookups[i].namespace == namespace
+        && STREQ (env->lookups[i].name, name))
+      return;
+
+  if (env->num_lookups == env->lookups_size)
+    {
+      env->lookups_size = env->lookups_size ? env->lookups_size * 2 : 16;
+      env->lookups = xrealloc (env->lookups,
+                               env->lookups_size * sizeof (*env->lookups));
+    }
+
+  lookup = &env->lookups[env->num_lookups++];
+  lookup->namespace = namespace;
+  lookup->name = xstrdup (name);
+  lookup->decl = decl ? ASTREF (decl) : NULL;
+}
+
+void
+pkl_env_start_recording (pkl_env env)
+{
+  assert (pkl_env_toplevel_p (env));
+  env->recording_p = 1;
+}
+
+size_t
+pkl_env_stop_recording (pkl_env env, struct pkl_env_lookup **lookups)
+{
+  size_t num_lookups = env->num_lookups;
+
+  *lookups = env->lookups;
+  env->recording_p = 0;
+  env->num_lookups = 0;
+  env->lookups_size = 0;
+  env->lookups = NULL;
+  return num_lookups;
+}
+
+void
+pkl_env_free_lookups (struct pkl_env_lookup *lookups, size_t num_lookups)
+{
+  size_t i;
+
+  for (i = 0; i < num_lookups; i++)
+    {
+      free (lookups[i].name);
+      if (lookups[i].decl)
+        pkl_ast_node_free (lookups[i].decl);
+    }
+  free (lookups);
+}
+
 static pkl_ast_node
 pkl_env_lookup_1 (pkl_env env, int namespace, const char *name,
                   int *back, int *over, int num_frame)
@@ -265,8 +460,11 @@ pkl_env_lookup_1 (pkl_env env, int namespace, const char *name,
     return NULL;
   else
     {
-      pkl_hash *table = get_ns_table (env, namespace);
-      pkl_ast_node decl = get_registered (*table, name);
+      struct pkl_env_table *table = get_ns_table (env, namespace);
+      pkl_ast_node decl = get_registered (table, name);
+
+      if (env->recording_p)
+        record_lookup (env, namespace, name, decl);
 
       if (decl)
         {
@@ -298,15 +496,8 @@ pkl_env_toplevel_p (pkl_env env)
 void
 pkl_env_iter_begin (pkl_env env, struct pkl_ast_node_iter *iter)
 {
-  iter->bucket = 0;
-  iter->node = env->hash_table[iter->bucket];
-  while (iter->node == NULL)
-    {
-      iter->bucket++;
-      if (iter->bucket >= HASH_TABLE_SIZE)
-        break;
-      iter->node = env->hash_table[iter->bucket];
-    }
+  iter->pos = 0;
+  iter->node = env->table.num_decls > 0 ? env->table.decls[0] : NULL;
 }
 
 void
@@ -314,20 +505,15 @@ pkl_env_iter_next (pkl_env env, struct pkl_ast_node_iter *iter)
 {
   assert (iter->node != NULL);
 
-  iter->node = PKL_AST_CHAIN2 (iter->node);
-  while (iter->node == NULL)
-    {
-      iter->bucket++;
-      if (iter->bucket >= HASH_TABLE_SIZE)
-        break;
-      iter->node = env->hash_table[iter->bucket];
-    }
+  iter->pos++;
+  iter->node = (iter->pos < env->table.num_decls
+                ? env->table.decls[iter->pos] : NULL);
 }
 
 bool
 pkl_env_iter_end (pkl_env env, const struct pkl_ast_node_iter *iter)
 {
-  return iter->bucket >= HASH_TABLE_SIZE;
+  return iter->pos >= env->table.num_decls;
 }
 
 void
@@ -346,65 +532,229 @@ pkl_env_map_decls (pkl_env env,
     }
 }
 
+/* Make TO, which is empty, a copy of the table FROM.  */
+
+static void
+dup_table (struct pkl_env_table *to, struct pkl_env_table *from)
+{
+  size_t i;
+
+  if (from->decls != from->inline_decls)
+    {
+      to->decls = xmalloc (from->size * sizeof (pkl_ast_node));
+      to->hashes = xmalloc (from->size * sizeof (uint32_t));
+      to->size = from->size;
+    }
+
+  for (i = 0; i < from->num_decls; ++i)
+    to->decls[i] = ASTREF (from->decls[i]);
+  memcpy (to->hashes, from->hashes, from->num_decls * sizeof (uint32_t));
+  to->num_decls = from->num_decls;
+
+  if (from->index != NULL)
+    {
+      to->index = xmalloc (from->index_size * sizeof (uint32_t));
+      memcpy (to->index, from->index, from->index_size * sizeof (uint32_t));
+      to->index_size = from->index_size;
+    }
+}
+
 pkl_env
 pkl_env_dup_toplevel (pkl_env env)
 {
   pkl_env new;
-  int i;
 
   assert (pkl_env_toplevel_p (env));
 
   new = pkl_env_new ();
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
+  dup_table (&new->table, &env->table);
+  dup_table (&new->units_table, &env->units_table);
+
+  new->num_types = env->num_types;
+  new->num_vars = env->num_vars;
+  new->num_units = env->num_units;
+
+  return new;
+}
+
+int
+pkl_env_version (pkl_env env)
+{
+  assert (pkl_env_toplevel_p (env));
+
+  /* Every registration of a variable or function, including
+     redefinitions, gets a new order.  */
+  return env->num_vars;
+}
+
+
+/* An index of names is an array of the names of the declarations
+   in the main namespace of a top-level environment, sorted
+   alphabetically.  Every entry holds a copy of the name and the
+   position of the declaration in the table.
+
+   NUM_DECLS is the number of declarations of the table that have
+   been indexed so far.  The tables of the top-level environments
+   only grow, and the position of a declaration is preserved by
+   `pkl_env_dup_toplevel', so the index can be updated with the
+   declarations registered after the last update.
+
+   A declaration that has been redefined changes its name to "", so
+   its entry is kept until the next update, and skipped.  */
+
+struct pkl_env_name
+{
+  char *name;
+  size_t pos;
+};
+
+struct pkl_env_names
+{
+  size_t num_decls;
+  size_t num_names;
+  struct pkl_env_name *names;
+};
+
+pkl_env_names
+pkl_env_names_new (void)
+{
+  return xzalloc (sizeof (struct pkl_env_names));
+}
+
+void
+pkl_env_names_free (pkl_env_names names)
+{
+  size_t i;
+
+  if (names == NULL)
+    return;
+
+  for (i = 0; i < names->num_names; ++i)
+    free (names->names[i].name);
+  free (names->names);
+  free (names);
+}
+
+/* Return the name of the declaration at position POS in TABLE.  */
+
+static const char *
+table_decl_name (struct pkl_env_table *table, size_t pos)
+{
+  return PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (table->decls[pos]));
+}
+
+static int
+cmp_names (const void *a, const void *b)
+{
+  const struct pkl_env_name *na = a;
+  const struct pkl_env_name *nb = b;
+
+  return strcmp (na->name, nb->name);
+}
+
+/* Merge the declarations registered in the top-level environment ENV
+   since the last update into NAMES.  The new names are sorted and
+   merged with the existing ones, dropping the entries of the
+   declarations that have been redefined.  */
+
+static void
+update_names (pkl_env_names names, pkl_env env)
+{
+  struct pkl_env_table *table = &env->table;
+  struct pkl_env_name *new_names, *merged;
+  size_t num_new = 0, i, j, k;
+
+  assert (pkl_env_toplevel_p (env));
+
+  if (names->num_decls >= table->num_decls)
+    return;
+
+  new_names = xmalloc ((table->num_decls - names->num_decls)
+                       * sizeof (struct pkl_env_name));
+  for (i = names->num_decls; i < table->num_decls; ++i)
     {
-      pkl_ast_node t;
-      pkl_ast_node decl = env->hash_table[i];
+      const char *name = table_decl_name (table, i);
 
-      for (t = decl; t; t = PKL_AST_CHAIN2 (t))
-        t = ASTREF (t);
-      new->hash_table[i] = decl;
+      if (*name != '\0')
+        {
+          new_names[num_new].name = xstrdup (name);
+          new_names[num_new].pos = i;
+          num_new++;
+        }
     }
+  qsort (new_names, num_new, sizeof (struct pkl_env_name), cmp_names);
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
+  merged = xmalloc ((names->num_names + num_new)
+                    * sizeof (struct pkl_env_name));
+  for (i = j = k = 0; i < names->num_names || j < num_new;)
     {
-      pkl_ast_node t;
-      pkl_ast_node decl = env->units_hash_table[i];
+      struct pkl_env_name *next;
 
-      for (t = decl; t; t = PKL_AST_CHAIN2 (t))
-        t = ASTREF (t);
-      new->units_hash_table[i] = decl;
-    }
+      if (j == num_new
+          || (i < names->num_names
+              && strcmp (names->names[i].name, new_names[j].name) <= 0))
+        next = &names->names[i++];
+      else
+        next = &new_names[j++];
 
-  new->num_types = env->num_types;
-  new->num_vars = env->num_vars;
-  new->num_units = env->num_units;
+      if (STREQ (table_decl_name (table, next->pos), next->name))
+        merged[k++] = *next;
+      else
+        free (next->name);
+    }
 
-  return new;
+  free (new_names);
+  free (names->names);
+  names->names = merged;
+  names->num_names = k;
+  names->num_decls = table->num_decls;
 }
 
+size_t
+pkl_env_names_search (pkl_env_names names, pkl_env env,
+                      const char *prefix)
+{
+  size_t lo = 0, hi;
+
+  update_names (names, env);
+
+  /* Find the first name that is not less than PREFIX, which is the
+     first one starting with PREFIX if there is any.  */
+  hi = names->num_names;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (strcmp (names->names[mid].name, prefix) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
 
-/*  Return the name of the next decl that is currently
-    in context of ENV and matches NAME,LEN.  ITER is an iterator
-    into the set of matches.  Returns the name of the next
-    command in the set, or NULL if there are no more.
-    The returned value must be freed by the caller.  */
 char *
-pkl_env_get_next_matching_decl (pkl_env env, struct pkl_ast_node_iter *iter,
-                                const char *name, size_t len)
+pkl_env_names_next (pkl_env_names names, pkl_env env,
+                    size_t *idx, const char *prefix)
 {
-  /* "Normal" commands.  */
-  for (;;)
+  size_t len = strlen (prefix);
+
+  for (; *idx < names->num_names; (*idx)++)
     {
-      if (pkl_env_iter_end (env, iter))
-        break;
+      struct pkl_env_name *entry = &names->names[*idx];
 
-      pkl_ast_node decl_name = PKL_AST_DECL_NAME (iter->node);
-      const char *cmdname = PKL_AST_IDENTIFIER_POINTER (decl_name);
-      if (strncmp (cmdname, name, len) == 0)
-        return strdup (cmdname);
+      if (strncmp (entry->name, prefix, len) != 0)
+        break;
 
-      pkl_env_iter_next (env, iter);
+      if (entry->pos < env->table.num_decls
+          && STREQ (table_decl_name (&env->table, entry->pos), entry->name))
+        {
+          (*idx)++;
+          return xstrdup (entry->name);
+        }
     }
+
   return NULL;
 }
@@ -96,6 +96,16 @@ int pkl_env_toplevel_p (pkl_env env);
 
 pkl_env pkl_env_dup_toplevel (pkl_env env);
 
+/* Return the version of the variables and functions registered in
+   the top-level environment ENV.  The version increases every time a
+   variable or function is registered, either a new one or a
+   redefinition of an existing one, and it is preserved by
+   `pkl_env_dup_toplevel'.  Therefore the lexical address of a
+   top-level declaration can be cached, as long as the version of the
+   environment doesn't change.  */
+
+int pkl_env_version (pkl_env env);
+
 /* Declarations in Poke live in two different, separated name spaces:
 
    The `main' namespace, shared by types, variables and functions.
@@ -118,11 +128,44 @@ pkl_ast_node pkl_env_lookup (pkl_env env, int namespace,
                              const char *name,
                              int *back, int *over);
 
+/* The compiler can record the lookups that reach the top-level frame
+   of an environment.  This is used in order to determine whether some
+   compiled code is still valid after the top-level environment
+   changes: it is, provided all the names it looked up still resolve
+   to the same declarations.
+
+   `pkl_env_start_recording' starts recording the lookups reaching
+   the top-level environment ENV.
+
+   `pkl_env_stop_recording' stops recording, and returns the recorded
+   lookups in LOOKUPS, which is a malloc'ed array.  Its number of
+   elements is returned.  Each name is recorded once.  DECL is NULL
+   for lookups that failed.  References are hold to the declaration
+   nodes, which should be released with `pkl_env_free_lookups'.  */
+
+struct pkl_env_lookup
+{
+  int namespace;
+  char *name;
+  pkl_ast_node decl;
+};
+
+void pkl_env_start_recording (pkl_env env);
+
+size_t pkl_env_stop_recording (pkl_env env,
+                               struct pkl_env_lookup **lookups);
+
+void pkl_env_free_lookups (struct pkl_env_lookup *lookups,
+                           size_t num_lookups);
+
 /* The following iterators work on the main namespace.  */
 
+/* The declarations are visited in the order in which they were
+   registered.  */
+
 struct pkl_ast_node_iter
 {
-  int bucket;        /* The bucket in which this node resides.  */
+  size_t pos;        /* The position of this node in its frame.  */
   pkl_ast_node node; /* A pointer to the node itself.  */
 };
 
@@ -133,9 +176,34 @@ void pkl_env_iter_next (pkl_env env, struct pkl_ast_node_iter *iter);
 
 bool pkl_env_iter_end (pkl_env env, const struct pkl_ast_node_iter *iter);
 
-char *pkl_env_get_next_matching_decl (pkl_env env,
-                                      struct pkl_ast_node_iter *iter,
-                                      const char *name, size_t len);
+/* Completion of the names of the declarations in the main namespace
+   of a top-level environment uses an index of names, which is sorted
+   alphabetically.  The index is updated incrementally with the
+   declarations registered since the last time it was used, so it is
+   meant to be used with the successive top-level environments of
+   some compiler.  */
+
+typedef struct pkl_env_names *pkl_env_names;
+
+pkl_env_names pkl_env_names_new (void);
+
+void pkl_env_names_free (pkl_env_names names);
+
+/* Bring NAMES up to date with the top-level environment ENV, and
+   return the position in the index of the first name that starts
+   with PREFIX, if any.  */
+
+size_t pkl_env_names_search (pkl_env_names names, pkl_env env,
+                             const char *prefix);
+
+/* Return a copy of the name at position *IDX of NAMES, if it starts
+   with PREFIX, and advance *IDX to the next name.  Names of
+   declarations that have been redefined are skipped.  Return NULL if
+   there are no more names starting with PREFIX.  The returned value
+   must be freed by the caller.  */
+
+char *pkl_env_names_next (pkl_env_names names, pkl_env env,
+                          size_t *idx, const char *prefix);
 
 /* Map over the declarations defined in the top-level compile-time
    environment, executing a handler.  */
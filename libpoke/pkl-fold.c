@@ -1225,12 +1225,176 @@ PKL_PHASE_BEGIN_HANDLER (pkl_fold_ps_indexer)
 }
 PKL_PHASE_END_HANDLER
 
+/* Return a copy of the literal value LITERAL, of type TYPE, or NULL
+   if LITERAL is not an integer, string or offset literal.  The copy
+   is built with new nodes, since other folding handlers may modify
+   the nodes in place.  */
+
+static pkl_ast_node
+pkl_fold_copy_literal (pkl_ast ast, pkl_ast_node literal,
+                       pkl_ast_node type)
+{
+  pkl_ast_node new;
+
+  switch (PKL_AST_CODE (literal))
+    {
+    case PKL_AST_INTEGER:
+      new = pkl_ast_make_integer (ast, PKL_AST_INTEGER_VALUE (literal));
+      break;
+    case PKL_AST_STRING:
+      new = pkl_ast_make_string (ast, PKL_AST_STRING_POINTER (literal));
+      break;
+    case PKL_AST_OFFSET:
+      {
+        pkl_ast_node magnitude = PKL_AST_OFFSET_MAGNITUDE (literal);
+        pkl_ast_node unit = PKL_AST_OFFSET_UNIT (literal);
+        pkl_ast_node new_magnitude, new_unit;
+
+        if (PKL_AST_CODE (magnitude) != PKL_AST_INTEGER
+            || PKL_AST_CODE (unit) != PKL_AST_INTEGER)
+          return NULL;
+
+        new_magnitude
+          = pkl_ast_make_integer (ast, PKL_AST_INTEGER_VALUE (magnitude));
+        PKL_AST_TYPE (new_magnitude) = ASTREF (PKL_AST_TYPE (magnitude));
+        PKL_AST_LOC (new_magnitude) = PKL_AST_LOC (magnitude);
+
+        new_unit = pkl_ast_make_integer (ast, PKL_AST_INTEGER_VALUE (unit));
+        PKL_AST_TYPE (new_unit) = ASTREF (PKL_AST_TYPE (unit));
+        PKL_AST_LOC (new_unit) = PKL_AST_LOC (unit);
+
+        new = pkl_ast_make_offset (ast, new_magnitude, new_unit);
+        break;
+      }
+    default:
+      return NULL;
+    }
+
+  PKL_AST_TYPE (new) = ASTREF (type);
+  return new;
+}
+
+/* References to local variables that are never assigned, and whose
+   initial value is a literal, can be replaced by the literal.  The
+   new literal may then be folded with the surrounding expressions.
+
+   Top-level variables are not propagated, because they can be
+   assigned by code compiled later, like in subsequent commands in
+   the REPL.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_fold_ps_var)
+{
+  pkl_ast_node var = PKL_PASS_NODE;
+  pkl_ast_node decl = PKL_AST_VAR_DECL (var);
+  pkl_ast_node new;
+
+  if (PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_VAR
+      || !PKL_AST_DECL_LOCAL_P (decl)
+      || PKL_AST_DECL_ASSIGNED_P (decl)
+      || PKL_AST_DECL_STRUCT_FIELD_P (decl)
+      || PKL_AST_DECL_INITIAL (decl) == NULL)
+    PKL_PASS_DONE;
+
+  new = pkl_fold_copy_literal (PKL_PASS_AST, PKL_AST_DECL_INITIAL (decl),
+                               PKL_AST_TYPE (var));
+  if (new == NULL)
+    PKL_PASS_DONE;
+
+  PKL_AST_LOC (new) = PKL_AST_LOC (var);
+  pkl_ast_node_free (var);
+  PKL_PASS_NODE = new;
+}
+PKL_PHASE_END_HANDLER
+
+/* Attributes whose value only depends on the type of the operand,
+   or on the value of a literal operand, are folded into the value of
+   the attribute.  The operand is required to be either a literal or
+   a variable, which can be evaluated without side effects.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_fold_attr)
+{
+  pkl_ast_node exp = PKL_PASS_NODE;
+  pkl_ast_node type = PKL_AST_TYPE (exp);
+  pkl_ast_node operand = PKL_AST_EXP_OPERAND (exp, 0);
+  pkl_ast_node operand_type = PKL_AST_TYPE (operand);
+  int operand_code = PKL_AST_CODE (operand);
+  int operand_type_code = PKL_AST_TYPE_CODE (operand_type);
+  pkl_ast_node new;
+  uint64_t value;
+
+  if (operand_code == PKL_AST_OFFSET
+      && (PKL_AST_CODE (PKL_AST_OFFSET_MAGNITUDE (operand)) != PKL_AST_INTEGER
+          || PKL_AST_CODE (PKL_AST_OFFSET_UNIT (operand)) != PKL_AST_INTEGER))
+    PKL_PASS_DONE;
+
+  switch (PKL_AST_EXP_ATTR (exp))
+    {
+    case PKL_AST_ATTR_SIZE:
+      if (operand_code == PKL_AST_STRING)
+        value = (strlen (PKL_AST_STRING_POINTER (operand)) + 1) * 8;
+      else if ((operand_code == PKL_AST_INTEGER || operand_code == PKL_AST_VAR)
+               && operand_type_code == PKL_TYPE_INTEGRAL)
+        value = PKL_AST_TYPE_I_SIZE (operand_type);
+      else if ((operand_code == PKL_AST_OFFSET || operand_code == PKL_AST_VAR)
+               && operand_type_code == PKL_TYPE_OFFSET)
+        value = PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_O_BASE_TYPE (operand_type));
+      else
+        PKL_PASS_DONE;
+
+      /* 'size is an offset in bits.  */
+      {
+        pkl_ast_node magnitude
+          = pkl_ast_make_integer (PKL_PASS_AST, value);
+
+        PKL_AST_TYPE (magnitude) = ASTREF (PKL_AST_TYPE_O_BASE_TYPE (type));
+        PKL_AST_LOC (magnitude) = PKL_AST_LOC (exp);
+
+        new = pkl_ast_make_offset (PKL_PASS_AST, magnitude,
+                                   PKL_AST_TYPE_O_UNIT (type));
+      }
+      break;
+    case PKL_AST_ATTR_SIGNED:
+      if (operand_code != PKL_AST_INTEGER && operand_code != PKL_AST_VAR)
+        PKL_PASS_DONE;
+      new = pkl_ast_make_integer (PKL_PASS_AST,
+                                  PKL_AST_TYPE_I_SIGNED_P (operand_type));
+      break;
+    case PKL_AST_ATTR_MAGNITUDE:
+      if (operand_code != PKL_AST_OFFSET)
+        PKL_PASS_DONE;
+      new = pkl_ast_make_integer (PKL_PASS_AST,
+                                  PKL_AST_INTEGER_VALUE (PKL_AST_OFFSET_MAGNITUDE (operand)));
+      break;
+    case PKL_AST_ATTR_UNIT:
+      if (operand_code != PKL_AST_OFFSET)
+        PKL_PASS_DONE;
+      new = pkl_ast_make_integer (PKL_PASS_AST,
+                                  PKL_AST_INTEGER_VALUE (PKL_AST_OFFSET_UNIT (operand)));
+      break;
+    case PKL_AST_ATTR_LENGTH:
+      if (operand_code != PKL_AST_STRING)
+        PKL_PASS_DONE;
+      new = pkl_ast_make_integer (PKL_PASS_AST,
+                                  strlen (PKL_AST_STRING_POINTER (operand)));
+      break;
+    default:
+      PKL_PASS_DONE;
+    }
+
+  PKL_AST_TYPE (new) = ASTREF (type);
+  PKL_AST_LOC (new) = PKL_AST_LOC (exp);
+  pkl_ast_node_free (exp);
+  PKL_PASS_NODE = new;
+}
+PKL_PHASE_END_HANDLER
+
 struct pkl_phase pkl_phase_fold =
   {
    PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_fold_ps_src),
    PKL_PHASE_PS_HANDLER (PKL_AST_CAST, pkl_fold_ps_cast),
    PKL_PHASE_PS_HANDLER (PKL_AST_INDEXER, pkl_fold_ps_indexer),
    PKL_PHASE_PS_HANDLER (PKL_AST_COND_EXP, pkl_fold_ps_cond_exp),
+   PKL_PHASE_PS_HANDLER (PKL_AST_VAR, pkl_fold_ps_var),
 #define ENTRY(ops, fs)\
    PKL_PHASE_PS_OP_HANDLER (PKL_AST_OP_##ops, pkl_fold_##fs)
 
@@ -1245,5 +1409,6 @@ struct pkl_phase pkl_phase_fold =
    ENTRY (BCONC, bconc),
    ENTRY (POS, pos), ENTRY (NEG, neg), ENTRY (BNOT, bnot),
    ENTRY (NOT, not), ENTRY (POW, pow),
+   ENTRY (ATTR, attr),
 #undef ENTRY
   };
@@ -27,6 +27,8 @@
 #include "pkl-pass.h"
 #include "pkl-asm.h"
 #include "pvm.h"
+#include "pvm-val.h" /* For pvm_allocate_struct_attrs.  */
+#include "ios-hash.h"
 
 /* The following macros are used in the rules below, to reduce
    verbosity.  */
@@ -107,14 +109,177 @@
   while (0)
 
 
+/* Name PROGRAM, which implements a function, for the function
+   profiler.  NODE is the declaration, type or function defining the
+   function, and provides both its name and its location.  KIND is
+   the kind of function generated for a type, like "struct_mapper", or
+   NULL for Poke functions.  */
+
+static void
+pkl_gen_name_program (pkl_gen_payload payload, pkl_ast ast,
+                      pvm_program program, const char *kind,
+                      pkl_ast_node node)
+{
+  const char *filename = payload->filename ? payload->filename : ast->filename;
+  const char *name = NULL;
+  char name_buf[128], location_buf[256];
+
+  if (PKL_AST_CODE (node) == PKL_AST_DECL)
+    name = PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (node));
+  else if (PKL_AST_CODE (node) == PKL_AST_TYPE && PKL_AST_TYPE_NAME (node))
+    name = PKL_AST_IDENTIFIER_POINTER (PKL_AST_TYPE_NAME (node));
+
+  if (name && kind)
+    snprintf (name_buf, sizeof (name_buf), "%s:%s", name, kind);
+  else
+    snprintf (name_buf, sizeof (name_buf), "%s",
+              name ? name : kind ? kind : "lambda");
+
+  if (PKL_AST_LOC_VALID (PKL_AST_LOC (node)))
+    {
+      snprintf (location_buf, sizeof (location_buf), "%s:%d",
+                filename ? filename : "<stdin>",
+                PKL_AST_LOC (node).first_line);
+      pvm_program_set_name (program, name_buf, location_buf);
+    }
+  else
+    pvm_program_set_name (program, name_buf, NULL);
+}
+
+static pvm_val pkl_gen_static_type (pkl_ast_node type);
+
+/* Return 1 if the expression EXP is known not to refer to a variable
+   called NAME, 0 otherwise.  NAME can be NULL.
+
+   Function calls are not considered, since they could map and raise
+   E_eof or E_constraint.  */
+
+static int
+pkl_gen_exp_independent_p (pkl_ast_node exp, const char *name)
+{
+  int i;
+
+  switch (PKL_AST_CODE (exp))
+    {
+    case PKL_AST_INTEGER:
+    case PKL_AST_STRING:
+      return 1;
+    case PKL_AST_VAR:
+      return (name == NULL
+              || !STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_VAR_NAME (exp)),
+                         name));
+    case PKL_AST_EXP:
+      for (i = 0; i < PKL_AST_EXP_NUMOPS (exp); ++i)
+        if (!pkl_gen_exp_independent_p (PKL_AST_EXP_OPERAND (exp, i), name))
+          return 0;
+      return 1;
+    case PKL_AST_COND_EXP:
+      return (pkl_gen_exp_independent_p (PKL_AST_COND_EXP_COND (exp), name)
+              && pkl_gen_exp_independent_p (PKL_AST_COND_EXP_THENEXP (exp), name)
+              && pkl_gen_exp_independent_p (PKL_AST_COND_EXP_ELSEEXP (exp), name));
+    case PKL_AST_CAST:
+      return pkl_gen_exp_independent_p (PKL_AST_CAST_EXP (exp), name);
+    case PKL_AST_ISA:
+      return pkl_gen_exp_independent_p (PKL_AST_ISA_EXP (exp), name);
+    case PKL_AST_OFFSET:
+      return (PKL_AST_CODE (PKL_AST_OFFSET_UNIT (exp)) == PKL_AST_INTEGER
+              && pkl_gen_exp_independent_p (PKL_AST_OFFSET_MAGNITUDE (exp),
+                                            name));
+    case PKL_AST_STRUCT_REF:
+      return pkl_gen_exp_independent_p (PKL_AST_STRUCT_REF_STRUCT (exp), name);
+    case PKL_AST_INDEXER:
+      return (pkl_gen_exp_independent_p (PKL_AST_INDEXER_ENTITY (exp), name)
+              && pkl_gen_exp_independent_p (PKL_AST_INDEXER_INDEX (exp), name));
+    default:
+      return 0;
+    }
+}
+
+/* Return 1 if FIELD is an alternative of the union type TYPE_STRUCT
+   whose constraint doesn't depend on the value of the alternative,
+   like in tagged unions where the constraints check a tag mapped
+   before the union.  Such constraints are evaluated before mapping
+   the alternative, which is then skipped altogether if the
+   constraint is not satisfied.  See struct_mapper.  */
+
+static int
+pkl_gen_union_precheck_p (pkl_ast_node type_struct, pkl_ast_node field)
+{
+  pkl_ast_node constraint, name;
+
+  if (!PKL_AST_TYPE_S_UNION_P (type_struct)
+      || PKL_AST_CODE (field) != PKL_AST_STRUCT_TYPE_FIELD
+      || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND (field))
+    return 0;
+
+  constraint = PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (field);
+  name = PKL_AST_STRUCT_TYPE_FIELD_NAME (field);
+  return (constraint
+          && pkl_gen_exp_independent_p (constraint,
+                                        name
+                                        ? PKL_AST_IDENTIFIER_POINTER (name)
+                                        : NULL));
+}
+
 /* Code generated by RAS is used in the handlers below.  Configure it
    to use the main assembler in the GEN payload.  Then just include
    the assembled macros in this file.  */
 #define RAS_ASM PKL_GEN_ASM
 #define RAS_PUSH_ASM PKL_GEN_PUSH_ASM
 #define RAS_POP_ASM PKL_GEN_POP_ASM
+#define RAS_PROGRAM_NAME(PROGRAM,NAME)                          \
+  pkl_gen_name_program (PKL_GEN_PAYLOAD, PKL_PASS_AST,          \
+                        (PROGRAM), (NAME), PKL_PASS_NODE)
 #include "pkl-gen.pkc"
 
+/* Return 1 if the struct type TYPE_STRUCT can be mapped by
+   struct_pod_mapper, i.e. if it is a plain sequence of integral and
+   offset fields of whole bytes with the same endianness, with no
+   constraints, labels, optional conditions, initializers,
+   declarations nor methods.  Return 0 otherwise.  */
+
+static int
+pkl_gen_pod_struct_p (pkl_ast_node type_struct)
+{
+  pkl_ast_node elem, first = PKL_AST_TYPE_S_ELEMS (type_struct);
+
+  if (PKL_AST_TYPE_S_UNION_P (type_struct)
+      || PKL_AST_TYPE_S_PINNED_P (type_struct)
+      || PKL_AST_TYPE_S_ITYPE (type_struct)
+      || PKL_AST_TYPE_S_NFIELD (type_struct) == 0
+      || PKL_AST_TYPE_S_NFIELD (type_struct)
+         != PKL_AST_TYPE_S_NELEM (type_struct))
+    return 0;
+
+  for (elem = first; elem; elem = PKL_AST_CHAIN (elem))
+    {
+      pkl_ast_node type;
+
+      if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD
+          || PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (elem)
+          || PKL_AST_STRUCT_TYPE_FIELD_LABEL (elem)
+          || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND (elem)
+          || PKL_AST_STRUCT_TYPE_FIELD_INITIALIZER (elem)
+          || (PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (elem)
+              != PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (first)))
+        return 0;
+
+      type = PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem);
+      if (PKL_AST_TYPE_CODE (type) == PKL_TYPE_OFFSET)
+        {
+          if (PKL_AST_CODE (PKL_AST_TYPE_O_UNIT (type)) != PKL_AST_INTEGER)
+            return 0;
+          type = PKL_AST_TYPE_O_BASE_TYPE (type);
+        }
+
+      if (PKL_AST_TYPE_CODE (type) != PKL_TYPE_INTEGRAL
+          || PKL_AST_TYPE_I_SIZE (type) % 8 != 0)
+        return 0;
+    }
+
+  return 1;
+}
+
 /*
  * SRC
  */
@@ -123,6 +288,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_src)
 {
   PKL_GEN_PAYLOAD->in_file_p
     = (PKL_AST_SRC_FILENAME (PKL_PASS_NODE) != NULL);
+  PKL_GEN_PAYLOAD->filename = PKL_AST_SRC_FILENAME (PKL_PASS_NODE);
 }
 PKL_PHASE_END_HANDLER
 
@@ -225,7 +391,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
                 PKL_GEN_DUP_CONTEXT;
                 PKL_GEN_SET_CONTEXT (PKL_GEN_CTX_IN_MAPPER);
 
-                RAS_FUNCTION_STRUCT_MAPPER (mapper_closure, type_struct);
+                if (pkl_gen_pod_struct_p (type_struct))
+                  RAS_FUNCTION_STRUCT_POD_MAPPER (mapper_closure, type_struct);
+                else
+                  RAS_FUNCTION_STRUCT_MAPPER (mapper_closure, type_struct);
                 pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, mapper_closure); /* CLS */
                 pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEC);                  /* CLS */
                 pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);                 /* _ */
@@ -387,6 +556,8 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
             program = pkl_asm_finish (PKL_GEN_ASM,
                                       0 /* epilogue */);
             PKL_GEN_POP_ASM;
+            pkl_gen_name_program (PKL_GEN_PAYLOAD, PKL_PASS_AST, program,
+                                  NULL /* kind */, PKL_PASS_NODE);
             pvm_program_make_executable (program);
 
             /* XXX */
@@ -479,7 +650,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_var)
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR,
                         var_function_back, 0);              /* SCT */
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
-                        pvm_make_string (PKL_AST_IDENTIFIER_POINTER (var_name)));
+                        pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (var_name)));
                                                             /* SCT STR */
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);        /* SCT STR VAL */
 
@@ -492,9 +663,19 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_var)
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
         }
       else
-        /* Normal variable.  */
-        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR,
-                      PKL_AST_VAR_BACK (var), PKL_AST_VAR_OVER (var));
+        {
+          /* Normal variable.  */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR,
+                        PKL_AST_VAR_BACK (var), PKL_AST_VAR_OVER (var));
+
+          /* Box the offset if it is stored unboxed.  */
+          if (PKL_AST_DECL_UNBOXED_OFFSET_P (var_decl))
+            {
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                            pvm_make_ulong (1, 64));
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MKO);
+            }
+        }
 
       /* If the declaration associated with the variable is in a
          struct and we are not in a method, i.e. we are in a context
@@ -556,6 +737,8 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_lambda)
   pvm_val closure;
 
   PKL_GEN_POP_ASM;
+  pkl_gen_name_program (PKL_GEN_PAYLOAD, PKL_PASS_AST, program,
+                        NULL /* kind */, PKL_PASS_NODE);
   pvm_program_make_executable (program);
   closure = pvm_make_cls (program);
 
@@ -585,6 +768,33 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_comp_stmt)
 {
   pkl_ast_node comp_stmt = PKL_PASS_NODE;
 
+  /* If this is the body of a memoized method, return the result
+     cached in the implicit struct, if any.  */
+  if (PKL_PASS_PARENT
+      && PKL_AST_CODE (PKL_PASS_PARENT) == PKL_AST_FUNC
+      && PKL_AST_FUNC_MEMO_P (PKL_PASS_PARENT)
+      && PKL_AST_FUNC_BODY (PKL_PASS_PARENT) == comp_stmt)
+    {
+      pkl_ast_node function = PKL_PASS_PARENT;
+      pvm_program_label label = pkl_asm_fresh_label (PKL_GEN_ASM);
+
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);  /* SCT */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                    pvm_make_string_atom (PKL_AST_FUNC_NAME (function)));
+      if (PKL_AST_FUNC_ARGS (function))
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+      else
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
+                                                /* SCT STR KEY */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SMEMO); /* SCT STR KEY VAL */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);   /* SCT STR VAL */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);  /* VAL */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BN, label);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+      pkl_asm_label (PKL_GEN_ASM, label);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);  /* _ */
+    }
+
   if (PKL_AST_COMP_STMT_BUILTIN (comp_stmt) == PKL_AST_BUILTIN_NONE)
     {
       /* If the compound statement is empty, do not generate
@@ -658,6 +868,32 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_comp_stmt)
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
           break;
+        case PKL_AST_BUILTIN_IODIRTY:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IODIRTY);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOCOMMIT:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOCOMMIT);
+          break;
+        case PKL_AST_BUILTIN_IODISCARD:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IODISCARD);
+          break;
+        case PKL_AST_BUILTIN_IOPREFETCH:
+          /* The offsets are passed to the instruction as bit
+             magnitudes.  */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOPREFETCH);
+          break;
         case PKL_AST_BUILTIN_FORGET:
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
@@ -665,6 +901,244 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_comp_stmt)
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_FLUSH);
           break;
+        case PKL_AST_BUILTIN_IOCOPY:
+          {
+            int i;
+
+            /* The offsets are passed to the instruction as bit
+               magnitudes.  */
+            for (i = 0; i < 5; i++)
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+                if (i % 2 == 1 || i == 4)
+                  {
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                  }
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOCOPY);
+            break;
+          }
+        case PKL_AST_BUILTIN_IODUMP:
+          {
+            int i;
+
+            for (i = 0; i < 7; i++)
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+                if (i >= 1 && i <= 3)
+                  {
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                  }
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IODUMP);
+            break;
+          }
+        case PKL_AST_BUILTIN_IOSEARCH:
+          {
+            int i;
+
+            for (i = 0; i < 6; i++)
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+                if (i >= 3)
+                  {
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                  }
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOSEARCH);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, pvm_make_ulong (1, 64));
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MKO);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+            break;
+          }
+        case PKL_AST_BUILTIN_IOSCRABBLE:
+          {
+            int i;
+
+            for (i = 0; i < 8; i++)
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+                if (i == 1 || (i >= 3 && i <= 5))
+                  {
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                  }
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOSCRABBLE);
+            break;
+          }
+        case PKL_AST_BUILTIN_BYTESWAP:
+          {
+            int i;
+
+            for (i = 0; i < 4; i++)
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+                if (i >= 1)
+                  {
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+                  }
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOBSWAP);
+            break;
+          }
+        case PKL_AST_BUILTIN_IOCRC32:
+        case PKL_AST_BUILTIN_IOADLER32:
+        case PKL_AST_BUILTIN_IOXXH64:
+        case PKL_AST_BUILTIN_IOSHA256:
+          {
+            int algo;
+
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+
+            /* The initial value, or seed, of the hash.  SHA-256
+               doesn't have one.  */
+            if (comp_stmt_builtin == PKL_AST_BUILTIN_IOSHA256)
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                            pvm_make_ulong (0, 64));
+            else
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+
+            switch (comp_stmt_builtin)
+              {
+              case PKL_AST_BUILTIN_IOCRC32: algo = IOS_HASH_CRC32; break;
+              case PKL_AST_BUILTIN_IOADLER32: algo = IOS_HASH_ADLER32; break;
+              case PKL_AST_BUILTIN_IOXXH64: algo = IOS_HASH_XXH64; break;
+              default: algo = IOS_HASH_SHA256; break;
+              }
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOHASH, algo);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+            break;
+          }
+        case PKL_AST_BUILTIN_IOULEB128:
+        case PKL_AST_BUILTIN_IOSLEB128:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOLEB128,
+                        comp_stmt_builtin == PKL_AST_BUILTIN_IOSLEB128);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOGETU128:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOGETU128);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOSETU128:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOSETU128);
+          break;
+        case PKL_AST_BUILTIN_U128OP:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_U128OP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_U128TOS:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_U128TOS);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_ASORT:
+          {
+            int i;
+
+            for (i = 0; i < 4; i++)
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ASORT);
+
+            /* Mapped arrays are sorted in IO as well.  */
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_WRITE);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+            break;
+          }
+        case PKL_AST_BUILTIN_PMAP:
+          {
+            int i;
+
+            for (i = 0; i < 3; i++)
+              pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, i);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PMAP);
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+            break;
+          }
+        case PKL_AST_BUILTIN_CATOS:
+        case PKL_AST_BUILTIN_LTOS:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM,
+                        (comp_stmt_builtin == PKL_AST_BUILTIN_CATOS
+                         ? PKL_INSN_CATOS : PKL_INSN_LTOS));
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_ATOI:
+        case PKL_AST_BUILTIN_STRCHR:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM,
+                        (comp_stmt_builtin == PKL_AST_BUILTIN_ATOI
+                         ? PKL_INSN_STOL : PKL_INSN_SCHR));
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_LTRIM:
+        case PKL_AST_BUILTIN_RTRIM:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_STRIM,
+                        comp_stmt_builtin == PKL_AST_BUILTIN_RTRIM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_STOCA:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_STOCA);
+
+          /* Mapped arrays are updated in IO as well.  */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_WRITE);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+          break;
+        case PKL_AST_BUILTIN_REVERSE:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AREV);
+
+          /* Mapped arrays are reversed in IO as well.  */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_WRITE);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+          break;
+        case PKL_AST_BUILTIN_DREMOVE:
+          /* The arguments are of type any.  DDEL raises E_conv if the
+             first argument is not a dict.  */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DDEL);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
         case PKL_AST_BUILTIN_GET_TIME:
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_TIME);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
@@ -883,7 +1357,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_ass_stmt)
      mapped, and the assigned value is a complex value, then we have
      to reflect the effect of the assignment in the corresponding IO
      space.  */
-  if ((PKL_AST_CODE (lvalue) == PKL_AST_INDEXER
+  if (((PKL_AST_CODE (lvalue) == PKL_AST_INDEXER
+        && (PKL_AST_TYPE_CODE (PKL_AST_TYPE (PKL_AST_INDEXER_ENTITY (lvalue)))
+            != PKL_TYPE_DICT))
        || PKL_AST_CODE (lvalue) == PKL_AST_STRUCT_REF)
       && (PKL_AST_TYPE_CODE (lvalue_type) == PKL_TYPE_ARRAY
           || PKL_AST_TYPE_CODE (lvalue_type) == PKL_TYPE_STRUCT))
@@ -946,7 +1422,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_ass_stmt)
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR,
                           var_function_back, 0);              /* VAL SCT */
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
-                          pvm_make_string (PKL_AST_IDENTIFIER_POINTER (var_name)));
+                          pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (var_name)));
                                                               /* VAL SCT STR */
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ROT);         /* SCT STR VAL */
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SSET);        /* SCT */
@@ -954,9 +1430,19 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_ass_stmt)
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
           }
         else
-          /* Normal variable.  */
-          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_POPVAR,
-                        PKL_AST_VAR_BACK (lvalue), PKL_AST_VAR_OVER (lvalue));
+          {
+            /* Normal variable.  If the variable holds an unboxed
+               offset, store just the magnitude.  Note that the
+               r-value has been promoted to offset<uint<64>,1>.  */
+            if (PKL_AST_DECL_UNBOXED_OFFSET_P (var_decl))
+              {
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+                pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+              }
+
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_POPVAR,
+                          PKL_AST_VAR_BACK (lvalue), PKL_AST_VAR_OVER (lvalue));
+          }
         break;
       }
     case PKL_AST_INDEXER:
@@ -965,7 +1451,18 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_ass_stmt)
 
         pkl_ast_node array = PKL_AST_INDEXER_ENTITY (lvalue);
         pkl_ast_node array_type = PKL_AST_TYPE (array);
-        pkl_ast_node etype = PKL_AST_TYPE_A_ETYPE (array_type);
+        pkl_ast_node etype;
+
+        /* Dicts are never mapped.  Stack: VAL DICT KEY */
+        if (PKL_AST_TYPE_CODE (array_type) == PKL_TYPE_DICT)
+          {
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ROT);  /* DICT KEY VAL */
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DSET); /* DICT */
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP); /* _ */
+            break;
+          }
+
+        etype = PKL_AST_TYPE_A_ETYPE (array_type);
 
         /* If the type of the array is ANY[], then check at runtime
            that the type of the value matches the type of the elements
@@ -1218,7 +1715,8 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_loop_stmt)
 
         pkl_asm_for_in (PKL_GEN_ASM,
                         PKL_AST_TYPE_CODE (container_type),
-                        condition);
+                        condition,
+                        !PKL_AST_LOOP_STMT_NO_BOUNDS_CHECK_P (loop_stmt));
         {
           PKL_PASS_SUBPASS (container);
         }
@@ -1277,6 +1775,23 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_return_stmt)
       == PKL_TYPE_VOID)
     pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
 
+  /* In a memoized method, cache the returned value in the implicit
+     struct.  */
+  if (PKL_AST_FUNC_MEMO_P (function))
+    {
+      int back = PKL_AST_RETURN_STMT_FUNCTION_BACK (return_stmt);
+
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, back, 0); /* VAL SCT */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                    pvm_make_string_atom (PKL_AST_FUNC_NAME (function)));
+      if (PKL_AST_FUNC_ARGS (function))
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, back, 1);
+      else
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
+                                                /* VAL SCT STR KEY */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SMEMOS); /* VAL */
+    }
+
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
 }
 PKL_PHASE_END_HANDLER
@@ -1534,6 +2049,37 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_funcall_arg)
 PKL_PHASE_END_HANDLER
 
 
+/* Reverse the NARGS actual arguments of a function at the top of the
+   stack, so the first argument is at the top.
+
+   Note that in methods the implicit struct argument is passed as the
+   last actual.  However, we have to process it as the _first_
+   formal.  We achieve this by not reversing it, saving it in the
+   return stack temporarily.  */
+
+static void
+pkl_gen_reverse_args (pkl_asm pasm, int nargs, int method_p)
+{
+  if (nargs <= 1)
+    return;
+
+  if (method_p)
+    pkl_asm_insn (pasm, PKL_INSN_TOR);
+
+  if (nargs == 2)
+    pkl_asm_insn (pasm, PKL_INSN_SWAP);
+  else if (nargs == 3)
+    {
+      pkl_asm_insn (pasm, PKL_INSN_SWAP);
+      pkl_asm_insn (pasm, PKL_INSN_ROT);
+    }
+  else
+    pkl_asm_insn (pasm, PKL_INSN_REVN, nargs);
+
+  if (method_p)
+    pkl_asm_insn (pasm, PKL_INSN_FROMR);
+}
+
 /* FUNCALL
  * | [ARG]
  * | ...
@@ -1547,7 +2093,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_funcall)
   pkl_ast_node function_type = PKL_AST_TYPE (function);
   int vararg = PKL_AST_TYPE_F_VARARG (function_type);
   int i, aindex = 0, vararg_actual = 0, optionals_specified = 0;
-  pkl_ast_node aa;
+  pkl_ast_node aa, inline_func;
 
   /* Push the actuals to the stack. */
   for (aa = PKL_AST_FUNCALL_ARGS (funcall); aa; aa = PKL_AST_CHAIN (aa))
@@ -1618,7 +2164,52 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_funcall)
   PKL_GEN_SET_CONTEXT (PKL_GEN_CTX_IN_FUNCALL);
   PKL_PASS_SUBPASS (PKL_AST_FUNCALL_FUNCTION (funcall));
   PKL_GEN_POP_CONTEXT;
-  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);
+
+  inline_func = PKL_AST_FUNCALL_INLINE (funcall);
+  if (inline_func && PKL_AST_FUNC_PROGRAM (inline_func))
+    {
+      /* The body of the called function is a single return
+         statement, whose expression is evaluated here, in an
+         environment built like the prologue of the function does.
+         But only if the closure actually runs the code compiled for
+         the function: otherwise, the function variable has been
+         assigned another closure, which is called as usual.  See
+         trans4.  */
+      pkl_ast_node body = PKL_AST_FUNC_BODY (inline_func);
+      pkl_ast_node return_stmt = PKL_AST_COMP_STMT_STMTS (body);
+      int nargs = PKL_AST_FUNC_NARGS (inline_func);
+      int method_p = PKL_AST_FUNC_METHOD_P (inline_func);
+      pvm_program_label call_label = pkl_asm_fresh_label (PKL_GEN_ASM);
+      pvm_program_label done_label = pkl_asm_fresh_label (PKL_GEN_ASM);
+
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                    pvm_make_cls (PKL_AST_FUNC_PROGRAM (inline_func)));
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BNCP, call_label);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);     /* ARGS [SCT] */
+
+      pkl_gen_reverse_args (PKL_GEN_ASM, nargs, method_p);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHF,
+                    method_p ? nargs + 1 : nargs);
+      for (i = 0; i < (method_p ? nargs + 1 : nargs); ++i)
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_REGVAR);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHF,
+                    PKL_AST_COMP_STMT_NUMVARS (body));
+
+      PKL_GEN_PUSH_CONTEXT;
+      PKL_PASS_SUBPASS (PKL_AST_RETURN_STMT_EXP (return_stmt));
+      PKL_GEN_POP_CONTEXT;
+
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_POPF, 2);   /* RETVAL */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BA, done_label);
+
+      pkl_asm_label (PKL_GEN_ASM, call_label);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);
+      pkl_asm_label (PKL_GEN_ASM, done_label);
+    }
+  else
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);
   PKL_PASS_BREAK;
 }
 PKL_PHASE_END_HANDLER
@@ -1643,31 +2234,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_func)
                   PKL_AST_FUNC_NAME (function));
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PROLOG);
 
-  if (nargs > 1)
-    {
-      /* Reverse the arguments.
-
-         Note that in methods the implicit struct argument is passed
-         as the last actual.  However, we have to process it as the
-         _first_ formal.  We achieve this by not reversing it, saving
-         it in the return stack temporarily.  */
-
-      if (method_p)
-        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_TOR);
-
-      if (nargs == 2)
-        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);
-      else if (nargs == 3)
-        {
-          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);
-          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ROT);
-        }
-      else if (nargs > 1)
-        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_REVN, nargs);
-
-      if (method_p)
-        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_FROMR);
-    }
+  pkl_gen_reverse_args (PKL_GEN_ASM, nargs, method_p);
 
   /* If the function's return type is an array type, make sure it has
      a bounder.  If it hasn't one, then compute it in this
@@ -1847,7 +2414,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_identifier)
 {
   pkl_ast_node identifier = PKL_PASS_NODE;
   pvm_val val
-    = pvm_make_string (PKL_AST_IDENTIFIER_POINTER (identifier));
+    = pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (identifier));
 
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, val);
 }
@@ -1916,6 +2483,56 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_offset)
 }
 PKL_PHASE_END_HANDLER
 
+/*
+ * TYPE_DICT
+ * | KTYPE
+ * | VTYPE
+ */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_dict)
+{
+  pkl_ast_node dict_type = PKL_PASS_NODE;
+
+  /* Note that typify guarantees dicts are never mapped nor written,
+     since they can't be stored in IO spaces.  */
+  if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_CONSTRUCTOR))
+    {
+      /* Stack: NULL */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
+
+      PKL_GEN_DUP_CONTEXT;
+      PKL_GEN_CLEAR_CONTEXT (PKL_GEN_CTX_IN_CONSTRUCTOR);
+      PKL_GEN_SET_CONTEXT (PKL_GEN_CTX_IN_TYPE);
+      PKL_PASS_SUBPASS (dict_type);             /* TYPE */
+      PKL_GEN_POP_CONTEXT;
+
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MKD); /* DICT */
+      PKL_PASS_BREAK;
+    }
+  else if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_PRINTER))
+    {
+      /* Stack: DICT DEPTH */
+      /* Pretty-printers are not used in the elements of dicts, so
+         they are always printed natively.  */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PRINTV); /* _ */
+      PKL_PASS_BREAK;
+    }
+  else if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_TYPE))
+    {
+      PKL_PASS_SUBPASS (PKL_AST_TYPE_D_KTYPE (dict_type)); /* KTYPE */
+      PKL_PASS_SUBPASS (PKL_AST_TYPE_D_VTYPE (dict_type)); /* KTYPE VTYPE */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MKTYD);          /* TYPE */
+      PKL_PASS_BREAK;
+    }
+
+  /* In normal context, just subpass on the types of the keys and
+     values.  */
+  PKL_PASS_SUBPASS (PKL_AST_TYPE_D_KTYPE (dict_type));
+  PKL_PASS_SUBPASS (PKL_AST_TYPE_D_VTYPE (dict_type));
+  PKL_PASS_BREAK;
+}
+PKL_PHASE_END_HANDLER
+
 /*
  * | TYPE
  * | MAGNITUDE
@@ -2130,6 +2747,14 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_cons)
       PKL_PASS_SUBPASS (cons_type);
       PKL_GEN_POP_CONTEXT;
       break;
+    case PKL_AST_CONS_KIND_DICT:
+      /* Build an empty dict.  */
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
+      PKL_GEN_DUP_CONTEXT;
+      PKL_GEN_SET_CONTEXT (PKL_GEN_CTX_IN_CONSTRUCTOR);
+      PKL_PASS_SUBPASS (cons_type);
+      PKL_GEN_POP_CONTEXT;
+      break;
     default:
       assert (0);
     }
@@ -2368,7 +2993,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_indexer)
       /* This is a l-value in an assignment.  The array and the index
          are pushed to the stack for the ass_stmt PR handler.  Nothing
          else to do here.  Note that analf guarantees that the entity
-         in this indexer is an array, not a string.  */
+         in this indexer is an array or a dict, not a string.  */
     }
   else
     {
@@ -2379,7 +3004,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_indexer)
       switch (PKL_AST_TYPE_CODE (container_type))
         {
         case PKL_TYPE_ARRAY:
-          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AREF);
+          if (PKL_AST_INDEXER_NO_BOUNDS_CHECK_P (indexer))
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AREFNB);
+          else
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AREF);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
 
           /* To cover cases where the referenced array is not mapped, but
@@ -2397,7 +3025,14 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_indexer)
             }
           break;
         case PKL_TYPE_STRING:
-          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_STRREF);
+          if (PKL_AST_INDEXER_NO_BOUNDS_CHECK_P (indexer))
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_STRREFNB);
+          else
+            pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_STRREF);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
+          break;
+        case PKL_TYPE_DICT:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DREF);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
           break;
         default:
@@ -2472,6 +3107,286 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_struct_field)
 }
 PKL_PHASE_END_HANDLER
 
+/* If TYPE is a complete type whose size can be determined at
+   compile-time, put its size in bits in *SIZE and return 1.  Return 0
+   otherwise.  */
+
+static int
+pkl_gen_complete_type_size (pkl_ast_node type, uint64_t *size)
+{
+  if (PKL_AST_TYPE_COMPLETE (type) != PKL_AST_TYPE_COMPLETE_YES)
+    return 0;
+
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      *size = PKL_AST_TYPE_I_SIZE (type);
+      return 1;
+    case PKL_TYPE_OFFSET:
+      return pkl_gen_complete_type_size (PKL_AST_TYPE_O_BASE_TYPE (type),
+                                         size);
+    case PKL_TYPE_ARRAY:
+      {
+        pkl_ast_node bound = PKL_AST_TYPE_A_BOUND (type);
+        uint64_t esize;
+
+        if (bound == NULL
+            || PKL_AST_CODE (bound) != PKL_AST_INTEGER
+            || !pkl_gen_complete_type_size (PKL_AST_TYPE_A_ETYPE (type),
+                                            &esize))
+          return 0;
+
+        *size = PKL_AST_INTEGER_VALUE (bound) * esize;
+        return 1;
+      }
+    case PKL_TYPE_STRUCT:
+      {
+        pkl_ast_node elem;
+        uint64_t fsize;
+
+        if (PKL_AST_TYPE_S_ITYPE (type))
+          return pkl_gen_complete_type_size (PKL_AST_TYPE_S_ITYPE (type),
+                                             size);
+
+        if (PKL_AST_TYPE_S_UNION_P (type) || PKL_AST_TYPE_S_PINNED_P (type))
+          return 0;
+
+        *size = 0;
+        for (elem = PKL_AST_TYPE_S_ELEMS (type);
+             elem;
+             elem = PKL_AST_CHAIN (elem))
+          {
+            if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD)
+              continue;
+
+            if (!pkl_gen_complete_type_size (PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem),
+                                             &fsize))
+              return 0;
+            *size += fsize;
+          }
+
+        return 1;
+      }
+    default:
+      return 0;
+    }
+}
+
+/* Return 1 if values of type TYPE can be mapped outside of the
+   lexical environment where the type was defined.  This is the case
+   of complete types whose struct components, if any, have their
+   mappers already compiled.  Return 0 otherwise.  */
+
+static int
+pkl_gen_standalone_type_p (pkl_ast_node type)
+{
+  if (PKL_AST_TYPE_COMPLETE (type) != PKL_AST_TYPE_COMPLETE_YES)
+    return 0;
+
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+    case PKL_TYPE_OFFSET:
+      return 1;
+    case PKL_TYPE_ARRAY:
+      return pkl_gen_standalone_type_p (PKL_AST_TYPE_A_ETYPE (type));
+    case PKL_TYPE_STRUCT:
+      return PKL_AST_TYPE_S_MAPPER (type) != PVM_NULL;
+    default:
+      return 0;
+    }
+}
+
+/* Determine whether the field named NAME of a mapped struct of type
+   STRUCT_TYPE can be mapped on its own, without mapping the rest of
+   the struct.  This requires the offset of the field to be known at
+   compile-time, i.e. all the fields preceding it have complete types
+   and no labels nor conditions, and the field itself to be of a
+   standalone type with no constraint.
+
+   If so, return the field and put its bit-offset, relative to the
+   beginning of the struct, in *BOFFSET.  Otherwise return NULL.  */
+
+static pkl_ast_node
+pkl_gen_deferred_field (pkl_ast_node struct_type, pkl_ast_node name,
+                        uint64_t *boffset)
+{
+  pkl_ast_node elem;
+  uint64_t offset = 0;
+
+  if (PKL_AST_TYPE_S_UNION_P (struct_type)
+      || PKL_AST_TYPE_S_PINNED_P (struct_type)
+      || PKL_AST_TYPE_S_ITYPE (struct_type))
+    return NULL;
+
+  for (elem = PKL_AST_TYPE_S_ELEMS (struct_type);
+       elem;
+       elem = PKL_AST_CHAIN (elem))
+    {
+      pkl_ast_node field_name;
+      pkl_ast_node field_type;
+      uint64_t field_size;
+
+      /* Declarations preceding the field may be used by its type,
+         and these are not available outside the struct's mapper.  */
+      if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD)
+        return NULL;
+
+      field_name = PKL_AST_STRUCT_TYPE_FIELD_NAME (elem);
+      field_type = PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem);
+
+      if (PKL_AST_STRUCT_TYPE_FIELD_LABEL (elem)
+          || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND (elem))
+        return NULL;
+
+      if (field_name
+          && strcmp (PKL_AST_IDENTIFIER_POINTER (field_name),
+                     PKL_AST_IDENTIFIER_POINTER (name)) == 0)
+        {
+          if (PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (elem)
+              || PKL_AST_STRUCT_TYPE_FIELD_INITIALIZER (elem)
+              || !pkl_gen_standalone_type_p (field_type))
+            return NULL;
+
+          *boffset = offset;
+          return elem;
+        }
+
+      if (!pkl_gen_complete_type_size (field_type, &field_size))
+        return NULL;
+      offset += field_size;
+    }
+
+  return NULL;
+}
+
+/* Return the position that the field named by the identifier NAME
+   occupies in values of the struct type STRUCT_TYPE, or -1 if that
+   position can't be determined at compile time.  Union values hold
+   just one field, so -1 is always returned for them.  */
+
+static int
+pkl_gen_struct_field_index (pkl_ast_node struct_type,
+                            pkl_ast_node name)
+{
+  pkl_ast_node elem;
+  int index = 0;
+
+  if (PKL_AST_TYPE_CODE (struct_type) != PKL_TYPE_STRUCT
+      || PKL_AST_TYPE_S_UNION_P (struct_type))
+    return -1;
+
+  for (elem = PKL_AST_TYPE_S_ELEMS (struct_type);
+       elem;
+       elem = PKL_AST_CHAIN (elem))
+    {
+      pkl_ast_node field_name;
+
+      if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD)
+        continue;
+
+      field_name = PKL_AST_STRUCT_TYPE_FIELD_NAME (elem);
+      if (field_name != NULL
+          && strcmp (PKL_AST_IDENTIFIER_POINTER (field_name),
+                     PKL_AST_IDENTIFIER_POINTER (name)) == 0)
+        return index;
+      index++;
+    }
+
+  return -1;
+}
+
+/*
+ * STRUCT_REF
+ * | STRUCT
+ * | IDENTIFIER
+ *
+ * References to fields of struct variables holding mapped values
+ * normally remap the whole struct.  If the referred field can be
+ * mapped on its own, map just that field instead.
+ */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_struct_ref)
+{
+  pkl_ast_node struct_ref = PKL_PASS_NODE;
+  pkl_ast_node struct_ref_struct = PKL_AST_STRUCT_REF_STRUCT (struct_ref);
+  pkl_ast_node struct_ref_identifier
+    = PKL_AST_STRUCT_REF_IDENTIFIER (struct_ref);
+  pkl_ast_node struct_ref_type = PKL_AST_TYPE (struct_ref);
+  pkl_ast_node struct_type = PKL_AST_TYPE (struct_ref_struct);
+  pkl_ast_node field;
+  pvm_program_label unmapped, done;
+  uint64_t field_boffset;
+
+  if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_LVALUE)
+      || PKL_AST_CODE (struct_ref_struct) != PKL_AST_VAR
+      || PKL_AST_DECL_STRUCT_FIELD_P (PKL_AST_VAR_DECL (struct_ref_struct)))
+    PKL_PASS_DONE;
+
+  field = pkl_gen_deferred_field (struct_type, struct_ref_identifier,
+                                  &field_boffset);
+  if (field == NULL)
+    PKL_PASS_DONE;
+
+  unmapped = pkl_asm_fresh_label (PKL_GEN_ASM);
+  done = pkl_asm_fresh_label (PKL_GEN_ASM);
+
+  /* Note that the variable is not remapped.  */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR,
+                PKL_AST_VAR_BACK (struct_ref_struct),
+                PKL_AST_VAR_OVER (struct_ref_struct)); /* SCT */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MM);            /* SCT MAPPED_P */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BZI, unmapped);
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);          /* SCT */
+
+  /* Map the field at its offset in the IOS of the struct, honoring
+     the strictness of the struct.  */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MGETS);         /* SCT STRICT */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);          /* STRICT SCT */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MGETIOS);       /* STRICT SCT IOS */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);          /* STRICT IOS SCT */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MGETO);         /* STRICT IOS SCT BOFF */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);           /* STRICT IOS BOFF */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                pvm_make_ulong (field_boffset, 64));
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_ADDLU);
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);          /* STRICT IOS FBOFF */
+  {
+    int endian = PKL_GEN_PAYLOAD->endian;
+
+    PKL_GEN_PAYLOAD->endian = PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (field);
+    PKL_GEN_DUP_CONTEXT;
+    PKL_GEN_SET_CONTEXT (PKL_GEN_CTX_IN_MAPPER);
+    PKL_PASS_SUBPASS (PKL_AST_STRUCT_TYPE_FIELD_TYPE (field)); /* VAL */
+    PKL_GEN_POP_CONTEXT;
+    PKL_GEN_PAYLOAD->endian = endian;
+  }
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BA, done);
+
+  /* The struct is not mapped: just reference the field.  */
+  pkl_asm_label (PKL_GEN_ASM, unmapped);
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);          /* SCT */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
+                pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (struct_ref_identifier)));
+  {
+    int field_index = pkl_gen_struct_field_index (struct_type,
+                                                  struct_ref_identifier);
+
+    if (field_index != -1)
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREFH, field_index);
+    else
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);      /* SCT STR VAL */
+  }
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);          /* VAL */
+  if (PKL_AST_TYPE_CODE (struct_ref_type) == PKL_TYPE_ARRAY
+      || PKL_AST_TYPE_CODE (struct_ref_type) == PKL_TYPE_STRUCT)
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_REMAP);
+
+  pkl_asm_label (PKL_GEN_ASM, done);
+  PKL_PASS_BREAK;
+}
+PKL_PHASE_END_HANDLER
+
 /*
  * | STRUCT
  * | IDENTIFIER
@@ -2497,7 +3412,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_struct_ref)
         = PKL_AST_STRUCT_REF_IDENTIFIER (struct_ref);
       pkl_ast_node struct_ref_struct_type = PKL_AST_TYPE (struct_ref_struct);
       pkl_ast_node elem;
-      int is_field_p = 0;
+      int is_field_p = 0, field_index;
 
       /* Determine whether the referred struct element is a field or a
          declaration.  */
@@ -2520,7 +3435,19 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_struct_ref)
             }
         }
 
-      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);
+      /* If the position of the field in the struct value is known
+         at compile time, pass it as a hint so the field doesn't have
+         to be looked up by name at run time.  */
+      field_index
+        = (is_field_p
+           ? pkl_gen_struct_field_index (struct_ref_struct_type,
+                                         struct_ref_identifier)
+           : -1);
+      if (field_index != -1)
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREFH, field_index);
+      else
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);
+
       /* If the parent is a funcall and the referred field is a struct
          method, then leave both the struct and the closure.  */
       if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_FUNCALL)
@@ -2991,6 +3918,14 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_array)
       pkl_ast_node array_type = PKL_PASS_NODE;
       pvm_val printer_closure = PKL_AST_TYPE_A_PRINTER (array_type);
 
+      /* Unless some pretty-printer may be involved, the native
+         printer is way faster than a compiled one.  */
+      if (!pkl_ast_type_pretty_printed_p (array_type))
+        {
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PRINTV); /* _ */
+          PKL_PASS_BREAK;
+        }
+
       /* If the array type doesn't have a printer, compile one.  */
       if (printer_closure == PVM_NULL)
         {
@@ -3172,6 +4107,95 @@ PKL_PHASE_END_HANDLER
  * | ...
  */
 
+/* Build the PVM type corresponding to the type TYPE at compile
+   time, if possible.  Return PVM_NULL if TYPE can't be built without
+   running code, for example because the unit of an offset type is
+   not a constant.
+
+   This is used to build struct types once per program, so all the
+   struct values created by a mapper or a constructor can share the
+   same type.  Note that the bounds of array types are never stored
+   in PVM types.  */
+
+static pvm_val
+pkl_gen_static_type (pkl_ast_node type)
+{
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      return pvm_make_integral_type (pvm_make_ulong (PKL_AST_TYPE_I_SIZE (type), 64),
+                                     pvm_make_uint (PKL_AST_TYPE_I_SIGNED_P (type), 32));
+    case PKL_TYPE_STRING:
+      return pvm_make_string_type ();
+    case PKL_TYPE_ANY:
+      return pvm_make_any_type ();
+    case PKL_TYPE_VOID:
+      return pvm_make_void_type ();
+    case PKL_TYPE_OFFSET:
+      {
+        pkl_ast_node unit = PKL_AST_TYPE_O_UNIT (type);
+        pvm_val base_type;
+
+        if (PKL_AST_CODE (unit) != PKL_AST_INTEGER)
+          return PVM_NULL;
+
+        base_type = pkl_gen_static_type (PKL_AST_TYPE_O_BASE_TYPE (type));
+        if (base_type == PVM_NULL)
+          return PVM_NULL;
+
+        return pvm_make_offset_type (base_type,
+                                     pvm_make_ulong (PKL_AST_INTEGER_VALUE (unit),
+                                                     64));
+      }
+    case PKL_TYPE_ARRAY:
+      {
+        pvm_val etype = pkl_gen_static_type (PKL_AST_TYPE_A_ETYPE (type));
+
+        if (etype == PVM_NULL)
+          return PVM_NULL;
+        return pvm_make_array_type (etype, PVM_NULL);
+      }
+    case PKL_TYPE_STRUCT:
+      {
+        pkl_ast_node type_name = PKL_AST_TYPE_NAME (type);
+        pvm_val nfields = pvm_make_ulong (PKL_AST_TYPE_S_NFIELD (type), 64);
+        pvm_val *fnames, *ftypes;
+        pkl_ast_node elem;
+        size_t i = 0;
+
+        pvm_allocate_struct_attrs (nfields, &fnames, &ftypes);
+        for (elem = PKL_AST_TYPE_S_ELEMS (type);
+             elem;
+             elem = PKL_AST_CHAIN (elem))
+          {
+            pkl_ast_node field_name;
+
+            if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD)
+              continue;
+
+            field_name = PKL_AST_STRUCT_TYPE_FIELD_NAME (elem);
+            fnames[i]
+              = (field_name
+                 ? pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (field_name))
+                 : PVM_NULL);
+            ftypes[i]
+              = pkl_gen_static_type (PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem));
+            if (ftypes[i] == PVM_NULL)
+              return PVM_NULL;
+            i++;
+          }
+
+        return pvm_make_struct_type (nfields,
+                                     (type_name
+                                      ? pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (type_name))
+                                      : PVM_NULL),
+                                     fnames, ftypes);
+      }
+    default:
+      return PVM_NULL;
+    }
+}
+
 PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
 {
   /* Note that the check for in_writer should appear first than the
@@ -3216,7 +4240,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
              current environment.  */
           pvm_val mapper_closure;
 
-          RAS_FUNCTION_STRUCT_MAPPER (mapper_closure, type_struct);
+          if (pkl_gen_pod_struct_p (type_struct))
+            RAS_FUNCTION_STRUCT_POD_MAPPER (mapper_closure, type_struct);
+          else
+            RAS_FUNCTION_STRUCT_MAPPER (mapper_closure, type_struct);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, mapper_closure);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEC);
         } /* ... STRICT IOS OFF CLS */
@@ -3391,6 +4418,13 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
       pkl_ast_node struct_type = PKL_PASS_NODE;
       pvm_val printer_closure = PKL_AST_TYPE_S_PRINTER (struct_type);
 
+      /* See the comment in pkl_gen_pr_type_array.  */
+      if (!pkl_ast_type_pretty_printed_p (struct_type))
+        {
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PRINTV); /* _ */
+          PKL_PASS_BREAK;
+        }
+
       /* If the struct type doesn't have a printer, compile one.  */
       if (printer_closure == PVM_NULL)
         {
@@ -3407,7 +4441,16 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
     }
   else if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_TYPE))
     {
-      /* Do nothing.  See PS hook.  */
+      /* If the PVM struct type can be built at compile time, push it
+         as a literal so it is shared by every value created by this
+         code.  Otherwise build it at run time in the PS hook.  */
+      pvm_val type = pkl_gen_static_type (PKL_PASS_NODE);
+
+      if (type != PVM_NULL)
+        {
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, type);
+          PKL_PASS_BREAK;
+        }
     }
   else
     {
@@ -3448,7 +4491,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_type_struct)
                     pvm_make_ulong (PKL_AST_TYPE_S_NFIELD (struct_type), 64));
       if (type_name)
         pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
-                      pvm_make_string (PKL_AST_IDENTIFIER_POINTER (type_name)));
+                      pvm_make_string_atom (PKL_AST_IDENTIFIER_POINTER (type_name)));
       else
         pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
 
@@ -3915,6 +4958,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_op_attr)
         case PKL_TYPE_STRING:
         case PKL_TYPE_ARRAY:
         case PKL_TYPE_STRUCT:
+        case PKL_TYPE_DICT:
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SEL);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
           break;
@@ -4006,6 +5050,14 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_op_attr)
           break;
         }
       break;
+    case PKL_AST_ATTR_KEYS:
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DKEYS);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+      break;
+    case PKL_AST_ATTR_VALUES:
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DVALS);
+      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+      break;
     default:
       PKL_ICE (PKL_AST_LOC (exp),
                "unhandled attribute expression code #%d in code generator",
@@ -4062,7 +5114,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_op_in)
   pkl_ast_node container_type = PKL_AST_TYPE (container);
   //  pkl_ast_node elem_type = PKL_AST_TYPE (elem);
 
-  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AIS, container_type);
+  if (PKL_AST_TYPE_CODE (container_type) == PKL_TYPE_DICT)
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DHAS);
+  else
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AIS, container_type);
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP2);
 }
 PKL_PHASE_END_HANDLER
@@ -4177,6 +5232,7 @@ struct pkl_phase pkl_phase_gen =
    PKL_PHASE_PR_HANDLER (PKL_AST_STRUCT, pkl_gen_pr_struct),
    PKL_PHASE_PS_HANDLER (PKL_AST_STRUCT, pkl_gen_ps_struct),
    PKL_PHASE_PR_HANDLER (PKL_AST_STRUCT_FIELD, pkl_gen_pr_struct_field),
+   PKL_PHASE_PR_HANDLER (PKL_AST_STRUCT_REF, pkl_gen_pr_struct_ref),
    PKL_PHASE_PS_HANDLER (PKL_AST_STRUCT_REF, pkl_gen_ps_struct_ref),
    PKL_PHASE_PR_HANDLER (PKL_AST_STRUCT_TYPE_FIELD, pkl_gen_pr_struct_type_field),
    PKL_PHASE_PS_OP_HANDLER (PKL_AST_OP_ADD, pkl_gen_ps_op_add),
@@ -4211,6 +5267,7 @@ struct pkl_phase pkl_phase_gen =
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_ANY, pkl_gen_ps_type_any),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_INTEGRAL, pkl_gen_ps_type_integral),
    PKL_PHASE_PR_TYPE_HANDLER (PKL_TYPE_OFFSET, pkl_gen_pr_type_offset),
+   PKL_PHASE_PR_TYPE_HANDLER (PKL_TYPE_DICT, pkl_gen_pr_type_dict),
    PKL_PHASE_PR_TYPE_HANDLER (PKL_TYPE_FUNCTION, pkl_gen_pr_type_function),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_FUNCTION, pkl_gen_ps_type_function),
    PKL_PHASE_PR_TYPE_HANDLER (PKL_TYPE_ARRAY, pkl_gen_pr_type_array),
@@ -91,6 +91,7 @@ struct pkl_gen_payload
   int constructor_depth;
   int mapper_depth;
   int in_file_p;
+  const char *filename;
 };
 
 typedef struct pkl_gen_payload *pkl_gen_payload;
@@ -18,101 +18,174 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include "pkl-pass.h"
 
-#define PKL_CALL_PHASES(CLASS,ORDER,DISCR)                              \
+/* The pass manager doesn't scan the list of phases for every node.
+   Instead, a dispatch table is computed once per pass, mapping every
+   node code, operation code and type code to a bitmap of the phases
+   that define a handler for it, in both orders.  Bit I in a bitmap
+   corresponds to PHASES[I].
+
+   A restarted subtree is processed by a suffix of the phases.  Since
+   the suffix also lies in the array the table was computed for, the
+   table is still valid: the bitmaps just need to be shifted by the
+   position of the first phase in the suffix.  */
+
+#define PKL_PASS_MAX_PHASES 32
+
+struct pkl_pass_dispatch
+{
+  struct pkl_phase **phases;
+  size_t num_phases;
+
+  uint64_t else_mask;
+
+  uint64_t default_ps_mask;
+  uint64_t code_ps_mask[PKL_AST_LAST];
+  uint64_t op_ps_mask[PKL_AST_OP_LAST];
+  uint64_t type_ps_mask[PKL_TYPE_NOTYPE + 1];
+
+  uint64_t default_pr_mask;
+  uint64_t code_pr_mask[PKL_AST_LAST];
+  uint64_t op_pr_mask[PKL_AST_OP_LAST];
+  uint64_t type_pr_mask[PKL_TYPE_NOTYPE + 1];
+};
+
+static void
+pkl_pass_init_dispatch (struct pkl_pass_dispatch *dispatch,
+                        struct pkl_phase *phases[])
+{
+  size_t i, j;
+
+  memset (dispatch, 0, sizeof (struct pkl_pass_dispatch));
+  dispatch->phases = phases;
+
+  if (phases == NULL)
+    return;
+
+  for (i = 0; phases[i]; i++)
+    {
+      struct pkl_phase *phase = phases[i];
+      uint64_t bit = (uint64_t) 1 << i;
+
+      assert (i < PKL_PASS_MAX_PHASES);
+
+      if (phase->else_handler)
+        dispatch->else_mask |= bit;
+      if (phase->default_ps_handler)
+        dispatch->default_ps_mask |= bit;
+      if (phase->default_pr_handler)
+        dispatch->default_pr_mask |= bit;
+
+      for (j = 0; j < PKL_AST_LAST; j++)
+        {
+          if (phase->code_ps_handlers[j])
+            dispatch->code_ps_mask[j] |= bit;
+          if (phase->code_pr_handlers[j])
+            dispatch->code_pr_mask[j] |= bit;
+        }
+
+      for (j = 0; j < PKL_AST_OP_LAST; j++)
+        {
+          if (phase->op_ps_handlers[j])
+            dispatch->op_ps_mask[j] |= bit;
+          if (phase->op_pr_handlers[j])
+            dispatch->op_pr_mask[j] |= bit;
+        }
+
+      /* Note that there are no handlers for PKL_TYPE_NOTYPE.  */
+      for (j = 0; j < PKL_TYPE_NOTYPE; j++)
+        {
+          if (phase->type_ps_handlers[j])
+            dispatch->type_ps_mask[j] |= bit;
+          if (phase->type_pr_handlers[j])
+            dispatch->type_pr_mask[j] |= bit;
+        }
+    }
+
+  dispatch->num_phases = i;
+}
+
+/* Return the position of the least significant bit set in the
+   non-zero MASK.  */
+
+static inline size_t
+pkl_pass_first_phase (uint64_t mask)
+{
+#if defined __GNUC__
+  return __builtin_ctzll (mask);
+#else
+  size_t i = 0;
+
+  while (!(mask & 1))
+    {
+      mask >>= 1;
+      i++;
+    }
+  return i;
+#endif
+}
+
+/* Call the handlers for the phases in MASK.  PHASES and PAYLOADS
+   point to the first phase that is still active in this traversal,
+   which is at position BASE in the dispatch table.  COUNT is a
+   statement to execute after each handler invocation.  */
+
+#define PKL_CALL_PHASES_1(MASK,HANDLER,COUNT)                              \
   do                                                                    \
     {                                                                   \
-      size_t i = 0;                                                     \
+      uint64_t mask = (MASK) >> base;                                   \
                                                                         \
-      while (phases[i])                                                 \
+      while (mask)                                                      \
         {                                                               \
-          if (phases[i]->CLASS##_##ORDER##_handlers[(DISCR)])           \
-            {                                                           \
-              int restart;                                              \
+          size_t i = pkl_pass_first_phase (mask);                       \
+          int restart;                                                  \
                                                                         \
-              node                                                      \
-                = phases[i]->CLASS##_##ORDER##_handlers[(DISCR)] (compiler, \
-                                                                  toplevel, \
-                                                                  ast,  \
-                                                                  node, \
-                                                                  payloads[i], \
-                                                                  &restart, \
-                                                                  child_pos, \
-                                                                  parent, \
-                                                                  &dobreak, \
-                                                                  payloads, \
-                                                                  phases,\
-                                                                  flags, \
-                                                                  level); \
-              *handlers_used += 1;                                      \
-              if (dobreak)                                              \
-                goto _exit;                                             \
+          mask &= mask - 1;                                             \
+          node = phases[i]->HANDLER (compiler,                          \
+                                     toplevel,                          \
+                                     ast,                               \
+                                     node,                              \
+                                     payloads[i],                       \
+                                     &restart,                          \
+                                     child_pos,                         \
+                                     parent,                            \
+                                     &dobreak,                          \
+                                     payloads,                          \
+                                     phases,                            \
+                                     flags,                             \
+                                     level);                            \
+          COUNT;                                                        \
+          if (dobreak)                                                  \
+            goto _exit;                                                 \
                                                                         \
-              if (restart)                                              \
-                {                                                       \
-                  /* Restart the subtree with the rest of the phases. */ \
-                  node = pkl_do_pass_1 (compiler, toplevel, ast, node,  \
-                                        child_pos,                      \
-                                        parent,                         \
-                                        payloads + i + 1,               \
-                                        phases + i + 1,                 \
-                                        flags,                          \
-                                        level);                         \
-                  /* goto restart */                                    \
-                  goto restart;                                         \
-                }                                                       \
+          if (restart)                                                  \
+            {                                                           \
+              /* Restart the subtree with the rest of the phases. */    \
+              node = pkl_do_pass_1 (compiler, toplevel, ast, node,      \
+                                    child_pos,                          \
+                                    parent,                             \
+                                    payloads + i + 1,                   \
+                                    phases + i + 1,                     \
+                                    dispatch,                           \
+                                    flags,                              \
+                                    level);                             \
+              /* goto restart */                                        \
+              goto restart;                                             \
             }                                                           \
-          i++;                                                          \
         }                                                               \
     }                                                                   \
   while (0)
 
+#define PKL_CALL_PHASES(CLASS,ORDER,DISCR)                              \
+  PKL_CALL_PHASES_1 (dispatch->CLASS##_##ORDER##_mask[(DISCR)],         \
+                     CLASS##_##ORDER##_handlers[(DISCR)],               \
+                     *handlers_used += 1)
+
 #define PKL_CALL_PHASES_SINGLE(what)                                    \
-  do                                                                    \
-    {                                                                   \
-      size_t i = 0;                                                     \
-                                                                        \
-      while (phases[i])                                                 \
-        {                                                               \
-          if (phases[i]->what##_handler)                                \
-            {                                                           \
-              int restart;                                              \
-              node                                                      \
-                = phases[i]->what##_handler (compiler,                  \
-                                             toplevel,                  \
-                                             ast,                       \
-                                             node,                      \
-                                             payloads[i],               \
-                                             &restart,                  \
-                                             child_pos,                 \
-                                             parent,                    \
-                                             &dobreak,                  \
-                                             payloads,                  \
-                                             phases,                    \
-                                             flags,                     \
-                                             level);                    \
-              if (dobreak)                                              \
-                goto _exit;                                             \
-                                                                        \
-              if (restart)                                              \
-                {                                                       \
-                  /* Restart the subtree with the rest of the phases. */ \
-                  node = pkl_do_pass_1 (compiler, toplevel, ast, node,  \
-                                        child_pos,                      \
-                                        parent,                         \
-                                        payloads + i + 1,               \
-                                        phases + i + 1,                 \
-                                        flags,                          \
-                                        level);                         \
-                  /* goto restart */                                    \
-                  goto restart;                                         \
-                }                                                       \
-            }                                                           \
-          i++;                                                          \
-        }                                                               \
-    }                                                                   \
-  while (0)
+  PKL_CALL_PHASES_1 (dispatch->what##_mask, what##_handler, (void) 0)
 
 /* Forward prototype.  */
 static pkl_ast_node pkl_do_pass_1 (pkl_compiler compiler,
@@ -122,6 +195,7 @@ static pkl_ast_node pkl_do_pass_1 (pkl_compiler compiler,
                                    size_t child_pos,
                                    pkl_ast_node parent,
                                    void *payloads[], struct pkl_phase *phases[],
+                                   struct pkl_pass_dispatch *dispatch,
                                    int flags, int level);
 
 
@@ -135,6 +209,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
                         pkl_ast_node node,
                         void *payloads[],
                         struct pkl_phase *phases[],
+                        struct pkl_pass_dispatch *dispatch,
                         int *handlers_used,
                         size_t child_pos,
                         pkl_ast_node parent,
@@ -145,6 +220,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
 {
   int node_code = PKL_AST_CODE (node);
   int dobreak = 0;
+  size_t base = phases - dispatch->phases;
 
   if (order == PKL_PASS_POST_ORDER)
     {
@@ -157,18 +233,9 @@ pkl_call_node_handlers (pkl_compiler compiler,
         {
           int opcode = PKL_AST_EXP_CODE (node);
 
-          switch (opcode)
-            {
-#define PKL_DEF_OP(ocode, str)                          \
-              case ocode:                               \
-                PKL_CALL_PHASES (op, ps, ocode);        \
-                break;
-#include "pkl-ops.def"
-#undef PKL_DEF_OP
-            default:
-              /* Unknown operation code.  */
-              assert (0);
-            }
+          /* Unknown operation codes are fatal.  */
+          assert (opcode >= 0 && opcode < PKL_AST_OP_LAST);
+          PKL_CALL_PHASES (op, ps, opcode);
 
           /* The node may have been replaced by the handler above.
              Refresh the code.  */
@@ -212,18 +279,9 @@ pkl_call_node_handlers (pkl_compiler compiler,
         {
           int opcode = PKL_AST_EXP_CODE (node);
 
-          switch (opcode)
-            {
-#define PKL_DEF_OP(ocode, str)                          \
-              case ocode:                               \
-                PKL_CALL_PHASES (op, pr, ocode);        \
-                break;
-#include "pkl-ops.def"
-#undef PKL_DEF_OP
-            default:
-              /* Unknown operation code.  */
-              assert (0);
-            }
+          /* Unknown operation codes are fatal.  */
+          assert (opcode >= 0 && opcode < PKL_AST_OP_LAST);
+          PKL_CALL_PHASES (op, pr, opcode);
 
           /* The node may have been replaced by the handler above.
              Refresh the code.  */
@@ -256,7 +314,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
     {                                                        \
       (CHILD) = pkl_do_pass_1 (compiler, toplevel, ast,      \
                                (CHILD), 0, node,             \
-                               payloads, phases,             \
+                               payloads, phases, dispatch,   \
                                flags, level);                \
     }                                                        \
   while (0)
@@ -273,7 +331,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
       elem = (CHAIN);                                           \
       next = PKL_AST_CHAIN (elem);                              \
       CHAIN = pkl_do_pass_1 (compiler, toplevel, ast, elem, cpos++, node, \
-                             payloads, phases, flags, level);           \
+                             payloads, phases, dispatch, flags, level); \
       last = (CHAIN);                                           \
       elem = next;                                              \
                                                                 \
@@ -289,6 +347,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
                                                 node,           \
                                                 payloads,       \
                                                 phases,         \
+                                                dispatch,       \
                                                 flags,          \
                                                 level);         \
           last = PKL_AST_CHAIN (last);                          \
@@ -304,16 +363,19 @@ pkl_do_pass_1 (pkl_compiler compiler,
                size_t child_pos,
                pkl_ast_node parent,
                void *payloads[], struct pkl_phase *phases[],
+               struct pkl_pass_dispatch *dispatch,
                int flags, int level)
 {
   pkl_ast_node node_orig = node;
   int node_code = PKL_AST_CODE (node);
   int handlers_used = 0;
   int dobreak = 0;
+  size_t base;
 
   /* If there are no passes then there is nothing to do. */
   if (phases == NULL)
     goto _exit;
+  base = phases - dispatch->phases;
 
   /* Check the COMPILED level in the node, and exit if the node
      doesn't need additional processing.  */
@@ -323,7 +385,8 @@ pkl_do_pass_1 (pkl_compiler compiler,
 
   /* Call the pre-order handlers from registered phases.  */
   node = pkl_call_node_handlers (compiler, toplevel, ast, node, payloads, phases,
-                                 &handlers_used, child_pos, parent, &dobreak,
+                                 dispatch, &handlers_used, child_pos, parent,
+                                 &dobreak,
                                  PKL_PASS_PRE_ORDER, flags, level);
   if (dobreak)
     goto _exit;
@@ -336,7 +399,7 @@ pkl_do_pass_1 (pkl_compiler compiler,
         PKL_AST_TYPE (node)
           = pkl_do_pass_1 (compiler, toplevel, ast,
                            PKL_AST_TYPE (node), 0, node,
-                           payloads, phases, flags, level);
+                           payloads, phases, dispatch, flags, level);
     }
 
   switch (node_code)
@@ -454,6 +517,10 @@ pkl_do_pass_1 (pkl_compiler compiler,
             PKL_PASS (PKL_AST_TYPE_O_BASE_TYPE (node));
             PKL_PASS (PKL_AST_TYPE_O_UNIT (node));
 
+            break;
+          case PKL_TYPE_DICT:
+            PKL_PASS (PKL_AST_TYPE_D_KTYPE (node));
+            PKL_PASS (PKL_AST_TYPE_D_VTYPE (node));
             break;
           case PKL_TYPE_INTEGRAL:
           case PKL_TYPE_STRING:
@@ -602,7 +669,8 @@ pkl_do_pass_1 (pkl_compiler compiler,
 
   /* Call the post-order handlers from registered phases.  */
   node = pkl_call_node_handlers (compiler, toplevel, ast, node, payloads, phases,
-                                 &handlers_used, child_pos, parent, &dobreak,
+                                 dispatch, &handlers_used, child_pos, parent,
+                                 &dobreak,
                                  PKL_PASS_POST_ORDER, flags, level);
 
   /* If no handler has been invoked, call the default handler of the
@@ -632,13 +700,34 @@ pkl_do_subpass (pkl_compiler compiler,
                 int flags, int level)
 {
   jmp_buf toplevel;
+  struct pkl_pass_dispatch local_dispatch;
+  struct pkl_pass_dispatch *dispatch = ast->pass_dispatch;
+  size_t i;
+
+  /* Subpasses are usually started by handlers, using the same phases
+     (or a suffix of them) than the enclosing pass.  In that case the
+     dispatch table of the enclosing pass can be reused.  */
+  if (dispatch)
+    {
+      for (i = 0; i <= dispatch->num_phases; i++)
+        if (dispatch->phases + i == phases)
+          break;
+      if (i > dispatch->num_phases)
+        dispatch = NULL;
+    }
+
+  if (!dispatch)
+    {
+      pkl_pass_init_dispatch (&local_dispatch, phases);
+      dispatch = &local_dispatch;
+    }
 
   switch (setjmp (toplevel))
     {
     case 0:
       ast->ast = pkl_do_pass_1 (compiler, toplevel, ast, node, 0,
                                 NULL /* parent */,
-                                payloads, phases, flags, level);
+                                payloads, phases, dispatch, flags, level);
       break;
     case 1:
       /* Non-error non-local exit.  */
@@ -658,6 +747,18 @@ pkl_do_pass (pkl_compiler compiler,
              struct pkl_phase *phases[], void *payloads[],
              int flags, int level)
 {
-  return pkl_do_subpass (compiler, ast, ast->ast, phases,
-                         payloads, flags, level);
+  struct pkl_pass_dispatch dispatch;
+  struct pkl_pass_dispatch *prev_dispatch = ast->pass_dispatch;
+  int ret;
+
+  /* Compute the dispatch table for the given phases, to be used for
+     the whole pass and its subpasses.  */
+  pkl_pass_init_dispatch (&dispatch, phases);
+
+  ast->pass_dispatch = &dispatch;
+  ret = pkl_do_subpass (compiler, ast, ast->ast, phases,
+                        payloads, flags, level);
+  ast->pass_dispatch = prev_dispatch;
+
+  return ret;
 }
@@ -830,15 +830,30 @@ PKL_PHASE_BEGIN_HANDLER (pkl_promo_ps_op_unary)
 PKL_PHASE_END_HANDLER
 
 /* Handler for promoting indexes in indexers to unsigned 64 bit
-   values.  */
+   values.  Keys indexing dicts are promoted to the type of the keys
+   of the dict instead.  */
 
 PKL_PHASE_BEGIN_HANDLER (pkl_promo_ps_indexer)
 {
   int restart;
   pkl_ast_node node = PKL_PASS_NODE;
+  pkl_ast_node entity_type
+    = PKL_AST_TYPE (PKL_AST_INDEXER_ENTITY (node));
 
-  if (!promote_integral (PKL_PASS_AST, 64, 0,
-                         &PKL_AST_INDEXER_INDEX (node), &restart))
+  if (PKL_AST_TYPE_CODE (entity_type) == PKL_TYPE_DICT)
+    {
+      if (!promote_node (PKL_PASS_AST,
+                         &PKL_AST_INDEXER_INDEX (node),
+                         PKL_AST_TYPE_D_KTYPE (entity_type),
+                         &restart))
+        {
+          PKL_ICE (PKL_AST_LOC (node),
+                   "couldn't promote dict key");
+          PKL_PASS_ERROR;
+        }
+    }
+  else if (!promote_integral (PKL_PASS_AST, 64, 0,
+                              &PKL_AST_INDEXER_INDEX (node), &restart))
     {
       PKL_ICE (PKL_AST_LOC (node),
                "couldn't promote indexer subscript");
@@ -1463,14 +1478,19 @@ PKL_PHASE_BEGIN_HANDLER (pkl_promo_ps_struct_type_field)
 PKL_PHASE_END_HANDLER
 
 /* The left operand of an `in' operator shall be promoted to the type
- * of the elements stored in the array at the right operand.  */
+ * of the elements stored in the array at the right operand, or to the
+ * type of the keys of the dict at the right operand.  */
 
 PKL_PHASE_BEGIN_HANDLER (pkl_promo_ps_op_in)
 {
   pkl_ast_node exp = PKL_PASS_NODE;
   pkl_ast_node op1 = PKL_AST_EXP_OPERAND (exp, 0);
   pkl_ast_node op2 = PKL_AST_EXP_OPERAND (exp, 1);
-  pkl_ast_node t2 = PKL_AST_TYPE_A_ETYPE (PKL_AST_TYPE (op2));
+  pkl_ast_node op2_type = PKL_AST_TYPE (op2);
+  pkl_ast_node t2
+    = (PKL_AST_TYPE_CODE (op2_type) == PKL_TYPE_DICT
+       ? PKL_AST_TYPE_D_KTYPE (op2_type)
+       : PKL_AST_TYPE_A_ETYPE (op2_type));
 
   int restart = 0;
 
@@ -1569,6 +1589,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_promo_ps_cons)
           }
         break;
       }
+    case PKL_AST_CONS_KIND_DICT:
+      /* Dict constructors don't take arguments.  */
+      break;
     default:
       assert (0);
     }
@@ -81,6 +81,7 @@ pkl_tab_error (YYLTYPE *llocp,
 
 #define IS_DEFUN 0
 #define IS_METHOD 1
+#define IS_MEMO_METHOD 2
 
 /* Register an argument in the compile-time environment.  This is used
    by function specifiers and try-catch statements.
@@ -397,12 +398,14 @@ token <integer> UNION    _("keyword `union'")
 %token INTCONSTR         _("int type constructor")
 %token UINTCONSTR        _("uint type constructor")
 %token OFFSETCONSTR      _("offset type constructor")
+%token DICTCONSTR        _("dict type constructor")
 %token DEFUN             _("keyword `fun'")
 %token DEFSET            _("keyword `defset'")
 %token DEFTYPE           _("keyword `type'")
 %token DEFVAR            _("keyword `var'")
 %token DEFUNIT           _("keyword `unit'")
 %token METHOD            _("keyword `method'")
+%token MEMO              _("keyword `memo'")
 %token RETURN            _("keyword `return'")
 %token BREAK             _("keyword `break'")
 %token STRING            _("string type specifier")
@@ -423,6 +426,16 @@ token <integer> UNION    _("keyword `union'")
 %token BUILTIN_TERM_GET_BGCOLOR BUILTIN_TERM_SET_BGCOLOR
 %token BUILTIN_TERM_BEGIN_CLASS BUILTIN_TERM_END_CLASS
 %token BUILTIN_TERM_BEGIN_HYPERLINK BUILTIN_TERM_END_HYPERLINK
+%token BUILTIN_IOCOPY BUILTIN_IODUMP BUILTIN_IOSEARCH BUILTIN_IODIRTY
+%token BUILTIN_IOCOMMIT BUILTIN_IODISCARD BUILTIN_IOPREFETCH
+%token BUILTIN_IOCRC32 BUILTIN_IOADLER32 BUILTIN_IOXXH64 BUILTIN_IOSHA256
+%token BUILTIN_ASORT BUILTIN_PMAP
+%token BUILTIN_IOULEB128 BUILTIN_IOSLEB128
+%token BUILTIN_DREMOVE
+%token BUILTIN_CATOS BUILTIN_STOCA BUILTIN_ATOI BUILTIN_LTOS
+%token BUILTIN_STRCHR BUILTIN_LTRIM BUILTIN_RTRIM BUILTIN_REVERSE
+%token BUILTIN_IOGETU128 BUILTIN_IOSETU128 BUILTIN_U128OP BUILTIN_U128TOS
+%token BUILTIN_IOSCRABBLE BUILTIN_BYTESWAP
 
 /* Compiler builtins.  */
 
@@ -516,6 +529,7 @@ token <integer> UNION    _("keyword `union'")
 %type <ast> array array_initializer_list array_initializer
 %type <ast> struct_field_list struct_field
 %type <ast> typename type_specifier simple_type_specifier cons_type_specifier
+%type <ast> dict_type_specifier
 %type <ast> integral_type_specifier offset_type_specifier array_type_specifier
 %type <ast> function_type_specifier function_type_arg_list function_type_arg
 %type <ast> struct_type_specifier string_type_specifier
@@ -906,9 +920,10 @@ expression:
                 }
         | cons_type_specifier '(' expression_list opt_comma ')'
                 {
-                  /* This syntax is only used for array
+                  /* This syntax is only used for array and dict
                      constructors.  */
-                  if (PKL_AST_TYPE_CODE ($1) != PKL_TYPE_ARRAY)
+                  if (PKL_AST_TYPE_CODE ($1) != PKL_TYPE_ARRAY
+                      && PKL_AST_TYPE_CODE ($1) != PKL_TYPE_DICT)
                     {
                       pkl_error (pkl_parser->compiler, pkl_parser->ast, @1,
                                  "expected array type in constructor");
@@ -1394,12 +1409,22 @@ simple_type_specifier:
         | offset_type_specifier
         | array_type_specifier
         | string_type_specifier
+        | dict_type_specifier
         ;
 
 cons_type_specifier:
           typename
         | array_type_specifier
         | string_type_specifier
+        | dict_type_specifier
+        ;
+
+dict_type_specifier:
+          DICTCONSTR simple_type_specifier ',' simple_type_specifier '>'
+                {
+                  $$ = pkl_ast_make_dict_type (pkl_parser->ast, $2, $4);
+                  PKL_AST_LOC ($$) = @$;
+                }
         ;
 
 integral_type_specifier:
@@ -1559,7 +1584,7 @@ struct_type_specifier:
                   pkl_register_dummies (pkl_parser, 5);
 
                   /* Now register OFFSET with a type of
-                     offset<uint<64>,1> */
+                     offset<uint<64>,1>.  */
                   {
                     pkl_ast_node decl, type;
                     pkl_ast_node offset_identifier
@@ -1588,6 +1613,10 @@ struct_type_specifier:
                                               offset,
                                               NULL /* source */);
 
+                    /* The struct mapper and constructor keep the
+                       value of OFFSET unboxed.  */
+                    PKL_AST_DECL_UNBOXED_OFFSET_P (decl) = 1;
+
                     if (!pkl_env_register (pkl_parser->env,
                                            PKL_ENV_NS_MAIN,
                                            PKL_AST_IDENTIFIER_POINTER (offset_identifier),
@@ -1839,7 +1868,7 @@ declaration:
                   /* function_specifier needs to know whether we are
                      in a function declaration or a method
                      declaration.  */
-                  pkl_parser->in_method_decl_p = ($1 == IS_METHOD);
+                  pkl_parser->in_method_decl_p = ($1 != IS_DEFUN);
                 }
         '=' function_specifier
                 {
@@ -1864,8 +1893,10 @@ declaration:
 
                   /* Annotate the function to be a method whenever
                      appropriate.  */
-                  if ($1 == IS_METHOD)
+                  if ($1 != IS_DEFUN)
                     PKL_AST_FUNC_METHOD_P ($5) = 1;
+                  if ($1 == IS_MEMO_METHOD)
+                    PKL_AST_FUNC_MEMO_P ($5) = 1;
 
                   /* XXX: move to trans1.  */
                   PKL_AST_FUNC_NAME ($5)
@@ -1879,6 +1910,7 @@ declaration:
 defun_or_method:
           DEFUN                { $$ = IS_DEFUN; }
         | METHOD        { $$ = IS_METHOD; }
+        | MEMO METHOD   { $$ = IS_MEMO_METHOD; }
         ;
 
 defvar_list:
@@ -1895,6 +1927,8 @@ defvar:
                                         pkl_parser->filename);
                 PKL_AST_LOC ($1) = @1;
                 PKL_AST_LOC ($$) = @$;
+                PKL_AST_DECL_LOCAL_P ($$)
+                  = !pkl_env_toplevel_p (pkl_parser->env);
 
                 if (!pkl_env_register (pkl_parser->env,
                                        PKL_ENV_NS_MAIN,
@@ -2032,6 +2066,36 @@ builtin:
         | BUILTIN_TERM_END_CLASS { $$ = PKL_AST_BUILTIN_TERM_END_CLASS; }
         | BUILTIN_TERM_BEGIN_HYPERLINK { $$ = PKL_AST_BUILTIN_TERM_BEGIN_HYPERLINK; }
         | BUILTIN_TERM_END_HYPERLINK { $$ = PKL_AST_BUILTIN_TERM_END_HYPERLINK; }
+        | BUILTIN_IOCOPY        { $$ = PKL_AST_BUILTIN_IOCOPY; }
+        | BUILTIN_IODUMP        { $$ = PKL_AST_BUILTIN_IODUMP; }
+        | BUILTIN_IOSEARCH      { $$ = PKL_AST_BUILTIN_IOSEARCH; }
+        | BUILTIN_IOSCRABBLE    { $$ = PKL_AST_BUILTIN_IOSCRABBLE; }
+        | BUILTIN_BYTESWAP      { $$ = PKL_AST_BUILTIN_BYTESWAP; }
+        | BUILTIN_IOCRC32       { $$ = PKL_AST_BUILTIN_IOCRC32; }
+        | BUILTIN_IOADLER32     { $$ = PKL_AST_BUILTIN_IOADLER32; }
+        | BUILTIN_IOXXH64       { $$ = PKL_AST_BUILTIN_IOXXH64; }
+        | BUILTIN_IOSHA256      { $$ = PKL_AST_BUILTIN_IOSHA256; }
+        | BUILTIN_ASORT         { $$ = PKL_AST_BUILTIN_ASORT; }
+        | BUILTIN_PMAP          { $$ = PKL_AST_BUILTIN_PMAP; }
+        | BUILTIN_IOULEB128     { $$ = PKL_AST_BUILTIN_IOULEB128; }
+        | BUILTIN_IOSLEB128     { $$ = PKL_AST_BUILTIN_IOSLEB128; }
+        | BUILTIN_DREMOVE       { $$ = PKL_AST_BUILTIN_DREMOVE; }
+        | BUILTIN_IODIRTY       { $$ = PKL_AST_BUILTIN_IODIRTY; }
+        | BUILTIN_IOCOMMIT      { $$ = PKL_AST_BUILTIN_IOCOMMIT; }
+        | BUILTIN_IODISCARD     { $$ = PKL_AST_BUILTIN_IODISCARD; }
+        | BUILTIN_IOPREFETCH    { $$ = PKL_AST_BUILTIN_IOPREFETCH; }
+        | BUILTIN_CATOS         { $$ = PKL_AST_BUILTIN_CATOS; }
+        | BUILTIN_STOCA         { $$ = PKL_AST_BUILTIN_STOCA; }
+        | BUILTIN_ATOI          { $$ = PKL_AST_BUILTIN_ATOI; }
+        | BUILTIN_LTOS          { $$ = PKL_AST_BUILTIN_LTOS; }
+        | BUILTIN_STRCHR        { $$ = PKL_AST_BUILTIN_STRCHR; }
+        | BUILTIN_LTRIM         { $$ = PKL_AST_BUILTIN_LTRIM; }
+        | BUILTIN_RTRIM         { $$ = PKL_AST_BUILTIN_RTRIM; }
+        | BUILTIN_REVERSE       { $$ = PKL_AST_BUILTIN_REVERSE; }
+        | BUILTIN_IOGETU128     { $$ = PKL_AST_BUILTIN_IOGETU128; }
+        | BUILTIN_IOSETU128     { $$ = PKL_AST_BUILTIN_IOSETU128; }
+        | BUILTIN_U128OP        { $$ = PKL_AST_BUILTIN_U128OP; }
+        | BUILTIN_U128TOS       { $$ = PKL_AST_BUILTIN_U128TOS; }
         ;
 
 stmt_decl_list:
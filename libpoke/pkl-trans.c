@@ -55,7 +55,10 @@
             compilation-time: SIZEOF for complete types.  This phase
             is intended to be executed short before code generation.
 
-   `trans4' is executed just before the code generation pass.
+   `trans4' is executed just before the code generation pass.  It
+            marks the calls to small functions that can be inlined,
+            and the accesses in loops that don't need to check the
+            bounds of the accessed arrays and strings.
 
    See the handlers below for details.  */
 
@@ -1048,6 +1051,16 @@ PKL_PHASE_BEGIN_HANDLER (pkl_trans1_ps_array)
 }
 PKL_PHASE_END_HANDLER
 
+/* Annotate return statements with their lexical nest level within
+   the containing function.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_trans1_ps_return_stmt)
+{
+  PKL_AST_RETURN_STMT_FUNCTION_BACK (PKL_PASS_NODE)
+    = PKL_TRANS_FUNCTION_BACK;
+}
+PKL_PHASE_END_HANDLER
+
 /* Compound statements introduce a lexical level.  Update the function
    back.  */
 
@@ -1120,6 +1133,7 @@ struct pkl_phase pkl_phase_trans1 =
    PKL_PHASE_PS_HANDLER (PKL_AST_COMP_STMT, pkl_trans1_ps_comp_stmt),
    PKL_PHASE_PS_HANDLER (PKL_AST_LOOP_STMT_ITERATOR, pkl_trans1_ps_loop_stmt_iterator),
    PKL_PHASE_PS_HANDLER (PKL_AST_LOOP_STMT, pkl_trans1_ps_loop_stmt),
+   PKL_PHASE_PS_HANDLER (PKL_AST_RETURN_STMT, pkl_trans1_ps_return_stmt),
    PKL_PHASE_PS_OP_HANDLER (PKL_AST_OP_ATTR, pkl_trans1_ps_op_attr),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_STRUCT, pkl_trans1_ps_type_struct),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_FUNCTION, pkl_trans1_ps_type_function),
@@ -1425,8 +1439,561 @@ struct pkl_phase pkl_phase_trans3 =
 
 
 
+/* Return whether values of type TYPE are handled by the simple
+   operations below.  */
+
+static int
+pkl_trans4_simple_type_p (pkl_ast_node type)
+{
+  int type_code = PKL_AST_TYPE_CODE (type);
+
+  return (type_code == PKL_TYPE_INTEGRAL
+          || type_code == PKL_TYPE_OFFSET
+          || type_code == PKL_TYPE_STRING);
+}
+
+/* Return whether the expression EXP is a simple operation, i.e. an
+   arithmetic, relational or logical operation on integral, offset or
+   string operands.  The code generated for these operations doesn't
+   run any other code.  Operations on complex values, on the contrary,
+   may need to compile closures in the current environment.  */
+
+static int
+pkl_trans4_simple_exp_p (pkl_ast_node exp)
+{
+  int i;
+
+  switch (PKL_AST_EXP_CODE (exp))
+    {
+    case PKL_AST_OP_OR:
+    case PKL_AST_OP_IOR:
+    case PKL_AST_OP_XOR:
+    case PKL_AST_OP_AND:
+    case PKL_AST_OP_BAND:
+    case PKL_AST_OP_EQ:
+    case PKL_AST_OP_NE:
+    case PKL_AST_OP_SL:
+    case PKL_AST_OP_SR:
+    case PKL_AST_OP_ADD:
+    case PKL_AST_OP_SUB:
+    case PKL_AST_OP_MUL:
+    case PKL_AST_OP_DIV:
+    case PKL_AST_OP_CEILDIV:
+    case PKL_AST_OP_MOD:
+    case PKL_AST_OP_LT:
+    case PKL_AST_OP_GT:
+    case PKL_AST_OP_LE:
+    case PKL_AST_OP_GE:
+    case PKL_AST_OP_SCONC:
+    case PKL_AST_OP_BCONC:
+    case PKL_AST_OP_POS:
+    case PKL_AST_OP_NEG:
+    case PKL_AST_OP_BNOT:
+    case PKL_AST_OP_NOT:
+      break;
+    default:
+      return 0;
+    }
+
+  for (i = 0; i < PKL_AST_EXP_NUMOPS (exp); ++i)
+    if (!pkl_trans4_simple_type_p (PKL_AST_TYPE (PKL_AST_EXP_OPERAND (exp, i))))
+      return 0;
+
+  return 1;
+}
+
+/* Return the size in AST nodes of the expression EXP in the body of
+   the function FUNC, or -1 if EXP can't be inlined in the callers of
+   FUNC.
+
+   The inlined expression is evaluated in a copy of the environment
+   of FUNC built in the caller, holding just the arguments, so EXP can
+   only refer to the arguments of FUNC, or to the fields of the
+   implicit struct if FUNC is a method.  Calls to other functions are
+   not inlined, and so neither are recursive functions.  */
+
+static int
+pkl_trans4_inline_size (pkl_ast_node func, pkl_ast_node exp)
+{
+  int size = 1, op_size, i;
+
+  switch (PKL_AST_CODE (exp))
+    {
+    case PKL_AST_INTEGER:
+    case PKL_AST_STRING:
+      break;
+    case PKL_AST_VAR:
+      {
+        pkl_ast_node decl = PKL_AST_VAR_DECL (exp);
+
+        /* Inside the body of FUNC, the arguments are in the
+           environment frame right before the one of the body.  */
+        if (PKL_AST_VAR_FUNCTION (exp) != func
+            || PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_VAR)
+          return -1;
+
+        if (PKL_AST_DECL_STRUCT_FIELD_P (decl))
+          {
+            if (!PKL_AST_FUNC_METHOD_P (func)
+                || PKL_AST_VAR_FUNCTION_BACK (exp) != 1)
+              return -1;
+          }
+        else if (PKL_AST_VAR_BACK (exp) != 1
+                 || PKL_AST_DECL_UNBOXED_OFFSET_P (decl))
+          return -1;
+        break;
+      }
+    case PKL_AST_EXP:
+      if (!pkl_trans4_simple_exp_p (exp))
+        return -1;
+
+      for (i = 0; i < PKL_AST_EXP_NUMOPS (exp); ++i)
+        {
+          op_size = pkl_trans4_inline_size (func, PKL_AST_EXP_OPERAND (exp, i));
+          if (op_size == -1)
+            return -1;
+          size += op_size;
+        }
+      break;
+    case PKL_AST_COND_EXP:
+      {
+        pkl_ast_node ops[3];
+
+        ops[0] = PKL_AST_COND_EXP_COND (exp);
+        ops[1] = PKL_AST_COND_EXP_THENEXP (exp);
+        ops[2] = PKL_AST_COND_EXP_ELSEEXP (exp);
+
+        for (i = 0; i < 3; ++i)
+          {
+            op_size = pkl_trans4_inline_size (func, ops[i]);
+            if (op_size == -1)
+              return -1;
+            size += op_size;
+          }
+        break;
+      }
+    case PKL_AST_STRUCT_REF:
+      if (PKL_AST_TYPE_CODE (PKL_AST_TYPE (exp)) == PKL_TYPE_FUNCTION
+          || (op_size
+              = pkl_trans4_inline_size (func,
+                                        PKL_AST_STRUCT_REF_STRUCT (exp))) == -1)
+        return -1;
+      size += op_size;
+      break;
+    case PKL_AST_OFFSET:
+      if (PKL_AST_CODE (PKL_AST_OFFSET_UNIT (exp)) != PKL_AST_INTEGER
+          || (op_size
+              = pkl_trans4_inline_size (func,
+                                        PKL_AST_OFFSET_MAGNITUDE (exp))) == -1)
+        return -1;
+      size += op_size + 1;
+      break;
+    case PKL_AST_INDEXER:
+      {
+        int entity_size
+          = pkl_trans4_inline_size (func, PKL_AST_INDEXER_ENTITY (exp));
+        int index_size
+          = pkl_trans4_inline_size (func, PKL_AST_INDEXER_INDEX (exp));
+
+        if (entity_size == -1 || index_size == -1)
+          return -1;
+        size += entity_size + index_size;
+        break;
+      }
+    case PKL_AST_CAST:
+      {
+        pkl_ast_node cast_exp = PKL_AST_CAST_EXP (exp);
+
+        /* Casts to and from other types may also need closures.  */
+        if (PKL_AST_TYPE_CODE (PKL_AST_TYPE (exp)) != PKL_TYPE_INTEGRAL
+            || PKL_AST_TYPE_CODE (PKL_AST_TYPE (cast_exp)) != PKL_TYPE_INTEGRAL
+            || (op_size = pkl_trans4_inline_size (func, cast_exp)) == -1)
+          return -1;
+        size += op_size;
+        break;
+      }
+    default:
+      return -1;
+    }
+
+  return size;
+}
+
+/* Calls to small functions whose body is just a return statement
+   are marked to be inlined by gen, if the called function is known
+   at compile-time: the function is referred to by the name of its
+   declaration, or it is a method.
+
+   Since the value of a function variable can be changed by an
+   assignment, gen still checks at run-time that the called closure
+   is the expected one, and performs a regular call otherwise.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_trans4_ps_funcall)
+{
+  pkl_ast_node funcall = PKL_PASS_NODE;
+  pkl_ast_node function = PKL_AST_FUNCALL_FUNCTION (funcall);
+  int threshold = PKL_TRANS_PAYLOAD->inline_threshold;
+  pkl_ast_node func = NULL, body, stmt, arg;
+  int size;
+
+  if (threshold == 0)
+    PKL_PASS_DONE;
+
+  /* Find the called function.  */
+  if (PKL_AST_CODE (function) == PKL_AST_VAR)
+    {
+      pkl_ast_node decl = PKL_AST_VAR_DECL (function);
+
+      if (PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_FUNC)
+        func = PKL_AST_DECL_INITIAL (decl);
+    }
+  else if (PKL_AST_CODE (function) == PKL_AST_STRUCT_REF)
+    {
+      pkl_ast_node struct_type
+        = PKL_AST_TYPE (PKL_AST_STRUCT_REF_STRUCT (function));
+      pkl_ast_node identifier = PKL_AST_STRUCT_REF_IDENTIFIER (function);
+      pkl_ast_node elem;
+
+      if (PKL_AST_TYPE_CODE (struct_type) != PKL_TYPE_STRUCT)
+        PKL_PASS_DONE;
+
+      for (elem = PKL_AST_TYPE_S_ELEMS (struct_type);
+           elem;
+           elem = PKL_AST_CHAIN (elem))
+        if (PKL_AST_CODE (elem) == PKL_AST_DECL
+            && PKL_AST_DECL_KIND (elem) == PKL_AST_DECL_KIND_FUNC
+            && STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (elem)),
+                      PKL_AST_IDENTIFIER_POINTER (identifier)))
+          {
+            func = PKL_AST_DECL_INITIAL (elem);
+            break;
+          }
+    }
+
+  if (func == NULL
+      || PKL_AST_CODE (func) != PKL_AST_FUNC
+      || PKL_AST_FUNC_MEMO_P (func)
+      || PKL_AST_FUNC_FIRST_OPT_ARG (func)
+      || PKL_AST_TYPE_F_VARARG (PKL_AST_TYPE (func))
+      || PKL_AST_TYPE_CODE (PKL_AST_FUNC_RET_TYPE (func)) == PKL_TYPE_ARRAY)
+    PKL_PASS_DONE;
+
+  /* Array arguments are converted to the type of the formal in the
+     environment of the function.  */
+  for (arg = PKL_AST_FUNC_ARGS (func); arg; arg = PKL_AST_CHAIN (arg))
+    if (PKL_AST_TYPE_CODE (PKL_AST_FUNC_ARG_TYPE (arg)) == PKL_TYPE_ARRAY)
+      PKL_PASS_DONE;
+
+  body = PKL_AST_FUNC_BODY (func);
+  if (PKL_AST_COMP_STMT_BUILTIN (body) != PKL_AST_BUILTIN_NONE)
+    PKL_PASS_DONE;
+
+  stmt = PKL_AST_COMP_STMT_STMTS (body);
+  if (stmt == NULL
+      || PKL_AST_CHAIN (stmt) != NULL
+      || PKL_AST_CODE (stmt) != PKL_AST_RETURN_STMT
+      || PKL_AST_RETURN_STMT_EXP (stmt) == NULL
+      || PKL_AST_RETURN_STMT_NDROPS (stmt) != 0)
+    PKL_PASS_DONE;
+
+  size = pkl_trans4_inline_size (func, PKL_AST_RETURN_STMT_EXP (stmt));
+  if (size != -1 && size <= threshold)
+    PKL_AST_FUNCALL_INLINE (funcall) = func;
+}
+PKL_PHASE_END_HANDLER
+
+/* Context of the analysis of the body of an indexed loop like:
+
+     for (var i = 0; i < s'length; i++) ... s[i] ...
+
+   ARRAY_DECL and INDEX_DECL are the declarations of the indexed
+   variable and of the index.  If MARK_P is set, the indexers
+   ARRAY[INDEX] in the body are marked to be performed without
+   checking the bounds.  */
+
+struct pkl_trans4_bounds
+{
+  pkl_ast_node array_decl;
+  pkl_ast_node index_decl;
+  int mark_p;
+};
+
+/* Return whether the expression EXP is a reference to the variable
+   declared by DECL, maybe converted to uint<64>.  */
+
+static int
+pkl_trans4_index_p (pkl_ast_node exp, pkl_ast_node decl)
+{
+  pkl_ast_node type = PKL_AST_TYPE (exp);
+
+  if (PKL_AST_TYPE_CODE (type) != PKL_TYPE_INTEGRAL
+      || PKL_AST_TYPE_I_SIZE (type) != 64
+      || PKL_AST_TYPE_I_SIGNED_P (type))
+    return 0;
+
+  if (PKL_AST_CODE (exp) == PKL_AST_CAST)
+    exp = PKL_AST_CAST_EXP (exp);
+
+  return (PKL_AST_CODE (exp) == PKL_AST_VAR
+          && PKL_AST_VAR_DECL (exp) == decl);
+}
+
+/* Return whether the variable referred by the VAR node VAR can be
+   assigned in the body of a loop analyzed with BOUNDS.  Assigning a
+   field of the implicit struct of a method may write to IO.  */
+
+static int
+pkl_trans4_assignable_p (pkl_ast_node var, struct pkl_trans4_bounds *bounds)
+{
+  pkl_ast_node decl;
+
+  if (PKL_AST_CODE (var) != PKL_AST_VAR)
+    return 0;
+
+  decl = PKL_AST_VAR_DECL (var);
+  return (PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_VAR
+          && !PKL_AST_DECL_STRUCT_FIELD_P (decl)
+          && (bounds == NULL
+              || (decl != bounds->array_decl
+                  && decl != bounds->index_decl)));
+}
+
+static int pkl_trans4_pure_p (pkl_ast_node node,
+                              struct pkl_trans4_bounds *bounds);
+
+static int
+pkl_trans4_pure_chain_p (pkl_ast_node chain,
+                         struct pkl_trans4_bounds *bounds)
+{
+  for (; chain; chain = PKL_AST_CHAIN (chain))
+    if (!pkl_trans4_pure_p (chain, bounds))
+      return 0;
+  return 1;
+}
+
+/* Return whether executing the statement or expression NODE can't
+   run code written by the user, like functions or the mappers and
+   constraints of mapped values, and can't change the size of any
+   array.  The bounds of the elements already accessed are then still
+   valid after executing NODE.
+
+   This is a conservative approximation: only the constructions
+   listed below are recognized.  Note that references to variables
+   holding arrays and structs are not recognized, since the values
+   may be remapped.
+
+   If BOUNDS is not NULL, it describes the indexed loop whose body
+   contains NODE.  See above.  */
+
+static int
+pkl_trans4_pure_p (pkl_ast_node node, struct pkl_trans4_bounds *bounds)
+{
+  int i;
+
+  switch (PKL_AST_CODE (node))
+    {
+    case PKL_AST_INTEGER:
+    case PKL_AST_STRING:
+    case PKL_AST_NULL_STMT:
+    case PKL_AST_BREAK_STMT:
+    case PKL_AST_CONTINUE_STMT:
+      return 1;
+    case PKL_AST_VAR:
+      {
+        pkl_ast_node decl = PKL_AST_VAR_DECL (node);
+        int type_code = PKL_AST_TYPE_CODE (PKL_AST_TYPE (node));
+
+        return (PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_VAR
+                && type_code != PKL_TYPE_ARRAY
+                && type_code != PKL_TYPE_STRUCT);
+      }
+    case PKL_AST_EXP:
+      if (!pkl_trans4_simple_exp_p (node))
+        return 0;
+      for (i = 0; i < PKL_AST_EXP_NUMOPS (node); ++i)
+        if (!pkl_trans4_pure_p (PKL_AST_EXP_OPERAND (node, i), bounds))
+          return 0;
+      return 1;
+    case PKL_AST_COND_EXP:
+      return (pkl_trans4_pure_p (PKL_AST_COND_EXP_COND (node), bounds)
+              && pkl_trans4_pure_p (PKL_AST_COND_EXP_THENEXP (node), bounds)
+              && pkl_trans4_pure_p (PKL_AST_COND_EXP_ELSEEXP (node), bounds));
+    case PKL_AST_CAST:
+      {
+        pkl_ast_node cast_exp = PKL_AST_CAST_EXP (node);
+
+        return (PKL_AST_TYPE_CODE (PKL_AST_TYPE (node)) == PKL_TYPE_INTEGRAL
+                && PKL_AST_TYPE_CODE (PKL_AST_TYPE (cast_exp)) == PKL_TYPE_INTEGRAL
+                && pkl_trans4_pure_p (cast_exp, bounds));
+      }
+    case PKL_AST_OFFSET:
+      return (PKL_AST_CODE (PKL_AST_OFFSET_UNIT (node)) == PKL_AST_INTEGER
+              && pkl_trans4_pure_p (PKL_AST_OFFSET_MAGNITUDE (node), bounds));
+    case PKL_AST_INDEXER:
+      {
+        pkl_ast_node entity = PKL_AST_INDEXER_ENTITY (node);
+        pkl_ast_node index = PKL_AST_INDEXER_INDEX (node);
+
+        if (bounds
+            && PKL_AST_CODE (entity) == PKL_AST_VAR
+            && PKL_AST_VAR_DECL (entity) == bounds->array_decl
+            && pkl_trans4_index_p (index, bounds->index_decl))
+          {
+            if (bounds->mark_p)
+              PKL_AST_INDEXER_NO_BOUNDS_CHECK_P (node) = 1;
+            return 1;
+          }
+
+        return (PKL_AST_TYPE_CODE (PKL_AST_TYPE (entity)) == PKL_TYPE_STRING
+                && pkl_trans4_pure_p (entity, bounds)
+                && pkl_trans4_pure_p (index, bounds));
+      }
+    case PKL_AST_INCRDECR:
+      {
+        pkl_ast_node exp = PKL_AST_INCRDECR_EXP (node);
+
+        return (pkl_trans4_assignable_p (exp, bounds)
+                && pkl_trans4_pure_p (exp, bounds));
+      }
+    case PKL_AST_ASS_STMT:
+      return (pkl_trans4_assignable_p (PKL_AST_ASS_STMT_LVALUE (node), bounds)
+              && pkl_trans4_pure_p (PKL_AST_ASS_STMT_EXP (node), bounds));
+    case PKL_AST_EXP_STMT:
+      return pkl_trans4_pure_p (PKL_AST_EXP_STMT_EXP (node), bounds);
+    case PKL_AST_COMP_STMT:
+      return (PKL_AST_COMP_STMT_BUILTIN (node) == PKL_AST_BUILTIN_NONE
+              && pkl_trans4_pure_chain_p (PKL_AST_COMP_STMT_STMTS (node),
+                                          bounds));
+    case PKL_AST_IF_STMT:
+      return (pkl_trans4_pure_p (PKL_AST_IF_STMT_EXP (node), bounds)
+              && pkl_trans4_pure_p (PKL_AST_IF_STMT_THEN_STMT (node), bounds)
+              && (PKL_AST_IF_STMT_ELSE_STMT (node) == NULL
+                  || pkl_trans4_pure_p (PKL_AST_IF_STMT_ELSE_STMT (node),
+                                        bounds)));
+    case PKL_AST_RETURN_STMT:
+      return (PKL_AST_RETURN_STMT_EXP (node) == NULL
+              || pkl_trans4_pure_p (PKL_AST_RETURN_STMT_EXP (node), bounds));
+    case PKL_AST_PRINT_STMT:
+      {
+        pkl_ast_node arg;
+
+        /* Printing other values may call pretty-printers.  */
+        for (arg = PKL_AST_PRINT_STMT_ARGS (node); arg;
+             arg = PKL_AST_CHAIN (arg))
+          {
+            pkl_ast_node exp = PKL_AST_PRINT_STMT_ARG_EXP (arg);
+
+            if (exp
+                && (!pkl_trans4_simple_type_p (PKL_AST_TYPE (exp))
+                    || !pkl_trans4_pure_p (exp, bounds)))
+              return 0;
+          }
+        return 1;
+      }
+    case PKL_AST_DECL:
+      return (PKL_AST_DECL_KIND (node) == PKL_AST_DECL_KIND_VAR
+              && pkl_trans4_pure_p (PKL_AST_DECL_INITIAL (node), bounds));
+    case PKL_AST_LOOP_STMT:
+      {
+        pkl_ast_node iterator = PKL_AST_LOOP_STMT_ITERATOR (node);
+        pkl_ast_node condition = PKL_AST_LOOP_STMT_CONDITION (node);
+
+        return ((iterator == NULL
+                 || pkl_trans4_pure_p (PKL_AST_LOOP_STMT_ITERATOR_CONTAINER (iterator),
+                                       bounds))
+                && pkl_trans4_pure_chain_p (PKL_AST_LOOP_STMT_HEAD (node),
+                                            bounds)
+                && (condition == NULL
+                    || pkl_trans4_pure_p (condition, bounds))
+                && pkl_trans4_pure_chain_p (PKL_AST_LOOP_STMT_TAIL (node),
+                                            bounds)
+                && pkl_trans4_pure_p (PKL_AST_LOOP_STMT_BODY (node), bounds));
+      }
+    default:
+      return 0;
+    }
+}
+
+/* The elements of the container of a for-in loop are accessed
+   without checking the bounds if the body of the loop can't change
+   the size of the container.  Strings are immutable, so this is
+   always the case when iterating over a string.
+
+   Likewise for the accesses s[i] in the body of a loop whose
+   condition is i < s'length, for a string s.  Arrays are not
+   optimized in this case, because every reference to an array
+   variable may remap its value.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_trans4_ps_loop_stmt)
+{
+  pkl_ast_node loop_stmt = PKL_PASS_NODE;
+  pkl_ast_node condition = PKL_AST_LOOP_STMT_CONDITION (loop_stmt);
+  pkl_ast_node body = PKL_AST_LOOP_STMT_BODY (loop_stmt);
+
+  switch (PKL_AST_LOOP_STMT_KIND (loop_stmt))
+    {
+    case PKL_AST_LOOP_STMT_KIND_FOR_IN:
+      {
+        pkl_ast_node iterator = PKL_AST_LOOP_STMT_ITERATOR (loop_stmt);
+        pkl_ast_node container
+          = PKL_AST_LOOP_STMT_ITERATOR_CONTAINER (iterator);
+
+        if (PKL_AST_TYPE_CODE (PKL_AST_TYPE (container)) == PKL_TYPE_STRING
+            || ((condition == NULL || pkl_trans4_pure_p (condition, NULL))
+                && pkl_trans4_pure_p (body, NULL)))
+          PKL_AST_LOOP_STMT_NO_BOUNDS_CHECK_P (loop_stmt) = 1;
+        break;
+      }
+    case PKL_AST_LOOP_STMT_KIND_FOR:
+      {
+        struct pkl_trans4_bounds bounds;
+        pkl_ast_node index, length, array;
+
+        if (condition == NULL
+            || PKL_AST_CODE (condition) != PKL_AST_EXP
+            || PKL_AST_EXP_CODE (condition) != PKL_AST_OP_LT)
+          break;
+
+        index = PKL_AST_EXP_OPERAND (condition, 0);
+        length = PKL_AST_EXP_OPERAND (condition, 1);
+        if (PKL_AST_CODE (length) != PKL_AST_EXP
+            || PKL_AST_EXP_CODE (length) != PKL_AST_OP_ATTR
+            || PKL_AST_EXP_ATTR (length) != PKL_AST_ATTR_LENGTH)
+          break;
+
+        array = PKL_AST_EXP_OPERAND (length, 0);
+        if (PKL_AST_CODE (array) != PKL_AST_VAR
+            || PKL_AST_TYPE_CODE (PKL_AST_TYPE (array)) != PKL_TYPE_STRING)
+          break;
+
+        if (PKL_AST_CODE (index) == PKL_AST_CAST)
+          index = PKL_AST_CAST_EXP (index);
+        if (PKL_AST_CODE (index) != PKL_AST_VAR
+            || !pkl_trans4_index_p (PKL_AST_EXP_OPERAND (condition, 0),
+                                    PKL_AST_VAR_DECL (index)))
+          break;
+
+        bounds.array_decl = PKL_AST_VAR_DECL (array);
+        bounds.index_decl = PKL_AST_VAR_DECL (index);
+        bounds.mark_p = 0;
+
+        if (pkl_trans4_pure_p (body, &bounds))
+          {
+            bounds.mark_p = 1;
+            pkl_trans4_pure_p (body, &bounds);
+          }
+        break;
+      }
+    default:
+      break;
+    }
+}
+PKL_PHASE_END_HANDLER
+
 struct pkl_phase pkl_phase_trans4 =
   {
    PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_trans_ps_src),
    PKL_PHASE_PR_HANDLER (PKL_AST_PROGRAM, pkl_trans_pr_program),
+   PKL_PHASE_PS_HANDLER (PKL_AST_FUNCALL, pkl_trans4_ps_funcall),
+   PKL_PHASE_PS_HANDLER (PKL_AST_LOOP_STMT, pkl_trans4_ps_loop_stmt),
   };
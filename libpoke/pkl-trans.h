@@ -36,7 +36,11 @@
    depth relative to the current function.
 
    NEXT_FUNCTION - 1 is the index for the enclosing function in
-   FUNCTIONS.  NEXT_FUNCTION is 0 if not in a function.  */
+   FUNCTIONS.  NEXT_FUNCTION is 0 if not in a function.
+
+   INLINE_THRESHOLD is the maximum size, in AST nodes, of the body
+   of the functions whose calls are inlined.  0 means no calls are
+   inlined.  This is used in trans4.  */
 
 #define PKL_TRANS_MAX_FUNCTION_NEST 32
 
@@ -47,6 +51,7 @@ struct pkl_trans_payload
   pkl_ast_node functions[PKL_TRANS_MAX_FUNCTION_NEST];
   int function_back[PKL_TRANS_MAX_FUNCTION_NEST];
   int next_function;
+  int inline_threshold;
 };
 
 typedef struct pkl_trans_payload *pkl_trans_payload;
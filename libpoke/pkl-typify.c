@@ -193,6 +193,8 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_op_rela)
         break;
       }
     case PKL_TYPE_ANY:
+      /* Fallthrough.  */
+    case PKL_TYPE_DICT:
       goto invalid_operands;
       break;
     default:
@@ -977,7 +979,11 @@ PKL_PHASE_END_HANDLER
 /* The type of an included operation IN is a boolean.  The right
    operator shall be an array, and the type of the left operator shall
    be promoteable to the type of the elements in the array.  Also the
-   left type should allow testing for equality.  */
+   left type should allow testing for equality.
+
+   The right operator can also be a dict, in which case the type of
+   the left operator shall be promoteable to the type of the keys of
+   the dict.  */
 
 PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_op_in)
 {
@@ -987,19 +993,22 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_op_in)
   pkl_ast_node t1 = PKL_AST_TYPE (op1);
   pkl_ast_node t2 = PKL_AST_TYPE (op2);
 
-  pkl_ast_node exp_type;
+  pkl_ast_node exp_type, etype;
 
-  if (PKL_AST_TYPE_CODE (t2) != PKL_TYPE_ARRAY)
+  if (PKL_AST_TYPE_CODE (t2) == PKL_TYPE_ARRAY)
+    etype = PKL_AST_TYPE_A_ETYPE (t2);
+  else if (PKL_AST_TYPE_CODE (t2) == PKL_TYPE_DICT)
+    etype = PKL_AST_TYPE_D_KTYPE (t2);
+  else
     {
       PKL_ERROR (PKL_AST_LOC (op2),
                  "operator has the wrong type\n\
-expected array");
+expected array or dict");
       PKL_TYPIFY_PAYLOAD->errors++;
       PKL_PASS_ERROR;
     }
 
-  if (!pkl_ast_type_promoteable_p (t1,
-                                   PKL_AST_TYPE_A_ETYPE (t2),
+  if (!pkl_ast_type_promoteable_p (t1, etype,
                                    0 /* promote_array_of_any */))
     {
       char *t1_str = pkl_type_str (t1, 1);
@@ -1279,6 +1288,31 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_indexer)
       type
         = PKL_AST_TYPE_A_ETYPE (container_type);
       break;
+    case PKL_TYPE_DICT:
+      {
+        /* The type of the indexer is the type of the values of the
+           dict, and the index is a key.  */
+        pkl_ast_node ktype = PKL_AST_TYPE_D_KTYPE (container_type);
+
+        if (!pkl_ast_type_promoteable_p (index_type, ktype,
+                                         0 /* promote_array_of_any */))
+          {
+            char *expected_type = pkl_type_str (ktype, 1);
+            char *found_type = pkl_type_str (index_type, 1);
+
+            PKL_ERROR (PKL_AST_LOC (index),
+                       "invalid key in dict\n\
+expected %s, got %s",
+                       expected_type, found_type);
+            free (expected_type);
+            free (found_type);
+            PKL_TYPIFY_PAYLOAD->errors++;
+            PKL_PASS_ERROR;
+          }
+
+        PKL_AST_TYPE (indexer) = ASTREF (PKL_AST_TYPE_D_VTYPE (container_type));
+        PKL_PASS_DONE;
+      }
     case PKL_TYPE_STRING:
       {
         /* The type of the indexer is a `char', i.e. a uint<8>.  */
@@ -1288,7 +1322,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_indexer)
       }
     default:
       PKL_ERROR (PKL_AST_LOC (container),
-                 "operator to [] must be an array or a string");
+                 "operator to [] must be an array, a string or a dict");
       PKL_TYPIFY_PAYLOAD->errors++;
       PKL_PASS_ERROR;
     }
@@ -2082,6 +2116,10 @@ expected %s, got %s",
 
       PKL_AST_CONS_KIND (cons) = PKL_AST_CONS_KIND_ARRAY;
       break;
+    case PKL_TYPE_DICT:
+      /* Dicts are always created empty.  */
+      PKL_AST_CONS_KIND (cons) = PKL_AST_CONS_KIND_DICT;
+      break;
     default:
       assert (0);
     }
@@ -2442,12 +2480,14 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_attr)
       PKL_AST_TYPE (exp) = ASTREF (exp_type);
       break;
     case PKL_AST_ATTR_LENGTH:
-      /* 'length is defined for array, struct and string values.  */
+      /* 'length is defined for array, struct, string and dict
+         values.  */
       switch (PKL_AST_TYPE_CODE (operand_type))
         {
         case PKL_TYPE_ARRAY:
         case PKL_TYPE_STRUCT:
         case PKL_TYPE_STRING:
+        case PKL_TYPE_DICT:
           break;
         default:
           goto invalid_attribute;
@@ -2492,6 +2532,22 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_attr)
       exp_type = pkl_ast_make_integral_type (PKL_PASS_AST, 32, 1);
       PKL_AST_TYPE (exp) = ASTREF (exp_type);
       break;
+    case PKL_AST_ATTR_KEYS:
+    case PKL_AST_ATTR_VALUES:
+      /* 'keys and 'values are defined for dict values.  */
+      if (PKL_AST_TYPE_CODE (operand_type) != PKL_TYPE_DICT)
+        goto invalid_attribute;
+
+      /* The type of 'keys and 'values is an unbounded array of the
+         type of the keys and values of the dict, respectively.  */
+      exp_type = pkl_ast_make_array_type (PKL_PASS_AST,
+                                          (attr == PKL_AST_ATTR_KEYS
+                                           ? PKL_AST_TYPE_D_KTYPE (operand_type)
+                                           : PKL_AST_TYPE_D_VTYPE (operand_type)),
+                                          NULL /* bound */);
+      PKL_AST_LOC (exp_type) = PKL_AST_LOC (exp);
+      PKL_AST_TYPE (exp) = ASTREF (exp_type);
+      break;
     default:
       PKL_ICE (PKL_AST_LOC (exp),
                "unhandled attribute expression code #%d in typify1",
@@ -2570,10 +2626,11 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_struct_type_field)
   pkl_ast_node elem_label
     = PKL_AST_STRUCT_TYPE_FIELD_LABEL (elem);
 
-  /* Any and void types cant appear in the definition of a struct type
-     element.  */
+  /* Any, void and dict types cant appear in the definition of a
+     struct type element.  */
   if (PKL_AST_TYPE_CODE (elem_type) == PKL_TYPE_ANY
-      || PKL_AST_TYPE_CODE (elem_type) == PKL_TYPE_VOID)
+      || PKL_AST_TYPE_CODE (elem_type) == PKL_TYPE_VOID
+      || PKL_AST_TYPE_CODE (elem_type) == PKL_TYPE_DICT)
     {
       PKL_ERROR (PKL_AST_LOC (elem_type),
                  "invalid type in struct field");
@@ -2762,6 +2819,24 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_type_offset)
 }
 PKL_PHASE_END_HANDLER
 
+/* The keys of a dict type shall be either integral or strings.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_typify1_ps_type_dict)
+{
+  pkl_ast_node dict_type = PKL_PASS_NODE;
+  pkl_ast_node ktype = PKL_AST_TYPE_D_KTYPE (dict_type);
+
+  if (PKL_AST_TYPE_CODE (ktype) != PKL_TYPE_INTEGRAL
+      && PKL_AST_TYPE_CODE (ktype) != PKL_TYPE_STRING)
+    {
+      PKL_ERROR (PKL_AST_LOC (ktype),
+                 "keys of dict types shall be integral or strings");
+      PKL_TYPIFY_PAYLOAD->errors++;
+      PKL_PASS_ERROR;
+    }
+}
+PKL_PHASE_END_HANDLER
+
 /* The expression in an `if' statement should evaluate to an integral
    type, as it is expected by the code generator.  */
 
@@ -2929,6 +3004,7 @@ struct pkl_phase pkl_phase_typify1 =
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_ARRAY, pkl_typify1_ps_type_array),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_STRUCT, pkl_typify1_ps_type_struct),
    PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_OFFSET, pkl_typify1_ps_type_offset),
+   PKL_PHASE_PS_TYPE_HANDLER (PKL_TYPE_DICT, pkl_typify1_ps_type_dict),
   };
 
 
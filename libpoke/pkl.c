@@ -26,12 +26,15 @@
 #include <string.h>
 
 #include "basename-lgpl.h"
+#include "timespec.h"
+#include "xalloc.h"
 
 #include "pkt.h"
 #include "pk-utils.h"
 
 #include "pkl.h"
 #include "pvm-val.h"
+#include "pvm-alloc.h"
 
 #include "pkl-ast.h"
 #include "pkl-parser.h"
@@ -44,6 +47,7 @@
 #include "pkl-promo.h"
 #include "pkl-fold.h"
 #include "pkl-env.h"
+#include "pkl-bcache.h"
 
 #define PKL_COMPILING_EXPRESSION 0
 #define PKL_COMPILING_PROGRAM    1
@@ -54,8 +58,34 @@
 
    LEXICAL_CUCKOLDING_P is 1 if alien tokens are to be recognized.
 
+   TIME_PASSES_P is 1 if the compiler shall report the time spent in
+   each compiler pass after every compilation.
+
+   STATS contains the statistics accumulated by the compiler.
+   STAGE_START is the time at which the current compilation stage
+   started.  STAGE_TIMES and BYTES_START are the time spent in each
+   stage and the size of the heap at the beginning of the current
+   compilation.
+
    ALIEN_TOKEN_FN is the user-provided handler for alien tokens.  This
-   field is NULL if the user didn't register a handler.  */
+   field is NULL if the user didn't register a handler.
+
+   CACHE and CACHE_PROGRAMS hold the recently compiled expressions and
+   statements.  See below.  CACHE_TICK is incremented every time the
+   cache is used.  CACHE_DEPTH is the number of cached programs being
+   executed.  */
+
+#define PKL_CACHE_SIZE 16
+
+struct pkl_cache_entry
+{
+  int what;
+  char *source;
+  size_t nchars;
+  size_t num_lookups;
+  struct pkl_env_lookup *lookups;
+  uint64_t last_use;
+};
 
 struct pkl_compiler
 {
@@ -69,14 +99,27 @@ struct pkl_compiler
   char **modules;
   int num_modules;
   int lexical_cuckolding_p;
+  int time_passes_p;
+  int peephole_p;
+  int inline_threshold;
   pkl_alien_token_handler_fn alien_token_fn;
+  struct pkl_compile_stats stats;
+  struct timespec stage_start;
+  double stage_times[PKL_NUM_STAGES];
+  size_t bytes_start;
+  struct pkl_cache_entry cache[PKL_CACHE_SIZE];
+  pvm_program cache_programs[PKL_CACHE_SIZE];
+  uint64_t cache_tick;
+  int cache_depth;
+  pkl_bcache bcache;
 };
 
 pkl_compiler
-pkl_new (pvm vm, const char *rt_path)
+pkl_new (pvm vm, const char *rt_path, const char *cache_dir)
 {
   pkl_compiler compiler
     = calloc (1, sizeof (struct pkl_compiler));
+  char *poke_rt_pk = NULL, *poke_std_pk = NULL;
 
   if (!compiler)
     goto out_of_memory;
@@ -91,54 +134,64 @@ pkl_new (pvm vm, const char *rt_path)
 
   /* Be verbose by default :) */
   compiler->quiet_p = 0;
+  compiler->peephole_p = 1;
+  compiler->inline_threshold = PKL_DEFAULT_INLINE_THRESHOLD;
 
   /* No modules loaded initially.  */
   compiler->modules = NULL;
   compiler->num_modules = 0;
 
-  /* Bootstrap the compiler.  An error bootstraping is an internal
-     error and should be reported as such.  */
-  {
-    char *poke_rt_pk = pk_str_concat (rt_path, "/pkl-rt.pk", NULL);
-    if (!poke_rt_pk)
-      goto out_of_memory;
+  /* The compiler struct is not allocated by the GC, so the cached
+     programs shall be registered as roots.  */
+  pvm_alloc_add_gc_roots (compiler->cache_programs, PKL_CACHE_SIZE);
 
-    if (!pkl_execute_file (compiler, poke_rt_pk, NULL))
-      {
-        free (poke_rt_pk);
+  poke_rt_pk = pk_str_concat (rt_path, "/pkl-rt.pk", NULL);
+  poke_std_pk = pk_str_concat (rt_path, "/std.pk", NULL);
+  if (!poke_rt_pk || !poke_std_pk)
+    goto out_of_memory;
 
-        pk_term_class ("error");
-        pk_puts ("internal error: ");
-        pk_term_end_class ("error");
-        pk_puts ("compiler failed to bootstrap itself\n");
+  /* The code generated for the run-time and the standard library is
+     taken from the bytecode cache, if possible.  */
+  if (cache_dir && *cache_dir)
+    {
+      const char *files[] = { poke_rt_pk, poke_std_pk };
 
-        pkl_free (compiler);
-        return NULL;
-      }
-    free (poke_rt_pk);
+      compiler->bcache = pkl_bcache_open (compiler, cache_dir, files, 2);
+    }
 
-    compiler->bootstrapped = 1;
-  }
+  /* Bootstrap the compiler.  An error bootstraping is an internal
+     error and should be reported as such.  */
+  if (!pkl_execute_file (compiler, poke_rt_pk, NULL))
+    {
+      pk_term_class ("error");
+      pk_puts ("internal error: ");
+      pk_term_end_class ("error");
+      pk_puts ("compiler failed to bootstrap itself\n");
+      goto error;
+    }
 
-  /* Load the standard library.  */
-  {
-    char *poke_std_pk = pk_str_concat (rt_path, "/std.pk", NULL);
-    if (!poke_std_pk)
-      goto out_of_memory;
+  compiler->bootstrapped = 1;
 
-    if (!pkl_execute_file (compiler, poke_std_pk, NULL))
-      {
-        free (poke_std_pk);
-        pkl_free (compiler);
-        return NULL;
-      }
+  /* Load the standard library.  */
+  if (!pkl_execute_file (compiler, poke_std_pk, NULL))
+    goto error;
 
-    free (poke_std_pk);
-  }
+  pkl_bcache_close (compiler->bcache);
+  compiler->bcache = NULL;
 
+  free (poke_rt_pk);
+  free (poke_std_pk);
   return compiler;
 
+error:
+  free (poke_rt_pk);
+  free (poke_std_pk);
+  pkl_free (compiler);
+  return NULL;
+
 out_of_memory:
+  free (poke_rt_pk);
+  free (poke_std_pk);
   if (compiler)
     pkl_free (compiler);
 
@@ -150,11 +203,148 @@ out_of_memory:
   return NULL;
 }
 
+/* Compiling the expressions and statements that the user types in
+   the REPL, or that a client of the MI submits to update its views,
+   is often more expensive than executing them.  Since these are
+   frequently repeated, the compiler keeps a cache of the programs
+   resulting from the last compilations.
+
+   Compiled code only depends on the source text and the top-level
+   declarations it refers to: top-level variables are accessed by
+   their position in the top-level frame, which is not altered by new
+   declarations.  Therefore, a cached program is still valid as long
+   as all the names looked up at the top-level while compiling it
+   resolve to the same declarations.  Redefining any of these names,
+   in any namespace, invalidates the program.
+
+   The cache is not used while lexical cuckolding is in effect, since
+   alien tokens may resolve differently each time.  It is not used
+   either while executing a cached program, so programs are never
+   evicted while running.  */
+
+#define PKL_CACHE_P(COMPILER)                                           \
+  (!((COMPILER)->lexical_cuckolding_p && (COMPILER)->alien_token_fn)    \
+   && (COMPILER)->cache_depth == 0)
+
+/* Run PROGRAM, which is owned by the cache.  */
+
+static int
+pkl_cache_run (pkl_compiler compiler, pvm_program program, pvm_val *val)
+{
+  int status;
+
+  compiler->cache_depth++;
+  status = pvm_run (compiler->vm, program, val);
+  compiler->cache_depth--;
+
+  return status;
+}
+
+static void
+pkl_cache_free_entry (pkl_compiler compiler, int i)
+{
+  struct pkl_cache_entry *entry = &compiler->cache[i];
+
+  free (entry->source);
+  pkl_env_free_lookups (entry->lookups, entry->num_lookups);
+  pvm_destroy_program (compiler->cache_programs[i]);
+  memset (entry, 0, sizeof (struct pkl_cache_entry));
+  compiler->cache_programs[i] = NULL;
+}
+
+/* Return the cached program resulting from the compilation of BUFFER
+   as WHAT, or NULL if there is no such valid program in the cache.
+   If END is not NULL, set it to the end of the source.  */
+
+static pvm_program
+pkl_cache_lookup (pkl_compiler compiler, int what,
+                  const char *buffer, const char **end)
+{
+  int i;
+  size_t j;
+
+  for (i = 0; i < PKL_CACHE_SIZE; i++)
+    {
+      struct pkl_cache_entry *entry = &compiler->cache[i];
+
+      if (entry->source == NULL
+          || entry->what != what
+          || !STREQ (entry->source, buffer))
+        continue;
+
+      for (j = 0; j < entry->num_lookups; j++)
+        {
+          struct pkl_env_lookup *lookup = &entry->lookups[j];
+
+          if (pkl_env_lookup (compiler->env, lookup->namespace,
+                              lookup->name, NULL, NULL) != lookup->decl)
+            break;
+        }
+
+      if (j < entry->num_lookups)
+        {
+          /* The program is stale.  */
+          pkl_cache_free_entry (compiler, i);
+          return NULL;
+        }
+
+      entry->last_use = ++compiler->cache_tick;
+      if (end)
+        *end = buffer + entry->nchars;
+      return compiler->cache_programs[i];
+    }
+
+  return NULL;
+}
+
+/* Add PROGRAM, the result of compiling the first NCHARS characters of
+   BUFFER as WHAT, to the cache.  LOOKUPS are the lookups recorded
+   while compiling it.  The cache takes ownership of both PROGRAM and
+   LOOKUPS, evicting the least recently used entry if needed.  */
+
+static void
+pkl_cache_insert (pkl_compiler compiler, int what,
+                  const char *buffer, size_t nchars, pvm_program program,
+                  struct pkl_env_lookup *lookups, size_t num_lookups)
+{
+  struct pkl_cache_entry *entry;
+  int i, victim = 0;
+
+  for (i = 0; i < PKL_CACHE_SIZE; i++)
+    {
+      if (compiler->cache[i].source == NULL)
+        {
+          victim = i;
+          break;
+        }
+      if (compiler->cache[i].last_use < compiler->cache[victim].last_use)
+        victim = i;
+    }
+
+  if (compiler->cache[victim].source)
+    pkl_cache_free_entry (compiler, victim);
+
+  entry = &compiler->cache[victim];
+  entry->what = what;
+  entry->source = xstrdup (buffer);
+  entry->nchars = nchars;
+  entry->lookups = lookups;
+  entry->num_lookups = num_lookups;
+  entry->last_use = ++compiler->cache_tick;
+  compiler->cache_programs[victim] = program;
+}
+
 void
 pkl_free (pkl_compiler compiler)
 {
   size_t i;
 
+  for (i = 0; i < PKL_CACHE_SIZE; i++)
+    if (compiler->cache[i].source)
+      pkl_cache_free_entry (compiler, i);
+  pvm_alloc_remove_gc_roots (compiler->cache_programs, PKL_CACHE_SIZE);
+
+  pkl_bcache_close (compiler->bcache);
   pkl_env_free (compiler->env);
   for (i = 0; i < compiler->num_modules; ++i)
     free (compiler->modules[i]);
@@ -162,10 +352,70 @@ pkl_free (pkl_compiler compiler)
   free (compiler);
 }
 
+/* The following functions keep the compilation statistics.
+
+   `pkl_begin_compilation' shall be called before parsing.
+
+   `pkl_end_stage' accounts for the time spent since the end of the
+   previous stage in STAGE.
+
+   `pkl_finish_compilation' generates native code for PROGRAM, and
+   then reports the times spent in the compilation stages if the user
+   asked for it.  */
+
+static void
+pkl_begin_compilation (pkl_compiler compiler)
+{
+  memset (compiler->stage_times, 0, sizeof (compiler->stage_times));
+  compiler->bytes_start = pvm_alloc_total_bytes ();
+  compiler->stage_start = current_timespec ();
+}
+
+static void
+pkl_end_stage (pkl_compiler compiler, int stage)
+{
+  struct timespec now = current_timespec ();
+  double elapsed = timespectod (timespec_sub (now, compiler->stage_start));
+
+  compiler->stage_times[stage] += elapsed;
+  compiler->stats.stage_times[stage] += elapsed;
+  compiler->stage_start = now;
+}
+
+static void
+pkl_finish_compilation (pkl_compiler compiler, pvm_program program)
+{
+  static const char *stage_names[] =
+    { "parse", "frontend", "middleend", "backend", "jitter" };
+
+  pvm_program_make_executable (program);
+  pkl_end_stage (compiler, PKL_STAGE_JITTER);
+
+  compiler->stats.compilations++;
+  compiler->stats.bytes_allocated
+    += pvm_alloc_total_bytes () - compiler->bytes_start;
+
+  if (compiler->time_passes_p)
+    {
+      double total = 0;
+      int i;
+
+      pk_puts ("pass times:\n");
+      for (i = 0; i < PKL_NUM_STAGES; i++)
+        {
+          pk_printf ("  %-10s %10.3f ms\n", stage_names[i],
+                     compiler->stage_times[i] * 1000);
+          total += compiler->stage_times[i];
+        }
+      pk_printf ("  %-10s %10.3f ms\n", "total", total * 1000);
+    }
+}
+
 static pvm_program
 rest_of_compilation (pkl_compiler compiler,
                      pkl_ast ast)
 {
+
   struct pkl_gen_payload gen_payload;
 
   struct pkl_anal_payload anal1_payload;
@@ -239,8 +489,11 @@ rest_of_compilation (pkl_compiler compiler,
   pkl_trans_init_payload (&trans2_payload);
   pkl_trans_init_payload (&trans3_payload);
   pkl_trans_init_payload (&trans4_payload);
+  trans4_payload.inline_threshold = compiler->inline_threshold;
   pkl_gen_init_payload (&gen_payload, compiler);
 
+  pkl_end_stage (compiler, PKL_STAGE_PARSE);
+
   if (!pkl_do_pass (compiler, ast,
                     frontend_phases, frontend_payloads, PKL_PASS_F_TYPES, 1))
     goto error;
@@ -255,6 +508,8 @@ rest_of_compilation (pkl_compiler compiler,
       || typify2_payload.errors > 0)
     goto error;
 
+  pkl_end_stage (compiler, PKL_STAGE_FRONTEND);
+
   if (!pkl_do_pass (compiler, ast,
                     middleend_phases, middleend_payloads, PKL_PASS_F_TYPES, 2))
     goto error;
@@ -264,6 +519,22 @@ rest_of_compilation (pkl_compiler compiler,
       || analf_payload.errors > 0)
     goto error;
 
+  pkl_end_stage (compiler, PKL_STAGE_MIDDLEEND);
+
+  if (compiler->bcache)
+    {
+      pvm_program program = pkl_bcache_restore (compiler->bcache, ast);
+
+      if (program)
+        {
+          pkl_end_stage (compiler, PKL_STAGE_BACKEND);
+          compiler->stats.ast_nodes += ast->uid;
+
+          pkl_ast_free (ast);
+          return program;
+        }
+    }
+
   if (!pkl_do_pass (compiler, ast,
                     backend_phases, backend_payloads, 0, 0))
     goto error;
@@ -271,6 +542,11 @@ rest_of_compilation (pkl_compiler compiler,
   if (analf_payload.errors > 0)
     goto error;
 
+  pkl_end_stage (compiler, PKL_STAGE_BACKEND);
+  if (compiler->bcache)
+    pkl_bcache_record (compiler->bcache, ast, gen_payload.program);
+  compiler->stats.ast_nodes += ast->uid;
+
   pkl_ast_free (ast);
   return gen_payload.program;
 
@@ -289,6 +565,7 @@ pkl_execute_buffer (pkl_compiler compiler,
   pkl_env env = NULL;
 
   compiler->compiling = PKL_COMPILING_PROGRAM;
+  pkl_begin_compilation (compiler);
   env = pkl_env_dup_toplevel (compiler->env);
 
   /* Parse the input routine into an AST.  */
@@ -307,7 +584,7 @@ pkl_execute_buffer (pkl_compiler compiler,
     goto error;
 
   //  pvm_disassemble_program (program);
-  pvm_program_make_executable (program);
+  pkl_finish_compilation (compiler, program);
 
   /* Execute the program in the poke vm.  */
   {
@@ -338,14 +615,29 @@ pkl_execute_statement (pkl_compiler compiler,
   pvm_program program;
   int ret;
   pkl_env env = NULL;
+  int num_modules = compiler->num_modules;
+  int cache_p = PKL_CACHE_P (compiler);
+  const char *stmt_end = buffer;
+  struct pkl_env_lookup *lookups;
+  size_t num_lookups;
 
   compiler->compiling = PKL_COMPILING_STATEMENT;
+
+  if (cache_p
+      && (program = pkl_cache_lookup (compiler, PKL_COMPILING_STATEMENT,
+                                      buffer, end)))
+    return pkl_cache_run (compiler, program, val) == PVM_EXIT_OK;
+
+  pkl_begin_compilation (compiler);
   env = pkl_env_dup_toplevel (compiler->env);
+  pkl_env_start_recording (env);
 
   /* Parse the input routine into an AST.  */
   ret = pkl_parse_buffer (compiler, &env, &ast,
                           PKL_PARSE_STATEMENT,
-                          buffer, end);
+                          buffer, &stmt_end);
+  if (end)
+    *end = stmt_end;
   if (ret == 1)
     /* Parse error.  */
     goto error;
@@ -357,13 +649,27 @@ pkl_execute_statement (pkl_compiler compiler,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_finish_compilation (compiler, program);
+
+  /* Statements loading modules alter the environment, and thus can't
+     be cached.  */
+  num_lookups = pkl_env_stop_recording (env, &lookups);
+  cache_p = cache_p && compiler->num_modules == num_modules;
+  if (cache_p)
+    pkl_cache_insert (compiler, PKL_COMPILING_STATEMENT,
+                      buffer, stmt_end - buffer, program,
+                      lookups, num_lookups);
+  else
+    pkl_env_free_lookups (lookups, num_lookups);
 
   /* Execute the routine in the poke vm.  */
-  if (pvm_run (compiler->vm, program, val) != PVM_EXIT_OK)
+  if ((cache_p
+       ? pkl_cache_run (compiler, program, val)
+       : pvm_run (compiler->vm, program, val)) != PVM_EXIT_OK)
     goto error;
 
-  pvm_destroy_program (program);
+  if (!cache_p)
+    pvm_destroy_program (program);
   pkl_env_free (compiler->env);
   compiler->env = env;
   return 1;
@@ -383,6 +689,7 @@ pkl_compile_expression (pkl_compiler compiler,
   pkl_env env = NULL;
 
    compiler->compiling = PKL_COMPILING_EXPRESSION;
+   pkl_begin_compilation (compiler);
    env = pkl_env_dup_toplevel (compiler->env);
 
    /* Parse the input program into an AST.  */
@@ -402,7 +709,7 @@ pkl_compile_expression (pkl_compiler compiler,
 
    pkl_env_free (compiler->env);
    compiler->env = env;
-   pvm_program_make_executable (program);
+   pkl_finish_compilation (compiler, program);
 
   return program;
 
@@ -420,14 +727,28 @@ pkl_execute_expression (pkl_compiler compiler,
   pvm_program program;
   int ret;
   pkl_env env = NULL;
+  int cache_p = PKL_CACHE_P (compiler);
+  const char *exp_end = buffer;
+  struct pkl_env_lookup *lookups;
+  size_t num_lookups;
 
   compiler->compiling = PKL_COMPILING_EXPRESSION;
+
+  if (cache_p
+      && (program = pkl_cache_lookup (compiler, PKL_COMPILING_EXPRESSION,
+                                      buffer, end)))
+    return pkl_cache_run (compiler, program, val) == PVM_EXIT_OK;
+
+  pkl_begin_compilation (compiler);
   env = pkl_env_dup_toplevel (compiler->env);
+  pkl_env_start_recording (env);
 
   /* Parse the input routine into an AST.  */
   ret = pkl_parse_buffer (compiler, &env, &ast,
                           PKL_PARSE_EXPRESSION,
-                          buffer, end);
+                          buffer, &exp_end);
+  if (end)
+    *end = exp_end;
   if (ret == 1)
     /* Parse error.  */
     goto error;
@@ -439,13 +760,24 @@ pkl_execute_expression (pkl_compiler compiler,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_finish_compilation (compiler, program);
+
+  num_lookups = pkl_env_stop_recording (env, &lookups);
+  if (cache_p)
+    pkl_cache_insert (compiler, PKL_COMPILING_EXPRESSION,
+                      buffer, exp_end - buffer, program,
+                      lookups, num_lookups);
+  else
+    pkl_env_free_lookups (lookups, num_lookups);
 
   /* Execute the routine in the poke vm.  */
-  if (pvm_run (compiler->vm, program, val) != PVM_EXIT_OK)
+  if ((cache_p
+       ? pkl_cache_run (compiler, program, val)
+       : pvm_run (compiler->vm, program, val)) != PVM_EXIT_OK)
     goto error;
 
-  pvm_destroy_program (program);
+  if (!cache_p)
+    pvm_destroy_program (program);
   pkl_env_free (compiler->env);
   compiler->env = env;
   return 1;
@@ -466,6 +798,7 @@ pkl_execute_file (pkl_compiler compiler, const char *fname,
   pkl_env env = NULL;
 
   compiler->compiling = PKL_COMPILING_PROGRAM;
+  pkl_begin_compilation (compiler);
 
   fp = fopen (fname, "rb");
   if (!fp)
@@ -489,7 +822,7 @@ pkl_execute_file (pkl_compiler compiler, const char *fname,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_finish_compilation (compiler, program);
   fclose (fp);
 
   /* Execute the program in the poke vm.  */
@@ -518,6 +851,12 @@ pkl_get_env (pkl_compiler compiler)
   return compiler->env;
 }
 
+int
+pkl_keep_programs_p (pkl_compiler compiler)
+{
+  return pkl_bcache_recording_p (compiler->bcache);
+}
+
 int
 pkl_bootstrapped_p (pkl_compiler compiler)
 {
@@ -561,6 +900,84 @@ pkl_set_quiet_p (pkl_compiler compiler, int quiet_p)
   compiler->quiet_p = quiet_p;
 }
 
+const struct pkl_compile_stats *
+pkl_compile_stats (pkl_compiler compiler)
+{
+  return &compiler->stats;
+}
+
+void
+pkl_reset_compile_stats (pkl_compiler compiler)
+{
+  memset (&compiler->stats, 0, sizeof (compiler->stats));
+}
+
+void
+pkl_compile_stats_add_routine (pkl_compiler compiler, size_t num_insns)
+{
+  struct pkl_compile_stats *stats = &compiler->stats;
+
+  stats->routines++;
+  stats->insns += num_insns;
+  if (num_insns > stats->max_routine_insns)
+    stats->max_routine_insns = num_insns;
+}
+
+int
+pkl_time_passes_p (pkl_compiler compiler)
+{
+  return compiler->time_passes_p;
+}
+
+void
+pkl_set_time_passes_p (pkl_compiler compiler, int time_passes_p)
+{
+  compiler->time_passes_p = time_passes_p;
+}
+
+int
+pkl_peephole_p (pkl_compiler compiler)
+{
+  return compiler->peephole_p;
+}
+
+void
+pkl_set_peephole_p (pkl_compiler compiler, int peephole_p)
+{
+  size_t i;
+
+  /* Programs in the cache may have been compiled with a different
+     setting.  */
+  if (peephole_p != compiler->peephole_p && compiler->cache_depth == 0)
+    for (i = 0; i < PKL_CACHE_SIZE; i++)
+      if (compiler->cache[i].source)
+        pkl_cache_free_entry (compiler, i);
+
+  compiler->peephole_p = peephole_p;
+}
+
+int
+pkl_inline_threshold (pkl_compiler compiler)
+{
+  return compiler->inline_threshold;
+}
+
+void
+pkl_set_inline_threshold (pkl_compiler compiler, int inline_threshold)
+{
+  size_t i;
+
+  /* Programs in the cache may have been compiled with a different
+     setting.  */
+  if (inline_threshold != compiler->inline_threshold
+      && compiler->cache_depth == 0)
+    for (i = 0; i < PKL_CACHE_SIZE; i++)
+      if (compiler->cache[i].source)
+        pkl_cache_free_entry (compiler, i);
+
+  compiler->inline_threshold = inline_threshold;
+}
+
 int
 pkl_lexical_cuckolding_p (pkl_compiler compiler)
 {
@@ -588,30 +1005,28 @@ pkl_set_alien_token_fn (pkl_compiler compiler,
 }
 
 pvm_program
-pkl_compile_call (pkl_compiler compiler, pvm_val cls, pvm_val *ret,
-                  va_list ap)
+pkl_compile_call_args (pkl_compiler compiler, pvm_val cls, pvm_val args)
 {
-  pvm_program program;
   pkl_asm pasm;
-  pvm_val arg;
+  uint64_t i, nargs = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (args));
 
   pasm = pkl_asm_new (NULL /* ast */, compiler, 1 /* prologue */);
 
-  /* Push the arguments for the function.  */
-  do
+  /* Push the arguments for the function, fetching them from ARGS at
+     run-time.  */
+  for (i = 0; i < nargs; ++i)
     {
-      arg = va_arg (ap, pvm_val);
-      if (arg != PVM_NULL)
-        pkl_asm_insn (pasm, PKL_INSN_PUSH, arg);
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, args);
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (i, 64));
+      pkl_asm_insn (pasm, PKL_INSN_AREF);
+      pkl_asm_insn (pasm, PKL_INSN_NIP2);
     }
-  while (arg != PVM_NULL);
 
   /* Call the closure.  */
   pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
   pkl_asm_insn (pasm, PKL_INSN_CALL);
 
-  program = pkl_asm_finish (pasm, 1 /* epilogue */);
-  return program;
+  return pkl_asm_finish (pasm, 1 /* epilogue */);
 }
 
 pvm
@@ -769,6 +1184,16 @@ pvm_type_to_ast_type (pkl_ast ast, pvm_val type)
     case PVM_TYPE_ANY:
       return pkl_ast_make_any_type (ast);
       break;
+    case PVM_TYPE_DICT:
+      {
+        pkl_ast_node ktype
+          = pvm_type_to_ast_type (ast, PVM_VAL_TYP_D_KTYPE (type));
+        pkl_ast_node vtype
+          = pvm_type_to_ast_type (ast, PVM_VAL_TYP_D_VTYPE (type));
+
+        return pkl_ast_make_dict_type (ast, ktype, vtype);
+        break;
+      }
     case PVM_TYPE_STRUCT:
       /* XXX writeme */
       assert (0);
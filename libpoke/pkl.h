@@ -74,10 +74,16 @@ typedef struct pkl_compiler *pkl_compiler; /* This data structure is
    RT_PATH should contain the name of a directory where the compiler can
    find its run-time support files.
 
+   CACHE_DIR is the name of the directory where the code generated
+   for the run-time support files is cached, so it is not generated
+   again by the next compilers created with the same files.  If it is
+   NULL or the empty string then the code is not cached.
+
    If there is an error creating the compiler this function returns
    NULL.  */
 
-pkl_compiler pkl_new (pvm vm, const char *rt_path);
+pkl_compiler pkl_new (pvm vm, const char *rt_path,
+                      const char *cache_dir);
 
 void pkl_free (pkl_compiler compiler);
 
@@ -118,21 +124,21 @@ int pkl_execute_statement (pkl_compiler compiler, const char *buffer, const char
 pvm_program pkl_compile_expression (pkl_compiler compiler,
                                     const char *buffer, const char **end);
 
-/* Compile a program that calls to a function.
-
-   CLS is the closure with the function to call.
+/* Compile a program that calls the function in the closure CLS.
+   The arguments to pass to the function are not fixed at
+   compile-time.  Instead, they are fetched from the
+   elements of the array ARGS every time the program is run, so the
+   same program can be executed many times with different arguments
+   by updating the elements of ARGS in between.
 
-   RET is set to the value returned by the function, or to PK_NULL if
-   it is a void function.
-
-   AP contains a list of PVM values to be passed to the function as
-   arguments, terminated by PVM_NULL.
+   The number of arguments is the number of elements in ARGS at the
+   time of compiling the program, and shall not change afterwards.
 
    Return the compiled PVM program, or NULL if there is a problem
    performing the operation.  */
 
-pvm_program pkl_compile_call (pkl_compiler compiler, pvm_val cls, pvm_val *ret,
-                              va_list ap);
+pvm_program pkl_compile_call_args (pkl_compiler compiler, pvm_val cls,
+                                   pvm_val args);
 
 /* Return the VM associated with COMPILER.  */
 
@@ -149,6 +155,14 @@ pkl_env pkl_get_env (pkl_compiler compiler);
 
 int pkl_bootstrapped_p (pkl_compiler compiler);
 
+/* Returns a boolean telling whether the items of the PVM programs
+   assembled by the compiler shall be kept after they are made
+   executable.  This is the case while the code generated for the
+   run-time support files is being recorded in the bytecode
+   cache.  */
+
+int pkl_keep_programs_p (pkl_compiler compiler);
+
 /* Returns a boolean telling whether the compiler is compiling a
    single xexpression or a statement, respectively.  */
 
@@ -172,6 +186,87 @@ int pkl_quiet_p (pkl_compiler compiler);
 
 void pkl_set_quiet_p (pkl_compiler compiler, int quiet_p);
 
+/* The compiler keeps statistics about the compilations it performs,
+   so the time spent in each compilation stage can be tracked.  The
+   stages are: parsing, the front-end pass, the middle-end pass, the
+   back-end pass and the generation of native code for the resulting
+   PVM programs.
+
+   COMPILATIONS is the number of successful compilations.
+
+   STAGE_TIMES contains the wall time spent in each stage, in seconds.
+
+   AST_NODES is the number of AST nodes created.
+
+   ROUTINES is the number of PVM routines assembled.  Every function,
+   mapper, writer, constructor and top-level program is a routine.
+
+   INSNS is the number of PVM instructions emitted, and
+   MAX_ROUTINE_INSNS is the number of instructions in the biggest
+   routine.
+
+   BYTES_ALLOCATED is the number of bytes allocated in the GC heap
+   while compiling.  */
+
+#define PKL_STAGE_PARSE 0
+#define PKL_STAGE_FRONTEND 1
+#define PKL_STAGE_MIDDLEEND 2
+#define PKL_STAGE_BACKEND 3
+#define PKL_STAGE_JITTER 4
+#define PKL_NUM_STAGES 5
+
+struct pkl_compile_stats
+{
+  uint64_t compilations;
+  double stage_times[PKL_NUM_STAGES];
+  uint64_t ast_nodes;
+  uint64_t routines;
+  uint64_t insns;
+  uint64_t max_routine_insns;
+  uint64_t bytes_allocated;
+};
+
+/* Return the statistics accumulated by COMPILER since it was created,
+   or since the last call to `pkl_reset_compile_stats'.  */
+
+const struct pkl_compile_stats *pkl_compile_stats (pkl_compiler compiler);
+
+void pkl_reset_compile_stats (pkl_compiler compiler);
+
+/* Account for a PVM routine of NUM_INSNS instructions assembled by
+   COMPILER.  This is used by the macro-assembler.  */
+
+void pkl_compile_stats_add_routine (pkl_compiler compiler,
+                                    size_t num_insns);
+
+/* Set/get the time_passes_p flag in/from the compiler.  If this flag
+   is set, the compiler reports the time spent in each compiler pass
+   after every compilation.  */
+
+int pkl_time_passes_p (pkl_compiler compiler);
+
+void pkl_set_time_passes_p (pkl_compiler compiler, int time_passes_p);
+
+/* Set/get the peephole_p flag in/from the compiler.  If this flag is
+   set, which is the default, the PVM programs generated by the
+   compiler are optimized with `pvm_program_optimize'.  */
+
+int pkl_peephole_p (pkl_compiler compiler);
+
+void pkl_set_peephole_p (pkl_compiler compiler, int peephole_p);
+
+/* Set/get the inline threshold in/from the compiler.  Calls to
+   functions whose body is a single return statement with an
+   expression of at most this number of AST nodes are inlined.  If
+   the threshold is 0, no calls are inlined.  */
+
+#define PKL_DEFAULT_INLINE_THRESHOLD 16
+
+int pkl_inline_threshold (pkl_compiler compiler);
+
+void pkl_set_inline_threshold (pkl_compiler compiler,
+                               int inline_threshold);
+
 /* Get/install a handler for alien tokens.  */
 
 typedef char *(*pkl_alien_token_handler_fn) (const char *id,
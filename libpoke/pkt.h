@@ -22,20 +22,24 @@
 #include <config.h>
 
 #include "libpoke.h"  /* For struct pk_term_if */
-
-extern struct pk_term_if libpoke_term_if;
-
-#define pk_puts libpoke_term_if.puts_fn
-#define pk_printf libpoke_term_if.printf_fn
-#define pk_term_flush libpoke_term_if.flush_fn
-#define pk_term_indent libpoke_term_if.indent_fn
-#define pk_term_class libpoke_term_if.class_fn
-#define pk_term_end_class libpoke_term_if.end_class_fn
-#define pk_term_hyperlink libpoke_term_if.hyperlink_fn
-#define pk_term_end_hyperlink libpoke_term_if.end_hyperlink_fn
-#define pk_term_get_color libpoke_term_if.get_color_fn
-#define pk_term_set_color libpoke_term_if.set_color_fn
-#define pk_term_get_bgcolor libpoke_term_if.get_bgcolor_fn
-#define pk_term_set_bgcolor libpoke_term_if.set_bgcolor_fn
+#include "pk-thread.h"
+
+/* Terminal interface of the compiler operated by the running thread.
+   See PK_ENTER in libpoke.c.  */
+
+extern PK_THREAD_LOCAL struct pk_term_if *libpoke_term_if;
+
+#define pk_puts libpoke_term_if->puts_fn
+#define pk_printf libpoke_term_if->printf_fn
+#define pk_term_flush libpoke_term_if->flush_fn
+#define pk_term_indent libpoke_term_if->indent_fn
+#define pk_term_class libpoke_term_if->class_fn
+#define pk_term_end_class libpoke_term_if->end_class_fn
+#define pk_term_hyperlink libpoke_term_if->hyperlink_fn
+#define pk_term_end_hyperlink libpoke_term_if->end_hyperlink_fn
+#define pk_term_get_color libpoke_term_if->get_color_fn
+#define pk_term_set_color libpoke_term_if->set_color_fn
+#define pk_term_get_bgcolor libpoke_term_if->get_bgcolor_fn
+#define pk_term_set_bgcolor libpoke_term_if->set_bgcolor_fn
 
 #endif /* ! PKT_H */
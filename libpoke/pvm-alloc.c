@@ -17,10 +17,19 @@
  */
 
 #include <config.h>
+
+#if HAVE_PTHREAD && HAVE_GC_ALLOW_REGISTER_THREADS
+#  define PVM_ALLOC_THREADS 1
+#  define GC_THREADS 1
+#endif
 #include <gc/gc.h>
 
+#include "timespec.h"
+
+#include "pk-thread.h"
 #include "pvm.h"
 #include "pvm-val.h"
+#include "pvm-alloc.h"
 
 void *
 pvm_alloc (size_t size)
@@ -28,6 +37,12 @@ pvm_alloc (size_t size)
   return GC_MALLOC (size);
 }
 
+void *
+pvm_alloc_atomic (size_t size)
+{
+  return GC_MALLOC_ATOMIC (size);
+}
+
 void *
 pvm_realloc (void *ptr, size_t size)
 {
@@ -60,11 +75,113 @@ pvm_alloc_cls (void)
   return cls;
 }
 
+#if PVM_ALLOC_THREADS
+
+/* Threads other than the one that initialized the collector must be
+   registered before allocating collectable memory, and unregistered
+   before they exit.  The latter is done by the destructor of
+   PVM_ALLOC_THREAD_KEY, which is set for every thread registered by
+   pvm_alloc_register_thread.  */
+
+static pthread_key_t pvm_alloc_thread_key;
+static PK_THREAD_LOCAL int pvm_alloc_thread_registered_p;
+PK_ONCE_DEFINE (pvm_alloc_thread_key_once);
+
+static void
+pvm_alloc_unregister_thread (void *data __attribute__ ((unused)))
+{
+  GC_unregister_my_thread ();
+}
+
+static void
+pvm_alloc_create_thread_key (void)
+{
+  pthread_key_create (&pvm_alloc_thread_key, pvm_alloc_unregister_thread);
+}
+
+#endif /* PVM_ALLOC_THREADS */
+
+/* Time spent in collections, in seconds.  They are updated by the
+   collector with the allocation lock held, so they need no further
+   locking.  */
+
+#if HAVE_GC_SET_ON_COLLECTION_EVENT
+static struct timespec pvm_alloc_gc_start;
+static double pvm_alloc_pause_time;
+static double pvm_alloc_max_pause_time;
+
+static void
+pvm_alloc_on_collection_event (GC_EventType event)
+{
+  double pause;
+
+  /* Note that the GC_get_* functions can't be called here.  */
+  switch (event)
+    {
+    case GC_EVENT_START:
+      pvm_alloc_gc_start = current_timespec ();
+      break;
+    case GC_EVENT_END:
+      pause = timespectod (timespec_sub (current_timespec (),
+                                         pvm_alloc_gc_start));
+      pvm_alloc_pause_time += pause;
+      if (pause > pvm_alloc_max_pause_time)
+        pvm_alloc_max_pause_time = pause;
+      break;
+    default:
+      break;
+    }
+}
+
+static void *
+pvm_alloc_get_pause_times (void *data)
+{
+  struct pvm_alloc_stats *stats = data;
+
+  stats->pause_time = pvm_alloc_pause_time;
+  stats->max_pause_time = pvm_alloc_max_pause_time;
+  return NULL;
+}
+#endif
+
 void
 pvm_alloc_initialize ()
 {
-  /* Initialize the Boehm Garbage Collector.  */
+  /* Initialize the Boehm Garbage Collector.  The collector shall
+     stay consistent in the processes forked by pk_compiler_fork.  */
+#if HAVE_GC_SET_HANDLE_FORK
+  GC_set_handle_fork (1);
+#endif
   GC_INIT ();
+#if HAVE_GC_SET_ON_COLLECTION_EVENT
+  GC_set_on_collection_event (pvm_alloc_on_collection_event);
+#endif
+
+#if PVM_ALLOC_THREADS
+  GC_allow_register_threads ();
+  PK_ONCE (pvm_alloc_thread_key_once, pvm_alloc_create_thread_key);
+#endif
+}
+
+void
+pvm_alloc_register_thread (void)
+{
+#if PVM_ALLOC_THREADS
+  struct GC_stack_base sb;
+
+  if (pvm_alloc_thread_registered_p)
+    return;
+  pvm_alloc_thread_registered_p = 1;
+
+  if (GC_thread_is_registered ())
+    return;
+
+  if (GC_get_stack_base (&sb) == GC_SUCCESS)
+    {
+      GC_register_my_thread (&sb);
+      pthread_setspecific (pvm_alloc_thread_key, &pvm_alloc_thread_key);
+    }
+#endif
 }
 
 void
@@ -86,3 +203,55 @@ pvm_alloc_remove_gc_roots (void *pointer, size_t nelems)
   GC_remove_roots (pointer,
                    ((char*) pointer) + sizeof (void*) * nelems);
 }
+
+size_t
+pvm_alloc_total_bytes (void)
+{
+  return GC_get_total_bytes ();
+}
+
+void
+pvm_alloc_enable_incremental (void)
+{
+  GC_enable_incremental ();
+}
+
+int
+pvm_alloc_incremental_p (void)
+{
+  return GC_is_incremental_mode ();
+}
+
+unsigned long
+pvm_alloc_free_space_divisor (void)
+{
+  return GC_get_free_space_divisor ();
+}
+
+void
+pvm_alloc_set_free_space_divisor (unsigned long divisor)
+{
+  GC_set_free_space_divisor (divisor);
+}
+
+void
+pvm_alloc_stats (struct pvm_alloc_stats *stats)
+{
+  stats->heap_size = GC_get_heap_size ();
+  stats->free_bytes = GC_get_free_bytes ();
+  stats->bytes_since_gc = GC_get_bytes_since_gc ();
+  stats->total_bytes = GC_get_total_bytes ();
+  stats->collections = GC_get_gc_no ();
+
+  /* The bytes allocated since the last collection are counted as
+     used, so take them out in order to get what survived it.  */
+  stats->live_bytes = stats->heap_size - stats->free_bytes;
+  stats->live_bytes = (stats->live_bytes > stats->bytes_since_gc
+                       ? stats->live_bytes - stats->bytes_since_gc : 0);
+
+#if HAVE_GC_SET_ON_COLLECTION_EVENT
+  GC_call_with_alloc_lock (pvm_alloc_get_pause_times, stats);
+#else
+  stats->pause_time = stats->max_pause_time = -1;
+#endif
+}
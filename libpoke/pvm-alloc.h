@@ -32,6 +32,14 @@
 void pvm_alloc_initialize (void);
 void pvm_alloc_finalize (void);
 
+/* Register the calling thread in the garbage collector.  This must
+   be called by every thread before it allocates or accesses
+   collectable memory, and it does nothing for threads that are
+   already registered.  Registered threads are unregistered
+   automatically when they exit.  */
+
+void pvm_alloc_register_thread (void);
+
 /* Register/unregister NELEM pointers at POINTER as roots for the
    garbage-collector.  */
 
@@ -46,6 +54,13 @@ void *pvm_alloc (size_t size)
   __attribute__ ((malloc))
   __attribute__ ((alloc_size (1)));
 
+/* Like pvm_alloc, but the allocated memory is not expected to contain
+   pointers to collectable memory, and is not initialized.  */
+
+void *pvm_alloc_atomic (size_t size)
+  __attribute__ ((malloc))
+  __attribute__ ((alloc_size (1)));
+
 /* Reallocate the given pointer to occupy SIZE bytes and return a
    pointer to the allocated memory.  SIZE has the same semantics as in
    realloc(3).  On error, return NULL.  */
@@ -71,4 +86,55 @@ char *pvm_alloc_strdup (const char *string)
 
 void pvm_alloc_gc (void);
 
+/* Return the total number of bytes allocated in the heap since the
+   allocator was initialized.  */
+
+size_t pvm_alloc_total_bytes (void);
+
+/* Enable incremental collection, which splits the marking phase in
+   small steps performed while allocating, instead of stopping the
+   world for a full collection.  Once enabled, incremental collection
+   can't be disabled.  */
+
+void pvm_alloc_enable_incremental (void);
+
+/* Return whether incremental collection is enabled.  */
+
+int pvm_alloc_incremental_p (void);
+
+/* Get and set the heap growth policy.  Once the number of bytes
+   allocated since the last collection exceeds the size of the heap
+   divided by DIVISOR, the collector runs instead of growing the heap.
+   Bigger values mean a smaller heap and more frequent collections.  */
+
+unsigned long pvm_alloc_free_space_divisor (void);
+void pvm_alloc_set_free_space_divisor (unsigned long divisor);
+
+/* Statistics about the garbage-collected heap.
+
+   HEAP_SIZE is the size of the heap in bytes, and FREE_BYTES the
+   number of bytes of it that are free.  BYTES_SINCE_GC is the number
+   of bytes allocated since the last collection, and TOTAL_BYTES the
+   number of bytes allocated since the allocator was initialized.
+   COLLECTIONS is the number of collections performed.
+
+   LIVE_BYTES approximates the number of bytes that survived the last
+   collection.  PAUSE_TIME is the time spent in collections and
+   MAX_PAUSE_TIME the longest of them, in seconds, or -1 if the
+   collector can't report them.  */
+
+struct pvm_alloc_stats
+{
+  size_t heap_size;
+  size_t free_bytes;
+  size_t bytes_since_gc;
+  size_t total_bytes;
+  size_t collections;
+  size_t live_bytes;
+  double pause_time;
+  double max_pause_time;
+};
+
+void pvm_alloc_stats (struct pvm_alloc_stats *stats);
+
 #endif /* ! PVM_ALLOC_H */
@@ -24,6 +24,8 @@
 
 #include "jitter/jitter-print.h"
 
+#include "xalloc.h"
+
 #include "pk-utils.h"
 #include "pkt.h"
 
@@ -35,12 +37,49 @@
 
 #define PVM_PROGRAM_MAX_POINTERS 16
 #define PVM_PROGRAM_MAX_LABELS 8
+#define PVM_PROGRAM_ITEMS_STEP 128
+
+/* The components of a program are not appended to the jitter routine
+   right away.  Instead, they are recorded as a sequence of items that
+   is appended to the routine as a whole, after optionally running a
+   peephole optimizer on it.
+
+   An instruction is an item of kind PVM_PROGRAM_ITEM_INSN followed by
+   the items for its parameters.  Push instructions are recorded in a
+   single item of kind PVM_PROGRAM_ITEM_PUSH.  Items deleted by the
+   optimizer have kind PVM_PROGRAM_ITEM_DELETED.  The kinds of items
+   are defined in pvm.h.  */
+
+struct pvm_program_item
+{
+  enum pvm_program_item_kind kind;
+  union
+  {
+    const char *insn_name;
+    pvm_val val;
+    unsigned int n;
+    pvm_register reg;
+    pvm_program_label label;
+  } u;
+};
 
 struct pvm_program
 {
   /* Jitter routine corresponding to this PVM program.  */
   pvm_routine routine;
 
+  /* Items not yet appended to ROUTINE.  */
+  struct pvm_program_item *items;
+
+  /* Number of items in ITEMS.  */
+  int num_items;
+
+  /* If KEEP_ITEMS_P is set then the items are not discarded once
+     they are appended to ROUTINE.  NUM_FLUSHED is the number of
+     items already appended.  */
+  int keep_items_p;
+  int num_flushed;
+
   /* Jitter labels used in the program.  */
   jitter_label *labels;
 
@@ -53,6 +92,10 @@ struct pvm_program
 
   /* Next available slot in POINTERS.  */
   int next_pointer;
+
+  /* Name of the program and location of its source, or NULL.  */
+  char *name;
+  char *location;
 };
 
 /* Jitter print context to use when disassembling PVM programs.  */
@@ -95,11 +138,76 @@ pvm_program_new (void)
       program->next_pointer = 0;
       program->labels = NULL;
       program->next_label = 0;
+      program->items = NULL;
+      program->num_items = 0;
+      program->keep_items_p = 0;
+      program->num_flushed = 0;
+      program->name = NULL;
+      program->location = NULL;
     }
 
   return program;
 }
 
+/* Return a copy of STR allocated in the GC heap, or NULL if STR is
+   NULL.  */
+
+static char *
+pvm_program_strdup (const char *str)
+{
+  char *copy;
+
+  if (str == NULL)
+    return NULL;
+
+  copy = pvm_alloc_atomic (strlen (str) + 1);
+  strcpy (copy, str);
+  return copy;
+}
+
+void
+pvm_program_set_name (pvm_program program, const char *name,
+                      const char *location)
+{
+  program->name = pvm_program_strdup (name);
+  program->location = pvm_program_strdup (location);
+}
+
+const char *
+pvm_program_name (pvm_program program)
+{
+  return program->name;
+}
+
+const char *
+pvm_program_location (pvm_program program)
+{
+  return program->location;
+}
+
+/* Append a new item of the given KIND to PROGRAM, and return it.  */
+
+static struct pvm_program_item *
+pvm_program_append_item (pvm_program program,
+                         enum pvm_program_item_kind kind)
+{
+  struct pvm_program_item *item;
+
+  if (program->num_items % PVM_PROGRAM_ITEMS_STEP == 0)
+    {
+      size_t size
+        = ((program->num_items + PVM_PROGRAM_ITEMS_STEP)
+           * sizeof (struct pvm_program_item));
+
+      program->items = pvm_realloc (program->items, size);
+      assert (program->items != NULL);
+    }
+
+  item = &program->items[program->num_items++];
+  item->kind = kind;
+  return item;
+}
+
 pvm_program_label
 pvm_program_fresh_label (pvm_program program)
 {
@@ -125,8 +233,7 @@ pvm_program_append_label (pvm_program program,
   if (label >= program->next_label)
     return PVM_EINVAL;
 
-  pvm_routine_append_label (program->routine,
-                            program->labels[label]);
+  pvm_program_append_item (program, PVM_PROGRAM_ITEM_LABEL)->u.label = label;
   return PVM_OK;
 }
 
@@ -139,11 +246,8 @@ pvm_program_append_instruction (pvm_program program,
      limitation in jitter gets fixed.  */
   assert (STRNEQ (insn_name, "push"));
 
-  /* XXX Jitter should provide error codes so we can return PVM_EINVAL
-     and PVM_EINSN properly.  */
-  pvm_routine_append_instruction_name (program->routine,
-                                       insn_name);
-
+  pvm_program_append_item (program,
+                           PVM_PROGRAM_ITEM_INSN)->u.insn_name = insn_name;
   return PVM_OK;
 }
 
@@ -151,10 +255,14 @@ int
 pvm_program_append_push_instruction (pvm_program program,
                                      pvm_val val)
 {
-  pvm_routine routine = program->routine;
-
   collect_value_pointers (program, val);
+  pvm_program_append_item (program, PVM_PROGRAM_ITEM_PUSH)->u.val = val;
+  return PVM_OK;
+}
 
+static void
+pvm_program_emit_push (pvm_routine routine, pvm_val val)
+{
   /* Due to some jitter limitations, we have to do some additional
      work.  */
 
@@ -187,17 +295,13 @@ pvm_program_append_push_instruction (pvm_program program,
   pvm_routine_append_unsigned_literal_parameter (routine,
                                                  (jitter_uint) val);
 #endif
-
-  return PVM_OK;
 }
 
 int
 pvm_program_append_val_parameter (pvm_program program, pvm_val val)
 {
   collect_value_pointers (program, val);
-  pvm_routine_append_unsigned_literal_parameter (program->routine,
-                                                 (jitter_uint) val);
-
+  pvm_program_append_item (program, PVM_PROGRAM_ITEM_VAL_PARAM)->u.val = val;
   return PVM_OK;
 }
 
@@ -205,9 +309,7 @@ int
 pvm_program_append_unsigned_parameter (pvm_program program,
                                        unsigned int n)
 {
-  pvm_routine_append_unsigned_literal_parameter (program->routine,
-                                                 (jitter_uint) n);
-
+  pvm_program_append_item (program, PVM_PROGRAM_ITEM_UNSIGNED_PARAM)->u.n = n;
   return PVM_OK;
 }
 
@@ -215,10 +317,8 @@ int
 pvm_program_append_register_parameter (pvm_program program,
                                        pvm_register reg)
 {
-  /* XXX Jitter should return an error code here so we can return
-     PVM_EINVAL whenever appropriate.  */
-  PVM_ROUTINE_APPEND_REGISTER_PARAMETER (program->routine, r, reg);
-
+  pvm_program_append_item (program,
+                           PVM_PROGRAM_ITEM_REGISTER_PARAM)->u.reg = reg;
   return PVM_OK;
 }
 
@@ -226,23 +326,410 @@ int
 pvm_program_append_label_parameter (pvm_program program,
                                     pvm_program_label label)
 {
-  /* XXX Jitter should return an error code here so we can return
-     PVM_EINVAL whenever appropriate.  */
-  pvm_routine_append_label_parameter (program->routine,
-                                      program->labels[label]);
+  if (label >= program->next_label)
+    return PVM_EINVAL;
 
+  pvm_program_append_item (program,
+                           PVM_PROGRAM_ITEM_LABEL_PARAM)->u.label = label;
   return PVM_OK;
 }
 
+/* Append the pending items of PROGRAM to its jitter routine.  */
+
+static void
+pvm_program_flush (pvm_program program)
+{
+  pvm_routine routine = program->routine;
+  int i;
+
+  for (i = program->num_flushed; i < program->num_items; ++i)
+    {
+      struct pvm_program_item *item = &program->items[i];
+
+      /* XXX Jitter should provide error codes so we can return
+         PVM_EINVAL and PVM_EINSN properly.  */
+      switch (item->kind)
+        {
+        case PVM_PROGRAM_ITEM_DELETED:
+          break;
+        case PVM_PROGRAM_ITEM_LABEL:
+          pvm_routine_append_label (routine,
+                                    program->labels[item->u.label]);
+          break;
+        case PVM_PROGRAM_ITEM_INSN:
+          pvm_routine_append_instruction_name (routine,
+                                               item->u.insn_name);
+          break;
+        case PVM_PROGRAM_ITEM_PUSH:
+          pvm_program_emit_push (routine, item->u.val);
+          break;
+        case PVM_PROGRAM_ITEM_VAL_PARAM:
+          pvm_routine_append_unsigned_literal_parameter (routine,
+                                                         (jitter_uint) item->u.val);
+          break;
+        case PVM_PROGRAM_ITEM_UNSIGNED_PARAM:
+          pvm_routine_append_unsigned_literal_parameter (routine,
+                                                         (jitter_uint) item->u.n);
+          break;
+        case PVM_PROGRAM_ITEM_REGISTER_PARAM:
+          PVM_ROUTINE_APPEND_REGISTER_PARAMETER (routine, r, item->u.reg);
+          break;
+        case PVM_PROGRAM_ITEM_LABEL_PARAM:
+          pvm_routine_append_label_parameter (routine,
+                                              program->labels[item->u.label]);
+          break;
+        default:
+          assert (0);
+        }
+    }
+
+  if (program->keep_items_p)
+    program->num_flushed = program->num_items;
+  else
+    {
+      program->items = NULL;
+      program->num_items = 0;
+    }
+}
+
+void
+pvm_program_keep_items (pvm_program program)
+{
+  program->keep_items_p = 1;
+}
+
+int
+pvm_program_map_items (pvm_program program, pvm_program_item_fn fn,
+                       void *data)
+{
+  int i;
+
+  if (!program->keep_items_p)
+    return PVM_EINVAL;
+
+  for (i = 0; i < program->num_items; ++i)
+    {
+      struct pvm_program_item *item = &program->items[i];
+      const char *insn_name = NULL;
+      pvm_val val = PVM_NULL;
+      unsigned int n = 0;
+
+      switch (item->kind)
+        {
+        case PVM_PROGRAM_ITEM_DELETED:
+          continue;
+        case PVM_PROGRAM_ITEM_INSN:
+          insn_name = item->u.insn_name;
+          break;
+        case PVM_PROGRAM_ITEM_PUSH:
+        case PVM_PROGRAM_ITEM_VAL_PARAM:
+          val = item->u.val;
+          break;
+        case PVM_PROGRAM_ITEM_UNSIGNED_PARAM:
+          n = item->u.n;
+          break;
+        case PVM_PROGRAM_ITEM_REGISTER_PARAM:
+          n = item->u.reg;
+          break;
+        case PVM_PROGRAM_ITEM_LABEL:
+        case PVM_PROGRAM_ITEM_LABEL_PARAM:
+          n = item->u.label;
+          break;
+        default:
+          assert (0);
+        }
+
+      if (fn (item->kind, insn_name, val, n, data) != PVM_OK)
+        return PVM_EINVAL;
+    }
+
+  return PVM_OK;
+}
+
+int
+pvm_program_num_labels (pvm_program program)
+{
+  return program->next_label;
+}
+
+/* **************** Peephole optimizer ****************  */
+
+/* Return whether the given item is a parameter.  */
+
+static inline int
+pvm_program_param_p (const struct pvm_program_item *item)
+{
+  return (item->kind == PVM_PROGRAM_ITEM_VAL_PARAM
+          || item->kind == PVM_PROGRAM_ITEM_UNSIGNED_PARAM
+          || item->kind == PVM_PROGRAM_ITEM_REGISTER_PARAM
+          || item->kind == PVM_PROGRAM_ITEM_LABEL_PARAM);
+}
+
+/* Return the index of the first label or instruction following the
+   item at index I in PROGRAM, or the number of items if there is
+   none.  */
+
+static int
+pvm_program_next (pvm_program program, int i)
+{
+  for (++i; i < program->num_items; ++i)
+    {
+      struct pvm_program_item *item = &program->items[i];
+
+      if (item->kind != PVM_PROGRAM_ITEM_DELETED
+          && !pvm_program_param_p (item))
+        break;
+    }
+
+  return i;
+}
+
+/* Return whether the instruction at index I in PROGRAM is named
+   NAME.  */
+
+static int
+pvm_program_insn_p (pvm_program program, int i, const char *name)
+{
+  return (i < program->num_items
+          && program->items[i].kind == PVM_PROGRAM_ITEM_INSN
+          && STREQ (program->items[i].u.insn_name, name));
+}
+
+/* Delete the instruction at index I in PROGRAM, along with its
+   parameters.  */
+
+static void
+pvm_program_delete_insn (pvm_program program, int i)
+{
+  int end = pvm_program_next (program, i);
+
+  for (; i < end; ++i)
+    program->items[i].kind = PVM_PROGRAM_ITEM_DELETED;
+}
+
+/* If the instruction at index I in PROGRAM is a branch, return the
+   index of its label parameter.  Return -1 otherwise.  */
+
+static int
+pvm_program_branch_param (pvm_program program, int i)
+{
+  static const char *branches[] =
+    {
+      "ba", "bn", "bnn", "bzi", "bziu", "bzl", "bzlu",
+      "bnzi", "bnziu", "bnzl", "bnzlu", "bncp", NULL
+    };
+  const char **b;
+
+  if (program->items[i].kind != PVM_PROGRAM_ITEM_INSN)
+    return -1;
+
+  for (b = branches; *b; ++b)
+    if (STREQ (program->items[i].u.insn_name, *b))
+      {
+        assert (program->items[i + 1].kind == PVM_PROGRAM_ITEM_LABEL_PARAM);
+        return i + 1;
+      }
+
+  return -1;
+}
+
+/* Determine whether the conditional branch at index I is taken when
+   the value at the top of the stack is VAL.  Return 1 if the branch
+   is taken, 0 if it is not taken, and -1 if it can't be
+   determined.  */
+
+static int
+pvm_program_branch_taken (pvm_program program, int i, pvm_val val)
+{
+  const char *name = program->items[i].u.insn_name;
+  int zero;
+
+  if (STREQ (name, "bn"))
+    return val == PVM_NULL;
+  else if (STREQ (name, "bnn"))
+    return val != PVM_NULL;
+  else if ((STREQ (name, "bzi") || STREQ (name, "bnzi")) && PVM_IS_INT (val))
+    zero = (PVM_VAL_INT (val) == 0);
+  else if ((STREQ (name, "bziu") || STREQ (name, "bnziu")) && PVM_IS_UINT (val))
+    zero = (PVM_VAL_UINT (val) == 0);
+  else if ((STREQ (name, "bzl") || STREQ (name, "bnzl")) && PVM_IS_LONG (val))
+    zero = (PVM_VAL_LONG (val) == 0);
+  else if ((STREQ (name, "bzlu") || STREQ (name, "bnzlu")) && PVM_IS_ULONG (val))
+    zero = (PVM_VAL_ULONG (val) == 0);
+  else
+    return -1;
+
+  return name[1] == 'z' ? zero : !zero;
+}
+
+/* Perform a single optimization pass over the pending items of
+   PROGRAM.  LABELS maps every label to the index of the item where it
+   is appended, or -1.  Return whether something changed.  */
+
+static int
+pvm_program_optimize_1 (pvm_program program, const int *labels)
+{
+  int i, changed = 0;
+
+  for (i = pvm_program_next (program, -1);
+       i < program->num_items;
+       i = pvm_program_next (program, i))
+    {
+      struct pvm_program_item *item = &program->items[i];
+      int next = pvm_program_next (program, i);
+      int param;
+
+      if (item->kind == PVM_PROGRAM_ITEM_LABEL)
+        continue;
+
+      /* push X; drop => nothing
+         swap; swap => nothing
+         dup; drop => nothing
+         dup; nip => nothing  */
+      if ((item->kind == PVM_PROGRAM_ITEM_PUSH
+           && pvm_program_insn_p (program, next, "drop"))
+          || (pvm_program_insn_p (program, i, "swap")
+              && pvm_program_insn_p (program, next, "swap"))
+          || (pvm_program_insn_p (program, i, "dup")
+              && (pvm_program_insn_p (program, next, "drop")
+                  || pvm_program_insn_p (program, next, "nip"))))
+        {
+          pvm_program_delete_insn (program, next);
+          pvm_program_delete_insn (program, i);
+          changed = 1;
+          continue;
+        }
+
+      /* push C; bCOND LABEL => push C; ba LABEL
+                             => push C  */
+      if (item->kind == PVM_PROGRAM_ITEM_PUSH
+          && next < program->num_items
+          && !pvm_program_insn_p (program, next, "ba")
+          && pvm_program_branch_param (program, next) != -1)
+        {
+          int taken = pvm_program_branch_taken (program, next, item->u.val);
+
+          if (taken == 1)
+            {
+              program->items[next].u.insn_name = "ba";
+              changed = 1;
+            }
+          else if (taken == 0)
+            {
+              pvm_program_delete_insn (program, next);
+              changed = 1;
+            }
+        }
+
+      param = pvm_program_branch_param (program, i);
+      if (param != -1)
+        {
+          pvm_program_label label = program->items[param].u.label;
+          int target = labels[label];
+
+          /* Jump threading: a branch to a label followed by an
+             unconditional branch to some other label can branch to
+             the later directly.  */
+          if (target != -1)
+            {
+              int t = target;
+
+              while (t < program->num_items
+                     && program->items[t].kind == PVM_PROGRAM_ITEM_LABEL)
+                t = pvm_program_next (program, t);
+
+              if (pvm_program_insn_p (program, t, "ba")
+                  && program->items[t + 1].u.label != label)
+                {
+                  program->items[param].u.label = program->items[t + 1].u.label;
+                  changed = 1;
+                }
+            }
+
+          /* ba LABEL; LABEL: => LABEL:  */
+          if (pvm_program_insn_p (program, i, "ba"))
+            {
+              int l;
+
+              for (l = next;
+                   l < program->num_items
+                     && program->items[l].kind == PVM_PROGRAM_ITEM_LABEL;
+                   l = pvm_program_next (program, l))
+                if (program->items[l].u.label == label)
+                  break;
+
+              if (l < program->num_items
+                  && program->items[l].kind == PVM_PROGRAM_ITEM_LABEL)
+                {
+                  pvm_program_delete_insn (program, i);
+                  changed = 1;
+                  continue;
+                }
+            }
+        }
+
+      /* Instructions following an unconditional transfer of control
+         are dead until the next label.  */
+      if (pvm_program_insn_p (program, i, "ba")
+          || pvm_program_insn_p (program, i, "raise")
+          || pvm_program_insn_p (program, i, "return")
+          || pvm_program_insn_p (program, i, "exit"))
+        {
+          while (next < program->num_items
+                 && program->items[next].kind != PVM_PROGRAM_ITEM_LABEL)
+            {
+              int n = pvm_program_next (program, next);
+
+              pvm_program_delete_insn (program, next);
+              next = n;
+              changed = 1;
+            }
+        }
+    }
+
+  return changed;
+}
+
+void
+pvm_program_optimize (pvm_program program)
+{
+  int *labels;
+  int i, pass;
+
+  /* The items already appended to the routine can't be changed.  */
+  if (program->num_items == 0 || program->num_flushed > 0)
+    return;
+
+  /* Labels are never deleted, so their positions don't change.  */
+  labels = xmalloc ((program->next_label + 1) * sizeof (int));
+  for (i = 0; i < program->next_label; ++i)
+    labels[i] = -1;
+  for (i = 0; i < program->num_items; ++i)
+    if (program->items[i].kind == PVM_PROGRAM_ITEM_LABEL)
+      labels[program->items[i].u.label] = i;
+
+  /* Every pass can enable further optimizations in the next one.
+     The number of passes is bounded in order to not spin forever on
+     cycles of unconditional branches.  */
+  for (pass = 0; pass < 8; ++pass)
+    if (!pvm_program_optimize_1 (program, labels))
+      break;
+
+  free (labels);
+}
+
 pvm_program_program_point
 pvm_program_beginning (pvm_program program)
 {
+  pvm_program_flush (program);
   return (pvm_program_program_point) PVM_ROUTINE_BEGINNING (program->routine);
 }
 
 int
 pvm_program_make_executable (pvm_program program)
 {
+  pvm_program_flush (program);
+
   /* XXX Jitter should return an error code here.  */
   jitter_routine_make_executable_if_needed (program->routine);
 
@@ -258,6 +745,7 @@ pvm_destroy_program (pvm_program program)
 pvm_routine
 pvm_program_routine (pvm_program program)
 {
+  pvm_program_flush (program);
   return program->routine;
 }
 
@@ -312,6 +800,7 @@ pvm_jitter_end_decoration (jitter_print_context_data data,
 void
 pvm_disassemble_program_nat (pvm_program program)
 {
+  pvm_program_flush (program);
   pvm_routine_disassemble (jitter_context, program->routine,
                            true, JITTER_OBJDUMP, NULL);
 }
@@ -319,6 +808,7 @@ pvm_disassemble_program_nat (pvm_program program)
 void
 pvm_disassemble_program (pvm_program program)
 {
+  pvm_program_flush (program);
   pvm_routine_print (jitter_context, program->routine);
 }
 
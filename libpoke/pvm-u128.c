@@ -0,0 +1,293 @@
+/* pvm-u128.c - Unsigned 128-bit integers for the PVM.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "pvm.h"
+#include "pvm-val.h"
+#include "pvm-u128.h"
+
+#if defined __SIZEOF_INT128__
+
+typedef unsigned __int128 u128;
+
+static inline u128
+u128_get (const uint64_t v[2])
+{
+  return ((u128) v[0] << 64) | v[1];
+}
+
+static inline void
+u128_put (u128 x, uint64_t v[2])
+{
+  v[0] = (uint64_t) (x >> 64);
+  v[1] = (uint64_t) x;
+}
+
+int
+pvm_u128_op (int op, const uint64_t a[2], const uint64_t b[2],
+             uint64_t res[2])
+{
+  u128 x = u128_get (a), y = u128_get (b);
+
+  switch (op)
+    {
+    case PVM_U128_ADD: x += y; break;
+    case PVM_U128_SUB: x -= y; break;
+    case PVM_U128_MUL: x *= y; break;
+    case PVM_U128_DIV:
+    case PVM_U128_MOD:
+      if (y == 0)
+        return 0;
+      x = op == PVM_U128_DIV ? x / y : x % y;
+      break;
+    case PVM_U128_AND: x &= y; break;
+    case PVM_U128_IOR: x |= y; break;
+    case PVM_U128_XOR: x ^= y; break;
+    case PVM_U128_SL:
+    case PVM_U128_SR:
+      if (y >= 128)
+        return 0;
+      x = op == PVM_U128_SL ? x << (int) y : x >> (int) y;
+      break;
+    default:
+      return 0;
+    }
+
+  u128_put (x, res);
+  return 1;
+}
+
+void
+pvm_u128_format (const uint64_t a[2], int base,
+                 char buf[PVM_U128_MAX_DIGITS + 1])
+{
+  static const char digits[] = "0123456789abcdef";
+  char tmp[PVM_U128_MAX_DIGITS];
+  u128 x = u128_get (a);
+  int n = 0, i;
+
+  do
+    {
+      tmp[n++] = digits[x % base];
+      x /= base;
+    }
+  while (x != 0);
+
+  for (i = 0; i < n; i++)
+    buf[i] = tmp[n - 1 - i];
+  buf[n] = '\0';
+}
+
+#else /* ! __SIZEOF_INT128__ */
+
+/* Operations on pairs of 64-bit limbs, for the C compilers lacking
+   128-bit integers.  */
+
+static int
+u128_less_p (const uint64_t a[2], const uint64_t b[2])
+{
+  return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+}
+
+static void
+u128_sub (const uint64_t a[2], const uint64_t b[2], uint64_t res[2])
+{
+  uint64_t lo = a[1] - b[1];
+
+  res[0] = a[0] - b[0] - (a[1] < b[1]);
+  res[1] = lo;
+}
+
+/* Multiply A and B, and put the 128-bit product in HI and LO.  */
+
+static void
+u128_mul64 (uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+  uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+  uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+  uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+
+  *lo = (mid << 32) | (p00 & 0xffffffff);
+  *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+/* Divide A by B, which is not zero, one bit at a time.  */
+
+static void
+u128_divmod (const uint64_t a[2], const uint64_t b[2],
+             uint64_t quot[2], uint64_t rem[2])
+{
+  uint64_t q[2] = {0, 0}, r[2] = {0, 0};
+  int i;
+
+  if (a[0] == 0 && b[0] == 0)
+    {
+      quot[0] = rem[0] = 0;
+      quot[1] = a[1] / b[1];
+      rem[1] = a[1] % b[1];
+      return;
+    }
+
+  for (i = 127; i >= 0; i--)
+    {
+      /* R is less than B, so twice R minus B fits in 128 bits even
+         when shifting R out of them.  */
+      int carry = r[0] >> 63;
+
+      r[0] = (r[0] << 1) | (r[1] >> 63);
+      r[1] = (r[1] << 1) | ((i >= 64 ? a[0] >> (i - 64) : a[1] >> i) & 1);
+      if (carry || !u128_less_p (r, b))
+        {
+          u128_sub (r, b, r);
+          q[i / 64 ? 0 : 1] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+
+  quot[0] = q[0];
+  quot[1] = q[1];
+  rem[0] = r[0];
+  rem[1] = r[1];
+}
+
+int
+pvm_u128_op (int op, const uint64_t a[2], const uint64_t b[2],
+             uint64_t res[2])
+{
+  uint64_t hi, lo, tmp[2];
+  unsigned int n;
+
+  switch (op)
+    {
+    case PVM_U128_ADD:
+      lo = a[1] + b[1];
+      hi = a[0] + b[0] + (lo < a[1]);
+      break;
+    case PVM_U128_SUB:
+      u128_sub (a, b, tmp);
+      hi = tmp[0];
+      lo = tmp[1];
+      break;
+    case PVM_U128_MUL:
+      u128_mul64 (a[1], b[1], &hi, &lo);
+      hi += a[0] * b[1] + a[1] * b[0];
+      break;
+    case PVM_U128_DIV:
+    case PVM_U128_MOD:
+      {
+        uint64_t quot[2], rem[2];
+
+        if (b[0] == 0 && b[1] == 0)
+          return 0;
+        u128_divmod (a, b, quot, rem);
+        hi = op == PVM_U128_DIV ? quot[0] : rem[0];
+        lo = op == PVM_U128_DIV ? quot[1] : rem[1];
+        break;
+      }
+    case PVM_U128_AND: hi = a[0] & b[0]; lo = a[1] & b[1]; break;
+    case PVM_U128_IOR: hi = a[0] | b[0]; lo = a[1] | b[1]; break;
+    case PVM_U128_XOR: hi = a[0] ^ b[0]; lo = a[1] ^ b[1]; break;
+    case PVM_U128_SL:
+    case PVM_U128_SR:
+      if (b[0] != 0 || b[1] >= 128)
+        return 0;
+      n = b[1];
+      if (n == 0)
+        {
+          hi = a[0];
+          lo = a[1];
+        }
+      else if (op == PVM_U128_SL)
+        {
+          hi = n < 64 ? (a[0] << n) | (a[1] >> (64 - n)) : a[1] << (n - 64);
+          lo = n < 64 ? a[1] << n : 0;
+        }
+      else
+        {
+          hi = n < 64 ? a[0] >> n : 0;
+          lo = n < 64 ? (a[1] >> n) | (a[0] << (64 - n)) : a[0] >> (n - 64);
+        }
+      break;
+    default:
+      return 0;
+    }
+
+  res[0] = hi;
+  res[1] = lo;
+  return 1;
+}
+
+void
+pvm_u128_format (const uint64_t a[2], int base,
+                 char buf[PVM_U128_MAX_DIGITS + 1])
+{
+  static const char digits[] = "0123456789abcdef";
+  char tmp[PVM_U128_MAX_DIGITS];
+  uint32_t w[4];
+  int n = 0, i;
+
+  w[0] = a[0] >> 32;
+  w[1] = a[0];
+  w[2] = a[1] >> 32;
+  w[3] = a[1];
+
+  /* Divide the number by BASE 32 bits at a time.  As the remainder is
+     less than BASE, every step fits in 64 bits.  */
+  do
+    {
+      uint64_t r = 0;
+
+      for (i = 0; i < 4; i++)
+        {
+          uint64_t d = (r << 32) | w[i];
+
+          w[i] = d / base;
+          r = d % base;
+        }
+      tmp[n++] = digits[r];
+    }
+  while (w[0] != 0 || w[1] != 0 || w[2] != 0 || w[3] != 0);
+
+  for (i = 0; i < n; i++)
+    buf[i] = tmp[n - 1 - i];
+  buf[n] = '\0';
+}
+
+#endif /* ! __SIZEOF_INT128__ */
+
+pvm_val
+pvm_make_u128 (const uint64_t v[2])
+{
+  pvm_val etype = pvm_make_integral_type (pvm_make_ulong (64, 64),
+                                          PVM_MAKE_INT (0, 32));
+  pvm_val arr = pvm_make_array (pvm_make_ulong (2, 64),
+                                pvm_make_array_type (etype, PVM_NULL));
+
+  pvm_array_insert (arr, pvm_make_ulong (0, 64), pvm_make_ulong (v[0], 64));
+  pvm_array_insert (arr, pvm_make_ulong (1, 64), pvm_make_ulong (v[1], 64));
+  return arr;
+}
+
+int
+pvm_u128_value (pvm_val val, uint64_t v[2])
+{
+  return (PVM_IS_ARR (val)
+          && PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val)) == 2
+          && pvm_array_get_integrals (val, 0, 2, v));
+}
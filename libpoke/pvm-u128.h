@@ -0,0 +1,79 @@
+/* pvm-u128.h - Unsigned 128-bit integers for the PVM.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PVM_U128_H
+#define PVM_U128_H
+
+#include <config.h>
+#include <stdint.h>
+
+#include "pvm.h"
+
+/* The PVM doesn't have integral values wider than 64 bits.  Unsigned
+   128-bit integers are represented in Poke as arrays of two
+   uint<64>, the most significant one first, and in C as two 64-bit
+   limbs in the same order.
+
+   The functions below implement the operations on them natively,
+   using the unsigned __int128 type of the C compiler when it is
+   available.  */
+
+/* Identifiers of the operations performed by pvm_u128_op, used by
+   the u128op PVM instruction.  They shall be kept in sync with the
+   std.pk functions that use it.  */
+
+#define PVM_U128_ADD 0
+#define PVM_U128_SUB 1
+#define PVM_U128_MUL 2
+#define PVM_U128_DIV 3
+#define PVM_U128_MOD 4
+#define PVM_U128_AND 5
+#define PVM_U128_IOR 6
+#define PVM_U128_XOR 7
+#define PVM_U128_SL  8
+#define PVM_U128_SR  9
+
+#define PVM_U128_MAX_OP PVM_U128_SR
+
+/* Compute A OP B, wrapping around on overflow, and put the result in
+   RES.  The second operand of the shifts is the number of bits to
+   shift.  Return 0 if B is zero in a division, or not less than 128
+   in a shift.  Otherwise return 1.  */
+
+int pvm_u128_op (int op, const uint64_t a[2], const uint64_t b[2],
+                 uint64_t res[2]);
+
+/* Format A in BASE, which shall be between 2 and 16, into BUF.  */
+
+#define PVM_U128_MAX_DIGITS 128
+
+void pvm_u128_format (const uint64_t a[2], int base,
+                      char buf[PVM_U128_MAX_DIGITS + 1]);
+
+/* Build a Poke unsigned 128-bit integer, which is an uint<64>[2]
+   array, out of the limbs in V.  */
+
+pvm_val pvm_make_u128 (const uint64_t v[2]);
+
+/* Put the limbs of the unsigned 128-bit integer VAL in V.  Return 0
+   if VAL is not an array of two integral values.  Otherwise return
+   1.  */
+
+int pvm_u128_value (pvm_val val, uint64_t v[2]);
+
+#endif /* ! PVM_U128_H */
@@ -30,6 +30,7 @@
 #include "pvm-val.h"
 #include "pvm-alloc.h"
 #include "pk-utils.h"
+#include "pk-thread.h"
 
 /* Unitary values that are always reused.
 
@@ -40,6 +41,38 @@ static pvm_val string_type;
 static pvm_val void_type;
 static pvm_val any_type;
 
+/* Type of the exceptions created by pvm_make_exception.  It is also
+   created in pvm_val_initialize.  */
+
+static pvm_val exception_type;
+
+/* Caches of frequently used values.
+
+   Boxed 64-bit integers in the range [0,PVM_LONG_CACHE_SIZE) are
+   stored in LONG_CACHE, which is not part of the collected heap.  It
+   is filled in pvm_val_initialize.
+
+   INTEGRAL_TYPES holds the integral types, indexed by signedness and
+   size minus one.  OFFSET_CACHE holds offsets whose magnitude is an
+   int<32> (index 0) or an ulong<64> (index 1) in the range
+   [0,PVM_OFFSET_CACHE_SIZE), and whose unit is either bits (index 0)
+   or bytes (index 1).  These two caches are also filled in
+   pvm_val_initialize.
+
+   All these values are immutable, so they can be shared by all the
+   PVMs of the process without locking.  */
+
+#define PVM_LONG_CACHE_SIZE 256
+#define PVM_OFFSET_CACHE_SIZE 256
+
+static uint64_t long_cache[2][PVM_LONG_CACHE_SIZE][2];
+static pvm_val integral_types[2][64];
+static pvm_val offset_cache[2][2][PVM_OFFSET_CACHE_SIZE];
+
+#define PVM_LONG_CACHE_VAL(SIGNED_P,V)                          \
+  (((uint64_t) (uintptr_t) long_cache[(SIGNED_P)][(V)])         \
+   | ((SIGNED_P) ? PVM_VAL_TAG_LONG : PVM_VAL_TAG_ULONG))
+
 pvm_val
 pvm_make_int (int32_t value, int size)
 {
@@ -55,33 +88,313 @@ pvm_make_uint (uint32_t value, int size)
 pvm_val
 pvm_make_long (int64_t value, int size)
 {
+  if (size == 64 && value >= 0 && value < PVM_LONG_CACHE_SIZE)
+    return PVM_LONG_CACHE_VAL (1, value);
   return PVM_MAKE_LONG_ULONG (value, size, PVM_VAL_TAG_LONG);
 }
 
 pvm_val
 pvm_make_ulong (uint64_t value, int size)
 {
+  if (size == 64 && value < PVM_LONG_CACHE_SIZE)
+    return PVM_LONG_CACHE_VAL (0, value);
   return PVM_MAKE_LONG_ULONG (value, size, PVM_VAL_TAG_ULONG);
 }
 
+/* Number of boxes allocated, indexed by tag.  They are shared by all
+   the PVMs of the process and incremented without locking, so they
+   may miss some allocations when several threads run at once.  */
+
+static uint64_t box_counts[PVM_VAL_TAG_DCT + 1];
+
 static pvm_val_box
 pvm_make_box (uint8_t tag)
 {
   pvm_val_box box = pvm_alloc (sizeof (struct pvm_val_box));
 
+  box_counts[tag]++;
   PVM_VAL_BOX_TAG (box) = tag;
   return box;
 }
 
+static pvm_val_box
+pvm_make_string_box (char *str, size_t len)
+{
+  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_STR);
+
+  PVM_VAL_BOX_STR_ROPE_P (box) = 0;
+  PVM_VAL_BOX_STR_LEN (box)
+    = len < PVM_STR_LEN_UNKNOWN ? len : PVM_STR_LEN_UNKNOWN;
+  PVM_VAL_BOX_STR (box) = str;
+  return box;
+}
+
 pvm_val
 pvm_make_string (const char *str)
 {
-  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_STR);
+  size_t len = strlen (str);
+  char *s = pvm_alloc_atomic (len + 1);
+
+  memcpy (s, str, len + 1);
+  return PVM_BOX (pvm_make_string_box (s, len));
+}
+
+pvm_val
+pvm_make_string_nodup (char *str)
+{
+  /* The length is computed only if it is needed.  */
+  return PVM_BOX (pvm_make_string_box (str, PVM_STR_LEN_UNKNOWN));
+}
+
+size_t
+pvm_string_length (pvm_val str)
+{
+  pvm_val_box box = PVM_VAL_BOX (str);
+  size_t len;
+
+  if (PVM_VAL_BOX_STR_LEN (box) != PVM_STR_LEN_UNKNOWN)
+    return PVM_VAL_BOX_STR_LEN (box);
+
+  len = strlen (PVM_VAL_BOX_STR (box));
+  if (len < PVM_STR_LEN_UNKNOWN)
+    PVM_VAL_BOX_STR_LEN (box) = len;
+  return len;
+}
+
+/* Concatenations resulting in strings shorter than this are done
+   right away, since copying a few bytes is cheaper than building
+   and then flattening a rope.  */
+
+#define PVM_ROPE_MIN_LEN 128
 
-  PVM_VAL_BOX_STR (box) = pvm_alloc_strdup (str);
+pvm_val
+pvm_make_string_concat (pvm_val str1, pvm_val str2)
+{
+  size_t len1 = pvm_string_length (str1);
+  size_t len2 = pvm_string_length (str2);
+  pvm_val_box box;
+
+  if (len2 == 0)
+    return str1;
+  if (len1 == 0)
+    return str2;
+
+  if (len1 + len2 < PVM_ROPE_MIN_LEN
+      || len1 + len2 >= PVM_STR_LEN_UNKNOWN)
+    {
+      char *s = pvm_alloc_atomic (len1 + len2 + 1);
+
+      memcpy (s, PVM_VAL_STR (str1), len1);
+      memcpy (s + len1, PVM_VAL_STR (str2), len2 + 1);
+      return PVM_BOX (pvm_make_string_box (s, len1 + len2));
+    }
+
+  box = pvm_make_box (PVM_VAL_TAG_STR);
+  PVM_VAL_BOX_STR_ROPE_P (box) = 1;
+  PVM_VAL_BOX_STR_LEN (box) = len1 + len2;
+  PVM_VAL_BOX_ROPE (box) = pvm_alloc (sizeof (struct pvm_rope));
+  PVM_VAL_BOX_ROPE (box)->left = str1;
+  PVM_VAL_BOX_ROPE (box)->right = str2;
   return PVM_BOX (box);
 }
 
+/* The pieces of a rope are collected from right to left in an
+   explicit stack, since ropes built by appending or prepending in a
+   loop are as deep as the number of pieces.  The stack doesn't need
+   to be a GC root: the pieces are reachable from the rope being
+   flattened.  */
+
+char *
+pvm_string_flatten (pvm_val str)
+{
+  pvm_val_box box = PVM_VAL_BOX (str);
+  size_t len = PVM_VAL_BOX_STR_LEN (box);
+  char *s;
+  pvm_val *stack;
+  size_t stack_size = 16, sp = 0;
+
+  if (!PVM_VAL_BOX_STR_ROPE_P (box))
+    return PVM_VAL_BOX_STR (box);
+
+  s = pvm_alloc_atomic (len + 1);
+  s[len] = '\0';
+  stack = xmalloc (stack_size * sizeof (pvm_val));
+  stack[sp++] = str;
+
+  while (sp > 0)
+    {
+      pvm_val piece = stack[--sp];
+
+      if (PVM_VAL_STR_ROPE_P (piece))
+        {
+          if (sp + 2 > stack_size)
+            {
+              stack_size *= 2;
+              stack = xrealloc (stack, stack_size * sizeof (pvm_val));
+            }
+          stack[sp++] = PVM_VAL_STR_ROPE (piece)->left;
+          stack[sp++] = PVM_VAL_STR_ROPE (piece)->right;
+        }
+      else
+        {
+          size_t piece_len = pvm_string_length (piece);
+
+          len -= piece_len;
+          memcpy (s + len, PVM_VAL_BOX_STR (PVM_VAL_BOX (piece)), piece_len);
+        }
+    }
+
+  free (stack);
+  assert (len == 0);
+
+  /* The rope is not needed anymore.  */
+  PVM_VAL_BOX_STR (box) = s;
+  PVM_VAL_BOX_STR_ROPE_P (box) = 0;
+  return s;
+}
+
+static uint32_t
+pvm_string_hash (const char *str)
+{
+  uint32_t hash = 5381;
+
+  while (*str)
+    hash = hash * 33 + (unsigned char) *str++;
+  return hash;
+}
+
+/* Table of interned strings.  This is an open-addressing hash table
+   whose size is always a power of two.  Interned strings are never
+   collected.  The table is shared by all the PVMs of the process and
+   is protected by STRING_ATOMS_LOCK.  */
+
+PK_LOCK_DEFINE (string_atoms_lock);
+
+static pvm_val *string_atoms;
+static size_t string_atoms_size;
+static size_t string_atoms_count;
+
+#define PVM_STRING_ATOMS_NROOTS(SIZE) \
+  ((SIZE) * sizeof (pvm_val) / sizeof (void *))
+
+static void
+pvm_string_atoms_grow (void)
+{
+  size_t new_size = string_atoms_size == 0 ? 256 : string_atoms_size * 2;
+  pvm_val *new_atoms = xcalloc (new_size, sizeof (pvm_val));
+  size_t i;
+
+  for (i = 0; i < string_atoms_size; ++i)
+    {
+      pvm_val atom = string_atoms[i];
+      size_t slot;
+
+      if (atom == PVM_NULL)
+        continue;
+
+      slot = pvm_string_hash (PVM_VAL_STR (atom)) & (new_size - 1);
+      while (new_atoms[slot] != PVM_NULL)
+        slot = (slot + 1) & (new_size - 1);
+      new_atoms[slot] = atom;
+    }
+
+  pvm_alloc_add_gc_roots (new_atoms, PVM_STRING_ATOMS_NROOTS (new_size));
+  if (string_atoms)
+    {
+      pvm_alloc_remove_gc_roots (string_atoms,
+                                 PVM_STRING_ATOMS_NROOTS (string_atoms_size));
+      free (string_atoms);
+    }
+
+  string_atoms = new_atoms;
+  string_atoms_size = new_size;
+}
+
+pvm_val
+pvm_make_string_atom (const char *str)
+{
+  size_t slot;
+  pvm_val atom;
+
+  PK_LOCK (string_atoms_lock);
+
+  if (string_atoms_count * 2 >= string_atoms_size)
+    pvm_string_atoms_grow ();
+
+  slot = pvm_string_hash (str) & (string_atoms_size - 1);
+  while (string_atoms[slot] != PVM_NULL)
+    {
+      if (STREQ (PVM_VAL_STR (string_atoms[slot]), str))
+        goto done;
+      slot = (slot + 1) & (string_atoms_size - 1);
+    }
+
+  string_atoms[slot] = pvm_make_string (str);
+  string_atoms_count++;
+
+ done:
+  atom = string_atoms[slot];
+  PK_UNLOCK (string_atoms_lock);
+  return atom;
+}
+
+int
+pvm_string_atom_p (pvm_val str)
+{
+  const char *s = PVM_VAL_STR (str);
+  size_t slot;
+  int atom_p = 0;
+
+  PK_LOCK (string_atoms_lock);
+
+  if (string_atoms_size > 0)
+    {
+      slot = pvm_string_hash (s) & (string_atoms_size - 1);
+      while (string_atoms[slot] != PVM_NULL)
+        {
+          if (STREQ (PVM_VAL_STR (string_atoms[slot]), s))
+            {
+              atom_p = (string_atoms[slot] == str);
+              break;
+            }
+          slot = (slot + 1) & (string_atoms_size - 1);
+        }
+    }
+
+  PK_UNLOCK (string_atoms_lock);
+  return atom_p;
+}
+
+/* Return a new packed array descriptor for elements of the integral
+   type ETYPE, with room for NALLOCATED elements.  */
+
+static struct pvm_array_packed *
+pvm_make_packed (pvm_val etype, uint64_t nallocated)
+{
+  struct pvm_array_packed *packed
+    = pvm_alloc (sizeof (struct pvm_array_packed));
+  int esize = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+
+  packed->esize = esize;
+  packed->signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (etype));
+  packed->width = (esize <= 8 ? 1
+                   : esize <= 16 ? 2
+                   : esize <= 32 ? 4 : 8);
+  packed->nallocated = nallocated;
+  packed->data = (nallocated > 0
+                  ? pvm_alloc_atomic (nallocated * packed->width)
+                  : NULL);
+  packed->boffset = 0;
+  packed->boffset_back = 0;
+  packed->lazy_p = 0;
+  packed->ios = -1;
+  packed->endian = IOS_ENDIAN_MSB;
+  packed->nenc = IOS_NENC_2;
+  packed->present = NULL;
+
+  return packed;
+}
+
 pvm_val
 pvm_make_array (pvm_val nelem, pvm_val type)
 {
@@ -96,131 +409,1501 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   PVM_MAPINFO_STRICT_P (arr->mapinfo) = 1;
   PVM_MAPINFO_IOS (arr->mapinfo) = PVM_NULL;
   PVM_MAPINFO_OFFSET (arr->mapinfo) = pvm_make_ulong (0, 64);
+  PVM_MAPINFO_GENERATION (arr->mapinfo) = 0;
 
   PVM_MAPINFO_MAPPED_P (arr->mapinfo_back) = 0;
   PVM_MAPINFO_IOS (arr->mapinfo_back) = PVM_NULL;
   PVM_MAPINFO_OFFSET (arr->mapinfo_back) = PVM_NULL;
+  PVM_MAPINFO_GENERATION (arr->mapinfo_back) = 0;
 
   arr->elems_bound = PVM_NULL;
   arr->size_bound = PVM_NULL;
   arr->mapper = PVM_NULL;
   arr->writer = PVM_NULL;
   arr->nelem = pvm_make_ulong (0, 64);
-  arr->nallocated = num_allocated;
   arr->type = type;
+  arr->packed = NULL;
+  arr->shared_p = 0;
 
-  arr->elems = pvm_alloc (nbytes);
-  for (i = 0; i < num_allocated; ++i)
+  /* Arrays of integral elements are packed.  */
+  if (PVM_IS_TYP (type)
+      && PVM_VAL_TYP_CODE (type) == PVM_TYPE_ARRAY
+      && PVM_VAL_TYP_CODE (PVM_VAL_TYP_A_ETYPE (type)) == PVM_TYPE_INTEGRAL)
     {
-      arr->elems[i].offset = PVM_NULL;
-      arr->elems[i].value = PVM_NULL;
+      arr->nallocated = 0;
+      arr->elems = NULL;
+      arr->packed = pvm_make_packed (PVM_VAL_TYP_A_ETYPE (type),
+                                     num_allocated);
     }
+  else
+    {
+      arr->nallocated = num_allocated;
+      arr->elems = pvm_alloc (nbytes);
+      for (i = 0; i < num_allocated; ++i)
+        {
+          arr->elems[i].offset = PVM_NULL;
+          arr->elems[i].value = PVM_NULL;
+        }
+    }
+
+  PVM_VAL_BOX_ARR (box) = arr;
+  return PVM_BOX (box);
+}
+
+pvm_val
+pvm_make_lazy_array (pvm_val type, uint64_t nelem,
+                     int ios_id, uint64_t boffset,
+                     int endian, int nenc)
+{
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (type);
+  int esize = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+  ios io = ios_search_by_id (ios_id);
+  ios_off begin;
+  pvm_val_box box;
+  pvm_array arr;
+  struct pvm_array_packed *packed;
+
+  /* Only arrays whose elements can be read back at any time, and
+     all of them, can be mapped lazily.  */
+  if (io == NULL || ios_volatile_p (io))
+    return PVM_NULL;
+
+  begin = (ios_off) boffset + ios_get_bias (io);
+  if (begin < 0
+      || nelem > (UINT64_MAX - begin) / esize
+      || begin + nelem * esize > ios_size (io))
+    return PVM_NULL;
+
+  box = pvm_make_box (PVM_VAL_TAG_ARR);
+  arr = pvm_alloc (sizeof (struct pvm_array));
+
+  PVM_MAPINFO_MAPPED_P (arr->mapinfo) = 0;
+  PVM_MAPINFO_STRICT_P (arr->mapinfo) = 1;
+  PVM_MAPINFO_IOS (arr->mapinfo) = PVM_NULL;
+  PVM_MAPINFO_OFFSET (arr->mapinfo) = pvm_make_ulong (boffset, 64);
+  PVM_MAPINFO_GENERATION (arr->mapinfo) = 0;
+
+  PVM_MAPINFO_MAPPED_P (arr->mapinfo_back) = 0;
+  PVM_MAPINFO_IOS (arr->mapinfo_back) = PVM_NULL;
+  PVM_MAPINFO_OFFSET (arr->mapinfo_back) = PVM_NULL;
+  PVM_MAPINFO_GENERATION (arr->mapinfo_back) = 0;
+
+  arr->elems_bound = PVM_NULL;
+  arr->size_bound = PVM_NULL;
+  arr->mapper = PVM_NULL;
+  arr->writer = PVM_NULL;
+  arr->nelem = pvm_make_ulong (nelem, 64);
+  arr->nallocated = 0;
+  arr->type = type;
+  arr->elems = NULL;
+  arr->shared_p = 0;
+
+  /* The buffer is allocated when the first element is accessed.  */
+  packed = pvm_make_packed (etype, 0);
+  packed->boffset = boffset;
+  packed->lazy_p = 1;
+  packed->ios = ios_id;
+  packed->endian = endian;
+  packed->nenc = nenc;
+  arr->packed = packed;
 
   PVM_VAL_BOX_ARR (box) = arr;
   return PVM_BOX (box);
 }
 
+/* Return the raw value of the IDX-th element of the packed array
+   described by PACKED.  */
+
+static inline uint64_t
+pvm_packed_get (struct pvm_array_packed *packed, uint64_t idx)
+{
+  switch (packed->width)
+    {
+    case 1: return ((uint8_t *) packed->data)[idx];
+    case 2: return ((uint16_t *) packed->data)[idx];
+    case 4: return ((uint32_t *) packed->data)[idx];
+    default: return ((uint64_t *) packed->data)[idx];
+    }
+}
+
+static inline void
+pvm_packed_put (struct pvm_array_packed *packed, uint64_t idx,
+                uint64_t raw)
+{
+  switch (packed->width)
+    {
+    case 1: ((uint8_t *) packed->data)[idx] = raw; break;
+    case 2: ((uint16_t *) packed->data)[idx] = raw; break;
+    case 4: ((uint32_t *) packed->data)[idx] = raw; break;
+    default: ((uint64_t *) packed->data)[idx] = raw; break;
+    }
+}
+
+/* Box the raw value RAW of an element of the packed array described
+   by PACKED.  */
+
+static pvm_val
+pvm_packed_box (struct pvm_array_packed *packed, uint64_t raw)
+{
+  int esize = packed->esize;
+
+  if (packed->signed_p)
+    {
+      int64_t v = (int64_t) (raw << (64 - esize)) >> (64 - esize);
+
+      return (esize <= 32
+              ? pvm_make_int (v, esize) : pvm_make_long (v, esize));
+    }
+  else
+    return (esize <= 32
+            ? pvm_make_uint (raw, esize) : pvm_make_ulong (raw, esize));
+}
+
+/* If VAL can be stored in the packed array described by PACKED, put
+   its raw value in *RAW and return 1.  Otherwise return 0.  */
+
+static int
+pvm_packed_unbox (struct pvm_array_packed *packed, pvm_val val,
+                  uint64_t *raw)
+{
+  int esize = packed->esize;
+  uint64_t mask = esize == 64 ? UINT64_MAX : (((uint64_t) 1 << esize) - 1);
+
+  if (esize <= 32)
+    {
+      if (packed->signed_p && PVM_IS_INT (val)
+          && PVM_VAL_INT_SIZE (val) == esize)
+        *raw = (uint64_t) (int64_t) PVM_VAL_INT (val);
+      else if (!packed->signed_p && PVM_IS_UINT (val)
+               && PVM_VAL_UINT_SIZE (val) == esize)
+        *raw = PVM_VAL_UINT (val);
+      else
+        return 0;
+    }
+  else
+    {
+      if (packed->signed_p && PVM_IS_LONG (val)
+          && PVM_VAL_LONG_SIZE (val) == esize)
+        *raw = (uint64_t) PVM_VAL_LONG (val);
+      else if (!packed->signed_p && PVM_IS_ULONG (val)
+               && PVM_VAL_ULONG_SIZE (val) == esize)
+        *raw = PVM_VAL_ULONG (val);
+      else
+        return 0;
+    }
+
+  *raw &= mask;
+  return 1;
+}
+
+/* Make sure the buffer of the packed array described by PACKED has
+   room for at least NELEM elements.  */
+
+static void
+pvm_packed_reserve (struct pvm_array_packed *packed, uint64_t nelem)
+{
+  if (packed->nallocated >= nelem)
+    return;
+
+  packed->data = (packed->data == NULL
+                  ? pvm_alloc_atomic (nelem * packed->width)
+                  : pvm_realloc (packed->data, nelem * packed->width));
+  packed->nallocated = nelem;
+}
+
+#define PVM_PACKED_PRESENT_P(PACKED,I)                  \
+  ((PACKED)->present[(I) / 8] & (1 << ((I) % 8)))
+#define PVM_PACKED_SET_PRESENT(PACKED,I)                \
+  ((PACKED)->present[(I) / 8] |= (1 << ((I) % 8)))
+
+/* Allocate the buffer of the lazily mapped array ARR, with none of
+   its elements present.  */
+
+static void
+pvm_array_packed_alloc (pvm_val arr)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+
+  pvm_packed_reserve (packed, nelem);
+  packed->present = pvm_alloc_atomic ((nelem + 7) / 8);
+  memset (packed->present, 0, (nelem + 7) / 8);
+}
+
+/* Peek from IO the elements of the lazily mapped array ARR that are
+   in the chunk containing the element IDX and have not been peeked
+   nor set so far.  Return an IOS status code.  */
+
+static int
+pvm_array_packed_load (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t first = idx - idx % PVM_ARRAY_PACKED_CHUNK;
+  uint64_t last = first + PVM_ARRAY_PACKED_CHUNK;
+  ios io;
+  uint64_t i;
+
+  if (packed->data == NULL)
+    pvm_array_packed_alloc (arr);
+
+  io = ios_search_by_id (packed->ios);
+  if (io == NULL)
+    return IOS_ERROR;
+
+  if (last > nelem)
+    last = nelem;
+
+  for (i = first; i < last; ++i)
+    {
+      ios_off offset = packed->boffset + i * packed->esize;
+      int ret;
+
+      if (PVM_PACKED_PRESENT_P (packed, i))
+        continue;
+
+      if (packed->signed_p)
+        {
+          int64_t v;
+
+          ret = ios_read_int (io, offset, 0, packed->esize,
+                              packed->endian, packed->nenc, &v);
+          if (ret != IOS_OK)
+            return ret;
+          pvm_packed_put (packed, i, (uint64_t) v);
+        }
+      else
+        {
+          uint64_t v;
+
+          ret = ios_read_uint (io, offset, 0, packed->esize,
+                               packed->endian, &v);
+          if (ret != IOS_OK)
+            return ret;
+          pvm_packed_put (packed, i, v);
+        }
+
+      PVM_PACKED_SET_PRESENT (packed, i);
+    }
+
+  return IOS_OK;
+}
+
 int
-pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
+pvm_array_load (pvm_val arr)
 {
-  size_t index = PVM_VAL_ULONG (idx);
-  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
-  size_t nallocated = PVM_VAL_ARR_NALLOCATED (arr);
-  size_t nelem_to_add = index - nelem + 1;
-  size_t val_size = pvm_sizeof (val);
-  size_t array_boffset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr));
-  size_t elem_boffset = array_boffset + pvm_sizeof (arr);
-  size_t i;
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t i;
 
-  /* First of all, make sure that the given index doesn't correspond
-     to an existing element.  If that is the case, return 0 now.  */
-  if (index < nelem)
-    return 0;
+  if (packed == NULL || !packed->lazy_p)
+    return IOS_OK;
 
-  /* We have a hard-limit in the number of elements to append, in
-     order to avoid malicious code or harmful bugs.  */
-  if (nelem_to_add > 1024)
+  for (i = 0; i < nelem; i += PVM_ARRAY_PACKED_CHUNK)
+    {
+      int ret = pvm_array_packed_load (arr, i);
+
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  packed->lazy_p = 0;
+  packed->present = NULL;
+  return IOS_OK;
+}
+
+int
+pvm_val_load (pvm_val val)
+{
+  size_t i, nelem;
+  int ret;
+
+  if (PVM_IS_ARR (val))
+    {
+      if (PVM_VAL_ARR_PACKED_P (val))
+        return pvm_array_load (val);
+
+      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      for (i = 0; i < nelem; ++i)
+        if ((ret = pvm_val_load (PVM_VAL_ARR_ELEM_VALUE (val, i))) != IOS_OK)
+          return ret;
+    }
+  else if (PVM_IS_SCT (val))
+    {
+      nelem = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      for (i = 0; i < nelem; ++i)
+        {
+          if (PVM_VAL_SCT_FIELD_ABSENT_P (val, i))
+            continue;
+          if ((ret = pvm_val_load (PVM_VAL_SCT_FIELD_VALUE (val, i)))
+              != IOS_OK)
+            return ret;
+        }
+    }
+
+  return IOS_OK;
+}
+
+/* Like pvm_array_load, but for the callers that can't report errors.
+   Elements that can't be read from IO are set to zero.  The PVM
+   instructions operating on whole arrays call pvm_array_load first
+   and raise E_io or E_eof on failure, so this is only reached from
+   the libpoke API.  */
+
+static void
+pvm_array_packed_load_all (pvm_val arr)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t i;
+
+  if (pvm_array_load (arr) == IOS_OK)
+    return;
+
+  for (i = 0; i < nelem; ++i)
+    if (!PVM_PACKED_PRESENT_P (packed, i))
+      pvm_packed_put (packed, i, 0);
+
+  packed->lazy_p = 0;
+  packed->present = NULL;
+}
+
+int
+pvm_array_packed_elem (pvm_val arr, uint64_t idx, pvm_val *value)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed->lazy_p
+      && (packed->data == NULL || !PVM_PACKED_PRESENT_P (packed, idx)))
+    {
+      int ret = pvm_array_packed_load (arr, idx);
+
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  *value = pvm_packed_box (packed, pvm_packed_get (packed, idx));
+  return IOS_OK;
+}
+
+pvm_val
+pvm_array_elem_value (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  pvm_val value;
+
+  if (packed == NULL)
+    return PVM_VAL_ARR_ELEM_VALUE (arr, idx);
+
+  if (pvm_array_packed_elem (arr, idx, &value) == IOS_OK)
+    return value;
+
+  return PVM_NULL;
+}
+
+pvm_val
+pvm_array_elem_offset (pvm_val arr, uint64_t idx)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (packed == NULL)
+    return PVM_VAL_ARR_ELEM_OFFSET (arr, idx);
+
+  return pvm_make_ulong (packed->boffset + idx * packed->esize, 64);
+}
+
+pvm_val
+pvm_make_integral_bits (uint64_t bits, pvm_val type)
+{
+  pvm_val itype = type, val;
+  int size, signed_p;
+
+  if (PVM_VAL_TYP_CODE (type) == PVM_TYPE_OFFSET)
+    itype = PVM_VAL_TYP_O_BASE_TYPE (type);
+  size = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (itype));
+  signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (itype));
+
+  if (signed_p)
+    {
+      int64_t v = (int64_t) (bits << (64 - size)) >> (64 - size);
+
+      val = size <= 32 ? pvm_make_int (v, size) : pvm_make_long (v, size);
+    }
+  else
+    {
+      if (size < 64)
+        bits &= (UINT64_C (1) << size) - 1;
+      val = size <= 32 ? pvm_make_uint (bits, size) : pvm_make_ulong (bits, size);
+    }
+
+  if (itype != type)
+    val = pvm_make_offset (val, PVM_VAL_TYP_O_UNIT (type));
+  return val;
+}
+
+pvm_val
+pvm_integrate_struct (pvm_val sct, pvm_val itype)
+{
+  pvm_val type = PVM_VAL_SCT_TYPE (sct);
+  uint64_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+  int ivalw = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (itype));
+  uint64_t i, sct_offset, field_offset, ival = 0;
+
+  sct_offset = (PVM_VAL_SCT_OFFSET (sct) == PVM_NULL
+                ? 0 : PVM_VAL_ULONG (PVM_VAL_SCT_OFFSET (sct)));
+
+  for (field_offset = 0, i = 0; i < nfields; ++i)
+    {
+      pvm_val ftype = PVM_VAL_TYP_S_FTYPE (type, i);
+      pvm_val fval = PVM_VAL_SCT_FIELD_VALUE (sct, i);
+      pvm_val foffset = PVM_VAL_SCT_FIELD_OFFSET (sct, i);
+      uint64_t bits;
+      int fieldw, shift;
+
+      if (PVM_VAL_TYP_CODE (ftype) == PVM_TYPE_OFFSET)
+        {
+          ftype = PVM_VAL_TYP_O_BASE_TYPE (ftype);
+          if (fval != PVM_NULL)
+            fval = PVM_VAL_OFF_MAGNITUDE (fval);
+        }
+      fieldw = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (ftype));
+
+      if (foffset != PVM_NULL)
+        field_offset = PVM_VAL_ULONG (foffset) - sct_offset;
+
+      /* Absent fields are not inserted in the integral value.  */
+      if (fval != PVM_NULL)
+        {
+          bits = PVM_VAL_INTEGRAL (fval);
+          if (fieldw < 64)
+            bits &= (UINT64_C (1) << fieldw) - 1;
+
+          shift = ivalw - field_offset - fieldw;
+          ival |= bits << shift;
+        }
+
+      field_offset += fieldw;
+    }
+
+  return pvm_make_integral_bits (ival, itype);
+}
+
+/* Bytes of the buffer used by pvm_peek_struct in the stack.  Bigger
+   structs use a buffer allocated in the heap.  */
+#define PVM_PEEK_STRUCT_BUF_SIZE 128
+
+int
+pvm_peek_struct (ios io, ios_off boffset, pvm_val type,
+                 enum ios_endian endian, pvm_val *value)
+{
+  uint64_t nfields = PVM_VAL_ULONG (PVM_VAL_TYP_S_NFIELDS (type));
+  uint8_t buf[PVM_PEEK_STRUCT_BUF_SIZE], *data = buf;
+  const uint8_t *p;
+  uint64_t i, nbytes = 0;
+  ios_off field_offset;
+  pvm_val sct;
+
+  for (i = 0; i < nfields; ++i)
+    {
+      pvm_val ftype = PVM_VAL_TYP_S_FTYPE (type, i);
+
+      if (PVM_VAL_TYP_CODE (ftype) == PVM_TYPE_OFFSET)
+        ftype = PVM_VAL_TYP_O_BASE_TYPE (ftype);
+      nbytes += PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (ftype)) / 8;
+    }
+
+  /* Get all the bytes of the struct at once, either directly from
+     the device or with a single read.  */
+  p = ios_direct_pointer (io, boffset, nbytes, 0);
+  if (p == NULL)
+    {
+      int ret;
+
+      if (nbytes > sizeof (buf))
+        data = xmalloc (nbytes);
+
+      ret = ios_read_raw (io, boffset, 0 /* flags */, data, nbytes);
+      if (ret != IOS_OK)
+        {
+          if (data != buf)
+            free (data);
+          return ret;
+        }
+      p = data;
+    }
+
+  sct = pvm_make_struct (PVM_VAL_TYP_S_NFIELDS (type),
+                         pvm_make_ulong (0, 64), type);
+  PVM_VAL_SCT_OFFSET (sct) = pvm_make_ulong (boffset, 64);
+
+  for (field_offset = 0, i = 0; i < nfields; ++i)
+    {
+      pvm_val ftype = PVM_VAL_TYP_S_FTYPE (type, i);
+      pvm_val itype = ftype;
+      int bits, j, n;
+      uint64_t u = 0;
+
+      if (PVM_VAL_TYP_CODE (ftype) == PVM_TYPE_OFFSET)
+        itype = PVM_VAL_TYP_O_BASE_TYPE (ftype);
+      bits = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (itype));
+      n = bits / 8;
+
+      if (endian == IOS_ENDIAN_MSB)
+        for (j = 0; j < n; ++j)
+          u = (u << 8) | p[j];
+      else
+        for (j = n - 1; j >= 0; --j)
+          u = (u << 8) | p[j];
+
+      PVM_VAL_SCT_FIELD_NAME (sct, i) = PVM_VAL_TYP_S_FNAME (type, i);
+      PVM_VAL_SCT_FIELD_VALUE (sct, i) = pvm_make_integral_bits (u, ftype);
+      PVM_VAL_SCT_FIELD_OFFSET (sct, i)
+        = pvm_make_ulong (boffset + field_offset, 64);
+
+      p += n;
+      field_offset += bits;
+    }
+
+  if (data != buf)
+    free (data);
+
+  *value = sct;
+  return IOS_OK;
+}
+
+void
+pvm_array_materialize (pvm_val arr)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t num_allocated = nelem > 0 ? nelem : 16;
+  struct pvm_array_elem *elems;
+  size_t i;
+
+  if (packed == NULL)
+    return;
+
+  pvm_array_packed_load_all (arr);
+
+  elems = pvm_alloc (sizeof (struct pvm_array_elem) * num_allocated);
+  for (i = 0; i < num_allocated; ++i)
+    {
+      if (i < nelem)
+        {
+          elems[i].value = pvm_packed_box (packed,
+                                           pvm_packed_get (packed, i));
+          elems[i].offset
+            = pvm_make_ulong (packed->boffset + i * packed->esize, 64);
+          elems[i].offset_back
+            = pvm_make_ulong (packed->boffset_back + i * packed->esize, 64);
+        }
+      else
+        {
+          elems[i].value = PVM_NULL;
+          elems[i].offset = PVM_NULL;
+          elems[i].offset_back = PVM_NULL;
+        }
+    }
+
+  PVM_VAL_ARR_ELEMS (arr) = elems;
+  PVM_VAL_ARR_NALLOCATED (arr) = num_allocated;
+  PVM_VAL_ARR_PACKED (arr) = NULL;
+}
+
+/* Return a new buffer with room for NALLOCATED array elements, with
+   a copy of the first NELEM elements in ELEMS.  The rest of positions
+   are left free.  */
+
+static struct pvm_array_elem *
+pvm_array_copy_elems (struct pvm_array_elem *elems, size_t nelem,
+                      size_t nallocated)
+{
+  struct pvm_array_elem *copy
+    = pvm_alloc (nallocated * sizeof (struct pvm_array_elem));
+  size_t i;
+
+  memcpy (copy, elems, nelem * sizeof (struct pvm_array_elem));
+  for (i = nelem; i < nallocated; ++i)
+    {
+      copy[i].value = PVM_NULL;
+      copy[i].offset = PVM_NULL;
+      copy[i].offset_back = PVM_NULL;
+    }
+
+  return copy;
+}
+
+void
+pvm_array_unshare (pvm_val arr)
+{
+  if (!PVM_VAL_ARR_SHARED_P (arr))
+    return;
+
+  PVM_VAL_ARR_ELEMS (arr)
+    = pvm_array_copy_elems (PVM_VAL_ARR_ELEMS (arr),
+                            PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)),
+                            PVM_VAL_ARR_NALLOCATED (arr));
+  PVM_VAL_ARR_SHARED_P (arr) = 0;
+}
+
+pvm_val
+pvm_array_concat (pvm_val arr1, pvm_val arr2)
+{
+  size_t nelem1 = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr1));
+  size_t nelem2 = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr2));
+  size_t nelem = nelem1 + nelem2;
+  struct pvm_array_packed *packed1 = PVM_VAL_ARR_PACKED (arr1);
+  struct pvm_array_packed *packed2 = PVM_VAL_ARR_PACKED (arr2);
+  pvm_val type = PVM_VAL_ARR_TYPE (arr2);
+  pvm_val res;
+  size_t i;
+
+  pvm_array_packed_load_all (arr1);
+  pvm_array_packed_load_all (arr2);
+
+  /* Packed arrays with the same kind of elements are concatenated by
+     copying their buffers.  */
+  if (packed1 && packed2
+      && packed1->esize == packed2->esize
+      && packed1->signed_p == packed2->signed_p)
+    {
+      struct pvm_array_packed *packed;
+
+      res = pvm_make_array (pvm_make_ulong (nelem, 64), type);
+      packed = PVM_VAL_ARR_PACKED (res);
+      assert (packed && packed->esize == packed1->esize);
+
+      if (nelem1 > 0)
+        memcpy (packed->data, packed1->data, nelem1 * packed->width);
+      if (nelem2 > 0)
+        memcpy ((char *) packed->data + nelem1 * packed->width,
+                packed2->data, nelem2 * packed->width);
+
+      PVM_VAL_ARR_NELEM (res) = pvm_make_ulong (nelem, 64);
+      return res;
+    }
+
+  /* The elements of an unmapped regular array are located from
+     bit-offset zero, like the elements of the new array.  If there
+     are free positions for the elements of ARR2 after the elements of
+     ARR1, the new array shares the elements of ARR1 and only the
+     elements of ARR2 are stored.  Otherwise the elements of ARR1 are
+     copied to a buffer with room for as many elements again, to be
+     shared in turn when more elements are appended to the new
+     array.  */
+  if (packed1 == NULL
+      && !PVM_VAL_ARR_MAPPED_P (arr1)
+      && PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr1)) == 0
+      && (nelem1 == 0
+          || PVM_VAL_ARR_ELEM_OFFSET (arr1, nelem1 - 1) != PVM_NULL))
+    {
+      int used_p = (nelem > PVM_VAL_ARR_NALLOCATED (arr1));
+      uint64_t boffset;
+
+      for (i = nelem1; !used_p && i < nelem; ++i)
+        used_p = (PVM_VAL_ARR_ELEM_VALUE (arr1, i) != PVM_NULL);
+
+      /* The buffer allocated by pvm_make_array is replaced below, so
+         keep it small.  */
+      res = pvm_make_array (pvm_make_ulong (1, 64), type);
+      PVM_VAL_ARR_PACKED (res) = NULL;
+      if (used_p)
+        {
+          PVM_VAL_ARR_ELEMS (res)
+            = pvm_array_copy_elems (PVM_VAL_ARR_ELEMS (arr1), nelem1,
+                                    nelem * 2);
+          PVM_VAL_ARR_NALLOCATED (res) = nelem * 2;
+        }
+      else
+        {
+          PVM_VAL_ARR_ELEMS (res) = PVM_VAL_ARR_ELEMS (arr1);
+          PVM_VAL_ARR_NALLOCATED (res) = PVM_VAL_ARR_NALLOCATED (arr1);
+          PVM_VAL_ARR_SHARED_P (res) = 1;
+          PVM_VAL_ARR_SHARED_P (arr1) = 1;
+        }
+
+      boffset = (nelem1 == 0
+                 ? 0
+                 : (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr1, nelem1 - 1))
+                    + pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr1, nelem1 - 1))));
+      for (i = 0; i < nelem2; ++i)
+        {
+          pvm_val val = pvm_array_elem_value (arr2, i);
+
+          PVM_VAL_ARR_ELEM_VALUE (res, nelem1 + i) = val;
+          PVM_VAL_ARR_ELEM_OFFSET (res, nelem1 + i)
+            = pvm_make_ulong (boffset, 64);
+          boffset += pvm_sizeof (val);
+        }
+
+      PVM_VAL_ARR_NELEM (res) = pvm_make_ulong (nelem, 64);
+      return res;
+    }
+
+  /* Otherwise append the elements one by one.  */
+  res = pvm_make_array (pvm_make_ulong (nelem, 64), type);
+  for (i = 0; i < nelem; ++i)
+    (void) pvm_array_insert (res, pvm_make_ulong (i, 64),
+                             (i < nelem1
+                              ? pvm_array_elem_value (arr1, i)
+                              : pvm_array_elem_value (arr2, i - nelem1)));
+
+  return res;
+}
+
+int
+pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
+{
+  size_t index = PVM_VAL_ULONG (idx);
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t nallocated;
+  size_t nelem_to_add = index - nelem + 1;
+  size_t val_size = pvm_sizeof (val);
+  size_t array_boffset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr));
+  size_t elem_boffset = array_boffset + pvm_sizeof (arr);
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t raw;
+  size_t i;
+
+  /* First of all, make sure that the given index doesn't correspond
+     to an existing element.  If that is the case, return 0 now.  */
+  if (index < nelem)
+    return 0;
+
+  /* We have a hard-limit in the number of elements to append, in
+     order to avoid malicious code or harmful bugs.  */
+  if (nelem_to_add > 1024)
+    return 0;
+
+  if (packed && pvm_packed_unbox (packed, val, &raw))
+    {
+      /* Elements of packed arrays are contiguous, and their offsets
+         are determined by the offset of the first one.  */
+      pvm_array_packed_load_all (arr);
+      if (nelem == 0)
+        packed->boffset = array_boffset;
+
+      /* Make space for the new elements, plus a buffer of 16
+         elements more.  Grow geometrically, since packed arrays
+         usually get all their elements appended one by one.  */
+      if (packed->nallocated < nelem + nelem_to_add)
+        pvm_packed_reserve (packed, (nelem + nelem_to_add) * 2 + 16);
+
+      for (i = nelem; i <= index; ++i)
+        pvm_packed_put (packed, i, raw);
+    }
+  else
+    {
+      pvm_array_materialize (arr);
+
+      /* The elements of an array sharing them with other arrays can
+         only be stored in place if no other array uses their
+         positions.  */
+      if (PVM_VAL_ARR_SHARED_P (arr))
+        {
+          int used_p = (index >= PVM_VAL_ARR_NALLOCATED (arr));
+
+          for (i = nelem; !used_p && i <= index; ++i)
+            used_p = (PVM_VAL_ARR_ELEM_VALUE (arr, i) != PVM_NULL);
+          if (used_p)
+            pvm_array_unshare (arr);
+        }
+      nallocated = PVM_VAL_ARR_NALLOCATED (arr);
+
+      /* Make sure there is enough room in the array for the new
+         elements.  Otherwise, make space for the new elements, plus a
+         buffer of 16 elements more.  Grow geometrically, so appending
+         elements one by one takes amortized constant time.  */
+      if ((nallocated - nelem) < nelem_to_add)
+        {
+          PVM_VAL_ARR_NALLOCATED (arr) = nallocated * 2 + nelem_to_add + 16;
+          PVM_VAL_ARR_ELEMS (arr) = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
+                                                 PVM_VAL_ARR_NALLOCATED (arr)
+                                                 * sizeof (struct pvm_array_elem));
+
+          for (i = index + 1; i < PVM_VAL_ARR_NALLOCATED (arr); ++i)
+            {
+              PVM_VAL_ARR_ELEM_VALUE (arr, i) = PVM_NULL;
+              PVM_VAL_ARR_ELEM_OFFSET (arr, i) = PVM_NULL;
+            }
+        }
+
+      /* Initialize the new elements with the given value, also
+         setting their bit-offset.  */
+      for (i = nelem; i <= PVM_VAL_ULONG (idx); ++i)
+        {
+          PVM_VAL_ARR_ELEM_VALUE (arr, i) = val;
+          PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (elem_boffset, 64);
+          elem_boffset += val_size;
+        }
+    }
+
+  /* Finally, adjust the number of elements.  */
+  PVM_VAL_ARR_NELEM (arr)
+    = pvm_make_ulong (PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) + nelem_to_add, 64);
+
+  return 1;
+}
+
+int
+pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
+{
+  size_t index = PVM_VAL_ULONG (idx);
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  size_t elem_boffset;
+  uint64_t raw;
+  size_t i;
+
+  /* Make sure that the given index is within bounds.  */
+  if (index >= nelem)
+    return 0;
+
+  /* Elements of packed arrays all have the same size, so there are
+     no offsets to recalculate.  */
+  if (packed && pvm_packed_unbox (packed, val, &raw))
+    {
+      if (packed->lazy_p)
+        {
+          if (packed->data == NULL)
+            pvm_array_packed_alloc (arr);
+          PVM_PACKED_SET_PRESENT (packed, index);
+        }
+
+      pvm_packed_put (packed, index, raw);
+      return 1;
+    }
+
+  pvm_array_materialize (arr);
+  pvm_array_unshare (arr);
+
+  /* Update the element with the given value.  */
+  PVM_VAL_ARR_ELEM_VALUE (arr, index) = val;
+
+  /* Recalculate the bit-offset of all the elemens following the
+     element just updated.  */
+  elem_boffset
+    = (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, index))
+       + pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, index)));
+
+  for (i = index + 1; i < nelem; ++i)
+    {
+      PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (elem_boffset, 64);
+      elem_boffset += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, i));
+    }
+
+  return 1;
+}
+
+int
+pvm_array_rem (pvm_val arr, pvm_val idx)
+{
+  size_t index = PVM_VAL_ULONG (idx);
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  size_t i;
+
+  /* Make sure the given index is within bounds.  */
+  if (index >= nelem)
+    return 0;
+
+  if (packed)
+    {
+      pvm_array_packed_load_all (arr);
+      memmove ((char *) packed->data + index * packed->width,
+               (char *) packed->data + (index + 1) * packed->width,
+               (nelem - index - 1) * packed->width);
+    }
+  else
+    {
+      pvm_array_unshare (arr);
+      for (i = index; i < (nelem - 1); i++)
+        PVM_VAL_ARR_ELEM (arr,i) = PVM_VAL_ARR_ELEM (arr, i + 1);
+    }
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
+
+  return 1;
+}
+
+/* Items sorted by pvm_array_sort.  KEY is the key of the element, in
+   a representation in which keys compare like unsigned integers, and
+   IDX is its original position in the array.  */
+
+struct pvm_sort_item
+{
+  uint64_t key;
+  uint64_t idx;
+};
+
+/* Items are ordered by key, and items with equal keys by original
+   position.  No two items are thus equal, and the resulting order is
+   the one a stable sort would produce.  */
+
+#define PVM_SORT_LESS(A,B)                                      \
+  ((A).key < (B).key || ((A).key == (B).key && (A).idx < (B).idx))
+
+#define PVM_SORT_SWAP(A,B)                      \
+  do                                            \
+    {                                           \
+      struct pvm_sort_item _tmp = (A);          \
+      (A) = (B);                                \
+      (B) = _tmp;                               \
+    }                                           \
+  while (0)
+
+/* Ranges of up to this number of items are sorted by insertion.  */
+#define PVM_SORT_INSERTION_MAX 16
+
+static void
+pvm_sort_insertion (struct pvm_sort_item *items, uint64_t n)
+{
+  uint64_t i, j;
+
+  for (i = 1; i < n; ++i)
+    {
+      struct pvm_sort_item item = items[i];
+
+      for (j = i; j > 0 && PVM_SORT_LESS (item, items[j - 1]); --j)
+        items[j] = items[j - 1];
+      items[j] = item;
+    }
+}
+
+static void
+pvm_sort_sift_down (struct pvm_sort_item *items, uint64_t root,
+                    uint64_t n)
+{
+  uint64_t child;
+
+  while ((child = 2 * root + 1) < n)
+    {
+      if (child + 1 < n && PVM_SORT_LESS (items[child], items[child + 1]))
+        child++;
+      if (!PVM_SORT_LESS (items[root], items[child]))
+        return;
+      PVM_SORT_SWAP (items[root], items[child]);
+      root = child;
+    }
+}
+
+static void
+pvm_sort_heap (struct pvm_sort_item *items, uint64_t n)
+{
+  uint64_t i;
+
+  for (i = n / 2; i > 0; --i)
+    pvm_sort_sift_down (items, i - 1, n);
+  for (i = n - 1; i > 0; --i)
+    {
+      PVM_SORT_SWAP (items[0], items[i]);
+      pvm_sort_sift_down (items, 0, i);
+    }
+}
+
+/* Sort the N items in ITEMS using introsort: quicksort with a
+   median-of-three pivot, falling back to heapsort if the recursion
+   gets deeper than DEPTH, and to insertion sort for small ranges.
+   The recursion happens on the smaller partition, so the stack depth
+   is bounded by log2 (N).  */
+
+static void
+pvm_sort_intro (struct pvm_sort_item *items, uint64_t n, int depth)
+{
+  while (n > PVM_SORT_INSERTION_MAX)
+    {
+      struct pvm_sort_item pivot;
+      uint64_t mid = n / 2, i, j;
+
+      if (depth-- == 0)
+        {
+          pvm_sort_heap (items, n);
+          return;
+        }
+
+      /* Put the median of the first, middle and last items in the
+         middle, and use it as the pivot.  */
+      if (PVM_SORT_LESS (items[mid], items[0]))
+        PVM_SORT_SWAP (items[mid], items[0]);
+      if (PVM_SORT_LESS (items[n - 1], items[mid]))
+        {
+          PVM_SORT_SWAP (items[n - 1], items[mid]);
+          if (PVM_SORT_LESS (items[mid], items[0]))
+            PVM_SORT_SWAP (items[mid], items[0]);
+        }
+      pivot = items[mid];
+
+      /* Hoare partition.  The first and last items act as
+         sentinels.  */
+      i = 0;
+      j = n - 1;
+      for (;;)
+        {
+          while (PVM_SORT_LESS (items[i], pivot))
+            i++;
+          while (PVM_SORT_LESS (pivot, items[j]))
+            j--;
+          if (i >= j)
+            break;
+          PVM_SORT_SWAP (items[i], items[j]);
+          i++;
+          j--;
+        }
+
+      /* items[0..j] <= pivot <= items[j+1..n-1].  */
+      if (j + 1 < n - j - 1)
+        {
+          pvm_sort_intro (items, j + 1, depth);
+          items += j + 1;
+          n -= j + 1;
+        }
+      else
+        {
+          pvm_sort_intro (items + j + 1, n - j - 1, depth);
+          n = j + 1;
+        }
+    }
+
+  pvm_sort_insertion (items, n);
+}
+
+/* Compute in *KEY the sorting key of the value VAL.  *KIND and *UNIT
+   hold the kind of the keys found so far: 0 if there were none, 1 for
+   unsigned integers and 2 for signed integers.  Offsets count as
+   integers, with the unit in *UNIT.  Signed keys have their sign bit
+   flipped, so they compare like unsigned integers.
+
+   Return 1 if VAL is suitable as a key, 0 otherwise.  */
+
+static int
+pvm_sort_key (pvm_val val, int *kind, uint64_t *unit, uint64_t *key)
+{
+  uint64_t val_unit = 0;
+  int val_kind;
+
+  if (PVM_IS_OFF (val))
+    {
+      val_unit = PVM_VAL_ULONG (PVM_VAL_OFF_UNIT (val));
+      val = PVM_VAL_OFF_MAGNITUDE (val);
+    }
+
+  if (PVM_IS_INT (val))
+    {
+      val_kind = 2;
+      *key = (uint64_t) (int64_t) PVM_VAL_INT (val);
+    }
+  else if (PVM_IS_LONG (val))
+    {
+      val_kind = 2;
+      *key = (uint64_t) PVM_VAL_LONG (val);
+    }
+  else if (PVM_IS_UINT (val))
+    {
+      val_kind = 1;
+      *key = PVM_VAL_UINT (val);
+    }
+  else if (PVM_IS_ULONG (val))
+    {
+      val_kind = 1;
+      *key = PVM_VAL_ULONG (val);
+    }
+  else
+    return 0;
+
+  if (*kind == 0)
+    {
+      *kind = val_kind;
+      *unit = val_unit;
+    }
+  else if (*kind != val_kind || *unit != val_unit)
+    return 0;
+
+  if (val_kind == 2)
+    *key ^= (uint64_t) 1 << 63;
+  return 1;
+}
+
+int
+pvm_array_sort (pvm_val arr, pvm_val by,
+                uint64_t left, uint64_t right)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  struct pvm_sort_item *items;
+  uint64_t n, i, unit = 0;
+  size_t field_idx = 0;
+  int kind = 0, depth = 0;
+
+  if (left > right || right >= nelem)
+    return 0;
+  n = right - left + 1;
+
+  if (by != PVM_NULL && PVM_IS_ARR (by)
+      && PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (by)) != n)
+    return 0;
+
+  /* The elements of packed arrays are integers, not structs.  */
+  if (packed)
+    {
+      if (by != PVM_NULL && !PVM_IS_ARR (by))
+        return 0;
+      pvm_array_packed_load_all (arr);
+    }
+  if (by != PVM_NULL && PVM_IS_ARR (by))
+    pvm_array_packed_load_all (by);
+
+  items = xmalloc (n * sizeof (struct pvm_sort_item));
+  for (i = 0; i < n; ++i)
+    {
+      pvm_val key;
+
+      items[i].idx = left + i;
+
+      if (by == PVM_NULL && packed)
+        {
+          /* Packed elements are all of the same type, and their raw
+             values can be used as keys directly.  */
+          uint64_t raw = pvm_packed_get (packed, left + i);
+          int esize = packed->esize;
+
+          if (packed->signed_p)
+            raw = (((uint64_t) ((int64_t) (raw << (64 - esize))
+                                >> (64 - esize)))
+                   ^ ((uint64_t) 1 << 63));
+          items[i].key = raw;
+          continue;
+        }
+      else if (by == PVM_NULL)
+        key = PVM_VAL_ARR_ELEM_VALUE (arr, left + i);
+      else if (PVM_IS_ARR (by))
+        key = pvm_array_elem_value (by, i);
+      else
+        {
+          /* Elements of the same type usually have the field at the
+             same position, so try there first.  */
+          pvm_val sct = PVM_VAL_ARR_ELEM_VALUE (arr, left + i);
+          const char *name = PVM_VAL_STR (by);
+
+          if (!PVM_IS_SCT (sct))
+            goto fail;
+
+          if (field_idx < PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct))
+              && !PVM_VAL_SCT_FIELD_ABSENT_P (sct, field_idx)
+              && PVM_VAL_SCT_FIELD_NAME (sct, field_idx) != PVM_NULL
+              && STREQ (PVM_VAL_STR (PVM_VAL_SCT_FIELD_NAME (sct,
+                                                            field_idx)),
+                        name))
+            key = PVM_VAL_SCT_FIELD_VALUE (sct, field_idx);
+          else
+            {
+              size_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+
+              for (field_idx = 0; field_idx < nfields; ++field_idx)
+                if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, field_idx)
+                    && PVM_VAL_SCT_FIELD_NAME (sct, field_idx) != PVM_NULL
+                    && STREQ (PVM_VAL_STR (PVM_VAL_SCT_FIELD_NAME (sct,
+                                                                  field_idx)),
+                              name))
+                  break;
+
+              if (field_idx == nfields)
+                goto fail;
+              key = PVM_VAL_SCT_FIELD_VALUE (sct, field_idx);
+            }
+        }
+
+      if (!pvm_sort_key (key, &kind, &unit, &items[i].key))
+        goto fail;
+    }
+
+  for (i = n; i > 1; i /= 2)
+    depth += 2;
+  pvm_sort_intro (items, n, depth);
+
+  /* Move the elements to their new positions.  */
+  if (packed)
+    {
+      uint64_t *raws = xmalloc (n * sizeof (uint64_t));
+
+      for (i = 0; i < n; ++i)
+        raws[i] = pvm_packed_get (packed, items[i].idx);
+      for (i = 0; i < n; ++i)
+        pvm_packed_put (packed, left + i, raws[i]);
+      free (raws);
+    }
+  else
+    {
+      pvm_val *values = xmalloc (n * sizeof (pvm_val));
+
+      pvm_array_unshare (arr);
+      for (i = 0; i < n; ++i)
+        values[i] = PVM_VAL_ARR_ELEM_VALUE (arr, items[i].idx);
+      for (i = 0; i < n; ++i)
+        PVM_VAL_ARR_ELEM_VALUE (arr, left + i) = values[i];
+      free (values);
+
+      /* Recalculate the bit-offsets of the moved elements, like
+         pvm_array_set does.  */
+      if (PVM_VAL_ARR_ELEM_OFFSET (arr, left) != PVM_NULL)
+        {
+          uint64_t elem_boffset
+            = PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, left));
+
+          for (i = left; i <= right; ++i)
+            {
+              PVM_VAL_ARR_ELEM_OFFSET (arr, i)
+                = pvm_make_ulong (elem_boffset, 64);
+              elem_boffset += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, i));
+            }
+        }
+    }
+
+  free (items);
+  return 1;
+
+ fail:
+  free (items);
+  return 0;
+}
+
+void
+pvm_array_reverse (pvm_val arr)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t l, h;
+
+  if (nelem < 2)
+    return;
+
+  if (packed)
+    {
+      pvm_array_packed_load_all (arr);
+      for (l = 0, h = nelem - 1; l < h; ++l, --h)
+        {
+          uint64_t raw = pvm_packed_get (packed, l);
+
+          pvm_packed_put (packed, l, pvm_packed_get (packed, h));
+          pvm_packed_put (packed, h, raw);
+        }
+      return;
+    }
+
+  pvm_array_unshare (arr);
+  for (l = 0, h = nelem - 1; l < h; ++l, --h)
+    {
+      pvm_val tmp = PVM_VAL_ARR_ELEM_VALUE (arr, l);
+
+      PVM_VAL_ARR_ELEM_VALUE (arr, l) = PVM_VAL_ARR_ELEM_VALUE (arr, h);
+      PVM_VAL_ARR_ELEM_VALUE (arr, h) = tmp;
+    }
+
+  /* The elements may be of different sizes.  Recalculate their
+     bit-offsets like pvm_array_set does.  */
+  if (PVM_VAL_ARR_ELEM_OFFSET (arr, 0) != PVM_NULL)
+    {
+      uint64_t elem_boffset = PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, 0));
+
+      for (l = 0; l < nelem; ++l)
+        {
+          PVM_VAL_ARR_ELEM_OFFSET (arr, l) = pvm_make_ulong (elem_boffset, 64);
+          elem_boffset += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, l));
+        }
+    }
+}
+
+/* Return 1 if the elements of the array ARR are stored in a buffer of
+   bytes, which can be accessed directly.  */
+
+static int
+pvm_array_bytes_p (pvm_val arr)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+
+  if (!packed || packed->width != 1 || packed->esize != 8)
+    return 0;
+
+  pvm_array_packed_load_all (arr);
+  return packed->data != NULL
+         || PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) == 0;
+}
+
+pvm_val
+pvm_array_to_string (pvm_val arr)
+{
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t len;
+  char *s;
+
+  if (pvm_array_bytes_p (arr))
+    {
+      const char *data = PVM_VAL_ARR_PACKED (arr)->data;
+      const char *nul = nelem ? memchr (data, '\0', nelem) : NULL;
+
+      len = nul ? nul - data : nelem;
+      s = pvm_alloc_atomic (len + 1);
+      if (len)
+        memcpy (s, data, len);
+    }
+  else
+    {
+      pvm_array_packed_load_all (arr);
+      s = pvm_alloc_atomic (nelem + 1);
+      for (len = 0; len < nelem; ++len)
+        {
+          char c = PVM_VAL_UINT (pvm_array_elem_value (arr, len));
+
+          if (c == '\0')
+            break;
+          s[len] = c;
+        }
+    }
+
+  s[len] = '\0';
+  return pvm_make_string_nodup (s);
+}
+
+int
+pvm_array_from_string (pvm_val arr, pvm_val str, uint8_t fill)
+{
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t len = pvm_string_length (str);
+  const char *s = PVM_VAL_STR (str);
+  uint64_t i;
+
+  if (len > nelem)
+    return 0;
+
+  if (pvm_array_bytes_p (arr))
+    {
+      char *data = PVM_VAL_ARR_PACKED (arr)->data;
+
+      memcpy (data, s, len);
+      memset (data + len, fill, nelem - len);
+    }
+  else
+    {
+      for (i = 0; i < nelem; ++i)
+        {
+          uint8_t c = i < len ? s[i] : fill;
+
+          (void) pvm_array_set (arr, pvm_make_ulong (i, 64),
+                                PVM_MAKE_UINT (c, 8));
+        }
+    }
+
+  return 1;
+}
+
+/* Return 1 if the elements of the array ARR are of an integral type,
+   and the positions IDX to IDX + COUNT - 1 are within its
+   boundaries.  */
+
+static int
+pvm_array_integral_range_p (pvm_val arr, uint64_t idx, uint64_t count)
+{
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (arr));
+
+  return (PVM_VAL_TYP_CODE (etype) == PVM_TYPE_INTEGRAL
+          && idx <= nelem && count <= nelem - idx);
+}
+
+int
+pvm_array_get_integrals (pvm_val arr, uint64_t idx, uint64_t count,
+                         uint64_t *buf)
+{
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  uint64_t i;
+
+  if (!pvm_array_integral_range_p (arr, idx, count))
     return 0;
 
-  /* Make sure there is enough room in the array for the new elements.
-     Otherwise, make space for the new elements, plus a buffer of 16
-     elements more.  */
-  if ((nallocated - nelem) < nelem_to_add)
+  if (packed)
     {
-      PVM_VAL_ARR_NALLOCATED (arr) += nelem_to_add + 16;
-      PVM_VAL_ARR_ELEMS (arr) = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
-                                             PVM_VAL_ARR_NALLOCATED (arr)
-                                             * sizeof (struct pvm_array_elem));
+      int esize = packed->esize;
 
-      for (i = index + 1; i < PVM_VAL_ARR_NALLOCATED (arr); ++i)
+      for (i = 0; i < count; ++i)
         {
-          PVM_VAL_ARR_ELEM_VALUE (arr, i) = PVM_NULL;
-          PVM_VAL_ARR_ELEM_OFFSET (arr, i) = PVM_NULL;
+          uint64_t raw = 0;
+
+          if (packed->lazy_p
+              && (packed->data == NULL
+                  || !PVM_PACKED_PRESENT_P (packed, idx + i)))
+            (void) pvm_array_packed_load (arr, idx + i);
+
+          /* Elements that can't be read from IO are copied as
+             zero.  */
+          if (!packed->lazy_p || PVM_PACKED_PRESENT_P (packed, idx + i))
+            raw = pvm_packed_get (packed, idx + i);
+
+          if (packed->signed_p)
+            raw = (uint64_t) ((int64_t) (raw << (64 - esize))
+                              >> (64 - esize));
+          buf[i] = raw;
         }
     }
-
-  /* Initialize the new elements with the given value, also setting
-     their bit-offset.  */
-  for (i = nelem; i <= PVM_VAL_ULONG (idx); ++i)
+  else
     {
-      PVM_VAL_ARR_ELEM_VALUE (arr, i) = val;
-      PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (elem_boffset, 64);
-      elem_boffset += val_size;
+      for (i = 0; i < count; ++i)
+        buf[i] = PVM_VAL_INTEGRAL (PVM_VAL_ARR_ELEM_VALUE (arr, idx + i));
     }
 
-  /* Finally, adjust the number of elements.  */
-  PVM_VAL_ARR_NELEM (arr)
-    = pvm_make_ulong (PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) + nelem_to_add, 64);
-
   return 1;
 }
 
 int
-pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
+pvm_array_set_integrals (pvm_val arr, uint64_t idx, uint64_t count,
+                         const uint64_t *buf)
 {
-  size_t index = PVM_VAL_ULONG (idx);
-  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
-  size_t elem_boffset;
-  size_t i;
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (arr));
+  uint64_t i;
 
-  /* Make sure that the given index is within bounds.  */
-  if (index >= nelem)
+  if (!pvm_array_integral_range_p (arr, idx, count))
     return 0;
 
-  /* Update the element with the given value.  */
-  PVM_VAL_ARR_ELEM_VALUE (arr, index) = val;
-
-  /* Recalculate the bit-offset of all the elemens following the
-     element just updated.  */
-  elem_boffset
-    = (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, index))
-       + pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, index)));
+  if (packed)
+    {
+      uint64_t mask = (packed->esize == 64
+                       ? UINT64_MAX : (UINT64_C (1) << packed->esize) - 1);
 
-  for (i = index + 1; i < nelem; ++i)
+      if (packed->lazy_p && packed->data == NULL)
+        pvm_array_packed_alloc (arr);
+      for (i = 0; i < count; ++i)
+        {
+          if (packed->lazy_p)
+            PVM_PACKED_SET_PRESENT (packed, idx + i);
+          pvm_packed_put (packed, idx + i, buf[i] & mask);
+        }
+    }
+  else
     {
-      PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (elem_boffset, 64);
-      elem_boffset += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, i));
+      /* The elements of the array have all the same size, so their
+         offsets don't change.  */
+      pvm_array_unshare (arr);
+      for (i = 0; i < count; ++i)
+        PVM_VAL_ARR_ELEM_VALUE (arr, idx + i)
+          = pvm_make_integral_bits (buf[i], etype);
     }
 
   return 1;
 }
 
-int
-pvm_array_rem (pvm_val arr, pvm_val idx)
+void *
+pvm_array_packed_data (pvm_val arr, int *width)
 {
-  size_t index = PVM_VAL_ULONG (idx);
-  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
-  size_t i;
+  struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (arr);
 
-  /* Make sure the given index is within bounds.  */
-  if (index >= nelem)
-    return 0;
+  if (!packed)
+    return NULL;
 
-  for (i = index; i < (nelem - 1); i++)
-    PVM_VAL_ARR_ELEM (arr,i) = PVM_VAL_ARR_ELEM (arr, i + 1);
-  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
+  pvm_array_packed_load_all (arr);
+  if (packed->data == NULL
+      && PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) != 0)
+    return NULL;
 
-  return 1;
+  *width = packed->width;
+  return packed->data;
 }
 
 pvm_val
@@ -239,10 +1922,12 @@ pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
   PVM_MAPINFO_STRICT_P (sct->mapinfo) = 1;
   PVM_MAPINFO_IOS (sct->mapinfo) = PVM_NULL;
   PVM_MAPINFO_OFFSET (sct->mapinfo) = pvm_make_ulong (0, 64);
+  PVM_MAPINFO_GENERATION (sct->mapinfo) = 0;
 
   PVM_MAPINFO_MAPPED_P (sct->mapinfo_back) = 0;
   PVM_MAPINFO_IOS (sct->mapinfo_back) = PVM_NULL;
   PVM_MAPINFO_OFFSET (sct->mapinfo_back) = PVM_NULL;
+  PVM_MAPINFO_GENERATION (sct->mapinfo_back) = 0;
 
   sct->mapper = PVM_NULL;
   sct->writer = PVM_NULL;
@@ -270,16 +1955,108 @@ pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
     {
       sct->methods[i].name = PVM_NULL;
       sct->methods[i].value = PVM_NULL;
+      sct->methods[i].memo = PVM_NULL;
     }
 
   PVM_VAL_BOX_SCT (box) = sct;
   return PVM_BOX (box);
 }
 
-pvm_val
-pvm_ref_struct_cstr (pvm_val sct, const char *name)
+/* Structs with less fields than this are looked up linearly, which
+   is faster than hashing the name.  */
+#define PVM_SCT_FHASH_MIN_FIELDS 8
+
+/* Build the field name hash table of the struct type TYPE.  */
+
+static void
+pvm_sct_build_fhash (pvm_val type)
+{
+  size_t nfields = PVM_VAL_ULONG (PVM_VAL_TYP_S_NFIELDS (type));
+  uint32_t size = 16, i;
+  uint32_t *fhash;
+
+  while (size < nfields * 2)
+    size <<= 1;
+
+  fhash = pvm_alloc_atomic (size * sizeof (uint32_t));
+  memset (fhash, 0, size * sizeof (uint32_t));
+
+  /* Insert the fields in reverse order, so the first occurrence of a
+     repeated name wins like in a linear scan.  */
+  for (i = nfields; i > 0; --i)
+    {
+      pvm_val fname = PVM_VAL_TYP_S_FNAME (type, i - 1);
+      uint32_t slot;
+
+      if (fname == PVM_NULL)
+        continue;
+
+      slot = pvm_string_hash (PVM_VAL_STR (fname)) & (size - 1);
+      while (fhash[slot] != 0
+             && !STREQ (PVM_VAL_STR (PVM_VAL_TYP_S_FNAME (type,
+                                                          fhash[slot] - 1)),
+                        PVM_VAL_STR (fname)))
+        slot = (slot + 1) & (size - 1);
+      fhash[slot] = i;
+    }
+
+  PVM_VAL_TYP_S_FHASH_MASK (type) = size - 1;
+  PVM_VAL_TYP_S_FHASH (type) = fhash;
+}
+
+/* Return the index of the field named NAME in the struct value SCT,
+   or -1 if the struct type of SCT doesn't provide a usable hint.  The
+   returned index is guaranteed to denote a field named NAME in SCT,
+   but the field may be absent.  */
+
+static ssize_t
+pvm_sct_field_index (pvm_val sct, const char *name)
+{
+  pvm_val type = PVM_VAL_SCT_TYPE (sct);
+  size_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+  uint32_t *fhash, slot, mask, idx;
+
+  if (nfields < PVM_SCT_FHASH_MIN_FIELDS
+      || !PVM_IS_TYP (type)
+      || PVM_VAL_TYP_CODE (type) != PVM_TYPE_STRUCT
+      || PVM_VAL_ULONG (PVM_VAL_TYP_S_NFIELDS (type)) != nfields)
+    return -1;
+
+  if (PVM_VAL_TYP_S_FHASH (type) == NULL)
+    pvm_sct_build_fhash (type);
+
+  fhash = PVM_VAL_TYP_S_FHASH (type);
+  mask = PVM_VAL_TYP_S_FHASH_MASK (type);
+  for (slot = pvm_string_hash (name) & mask;
+       (idx = fhash[slot]) != 0;
+       slot = (slot + 1) & mask)
+    {
+      pvm_val fname = PVM_VAL_SCT_FIELD_NAME (sct, idx - 1);
+
+      /* The field names of the value normally match the ones of the
+         type, but be conservative.  */
+      if (fname != PVM_NULL && STREQ (PVM_VAL_STR (fname), name))
+        return idx - 1;
+      if (STREQ (PVM_VAL_STR (PVM_VAL_TYP_S_FNAME (type, idx - 1)), name))
+        return -1;
+    }
+
+  return -1;
+}
+
+/* Return whether the struct element name NAME, which is a PVM
+   string, is the string NAME_VAL or has the contents CNAME.  NAME_VAL
+   can be PVM_NULL.  Interned names are the same PVM value, so they
+   are found without comparing characters.  */
+
+#define PVM_SCT_NAME_EQ(NAME, NAME_VAL, CNAME)                  \
+  ((NAME) == (NAME_VAL) || STREQ (PVM_VAL_STR ((NAME)), (CNAME)))
+
+static pvm_val
+pvm_ref_struct_1 (pvm_val sct, pvm_val name_val, const char *name)
 {
   size_t nfields, nmethods, i;
+  ssize_t idx;
   struct pvm_struct_field *fields;
   struct pvm_struct_method *methods;
 
@@ -289,12 +2066,15 @@ pvm_ref_struct_cstr (pvm_val sct, const char *name)
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
   fields = PVM_VAL_SCT (sct)->fields;
 
+  idx = pvm_sct_field_index (sct, name);
+  if (idx != -1 && !PVM_VAL_SCT_FIELD_ABSENT_P (sct, idx))
+    return fields[idx].value;
+
   for (i = 0; i < nfields; ++i)
     {
       if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
           && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    name))
+          && PVM_SCT_NAME_EQ (fields[i].name, name_val, name))
         return fields[i].value;
     }
 
@@ -304,19 +2084,24 @@ pvm_ref_struct_cstr (pvm_val sct, const char *name)
 
   for (i = 0; i < nmethods; ++i)
     {
-      if (STREQ (PVM_VAL_STR (methods[i].name),
-                 name))
+      if (PVM_SCT_NAME_EQ (methods[i].name, name_val, name))
         return methods[i].value;
     }
 
   return PVM_NULL;
 }
 
+pvm_val
+pvm_ref_struct_cstr (pvm_val sct, const char *name)
+{
+  return pvm_ref_struct_1 (sct, PVM_NULL, name);
+}
+
 pvm_val
 pvm_ref_struct (pvm_val sct, pvm_val name)
 {
   assert (PVM_IS_STR (name));
-  return pvm_ref_struct_cstr (sct, PVM_VAL_STR (name));
+  return pvm_ref_struct_1 (sct, name, PVM_VAL_STR (name));
 }
 
 pvm_val
@@ -325,17 +2110,22 @@ pvm_refo_struct (pvm_val sct, pvm_val name)
   size_t nfields, i;
   struct pvm_struct_field *fields;
 
+  ssize_t idx;
+
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
   fields = PVM_VAL_SCT (sct)->fields;
 
+  idx = pvm_sct_field_index (sct, PVM_VAL_STR (name));
+  if (idx != -1 && !PVM_VAL_SCT_FIELD_ABSENT_P (sct, idx))
+    return fields[idx].offset;
+
   for (i = 0; i < nfields; ++i)
     {
       if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
           && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
+          && PVM_SCT_NAME_EQ (fields[i].name, name, PVM_VAL_STR (name)))
         return fields[i].offset;
     }
 
@@ -348,16 +2138,27 @@ pvm_set_struct (pvm_val sct, pvm_val name, pvm_val val)
   size_t nfields, i;
   struct pvm_struct_field *fields;
 
+  ssize_t idx;
+
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
   fields = PVM_VAL_SCT (sct)->fields;
 
+  pvm_struct_memo_flush (sct);
+
+  idx = pvm_sct_field_index (sct, PVM_VAL_STR (name));
+  if (idx != -1)
+    {
+      PVM_VAL_SCT_FIELD_VALUE (sct,idx) = val;
+      PVM_VAL_SCT_FIELD_MODIFIED (sct,idx) = PVM_MAKE_INT (1, 32);
+      return 1;
+    }
+
   for (i = 0; i < nfields; ++i)
     {
       if (fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
+          && PVM_SCT_NAME_EQ (fields[i].name, name, PVM_VAL_STR (name)))
         {
           PVM_VAL_SCT_FIELD_VALUE (sct,i) = val;
           PVM_VAL_SCT_FIELD_MODIFIED (sct,i) =
@@ -384,6 +2185,335 @@ pvm_get_struct_method (pvm_val sct, const char *name)
   return PVM_NULL;
 }
 
+/* Return the index of the method NAME of the struct SCT, or -1 if
+   the struct has no such method.  */
+
+static ssize_t
+pvm_sct_method_index (pvm_val sct, pvm_val name)
+{
+  size_t i, nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
+  struct pvm_struct_method *methods = PVM_VAL_SCT (sct)->methods;
+
+  for (i = 0; i < nmethods; ++i)
+    {
+      if (PVM_SCT_NAME_EQ (methods[i].name, name, PVM_VAL_STR (name)))
+        return i;
+    }
+
+  return -1;
+}
+
+/* Cached results are keyed by the argument passed to the method.
+   Offsets are keyed by their magnitude in bits, and methods without
+   arguments use a single key.  */
+
+static pvm_val
+pvm_struct_memo_key (pvm_val key)
+{
+  if (key == PVM_NULL)
+    return pvm_make_ulong (0, 64);
+  else if (PVM_IS_OFF (key))
+    return pvm_make_ulong (PVM_VAL_INTEGRAL (PVM_VAL_OFF_MAGNITUDE (key))
+                           * PVM_VAL_ULONG (PVM_VAL_OFF_UNIT (key)),
+                           64);
+
+  return key;
+}
+
+pvm_val
+pvm_struct_memo_get (pvm_val sct, pvm_val name, pvm_val key)
+{
+  ssize_t idx = pvm_sct_method_index (sct, name);
+  pvm_val memo;
+
+  if (idx == -1)
+    return PVM_NULL;
+
+  memo = PVM_VAL_SCT_METHOD_MEMO (sct, idx);
+  if (memo == PVM_NULL)
+    return PVM_NULL;
+
+  return pvm_dict_get (memo, pvm_struct_memo_key (key));
+}
+
+void
+pvm_struct_memo_set (pvm_val sct, pvm_val name, pvm_val key,
+                     pvm_val val)
+{
+  ssize_t idx = pvm_sct_method_index (sct, name);
+  pvm_val memo;
+
+  if (idx == -1)
+    return;
+
+  key = pvm_struct_memo_key (key);
+  memo = PVM_VAL_SCT_METHOD_MEMO (sct, idx);
+  if (memo == PVM_NULL)
+    {
+      memo = pvm_make_dict (pvm_make_dict_type (pvm_typeof (key),
+                                                pvm_typeof (val)));
+      PVM_VAL_SCT_METHOD_MEMO (sct, idx) = memo;
+    }
+
+  pvm_dict_set (memo, key, val);
+}
+
+void
+pvm_struct_memo_flush (pvm_val sct)
+{
+  size_t i, nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
+
+  for (i = 0; i < nmethods; ++i)
+    PVM_VAL_SCT_METHOD_MEMO (sct, i) = PVM_NULL;
+}
+
+pvm_val
+pvm_make_dict (pvm_val type)
+{
+  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_DCT);
+  pvm_dict dict = pvm_alloc (sizeof (struct pvm_dict));
+
+  dict->type = type;
+  dict->nelem = 0;
+  dict->nentries = 0;
+  dict->nallocated = 0;
+  dict->entries = NULL;
+  dict->slots = NULL;
+  dict->slots_mask = 0;
+
+  PVM_VAL_BOX_DCT (box) = dict;
+  return PVM_BOX (box);
+}
+
+/* Keys of dicts are either strings or integers, all of the same
+   type.  Integers are hashed by value, mixing their bits so
+   consecutive keys, which are common, spread over the table.  */
+
+static uint32_t
+pvm_dict_hash (pvm_val key)
+{
+  uint64_t k;
+
+  if (PVM_IS_STR (key))
+    return pvm_string_hash (PVM_VAL_STR (key));
+
+  k = (uint64_t) PVM_VAL_INTEGRAL (key);
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  return (uint32_t) k;
+}
+
+static int
+pvm_dict_key_equal_p (pvm_val key1, pvm_val key2)
+{
+  if (PVM_IS_STR (key1))
+    return (key1 == key2
+            || (PVM_IS_STR (key2)
+                && STREQ (PVM_VAL_STR (key1), PVM_VAL_STR (key2))));
+
+  return (PVM_IS_INTEGRAL (key2)
+          && PVM_VAL_INTEGRAL (key1) == PVM_VAL_INTEGRAL (key2));
+}
+
+/* Return the slot of the table of DICT holding the entry for KEY,
+   whose hash is HASH.  If the dict doesn't contain KEY, return the
+   empty slot where it would be stored.  The table shall exist.  */
+
+static uint32_t
+pvm_dict_slot (pvm_dict dict, pvm_val key, uint32_t hash)
+{
+  uint32_t mask = dict->slots_mask;
+  uint32_t slot;
+
+  for (slot = hash & mask; dict->slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+      struct pvm_dict_entry *entry = &dict->entries[dict->slots[slot] - 1];
+
+      if (entry->hash == hash && pvm_dict_key_equal_p (entry->key, key))
+        break;
+    }
+
+  return slot;
+}
+
+/* Make room in DICT for at least one more entry, discarding the
+   removed entries and rebuilding the table if needed.  */
+
+static void
+pvm_dict_reserve (pvm_dict dict)
+{
+  uint64_t i, j, nslots;
+
+  if (dict->nentries < dict->nallocated)
+    return;
+
+  /* Compact the entries.  */
+  for (i = 0, j = 0; i < dict->nentries; ++i)
+    if (dict->entries[i].key != PVM_NULL)
+      dict->entries[j++] = dict->entries[i];
+  dict->nentries = j;
+
+  /* Grow the vector of entries if it is more than half full.  */
+  if (dict->nentries >= dict->nallocated / 2)
+    {
+      uint64_t nallocated
+        = dict->nallocated == 0 ? 8 : dict->nallocated * 2;
+
+      dict->entries
+        = pvm_realloc (dict->entries,
+                       nallocated * sizeof (struct pvm_dict_entry));
+      for (i = dict->nallocated; i < nallocated; ++i)
+        {
+          dict->entries[i].key = PVM_NULL;
+          dict->entries[i].value = PVM_NULL;
+        }
+      dict->nallocated = nallocated;
+    }
+
+  /* Rebuild the table, so it has at least twice as many slots as
+     entries can be stored.  */
+  for (nslots = 16; nslots < dict->nallocated * 2; nslots *= 2)
+    ;
+  assert (nslots <= UINT32_MAX);
+
+  dict->slots = pvm_alloc_atomic (nslots * sizeof (uint32_t));
+  memset (dict->slots, 0, nslots * sizeof (uint32_t));
+  dict->slots_mask = nslots - 1;
+
+  for (i = 0; i < dict->nentries; ++i)
+    {
+      uint32_t slot;
+
+      for (slot = dict->entries[i].hash & dict->slots_mask;
+           dict->slots[slot] != 0;
+           slot = (slot + 1) & dict->slots_mask)
+        ;
+      dict->slots[slot] = i + 1;
+    }
+}
+
+pvm_val
+pvm_dict_get (pvm_val val, pvm_val key)
+{
+  pvm_dict dict = PVM_VAL_DCT (val);
+  uint32_t slot;
+
+  if (dict->nelem == 0)
+    return PVM_NULL;
+
+  slot = pvm_dict_slot (dict, key, pvm_dict_hash (key));
+  if (dict->slots[slot] == 0)
+    return PVM_NULL;
+
+  return dict->entries[dict->slots[slot] - 1].value;
+}
+
+void
+pvm_dict_set (pvm_val val, pvm_val key, pvm_val value)
+{
+  pvm_dict dict = PVM_VAL_DCT (val);
+  uint32_t hash = pvm_dict_hash (key);
+  uint32_t slot;
+  struct pvm_dict_entry *entry;
+
+  if (dict->slots != NULL)
+    {
+      slot = pvm_dict_slot (dict, key, hash);
+      if (dict->slots[slot] != 0)
+        {
+          dict->entries[dict->slots[slot] - 1].value = value;
+          return;
+        }
+    }
+
+  pvm_dict_reserve (dict);
+  slot = pvm_dict_slot (dict, key, hash);
+
+  entry = &dict->entries[dict->nentries];
+  entry->hash = hash;
+  entry->key = key;
+  entry->value = value;
+  dict->slots[slot] = ++dict->nentries;
+  dict->nelem++;
+}
+
+int
+pvm_dict_rem (pvm_val val, pvm_val key)
+{
+  pvm_dict dict = PVM_VAL_DCT (val);
+  uint32_t mask = dict->slots_mask;
+  uint32_t slot, next;
+
+  if (dict->nelem == 0)
+    return 0;
+
+  slot = pvm_dict_slot (dict, key, pvm_dict_hash (key));
+  if (dict->slots[slot] == 0)
+    return 0;
+
+  dict->entries[dict->slots[slot] - 1].key = PVM_NULL;
+  dict->entries[dict->slots[slot] - 1].value = PVM_NULL;
+  dict->nelem--;
+
+  /* Shift back the entries following the removed one in its probe
+     sequence, so no tombstones are needed in the table.  */
+  for (next = (slot + 1) & mask; dict->slots[next] != 0;
+       next = (next + 1) & mask)
+    {
+      uint32_t home
+        = dict->entries[dict->slots[next] - 1].hash & mask;
+
+      if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+          dict->slots[slot] = dict->slots[next];
+          slot = next;
+        }
+    }
+  dict->slots[slot] = 0;
+
+  return 1;
+}
+
+/* Return an array with the keys, or the values if VALUES_P is set,
+   of the entries of the dict VAL, in insertion order.  */
+
+static pvm_val
+pvm_dict_array (pvm_val val, int values_p)
+{
+  pvm_dict dict = PVM_VAL_DCT (val);
+  pvm_val dtype = dict->type;
+  pvm_val etype = (values_p
+                   ? PVM_VAL_TYP_D_VTYPE (dtype)
+                   : PVM_VAL_TYP_D_KTYPE (dtype));
+  pvm_val arr = pvm_make_array (pvm_make_ulong (0, 64),
+                                pvm_make_array_type (etype, PVM_NULL));
+  uint64_t i, n;
+
+  for (i = 0, n = 0; i < dict->nentries; ++i)
+    {
+      struct pvm_dict_entry *entry = &dict->entries[i];
+
+      if (entry->key != PVM_NULL)
+        pvm_array_insert (arr, pvm_make_ulong (n++, 64),
+                          values_p ? entry->value : entry->key);
+    }
+
+  return arr;
+}
+
+pvm_val
+pvm_dict_keys (pvm_val dict)
+{
+  return pvm_dict_array (dict, 0);
+}
+
+pvm_val
+pvm_dict_values (pvm_val dict)
+{
+  return pvm_dict_array (dict, 1);
+}
+
 static pvm_val
 pvm_make_type (enum pvm_type_code code)
 {
@@ -400,8 +2530,28 @@ pvm_make_type (enum pvm_type_code code)
 pvm_val
 pvm_make_integral_type (pvm_val size, pvm_val signed_p)
 {
-  pvm_val itype = pvm_make_type (PVM_TYPE_INTEGRAL);
+  pvm_val itype;
+
+  if (PVM_IS_ULONG (size)
+      && PVM_VAL_ULONG (size) >= 1 && PVM_VAL_ULONG (size) <= 64
+      && (PVM_IS_INT (signed_p) || PVM_IS_UINT (signed_p))
+      && (PVM_VAL_INT (signed_p) == 0 || PVM_VAL_INT (signed_p) == 1))
+    {
+      uint64_t isize = PVM_VAL_ULONG (size);
+      int32_t isigned_p = PVM_VAL_INT (signed_p);
+      pvm_val *cached = &integral_types[isigned_p][isize - 1];
 
+      if (*cached == PVM_NULL)
+        {
+          *cached = pvm_make_type (PVM_TYPE_INTEGRAL);
+          PVM_VAL_TYP_I_SIZE (*cached) = pvm_make_ulong (isize, 64);
+          PVM_VAL_TYP_I_SIGNED_P (*cached) = PVM_MAKE_INT (isigned_p, 32);
+        }
+
+      return *cached;
+    }
+
+  itype = pvm_make_type (PVM_TYPE_INTEGRAL);
   PVM_VAL_TYP_I_SIZE (itype) = size;
   PVM_VAL_TYP_I_SIGNED_P (itype) = signed_p;
   return itype;
@@ -472,6 +2622,16 @@ pvm_make_closure_type (pvm_val rtype,
   return ctype;
 }
 
+pvm_val
+pvm_make_dict_type (pvm_val ktype, pvm_val vtype)
+{
+  pvm_val dtype = pvm_make_type (PVM_TYPE_DICT);
+
+  PVM_VAL_TYP_D_KTYPE (dtype) = ktype;
+  PVM_VAL_TYP_D_VTYPE (dtype) = vtype;
+  return dtype;
+}
+
 pvm_val
 pvm_make_cls (pvm_program program)
 {
@@ -490,14 +2650,37 @@ pvm_make_cls (pvm_program program)
 pvm_val
 pvm_make_offset (pvm_val magnitude, pvm_val unit)
 {
-  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_OFF);
-  pvm_off off = pvm_alloc (sizeof (struct pvm_off));
+  pvm_val_box box;
+  pvm_off off;
+  pvm_val *cached = NULL;
+
+  if (PVM_IS_ULONG (unit) && PVM_VAL_ULONG_SIZE (unit) == 64
+      && (PVM_VAL_ULONG (unit) == 1 || PVM_VAL_ULONG (unit) == 8))
+    {
+      int unit_idx = PVM_VAL_ULONG (unit) == 8;
+
+      if (PVM_IS_INT (magnitude) && PVM_VAL_INT_SIZE (magnitude) == 32
+          && PVM_VAL_INT (magnitude) >= 0
+          && PVM_VAL_INT (magnitude) < PVM_OFFSET_CACHE_SIZE)
+        cached = &offset_cache[0][unit_idx][PVM_VAL_INT (magnitude)];
+      else if (PVM_IS_ULONG (magnitude) && PVM_VAL_ULONG_SIZE (magnitude) == 64
+               && PVM_VAL_ULONG (magnitude) < PVM_OFFSET_CACHE_SIZE)
+        cached = &offset_cache[1][unit_idx][PVM_VAL_ULONG (magnitude)];
+
+      if (cached && *cached != PVM_NULL)
+        return *cached;
+    }
+
+  box = pvm_make_box (PVM_VAL_TAG_OFF);
+  off = pvm_alloc (sizeof (struct pvm_off));
 
   off->base_type = pvm_typeof (magnitude);
   off->magnitude = magnitude;
   off->unit = unit;
 
   PVM_VAL_BOX_OFF (box) = off;
+  if (cached)
+    *cached = PVM_BOX (box);
   return PVM_BOX (box);
 }
 
@@ -519,7 +2702,8 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
     return (PVM_VAL_ULONG_SIZE (val1) == PVM_VAL_ULONG_SIZE (val2))
            && (PVM_VAL_ULONG (val1) == PVM_VAL_ULONG (val2));
   else if (PVM_IS_STR (val1) && PVM_IS_STR (val2))
-    return STREQ (PVM_VAL_STR (val1), PVM_VAL_STR (val2));
+    return (val1 == val2
+            || STREQ (PVM_VAL_STR (val1), PVM_VAL_STR (val2)));
   else if (PVM_IS_OFF (val1) && PVM_IS_OFF (val2))
     {
       int pvm_off_mag_equal, pvm_off_unit_equal;
@@ -605,27 +2789,80 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
                             PVM_VAL_ARR_ELEMS_BOUND (val2)))
         return 0;
 
-      if (!pvm_val_equal_p (PVM_VAL_ARR_SIZE_BOUND (val1),
-                            PVM_VAL_ARR_SIZE_BOUND (val2)))
-        return 0;
+      if (!pvm_val_equal_p (PVM_VAL_ARR_SIZE_BOUND (val1),
+                            PVM_VAL_ARR_SIZE_BOUND (val2)))
+        return 0;
+
+      pvm_array_packed_load_all (val1);
+      pvm_array_packed_load_all (val2);
+      for (size_t i = 0 ; i < pvm_arr1_nelems ; i++)
+        {
+          if (!pvm_val_equal_p (pvm_array_elem_value (val1, i),
+                                pvm_array_elem_value (val2, i)))
+            return 0;
+
+          if (!pvm_val_equal_p (pvm_array_elem_offset (val1, i),
+                                pvm_array_elem_offset (val2, i)))
+            return 0;
+        }
+
+      return 1;
+    }
+  else if (PVM_IS_TYP (val1) && PVM_IS_TYP (val2))
+    return pvm_type_equal_p (val1, val2);
+  else
+    return 0;
+}
+
+int
+pvm_array_equal_p (pvm_val arr1, pvm_val arr2)
+{
+  struct pvm_array_packed *packed1 = PVM_VAL_ARR_PACKED (arr1);
+  struct pvm_array_packed *packed2 = PVM_VAL_ARR_PACKED (arr2);
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr1));
+  uint64_t i;
+
+  if (nelem != PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr2)))
+    return 0;
+  if (nelem == 0 || arr1 == arr2)
+    return 1;
+
+  /* The raw values of packed elements are kept truncated to their
+     size, so the buffers of two packed arrays with elements of the
+     same type can be compared with memcmp.  */
+  pvm_array_packed_load_all (arr1);
+  pvm_array_packed_load_all (arr2);
+  if (packed1 && packed2
+      && packed1->esize == packed2->esize
+      && packed1->width == packed2->width)
+    {
+      if (packed1->data && packed2->data)
+        return memcmp (packed1->data, packed2->data,
+                       nelem * packed1->width) == 0;
+    }
+
+  for (i = 0; i < nelem; ++i)
+    {
+      pvm_val elem1 = pvm_array_elem_value (arr1, i);
+      pvm_val elem2 = pvm_array_elem_value (arr2, i);
 
-      for (size_t i = 0 ; i < pvm_arr1_nelems ; i++)
+      if (PVM_IS_STR (elem1) && PVM_IS_STR (elem2))
         {
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_VALUE (val1, i),
-                                PVM_VAL_ARR_ELEM_VALUE (val2, i)))
+          if (elem1 != elem2
+              && (pvm_string_length (elem1) != pvm_string_length (elem2)
+                  || !STREQ (PVM_VAL_STR (elem1), PVM_VAL_STR (elem2))))
             return 0;
-
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_OFFSET (val1, i),
-                                PVM_VAL_ARR_ELEM_OFFSET (val2, i)))
+        }
+      else if (PVM_IS_INTEGRAL (elem1) && PVM_IS_INTEGRAL (elem2))
+        {
+          if (PVM_VAL_INTEGRAL (elem1) != PVM_VAL_INTEGRAL (elem2))
             return 0;
         }
-
-      return 1;
+      else if (!pvm_val_equal_p (elem1, elem2))
+        return 0;
     }
-  else if (PVM_IS_TYP (val1) && PVM_IS_TYP (val2))
-    return pvm_type_equal_p (val1, val2);
-  else
-    return 0;
+
+  return 1;
 }
 
 void
@@ -664,7 +2901,9 @@ pvm_elemsof (pvm_val val)
       return pvm_make_ulong (present_fields, 64);
     }
   else if (PVM_IS_STR (val))
-    return pvm_make_ulong (strlen (PVM_VAL_STR (val)), 64);
+    return pvm_make_ulong (pvm_string_length (val), 64);
+  else if (PVM_IS_DCT (val))
+    return pvm_make_ulong (PVM_VAL_DCT_NELEM (val), 64);
   else
     return pvm_make_ulong (1, 64);
 }
@@ -700,6 +2939,10 @@ pvm_val_unmap (pvm_val val)
     {
       size_t nelem, i;
 
+      /* Integral elements are not mapped by themselves.  */
+      if (PVM_VAL_ARR_PACKED_P (val))
+        return;
+
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
       for (i = 0; i < nelem; ++i)
         pvm_val_unmap (PVM_VAL_ARR_ELEM_VALUE (val, i));
@@ -708,12 +2951,116 @@ pvm_val_unmap (pvm_val val)
     {
       size_t nfields, i;
 
+      pvm_struct_memo_flush (val);
       nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
       for (i = 0; i < nfields; ++i)
         pvm_val_unmap (PVM_VAL_SCT_FIELD_VALUE (val, i));
     }
 }
 
+int
+pvm_val_unbounded_p (pvm_val val)
+{
+  size_t n, i;
+
+  if (PVM_IS_ARR (val))
+    {
+      if (PVM_VAL_ARR_ELEMS_BOUND (val) == PVM_NULL
+          && PVM_VAL_ARR_SIZE_BOUND (val) == PVM_NULL)
+        return 1;
+
+      if (PVM_VAL_ARR_PACKED_P (val))
+        return 0;
+
+      n = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      for (i = 0; i < n; ++i)
+        {
+          pvm_val elem = PVM_VAL_ARR_ELEM_VALUE (val, i);
+
+          if ((PVM_IS_ARR (elem) || PVM_IS_SCT (elem))
+              && PVM_VAL_MAPPED_P (elem)
+              && (PVM_IS_ARR (elem)
+                  ? PVM_VAL_ARR_GENERATION (elem)
+                  : PVM_VAL_SCT_GENERATION (elem)) == 0)
+            return 1;
+        }
+    }
+  else if (PVM_IS_SCT (val))
+    {
+      n = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      for (i = 0; i < n; ++i)
+        {
+          pvm_val field = PVM_VAL_SCT_FIELD_VALUE (val, i);
+
+          if (PVM_VAL_SCT_FIELD_ABSENT_P (val, i))
+            continue;
+          if ((PVM_IS_ARR (field) || PVM_IS_SCT (field))
+              && PVM_VAL_MAPPED_P (field)
+              && (PVM_IS_ARR (field)
+                  ? PVM_VAL_ARR_GENERATION (field)
+                  : PVM_VAL_SCT_GENERATION (field)) == 0)
+            return 1;
+        }
+    }
+
+  return 0;
+}
+
+int
+pvm_val_fresh_p (pvm_val val)
+{
+  uint64_t generation;
+  pvm_val ios_id;
+  ios io;
+
+  if (!PVM_VAL_MAPPED_P (val))
+    return 0;
+
+  generation = (PVM_IS_ARR (val)
+                ? PVM_VAL_ARR_GENERATION (val)
+                : PVM_VAL_SCT_GENERATION (val));
+  if (generation == 0)
+    return 0;
+
+  ios_id = PVM_VAL_IOS (val);
+  io = (ios_id == PVM_NULL
+        ? ios_cur () : ios_search_by_id (PVM_VAL_INT (ios_id)));
+  if (io == NULL)
+    return 0;
+
+  return !ios_written_since_p (io, generation,
+                               PVM_VAL_ULONG (PVM_VAL_OFFSET (val)),
+                               pvm_sizeof (val));
+}
+
+static void
+pvm_ios_dirty_range (uint64_t offset, uint64_t count, void *data)
+{
+  pvm_val ranges = *(pvm_val *) data;
+  pvm_val range_type = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (ranges));
+  pvm_val range = pvm_make_array (pvm_make_ulong (2, 64), range_type);
+
+  (void) pvm_array_insert (range, pvm_make_ulong (0, 64),
+                           pvm_make_ulong (offset, 64));
+  (void) pvm_array_insert (range, pvm_make_ulong (1, 64),
+                           pvm_make_ulong (count, 64));
+  (void) pvm_array_insert (ranges, PVM_VAL_ARR_NELEM (ranges), range);
+}
+
+pvm_val
+pvm_ios_dirty_ranges (ios io)
+{
+  pvm_val etype = pvm_make_integral_type (pvm_make_ulong (64, 64),
+                                          PVM_MAKE_INT (0, 32));
+  pvm_val range_type = pvm_make_array_type (etype, PVM_NULL);
+  pvm_val ranges = pvm_make_array (pvm_make_ulong (0, 64),
+                                   pvm_make_array_type (range_type,
+                                                        PVM_NULL));
+
+  ios_map_dirty (io, 0, pvm_ios_dirty_range, &ranges);
+  return ranges;
+}
+
 void
 pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
 {
@@ -724,21 +3071,35 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       size_t nelem, i;
       uint64_t array_offset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (val));
 
-      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
-      for (i = 0; i < nelem; ++i)
+      if (PVM_VAL_ARR_PACKED_P (val))
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
-          pvm_val elem_offset = PVM_VAL_ARR_ELEM_OFFSET (val, i);
-          uint64_t elem_new_offset
-            = boff + (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (val, i))
-                      - array_offset);
-
-          PVM_VAL_ARR_ELEM_OFFSET_BACK (val, i) = elem_offset;
-          PVM_VAL_ARR_ELEM_OFFSET (val, i)
-            = pvm_make_ulong (elem_new_offset, 64);
+          struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (val);
 
-          pvm_val_reloc (elem_value, ios,
-                         pvm_make_ulong (elem_new_offset, 64));
+          /* Lazily mapped elements are to be peeked from the original
+             location, so get them now.  */
+          pvm_array_packed_load_all (val);
+          packed->boffset_back = packed->boffset;
+          packed->boffset = boff + (packed->boffset - array_offset);
+        }
+      else
+        {
+          pvm_array_unshare (val);
+          nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+          for (i = 0; i < nelem; ++i)
+            {
+              pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
+              pvm_val elem_offset = PVM_VAL_ARR_ELEM_OFFSET (val, i);
+              uint64_t elem_new_offset
+                = boff + (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (val, i))
+                          - array_offset);
+
+              PVM_VAL_ARR_ELEM_OFFSET_BACK (val, i) = elem_offset;
+              PVM_VAL_ARR_ELEM_OFFSET (val, i)
+                = pvm_make_ulong (elem_new_offset, 64);
+
+              pvm_val_reloc (elem_value, ios,
+                             pvm_make_ulong (elem_new_offset, 64));
+            }
         }
 
       PVM_VAL_ARR_MAPINFO_BACK (val) = PVM_VAL_ARR_MAPINFO (val);
@@ -746,12 +3107,14 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       PVM_VAL_ARR_MAPPED_P (val) = 1;
       PVM_VAL_ARR_IOS (val) = ios;
       PVM_VAL_ARR_OFFSET (val) = pvm_make_ulong (boff, 64);
+      PVM_VAL_ARR_GENERATION (val) = 0;
     }
   else if (PVM_IS_SCT (val))
     {
       size_t nfields, i;
       uint64_t struct_offset = PVM_VAL_ULONG (PVM_VAL_SCT_OFFSET (val));
 
+      pvm_struct_memo_flush (val);
       nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
       for (i = 0; i < nfields; ++i)
         {
@@ -783,6 +3146,7 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       PVM_VAL_SCT_MAPPED_P (val) = 1;
       PVM_VAL_SCT_IOS (val) = ios;
       PVM_VAL_SCT_OFFSET (val) = pvm_make_ulong (boff, 64);
+      PVM_VAL_SCT_GENERATION (val) = 0;
     }
 }
 
@@ -793,13 +3157,24 @@ pvm_val_ureloc (pvm_val val)
     {
       size_t nelem, i;
 
-      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
-      for (i = 0; i < nelem; ++i)
+      if (PVM_VAL_ARR_PACKED_P (val))
+        {
+          struct pvm_array_packed *packed = PVM_VAL_ARR_PACKED (val);
+
+          packed->boffset = packed->boffset_back;
+        }
+      else
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
+          pvm_array_unshare (val);
+          nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+          for (i = 0; i < nelem; ++i)
+            {
+              pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
 
-          PVM_VAL_ARR_ELEM_OFFSET (val, i) = PVM_VAL_ARR_ELEM_OFFSET_BACK (val, i);
-          pvm_val_ureloc (elem_value);
+              PVM_VAL_ARR_ELEM_OFFSET (val, i)
+                = PVM_VAL_ARR_ELEM_OFFSET_BACK (val, i);
+              pvm_val_ureloc (elem_value);
+            }
         }
 
       PVM_VAL_ARR_MAPINFO (val) = PVM_VAL_ARR_MAPINFO_BACK (val);
@@ -808,6 +3183,7 @@ pvm_val_ureloc (pvm_val val)
     {
       size_t nfields, i;
 
+      pvm_struct_memo_flush (val);
       nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
       for (i = 0; i < nfields; ++i)
         {
@@ -837,13 +3213,16 @@ pvm_sizeof (pvm_val val)
   else if (PVM_IS_ULONG (val))
     return PVM_VAL_ULONG_SIZE (val);
   else if (PVM_IS_STR (val))
-    return (strlen (PVM_VAL_STR (val)) + 1) * 8;
+    return (pvm_string_length (val) + 1) * 8;
   else if (PVM_IS_ARR (val))
     {
       size_t nelem, i;
       size_t size = 0;
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_PACKED_P (val))
+        return nelem * PVM_VAL_ARR_PACKED (val)->esize;
+
       for (i = 0; i < nelem; ++i)
         size += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (val, i));
 
@@ -893,6 +3272,9 @@ pvm_sizeof (pvm_val val)
   else if (PVM_IS_CLS (val))
     /* By convention, closure values have size zero.  */
     return 0;
+  else if (PVM_IS_DCT (val))
+    /* Dicts can't be stored in IO, so they have size zero.  */
+    return 0;
 
   assert (0);
   return 0;
@@ -955,6 +3337,92 @@ print_unit_name (uint64_t unit)
     }
 }
 
+/* The PVM_PRINT_F_PRINTF flavor of printing integers and bit-offsets,
+   which must be kept in sync with the integral_printer and
+   print_boffset macros in pkl-gen.pks.  */
+
+static void
+print_integral_printf (pvm_val val, int base)
+{
+  int size, signed_p;
+  int64_t sval = 0;
+  uint64_t uval;
+
+  if (PVM_IS_LONG (val))
+    {
+      size = PVM_VAL_LONG_SIZE (val);
+      sval = PVM_VAL_LONG (val);
+      uval = (uint64_t) sval;
+      signed_p = 1;
+    }
+  else if (PVM_IS_ULONG (val))
+    {
+      size = PVM_VAL_ULONG_SIZE (val);
+      uval = PVM_VAL_ULONG (val);
+      signed_p = 0;
+    }
+  else if (PVM_IS_INT (val))
+    {
+      size = PVM_VAL_INT_SIZE (val);
+      sval = PVM_VAL_INT (val);
+      uval = (uint64_t) sval;
+      signed_p = 1;
+    }
+  else
+    {
+      size = PVM_VAL_UINT_SIZE (val);
+      uval = PVM_VAL_UINT (val);
+      signed_p = 0;
+    }
+
+  if (size < 64)
+    uval &= (((uint64_t) 1) << size) - 1;
+
+  pk_term_class ("integer");
+  switch (base)
+    {
+    case 2:
+      pk_puts ("0b");
+      pk_print_binary (pk_puts, uval, size, 1);
+      break;
+    case 8:
+      pk_printf ("0o%0*" PRIo64, (size + 2) / 3, uval);
+      break;
+    case 16:
+      pk_printf ("0x%0*" PRIx64, (size + 3) / 4, uval);
+      break;
+    default:
+      if (signed_p)
+        pk_printf ("%" PRIi64, sval);
+      else
+        pk_printf ("%" PRIu64, uval);
+      break;
+    }
+
+  if (!signed_p)
+    pk_puts ("U");
+  switch (size)
+    {
+    case 4: pk_puts ("N"); break;
+    case 8: pk_puts ("B"); break;
+    case 16: pk_puts ("H"); break;
+    case 64: pk_puts ("L"); break;
+    default: break;
+    }
+  pk_term_end_class ("integer");
+}
+
+static void
+print_boffset_printf (pvm_val boffset)
+{
+  pk_term_class ("offset");
+  pk_term_class ("integer");
+  pk_printf ("0x%016" PRIx64, PVM_VAL_ULONG (boffset));
+  pk_term_end_class ("integer");
+  pk_puts ("#b");
+  pk_term_end_class ("offset");
+}
+
 #define PVM_PRINT_VAL_1(...)                    \
   pvm_print_val_1 (vm, depth, mode, base, indent, acutoff, flags, __VA_ARGS__)
 
@@ -971,6 +3439,7 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
   /* Extract configuration settings from FLAGS.  */
   int maps = flags & PVM_PRINT_F_MAPS;
   int pprint = flags & PVM_PRINT_F_PPRINT;
+  int printf_p = flags & PVM_PRINT_F_PRINTF;
 
   /* Select the appropriate formatting templates for the given
      base.  */
@@ -1050,6 +3519,8 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
   /* And print out the value in the given stream..  */
   if (val == PVM_NULL)
     pk_puts ("null");
+  else if (printf_p && PVM_IS_INTEGRAL (val))
+    print_integral_printf (val, base);
   else if (PVM_IS_LONG (val))
     {
       int size = PVM_VAL_LONG_SIZE (val);
@@ -1169,11 +3640,19 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
     {
       const char *str = PVM_VAL_STR (val);
       char *str_printable;
-      size_t str_size = strlen (PVM_VAL_STR (val));
+      size_t str_size = pvm_string_length (val);
       size_t printable_size, i, j;
 
       pk_term_class ("string");
 
+      /* The string printer of printf doesn't escape.  */
+      if (printf_p)
+        {
+          pk_printf ("\"%s\"", str);
+          pk_term_end_class ("string");
+          return;
+        }
+
       /* Calculate the length (in bytes) of the printable string
          corresponding to the string value.  */
       for (printable_size = 0, i = 0; i < str_size; i++)
@@ -1239,10 +3718,10 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
       pk_puts ("[");
       for (idx = 0; idx < nelem; idx++)
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, idx);
-          pvm_val elem_offset = PVM_VAL_ARR_ELEM_OFFSET (val, idx);
+          pvm_val elem_value;
+          pvm_val elem_offset;
 
-          if (idx != 0)
+          if (idx != 0 && !printf_p)
             pk_puts (",");
 
           if ((acutoff != 0) && (acutoff <= idx))
@@ -1253,9 +3732,20 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
               break;
             }
 
+          if (idx != 0 && printf_p)
+            pk_puts (",");
+
+          elem_value = pvm_array_elem_value (val, idx);
+          elem_offset = pvm_array_elem_offset (val, idx);
+
           PVM_PRINT_VAL_1 (elem_value, ndepth);
 
-          if (maps && elem_offset != PVM_NULL)
+          if (maps && elem_offset != PVM_NULL && printf_p)
+            {
+              pk_puts (" @ ");
+              print_boffset_printf (elem_offset);
+            }
+          else if (maps && elem_offset != PVM_NULL)
             {
               pk_puts (" @ ");
               pk_term_class ("offset");
@@ -1266,7 +3756,12 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
         }
       pk_puts ("]");
 
-      if (maps && array_offset != PVM_NULL)
+      if (maps && array_offset != PVM_NULL && printf_p)
+        {
+          pk_puts (" @ ");
+          print_boffset_printf (array_offset);
+        }
+      else if (maps && array_offset != PVM_NULL)
         {
           /* The struct offset is a bit-offset.  Do not bother to
              create a real offset here.  */
@@ -1304,6 +3799,12 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
           pk_puts ( PVM_VAL_STR (struct_type_name));
           pk_term_end_class ("struct-type-name");
         }
+      else if (printf_p)
+        {
+          pk_term_class ("struct-type-name");
+          pk_puts ("struct");
+          pk_term_end_class ("struct-type-name");
+        }
       else
         pk_puts ("struct");
 
@@ -1344,7 +3845,15 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
               PVM_PRINT_VAL_1 (value, ndepth + 1);
             }
 
-          if (maps && offset != PVM_NULL)
+          if (maps && offset != PVM_NULL && printf_p)
+            {
+              if (!PVM_VAL_SCT_FIELD_ABSENT_P (val, idx))
+                {
+                  pk_puts (" @ ");
+                  print_boffset_printf (offset);
+                }
+            }
+          else if (maps && offset != PVM_NULL)
             {
               pk_puts (" @ ");
               pk_term_class ("offset");
@@ -1358,7 +3867,12 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
         pk_term_indent (ndepth, indent);
       pk_puts ("}");
 
-      if (maps && struct_offset != PVM_NULL)
+      if (maps && struct_offset != PVM_NULL && printf_p)
+        {
+          pk_puts (" @ ");
+          print_boffset_printf (struct_offset);
+        }
+      else if (maps && struct_offset != PVM_NULL)
         {
           /* The struct offset is a bit-offset.  Do not bother to
              create a real offset here.  */
@@ -1465,6 +3979,13 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
             pk_puts ("}");
           break;
           }
+        case PVM_TYPE_DICT:
+          pk_puts ("dict<");
+          PVM_PRINT_VAL_1 (PVM_VAL_TYP_D_KTYPE (val), ndepth);
+          pk_puts (",");
+          PVM_PRINT_VAL_1 (PVM_VAL_TYP_D_VTYPE (val), ndepth);
+          pk_puts (">");
+          break;
         default:
           assert (0);
         }
@@ -1479,6 +4000,43 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
       print_unit_name (PVM_VAL_ULONG (PVM_VAL_OFF_UNIT (val)));
       pk_term_end_class ("offset");
     }
+  else if (PVM_IS_DCT (val))
+    {
+      pvm_dict dict = PVM_VAL_DCT (val);
+      size_t i, idx;
+
+      pk_term_class ("dict");
+
+      pk_puts ("{");
+      for (i = 0, idx = 0; i < dict->nentries; i++)
+        {
+          struct pvm_dict_entry *entry = &dict->entries[i];
+
+          if (entry->key == PVM_NULL)
+            continue;
+
+          if (idx != 0)
+            pk_puts (",");
+
+          if ((acutoff != 0) && (acutoff <= idx))
+            {
+              pk_term_class ("ellipsis");
+              pk_puts ("...");
+              pk_term_end_class ("ellipsis");
+              break;
+            }
+
+          PVM_PRINT_VAL_1 (entry->key, ndepth);
+          pk_puts (":");
+          PVM_PRINT_VAL_1 (entry->value, ndepth);
+          idx++;
+        }
+      pk_puts ("}");
+
+      pk_term_end_class ("dict");
+    }
+  else if (PVM_IS_CLS (val) && printf_p)
+    pk_puts ("#<closure>");
   else if (PVM_IS_CLS (val))
     {
       pk_term_class ("special");
@@ -1517,6 +4075,157 @@ pvm_print_val_with_params (pvm vm, pvm_val val,
                    0 /* ndepth */);
 }
 
+void
+pvm_print_val_at_depth (pvm vm, pvm_val val, int ndepth)
+{
+  pvm_print_val_1 (vm,
+                   pvm_odepth (vm), pvm_omode (vm),
+                   pvm_obase (vm), pvm_oindent (vm),
+                   pvm_oacutoff (vm),
+                   (pvm_omaps (vm) << (PVM_PRINT_F_MAPS - 1)
+                    | PVM_PRINT_F_PRINTF),
+                   val,
+                   ndepth);
+}
+
+/* The data dumped by pvm_print_dump is read in blocks of this size.
+   It must be a multiple of the number of bytes per line.  */
+
+#define PVM_DUMP_BLOCK_SIZE 65536
+#define PVM_DUMP_LINE_SIZE 16
+
+int
+pvm_print_dump (ios io, uint64_t from, uint64_t top,
+                uint64_t group_by, uint64_t cluster_by,
+                int ascii, char nonprintable)
+{
+  uint8_t *block;
+  uint64_t cluster_size = cluster_by * group_by;
+  uint64_t offset, nbytes = 0;
+  int ret = IOS_OK;
+
+  assert (cluster_size != 0);
+
+  block = malloc (PVM_DUMP_BLOCK_SIZE);
+  if (block == NULL)
+    return IOS_ENOMEM;
+
+  for (offset = from; offset < top; offset += PVM_DUMP_LINE_SIZE)
+    {
+      /* hex is big enough for sixteen bytes, printed in groups and
+         clusters of one byte.  */
+      char hex[PVM_DUMP_LINE_SIZE * 4 + 1], text[PVM_DUMP_LINE_SIZE + 1];
+      char *p = hex;
+      uint8_t *line;
+      uint64_t o, nline, ntext;
+
+      /* Read a new block if the data of this line is not in the
+         current one.  */
+      if ((offset - from) % PVM_DUMP_BLOCK_SIZE == 0)
+        {
+          nbytes = top - offset;
+          if (nbytes > PVM_DUMP_BLOCK_SIZE)
+            nbytes = PVM_DUMP_BLOCK_SIZE;
+
+          ret = ios_read_raw (io, offset * 8, 0, block, nbytes);
+          if (ret == IOS_EIOFF)
+            {
+              /* The block goes past the end of the IO space.  Find
+                 out how much of it is available.  */
+              uint64_t n;
+
+              for (n = 0; n < nbytes; n++)
+                if (ios_read_raw (io, (offset + n) * 8, 0,
+                                  block + n, 1) != IOS_OK)
+                  break;
+              nbytes = n;
+            }
+          else if (ret != IOS_OK)
+            break;
+        }
+
+      line = block + (offset - from) % PVM_DUMP_BLOCK_SIZE;
+      nline = nbytes - (offset - from) % PVM_DUMP_BLOCK_SIZE;
+      if (nline > PVM_DUMP_LINE_SIZE)
+        nline = PVM_DUMP_LINE_SIZE;
+      if (nline == 0)
+        {
+          /* We reached the end of the IO space.  */
+          ret = IOS_EIOFF;
+          break;
+        }
+
+      pk_term_class ("dump-address");
+      pk_printf ("%08" PRIx32 ":", (uint32_t) offset);
+      pk_term_end_class ("dump-address");
+
+      for (o = 0; o < nline; o++)
+        {
+          if (o % group_by == 0)
+            *p++ = ' ';
+          *p++ = "0123456789abcdef"[line[o] >> 4];
+          *p++ = "0123456789abcdef"[line[o] & 0xf];
+          if (o + 1 < PVM_DUMP_LINE_SIZE && (o + 1) % cluster_size == 0)
+            *p++ = ' ';
+        }
+
+      if (ascii)
+        {
+          /* Pad the last line so the ASCII dump gets aligned with the
+             lines above.  */
+          for (; o < PVM_DUMP_LINE_SIZE
+                 && (offset + o) % PVM_DUMP_LINE_SIZE != 0; o++)
+            {
+              if (o % group_by == 0)
+                *p++ = ' ';
+              *p++ = ' ';
+              *p++ = ' ';
+            }
+        }
+
+      *p = '\0';
+      pk_puts (hex);
+
+      if (ascii)
+        {
+          int end_of_cluster_p;
+
+          pk_puts ("  ");
+
+          /* The characters are printed in runs, separated by the
+             spaces between clusters.  */
+          for (o = 0, ntext = 0; o < nline; o++)
+            {
+              text[ntext++] = (line[o] < ' ' || line[o] > '~'
+                               ? nonprintable : line[o]);
+              end_of_cluster_p = (o + 1 < PVM_DUMP_LINE_SIZE
+                                  && (o + 1) % cluster_size == 0);
+              if (end_of_cluster_p || o + 1 == nline)
+                {
+                  text[ntext] = '\0';
+                  pk_term_class ("dump-ascii");
+                  pk_puts (text);
+                  pk_term_end_class ("dump-ascii");
+                  ntext = 0;
+                }
+              if (end_of_cluster_p)
+                pk_puts (" ");
+            }
+        }
+      pk_puts ("\n");
+
+      if (nline < PVM_DUMP_LINE_SIZE && offset + nline < top)
+        {
+          /* We reached the end of the IO space.  */
+          ret = IOS_EIOFF;
+          break;
+        }
+    }
+
+  free (block);
+  return ret;
+}
+
 pvm_val
 pvm_typeof (pvm_val val)
 {
@@ -1543,6 +4252,8 @@ pvm_typeof (pvm_val val)
     type = PVM_VAL_ARR_TYPE (val);
   else if (PVM_IS_SCT (val))
     type = PVM_VAL_SCT_TYPE (val);
+  else if (PVM_IS_DCT (val))
+    type = PVM_VAL_DCT_TYPE (val);
   else
     assert (0);
 
@@ -1606,6 +4317,11 @@ pvm_type_equal_p (pvm_val type1, pvm_val type2)
 
         return 1;
       }
+    case PVM_TYPE_DICT:
+      return (pvm_type_equal_p (PVM_VAL_TYP_D_KTYPE (type1),
+                                PVM_VAL_TYP_D_KTYPE (type2))
+              && pvm_type_equal_p (PVM_VAL_TYP_D_VTYPE (type1),
+                                   PVM_VAL_TYP_D_VTYPE (type2)));
     default:
       assert (0);
     }
@@ -1640,57 +4356,126 @@ pvm_make_exception (int code, char *message, int exit_status)
 {
   pvm_val nfields = pvm_make_ulong (3, 64);
   pvm_val nmethods = pvm_make_ulong (0, 64);
-  pvm_val struct_name = pvm_make_string ("Exception");
-  pvm_val code_name = pvm_make_string ("code");
-  pvm_val msg_name = pvm_make_string ("msg");
-  pvm_val exit_status_name = pvm_make_string ("exit_status");
-  pvm_val *field_names, *field_types, type;
   pvm_val exception;
 
-  pvm_allocate_struct_attrs (nfields, &field_names, &field_types);
-
-  field_names[0] = code_name;
-  field_types[0] = pvm_make_integral_type (32, 1);
-
-  field_names[1] = msg_name;
-  field_types[1] = pvm_make_string_type ();
+  /* Exceptions are raised often while mapping, for example when
+     probing the alternatives of unions, and they are seldom printed.
+     So avoid creating the type and copying the message every time:
+     the type is shared by all the exceptions built here, and since
+     messages are always constant strings, they are interned.  */
+  exception = pvm_make_struct (nfields, nmethods, exception_type);
 
-  type = pvm_make_struct_type (nfields, struct_name,
-                               field_names, field_types);
-
-  exception = pvm_make_struct (nfields, nmethods, type);
-
-  PVM_VAL_SCT_FIELD_NAME (exception, 0) = code_name;
+  PVM_VAL_SCT_FIELD_NAME (exception, 0) = PVM_VAL_TYP_S_FNAME (exception_type, 0);
   PVM_VAL_SCT_FIELD_VALUE (exception, 0)
     = PVM_MAKE_INT (code, 32);
 
-  PVM_VAL_SCT_FIELD_NAME (exception, 1) = msg_name;
+  PVM_VAL_SCT_FIELD_NAME (exception, 1) = PVM_VAL_TYP_S_FNAME (exception_type, 1);
   PVM_VAL_SCT_FIELD_VALUE (exception, 1)
-    = pvm_make_string (message);
+    = pvm_make_string_atom (message);
 
-  PVM_VAL_SCT_FIELD_NAME (exception, 2) = exit_status_name;
+  PVM_VAL_SCT_FIELD_NAME (exception, 2) = PVM_VAL_TYP_S_FNAME (exception_type, 2);
   PVM_VAL_SCT_FIELD_VALUE (exception, 2)
     = PVM_MAKE_INT (exit_status, 32);
 
   return exception;
 }
 
+int
+pvm_exception_p (pvm_val val)
+{
+  return PVM_IS_SCT (val) && PVM_VAL_SCT_TYPE (val) == exception_type;
+}
+
 pvm_program
 pvm_val_cls_program (pvm_val cls)
 {
   return PVM_VAL_CLS_PROGRAM (cls);
 }
 
+void
+pvm_val_stats (struct pvm_val_stats *stats)
+{
+  int tag;
+
+  stats->strings = box_counts[PVM_VAL_TAG_STR];
+  stats->offsets = box_counts[PVM_VAL_TAG_OFF];
+  stats->arrays = box_counts[PVM_VAL_TAG_ARR];
+  stats->structs = box_counts[PVM_VAL_TAG_SCT];
+
+  stats->others = 0;
+  for (tag = 0; tag <= PVM_VAL_TAG_DCT; ++tag)
+    stats->others += box_counts[tag];
+  stats->others -= (stats->strings + stats->offsets
+                    + stats->arrays + stats->structs);
+}
+
 void
 pvm_val_initialize (void)
 {
+  size_t i;
+
   pvm_alloc_add_gc_roots (&string_type, 1);
   pvm_alloc_add_gc_roots (&void_type, 1);
   pvm_alloc_add_gc_roots (&any_type, 1);
+  pvm_alloc_add_gc_roots (&exception_type, 1);
+  pvm_alloc_add_gc_roots (integral_types,
+                          sizeof (integral_types) / sizeof (void *));
+  pvm_alloc_add_gc_roots (offset_cache,
+                          sizeof (offset_cache) / sizeof (void *));
+
+  for (i = 0; i < PVM_LONG_CACHE_SIZE; ++i)
+    {
+      long_cache[0][i][0] = long_cache[1][i][0] = i;
+      long_cache[0][i][1] = long_cache[1][i][1] = 63;
+    }
+
+  for (i = 0; i < 64; ++i)
+    integral_types[0][i] = integral_types[1][i] = PVM_NULL;
+
+  for (i = 0; i < PVM_OFFSET_CACHE_SIZE; ++i)
+    offset_cache[0][0][i] = offset_cache[0][1][i]
+      = offset_cache[1][0][i] = offset_cache[1][1][i] = PVM_NULL;
 
   string_type = pvm_make_type (PVM_TYPE_STRING);
   void_type = pvm_make_type (PVM_TYPE_VOID);
   any_type = pvm_make_type (PVM_TYPE_ANY);
+
+  /* Fill the caches.  Note that the integral types must be built
+     first, since they are used by the offsets.  */
+  for (i = 1; i <= 64; ++i)
+    {
+      pvm_make_integral_type (pvm_make_ulong (i, 64), PVM_MAKE_INT (0, 32));
+      pvm_make_integral_type (pvm_make_ulong (i, 64), PVM_MAKE_INT (1, 32));
+    }
+
+  for (i = 0; i < PVM_OFFSET_CACHE_SIZE; ++i)
+    {
+      pvm_make_offset (PVM_MAKE_INT (i, 32), pvm_make_ulong (1, 64));
+      pvm_make_offset (PVM_MAKE_INT (i, 32), pvm_make_ulong (8, 64));
+      pvm_make_offset (pvm_make_ulong (i, 64), pvm_make_ulong (1, 64));
+      pvm_make_offset (pvm_make_ulong (i, 64), pvm_make_ulong (8, 64));
+    }
+
+  {
+    pvm_val nfields = pvm_make_ulong (3, 64);
+    pvm_val *field_names, *field_types;
+
+    pvm_allocate_struct_attrs (nfields, &field_names, &field_types);
+
+    field_names[0] = pvm_make_string_atom ("code");
+    field_types[0] = pvm_make_integral_type (pvm_make_ulong (32, 64),
+                                             PVM_MAKE_INT (1, 32));
+
+    field_names[1] = pvm_make_string_atom ("msg");
+    field_types[1] = string_type;
+
+    field_names[2] = pvm_make_string_atom ("exit_status");
+    field_types[2] = field_types[0];
+
+    exception_type
+      = pvm_make_struct_type (nfields, pvm_make_string_atom ("Exception"),
+                              field_names, field_types);
+  }
 }
 
 void
@@ -1699,4 +4484,18 @@ pvm_val_finalize (void)
   pvm_alloc_remove_gc_roots (&string_type, 1);
   pvm_alloc_remove_gc_roots (&void_type, 1);
   pvm_alloc_remove_gc_roots (&any_type, 1);
+  pvm_alloc_remove_gc_roots (&exception_type, 1);
+  pvm_alloc_remove_gc_roots (integral_types,
+                             sizeof (integral_types) / sizeof (void *));
+  pvm_alloc_remove_gc_roots (offset_cache,
+                             sizeof (offset_cache) / sizeof (void *));
+
+  if (string_atoms)
+    {
+      pvm_alloc_remove_gc_roots (string_atoms,
+                                 PVM_STRING_ATOMS_NROOTS (string_atoms_size));
+      free (string_atoms);
+      string_atoms = NULL;
+      string_atoms_size = string_atoms_count = 0;
+    }
 }
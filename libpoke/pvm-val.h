@@ -44,6 +44,7 @@
 #define PVM_VAL_TAG_SCT 0xb
 #define PVM_VAL_TAG_TYP 0xc
 #define PVM_VAL_TAG_CLS 0xd
+#define PVM_VAL_TAG_DCT 0xe
 
 #define PVM_VAL_BOXED_P(V) (PVM_VAL_TAG((V)) > 1)
 
@@ -142,31 +143,72 @@
 
 #define PVM_VAL_BOX_TAG(B) ((B)->tag)
 #define PVM_VAL_BOX_STR(B) ((B)->v.string)
+#define PVM_VAL_BOX_STR_LEN(B) ((B)->str_len)
+#define PVM_VAL_BOX_STR_ROPE_P(B) ((B)->str_rope_p)
+#define PVM_VAL_BOX_ROPE(B) ((B)->v.rope)
 #define PVM_VAL_BOX_ARR(B) ((B)->v.array)
 #define PVM_VAL_BOX_SCT(B) ((B)->v.sct)
 #define PVM_VAL_BOX_TYP(B) ((B)->v.type)
 #define PVM_VAL_BOX_CLS(B) ((B)->v.cls)
 #define PVM_VAL_BOX_OFF(B) ((B)->v.offset)
+#define PVM_VAL_BOX_DCT(B) ((B)->v.dict)
 
 struct pvm_val_box
 {
   uint8_t tag;
+  uint8_t str_rope_p;
+  uint32_t str_len;
   union
   {
     char *string;
+    struct pvm_rope *rope;
     struct pvm_array *array;
     struct pvm_struct *sct;
     struct pvm_type *type;
     struct pvm_off *offset;
     struct pvm_cls *cls;
+    struct pvm_dict *dict;
   } v;
 };
 
 typedef struct pvm_val_box *pvm_val_box;
 
-/* Strings are boxed.  */
+/* Strings are boxed.
 
-#define PVM_VAL_STR(V) (PVM_VAL_BOX_STR (PVM_VAL_BOX ((V))))
+   STR_LEN is the length of the string, not counting the terminating
+   NUL character, or PVM_STR_LEN_UNKNOWN if it hasn't been computed
+   yet, or it doesn't fit in 32 bits.  Use pvm_string_length to get
+   the length of a string.
+
+   If STR_ROPE_P is 0 the contents of the string are in STRING.
+   Otherwise the string is the concatenation of two other strings,
+   described by ROPE, and its length is always known.  This allows
+   concatenating strings in constant time, which is what makes
+   building a string by appending pieces to it, like in `s = s + c',
+   linear instead of quadratic.  Ropes are flattened into a regular
+   string by pvm_string_flatten the first time their contents are
+   accessed with PVM_VAL_STR.
+
+   Strings are immutable, so a box is not changed after it is built,
+   other than to cache the results of flattening it or computing its
+   length.  */
+
+struct pvm_rope
+{
+  pvm_val left;
+  pvm_val right;
+};
+
+#define PVM_STR_LEN_UNKNOWN UINT32_MAX
+
+#define PVM_VAL_STR(V)                                          \
+  (PVM_VAL_BOX_STR_ROPE_P (PVM_VAL_BOX ((V)))                   \
+   ? pvm_string_flatten ((V)) : PVM_VAL_BOX_STR (PVM_VAL_BOX ((V))))
+#define PVM_VAL_STR_ROPE(V) (PVM_VAL_BOX_ROPE (PVM_VAL_BOX ((V))))
+#define PVM_VAL_STR_ROPE_P(V) (PVM_VAL_BOX_STR_ROPE_P (PVM_VAL_BOX ((V))))
+#define PVM_VAL_STR_LEN(V) (PVM_VAL_BOX_STR_LEN (PVM_VAL_BOX ((V))))
+
+char *pvm_string_flatten (pvm_val str);
 
 /* Map-able values share a set of properties/attributes, which are
    stored in `mapinfo' structures.
@@ -186,6 +228,9 @@ typedef struct pvm_val_box *pvm_val_box;
    space where the value is mapped.  If the value is not mapped then
    this holds 0UL by convention.
 
+   GENERATION is the generation of the IO space at the time the value
+   was mapped, or 0 if it is not known.  See ios_generation.
+
    Note that other properties related to mapping that are not shared
    among the different kind of map-able values are not stored in this
    struct.  */
@@ -194,6 +239,7 @@ typedef struct pvm_val_box *pvm_val_box;
 #define PVM_MAPINFO_STRICT_P(MINFO) ((MINFO).strict_p)
 #define PVM_MAPINFO_IOS(MINFO) ((MINFO).ios)
 #define PVM_MAPINFO_OFFSET(MINFO) ((MINFO).offset)
+#define PVM_MAPINFO_GENERATION(MINFO) ((MINFO).generation)
 
 struct pvm_mapinfo
 {
@@ -201,6 +247,7 @@ struct pvm_mapinfo
   int strict_p;
   pvm_val ios;
   pvm_val offset;
+  uint64_t generation;
 };
 
 struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
@@ -242,7 +289,23 @@ struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
    NALLOCATED is the number of elements allocated in the array.
 
    ELEMS is a list of elements.  The order of the elements is
-   relevant.  */
+   relevant.
+
+   PACKED is NULL for arrays whose elements are stored in ELEMS.
+   Arrays of integral elements instead store the values of their
+   elements contiguously in a native buffer described by PACKED.  In
+   that case NALLOCATED is 0 and ELEMS is NULL.  Such arrays are
+   turned into regular arrays if they get an element not fitting in
+   the buffer.  See pvm_array_materialize.
+
+   SHARED_P is 1 if ELEMS may be shared with other arrays, which
+   happens when an array is the result of appending elements to
+   another one.  The arrays sharing ELEMS use positions from the
+   beginning of the buffer, and the positions not used by any of
+   them have PVM_NULL values.  Elements can be added to an array
+   sharing ELEMS only in these free positions, and an array sharing
+   ELEMS shall get a copy of its own before any of its elements is
+   modified.  See pvm_array_concat and pvm_array_unshare.  */
 
 #define PVM_VAL_ARR(V) (PVM_VAL_BOX_ARR (PVM_VAL_BOX ((V))))
 #define PVM_VAL_ARR_MAPINFO(V) (PVM_VAL_ARR(V)->mapinfo)
@@ -251,6 +314,7 @@ struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
 #define PVM_VAL_ARR_STRICT_P(V) (PVM_MAPINFO_STRICT_P (PVM_VAL_ARR_MAPINFO ((V))))
 #define PVM_VAL_ARR_IOS(V) (PVM_MAPINFO_IOS (PVM_VAL_ARR_MAPINFO ((V))))
 #define PVM_VAL_ARR_OFFSET(V) (PVM_MAPINFO_OFFSET (PVM_VAL_ARR_MAPINFO ((V))))
+#define PVM_VAL_ARR_GENERATION(V) (PVM_MAPINFO_GENERATION (PVM_VAL_ARR_MAPINFO ((V))))
 #define PVM_VAL_ARR_ELEMS_BOUND(V) (PVM_VAL_ARR(V)->elems_bound)
 #define PVM_VAL_ARR_SIZE_BOUND(V) (PVM_VAL_ARR(V)->size_bound)
 #define PVM_VAL_ARR_MAPPER(V) (PVM_VAL_ARR(V)->mapper)
@@ -260,6 +324,9 @@ struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
 #define PVM_VAL_ARR_NALLOCATED(V) (PVM_VAL_ARR(V)->nallocated)
 #define PVM_VAL_ARR_ELEMS(V) (PVM_VAL_ARR(V)->elems)
 #define PVM_VAL_ARR_ELEM(V,I) (PVM_VAL_ARR(V)->elems[(I)])
+#define PVM_VAL_ARR_PACKED(V) (PVM_VAL_ARR(V)->packed)
+#define PVM_VAL_ARR_PACKED_P(V) (PVM_VAL_ARR_PACKED(V) != NULL)
+#define PVM_VAL_ARR_SHARED_P(V) (PVM_VAL_ARR(V)->shared_p)
 
 struct pvm_array
 {
@@ -273,10 +340,48 @@ struct pvm_array
   pvm_val nelem;
   uint64_t nallocated;
   struct pvm_array_elem *elems;
+  struct pvm_array_packed *packed;
+  int shared_p;
 };
 
 typedef struct pvm_array *pvm_array;
 
+/* Packed arrays store the values of their integral elements in DATA,
+   which is a contiguous buffer of NALLOCATED elements of WIDTH bytes
+   each.  Values are stored as unsigned integers truncated to ESIZE
+   bits, SIGNED_P telling how to extend them back to values.
+
+   BOFFSET is the bit-offset of the first element.  The element at
+   position I is located at BOFFSET + I * ESIZE.  BOFFSET_BACK is a
+   backup area used by the reloc instructions.
+
+   Packed arrays can also be mapped lazily.  In that case LAZY_P is
+   1, and the elements are peeked from IO, at the bit-offset of the
+   element in the IO space with id IOS, using ENDIAN and NENC, the
+   first time they are accessed.  PRESENT is a bitmap telling which
+   elements are already in DATA.  DATA and PRESENT are allocated the
+   first time an element is accessed, and elements are peeked in
+   chunks of PVM_ARRAY_PACKED_CHUNK elements.  */
+
+#define PVM_ARRAY_PACKED_CHUNK 512
+
+struct pvm_array_packed
+{
+  int esize;
+  int signed_p;
+  int width;
+  uint64_t nallocated;
+  void *data;
+  uint64_t boffset;
+  uint64_t boffset_back;
+
+  int lazy_p;
+  int ios;
+  int endian;
+  int nenc;
+  uint8_t *present;
+};
+
 /* Array elements hold the data of the arrays, and/or information on
    how to obtain these values.
 
@@ -331,6 +436,7 @@ struct pvm_array_elem
 #define PVM_VAL_SCT_STRICT_P(V) (PVM_MAPINFO_STRICT_P (PVM_VAL_SCT_MAPINFO ((V))))
 #define PVM_VAL_SCT_IOS(V) (PVM_MAPINFO_IOS (PVM_VAL_SCT_MAPINFO ((V))))
 #define PVM_VAL_SCT_OFFSET(V) (PVM_MAPINFO_OFFSET (PVM_VAL_SCT_MAPINFO ((V))))
+#define PVM_VAL_SCT_GENERATION(V) (PVM_MAPINFO_GENERATION (PVM_VAL_SCT_MAPINFO ((V))))
 #define PVM_VAL_SCT_MAPPER(V) (PVM_VAL_SCT((V))->mapper)
 #define PVM_VAL_SCT_WRITER(V) (PVM_VAL_SCT((V))->writer)
 #define PVM_VAL_SCT_TYPE(V) (PVM_VAL_SCT((V))->type)
@@ -402,19 +508,68 @@ struct pvm_struct_field
    NAME is a string containing the name of the method.  This name
    should be unique in the struct.
 
-   VALUE is a PVM closure.  */
+   VALUE is a PVM closure.
+
+   MEMO is a dict with the results of the method cached for this
+   struct, keyed by the argument passed to the method, or PVM_NULL if
+   no result is cached.  This is only used by memoized methods.  The
+   cached results are discarded whenever a field of the struct is set,
+   or the struct is relocated or unmapped.  */
 
 #define PVM_VAL_SCT_METHOD_NAME(V,I) (PVM_VAL_SCT_METHOD((V),(I)).name)
 #define PVM_VAL_SCT_METHOD_VALUE(V,I) (PVM_VAL_SCT_METHOD((V),(I)).value)
+#define PVM_VAL_SCT_METHOD_MEMO(V,I) (PVM_VAL_SCT_METHOD((V),(I)).memo)
 
 struct pvm_struct_method
 {
   pvm_val name;
   pvm_val value;
+  pvm_val memo;
 };
 
 typedef struct pvm_struct *pvm_struct;
 
+/* Dict values are boxed, and associate keys with values.  The keys
+   are either integers or strings, and all of them have the type of
+   the keys of the dict.  Dicts are never mapped.
+
+   TYPE is the type of the dict.
+
+   NELEM is the number of entries stored in the dict.
+
+   ENTRIES is a vector of NALLOCATED entries, NENTRIES of which are in
+   use.  Entries are kept in insertion order.  Removed entries have a
+   KEY of PVM_NULL, and are discarded when the vector is grown.
+
+   SLOTS is an open-addressing table, with linear probing, mapping
+   keys to entries.  Each slot holds the index of an entry plus one,
+   or zero if the slot is empty.  SLOTS_MASK is the size of the table
+   minus one.  The table is kept at most half full.  */
+
+#define PVM_VAL_DCT(V) (PVM_VAL_BOX_DCT (PVM_VAL_BOX ((V))))
+#define PVM_VAL_DCT_TYPE(V) (PVM_VAL_DCT((V))->type)
+#define PVM_VAL_DCT_NELEM(V) (PVM_VAL_DCT((V))->nelem)
+
+struct pvm_dict_entry
+{
+  uint32_t hash;
+  pvm_val key;
+  pvm_val value;
+};
+
+struct pvm_dict
+{
+  pvm_val type;
+  uint64_t nelem;
+  uint64_t nentries;
+  uint64_t nallocated;
+  struct pvm_dict_entry *entries;
+  uint32_t *slots;
+  uint32_t slots_mask;
+};
+
+typedef struct pvm_dict *pvm_dict;
+
 /* Types are also boxed.  */
 
 #define PVM_VAL_TYP(V) (PVM_VAL_BOX_TYP (PVM_VAL_BOX ((V))))
@@ -430,12 +585,16 @@ typedef struct pvm_struct *pvm_struct;
 #define PVM_VAL_TYP_S_FTYPES(V) (PVM_VAL_TYP((V))->val.sct.ftypes)
 #define PVM_VAL_TYP_S_FNAME(V,I) (PVM_VAL_TYP_S_FNAMES((V))[(I)])
 #define PVM_VAL_TYP_S_FTYPE(V,I) (PVM_VAL_TYP_S_FTYPES((V))[(I)])
+#define PVM_VAL_TYP_S_FHASH(V) (PVM_VAL_TYP((V))->val.sct.fhash)
+#define PVM_VAL_TYP_S_FHASH_MASK(V) (PVM_VAL_TYP((V))->val.sct.fhash_mask)
 #define PVM_VAL_TYP_O_UNIT(V) (PVM_VAL_TYP((V))->val.off.unit)
 #define PVM_VAL_TYP_O_BASE_TYPE(V) (PVM_VAL_TYP((V))->val.off.base_type)
 #define PVM_VAL_TYP_C_RETURN_TYPE(V) (PVM_VAL_TYP((V))->val.cls.return_type)
 #define PVM_VAL_TYP_C_NARGS(V) (PVM_VAL_TYP((V))->val.cls.nargs)
 #define PVM_VAL_TYP_C_ATYPES(V) (PVM_VAL_TYP((V))->val.cls.atypes)
 #define PVM_VAL_TYP_C_ATYPE(V,I) (PVM_VAL_TYP_C_ATYPES((V))[(I)])
+#define PVM_VAL_TYP_D_KTYPE(V) (PVM_VAL_TYP((V))->val.dict.ktype)
+#define PVM_VAL_TYP_D_VTYPE(V) (PVM_VAL_TYP((V))->val.dict.vtype)
 
 enum pvm_type_code
 {
@@ -446,7 +605,8 @@ enum pvm_type_code
   PVM_TYPE_OFFSET,
   PVM_TYPE_CLOSURE,
   PVM_TYPE_ANY,
-  PVM_TYPE_VOID
+  PVM_TYPE_VOID,
+  PVM_TYPE_DICT
 };
 
 struct pvm_type
@@ -473,6 +633,14 @@ struct pvm_type
       pvm_val nfields;
       pvm_val *fnames;
       pvm_val *ftypes;
+
+      /* FHASH is an open-addressing table mapping field names to
+         field indexes, built lazily the first time a field is looked
+         up by name in a struct value of this type.  Each slot holds
+         the index of the field plus one, or zero if the slot is
+         empty.  FHASH_MASK is the size of the table minus one.  */
+      uint32_t *fhash;
+      uint32_t fhash_mask;
     } sct;
 
     struct
@@ -487,6 +655,12 @@ struct pvm_type
       pvm_val return_type;
       pvm_val *atypes;
     } cls;
+
+    struct
+    {
+      pvm_val ktype;
+      pvm_val vtype;
+    } dict;
   } val;
 };
 
@@ -569,6 +743,9 @@ typedef struct pvm_off *pvm_off;
 #define PVM_IS_OFF(V)                                                   \
   (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_OFF)
+#define PVM_IS_DCT(V)                                                   \
+  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+   && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_DCT)
 
 
 #define PVM_IS_INTEGRAL(V)                                      \
@@ -617,6 +794,15 @@ typedef struct pvm_off *pvm_off;
         PVM_VAL_SCT_IOS ((V)) = (I);             \
     } while (0)
 
+#define PVM_VAL_SET_GENERATION(V,G)              \
+  do                                             \
+    {                                            \
+      if (PVM_IS_ARR ((V)))                      \
+        PVM_VAL_ARR_GENERATION ((V)) = (G);      \
+      else if (PVM_IS_SCT (V))                   \
+        PVM_VAL_SCT_GENERATION ((V)) = (G);      \
+    } while (0)
+
 #define PVM_VAL_MAPPED_P(V)                             \
   (PVM_IS_ARR ((V)) ? PVM_VAL_ARR_MAPPED_P ((V))        \
    : PVM_IS_SCT ((V)) ? PVM_VAL_SCT_MAPPED_P ((V))      \
@@ -701,6 +887,20 @@ void pvm_allocate_struct_attrs (pvm_val nfields, pvm_val **fnames,
                                 pvm_val **ftypes);
 void pvm_allocate_closure_attrs (pvm_val nargs, pvm_val **atypes);
 
+/* Number of values allocated since libpoke was loaded, by kind.
+   OTHERS counts the types, closures and dictionaries.  */
+
+struct pvm_val_stats
+{
+  uint64_t strings;
+  uint64_t offsets;
+  uint64_t arrays;
+  uint64_t structs;
+  uint64_t others;
+};
+
+void pvm_val_stats (struct pvm_val_stats *stats);
+
 void pvm_val_initialize (void);
 void pvm_val_finalize (void);
 
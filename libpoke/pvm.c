@@ -18,18 +18,26 @@
 
 #include <config.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <inttypes.h>
 
 #include "pkl.h"
 #include "pkl-asm.h"
 #include "pvm.h"
 
+#include "pk-thread.h"
+#include "pkt.h"
 #include "pvm-alloc.h"
 #include "pvm-program.h"
+#include "pvm-val.h"
 #include "pvm-vm.h"
+#include "xalloc.h"
+#include "timespec.h"
 
 /* The following struct defines a Poke Virtual Machine.  */
 
@@ -39,6 +47,12 @@
   ((PVM)->pvm_state.pvm_state_backing.exit_code)
 #define PVM_STATE_VM(PVM)                               \
   ((PVM)->pvm_state.pvm_state_backing.vm)
+#define PVM_STATE_PROFILE_P(PVM)                        \
+  ((PVM)->pvm_state.pvm_state_backing.profile_p)
+#define PVM_STATE_BUDGET(PVM)                           \
+  ((PVM)->pvm_state.pvm_state_backing.budget)
+#define PVM_STATE_BUDGET_LEFT(PVM)                      \
+  ((PVM)->pvm_state.pvm_state_backing.budget_left)
 #define PVM_STATE_ENV(PVM)                              \
   ((PVM)->pvm_state.pvm_state_runtime.env)
 #define PVM_STATE_ENDIAN(PVM)                           \
@@ -60,6 +74,11 @@
 #define PVM_STATE_OACUTOFF(PVM)                         \
   ((PVM)->pvm_state.pvm_state_runtime.oacutoff)
 
+/* Maximum number of arguments of the closures called using the
+   trampolines of a PVM.  See pvm_call_closure_args below.  */
+
+#define PVM_CALL_MAX_ARGS 8
+
 struct pvm
 {
   /* Note that the contents of the struct pvm_state are defined in the
@@ -70,8 +89,54 @@ struct pvm
   /* If not NULL, this is the compiler to be used when the PVM needs
      to build programs.  */
   pkl_compiler compiler;
+
+  /* IO context holding the IO spaces operated by this PVM.  If
+     IOS_CTX_BORROWED_P is set, the IO context belongs to another
+     PVM and is not freed along with this one.  */
+  ios_context ios_ctx;
+  int ios_ctx_borrowed_p;
+
+  /* State of the function profiler.  See below.  */
+  struct pvm_prof_node *prof_root;
+  struct pvm_prof_node *prof_cur;
+  struct pvm_prof_frame *prof_frames;
+  size_t prof_depth;
+  size_t prof_nframes;
+  int prof_run_depth;
+  struct timespec prof_last;
+
+  /* Trampolines used in order to call closures from C, indexed by
+     number of arguments, and the arrays where they fetch the
+     arguments and the closure from.  They are built when first
+     needed.  */
+  pvm_program call_programs[PVM_CALL_MAX_ARGS + 1];
+  pvm_val call_args[PVM_CALL_MAX_ARGS + 1];
+
+  /* Function called when the execution budget is exhausted, and its
+     argument.  See pvm_set_budget.  */
+  pvm_budget_fn budget_fn;
+  void *budget_data;
 };
 
+/* The memory allocator, the PVM values and the VM subsystem are
+   shared by all the PVMs of the process.  They are initialized when
+   the first PVM is created and finalized when the last PVM is shut
+   down.  PVM_NUM_VMS is the number of existing PVMs, and PVM_LOCK
+   protects it, as well as the creation and destruction of Jitter
+   states, which are linked in a global list.  */
+
+static int pvm_num_vms;
+PK_LOCK_DEFINE (pvm_lock);
+
+/* The SIGINT handler is process-wide.  It is installed when some PVM
+   starts running a program and the previous handler is restored
+   once no PVM is running.  PVM_NUM_RUNNING is the number of running
+   PVMs, and PVM_PREVIOUS_HANDLER the handler to restore.  Both are
+   protected by PVM_LOCK.  */
+
+static int pvm_num_running;
+static sighandler_t pvm_previous_handler;
+
 static void
 pvm_initialize_state (pvm apvm, struct pvm_state *state)
 {
@@ -96,6 +161,25 @@ pvm_initialize_state (pvm apvm, struct pvm_state *state)
   state->pvm_state_backing.vm = apvm;
 }
 
+static void
+pvm_finalize_state (struct pvm_state *state)
+{
+  /* Deregister GC roots.  */
+  pvm_alloc_remove_gc_roots (&state->pvm_state_runtime.env, 1);
+  pvm_alloc_remove_gc_roots
+    (state->pvm_state_backing.jitter_stack_stack_backing.memory,
+     state->pvm_state_backing.jitter_stack_stack_backing.element_no);
+  pvm_alloc_remove_gc_roots
+    (state->pvm_state_backing.jitter_stack_returnstack_backing.memory,
+     state->pvm_state_backing.jitter_stack_returnstack_backing.element_no);
+  pvm_alloc_remove_gc_roots
+    (state->pvm_state_backing.jitter_stack_exceptionstack_backing.memory,
+     state->pvm_state_backing.jitter_stack_exceptionstack_backing.element_no);
+
+  /* Call the Jitter state finalizer.  */
+  pvm_state_finalize (state);
+}
+
 pvm
 pvm_init (void)
 {
@@ -103,20 +187,37 @@ pvm_init (void)
   if (!apvm)
     return NULL;
 
-  /* Initialize the memory allocation subsystem.  */
-  pvm_alloc_initialize ();
+  apvm->ios_ctx = ios_context_new ();
+  if (!apvm->ios_ctx)
+    {
+      free (apvm);
+      return NULL;
+    }
+
+  PK_LOCK (pvm_lock);
+
+  if (pvm_num_vms++ == 0)
+    {
+      /* Initialize the memory allocation subsystem.  */
+      pvm_alloc_initialize ();
 
-  /* Initialize values.  */
-  pvm_val_initialize ();
+      /* Initialize values.  */
+      pvm_val_initialize ();
 
-  /* Initialize the VM subsystem.  */
-  pvm_initialize ();
+      /* Initialize the VM subsystem.  */
+      pvm_initialize ();
+
+      /* Initialize pvm-program.  */
+      pvm_program_init ();
+    }
 
   /* Initialize the VM state.  */
   pvm_initialize_state (apvm, &apvm->pvm_state);
+  pvm_alloc_add_gc_roots (&apvm->prof_root, 1);
+  pvm_alloc_add_gc_roots (apvm->call_programs, PVM_CALL_MAX_ARGS + 1);
+  pvm_alloc_add_gc_roots (apvm->call_args, PVM_CALL_MAX_ARGS + 1);
 
-  /* Initialize pvm-program.  */
-  pvm_program_init ();
+  PK_UNLOCK (pvm_lock);
 
   return apvm;
 }
@@ -137,6 +238,348 @@ pvm_reset_profile (pvm apvm)
   struct pvm_profile_runtime *p
     = pvm_state_profile_runtime (&apvm->pvm_state);
   pvm_profile_runtime_clear (p);
+
+  apvm->prof_root = NULL;
+  apvm->prof_cur = NULL;
+  apvm->prof_depth = 0;
+  if (PVM_STATE_PROFILE_P (apvm))
+    pvm_set_profile_functions (apvm, 1);
+}
+
+/* The function profiler.
+
+   When enabled, the `call' and `return' instructions notify the
+   profiler, which builds a calling context tree: every node is a
+   program implementing a Poke function (or a mapper, constructor,
+   etc) called from the program in its parent node.  The root of the
+   tree is the code executed outside of any function.  Every node
+   counts the calls to the function from that context, and the time
+   spent in the function itself, excluding the functions it calls.
+
+   Raising exceptions unwinds activations without executing `return'.
+   Therefore every activation records the height of the return stack
+   at the time of the call, and the activations above the current
+   height are discarded when calling or returning.  */
+
+struct pvm_prof_node
+{
+  pvm_program program;
+  struct pvm_prof_node *parent;
+  struct pvm_prof_node *children;
+  struct pvm_prof_node *next;
+  uint64_t calls;
+  uint64_t self_ns;
+};
+
+struct pvm_prof_frame
+{
+  struct pvm_prof_node *node;
+  uintptr_t height;
+};
+
+static struct pvm_prof_node *
+pvm_prof_node_new (pvm_program program, struct pvm_prof_node *parent)
+{
+  struct pvm_prof_node *node = pvm_alloc (sizeof (struct pvm_prof_node));
+
+  memset (node, 0, sizeof (struct pvm_prof_node));
+  node->program = program;
+  node->parent = parent;
+  return node;
+}
+
+/* Charge the time elapsed since the last event to the current
+   function.  */
+
+static void
+pvm_profile_tick (pvm apvm)
+{
+  struct timespec now = current_timespec ();
+
+  if (apvm->prof_run_depth > 0)
+    apvm->prof_cur->self_ns
+      += ((now.tv_sec - apvm->prof_last.tv_sec) * 1000000000LL
+          + (now.tv_nsec - apvm->prof_last.tv_nsec));
+  apvm->prof_last = now;
+}
+
+/* Discard the activations whose height is HEIGHT or bigger.  */
+
+static void
+pvm_profile_unwind (pvm apvm, uintptr_t height)
+{
+  while (apvm->prof_depth > 0
+         && apvm->prof_frames[apvm->prof_depth - 1].height >= height)
+    apvm->prof_depth--;
+
+  apvm->prof_cur = (apvm->prof_depth > 0
+                    ? apvm->prof_frames[apvm->prof_depth - 1].node
+                    : apvm->prof_root);
+}
+
+void
+pvm_profile_enter (pvm apvm, pvm_program program, uintptr_t height)
+{
+  struct pvm_prof_node *node;
+
+  pvm_profile_tick (apvm);
+  pvm_profile_unwind (apvm, height);
+
+  for (node = apvm->prof_cur->children; node; node = node->next)
+    if (node->program == program)
+      break;
+
+  if (!node)
+    {
+      node = pvm_prof_node_new (program, apvm->prof_cur);
+      node->next = apvm->prof_cur->children;
+      apvm->prof_cur->children = node;
+    }
+
+  if (apvm->prof_depth == apvm->prof_nframes)
+    {
+      apvm->prof_nframes = apvm->prof_nframes ? 2 * apvm->prof_nframes : 64;
+      apvm->prof_frames = xrealloc (apvm->prof_frames,
+                                    (apvm->prof_nframes
+                                     * sizeof (struct pvm_prof_frame)));
+    }
+
+  apvm->prof_frames[apvm->prof_depth].node = node;
+  apvm->prof_frames[apvm->prof_depth].height = height;
+  apvm->prof_depth++;
+
+  node->calls++;
+  apvm->prof_cur = node;
+}
+
+void
+pvm_profile_leave (pvm apvm, uintptr_t height)
+{
+  pvm_profile_tick (apvm);
+  pvm_profile_unwind (apvm, height);
+}
+
+void
+pvm_set_profile_functions (pvm apvm, int profile_p)
+{
+  if (profile_p && apvm->prof_root == NULL)
+    {
+      apvm->prof_root = pvm_prof_node_new (NULL, NULL);
+      apvm->prof_cur = apvm->prof_root;
+      apvm->prof_depth = 0;
+    }
+
+  PVM_STATE_PROFILE_P (apvm) = profile_p;
+}
+
+void
+pvm_set_budget (pvm apvm, uint64_t budget, pvm_budget_fn fn, void *data)
+{
+  PVM_STATE_BUDGET (apvm) = budget;
+  PVM_STATE_BUDGET_LEFT (apvm) = budget;
+  apvm->budget_fn = fn;
+  apvm->budget_data = data;
+}
+
+int
+pvm_budget_expired (pvm apvm)
+{
+  PVM_STATE_BUDGET_LEFT (apvm) = PVM_STATE_BUDGET (apvm);
+  return apvm->budget_fn ? apvm->budget_fn (apvm->budget_data) : 0;
+}
+
+void
+pvm_interrupt (pvm apvm)
+{
+  pvm_interrupt_state (&apvm->pvm_state);
+}
+
+int
+pvm_profile_functions_p (pvm apvm)
+{
+  return PVM_STATE_PROFILE_P (apvm);
+}
+
+/* Print the name of the function run by PROGRAM, for the function
+   profile.  */
+
+static void
+pvm_profile_print_name (pvm_program program)
+{
+  const char *name = program ? pvm_program_name (program) : "<toplevel>";
+  const char *location = program ? pvm_program_location (program) : NULL;
+
+  pk_puts (name ? name : "<unknown>");
+  if (location)
+    pk_printf (" (%s)", location);
+}
+
+/* Print the stacks in the subtree rooted at NODE in folded format,
+   which is understood by flame graph generators.  Every line
+   contains the functions in a stack separated by semicolons,
+   followed by the time spent in the last one, in microseconds.
+
+   PATH contains the DEPTH nodes from the root to NODE, excluded.  */
+
+static void
+pvm_profile_print_folded (struct pvm_prof_node *node,
+                          struct pvm_prof_node **path, size_t depth)
+{
+  struct pvm_prof_node *child;
+  uint64_t usecs = node->self_ns / 1000;
+
+  if (usecs > 0)
+    {
+      size_t i;
+
+      /* The root is not part of the stacks of the functions.  */
+      for (i = 1; i < depth; ++i)
+        {
+          pvm_profile_print_name (path[i]->program);
+          pk_puts (";");
+        }
+      pvm_profile_print_name (node->program);
+      pk_printf (" %" PRIu64 "\n", usecs);
+    }
+
+  path[depth] = node;
+  for (child = node->children; child; child = child->next)
+    pvm_profile_print_folded (child, path, depth + 1);
+}
+
+/* The flat profile has an entry per program.  TOTAL_NS is the time
+   spent in the program and the functions it calls.  Recursive
+   activations are only accounted once.  */
+
+struct pvm_prof_entry
+{
+  pvm_program program;
+  uint64_t calls;
+  uint64_t self_ns;
+  uint64_t total_ns;
+};
+
+struct pvm_prof_flat
+{
+  struct pvm_prof_entry *entries;
+  size_t num_entries;
+};
+
+static struct pvm_prof_entry *
+pvm_profile_flat_entry (struct pvm_prof_flat *flat, pvm_program program)
+{
+  size_t i;
+
+  for (i = 0; i < flat->num_entries; ++i)
+    if (flat->entries[i].program == program)
+      return &flat->entries[i];
+
+  flat->entries = xrealloc (flat->entries,
+                            ((flat->num_entries + 1)
+                             * sizeof (struct pvm_prof_entry)));
+  memset (&flat->entries[i], 0, sizeof (struct pvm_prof_entry));
+  flat->entries[i].program = program;
+  flat->num_entries++;
+  return &flat->entries[i];
+}
+
+/* Add the subtree rooted at NODE to FLAT, and return the time spent
+   in it.  PATH contains the DEPTH nodes from the root to NODE,
+   excluded.  */
+
+static uint64_t
+pvm_profile_flatten (struct pvm_prof_flat *flat, struct pvm_prof_node *node,
+                     struct pvm_prof_node **path, size_t depth)
+{
+  struct pvm_prof_entry *entry;
+  struct pvm_prof_node *child;
+  uint64_t total_ns = node->self_ns;
+  size_t i;
+
+  path[depth] = node;
+  for (child = node->children; child; child = child->next)
+    total_ns += pvm_profile_flatten (flat, child, path, depth + 1);
+
+  entry = pvm_profile_flat_entry (flat, node->program);
+  entry->calls += node->calls;
+  entry->self_ns += node->self_ns;
+
+  for (i = 0; i < depth; ++i)
+    if (path[i]->program == node->program)
+      break;
+  if (i == depth)
+    entry->total_ns += total_ns;
+
+  return total_ns;
+}
+
+/* Return the depth of the subtree rooted at NODE.  */
+
+static size_t
+pvm_profile_depth (struct pvm_prof_node *node)
+{
+  struct pvm_prof_node *child;
+  size_t depth = 0;
+
+  for (child = node->children; child; child = child->next)
+    {
+      size_t d = pvm_profile_depth (child);
+      if (d > depth)
+        depth = d;
+    }
+
+  return depth + 1;
+}
+
+static int
+pvm_profile_cmp_entries (const void *a, const void *b)
+{
+  const struct pvm_prof_entry *ea = a;
+  const struct pvm_prof_entry *eb = b;
+
+  if (ea->self_ns != eb->self_ns)
+    return ea->self_ns < eb->self_ns ? 1 : -1;
+  return ea->calls < eb->calls ? 1 : (ea->calls > eb->calls ? -1 : 0);
+}
+
+void
+pvm_print_function_profile (pvm apvm, int folded_p)
+{
+  struct pvm_prof_node **path;
+  size_t i;
+
+  if (apvm->prof_root == NULL)
+    return;
+
+  path = xmalloc (pvm_profile_depth (apvm->prof_root)
+                  * sizeof (struct pvm_prof_node *));
+
+  if (folded_p)
+    pvm_profile_print_folded (apvm->prof_root, path, 0);
+  else
+    {
+      struct pvm_prof_flat flat = { NULL, 0 };
+
+      pvm_profile_flatten (&flat, apvm->prof_root, path, 0);
+      qsort (flat.entries, flat.num_entries, sizeof (struct pvm_prof_entry),
+             pvm_profile_cmp_entries);
+
+      pk_puts ("   self ms   total ms      calls  function\n");
+      for (i = 0; i < flat.num_entries; ++i)
+        {
+          struct pvm_prof_entry *entry = &flat.entries[i];
+
+          pk_printf ("%10.3f %10.3f %10" PRIu64 "  ",
+                     entry->self_ns / 1e6, entry->total_ns / 1e6,
+                     entry->calls);
+          pvm_profile_print_name (entry->program);
+          pk_puts ("\n");
+        }
+
+      free (flat.entries);
+    }
+
+  free (path);
 }
 
 pvm_env
@@ -145,18 +588,55 @@ pvm_get_env (pvm apvm)
   return PVM_STATE_ENV (apvm);
 }
 
+const char *
+pvm_dispatch_name (void)
+{
+#if defined JITTER_DISPATCH_NO_THREADING
+  return "no-threading";
+#elif defined JITTER_DISPATCH_MINIMAL_THREADING
+  return "minimal-threading";
+#elif defined JITTER_DISPATCH_DIRECT_THREADING
+  return "direct-threading";
+#elif defined JITTER_DISPATCH_SWITCH
+  return "switch";
+#else
+  return "unknown";
+#endif
+}
+
 enum pvm_exit_code
 pvm_run (pvm apvm, pvm_program program, pvm_val *res)
 {
-  sighandler_t previous_handler;
   pvm_routine routine = pvm_program_routine (program);
 
   PVM_STATE_RESULT_VALUE (apvm) = PVM_NULL;
   PVM_STATE_EXIT_CODE (apvm) = PVM_EXIT_OK;
 
-  previous_handler = signal (SIGINT, pvm_handle_signal);
+  /* Nested runs, like the ones calling pretty-printers, share the
+     budget of the outermost run.  */
+  if (apvm->prof_run_depth == 0)
+    PVM_STATE_BUDGET_LEFT (apvm) = PVM_STATE_BUDGET (apvm);
+
+  if (PVM_STATE_PROFILE_P (apvm))
+    pvm_profile_tick (apvm);
+  apvm->prof_run_depth++;
+
+  PK_LOCK (pvm_lock);
+  if (pvm_num_running++ == 0)
+    pvm_previous_handler = signal (SIGINT, pvm_handle_signal);
+  PK_UNLOCK (pvm_lock);
+
   pvm_execute_routine (routine, &apvm->pvm_state);
-  signal (SIGINT, previous_handler);
+
+  if (PVM_STATE_PROFILE_P (apvm))
+    pvm_profile_tick (apvm);
+  if (--apvm->prof_run_depth == 0 && apvm->prof_root)
+    pvm_profile_unwind (apvm, 0);
+
+  PK_LOCK (pvm_lock);
+  if (--pvm_num_running == 0)
+    signal (SIGINT, pvm_previous_handler);
+  PK_UNLOCK (pvm_lock);
 
   if (res != NULL)
     *res = PVM_STATE_RESULT_VALUE (apvm);
@@ -164,66 +644,461 @@ pvm_run (pvm apvm, pvm_program program, pvm_val *res)
   return PVM_STATE_EXIT_CODE (apvm);
 }
 
-void
-pvm_call_closure (pvm vm, pvm_val cls, ...)
+/* Closures are called from C using a trampoline: a program that
+   pushes the elements of an array of `any' values, the arguments
+   followed by the closure, and calls the closure.  Since the array
+   is a literal in the program, calling a closure once the
+   trampoline exists involves no compilation at all: the arguments
+   are stored in the array and the program is run.
+
+   The trampoline for NARGS arguments is built the first time it is
+   needed.  The elements of its array are read by the program before
+   the call, so nested calls with the same number of arguments can
+   reuse it.  */
+
+static pvm_program
+pvm_call_trampoline (pvm vm, size_t nargs)
 {
   pvm_program program;
+  pvm_val args;
   pkl_asm pasm;
-  va_list valist;
-  pvm_val arg;
+  size_t i;
+
+  if (vm->call_programs[nargs])
+    return vm->call_programs[nargs];
+
+  args = pvm_make_array (pvm_make_ulong (0, 64),
+                         pvm_make_array_type (pvm_make_any_type (),
+                                              PVM_NULL));
+  pvm_array_insert (args, pvm_make_ulong (nargs, 64),
+                    pvm_make_int (0, 32));
 
   pasm = pkl_asm_new (NULL /* ast */,
                       pvm_compiler (vm), 1 /* prologue */);
+  for (i = 0; i <= nargs; ++i)
+    {
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, args);
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (i, 64));
+      pkl_asm_insn (pasm, PKL_INSN_AREF);
+      pkl_asm_insn (pasm, PKL_INSN_NIP2);
+    }
+  pkl_asm_insn (pasm, PKL_INSN_CALL);
+
+  program = pkl_asm_finish (pasm, 1 /* epilogue */);
+  pvm_program_make_executable (program);
+
+  vm->call_args[nargs] = args;
+  vm->call_programs[nargs] = program;
+  return program;
+}
+
+enum pvm_exit_code
+pvm_call_closure_args (pvm vm, pvm_val cls, size_t nargs,
+                       const pvm_val *args, pvm_val *ret)
+{
+  enum pvm_exit_code exit_code;
+  pvm_program program;
+  size_t i;
+
+  if (nargs <= PVM_CALL_MAX_ARGS)
+    {
+      program = pvm_call_trampoline (vm, nargs);
+
+      /* The array of the trampoline is unmapped, so there are no
+         element offsets to keep up to date.  */
+      for (i = 0; i < nargs; ++i)
+        PVM_VAL_ARR_ELEM_VALUE (vm->call_args[nargs], i) = args[i];
+      PVM_VAL_ARR_ELEM_VALUE (vm->call_args[nargs], nargs) = cls;
+
+      return pvm_run (vm, program, ret);
+    }
+
+  /* Too many arguments for a trampoline.  Build a program that
+     pushes them.  */
+  {
+    pkl_asm pasm = pkl_asm_new (NULL /* ast */,
+                                pvm_compiler (vm), 1 /* prologue */);
+
+    for (i = 0; i < nargs; ++i)
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, args[i]);
+    pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
+    pkl_asm_insn (pasm, PKL_INSN_CALL);
 
-  /* Push the arguments to the call.  */
+    program = pkl_asm_finish (pasm, 1 /* epilogue */);
+    pvm_program_make_executable (program);
+    exit_code = pvm_run (vm, program, ret);
+    pvm_destroy_program (program);
+  }
+
+  return exit_code;
+}
+
+void
+pvm_call_closure (pvm vm, pvm_val cls, ...)
+{
+  pvm_val args[PVM_CALL_MAX_ARGS];
+  size_t nargs = 0;
+  va_list valist;
+  pvm_val arg;
+
+  /* Closures called this way, like pretty-printers, take very few
+     arguments.  */
   va_start (valist, cls);
   while ((arg = va_arg (valist, pvm_val)) != PVM_NULL)
-    pkl_asm_insn (pasm, PKL_INSN_PUSH, arg);
+    {
+      assert (nargs < PVM_CALL_MAX_ARGS);
+      args[nargs++] = arg;
+    }
   va_end (valist);
 
-  /* Call the closure.  */
+  (void) pvm_call_closure_args (vm, cls, nargs, args, NULL);
+}
+
+/* Destroy the trampolines of the PVM VM and deregister them as GC
+   roots.  */
+
+static void
+pvm_destroy_call_trampolines (pvm vm)
+{
+  size_t i;
+
+  for (i = 0; i <= PVM_CALL_MAX_ARGS; ++i)
+    if (vm->call_programs[i])
+      pvm_destroy_program (vm->call_programs[i]);
+
+  pvm_alloc_remove_gc_roots (vm->call_programs, PVM_CALL_MAX_ARGS + 1);
+  pvm_alloc_remove_gc_roots (vm->call_args, PVM_CALL_MAX_ARGS + 1);
+}
+
+void
+pvm_shutdown (pvm apvm)
+{
+  /* Close the IO spaces of this PVM.  */
+  ios_context_free (apvm->ios_ctx);
+
+  PK_LOCK (pvm_lock);
+
+  /* Finalize the VM state.  */
+  pvm_destroy_call_trampolines (apvm);
+  pvm_alloc_remove_gc_roots (&apvm->prof_root, 1);
+  pvm_finalize_state (&apvm->pvm_state);
+  free (apvm->prof_frames);
+  free (apvm);
+
+  if (--pvm_num_vms == 0)
+    {
+      /* Finalize pvm-program.  */
+      pvm_program_fini ();
+
+      /* Finalize values.  */
+      pvm_val_finalize ();
+
+      /* Finalize the VM subsystem.  */
+      pvm_finalize ();
+
+      /* Finalize the memory allocator.  */
+      pvm_alloc_finalize ();
+    }
+
+  PK_UNLOCK (pvm_lock);
+}
+
+ios_context
+pvm_ios_context (pvm apvm)
+{
+  return apvm->ios_ctx;
+}
+
+pvm
+pvm_worker_new (pvm parent, int share_ios_p)
+{
+  pvm wvm = calloc (1, sizeof (struct pvm));
+
+  if (!wvm)
+    return NULL;
+
+  wvm->compiler = parent->compiler;
+  if (share_ios_p)
+    {
+      wvm->ios_ctx = parent->ios_ctx;
+      wvm->ios_ctx_borrowed_p = 1;
+    }
+  else
+    {
+      wvm->ios_ctx = ios_context_new ();
+      if (!wvm->ios_ctx)
+        {
+          free (wvm);
+          return NULL;
+        }
+    }
+
+  PK_LOCK (pvm_lock);
+  pvm_initialize_state (wvm, &wvm->pvm_state);
+  pvm_alloc_add_gc_roots (wvm->call_programs, PVM_CALL_MAX_ARGS + 1);
+  pvm_alloc_add_gc_roots (wvm->call_args, PVM_CALL_MAX_ARGS + 1);
+  PK_UNLOCK (pvm_lock);
+
+  PVM_STATE_ENDIAN (wvm) = PVM_STATE_ENDIAN (parent);
+  PVM_STATE_NENC (wvm) = PVM_STATE_NENC (parent);
+  PVM_STATE_PRETTY_PRINT (wvm) = PVM_STATE_PRETTY_PRINT (parent);
+  PVM_STATE_OMODE (wvm) = PVM_STATE_OMODE (parent);
+  PVM_STATE_OBASE (wvm) = PVM_STATE_OBASE (parent);
+  PVM_STATE_OMAPS (wvm) = PVM_STATE_OMAPS (parent);
+  PVM_STATE_ODEPTH (wvm) = PVM_STATE_ODEPTH (parent);
+  PVM_STATE_OINDENT (wvm) = PVM_STATE_OINDENT (parent);
+  PVM_STATE_OACUTOFF (wvm) = PVM_STATE_OACUTOFF (parent);
+
+  /* The argument passed by pvm_apply is the first variable of the
+     global environment of the worker.  */
+  pvm_env_register (PVM_STATE_ENV (wvm), PVM_NULL);
+  return wvm;
+}
+
+void
+pvm_worker_free (pvm wvm)
+{
+  if (!wvm->ios_ctx_borrowed_p)
+    ios_context_free (wvm->ios_ctx);
+
+  PK_LOCK (pvm_lock);
+  pvm_destroy_call_trampolines (wvm);
+  pvm_finalize_state (&wvm->pvm_state);
+  PK_UNLOCK (pvm_lock);
+  free (wvm);
+}
+
+pvm_program
+pvm_make_apply_program (pvm apvm, pvm_val cls)
+{
+  pkl_asm pasm = pkl_asm_new (NULL /* ast */,
+                              pvm_compiler (apvm), 0 /* prologue */);
+  pvm_program_label error_label = pkl_asm_fresh_label (pasm);
+  pvm_program program;
+
+  pkl_asm_insn (pasm, PKL_INSN_CANARY);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                pvm_make_offset (pvm_make_int (0, 32),
+                                 pvm_make_ulong (1, 64)));
+  pkl_asm_insn (pasm, PKL_INSN_POPR, 0);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                pvm_make_exception (PVM_E_GENERIC, PVM_E_GENERIC_MSG,
+                                    PVM_E_GENERIC_ESTATUS));
+  pkl_asm_insn (pasm, PKL_INSN_PUSHE, error_label);
+
+  pkl_asm_insn (pasm, PKL_INSN_PUSHVAR, 0, 0);
   pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
   pkl_asm_insn (pasm, PKL_INSN_CALL);
 
-  /* Run the program in the poke VM.  */
-  program = pkl_asm_finish (pasm, 1 /* epilogue */);
+  pkl_asm_insn (pasm, PKL_INSN_POPE);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_int (PVM_EXIT_OK, 32));
+  pkl_asm_insn (pasm, PKL_INSN_EXIT);
+
+  /* The exception is on the stack.  */
+  pkl_asm_label (pasm, error_label);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_int (PVM_EXIT_ERROR, 32));
+  pkl_asm_insn (pasm, PKL_INSN_EXIT);
+
+  program = pkl_asm_finish (pasm, 0 /* epilogue */);
   pvm_program_make_executable (program);
-  (void) pvm_run (vm, program, NULL);
-  pvm_destroy_program (program);
+  return program;
+}
 
+enum pvm_exit_code
+pvm_apply (pvm wvm, pvm_program program, pvm_val arg, pvm_val *res)
+{
+  pvm_env_set_var (PVM_STATE_ENV (wvm), 0, 0, arg);
+  return pvm_run (wvm, program, res);
 }
 
-void
-pvm_shutdown (pvm apvm)
+/* Parallel mapping.
+
+   pvm_pmap calls a closure for every index in [0,NELEM), splitting
+   the range in consecutive chunks that are processed by worker
+   threads.  Every worker runs in its own PVM, sharing the IO context
+   of the calling PVM.  The workers are created for every call.
+
+   A worker processes the indexes of its chunk in order, and stops at
+   the first one for which the closure raises an exception.  */
+
+#define PVM_PMAP_MAX_THREADS 64
+
+struct pvm_pmap_worker
 {
-  /* Finalize pvm-program.  */
-  pvm_program_fini ();
+  pvm vm;
+  pvm_program program;
+  pvm_val results;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t exc_index;
+  pvm_val exception;
+  struct pk_term_if *term_if;
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+};
 
-  /* Deregister GC roots.  */
-  pvm_alloc_remove_gc_roots (&PVM_STATE_ENV (apvm), 1);
-  pvm_alloc_remove_gc_roots
-    (apvm->pvm_state.pvm_state_backing.jitter_stack_stack_backing.memory,
-     apvm->pvm_state.pvm_state_backing.jitter_stack_stack_backing.element_no);
-  pvm_alloc_remove_gc_roots
-    (apvm->pvm_state.pvm_state_backing.jitter_stack_returnstack_backing.memory,
-     apvm->pvm_state.pvm_state_backing.jitter_stack_returnstack_backing.element_no);
-  pvm_alloc_remove_gc_roots
-    (apvm->pvm_state.pvm_state_backing.jitter_stack_exceptionstack_backing.memory,
-     apvm->pvm_state.pvm_state_backing.jitter_stack_exceptionstack_backing.element_no);
+static void
+pvm_pmap_run (struct pvm_pmap_worker *w)
+{
+  uint64_t i;
 
-  /* Finalize values.  */
-  pvm_val_initialize ();
+  for (i = w->begin; i < w->end; ++i)
+    {
+      pvm_val val;
 
-  /* Finalize the VM state.  */
-  pvm_state_finalize (&apvm->pvm_state);
+      if (pvm_apply (w->vm, w->program, pvm_make_ulong (i, 64), &val)
+          != PVM_EXIT_OK)
+        {
+          w->exc_index = i;
+          w->exception = val;
+          break;
+        }
 
-  /* Finalize the VM subsystem.  */
-  pvm_finalize ();
+      PVM_VAL_ARR_ELEM_VALUE (w->results, i) = val;
+    }
+}
 
-  free (apvm);
+#if HAVE_PTHREAD
+
+static void *
+pvm_pmap_thread (void *data)
+{
+  struct pvm_pmap_worker *w = data;
+
+  pvm_alloc_register_thread ();
+  ios_context_set_cur (w->vm->ios_ctx);
+  libpoke_term_if = w->term_if;
+
+  pvm_pmap_run (w);
+  return NULL;
+}
+
+#endif /* HAVE_PTHREAD */
+
+int
+pvm_pmap (pvm apvm, pvm_val cls, uint64_t nelem, unsigned int nthreads,
+          pvm_val *result)
+{
+  struct pvm_pmap_worker workers[PVM_PMAP_MAX_THREADS];
+  pvm_program program;
+  pvm_val arr, exception = PVM_NULL;
+  uint64_t i, boffset;
+  unsigned int t, nworkers = 0;
+  int ret = 1;
+
+#if HAVE_PTHREAD
+  if (nthreads == 0)
+    {
+      long nprocs = sysconf (_SC_NPROCESSORS_ONLN);
+      nthreads = nprocs > 0 ? nprocs : 1;
+    }
+#else
+  nthreads = 1;
+#endif
+
+  if (nthreads > PVM_PMAP_MAX_THREADS)
+    nthreads = PVM_PMAP_MAX_THREADS;
+  if (nthreads > nelem)
+    nthreads = nelem > 0 ? nelem : 1;
+
+  arr = pvm_make_array (pvm_make_ulong (nelem, 64),
+                        pvm_make_array_type (pvm_make_any_type (),
+                                             PVM_NULL));
+  program = pvm_make_apply_program (apvm, cls);
+
+  for (t = 0; t < nthreads; ++t)
+    {
+      struct pvm_pmap_worker *w = &workers[t];
+
+      w->vm = pvm_worker_new (apvm, 1 /* share_ios_p */);
+      if (w->vm == NULL)
+        break;
+      w->program = program;
+      w->results = arr;
+      w->begin = nelem * t / nthreads;
+      w->end = nelem * (t + 1) / nthreads;
+      w->exc_index = w->end;
+      w->exception = PVM_NULL;
+      w->term_if = libpoke_term_if;
+      nworkers++;
+    }
+
+  if (nworkers == 0)
+    {
+      pvm_destroy_program (program);
+      *result = pvm_make_exception (PVM_E_GENERIC, PVM_E_GENERIC_MSG,
+                                    PVM_E_GENERIC_ESTATUS);
+      return 0;
+    }
+
+  /* Workers that couldn't be created are replaced by the last one
+     created.  */
+  workers[nworkers - 1].end = nelem;
+  workers[nworkers - 1].exc_index = nelem;
+
+#if HAVE_PTHREAD
+  if (nworkers > 1)
+    {
+      /* The context may be already shared if this is a nested
+         call.  */
+      int shared_p = ios_context_set_shared (apvm->ios_ctx, 1);
+
+      for (t = 1; t < nworkers; ++t)
+        if (pthread_create (&workers[t].thread, NULL,
+                            pvm_pmap_thread, &workers[t]) != 0)
+          {
+            /* Process the chunk in the calling thread.  */
+            pvm_pmap_run (&workers[t]);
+            workers[t].thread = pthread_self ();
+          }
+
+      pvm_pmap_run (&workers[0]);
+
+      for (t = 1; t < nworkers; ++t)
+        if (!pthread_equal (workers[t].thread, pthread_self ()))
+          pthread_join (workers[t].thread, NULL);
+
+      ios_context_set_shared (apvm->ios_ctx, shared_p);
+    }
+  else
+#endif
+    pvm_pmap_run (&workers[0]);
+
+  /* Report the exception raised for the lowest index, which is the
+     same one a sequential mapping would have raised.  The chunks are
+     consecutive, so this is the exception of the first worker that
+     was interrupted.  */
+  for (t = 0; t < nworkers; ++t)
+    if (workers[t].exc_index < workers[t].end)
+      {
+        exception = workers[t].exception;
+        ret = 0;
+        break;
+      }
+
+  for (t = 0; t < nworkers; ++t)
+    pvm_worker_free (workers[t].vm);
+  pvm_destroy_program (program);
+
+  if (!ret)
+    {
+      *result = exception;
+      return 0;
+    }
+
+  /* Fill in the offsets of the elements.  */
+  for (boffset = 0, i = 0; i < nelem; ++i)
+    {
+      pvm_val val = PVM_VAL_ARR_ELEM_VALUE (arr, i);
+
+      PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (boffset, 64);
+      boffset += pvm_sizeof (val);
+    }
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem, 64);
 
-  /* Finalize the memory allocator.  */
-  pvm_alloc_finalize ();
+  *result = arr;
+  return 1;
 }
 
 enum ios_endian
@@ -88,6 +88,74 @@ void pvm_destroy_program (pvm_program program);
 
 int pvm_program_make_executable (pvm_program program);
 
+/* Set and get the name of a PVM program, and the location of the
+   source code it was compiled from, like "foo.pk:12".  These are
+   used by the function profiler to identify the programs
+   implementing Poke functions.  Both the name and the location are
+   NULL by default.  */
+
+void pvm_program_set_name (pvm_program program, const char *name,
+                           const char *location);
+
+const char *pvm_program_name (pvm_program program);
+
+const char *pvm_program_location (pvm_program program);
+
+/* Run a peephole optimizer on the instructions of PROGRAM.  This
+   removes useless sequences of instructions like `push X; drop',
+   resolves conditional branches on constant values, threads jumps to
+   unconditional branches and deletes dead code following `ba',
+   `raise', `return' and `exit'.
+
+   This function shall be called after the program has been
+   completely assembled and before it is made executable.  */
+
+void pvm_program_optimize (pvm_program program);
+
+/* The components of a PVM program are called items.  An instruction
+   is an item of kind PVM_PROGRAM_ITEM_INSN followed by the items for
+   its parameters, except push instructions, which are a single item
+   of kind PVM_PROGRAM_ITEM_PUSH.  */
+
+enum pvm_program_item_kind
+{
+  PVM_PROGRAM_ITEM_DELETED,
+  PVM_PROGRAM_ITEM_LABEL,
+  PVM_PROGRAM_ITEM_INSN,
+  PVM_PROGRAM_ITEM_PUSH,
+  PVM_PROGRAM_ITEM_VAL_PARAM,
+  PVM_PROGRAM_ITEM_UNSIGNED_PARAM,
+  PVM_PROGRAM_ITEM_REGISTER_PARAM,
+  PVM_PROGRAM_ITEM_LABEL_PARAM,
+};
+
+/* Keep the items of PROGRAM once it is made executable, so they can
+   be visited with `pvm_program_map_items'.  This function shall be
+   called before appending anything to PROGRAM.  */
+
+void pvm_program_keep_items (pvm_program program);
+
+/* Call FN for every item of PROGRAM, in order.  INSN_NAME is the
+   name of the instruction for PVM_PROGRAM_ITEM_INSN items, VAL is the
+   value of PVM_PROGRAM_ITEM_PUSH and PVM_PROGRAM_ITEM_VAL_PARAM
+   items, and N is the literal, register or label of the other items.
+   DATA is passed to FN untouched.
+
+   This function returns PVM_EINVAL if the items of PROGRAM were not
+   kept, or if FN returns anything else than PVM_OK.  */
+
+typedef int (*pvm_program_item_fn) (enum pvm_program_item_kind kind,
+                                    const char *insn_name,
+                                    pvm_val val, unsigned int n,
+                                    void *data);
+
+int pvm_program_map_items (pvm_program program, pvm_program_item_fn fn,
+                           void *data);
+
+/* Return the number of labels created in PROGRAM.  */
+
+int pvm_program_num_labels (pvm_program program);
+
 /* Print a native disassembly of the given program in the standard
    output.  */
 
@@ -213,6 +281,35 @@ pvm_val pvm_make_ulong (uint64_t value, int size);
 
 pvm_val pvm_make_string (const char *value);
 
+/* Like pvm_make_string, but use VALUE as the contents of the string
+   instead of a copy of it.  VALUE shall have been allocated with
+   pvm_alloc_atomic.  */
+
+pvm_val pvm_make_string_nodup (char *value);
+
+/* Make an interned string PVM value.  Interned strings having the
+   same contents are the same PVM value, so they can be compared by
+   identity.  They are never collected, and they shall not be
+   modified.  This is intended for identifiers such as the names of
+   struct fields and methods.  */
+
+pvm_val pvm_make_string_atom (const char *value);
+
+/* Return whether the string STR is an interned string.  */
+
+int pvm_string_atom_p (pvm_val str);
+
+/* Make a string PVM value with the concatenation of the strings STR1
+   and STR2.  This takes constant time, unless the strings are short:
+   see the description of ropes in pvm-val.h.  */
+
+pvm_val pvm_make_string_concat (pvm_val str1, pvm_val str2);
+
+/* Return the length of the string STR, not counting the terminating
+   NUL character.  The length is cached in the string.  */
+
+size_t pvm_string_length (pvm_val str);
+
 /* Make an offset PVM value.
 
    MAGNITUDE is a PVM integral value.
@@ -233,6 +330,109 @@ pvm_val pvm_make_offset (pvm_val magnitude, pvm_val unit);
 
 pvm_val pvm_make_array (pvm_val nelem, pvm_val type);
 
+/* Make a lazily mapped array PVM value.
+
+   TYPE is a type PVM value specifying the type of the array.  The
+   type of the elements shall be integral.
+
+   NELEM is the number of elements in the array.
+
+   IOS is the id of the IO space where the elements are mapped, and
+   BOFFSET is the bit-offset of the first element.
+
+   ENDIAN and NENC are the endianness and negative encoding to use
+   when peeking the elements.
+
+   No element is read from IO at this point.  If the IO space doesn't
+   exist, if its contents may become unavailable later (like in
+   streams) or if any of the elements lays beyond the end of the IO
+   space, then return PVM_NULL.  */
+
+pvm_val pvm_make_lazy_array (pvm_val type, uint64_t nelem,
+                             int ios, uint64_t boffset,
+                             int endian, int nenc);
+
+/* Get in *VALUE the element occupying the position IDX in the packed
+   array ARR, peeking it from IO if the array is mapped lazily and the
+   element has not been accessed before.  IDX should be within the
+   boundaries of the array.
+
+   Return IOS_OK if the element was successfully obtained.
+   Otherwise, return an IOS error code.  */
+
+int pvm_array_packed_elem (pvm_val arr, uint64_t idx, pvm_val *value);
+
+/* Peek from IO all the elements of the lazily mapped array ARR not
+   accessed so far, and turn it into a non-lazy packed array.  If ARR
+   is not mapped lazily, do nothing.
+
+   Return IOS_OK if all the elements were successfully obtained.
+   Otherwise, return an IOS error code and leave ARR mapped lazily.  */
+
+int pvm_array_load (pvm_val arr);
+
+/* Like pvm_array_load, but for every lazily mapped array contained
+   in the value VAL, including VAL itself.  */
+
+int pvm_val_load (pvm_val val);
+
+/* Return a value of the integral or offset type TYPE, whose 64-bit
+   two's complement representation (or the one of its magnitude) is
+   given by the least significant bits of BITS.  */
+
+pvm_val pvm_make_integral_bits (uint64_t bits, pvm_val type);
+
+/* Return the integral value of type ITYPE corresponding to the
+   integral struct SCT, with every field placed at its offset in the
+   struct, the first field occupying the most significant bits.  */
+
+pvm_val pvm_integrate_struct (pvm_val sct, pvm_val itype);
+
+/* Peek from IO a value of the struct type TYPE located at the
+   bit-offset BOFFSET, and put it in *VALUE.  All the fields of TYPE
+   shall be integral or offset values whose sizes are multiples of 8
+   bits, stored one after the other with the given ENDIAN, starting
+   at BOFFSET.  The bytes of the struct are read from IO at once, and
+   the value is not mapped.
+
+   Return IOS_OK if the struct was successfully peeked.  Otherwise,
+   return an IOS error code.  */
+
+int pvm_peek_struct (ios io, ios_off boffset, pvm_val type,
+                     enum ios_endian endian, pvm_val *value);
+
+/* Return the value and the bit-offset, respectively, of the element
+   occupying the position IDX in the array ARR, which can be either
+   packed or not.  If the element of a lazily mapped array can't be
+   read from IO, the value returned is PVM_NULL; use
+   pvm_array_packed_elem to get the IOS error code.  IDX should be
+   within the boundaries of the array.  */
+
+pvm_val pvm_array_elem_value (pvm_val arr, uint64_t idx);
+pvm_val pvm_array_elem_offset (pvm_val arr, uint64_t idx);
+
+/* Turn the packed array ARR into a regular array, peeking from IO
+   all the elements not accessed so far if it is mapped lazily.
+   Elements that can't be read from IO are set to zero, so callers
+   that can report errors shall call pvm_array_load first.  If ARR is
+   not packed, do nothing.  */
+
+void pvm_array_materialize (pvm_val arr);
+
+/* Give the array ARR its own copy of its elements, if it shares them
+   with other arrays.  This shall be done before modifying the
+   elements of ARR in place.  */
+
+void pvm_array_unshare (pvm_val arr);
+
+/* Return a new unbounded array with the elements of ARR1 followed by
+   the elements of ARR2, which have the same type.  If possible, the
+   new array shares the elements of ARR1, so that appending elements
+   to an array repeatedly, like in `a += [x]', takes amortized
+   constant time.  */
+
+pvm_val pvm_array_concat (pvm_val arr1, pvm_val arr2);
+
 /* Make a struct PVM value.
 
    NFIELDS is an ulong<64> PVM value specifying the number of fields
@@ -248,6 +448,38 @@ pvm_val pvm_make_array (pvm_val nelem, pvm_val type);
 
 pvm_val pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type);
 
+/* Make a dict PVM value.
+
+   TYPE is a type PVM value specifying the type of the dict.
+
+   The created dict is empty.  */
+
+pvm_val pvm_make_dict (pvm_val type);
+
+/* Return the value associated with KEY in the dict DICT, or PVM_NULL
+   if the dict doesn't contain KEY.  Integral keys are compared by
+   value.  */
+
+pvm_val pvm_dict_get (pvm_val dict, pvm_val key);
+
+/* Associate the value VAL with KEY in the dict DICT, replacing the
+   value previously associated with KEY, if any.  KEY shall be of the
+   type of the keys of the dict.  */
+
+void pvm_dict_set (pvm_val dict, pvm_val key, pvm_val val);
+
+/* Remove the entry for KEY from the dict DICT.
+
+   If the dict doesn't contain KEY, return 0.  Otherwise return 1.  */
+
+int pvm_dict_rem (pvm_val dict, pvm_val key);
+
+/* Return an array with the keys, or the values, of the entries of the
+   dict DICT, in the order in which they were inserted.  */
+
+pvm_val pvm_dict_keys (pvm_val dict);
+pvm_val pvm_dict_values (pvm_val dict);
+
 /* Make a closure PVM value.
    PROGRAM is a PVM program that conforms the body of the closure.  */
 
@@ -259,6 +491,13 @@ pvm_val pvm_make_cls (pvm_program program);
 
 int pvm_val_equal_p (pvm_val val1, pvm_val val2);
 
+/* Return 1 if the arrays ARR1 and ARR2 have the same number of
+   elements, and their elements are equal as per the `==' operator of
+   Poke.  Otherwise return 0.  The elements shall be of the same
+   integral or string type.  */
+
+int pvm_array_equal_p (pvm_val arr1, pvm_val arr2);
+
 /*** PVM values.  ***/
 
 void pvm_print_string (pvm_val string);
@@ -277,6 +516,22 @@ int pvm_set_struct (pvm_val sct, pvm_val name, pvm_val val);
 
 pvm_val pvm_get_struct_method (pvm_val sct, const char *name);
 
+/* Return the result of the method NAME of the struct SCT cached for
+   the argument KEY, or PVM_NULL if there is no such result.  KEY is
+   PVM_NULL for methods taking no arguments.  */
+
+pvm_val pvm_struct_memo_get (pvm_val sct, pvm_val name, pvm_val key);
+
+/* Cache VAL as the result of the method NAME of the struct SCT for
+   the argument KEY.  */
+
+void pvm_struct_memo_set (pvm_val sct, pvm_val name, pvm_val key,
+                          pvm_val val);
+
+/* Discard the results cached for the methods of the struct SCT.  */
+
+void pvm_struct_memo_flush (pvm_val sct);
+
 pvm_val pvm_make_integral_type (pvm_val size, pvm_val signed_p);
 
 pvm_val pvm_make_string_type (void);
@@ -293,6 +548,7 @@ pvm_val pvm_make_struct_type (pvm_val nfields, pvm_val name,
 pvm_val pvm_make_offset_type (pvm_val base_type, pvm_val unit);
 pvm_val pvm_make_closure_type (pvm_val rtype, pvm_val nargs,
                                pvm_val *atypes);
+pvm_val pvm_make_dict_type (pvm_val ktype, pvm_val vtype);
 
 pvm_val pvm_dup_type (pvm_val type);
 
@@ -328,13 +584,70 @@ int pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val);
 
 int pvm_array_rem (pvm_val arr, pvm_val idx);
 
+/* Sort in ascending order the elements occupying the positions LEFT
+   to RIGHT, both included, in the array ARR.  Elements with equal
+   keys keep their relative order.
+
+   If BY is PVM_NULL then the elements are their own keys.  If BY is a
+   string then the elements are structs, and the keys are the values
+   of their fields named BY.  If BY is an array then it contains the
+   keys of the elements, the first one being the key of the element
+   at position LEFT.  Keys should be integers, or offsets with the
+   same unit, and all of them either signed or unsigned.
+
+   If the keys are not suitable for sorting, or LEFT and RIGHT are not
+   within the boundaries of the array, leave ARR untouched and return
+   0.  Otherwise return 1.  */
+
+int pvm_array_sort (pvm_val arr, pvm_val by,
+                    uint64_t left, uint64_t right);
+
+/* Reverse the order of the elements of the array ARR.  */
+
+void pvm_array_reverse (pvm_val arr);
+
+/* Return a string with the characters in the array ARR, whose
+   elements are uint<8> values, up to the first NUL character.  */
+
+pvm_val pvm_array_to_string (pvm_val arr);
+
+/* Set the elements of the array ARR, whose elements are uint<8>
+   values, to the characters of the string STR, and the remaining
+   elements, if any, to FILL.  If STR is longer than ARR leave ARR
+   untouched and return 0.  Otherwise return 1.  */
+
+int pvm_array_from_string (pvm_val arr, pvm_val str, uint8_t fill);
+
+/* Copy the elements occupying the positions IDX to IDX + COUNT - 1 of
+   the array ARR, whose elements are integral, to BUF, as 64-bit
+   two's complement integers.  If the elements are not integral, or
+   the positions are not within the boundaries of the array, return
+   0.  Otherwise return 1.  */
+
+int pvm_array_get_integrals (pvm_val arr, uint64_t idx, uint64_t count,
+                             uint64_t *buf);
+
+/* Set the elements occupying the positions IDX to IDX + COUNT - 1 of
+   the array ARR, whose elements are integral, to the values in BUF,
+   truncated to the size of the elements.  Return like
+   pvm_array_get_integrals.  */
+
+int pvm_array_set_integrals (pvm_val arr, uint64_t idx, uint64_t count,
+                             const uint64_t *buf);
+
+/* If the array ARR is packed, return its buffer and put the size of
+   its elements, in bytes, in *WIDTH.  Otherwise return NULL.  See
+   struct pvm_array_packed in pvm-val.h.  */
+
+void *pvm_array_packed_data (pvm_val arr, int *width);
+
 /* Return the size of VAL, in bits.  */
 
 uint64_t pvm_sizeof (pvm_val val);
 
 /* For strings, arrays and structs, return the number of
-   elements/fields stored, as an unsigned 64-bits long.  Return 1
-   otherwise.  */
+   elements/fields stored, as an unsigned 64-bits long.  For dicts,
+   return the number of entries.  Return 1 otherwise.  */
 
 pvm_val pvm_elemsof (pvm_val val);
 
@@ -345,6 +658,32 @@ pvm_val pvm_val_mapper (pvm_val val);
 
 pvm_val pvm_val_writer (pvm_val val);
 
+/* Return 1 if the given mapped value is up to date, i.e. if the IO
+   space where it is mapped has not been written in the range of the
+   value since the value was mapped.  Return 0 otherwise, including
+   when the value is not mapped.  */
+
+int pvm_val_fresh_p (pvm_val val);
+
+/* Return 1 if the layout of the given mapped value may depend on data
+   past its own range, i.e. if it is an array mapped without bounds,
+   which extends until the end of the IO space or until an element
+   that doesn't satisfy its constraints, or if it contains such a
+   value.  Return 0 otherwise.
+
+   Such values are never considered up to date by pvm_val_fresh_p,
+   since writing just past them, or growing the IO space, can change
+   them.  */
+
+int pvm_val_unbounded_p (pvm_val val);
+
+/* Return an array with the ranges written in the IO space IO, as
+   returned by ios_map_dirty.  The elements of the array are arrays
+   of two uint<64> values, the byte offset and the size of each
+   range.  */
+
+pvm_val pvm_ios_dirty_ranges (ios io);
+
 /* Relocate the given value to the given bit-offset.  If the value is
    not map-able then this is a no-operation.  */
 
@@ -364,6 +703,10 @@ void pvm_val_unmap (pvm_val val);
 
 pvm_val pvm_make_exception (int code, char *message, int exit_status);
 
+/* Return whether VAL is an exception built by `pvm_make_exception'.  */
+
+int pvm_exception_p (pvm_val val);
+
 
 /* **************** The Run-Time Environment ****************  */
 
@@ -548,7 +891,11 @@ enum pvm_exit_code
 
 typedef struct pvm *pvm;
 
-/* Initialize a new Poke Virtual Machine and return it.  */
+/* Initialize a new Poke Virtual Machine and return it.
+
+   Several virtual machines can exist at the same time, and be run
+   concurrently in different threads.  A given virtual machine shall
+   be run by one thread at a time.  */
 
 pvm pvm_init (void);
 
@@ -560,15 +907,78 @@ void pvm_shutdown (pvm pvm);
 
 pvm_env pvm_get_env (pvm pvm);
 
+/* Return the name of the dispatch model the PVM has been built with:
+   "switch", "direct-threading", "minimal-threading" or
+   "no-threading".  The latter generates native code.  */
+
+const char *pvm_dispatch_name (void);
+
 /* Print a profiling summary corresponding to the currrent state of
    the PVM.  */
 
 void pvm_print_profile (pvm pvm);
 
-/* Reset profiling counters in the given PVM.  */
+/* Reset profiling counters in the given PVM, including the ones of
+   the function profiler.  */
 
 void pvm_reset_profile (pvm pvm);
 
+/* Enable or disable the function profiler of PVM, which counts the
+   calls to every function and the time spent in it, for every
+   calling context.  It is disabled by default.  Disabling the
+   profiler keeps the data collected so far.  */
+
+void pvm_set_profile_functions (pvm pvm, int profile_p);
+
+/* Cooperative preemption.
+
+   The programs executed by a PVM reach a safepoint, which is a
+   `sync' instruction, at every backwards jump.  The
+   execution budget of the PVM is the number of safepoints the
+   programs can reach before FN is called with DATA.  If FN returns
+   zero, or if it is NULL, the execution is interrupted by raising
+   PVM_E_SIGNAL.  Otherwise the budget is renewed, and the execution
+   continues.  Every run of the PVM starts with a full budget.
+
+   A BUDGET of zero, which is the default, means no budget.  */
+
+typedef int (*pvm_budget_fn) (void *data);
+
+void pvm_set_budget (pvm pvm, uint64_t budget, pvm_budget_fn fn, void *data);
+
+/* Handle the exhaustion of the execution budget of PVM, as explained
+   above.  Return 1 if the execution shall continue, 0 otherwise.
+   This is used in pvm.jitter.  */
+
+int pvm_budget_expired (pvm pvm);
+
+/* Interrupt the program being executed by PVM at the next safepoint
+   by raising PVM_E_SIGNAL, as if SIGINT was received.  If PVM is not
+   running, the interruption happens in the next run.  This can be
+   called from any thread, or from the budget function.  */
+
+void pvm_interrupt (pvm pvm);
+
+int pvm_profile_functions_p (pvm pvm);
+
+/* Print the data collected by the function profiler of PVM.  If
+   FOLDED_P is set, print one line per calling stack, with the names
+   of the functions separated by semicolons followed by the time
+   spent in the innermost function, in microseconds.  This is the
+   format expected by flame graph generators.  Otherwise print a
+   table with the calls and time spent in every function.  */
+
+void pvm_print_function_profile (pvm pvm, int folded_p);
+
+/* Notify the function profiler of PVM that PROGRAM is being called,
+   or that the current function is returning.  HEIGHT is the height
+   of the return stack before the call, and after the return.  These
+   are used by the call and return instructions.  */
+
+void pvm_profile_enter (pvm pvm, pvm_program program, uintptr_t height);
+
+void pvm_profile_leave (pvm pvm, uintptr_t height);
+
 /* Run a PVM program in a virtual machine.
 
    If the execution of PROGRAM generates a result value, it is put in
@@ -589,6 +999,24 @@ enum pvm_exit_code pvm_run (pvm vm,
 
 void pvm_call_closure (pvm vm, pvm_val cls, ...);
 
+/* Given a PVM and a closure value, call the closure passing it the
+   NARGS values in ARGS as arguments.
+
+   If RET is not NULL, the value returned by the closure, if any, is
+   stored in *RET.
+
+   Closures taking a few arguments are called through a trampoline
+   built once per number of arguments, so no code is generated by
+   repeated calls.
+
+   This function returns the exit code of the execution, like
+   pvm_run.  */
+
+enum pvm_exit_code pvm_call_closure_args (pvm vm, pvm_val cls,
+                                          size_t nargs,
+                                          const pvm_val *args,
+                                          pvm_val *ret);
+
 /* Get/set the current byte endianness of a virtual machine.
 
    The current endianness is used by certain VM instructions that
@@ -679,16 +1107,75 @@ pkl_compiler pvm_compiler (pvm vm);
 
 void pvm_set_compiler (pvm vm, pkl_compiler compiler);
 
+/* Return the IO context holding the IO spaces of the given virtual
+   machine.  It is created by pvm_init and freed, closing all its IO
+   spaces, by pvm_shutdown.  The IO context must be made current in
+   the running thread before executing programs in VM.  */
+
+ios_context pvm_ios_context (pvm vm);
+
+/* Worker PVMs.
+
+   A worker is a PVM created from another PVM, that shares its
+   compiler and its global environment, but has its own stacks and
+   registers, so it can run programs in a different thread.  The
+   output parameters of the worker are copied from VM.
+
+   If SHARE_IOS_P is set then the worker operates the IO spaces of
+   VM.  Otherwise the worker gets an IO context of its own, which is
+   freed along with the worker.  Return NULL if there is not enough
+   memory.  */
+
+pvm pvm_worker_new (pvm vm, int share_ios_p);
+
+void pvm_worker_free (pvm worker);
+
+/* Build an executable program that calls the closure CLS with the
+   argument passed to pvm_apply.  The program can be run by several
+   workers at the same time, and must be destroyed with
+   pvm_destroy_program.  */
+
+pvm_program pvm_make_apply_program (pvm vm, pvm_val cls);
+
+/* Run PROGRAM, as returned by pvm_make_apply_program, in the worker
+   WORKER, passing ARG to the closure.  If the closure returns, set
+   *RES to the returned value, if any, and return PVM_EXIT_OK.  If it
+   raises an exception, set *RES to the exception and return
+   PVM_EXIT_ERROR.  */
+
+enum pvm_exit_code pvm_apply (pvm worker, pvm_program program,
+                              pvm_val arg, pvm_val *res);
+
+/* Call the closure CLS for every index in [0,NELEM), passing the
+   index as an ulong<64>, using NTHREADS threads running in parallel.
+   If NTHREADS is 0 then use as many threads as online processors.
+
+   Every thread runs the closure in a worker PVM of its own, which
+   shares the IO context and the global environment of VM, and gets
+   a consecutive chunk of the indexes.  The IO context is shared
+   while the workers run.
+
+   If all the calls succeed, set *RESULT to an array of type any[]
+   holding the values returned by the calls, in index order, and
+   return 1.  Otherwise set *RESULT to the exception raised by the
+   call with the lowest index and return 0.  */
+
+int pvm_pmap (pvm vm, pvm_val cls, uint64_t nelem, unsigned int nthreads,
+              pvm_val *result);
+
 /* The following function is to be used in pvm.jitter, because the
    system `assert' may expand to a macro and is therefore
    non-wrappeable.  */
 
 void pvm_assert (int expression);
 
-/* This is defined in the late-c block in pvm.jitter.  */
+/* These are defined in the late-c block in pvm.jitter.  */
 
 void pvm_handle_signal (int signal_number);
 
+struct pvm_state;
+void pvm_interrupt_state (struct pvm_state *state);
+
 /* Call the pretty printer of the given value VAL.  */
 
 int pvm_call_pretty_printer (pvm vm, pvm_val val);
@@ -720,10 +1207,15 @@ int pvm_call_pretty_printer (pvm vm, pvm_val val);
    exactly the same way than non-mapped values.
 
    If PVM_PRINT_F_PPRINT is specified then pretty-printers are used to
-   print struct values, if they are defined.  */
+   print struct values, if they are defined.
+
+   If PVM_PRINT_F_PRINTF is specified then values are printed the way
+   the %v directive of printf prints them, which differs in the
+   formatting of integers, strings and offsets of mapped values.  */
 
 #define PVM_PRINT_F_MAPS   1
 #define PVM_PRINT_F_PPRINT 2
+#define PVM_PRINT_F_PRINTF 4
 
 void pvm_print_val (pvm vm, pvm_val val);
 
@@ -732,4 +1224,30 @@ void pvm_print_val_with_params (pvm vm, pvm_val val,
                                 int indent, int acutoff,
                                 uint32_t flags);
 
+/* Print a PVM value like the %v directive of printf does, as if it
+   were nested NDEPTH levels into some other value being printed,
+   using the output parameters of the VM.  Pretty-printers are never
+   used.  */
+
+void pvm_print_val_at_depth (pvm vm, pvm_val val, int ndepth);
+
+/* Print an hexadecimal dump of the bytes of the IO space IO located
+   from the byte offset FROM up to, and not including, the byte offset
+   TOP.  Sixteen bytes are printed per line, prefixed by their
+   address.
+
+   The bytes are printed in groups of GROUP_BY bytes, separated by a
+   space.  An additional space is printed after every CLUSTER_BY
+   groups.  If ASCII is not zero, the printable bytes are also
+   printed as ASCII characters at the right of the line, using the
+   character NONPRINTABLE for bytes that are not printable.
+
+   The dump stops at the end of the IO space.  Return IOS_OK if the
+   whole range was dumped, IOS_EIOFF if the end of the IO space was
+   reached before TOP, or another IOS error code.  */
+
+int pvm_print_dump (ios io, uint64_t from, uint64_t top,
+                    uint64_t group_by, uint64_t cluster_by,
+                    int ascii, char nonprintable);
+
 #endif /* ! PVM_H */
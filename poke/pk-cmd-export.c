@@ -0,0 +1,410 @@
+/* pk-cmd-export.c - Commands for exporting values to files.  */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <readline.h> /* For rl_filename_completion_function */
+#include "xalloc.h"
+
+#include "poke.h"
+#include "pk-cmd.h"
+#include "pk-utils.h"
+
+/* The export command writes the elements of an array to a file, one
+   element per line, either in CSV (RFC 4180) or in JSON Lines
+   format.  The elements are converted and written one at a time, so
+   no representation of the whole array is ever built in memory.
+
+   In CSV the columns are derived from the type of the elements of
+   the array.  Fields of struct type are flattened into several
+   columns, named after the path to them, like `hdr.e_type'.  Values
+   that can't be flattened, like arrays, are stored in the cells in
+   JSON.  */
+
+#define PK_EXPORT_UFLAGS "cj"
+#define PK_EXPORT_F_CSV 0x1
+#define PK_EXPORT_F_JSON 0x2
+
+/* Output stream used by the exporters.  If QUOTE_P is set, double
+   quotes are doubled as they are written, which is how JSON text is
+   embedded in CSV cells.  */
+
+struct export_out
+{
+  FILE *fp;
+  int quote_p;
+};
+
+static void
+export_putc (struct export_out *out, int c)
+{
+  if (out->quote_p && c == '"')
+    putc ('"', out->fp);
+  putc (c, out->fp);
+}
+
+static void
+export_puts (struct export_out *out, const char *str)
+{
+  if (!out->quote_p)
+    fputs (str, out->fp);
+  else
+    for (; *str; str++)
+      export_putc (out, *str);
+}
+
+/* Return the value of the field named NAME in the struct SCT, or
+   PK_NULL if the struct doesn't have such a field.  The fields of a
+   struct value usually match the fields of its type, so IDX is tried
+   first.  */
+
+static pk_val
+export_sct_field (pk_val sct, uint64_t idx, const char *name)
+{
+  uint64_t i, nfields = pk_uint_value (pk_struct_nfields (sct));
+  pk_val fname = pk_struct_field_name (sct, idx);
+
+  if (fname != PK_NULL && STREQ (pk_string_str (fname), name))
+    return pk_struct_field_value (sct, idx);
+
+  for (i = 0; i < nfields; ++i)
+    {
+      fname = pk_struct_field_name (sct, i);
+      if (fname != PK_NULL && STREQ (pk_string_str (fname), name))
+        return pk_struct_field_value (sct, i);
+    }
+
+  return PK_NULL;
+}
+
+static void
+export_json_string (struct export_out *out, const char *str)
+{
+  char buf[8];
+
+  export_putc (out, '"');
+  for (; *str; str++)
+    {
+      unsigned char c = *str;
+
+      switch (c)
+        {
+        case '"': export_puts (out, "\\\""); break;
+        case '\\': export_puts (out, "\\\\"); break;
+        case '\n': export_puts (out, "\\n"); break;
+        case '\t': export_puts (out, "\\t"); break;
+        case '\r': export_puts (out, "\\r"); break;
+        default:
+          if (c < 0x20)
+            {
+              snprintf (buf, sizeof (buf), "\\u%04x", c);
+              export_puts (out, buf);
+            }
+          else
+            export_putc (out, c);
+          break;
+        }
+    }
+  export_putc (out, '"');
+}
+
+/* Write the given integral value, or the magnitude of the given
+   offset value, in decimal.  */
+
+static void
+export_number (struct export_out *out, pk_val val)
+{
+  char buf[32];
+
+  switch (pk_type_code (pk_typeof (val)))
+    {
+    case PK_INT:
+      snprintf (buf, sizeof (buf), "%" PRIi64, pk_int_value (val));
+      break;
+    case PK_UINT:
+      snprintf (buf, sizeof (buf), "%" PRIu64, pk_uint_value (val));
+      break;
+    case PK_OFFSET:
+      export_number (out, pk_offset_magnitude (val));
+      return;
+    default:
+      assert (0);
+    }
+
+  export_puts (out, buf);
+}
+
+static void
+export_json_val (struct export_out *out, pk_val val)
+{
+  uint64_t i, n;
+  int first;
+
+  if (val == PK_NULL)
+    {
+      export_puts (out, "null");
+      return;
+    }
+
+  switch (pk_type_code (pk_typeof (val)))
+    {
+    case PK_INT:
+    case PK_UINT:
+    case PK_OFFSET:
+      export_number (out, val);
+      break;
+    case PK_STRING:
+      export_json_string (out, pk_string_str (val));
+      break;
+    case PK_ARRAY:
+      n = pk_uint_value (pk_array_nelem (val));
+      export_putc (out, '[');
+      for (i = 0; i < n; ++i)
+        {
+          if (i > 0)
+            export_putc (out, ',');
+          export_json_val (out, pk_array_elem_val (val, i));
+        }
+      export_putc (out, ']');
+      break;
+    case PK_STRUCT:
+      /* Anonymous and absent fields are not exported.  */
+      n = pk_uint_value (pk_struct_nfields (val));
+      export_putc (out, '{');
+      for (first = 1, i = 0; i < n; ++i)
+        {
+          pk_val fname = pk_struct_field_name (val, i);
+          pk_val fvalue = pk_struct_field_value (val, i);
+
+          if (fname == PK_NULL || fvalue == PK_NULL)
+            continue;
+
+          if (!first)
+            export_putc (out, ',');
+          export_json_string (out, pk_string_str (fname));
+          export_putc (out, ':');
+          export_json_val (out, fvalue);
+          first = 0;
+        }
+      export_putc (out, '}');
+      break;
+    default:
+      export_puts (out, "null");
+      break;
+    }
+}
+
+static void
+export_csv_string (struct export_out *out, const char *str)
+{
+  if (strpbrk (str, ",\"\r\n") == NULL)
+    export_puts (out, str);
+  else
+    {
+      out->quote_p = 1;
+      export_putc (out, '"');
+      export_puts (out, str);
+      out->quote_p = 0;
+      putc ('"', out->fp);
+    }
+}
+
+/* Write the names of the columns corresponding to values of the given
+   TYPE, whose path is PREFIX.  */
+
+static void
+export_csv_header (struct export_out *out, pk_val type,
+                   const char *prefix, int *first)
+{
+  uint64_t i, n;
+
+  if (pk_type_code (type) != PK_STRUCT)
+    {
+      if (!*first)
+        putc (',', out->fp);
+      export_csv_string (out, prefix);
+      *first = 0;
+      return;
+    }
+
+  n = pk_uint_value (pk_struct_type_nfields (type));
+  for (i = 0; i < n; ++i)
+    {
+      pk_val fname = pk_struct_type_fname (type, i);
+      char *path;
+
+      if (fname == PK_NULL)
+        continue;
+
+      if (*prefix == '\0')
+        path = xstrdup (pk_string_str (fname));
+      else if (asprintf (&path, "%s.%s",
+                         prefix, pk_string_str (fname)) == -1)
+        pk_fatal (_("out of memory"));
+
+      export_csv_header (out, pk_struct_type_ftype (type, i), path, first);
+      free (path);
+    }
+}
+
+/* Write the cells corresponding to the value VAL of the given TYPE.
+   VAL is PK_NULL for absent fields, and then all the cells are left
+   empty.  */
+
+static void
+export_csv_cells (struct export_out *out, pk_val type, pk_val val,
+                  int *first)
+{
+  uint64_t i, n;
+
+  if (pk_type_code (type) == PK_STRUCT)
+    {
+      n = pk_uint_value (pk_struct_type_nfields (type));
+      for (i = 0; i < n; ++i)
+        {
+          pk_val fname = pk_struct_type_fname (type, i);
+          pk_val fvalue = PK_NULL;
+
+          if (fname == PK_NULL)
+            continue;
+
+          if (val != PK_NULL)
+            fvalue = export_sct_field (val, i, pk_string_str (fname));
+          export_csv_cells (out, pk_struct_type_ftype (type, i), fvalue,
+                            first);
+        }
+      return;
+    }
+
+  if (!*first)
+    putc (',', out->fp);
+  *first = 0;
+
+  if (val == PK_NULL)
+    return;
+
+  switch (pk_type_code (pk_typeof (val)))
+    {
+    case PK_INT:
+    case PK_UINT:
+    case PK_OFFSET:
+      export_number (out, val);
+      break;
+    case PK_STRING:
+      export_csv_string (out, pk_string_str (val));
+      break;
+    case PK_ARRAY:
+    case PK_STRUCT:
+      out->quote_p = 1;
+      export_putc (out, '"');
+      export_json_val (out, val);
+      out->quote_p = 0;
+      putc ('"', out->fp);
+      break;
+    default:
+      break;
+    }
+}
+
+static int
+pk_cmd_export (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* export[/cj] FILE, EXP */
+
+  const char *filename, *expr;
+  struct export_out out;
+  pk_val val, etype;
+  uint64_t i, nelem;
+  int first;
+
+  assert (argc == 2);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
+  assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_STR);
+
+  filename = PK_CMD_ARG_STR (argv[0]);
+  expr = PK_CMD_ARG_STR (argv[1]);
+
+  if ((uflags & PK_EXPORT_F_CSV) && (uflags & PK_EXPORT_F_JSON))
+    {
+      pk_printf (_("Only one output format can be specified\n"));
+      return 0;
+    }
+
+  if (pk_compile_expression (poke_compiler, expr, NULL, &val) != PK_OK)
+    return 0;
+
+  if (val == PK_NULL || pk_type_code (pk_typeof (val)) != PK_ARRAY)
+    {
+      pk_printf (_("Only arrays can be exported\n"));
+      return 0;
+    }
+
+  out.quote_p = 0;
+  out.fp = fopen (filename, "w");
+  if (out.fp == NULL)
+    {
+      pk_printf (_("Error opening `%s': %s\n"), filename, strerror (errno));
+      return 0;
+    }
+
+  nelem = pk_uint_value (pk_array_nelem (val));
+  etype = pk_array_type_etype (pk_typeof (val));
+
+  if (uflags & PK_EXPORT_F_JSON)
+    for (i = 0; i < nelem; ++i)
+      {
+        export_json_val (&out, pk_array_elem_val (val, i));
+        putc ('\n', out.fp);
+      }
+  else
+    {
+      first = 1;
+      export_csv_header (&out, etype,
+                         pk_type_code (etype) == PK_STRUCT ? "" : "value",
+                         &first);
+      fputs ("\r\n", out.fp);
+
+      for (i = 0; i < nelem; ++i)
+        {
+          first = 1;
+          export_csv_cells (&out, etype, pk_array_elem_val (val, i), &first);
+          fputs ("\r\n", out.fp);
+        }
+    }
+
+  if (ferror (out.fp) | (fclose (out.fp) != 0))
+    {
+      pk_printf (_("Error writing `%s'\n"), filename);
+      return 0;
+    }
+
+  return 1;
+}
+
+const struct pk_cmd export_cmd =
+  {"export", "s,s", PK_EXPORT_UFLAGS, 0, NULL, pk_cmd_export,
+   "export[/cj] FILE, EXP\n\
+Write the elements of the array EXP to FILE, one per line.\n\
+Flags:\n\
+  c (write CSV, the default)\n\
+  j (write JSON Lines)", rl_filename_completion_function};
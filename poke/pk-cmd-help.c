@@ -34,6 +34,10 @@ pk_cmd_help (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
   topic = pk_make_string (PK_CMD_ARG_STR (argv[0]));
 
+  /* The help topics of the commands are registered by their
+     modules.  */
+  pk_cmd_autoload_all ();
+
   pk_help = pk_decl_val (poke_compiler, "pk_help");
   assert (pk_help != PK_NULL);
   if (pk_call (poke_compiler, pk_help, &ret, topic, PK_NULL) == PK_ERROR)
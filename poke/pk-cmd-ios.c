@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <readline.h>
 #include "xalloc.h"
 
@@ -200,6 +201,54 @@ print_info_ios (pk_ios io, void *data)
   pk_table_column (table, pk_ios_handler (io));
 }
 
+static void
+print_info_ios_buffer (pk_ios io, void *data)
+{
+  uint64_t chunk_size, nchunks, max_nchunks;
+
+  if (pk_ios_buffer_stats (io, &chunk_size, &nchunks,
+                           &max_nchunks) != PK_OK)
+    return;
+
+  pk_printf (_("#%d: buffer of %" PRIu64 " chunks of %" PRIu64 "#B"
+               " (at most %" PRIu64 " chunks so far)\n"),
+             pk_ios_get_id (io), nchunks, chunk_size, max_nchunks);
+}
+
+static void
+print_info_ios_cache (pk_ios io, void *data)
+{
+  uint64_t hits, misses;
+
+  if (pk_ios_cache_stats (io, &hits, &misses) != PK_OK
+      || hits + misses == 0)
+    return;
+
+  pk_printf (_("#%d: cache hits %" PRIu64 ", misses %" PRIu64 "\n"),
+             pk_ios_get_id (io), hits, misses);
+}
+
+static void
+print_info_ios_stats (pk_ios io, void *data)
+{
+  struct pk_ios_stats stats;
+
+  pk_ios_stats (io, &stats);
+  if (stats.reads + stats.writes == 0)
+    return;
+
+  pk_printf (_("#%d: %" PRIu64 " reads of %" PRIu64 "#B,"
+               " %" PRIu64 " writes of %" PRIu64 "#B\n"),
+             pk_ios_get_id (io), stats.reads, stats.read_bytes,
+             stats.writes, stats.written_bytes);
+  pk_printf (_("#%d: device: %" PRIu64 " reads of %" PRIu64 "#B,"
+               " %" PRIu64 " writes of %" PRIu64 "#B,"
+               " %" PRIu64 " seeks, %.3f ms\n"),
+             pk_ios_get_id (io), stats.dev_reads, stats.dev_read_bytes,
+             stats.dev_writes, stats.dev_written_bytes, stats.dev_seeks,
+             stats.dev_nsecs / 1e6);
+}
+
 static int
 pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
@@ -219,6 +268,15 @@ pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 
   pk_table_print (table);
   pk_table_free (table);
+
+  /* Statistics of the IO spaces whose devices buffer data.  */
+  pk_ios_map (poke_compiler, print_info_ios_buffer, NULL);
+
+  /* Statistics of the page caches of the IO spaces.  */
+  pk_ios_map (poke_compiler, print_info_ios_cache, NULL);
+
+  /* Statistics of the accesses to the IO spaces.  */
+  pk_ios_map (poke_compiler, print_info_ios_stats, NULL);
   return 1;
 }
 
@@ -252,6 +310,7 @@ pk_cmd_load_file (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   else
     goto no_file;
 
+  pk_cmd_autoload_file (filename);
   if (pk_compile_file (poke_compiler, filename, NULL /* exit_status */)
       != PK_OK)
     /* Note that the compiler emits its own error messages.  */
@@ -171,7 +171,7 @@ pk_cmd_map_show (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   {
     pk_map_entry entry;
 
-    for (entry = PK_MAP_ENTRIES (map);
+    for (entry = pk_map_entries (map);
          entry;
          entry = PK_MAP_ENTRY_CHAIN (entry))
       {
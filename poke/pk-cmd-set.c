@@ -21,6 +21,9 @@
 #include <string.h>
 #include <arpa/inet.h> /* For htonl */
 #include <stdlib.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <readline.h> /* For rl_filename_completion_function */
 #include "xalloc.h"
 
 #include "poke.h"
@@ -557,6 +560,211 @@ pk_cmd_set_doc_viewer (int argc, struct pk_cmd_arg argv[],
   return 1;
 }
 
+static int
+pk_cmd_set_ios_cache_size (int argc, struct pk_cmd_arg argv[],
+                           uint64_t uflags)
+{
+  /* set ios-cache-size [SIZE]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%" PRIu64 "\n", pk_ios_cache_size (poke_compiler));
+  else
+    {
+      int64_t size = PK_CMD_ARG_INT (argv[0]);
+
+      if (size < 0)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" cache size should be a positive number of bytes.\n"));
+          return 0;
+        }
+
+      pk_set_ios_cache_size (poke_compiler, size);
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_set_ios_cache_page_size (int argc, struct pk_cmd_arg argv[],
+                                uint64_t uflags)
+{
+  /* set ios-cache-page-size [SIZE]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%" PRIu64 "\n", pk_ios_cache_page_size (poke_compiler));
+  else
+    {
+      int64_t size = PK_CMD_ARG_INT (argv[0]);
+
+      if (size < 0
+          || pk_set_ios_cache_page_size (poke_compiler, size) != PK_OK)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" page size should be a power of two between 512 and 1048576.\n"));
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+/* Name of the file where the accesses to the IO spaces are being
+   logged, or NULL.  */
+
+static char *poke_ios_trace_file;
+
+static int
+pk_cmd_set_ios_trace (int argc, struct pk_cmd_arg argv[],
+                      uint64_t uflags)
+{
+  /* set ios-trace [FILE-NAME|no]  */
+
+  const char *arg;
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    {
+      pk_printf ("%s\n", poke_ios_trace_file ? poke_ios_trace_file : "no");
+      return 1;
+    }
+
+  arg = PK_CMD_ARG_STR (argv[0]);
+  if (STREQ (arg, "no"))
+    arg = NULL;
+
+  if (pk_ios_set_trace (poke_compiler, arg) != PK_OK)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_printf (_("couldn't open %s for writing.\n"), arg);
+      return 0;
+    }
+
+  free (poke_ios_trace_file);
+  poke_ios_trace_file = arg ? xstrdup (arg) : NULL;
+  return 1;
+}
+
+static int
+pk_cmd_set_gc_incremental (int argc, struct pk_cmd_arg argv[],
+                           uint64_t uflags)
+{
+  /* set gc-incremental {yes,no}  */
+
+  const char *arg;
+
+  /* See comment in pk_cmd_set_pretty_print.  */
+
+  if (argc != 1)
+    assert (0);
+
+  arg = PK_CMD_ARG_STR (argv[0]);
+
+  if (*arg == '\0')
+    {
+      if (pk_gc_incremental (poke_compiler))
+        pk_puts ("yes\n");
+      else
+        pk_puts ("no\n");
+    }
+  else
+    {
+      int incremental_p;
+
+      if (STREQ (arg, "yes"))
+        incremental_p = 1;
+      else if (STREQ (arg, "no"))
+        incremental_p = 0;
+      else
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (" gc-incremental should be one of `yes' or `no'.\n");
+          return 0;
+        }
+
+      if (pk_set_gc_incremental (poke_compiler, incremental_p) != PK_OK)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" incremental collection can't be disabled once enabled.\n"));
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_set_gc_free_space_divisor (int argc, struct pk_cmd_arg argv[],
+                                  uint64_t uflags)
+{
+  /* set gc-free-space-divisor [DIVISOR]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%" PRIu64 "\n", pk_gc_free_space_divisor (poke_compiler));
+  else
+    {
+      int64_t divisor = PK_CMD_ARG_INT (argv[0]);
+
+      if (divisor <= 0
+          || pk_set_gc_free_space_divisor (poke_compiler,
+                                           divisor) != PK_OK)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" free space divisor should be a positive number.\n"));
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_set_inline_threshold (int argc, struct pk_cmd_arg argv[],
+                             uint64_t uflags)
+{
+  /* set inline-threshold [NODES]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%d\n", pk_inline_threshold (poke_compiler));
+  else
+    {
+      int64_t threshold = PK_CMD_ARG_INT (argv[0]);
+
+      if (threshold < 0 || threshold > INT_MAX
+          || pk_set_inline_threshold (poke_compiler, threshold) != PK_OK)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" inline threshold should be zero or a positive number.\n"));
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
 extern struct pk_cmd null_cmd; /* pk-cmd.c  */
 
 const struct pk_cmd set_oacutoff_cmd =
@@ -603,6 +811,31 @@ const struct pk_cmd set_prompt_maps =
   {"prompt-maps", "s?", "", 0, NULL, pk_cmd_set_prompt_maps,
    "set prompt-maps (yes|no)", NULL};
 
+const struct pk_cmd set_ios_cache_size_cmd =
+  {"ios-cache-size", "?i", "", 0, NULL, pk_cmd_set_ios_cache_size,
+   "set ios-cache-size [SIZE]", NULL};
+
+const struct pk_cmd set_ios_cache_page_size_cmd =
+  {"ios-cache-page-size", "?i", "", 0, NULL, pk_cmd_set_ios_cache_page_size,
+   "set ios-cache-page-size [SIZE]", NULL};
+
+const struct pk_cmd set_ios_trace_cmd =
+  {"ios-trace", "?f", "", 0, NULL, pk_cmd_set_ios_trace,
+   "set ios-trace [FILE-NAME|no]", rl_filename_completion_function};
+
+const struct pk_cmd set_gc_incremental_cmd =
+  {"gc-incremental", "s?", "", 0, NULL, pk_cmd_set_gc_incremental,
+   "set gc-incremental (yes|no)", NULL};
+
+const struct pk_cmd set_gc_free_space_divisor_cmd =
+  {"gc-free-space-divisor", "?i", "", 0, NULL,
+   pk_cmd_set_gc_free_space_divisor,
+   "set gc-free-space-divisor [DIVISOR]", NULL};
+
+const struct pk_cmd set_inline_threshold_cmd =
+  {"inline-threshold", "?i", "", 0, NULL, pk_cmd_set_inline_threshold,
+   "set inline-threshold [NODES]", NULL};
+
 const struct pk_cmd *set_cmds[] =
   {
    &set_oacutoff_cmd,
@@ -618,6 +851,12 @@ const struct pk_cmd *set_cmds[] =
    &set_doc_viewer,
    &set_auto_map,
    &set_prompt_maps,
+   &set_ios_cache_size_cmd,
+   &set_ios_cache_page_size_cmd,
+   &set_ios_trace_cmd,
+   &set_gc_incremental_cmd,
+   &set_gc_free_space_divisor_cmd,
+   &set_inline_threshold_cmd,
    &null_cmd
   };
 
@@ -18,12 +18,14 @@
 
 #include <config.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "poke.h"
 #include "pk-cmd.h"
 
-#define PK_VM_DIS_UFLAGS "n"
+#define PK_VM_DIS_UFLAGS "nu"
 #define PK_VM_DIS_F_NAT 0x1
+#define PK_VM_DIS_F_UNOPT 0x2
 
 static int
 pk_cmd_vm_disas_exp (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
@@ -37,8 +39,19 @@ pk_cmd_vm_disas_exp (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
 
   expr = PK_CMD_ARG_STR (argv[0]);
-  ret = pk_disassemble_expression (poke_compiler, expr,
-                                   uflags & PK_VM_DIS_F_NAT);
+  pk_cmd_autoload (expr);
+  if (uflags & PK_VM_DIS_F_UNOPT)
+    {
+      int peephole_p = pk_peephole_p (poke_compiler);
+
+      pk_set_peephole_p (poke_compiler, 0);
+      ret = pk_disassemble_expression (poke_compiler, expr,
+                                       uflags & PK_VM_DIS_F_NAT);
+      pk_set_peephole_p (poke_compiler, peephole_p);
+    }
+  else
+    ret = pk_disassemble_expression (poke_compiler, expr,
+                                     uflags & PK_VM_DIS_F_NAT);
 
   if (ret == PK_ERROR)
     {
@@ -64,7 +77,17 @@ pk_cmd_vm_disas_fun (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
 
   expr = PK_CMD_ARG_STR (argv[0]);
-  ret = pk_compile_expression (poke_compiler, expr, NULL, &cls);
+  pk_cmd_autoload (expr);
+  if (uflags & PK_VM_DIS_F_UNOPT)
+    {
+      int peephole_p = pk_peephole_p (poke_compiler);
+
+      pk_set_peephole_p (poke_compiler, 0);
+      ret = pk_compile_expression (poke_compiler, expr, NULL, &cls);
+      pk_set_peephole_p (poke_compiler, peephole_p);
+    }
+  else
+    ret = pk_compile_expression (poke_compiler, expr, NULL, &cls);
 
   if (ret != PK_OK)
     /* The compiler has already printed diagnostics in the
@@ -85,10 +108,31 @@ pk_cmd_vm_disas_fun (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+#define PK_VM_PROFILE_SHOW_UFLAGS "f"
+#define PK_VM_PROFILE_SHOW_F_FOLDED 0x1
+
 static int
 pk_cmd_vm_profile_show (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
+  struct pk_gc_stats stats;
+
+  /* The folded format is meant to be processed by other programs, so
+     print nothing else.  */
+  if (uflags & PK_VM_PROFILE_SHOW_F_FOLDED)
+    {
+      pk_print_function_profile (poke_compiler, 1 /* folded_p */);
+      return 1;
+    }
+
   pk_print_profile (poke_compiler);
+  pk_print_function_profile (poke_compiler, 0 /* folded_p */);
+
+  pk_gc_stats (poke_compiler, &stats);
+  pk_printf ("GC collections:    %" PRIu64 "\n", stats.collections);
+  pk_printf ("GC heap size:      %" PRIu64 " bytes\n", stats.heap_size);
+  pk_printf ("GC free bytes:     %" PRIu64 " bytes\n", stats.free_bytes);
+  pk_printf ("GC since last:     %" PRIu64 " bytes\n", stats.bytes_since_gc);
+  pk_printf ("GC total:          %" PRIu64 " bytes\n", stats.total_bytes);
   return 1;
 }
 
@@ -99,19 +143,71 @@ pk_cmd_vm_profile_reset (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_vm_profile_start (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  pk_set_profile_functions (poke_compiler, 1);
+  return 1;
+}
+
+static int
+pk_cmd_vm_profile_stop (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  pk_set_profile_functions (poke_compiler, 0);
+  return 1;
+}
+
+#define PK_VM_COMPILE_STATS_UFLAGS "r"
+#define PK_VM_COMPILE_STATS_F_RESET 0x1
+
+static int
+pk_cmd_vm_compile_stats (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  struct pk_compile_stats stats;
+  double total;
+
+  pk_compile_stats (poke_compiler, &stats);
+  total = (stats.parse_time + stats.frontend_time + stats.middleend_time
+           + stats.backend_time + stats.jitter_time);
+
+  pk_printf ("compilations:      %" PRIu64 "\n", stats.compilations);
+  pk_printf ("parse time:        %.3f ms\n", stats.parse_time * 1000);
+  pk_printf ("frontend time:     %.3f ms\n", stats.frontend_time * 1000);
+  pk_printf ("middleend time:    %.3f ms\n", stats.middleend_time * 1000);
+  pk_printf ("backend time:      %.3f ms\n", stats.backend_time * 1000);
+  pk_printf ("jitter time:       %.3f ms\n", stats.jitter_time * 1000);
+  pk_printf ("total time:        %.3f ms\n", total * 1000);
+  pk_printf ("AST nodes:         %" PRIu64 "\n", stats.ast_nodes);
+  pk_printf ("PVM routines:      %" PRIu64 "\n", stats.routines);
+  pk_printf ("PVM instructions:  %" PRIu64, stats.insns);
+  if (stats.routines > 0)
+    pk_printf (" (%" PRIu64 " per routine, %" PRIu64 " max)",
+               stats.insns / stats.routines, stats.max_routine_insns);
+  pk_puts ("\n");
+  pk_printf ("memory allocated:  %" PRIu64 " bytes\n", stats.bytes_allocated);
+
+  if (uflags & PK_VM_COMPILE_STATS_F_RESET)
+    pk_reset_compile_stats (poke_compiler);
+
+  return 1;
+}
+
 extern struct pk_cmd null_cmd; /* pk-cmd.c  */
 
 const struct pk_cmd vm_disas_exp_cmd =
   {"expression", "s", PK_VM_DIS_UFLAGS, 0, NULL, pk_cmd_vm_disas_exp,
-   "vm disassemble expression[/n] EXP\n\
+   "vm disassemble expression[/nu] EXP\n\
 Flags:\n\
-  n (do a native disassemble)", NULL};
+  n (do a native disassemble)\n\
+  u (do not run the peephole optimizer)", NULL};
 
 const struct pk_cmd vm_disas_fun_cmd =
   {"function", "s", PK_VM_DIS_UFLAGS, 0, NULL, pk_cmd_vm_disas_fun,
-   "vm disassemble function[/n] EXP\n\
+   "vm disassemble function[/nu] EXP\n\
 Flags:\n\
-  n (do a native disassemble)", NULL};
+  n (do a native disassemble)\n\
+  u (do not run the peephole optimizer on functions compiled\n\
+     while evaluating EXP)", NULL};
 
 const struct pk_cmd *vm_disas_cmds[] =
   {
@@ -127,17 +223,29 @@ const struct pk_cmd vm_disas_cmd =
    "vm disassemble (expression|function)", NULL};
 
 const struct pk_cmd vm_profile_show_cmd =
-  {"show", "", "", 0, NULL, pk_cmd_vm_profile_show,
-   "vm profile show", NULL};
+  {"show", "", PK_VM_PROFILE_SHOW_UFLAGS, 0, NULL, pk_cmd_vm_profile_show,
+   "vm profile show[/f]\n\
+Flags:\n\
+  f (print the function profile in folded format, for flame graphs)", NULL};
 
 const struct pk_cmd vm_profile_reset_cmd =
   {"reset", "", "", 0, NULL, pk_cmd_vm_profile_reset,
    "vm profile reset", NULL};
 
+const struct pk_cmd vm_profile_start_cmd =
+  {"start", "", "", 0, NULL, pk_cmd_vm_profile_start,
+   "vm profile start", NULL};
+
+const struct pk_cmd vm_profile_stop_cmd =
+  {"stop", "", "", 0, NULL, pk_cmd_vm_profile_stop,
+   "vm profile stop", NULL};
+
 const struct pk_cmd *vm_profile_cmds[] =
   {
     &vm_profile_show_cmd,
     &vm_profile_reset_cmd,
+    &vm_profile_start_cmd,
+    &vm_profile_stop_cmd,
     &null_cmd
   };
 
@@ -145,7 +253,50 @@ struct pk_trie *vm_profile_trie;
 
 const struct pk_cmd vm_profile_cmd =
   {"profile", "", "", 0, &vm_profile_trie, NULL,
-   "vm profile (show|reset)", NULL};
+   "vm profile (show|reset|start|stop)", NULL};
+static int
+pk_cmd_vm_info (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  pk_printf ("jitter version:    %s\n", JITTER_VERSION);
+  pk_printf ("dispatch model:    %s\n", pk_vm_dispatch (poke_compiler));
+  return 1;
+}
+
+static int
+pk_cmd_info_memory (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  struct pk_gc_stats stats;
+
+  pk_gc_stats (poke_compiler, &stats);
+  pk_printf ("heap size:         %" PRIu64 " bytes\n", stats.heap_size);
+  pk_printf ("free bytes:        %" PRIu64 " bytes\n", stats.free_bytes);
+  pk_printf ("live bytes:        %" PRIu64 " bytes\n", stats.live_bytes);
+  pk_printf ("since last GC:     %" PRIu64 " bytes\n", stats.bytes_since_gc);
+  pk_printf ("total allocated:   %" PRIu64 " bytes\n", stats.total_bytes);
+  pk_printf ("collections:       %" PRIu64 "\n", stats.collections);
+  if (stats.pause_time >= 0)
+    pk_printf ("GC pause time:     %.3f ms (max %.3f ms)\n",
+               stats.pause_time * 1000, stats.max_pause_time * 1000);
+  pk_printf ("strings:           %" PRIu64 "\n", stats.strings);
+  pk_printf ("offsets:           %" PRIu64 "\n", stats.offsets);
+  pk_printf ("arrays:            %" PRIu64 "\n", stats.arrays);
+  pk_printf ("structs:           %" PRIu64 "\n", stats.structs);
+  pk_printf ("other values:      %" PRIu64 "\n", stats.other_vals);
+  return 1;
+}
+
+const struct pk_cmd info_memory_cmd =
+  {"memory", "", "", 0, NULL, pk_cmd_info_memory, "info memory", NULL};
+
+const struct pk_cmd vm_compile_stats_cmd =
+  {"compile-stats", "", PK_VM_COMPILE_STATS_UFLAGS, 0, NULL,
+   pk_cmd_vm_compile_stats,
+   "vm compile-stats[/r]\n\
+Flags:\n\
+  r (reset the statistics after printing them)", NULL};
+
+const struct pk_cmd vm_info_cmd =
+  {"info", "", "", 0, NULL, pk_cmd_vm_info, "vm info", NULL};
 
 struct pk_trie *vm_trie;
 
@@ -153,8 +304,10 @@ const struct pk_cmd *vm_cmds[] =
   {
     &vm_disas_cmd,
     &vm_profile_cmd,
+    &vm_compile_stats_cmd,
+    &vm_info_cmd,
     &null_cmd
   };
 
 const struct pk_cmd vm_cmd =
-  {"vm", "", "", 0, &vm_trie, NULL, "vm (disassemble)", NULL};
+  {"vm", "", "", 0, &vm_trie, NULL, "vm (disassemble|profile|compile-stats|info)", NULL};
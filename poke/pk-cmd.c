@@ -30,6 +30,7 @@
 #include <xalloc.h>
 #include <xstrndup.h>
 #include <ctype.h>
+#include "read-file.h"
 
 #include "poke.h"
 #include "pk-cmd.h"
@@ -57,6 +58,7 @@ extern const struct pk_cmd vm_cmd; /* pk-cmd-vm.c  */
 extern const struct pk_cmd set_cmd; /* pk-cmd-set.c */
 extern const struct pk_cmd editor_cmd; /* pk-cmd-editor.c */
 extern const struct pk_cmd map_cmd; /* pk-cmd-map.c */
+extern const struct pk_cmd export_cmd; /* pk-cmd-export.c */
 
 const struct pk_cmd null_cmd = {};
 
@@ -77,6 +79,7 @@ static const struct pk_cmd *dot_cmds[] =
     &vm_cmd,
     &set_cmd,
     &map_cmd,
+    &export_cmd,
     &editor_cmd,
     &mem_cmd,
 #ifdef HAVE_LIBNBD
@@ -613,6 +616,7 @@ pk_cmd_exec (const char *str)
           ecmd = cmd_alloc;
         }
 
+      pk_cmd_autoload (ecmd);
       pk_set_lexical_cuckolding_p (poke_compiler, 1);
       if (what == 0)
         {
@@ -716,6 +720,141 @@ pk_cmd_exec_script (const char *filename)
   return 0;
 }
 
+/* Modules defining commands written in Poke, which are loaded on
+   demand.  A module is loaded when some code refers to NAME, or to
+   some identifier starting with PREFIX if it is not NULL, and there
+   is no such declaration yet.  */
+
+static struct
+{
+  const char *module;
+  const char *name;
+  const char *prefix;
+  int loaded_p;
+} autoloads[] =
+  {
+    { "pk-dump", "dump", "pk_dump_", 0 },
+    { "pk-copy", "copy", NULL, 0 },
+    { "pk-save", "save", NULL, 0 },
+    { "pk-extract", "extract", NULL, 0 },
+    { "pk-scrabble", "scrabble", NULL, 0 },
+    { "pk-search", "search", NULL, 0 },
+  };
+
+#define NUM_AUTOLOADS (sizeof (autoloads) / sizeof (autoloads[0]))
+
+static void
+autoload_module (size_t i)
+{
+  if (autoloads[i].loaded_p)
+    return;
+
+  autoloads[i].loaded_p = 1;
+  if (!pk_load (poke_compiler, autoloads[i].module))
+    pk_fatal ("unable to load a command module");
+}
+
+/* Load the module declaring the identifier ID of length LEN, if
+   any.  */
+
+static void
+autoload_identifier (const char *id, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < NUM_AUTOLOADS; ++i)
+    {
+      const char *prefix = autoloads[i].prefix;
+
+      if (autoloads[i].loaded_p)
+        continue;
+
+      if ((strlen (autoloads[i].name) == len
+           && strncmp (autoloads[i].name, id, len) == 0)
+          || (prefix && len >= strlen (prefix)
+              && strncmp (prefix, id, strlen (prefix)) == 0))
+        {
+          /* Don't override a declaration by the user.  */
+          char *name = xstrndup (id, len);
+          int declared_p = pk_decl_p (poke_compiler, name, PK_DECL_KIND_VAR)
+                           || pk_decl_p (poke_compiler, name,
+                                         PK_DECL_KIND_FUNC);
+
+          free (name);
+          if (!declared_p)
+            autoload_module (i);
+        }
+    }
+}
+
+void
+pk_cmd_autoload (const char *src)
+{
+  const char *p = src;
+
+  /* This doesn't need to be accurate: loading a module that is not
+     needed is harmless.  Identifiers in comments, strings and
+     character literals are skipped, anyway.  */
+  while (*p != '\0')
+    {
+      if (p[0] == '/' && p[1] == '*')
+        {
+          const char *end = strstr (p + 2, "*/");
+          p = end ? end + 2 : p + strlen (p);
+        }
+      else if (p[0] == '/' && p[1] == '/')
+        p += strcspn (p, "\n");
+      else if (*p == '"' || *p == '\'')
+        {
+          char quote = *p++;
+
+          while (*p != '\0' && *p != quote)
+            p += (p[0] == '\\' && p[1] != '\0') ? 2 : 1;
+          if (*p != '\0')
+            p++;
+        }
+      else if (isalpha ((unsigned char) *p) || *p == '_')
+        {
+          const char *id = p;
+
+          while (isalnum ((unsigned char) *p) || *p == '_')
+            p++;
+          autoload_identifier (id, p - id);
+        }
+      else if (isdigit ((unsigned char) *p))
+        {
+          /* Skip numbers, which can contain letters.  */
+          while (isalnum ((unsigned char) *p) || *p == '_')
+            p++;
+        }
+      else
+        p++;
+    }
+}
+
+void
+pk_cmd_autoload_file (const char *filename)
+{
+  size_t size;
+  char *data = read_file (filename, 0, &size);
+
+  /* If the file can't be read, the compiler will complain.  */
+  if (data)
+    {
+      pk_cmd_autoload (data);
+      free (data);
+    }
+}
+
+void
+pk_cmd_autoload_all (void)
+{
+  size_t i;
+
+  for (i = 0; i < NUM_AUTOLOADS; ++i)
+    autoload_module (i);
+}
+
 void
 pk_cmd_init (void)
 {
@@ -91,6 +91,17 @@ int pk_cmd_exec (const char *str);
 
 int pk_cmd_exec_script (const char *filename);
 
+/* The commands written in Poke, like `dump' or `copy', are defined
+   in modules that are loaded the first time they are used.  Before
+   compiling some Poke code, the following functions look for the
+   names declared by these modules in the code in the string SRC or
+   in the file FILENAME, and load the modules that haven't been
+   loaded yet.  pk_cmd_autoload_all loads all of them.  */
+
+void pk_cmd_autoload (const char *src);
+void pk_cmd_autoload_file (const char *filename);
+void pk_cmd_autoload_all (void);
+
 /* Initialize the cmd subsystem.  */
 
 void pk_cmd_init (void);
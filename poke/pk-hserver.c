@@ -22,8 +22,11 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -50,85 +53,193 @@ static pthread_t hserver_thread;
 /* Socket used by the worker thread.  */
 static int hserver_socket;
 
-/* Port where the server listens for connections.  */
-static pk_val hserver_port;
+/* Port where the server listens for connections, and name of the
+   host.  */
+static int hserver_port;
+static char hserver_hostname[128];
+
+/* The server thread waits for events on the listening socket, the
+   connected clients and the control pipe.  Writing to the control
+   pipe wakes up the server, so it can check hserver_finish.  */
+static int hserver_control_pipe[2];
 
 /* hserver_finish is used to tell the server threads to terminate.  It
-   is protected with a mutex.  */
+   is protected with a mutex, along with the token table and the
+   queue of commands below.  */
 static int hserver_finish;
 static pthread_mutex_t hserver_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* The server maintains a table with tokens.  Each hyperlink uses its
    own unique token, which is included in the payload and checked upon
-   connection.  */
-static pk_val hserver_tokens;
+   connection.
+
+   Tokens are allocated in sequence, and stored in the entry of the
+   table indexed by the token modulus the size of the table.  Note how
+   tokens expire at some point if the capacity of the table is
+   exceeded.  */
+
+#define HSERVER_MAX_TOKENS 128
+
+struct hserver_token
+{
+  int token;
+  char kind;
+  char *cmd;
+};
+
+static struct hserver_token hserver_tokens[HSERVER_MAX_TOKENS];
+static int hserver_next_token;
+
+/* Commands of the clicked hyperlinks are not executed by the server
+   thread, which would need to access the compiler and the terminal
+   concurrently with the main thread.  Instead they are queued, and the
+   main thread is notified through the commands pipe.  The main thread
+   runs them next time it waits for input, see pk_hserver_wait.  */
+
+struct hserver_command
+{
+  char kind;
+  char *cmd;
+  struct hserver_command *next;
+};
+
+static struct hserver_command *hserver_commands;
+static struct hserver_command **hserver_commands_tail = &hserver_commands;
+static int hserver_commands_pipe[2];
 
 int
 pk_hserver_port (void)
 {
-  pk_val port = pk_decl_val (poke_compiler, "hserver_port");
-
-  assert (hserver_port != PK_NULL);
-  return pk_int_value (port);
+  return hserver_port;
 }
 
 int
 pk_hserver_get_token (void)
 {
-  pk_val cls = pk_decl_val (poke_compiler, "hserver_get_token");
-  pk_val token;
-  int ret;
+  int token;
 
-  assert (cls != PK_NULL);
-  ret = pk_call (poke_compiler, cls, &token, PK_NULL);
-  assert (ret == PK_OK);
+  struct hserver_token *entry;
+
+  pthread_mutex_lock (&hserver_mutex);
+  token = hserver_next_token;
+  hserver_next_token = (hserver_next_token + 1) & 0x7fffffff;
+  entry = &hserver_tokens[token % HSERVER_MAX_TOKENS];
+  entry->token = token;
+  free (entry->cmd);
+  entry->cmd = NULL;
+  pthread_mutex_unlock (&hserver_mutex);
 
-  return pk_int_value (token);
+  return token;
 }
 
+/* Queue the command associated with TOKEN, if the token is valid.
+   Return 1 if the command was queued, 0 otherwise.  */
+
 static int
-pk_hserver_token_p (int token)
+pk_hserver_queue_token (int token)
 {
-  pk_val cls = pk_decl_val (poke_compiler, "hserver_token_p");
-  pk_val token_val = pk_make_int (token, 32);
-  pk_val token_p;
-  int ret;
+  struct hserver_token *entry;
+  struct hserver_command *command = NULL;
+
+  if (token < 0)
+    return 0;
 
-  assert (cls != PK_NULL);
-  ret = pk_call (poke_compiler, cls, &token_p, token_val, PK_NULL);
-  assert (ret == PK_OK);
+  pthread_mutex_lock (&hserver_mutex);
+  entry = &hserver_tokens[token % HSERVER_MAX_TOKENS];
+  if (entry->token == token && entry->cmd != NULL)
+    {
+      command = xmalloc (sizeof (struct hserver_command));
+      command->kind = entry->kind;
+      command->cmd = xstrdup (entry->cmd);
+      command->next = NULL;
+      *hserver_commands_tail = command;
+      hserver_commands_tail = &command->next;
+    }
+  pthread_mutex_unlock (&hserver_mutex);
 
-  return pk_int_value (token_p);
+  if (command)
+    {
+      char c = 0;
+
+      /* If the pipe is full the main thread has been notified
+         already.  */
+      if (write (hserver_commands_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+        perror ("write");
+    }
+
+  return command != NULL;
 }
 
-static char
-pk_hserver_token_kind (int token)
+/* Run the commands in the queue.  This is called by the main
+   thread.  */
+
+static void
+pk_hserver_run_commands (void)
 {
-  pk_val cls = pk_decl_val (poke_compiler, "hserver_token_kind");
-  pk_val token_val = pk_make_int (token, 32);
-  pk_val token_kind;
-  int ret;
+  struct hserver_command *command, *next;
+  char buffer[64];
 
-  assert (cls != PK_NULL);
-  ret = pk_call (poke_compiler, cls, &token_kind, token_val, PK_NULL);
-  assert (ret == PK_OK);
+  /* Empty the commands pipe.  */
+  while (read (hserver_commands_pipe[0], buffer, sizeof (buffer)) > 0)
+    ;
 
-  return pk_uint_value (token_kind);
+  pthread_mutex_lock (&hserver_mutex);
+  command = hserver_commands;
+  hserver_commands = NULL;
+  hserver_commands_tail = &hserver_commands;
+  pthread_mutex_unlock (&hserver_mutex);
+
+  for (; command; command = next)
+    {
+      switch (command->kind)
+        {
+        case 'e':
+          /* Command 'execute'.  */
+          pk_repl_display_begin ();
+          pk_puts (command->cmd);
+          pk_puts ("\n");
+          pk_cmd_exec (command->cmd);
+          pk_repl_display_end ();
+          break;
+        case 'i':
+          /* Command 'insert'.  */
+          pk_repl_insert (command->cmd);
+          break;
+        default:
+          break;
+        }
+
+      next = command->next;
+      free (command->cmd);
+      free (command);
+    }
 }
 
-static const char *
-pk_hserver_cmd (int token)
+void
+pk_hserver_wait (int fd)
 {
-  pk_val cls = pk_decl_val (poke_compiler, "hserver_token_cmd");
-  pk_val token_val = pk_make_int (token, 32);
-  pk_val cmd;
-  int ret;
+  struct pollfd fds[2];
+
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = hserver_commands_pipe[0];
+  fds[1].events = POLLIN;
 
-  assert (cls != PK_NULL);
-  ret = pk_call (poke_compiler, cls, &cmd, token_val, PK_NULL);
-  assert (ret == PK_OK);
+  while (1)
+    {
+      if (poll (fds, 2, -1 /* timeout */) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("poll");
+          return;
+        }
 
-  return pk_string_str (cmd);
+      if (fds[1].revents & POLLIN)
+        pk_hserver_run_commands ();
+      if (fds[0].revents)
+        return;
+    }
 }
 
 static int
@@ -181,13 +292,12 @@ read_from_client (int filedes)
   char buffer[MAXMSG];
   int nbytes;
 
-  nbytes = read (filedes, buffer, MAXMSG);
+  nbytes = read (filedes, buffer, MAXMSG - 1);
   if (nbytes < 0)
     {
-      /* Read error. */
+      /* Read error.  Drop the client.  */
       perror ("read");
-      pk_fatal (NULL);
-      return 0;
+      return -1;
     }
   else if (nbytes == 0)
     /* End-of-file. */
@@ -195,55 +305,21 @@ read_from_client (int filedes)
   else
     {
       int token;
-      char kind;
       char *p = buffer;
-      const char *cmd;
 
       /* Remove the newline at the end.  */
-      buffer[nbytes-1] = '\0';
+      buffer[nbytes] = '\0';
+      if (buffer[nbytes - 1] == '\n')
+        buffer[nbytes - 1] = '\0';
 
       /* The format of the payload is:
-         [0-9]+/{e,i} */
+         [0-9]+ */
 
       /* Get the token and check it.  */
-      if (!parse_int (&p, &token))
-        {
-          printf ("PARSING INT\n");
-          return 0;
-        }
-
-      if (!pk_hserver_token_p (token))
+      if (!parse_int (&p, &token) || *p != '\0')
         return 0;
 
-      kind = pk_hserver_token_kind (token);
-
-      if (*p != '\0')
-        return 0;
-
-      switch (kind)
-        {
-        case 'e':
-          /* Command 'execute'.  */
-          cmd = pk_hserver_cmd (token);
-          pthread_mutex_lock (&hserver_mutex);
-          pk_repl_display_begin ();
-          pk_puts (p);
-          pk_puts ("\n");
-          pk_cmd_exec (cmd);
-          pk_repl_display_end ();
-          pthread_mutex_unlock (&hserver_mutex);
-          break;
-        case 'i':
-          /* Command 'insert'.  */
-          cmd = pk_hserver_cmd (token);
-          pthread_mutex_lock (&hserver_mutex);
-          pk_repl_insert (cmd);
-          pthread_mutex_unlock (&hserver_mutex);
-          break;
-        default:
-          break;
-        }
-
+      pk_hserver_queue_token (token);
       return 0;
     }
 }
@@ -251,88 +327,124 @@ read_from_client (int filedes)
 static void *
 hserver_thread_worker (void *data)
 {
-  fd_set active_fd_set, read_fd_set;
-  int i;
-  struct sockaddr_in clientname;
-  socklen_t size;
-
-  /* Initialize the set of active sockets. */
-  FD_ZERO (&active_fd_set);
-  FD_SET (hserver_socket, &active_fd_set);
+  struct pollfd *fds;
+  nfds_t nfds, allocated, i, j;
+
+  /* The first two entries are the control pipe and the listening
+     socket.  The connected clients follow.  */
+  allocated = 16;
+  fds = xmalloc (allocated * sizeof (struct pollfd));
+  fds[0].fd = hserver_control_pipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = hserver_socket;
+  fds[1].events = POLLIN;
+  nfds = 2;
 
   while (1)
     {
-      struct timeval timeout = { 0, 200000 };
-
       /* Block until input arrives on one or more active sockets.  */
-      read_fd_set = active_fd_set;
-      if (select (FD_SETSIZE, &read_fd_set, NULL, NULL, &timeout) < 0)
+      if (poll (fds, nfds, -1 /* timeout */) < 0)
         {
           if (errno == EINTR)
             continue;
-          perror ("select");
+          perror ("poll");
           pk_fatal (NULL);
         }
 
-      /* Service all the sockets with input pending. */
-      for (i = 0; i < FD_SETSIZE; ++i)
-        if (FD_ISSET (i, &read_fd_set))
-          {
-            if (i == hserver_socket)
-              {
-                /* Connection request on original socket. */
-                int new;
-                size = sizeof (clientname);
-                new = accept (hserver_socket,
-                              (struct sockaddr *) &clientname,
-                              &size);
-                if (new < 0)
-                  {
-                    perror ("accept");
-                    pk_fatal (NULL);
-                  }
-                FD_SET (new, &active_fd_set);
-              }
-            else
-              {
-                /* Data arriving on an already-connected socket. */
-                if (read_from_client (i) < 0)
-                  {
-                    close (i);
-                    FD_CLR (i, &active_fd_set);
-                  }
-              }
-          }
-
-      pthread_mutex_lock (&hserver_mutex);
-      if (hserver_finish)
+      if (fds[0].revents & POLLIN)
         {
+          pthread_mutex_lock (&hserver_mutex);
+          if (hserver_finish)
+            {
+              pthread_mutex_unlock (&hserver_mutex);
+              break;
+            }
           pthread_mutex_unlock (&hserver_mutex);
-          pthread_exit (NULL);
         }
-      pthread_mutex_unlock (&hserver_mutex);
+
+      /* Service all the clients with input pending, dropping the
+         ones that closed the connection.  */
+      for (i = j = 2; i < nfds; ++i)
+        {
+          if (fds[i].revents
+              && read_from_client (fds[i].fd) < 0)
+            {
+              close (fds[i].fd);
+              continue;
+            }
+          fds[j++] = fds[i];
+        }
+      nfds = j;
+
+      if (fds[1].revents & POLLIN)
+        {
+          /* Connection request on original socket. */
+          struct sockaddr_in clientname;
+          socklen_t size = sizeof (clientname);
+          int new = accept (hserver_socket,
+                            (struct sockaddr *) &clientname,
+                            &size);
+
+          if (new < 0)
+            perror ("accept");
+          else
+            {
+              if (nfds == allocated)
+                {
+                  allocated *= 2;
+                  fds = xrealloc (fds, allocated * sizeof (struct pollfd));
+                }
+              fds[nfds].fd = new;
+              fds[nfds].events = POLLIN;
+              fds[nfds].revents = 0;
+              nfds++;
+            }
+        }
+    }
+
+  for (i = 2; i < nfds; ++i)
+    close (fds[i].fd);
+  free (fds);
+  return NULL;
+}
+
+/* Create a pipe whose ends don't block.  */
+
+static void
+make_pipe (int fds[2])
+{
+  if (pipe (fds) != 0)
+    {
+      perror ("pipe");
+      pk_fatal (NULL);
+    }
+
+  if (fcntl (fds[0], F_SETFL, fcntl (fds[0], F_GETFL) | O_NONBLOCK) < 0
+      || fcntl (fds[1], F_SETFL, fcntl (fds[1], F_GETFL) | O_NONBLOCK) < 0)
+    {
+      perror ("fcntl");
+      pk_fatal (NULL);
     }
 }
 
 void
 pk_hserver_init (void)
 {
-  char hostname[128];
-
   /* Load the Poke components of the hserver.  */
   if (!pk_load (poke_compiler, "pk-hserver"))
     pk_fatal ("unable to load the pk-hserver module");
 
-  hserver_tokens = pk_decl_val (poke_compiler, "hserver_tokens");
-  assert (hserver_tokens != PK_NULL);
-
-  if (gethostname (hostname, sizeof (hostname)) != 0)
+  if (gethostname (hserver_hostname, sizeof (hserver_hostname)) != 0)
     {
       perror ("gethostname");
       pk_fatal (NULL);
     }
+  hserver_hostname[sizeof (hserver_hostname) - 1] = '\0';
   pk_decl_set_val (poke_compiler, "hserver_hostname",
-                   pk_make_string (hostname));
+                   pk_make_string (hserver_hostname));
+
+  make_pipe (hserver_control_pipe);
+  make_pipe (hserver_commands_pipe);
 }
 
 void
@@ -343,16 +455,15 @@ pk_hserver_start (void)
   socklen_t size;
 
   /* Create the socket and set it up to accept connections. */
-  hserver_socket = make_socket (pk_hserver_port ());
-  if (listen (hserver_socket, 1) < 0)
+  hserver_socket = make_socket (hserver_port);
+  if (listen (hserver_socket, SOMAXCONN) < 0)
     {
       perror ("listen");
       pk_fatal (NULL);
     }
 
-  /* Get a suitable ephemeral port and initialize hserver_port and
-     hserver_port_str.  These will be used until the server shuts
-     down.  */
+  /* Get a suitable ephemeral port and initialize hserver_port.  This
+     will be used until the server shuts down.  */
   size = sizeof (clientname);
   if (getsockname (hserver_socket, &clientname, &size) != 0)
     {
@@ -360,8 +471,9 @@ pk_hserver_start (void)
       pk_fatal (NULL);
     }
 
+  hserver_port = ntohs (clientname.sin_port);
   pk_decl_set_val (poke_compiler, "hserver_port",
-                   pk_make_int (ntohs (clientname.sin_port), 32));
+                   pk_make_int (hserver_port, 32));
 
   hserver_finish = 0;
   ret = pthread_create (&hserver_thread,
@@ -380,13 +492,17 @@ pk_hserver_start (void)
 void
 pk_hserver_shutdown (void)
 {
-  int ret;
+  int i, ret;
   void *res;
+  char c = 0;
 
   pthread_mutex_lock (&hserver_mutex);
   hserver_finish = 1;
   pthread_mutex_unlock (&hserver_mutex);
 
+  if (write (hserver_control_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+    perror ("write");
+
   ret = pthread_join (hserver_thread, &res);
   if (ret != 0)
     {
@@ -394,23 +510,33 @@ pk_hserver_shutdown (void)
       perror ("pthread_join");
       pk_fatal (NULL);
     }
+
+  close (hserver_socket);
+  for (i = 0; i < HSERVER_MAX_TOKENS; ++i)
+    free (hserver_tokens[i].cmd);
 }
 
 char *
 pk_hserver_make_hyperlink (char type,
                            const char *cmd)
 {
-  pk_val cls = pk_decl_val (poke_compiler, "hserver_make_hyperlink");
-  pk_val hyperlink, kind_val, cmd_val;
-  int ret;
+  int token;
+  char *hyperlink;
+  struct hserver_token *entry;
+
+  assert (type == 'i' || type == 'e');
 
-  kind_val = pk_make_uint (type, 8);
-  cmd_val = pk_make_string (cmd);
+  token = pk_hserver_get_token ();
+
+  pthread_mutex_lock (&hserver_mutex);
+  entry = &hserver_tokens[token % HSERVER_MAX_TOKENS];
+  entry->kind = type;
+  entry->cmd = xstrdup (cmd);
+  pthread_mutex_unlock (&hserver_mutex);
 
-  assert (cls != PK_NULL);
-  ret = pk_call (poke_compiler, cls, &hyperlink,
-                 kind_val, cmd_val, PK_NULL);
-  assert (ret == PK_OK);
+  if (asprintf (&hyperlink, "app://%s:%d/%d",
+                hserver_hostname, hserver_port, token) == -1)
+    pk_fatal (_("out of memory"));
 
-  return xstrdup (pk_string_str (hyperlink));
+  return hyperlink;
 }
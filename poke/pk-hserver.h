@@ -35,6 +35,12 @@ int pk_hserver_get_token (void);
    function shall be called after pk_hserver_init.  */
 int pk_hserver_port (void);
 
+/* Wait until there is input available in the file descriptor FD.
+   The commands of the hyperlinks activated in the meanwhile are
+   executed while waiting.  This function shall be called by the main
+   thread.  */
+void pk_hserver_wait (int fd);
+
 /* Build hyperlinks.  */
 char *pk_hserver_make_hyperlink (char type, const char *cmd);
 
@@ -69,14 +69,15 @@ struct pk_map_parsed_map
 
 typedef struct pk_map_parsed_map *pk_map_parsed_map;
 
-/* Parse a map definition from the given file.
+/* Parse a map definition from the contents of a file.
 
-   FILENAME is the name of the file to parse.
-   FP is a FILE * for the file whose contents are to be parsed.
+   FILENAME is the name of the file, used in error messages.
+   BUFFER and SIZE are the contents of the file to be parsed.
 
    Return the parsed map, or NULL if there is an error.  */
 
-pk_map_parsed_map pk_map_parse_file (const char *filename, FILE *fp);
+pk_map_parsed_map pk_map_parse_buffer (const char *filename,
+                                       const char *buffer, size_t size);
 
 /* Free the resources used by the given parsed map struct.  */
 
@@ -367,7 +367,8 @@ tagged_value:
 /* Parser public functions.  */
 
 pk_map_parsed_map
-pk_map_parse_file (const char *filename, FILE *fp)
+pk_map_parse_buffer (const char *filename, const char *buffer,
+                     size_t size)
 {
   int ret;
   struct pk_map_parser map_parser;
@@ -380,7 +381,7 @@ pk_map_parse_file (const char *filename, FILE *fp)
 
   pk_map_tab_lex_init (&map_parser.lexer);
   pk_map_tab_set_extra (&map_parser, map_parser.lexer);
-  pk_map_tab_set_in (fp, map_parser.lexer);
+  pk_map_tab__scan_bytes (buffer, size, map_parser.lexer);
   ret = pk_map_tab_parse (&map_parser);
   pk_map_tab_lex_destroy (map_parser.lexer);
 
@@ -391,6 +392,29 @@ pk_map_parse_file (const char *filename, FILE *fp)
   return map_parser.map;
 }
 
+void
+pk_map_free_parsed_map (pk_map_parsed_map parsed_map)
+{
+  pk_map_parsed_entry entry, next;
+
+  for (entry = PK_MAP_PARSED_MAP_ENTRIES (parsed_map);
+       entry;
+       entry = next)
+    {
+      next = PK_MAP_PARSED_ENTRY_CHAIN (entry);
+      free (PK_MAP_PARSED_ENTRY_NAME (entry));
+      free (PK_MAP_PARSED_ENTRY_VARNAME (entry));
+      free (PK_MAP_PARSED_ENTRY_TYPE (entry));
+      free (PK_MAP_PARSED_ENTRY_OFFSET (entry));
+      free (PK_MAP_PARSED_ENTRY_CONDITION (entry));
+      free (entry);
+    }
+
+  free (PK_MAP_PARSED_MAP_NAME (parsed_map));
+  free (PK_MAP_PARSED_MAP_PROLOGUE (parsed_map));
+  free (parsed_map);
+}
+
 /* For debugging.  */
 
 static void
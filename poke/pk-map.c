@@ -23,8 +23,13 @@
 #include <errno.h>
 #include <string.h>
 #include <xalloc.h>
+#include <xstrndup.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "basename-lgpl.h"
+#include "read-file.h"
+#include "sha256.h"
 
 #include "poke.h"
 #include "pk-utils.h"
@@ -37,6 +42,12 @@
 
 static uint64_t next_map_id;
 
+/* Handles for the variables `map_load_path' and `map_cache_dir',
+   which are accessed every time a map is resolved or loaded.  */
+
+static pk_decl_handle map_load_path_handle;
+static pk_decl_handle map_cache_dir_handle;
+
 /* Maps for a given IOS.
 
    IOS_ID is the identifier of the ios.
@@ -78,6 +89,7 @@ search_map_ios (int ios_id)
 static void
 free_entry (pk_map_entry entry)
 {
+  free (PK_MAP_ENTRY_NAME (entry));
   free (PK_MAP_ENTRY_VARNAME (entry));
   free (entry);
 }
@@ -89,10 +101,13 @@ free_map (pk_map map)
 
   for (entry = PK_MAP_ENTRIES (map); entry; entry = tmp)
     {
-      tmp = PK_MAP_CHAIN (entry);
+      tmp = PK_MAP_ENTRY_CHAIN (entry);
       free_entry (entry);
     }
 
+  free (map->buckets);
+  free (map->by_offset);
+  free (map->max_end);
   free (PK_MAP_NAME (map));
   free (PK_MAP_SOURCE (map));
   free (map);
@@ -114,14 +129,33 @@ search_map (pk_map_ios map_ios, const char *mapname)
   return map;
 }
 
+/* The hash table of a map is resized so it has at least one bucket
+   per entry.  */
+
+#define PK_MAP_MIN_BUCKETS 64
+
+static size_t
+hash_entry_name (const char *name)
+{
+  /* FNV-1a.  */
+  size_t hash = 2166136261U;
+
+  for (; *name; ++name)
+    hash = (hash ^ (unsigned char) *name) * 16777619U;
+  return hash;
+}
+
 static pk_map_entry
 search_map_entry (pk_map map, const char *name)
 {
   pk_map_entry map_entry;
 
-  for (map_entry = PK_MAP_ENTRIES (map);
+  if (map->num_buckets == 0)
+    return NULL;
+
+  for (map_entry = map->buckets[hash_entry_name (name) % map->num_buckets];
        map_entry;
-       map_entry = PK_MAP_ENTRY_CHAIN (map_entry))
+       map_entry = PK_MAP_ENTRY_HASH_CHAIN (map_entry))
     {
       if (STREQ (PK_MAP_ENTRY_NAME (map_entry), name))
         break;
@@ -130,6 +164,134 @@ search_map_entry (pk_map map, const char *name)
   return map_entry;
 }
 
+static void
+index_map_entry (pk_map map, pk_map_entry entry)
+{
+  size_t bucket;
+
+  if (PK_MAP_NUM_ENTRIES (map) >= map->num_buckets)
+    {
+      /* Grow the hash table and rehash the entries.  */
+      size_t num_buckets = (map->num_buckets == 0
+                            ? PK_MAP_MIN_BUCKETS : map->num_buckets * 2);
+      pk_map_entry e;
+
+      free (map->buckets);
+      map->buckets = xcalloc (num_buckets, sizeof (pk_map_entry));
+      map->num_buckets = num_buckets;
+
+      for (e = PK_MAP_ENTRIES (map); e; e = PK_MAP_ENTRY_CHAIN (e))
+        if (e != entry)
+          {
+            bucket = hash_entry_name (PK_MAP_ENTRY_NAME (e)) % num_buckets;
+            PK_MAP_ENTRY_HASH_CHAIN (e) = map->buckets[bucket];
+            map->buckets[bucket] = e;
+          }
+    }
+
+  bucket = hash_entry_name (PK_MAP_ENTRY_NAME (entry)) % map->num_buckets;
+  PK_MAP_ENTRY_HASH_CHAIN (entry) = map->buckets[bucket];
+  map->buckets[bucket] = entry;
+}
+
+static void
+unindex_map_entry (pk_map map, pk_map_entry entry)
+{
+  pk_map_entry *p;
+
+  for (p = &map->buckets[hash_entry_name (PK_MAP_ENTRY_NAME (entry))
+                         % map->num_buckets];
+       *p != entry;
+       p = &PK_MAP_ENTRY_HASH_CHAIN (*p))
+    ;
+  *p = PK_MAP_ENTRY_HASH_CHAIN (entry);
+}
+
+/* Sort the list of entries of MAP by offset, and build the array
+   used to look up entries by offset.  The entries are sorted with a
+   bottom-up merge sort, which is stable.  */
+
+static void
+sort_map_entries (pk_map map)
+{
+  pk_map_entry list = PK_MAP_ENTRIES (map);
+  size_t run, i;
+
+  if (map->sorted_p)
+    return;
+
+  for (run = 1; list; run *= 2)
+    {
+      pk_map_entry p = list, tail = NULL;
+      size_t nmerges = 0;
+
+      list = NULL;
+      while (p)
+        {
+          pk_map_entry q = p, e;
+          size_t psize, qsize;
+
+          nmerges++;
+          for (psize = 0; q && psize < run; psize++)
+            q = PK_MAP_ENTRY_CHAIN (q);
+          qsize = run;
+
+          while (psize > 0 || (qsize > 0 && q))
+            {
+              if (psize == 0
+                  || (qsize > 0 && q
+                      && (PK_MAP_ENTRY_OFFSET_BITS (q)
+                          < PK_MAP_ENTRY_OFFSET_BITS (p))))
+                {
+                  e = q;
+                  q = PK_MAP_ENTRY_CHAIN (q);
+                  qsize--;
+                }
+              else
+                {
+                  e = p;
+                  p = PK_MAP_ENTRY_CHAIN (p);
+                  psize--;
+                }
+
+              if (tail)
+                PK_MAP_ENTRY_CHAIN (tail) = e;
+              else
+                list = e;
+              tail = e;
+            }
+
+          p = q;
+        }
+
+      PK_MAP_ENTRY_CHAIN (tail) = NULL;
+      map->last_entry = tail;
+      if (nmerges <= 1)
+        break;
+    }
+
+  PK_MAP_ENTRIES (map) = list;
+
+  free (map->by_offset);
+  free (map->max_end);
+  map->by_offset = xmalloc ((PK_MAP_NUM_ENTRIES (map) + 1)
+                            * sizeof (pk_map_entry));
+  map->max_end = xmalloc ((PK_MAP_NUM_ENTRIES (map) + 1)
+                          * sizeof (uint64_t));
+
+  for (i = 0; list; list = PK_MAP_ENTRY_CHAIN (list), ++i)
+    {
+      uint64_t end = (PK_MAP_ENTRY_OFFSET_BITS (list)
+                      + PK_MAP_ENTRY_SIZE_BITS (list));
+
+      map->by_offset[i] = list;
+      map->max_end[i] = (i > 0 && map->max_end[i - 1] > end
+                         ? map->max_end[i - 1] : end);
+    }
+
+  map->sorted_p = 1;
+}
+
 static char *
 entry_name_to_varname (const char *name)
 {
@@ -177,21 +339,15 @@ pk_map_alien_token_handler (const char *id, char **errmsg)
       ios_id = pk_ios_get_id (cur_ios);
 
       map = pk_map_search (ios_id, map_name);
+      free (map_name);
       if (map)
         {
-          pk_map_entry entry;
+          pk_map_entry entry = search_map_entry (map, entry_name);
 
-          for (entry = PK_MAP_ENTRIES (map);
-               entry;
-               entry = PK_MAP_ENTRY_CHAIN (entry))
-            {
-              if (STREQ (PK_MAP_ENTRY_NAME (entry), entry_name))
-                return xstrdup (PK_MAP_ENTRY_VARNAME (entry));
-            }
+          if (entry)
+            return xstrdup (PK_MAP_ENTRY_VARNAME (entry));
         }
 
-      free (map_name);
-
     }
 
  error:
@@ -204,6 +360,11 @@ pk_map_init (void)
 {
   poke_maps = NULL;
 
+  map_load_path_handle = pk_decl_handle_new (poke_compiler, "map_load_path");
+  map_cache_dir_handle = pk_decl_handle_new (poke_compiler, "map_cache_dir");
+  if (!map_load_path_handle || !map_cache_dir_handle)
+    pk_fatal ("out of memory");
+
   /* Install the handler for alien variables that recognizes map
      entries.  */
   pk_set_alien_token_fn (poke_compiler, pk_map_alien_token_handler);
@@ -220,20 +381,8 @@ pk_map_shutdown (void)
 
       for (map = PK_MAP_IOS_MAPS (map_ios); map; map = next_map)
         {
-          struct pk_map_entry *entry, *next_entry;
-
-          for (entry = PK_MAP_ENTRIES (map);
-               entry;
-               entry = next_entry)
-            {
-              next_entry = PK_MAP_ENTRY_CHAIN (entry);
-              free (entry->varname);
-              free (entry);
-            }
-
           next_map = PK_MAP_CHAIN (map);
-          free (map->name);
-          free (map);
+          free_map (map);
         }
 
       next_map_ios = PK_MAP_IOS_CHAIN (map_ios);
@@ -241,6 +390,9 @@ pk_map_shutdown (void)
     }
 
   poke_maps = NULL;
+
+  pk_decl_handle_free (map_load_path_handle);
+  pk_decl_handle_free (map_cache_dir_handle);
 }
 
 int
@@ -287,6 +439,13 @@ pk_map_create (int ios_id, const char *mapname,
     else
       PK_MAP_SOURCE (map) = NULL;
     PK_MAP_ENTRIES (map) = NULL;
+    PK_MAP_NUM_ENTRIES (map) = 0;
+    map->buckets = NULL;
+    map->num_buckets = 0;
+    map->last_entry = NULL;
+    map->by_offset = NULL;
+    map->max_end = NULL;
+    map->sorted_p = 1;
 
     PK_MAP_CHAIN (map) = PK_MAP_IOS_MAPS (map_ios);
     PK_MAP_IOS_MAPS (map_ios) = map;
@@ -367,44 +526,32 @@ pk_map_add_entry (int ios_id, const char *mapname,
   if (entry)
     return 0;
 
-  /* Create a new entry and chain it in the map.  The entries are kept
-     sorted by offset.  */
+  /* Create a new entry and chain it in the map.  The entries are
+     sorted by offset the next time they are traversed.  */
   entry = xmalloc (sizeof (struct pk_map_entry));
   PK_MAP_ENTRY_NAME (entry) = xstrdup (name);
   PK_MAP_ENTRY_VARNAME (entry) = xstrdup (varname);
   PK_MAP_ENTRY_OFFSET (entry) = offset;
+  PK_MAP_ENTRY_OFFSET_BITS (entry)
+    = (pk_uint_value (pk_offset_magnitude (offset))
+       * pk_uint_value (pk_offset_unit (offset)));
+  {
+    pk_val val = pk_decl_val (poke_compiler, varname);
 
-  if (PK_MAP_ENTRIES (map) == NULL)
-    {
-      PK_MAP_ENTRY_CHAIN (entry) = NULL;
-      PK_MAP_ENTRIES (map) = entry;
-    }
-  else
-    {
-      pk_map_entry e, p;
-      uint64_t offset_bits
-        = (pk_uint_value (pk_offset_magnitude (offset))
-           * pk_uint_value (pk_offset_unit (offset)));
-
-      for (p = NULL, e = PK_MAP_ENTRIES (map);
-           e;
-           p = e, e = PK_MAP_ENTRY_CHAIN (e))
-        {
-          pk_val e_offset = PK_MAP_ENTRY_OFFSET (e);
-
-          if ((pk_uint_value (pk_offset_magnitude (e_offset))
-               * pk_uint_value (pk_offset_unit (e_offset)))
-              > offset_bits)
-            break;
-        }
-
+    PK_MAP_ENTRY_SIZE_BITS (entry) = val != PK_NULL ? pk_sizeof (val) : 0;
+  }
 
-      PK_MAP_ENTRY_CHAIN (entry) = e;
-      if (p)
-        PK_MAP_ENTRY_CHAIN (p) = entry;
-      else
-        PK_MAP_ENTRIES (map) = entry;
-    }
+  /* The entry is appended to the list, so the stable sort keeps the
+     entries sharing an offset in the order they were added.  */
+  PK_MAP_ENTRY_CHAIN (entry) = NULL;
+  if (map->last_entry)
+    PK_MAP_ENTRY_CHAIN (map->last_entry) = entry;
+  else
+    PK_MAP_ENTRIES (map) = entry;
+  map->last_entry = entry;
+  PK_MAP_NUM_ENTRIES (map)++;
+  index_map_entry (map, entry);
+  map->sorted_p = 0;
 
   return 1;
 }
@@ -435,6 +582,13 @@ pk_map_remove_entry (int ios_id, const char *mapname,
             PK_MAP_ENTRY_CHAIN (prev) = PK_MAP_ENTRY_CHAIN (entry);
           else
             PK_MAP_ENTRIES (map) = PK_MAP_ENTRY_CHAIN (entry);
+          if (map->last_entry == entry)
+            map->last_entry = prev;
+
+          unindex_map_entry (map, entry);
+          PK_MAP_NUM_ENTRIES (map)--;
+          /* The lookup array contains the removed entry.  */
+          map->sorted_p = 0;
 
           free_entry (entry);
           return 1;
@@ -444,6 +598,71 @@ pk_map_remove_entry (int ios_id, const char *mapname,
   return 0;
 }
 
+pk_map_entry
+pk_map_entries (pk_map map)
+{
+  sort_map_entries (map);
+  return PK_MAP_ENTRIES (map);
+}
+
+pk_map_entry
+pk_map_search_entry (pk_map map, const char *name)
+{
+  return search_map_entry (map, name);
+}
+
+size_t
+pk_map_entries_at (pk_map map, uint64_t offset, pk_map_entry **entries)
+{
+  size_t lo, hi, first, last, i, n = 0;
+
+  sort_map_entries (map);
+
+  /* LAST is the number of entries starting at or before OFFSET.  */
+  lo = 0;
+  hi = PK_MAP_NUM_ENTRIES (map);
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (PK_MAP_ENTRY_OFFSET_BITS (map->by_offset[mid]) <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  last = lo;
+
+  /* FIRST is the first entry whose MAX_END goes past OFFSET.  None
+     of the entries before it can cover OFFSET.  */
+  lo = 0;
+  hi = last;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (map->max_end[mid] <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  first = lo;
+
+  for (i = first; i < last; ++i)
+    {
+      pk_map_entry entry = map->by_offset[i];
+
+      if (PK_MAP_ENTRY_OFFSET_BITS (entry) + PK_MAP_ENTRY_SIZE_BITS (entry)
+          > offset)
+        {
+          if (n == 0)
+            *entries = xmalloc ((last - i) * sizeof (pk_map_entry));
+          (*entries)[n++] = entry;
+        }
+    }
+
+  return n;
+}
+
 pk_map
 pk_map_get_maps (int ios_id)
 {
@@ -460,86 +679,148 @@ pk_map_get_maps (int ios_id)
   return NULL;
 }
 
+/* Return whether the condition, type or offset of ENTRY may refer
+   to other entries of the map being loaded, either using an alien
+   token $MAP::ENTRY or the name of the variable of an entry.  */
+
 static int
-pk_map_load_parsed_map (int ios_id, const char *mapname,
-                        const char *filename,
-                        pk_map_parsed_map map)
+entry_refers_to_entries_p (pk_map_parsed_entry entry)
 {
-  pk_map_parsed_entry entry;
+  const char *exps[3] = { PK_MAP_PARSED_ENTRY_CONDITION (entry),
+                          PK_MAP_PARSED_ENTRY_TYPE (entry),
+                          PK_MAP_PARSED_ENTRY_OFFSET (entry) };
+  int i;
 
-  /* First, compile the prologue.  */
-  /* XXX set error location and disable verbose error messages in
-     poke_compiler.  */
-  if (pk_compile_buffer (poke_compiler,
-                         PK_MAP_PARSED_MAP_PROLOGUE (map),
-                         NULL) != PK_OK)
-    return 0;
+  for (i = 0; i < 3; ++i)
+    if (exps[i]
+        && (strstr (exps[i], "::") || strstr (exps[i], "__map_entry_")))
+      return 1;
 
-  /* Process the map entries and create the mapped global
-     variables.  */
+  return 0;
+}
 
-  for (entry = PK_MAP_PARSED_MAP_ENTRIES (map);
-       entry;
+/* Process the entries of a parsed map from FIRST up to, but not
+   including, LAST, and add the selected ones to the map MAPNAME.
+
+   The conditions of the entries are evaluated with a single
+   expression, which is an array having 1 for every entry to be
+   processed and 0 for every entry to be skipped, and the mapped
+   global variables of the entries to be processed are created by
+   compiling a single buffer.  Compiling the expressions one by one
+   is way more expensive with big maps.
+
+   Return 0 if there is an error, 1 otherwise.  */
+
+static int
+pk_map_load_parsed_entries (int ios_id, const char *mapname,
+                            pk_map_parsed_entry first,
+                            pk_map_parsed_entry last)
+{
+  pk_map_parsed_entry entry;
+  size_t nconds = 0, cond_len = 0, defs_len = 0;
+
+  for (entry = first;
+       entry != last;
        entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
     {
-      pk_val val;
-      int process_p = 1;
       const char *condition = PK_MAP_PARSED_ENTRY_CONDITION (entry);
 
-      /* Evaluate the condition.  */
+      PK_MAP_PARSED_ENTRY_SKIPPED_P (entry) = 0;
       if (condition)
         {
-          /* XXX set error location... */
-          if (pk_compile_expression (poke_compiler,
-                                     condition,
-                                     NULL /* end */,
-                                     &val) != PK_OK)
-            goto error;
-
-          if (pk_type_code (pk_typeof (val)) != PK_INT
-              && pk_type_code (pk_typeof (val)) != PK_UINT)
+          nconds++;
+          cond_len += strlen (condition) + strlen ("(( ) ? 1 : 0),");
+        }
+    }
+
+  if (nconds > 0)
+    {
+      char *cond_str = xmalloc (cond_len + 3);
+      char *p = cond_str;
+      pk_val val;
+      uint64_t idx = 0;
+      int ret;
+
+      *p++ = '[';
+      for (entry = first;
+           entry != last;
+           entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
+        {
+          const char *condition = PK_MAP_PARSED_ENTRY_CONDITION (entry);
+
+          if (condition)
             {
-              /* XXX error location.  */
-              pk_printf ("error: invalid condition expression\n");
-              goto error;
+              if (p != cond_str + 1)
+                *p++ = ',';
+              p = stpcpy (p, "((");
+              p = stpcpy (p, condition);
+              p = stpcpy (p, ") ? 1 : 0)");
             }
-
-          if (!(pk_type_code (pk_typeof (val)) == PK_INT
-                ? pk_int_value (val) : pk_uint_value (val)))
-            process_p = 0;
         }
-
-      PK_MAP_PARSED_ENTRY_SKIPPED_P (entry) = !process_p;
-      if (process_p)
+      *p++ = ']';
+      *p = '\0';
+
+      /* XXX set error location... */
+      ret = pk_compile_expression (poke_compiler, cond_str,
+                                   NULL /* end */, &val);
+      free (cond_str);
+      if (ret != PK_OK)
+        return 0;
+
+      for (entry = first;
+           entry != last;
+           entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
         {
-          const char *name = PK_MAP_PARSED_ENTRY_NAME (entry);
-          const char *type = PK_MAP_PARSED_ENTRY_TYPE (entry);
-          const char *offset = PK_MAP_PARSED_ENTRY_OFFSET (entry);
-
-          PK_MAP_PARSED_ENTRY_VARNAME (entry)
-            = entry_name_to_varname (name);
-
-          /* XXX set error location with compiler pragmas... */
-          char *defvar_str
-            = pk_str_concat ("var ",
-                             PK_MAP_PARSED_ENTRY_VARNAME (entry),
-                             " = ", type, " @ ", offset, ";", NULL);
-
-          /* XXX what about constraints?  */
-          if (pk_compile_buffer (poke_compiler,
-                                 defvar_str,
-                                 NULL /* end */) != PK_OK)
-            goto error;
+          if (PK_MAP_PARSED_ENTRY_CONDITION (entry))
+            PK_MAP_PARSED_ENTRY_SKIPPED_P (entry)
+              = !pk_int_value (pk_array_elem_val (val, idx++));
         }
     }
 
-  /* Create the map.  */
-  if (!pk_map_create (ios_id, mapname, filename))
-    return 0;
+  for (entry = first;
+       entry != last;
+       entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
+    {
+      if (!PK_MAP_PARSED_ENTRY_SKIPPED_P (entry))
+        defs_len += (strlen ("var  =  @ ;\n")
+                     + strlen (PK_MAP_PARSED_ENTRY_VARNAME (entry))
+                     + strlen (PK_MAP_PARSED_ENTRY_TYPE (entry))
+                     + strlen (PK_MAP_PARSED_ENTRY_OFFSET (entry)));
+    }
+
+  if (defs_len > 0)
+    {
+      char *defs_str = xmalloc (defs_len + 1);
+      char *p = defs_str;
+      int ret;
+
+      for (entry = first;
+           entry != last;
+           entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
+        {
+          if (!PK_MAP_PARSED_ENTRY_SKIPPED_P (entry))
+            {
+              p = stpcpy (p, "var ");
+              p = stpcpy (p, PK_MAP_PARSED_ENTRY_VARNAME (entry));
+              p = stpcpy (p, " = ");
+              p = stpcpy (p, PK_MAP_PARSED_ENTRY_TYPE (entry));
+              p = stpcpy (p, " @ ");
+              p = stpcpy (p, PK_MAP_PARSED_ENTRY_OFFSET (entry));
+              p = stpcpy (p, ";\n");
+            }
+        }
+
+      /* XXX set error location with compiler pragmas... */
+      /* XXX what about constraints?  */
+      ret = pk_compile_buffer (poke_compiler, defs_str, NULL /* end */);
+      free (defs_str);
+      if (ret != PK_OK)
+        return 0;
+    }
 
   /* Add the map entries.  */
-  for (entry = PK_MAP_PARSED_MAP_ENTRIES (map);
-       entry;
+  for (entry = first;
+       entry != last;
        entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
     {
       if (!PK_MAP_PARSED_ENTRY_SKIPPED_P (entry))
@@ -554,14 +835,288 @@ pk_map_load_parsed_map (int ios_id, const char *mapname,
 
           if (!pk_map_add_entry (ios_id, mapname, name,
                                  varname, offset))
-            goto error;
+            return 0;
         }
     }
 
   return 1;
+}
+
+static int
+pk_map_load_parsed_map (int ios_id, const char *mapname,
+                        const char *filename,
+                        pk_map_parsed_map map)
+{
+  pk_map_parsed_entry entry, first, last;
+
+  /* First, compile the prologue.  */
+  /* XXX set error location and disable verbose error messages in
+     poke_compiler.  */
+  if (pk_compile_buffer (poke_compiler,
+                         PK_MAP_PARSED_MAP_PROLOGUE (map),
+                         NULL) != PK_OK)
+    return 0;
+
+  /* The names of the variables contain the identifier of the map to
+     be created.  */
+  for (entry = PK_MAP_PARSED_MAP_ENTRIES (map);
+       entry;
+       entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
+    {
+      free (PK_MAP_PARSED_ENTRY_VARNAME (entry));
+      PK_MAP_PARSED_ENTRY_VARNAME (entry)
+        = entry_name_to_varname (PK_MAP_PARSED_ENTRY_NAME (entry));
+    }
+
+  /* Create the map.  */
+  if (!pk_map_create (ios_id, mapname, filename))
+    return 0;
+
+  /* Process the entries in batches.  An entry referring to other
+     entries needs the previous entries to be processed first, so it
+     starts a new batch.  */
+  for (first = PK_MAP_PARSED_MAP_ENTRIES (map); first; first = last)
+    {
+      for (last = PK_MAP_PARSED_ENTRY_CHAIN (first);
+           last && !entry_refers_to_entries_p (last);
+           last = PK_MAP_PARSED_ENTRY_CHAIN (last))
+        ;
+
+      if (!pk_map_load_parsed_entries (ios_id, mapname, first, last))
+        {
+          pk_map_remove (ios_id, mapname);
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+/* Cache of parsed map files.
+
+   Loading a map file involves parsing it, which can take some time
+   with big maps.  The result of parsing a map file is therefore
+   written in a cache file, which is used the next time a file with
+   the very same contents is loaded.  The name of the cache file is
+   the SHA-256 hash of the contents of the map file, followed by the
+   extension .pkmc.  Cache files are stored in the directory denoted
+   by the Poke variable `map_cache_dir'.  If it is the empty string
+   then maps are not cached.
+
+   Cache files contain the following lines, where every string is
+   written as its length in decimal, a newline character, the
+   contents of the string and another newline character.  Absent
+   strings are written as a line with a single dash.
+
+     poke-map-cache VERSION
+     PROLOGUE
+     and for every entry, NAME TYPE OFFSET CONDITION
+
+   Note that the compiled code of the entries can't be cached: it
+   depends on the declarations that are in effect when the map is
+   loaded.  */
+
+#define PK_MAP_CACHE_MAGIC "poke-map-cache 1\n"
+
+static const char *
+map_cache_dir (void)
+{
+  pk_val val = pk_decl_handle_val (map_cache_dir_handle);
+
+  if (val == PK_NULL
+      || pk_type_code (pk_typeof (val)) != PK_STRING
+      || *pk_string_str (val) == '\0')
+    return NULL;
+
+  return pk_string_str (val);
+}
+
+/* Return the name of the cache file for a map file with the given
+   contents, or NULL if maps are not to be cached.  The returned
+   string should be freed by the caller.  */
+
+static char *
+map_cache_filename (const char *data, size_t size)
+{
+  const char *dir = map_cache_dir ();
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  char *filename;
+  int i;
+
+  if (!dir)
+    return NULL;
+
+  sha256_buffer (data, size, digest);
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    sprintf (hex + 2 * i, "%02x", digest[i]);
+
+  if (asprintf (&filename, "%s/%s.pkmc", dir, hex) == -1)
+    pk_fatal (_("out of memory"));
+  return filename;
+}
+
+/* Read a string from the contents of a cache file, advancing *P.
+   The contents are terminated by a NULL character.  Absent strings
+   are stored as NULL in *STR.  Return 0 if the contents don't
+   contain a valid string, 1 otherwise.  */
+
+static int
+map_cache_read_string (const char **p, const char *end, char **str)
+{
+  const char *s = *p;
+  char *tail;
+  unsigned long len;
+
+  if (s < end && *s == '-')
+    {
+      if (s + 1 == end || s[1] != '\n')
+        return 0;
+      *str = NULL;
+      *p = s + 2;
+      return 1;
+    }
+
+  if (s == end || *s < '0' || *s > '9')
+    return 0;
+  len = strtoul (s, &tail, 10);
+  if (*tail != '\n' || len >= (unsigned long) (end - tail - 1)
+      || tail[len + 1] != '\n')
+    return 0;
+
+  *str = xstrndup (tail + 1, len);
+  *p = tail + len + 2;
+  return 1;
+}
+
+/* Return the parsed map stored in the cache file FILENAME, or NULL
+   if there is no such cache file or it is not valid.  */
+
+static pk_map_parsed_map
+map_cache_load (const char *filename)
+{
+  pk_map_parsed_map map;
+  pk_map_parsed_entry last_entry = NULL;
+  const char *p, *end;
+  char *data;
+  size_t size;
+
+  data = read_file (filename, RF_BINARY, &size);
+  if (!data)
+    return NULL;
+
+  if (size < strlen (PK_MAP_CACHE_MAGIC)
+      || strncmp (data, PK_MAP_CACHE_MAGIC, strlen (PK_MAP_CACHE_MAGIC)) != 0)
+    {
+      free (data);
+      return NULL;
+    }
+
+  map = xzalloc (sizeof (struct pk_map_parsed_map));
+  p = data + strlen (PK_MAP_CACHE_MAGIC);
+  end = data + size;
+
+  if (!map_cache_read_string (&p, end, &PK_MAP_PARSED_MAP_PROLOGUE (map))
+      || PK_MAP_PARSED_MAP_PROLOGUE (map) == NULL)
+    goto error;
+
+  while (p < end)
+    {
+      pk_map_parsed_entry entry
+        = xzalloc (sizeof (struct pk_map_parsed_entry));
+
+      if (last_entry)
+        PK_MAP_PARSED_ENTRY_CHAIN (last_entry) = entry;
+      else
+        PK_MAP_PARSED_MAP_ENTRIES (map) = entry;
+      last_entry = entry;
+
+      if (!map_cache_read_string (&p, end, &PK_MAP_PARSED_ENTRY_NAME (entry))
+          || !map_cache_read_string (&p, end,
+                                     &PK_MAP_PARSED_ENTRY_TYPE (entry))
+          || !map_cache_read_string (&p, end,
+                                     &PK_MAP_PARSED_ENTRY_OFFSET (entry))
+          || !map_cache_read_string (&p, end,
+                                     &PK_MAP_PARSED_ENTRY_CONDITION (entry))
+          || !PK_MAP_PARSED_ENTRY_NAME (entry)
+          || !PK_MAP_PARSED_ENTRY_TYPE (entry)
+          || !PK_MAP_PARSED_ENTRY_OFFSET (entry))
+        goto error;
+    }
+
+  free (data);
+  return map;
 
  error:
-  return 0;
+  free (data);
+  pk_map_free_parsed_map (map);
+  return NULL;
+}
+
+static void
+map_cache_write_string (FILE *fp, const char *str)
+{
+  if (str)
+    fprintf (fp, "%zu\n%s\n", strlen (str), str);
+  else
+    fputs ("-\n", fp);
+}
+
+/* Write MAP in the cache file FILENAME.  The cache file is written
+   in a temporary file which is then renamed, so concurrent poke
+   processes never see partially written cache files.  Failing to
+   write the cache file is not an error.  */
+
+static void
+map_cache_save (const char *filename, pk_map_parsed_map map)
+{
+  pk_map_parsed_entry entry;
+  char *tmpname;
+  FILE *fp;
+  int fd, write_ok;
+
+  if (!pk_mkdir_p (map_cache_dir (), 0700))
+    return;
+
+  tmpname = pk_str_concat (filename, ".XXXXXX", NULL);
+  fd = mkstemp (tmpname);
+  if (fd == -1)
+    {
+      free (tmpname);
+      return;
+    }
+
+  fp = fdopen (fd, "w");
+  if (!fp)
+    {
+      close (fd);
+      goto error;
+    }
+
+  fputs (PK_MAP_CACHE_MAGIC, fp);
+  map_cache_write_string (fp, PK_MAP_PARSED_MAP_PROLOGUE (map));
+  for (entry = PK_MAP_PARSED_MAP_ENTRIES (map);
+       entry;
+       entry = PK_MAP_PARSED_ENTRY_CHAIN (entry))
+    {
+      map_cache_write_string (fp, PK_MAP_PARSED_ENTRY_NAME (entry));
+      map_cache_write_string (fp, PK_MAP_PARSED_ENTRY_TYPE (entry));
+      map_cache_write_string (fp, PK_MAP_PARSED_ENTRY_OFFSET (entry));
+      map_cache_write_string (fp, PK_MAP_PARSED_ENTRY_CONDITION (entry));
+    }
+
+  write_ok = !ferror (fp);
+  if (fclose (fp) == EOF)
+    write_ok = 0;
+  if (!write_ok || rename (tmpname, filename) != 0)
+    goto error;
+
+  free (tmpname);
+  return;
+
+ error:
+  unlink (tmpname);
+  free (tmpname);
 }
 
 char *
@@ -594,9 +1149,10 @@ int
 pk_map_load_file (int ios_id,
                   const char *path, char **errmsg)
 {
-  char *emsg, *mapname;
-  FILE *fp;
-  pk_map_parsed_map parsed_map;
+  char *emsg, *mapname, *data, *cache_file;
+  size_t size;
+  int ret;
+  pk_map_parsed_map parsed_map = NULL;
 
   /* Do not attempt to load the mapfile if there is already a map with
      the same name defined in the IO space.  */
@@ -604,55 +1160,65 @@ pk_map_load_file (int ios_id,
   if (pk_map_search (ios_id, mapname) != NULL)
     {
       *errmsg = "map already loaded";
+      free (mapname);
       return 0;
     }
 
-  /* Open the file whose contents are to be parsed.  */
+  /* Read the contents of the file.  */
   if ((emsg = pk_file_readable (path)) != NULL)
     {
       *errmsg = emsg;
+      free (mapname);
       return 0;
     }
 
-  fp = fopen (path, "r");
-  if (!fp)
+  data = read_file (path, RF_BINARY, &size);
+  if (!data)
     {
       *errmsg = strerror (errno);
       free (mapname);
       return 0;
     }
 
-  /* Parse the file contents and close the file.  */
-  parsed_map = pk_map_parse_file (path, fp);
+  /* Try to get the parsed map from the cache, and parse the file
+     contents otherwise.  */
+  cache_file = map_cache_filename (data, size);
+  if (cache_file)
+    parsed_map = map_cache_load (cache_file);
+
   if (!parsed_map)
     {
-      if (errmsg)
-        *errmsg = "";
-      return 0;
-    }
+      parsed_map = pk_map_parse_buffer (path, data, size);
+      if (!parsed_map)
+        {
+          if (errmsg)
+            *errmsg = "";
+          goto error;
+        }
 
-  if (fclose (fp) == EOF)
-    {
-      *errmsg = strerror (errno);
-      free (mapname);
-      return 0;
+      if (cache_file)
+        map_cache_save (cache_file, parsed_map);
     }
 
   /* XXX */
   //  pk_map_print_parsed_map (parsed_map);
 
   /* Process the result.  */
-  if (!pk_map_load_parsed_map (ios_id,
-                               mapname,
-                               path,
-                               parsed_map))
-    {
-      free (mapname);
-      return 0;
-    }
+  ret = pk_map_load_parsed_map (ios_id,
+                                mapname,
+                                path,
+                                parsed_map);
+  pk_map_free_parsed_map (parsed_map);
+  free (cache_file);
+  free (data);
+  free (mapname);
+  return ret;
 
+ error:
+  free (cache_file);
+  free (data);
   free (mapname);
-  return 1;
+  return 0;
 }
 
 char *
@@ -662,7 +1228,7 @@ pk_map_resolve_map (const char *mapname, int filename_p)
   const char *map_load_path;
   char *full_filename = NULL;
 
-  val = pk_decl_val (poke_compiler, "map_load_path");
+  val = pk_decl_handle_val (map_load_path_handle);
   if (val == PK_NULL)
     pk_fatal ("couldn't get `map_load_path'");
 
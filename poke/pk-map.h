@@ -42,19 +42,31 @@
 
    OFFSET is the offset where the entry is mapped.
 
-   CHAIN is a pointer to another map entry, or NULL.  */
+   OFFSET_BITS and SIZE_BITS are the offset of the entry and the size
+   of the mapped value when the entry was added, in bits.
+
+   CHAIN is a pointer to another map entry, or NULL.
+
+   HASH_CHAIN is a pointer to the next entry in the same bucket of
+   the hash table of the map, or NULL.  */
 
 #define PK_MAP_ENTRY_NAME(ENTRY) ((ENTRY)->name)
 #define PK_MAP_ENTRY_VARNAME(ENTRY) ((ENTRY)->varname)
 #define PK_MAP_ENTRY_OFFSET(ENTRY) ((ENTRY)->offset)
+#define PK_MAP_ENTRY_OFFSET_BITS(ENTRY) ((ENTRY)->offset_bits)
+#define PK_MAP_ENTRY_SIZE_BITS(ENTRY) ((ENTRY)->size_bits)
 #define PK_MAP_ENTRY_CHAIN(ENTRY) ((ENTRY)->chain)
+#define PK_MAP_ENTRY_HASH_CHAIN(ENTRY) ((ENTRY)->hash_chain)
 
 struct pk_map_entry
 {
   char *name;
   char *varname;
   pk_val offset;
+  uint64_t offset_bits;
+  uint64_t size_bits;
   struct pk_map_entry *chain;
+  struct pk_map_entry *hash_chain;
 };
 
 typedef struct pk_map_entry *pk_map_entry;
@@ -69,7 +81,19 @@ typedef struct pk_map_entry *pk_map_entry;
    loaded from files, this contains the path of the file.  For maps
    created by the user using commands, this is NULL.
 
-   ENTRIES is a list of chained map entries.
+   ENTRIES is a list of chained map entries, and LAST_ENTRY is the
+   last entry in the list.  The list is sorted by offset only if
+   SORTED_P is set, so use pk_map_entries to traverse it.
+   NUM_ENTRIES is the number of entries in the map.
+
+   BUCKETS is a hash table with NUM_BUCKETS buckets, indexing the
+   entries by name.
+
+   BY_OFFSET is an array with the entries sorted by offset, valid
+   only if SORTED_P is set.  MAX_END[I] is the biggest end offset, in
+   bits, of the entries BY_OFFSET[0] to BY_OFFSET[I].  Together they
+   allow to find the entries covering a given offset without
+   traversing the whole map.
 
    CHAIN is a pointer to another pk map, or NULL.  */
 
@@ -77,6 +101,7 @@ typedef struct pk_map_entry *pk_map_entry;
 #define PK_MAP_NAME(MAP) ((MAP)->name)
 #define PK_MAP_SOURCE(MAP) ((MAP)->source)
 #define PK_MAP_ENTRIES(MAP) ((MAP)->entries)
+#define PK_MAP_NUM_ENTRIES(MAP) ((MAP)->num_entries)
 #define PK_MAP_CHAIN(MAP) ((MAP)->chain)
 
 struct pk_map
@@ -85,6 +110,13 @@ struct pk_map
   char *name;
   char *source;
   struct pk_map_entry *entries;
+  struct pk_map_entry *last_entry;
+  size_t num_entries;
+  struct pk_map_entry **buckets;
+  size_t num_buckets;
+  struct pk_map_entry **by_offset;
+  uint64_t *max_end;
+  int sorted_p;
   struct pk_map *chain;
 };
 
@@ -155,6 +187,27 @@ int pk_map_add_entry (int ios_id, const char *mapname,
 int pk_map_remove_entry (int ios_id, const char *mapname,
                          const char *varname);
 
+/* Return the first of the entries of MAP, which are chained in
+   ascending order of offset.  Entries mapped at the same offset are
+   kept in the order they were added.  */
+
+pk_map_entry pk_map_entries (pk_map map);
+
+/* Search for an entry by name in MAP.  Return NULL if there is no
+   entry with the given NAME.  */
+
+pk_map_entry pk_map_search_entry (pk_map map, const char *name);
+
+/* Find the entries of MAP covering the given OFFSET, in bits, i.e.
+   the entries whose mapped values contain the bit at OFFSET.
+
+   Return the number of entries found.  If it is not zero then
+   *ENTRIES is set to an array with the found entries, in ascending
+   order of offset, which should be freed by the caller.  */
+
+size_t pk_map_entries_at (pk_map map, uint64_t offset,
+                          pk_map_entry **entries);
+
 /* Initialize the global map.   */
 
 void pk_map_init (void);
@@ -0,0 +1,1273 @@
+/* pk-mi-cbor.c - Machine Interface CBOR encoding */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <xstrndup.h>
+
+#include "pk-mi-cbor.h"
+#include "pk-mi-msg.h"
+#include "libpoke.h"
+
+/* Messages are encoded as CBOR maps whose keys are text strings, with
+   the same structure and names used by the JSON encoding (see
+   pk-mi-json.c).  Integers are encoded as CBOR integers, strings as
+   CBOR text strings and booleans as CBOR simple values.
+
+   Poke values are encoded in a more compact way than in JSON, using
+   CBOR arrays whose first element identifies the kind of value:
+
+   PokeValue:: ( Null | Integer | UnsignedInteger | String | Offset
+                 | Struct | Array | Other )
+
+   Null:: null
+   Other:: undefined
+   Integer:: [ 0, size : uint, value : int ]
+   UnsignedInteger:: [ 1, size : uint, value : uint ]
+   String:: text
+   Offset:: [ 2, magnitude : ( Integer | UnsignedInteger ), unit : uint ]
+   Struct:: [ 3, name : ( text | null ), fields : [ *Field ], Mapping,
+              ? elided : true ]
+   Field:: [ name : ( text | null ), boffset : uint, value : PokeValue ]
+   Array:: [ 4, elements : [ *Element ], Mapping, ? elided : true ]
+   Element:: [ boffset : uint, value : PokeValue ]
+   Mapping:: ( null | [ ios : int, offset : Offset ] )
+
+   Structs and arrays whose contents are not sent, due to the depth
+   limit of a VALUE request, have no fields or elements and an extra
+   element set to true.
+
+   All the CBOR items use definite lengths, so the number of elements
+   of every array and map is known when its first element is read.  The
+   encoders emit the values as they traverse them, so big arrays are
+   not buffered.  */
+
+#define PK_MI_CBOR_UINT 0
+#define PK_MI_CBOR_NINT 1
+#define PK_MI_CBOR_BYTES 2
+#define PK_MI_CBOR_TEXT 3
+#define PK_MI_CBOR_ARRAY 4
+#define PK_MI_CBOR_MAP 5
+#define PK_MI_CBOR_TAG 6
+#define PK_MI_CBOR_SIMPLE 7
+
+#define PK_MI_CBOR_FALSE 20
+#define PK_MI_CBOR_TRUE 21
+#define PK_MI_CBOR_NULL 22
+#define PK_MI_CBOR_UNDEFINED 23
+
+#define PK_MI_CBOR_VAL_INT 0
+#define PK_MI_CBOR_VAL_UINT 1
+#define PK_MI_CBOR_VAL_OFFSET 2
+#define PK_MI_CBOR_VAL_STRUCT 3
+#define PK_MI_CBOR_VAL_ARRAY 4
+
+/* Maximum nesting of the CBOR items accepted by the decoder.  */
+
+#define PK_MI_CBOR_MAX_DEPTH 512
+
+/*** Encoder.  ***/
+
+struct cbor_out
+{
+  pk_mi_cbor_write_fn write;
+  void *data;
+};
+
+static void
+cbor_head (struct cbor_out *out, int major, uint64_t arg)
+{
+  unsigned char buf[9];
+  size_t len, i;
+
+  if (arg < 24)
+    {
+      buf[0] = major << 5 | arg;
+      len = 1;
+    }
+  else
+    {
+      if (arg <= 0xff)
+        {
+          buf[0] = major << 5 | 24;
+          len = 2;
+        }
+      else if (arg <= 0xffff)
+        {
+          buf[0] = major << 5 | 25;
+          len = 3;
+        }
+      else if (arg <= 0xffffffff)
+        {
+          buf[0] = major << 5 | 26;
+          len = 5;
+        }
+      else
+        {
+          buf[0] = major << 5 | 27;
+          len = 9;
+        }
+
+      for (i = len - 1; i > 0; --i, arg >>= 8)
+        buf[i] = arg & 0xff;
+    }
+
+  out->write (buf, len, out->data);
+}
+
+static void
+cbor_uint (struct cbor_out *out, uint64_t value)
+{
+  cbor_head (out, PK_MI_CBOR_UINT, value);
+}
+
+static void
+cbor_int (struct cbor_out *out, int64_t value)
+{
+  if (value >= 0)
+    cbor_head (out, PK_MI_CBOR_UINT, value);
+  else
+    cbor_head (out, PK_MI_CBOR_NINT, -(value + 1));
+}
+
+static void
+cbor_text (struct cbor_out *out, const char *str)
+{
+  size_t len = strlen (str);
+
+  cbor_head (out, PK_MI_CBOR_TEXT, len);
+  out->write (str, len, out->data);
+}
+
+static void
+cbor_simple (struct cbor_out *out, int value)
+{
+  cbor_head (out, PK_MI_CBOR_SIMPLE, value);
+}
+
+/* Encode a key of a map, followed by the head of an integer value.  */
+
+static void
+cbor_key_int (struct cbor_out *out, const char *key, int64_t value)
+{
+  cbor_text (out, key);
+  cbor_int (out, value);
+}
+
+/* Encode either a Poke string or PK_NULL.  */
+
+static void
+cbor_string_or_null (struct cbor_out *out, pk_val str)
+{
+  if (str == PK_NULL)
+    cbor_simple (out, PK_MI_CBOR_NULL);
+  else
+    cbor_text (out, pk_string_str (str));
+}
+
+static void cbor_val_1 (struct cbor_out *out, pk_val val,
+                        const struct pk_mi_val_params *params,
+                        int level, int fields_p);
+
+static void
+cbor_val (struct cbor_out *out, pk_val val)
+{
+  cbor_val_1 (out, val, NULL, 0, 0);
+}
+
+static void
+cbor_mapping (struct cbor_out *out, pk_val val)
+{
+  if (!pk_val_mapped_p (val))
+    {
+      cbor_simple (out, PK_MI_CBOR_NULL);
+      return;
+    }
+
+  cbor_head (out, PK_MI_CBOR_ARRAY, 2);
+  cbor_int (out, pk_int_value (pk_val_ios (val)));
+  cbor_val (out, pk_val_offset (val));
+}
+
+/* Return whether the field IDX of the struct SCT is selected by
+   PARAMS.  */
+
+static int
+cbor_field_p (pk_val sct, uint64_t idx,
+              const struct pk_mi_val_params *params, int fields_p)
+{
+  pk_val name = pk_struct_field_name (sct, idx);
+
+  return (!fields_p
+          || pk_mi_val_params_field_p (params,
+                                       name == PK_NULL
+                                       ? NULL : pk_string_str (name)));
+}
+
+/* Encode VAL, located at nesting level LEVEL.  PARAMS selects the
+   parts of the value to encode.  FIELDS_P tells whether the field
+   selection of PARAMS applies to VAL.  */
+
+static void
+cbor_val_1 (struct cbor_out *out, pk_val val,
+            const struct pk_mi_val_params *params, int level, int fields_p)
+{
+  if (val == PK_NULL)
+    {
+      cbor_simple (out, PK_MI_CBOR_NULL);
+      return;
+    }
+
+  switch (pk_type_code (pk_typeof (val)))
+    {
+    case PK_INT:
+      cbor_head (out, PK_MI_CBOR_ARRAY, 3);
+      cbor_uint (out, PK_MI_CBOR_VAL_INT);
+      cbor_uint (out, pk_int_size (val));
+      cbor_int (out, pk_int_value (val));
+      break;
+    case PK_UINT:
+      cbor_head (out, PK_MI_CBOR_ARRAY, 3);
+      cbor_uint (out, PK_MI_CBOR_VAL_UINT);
+      cbor_uint (out, pk_uint_size (val));
+      cbor_uint (out, pk_uint_value (val));
+      break;
+    case PK_STRING:
+      cbor_text (out, pk_string_str (val));
+      break;
+    case PK_OFFSET:
+      cbor_head (out, PK_MI_CBOR_ARRAY, 3);
+      cbor_uint (out, PK_MI_CBOR_VAL_OFFSET);
+      cbor_val (out, pk_offset_magnitude (val));
+      cbor_uint (out, pk_uint_value (pk_offset_unit (val)));
+      break;
+    case PK_STRUCT:
+      {
+        int elided_p = pk_mi_val_params_elided_p (params, level);
+        uint64_t i, nfields = pk_uint_value (pk_struct_nfields (val));
+        uint64_t nselected = 0;
+
+        cbor_head (out, PK_MI_CBOR_ARRAY, 4 + elided_p);
+        cbor_uint (out, PK_MI_CBOR_VAL_STRUCT);
+        cbor_string_or_null (out, pk_struct_type_name (pk_struct_type (val)));
+
+        /* The number of fields goes before the fields.  */
+        if (elided_p)
+          nfields = 0;
+        for (i = 0; i < nfields; ++i)
+          nselected += cbor_field_p (val, i, params, fields_p);
+
+        cbor_head (out, PK_MI_CBOR_ARRAY, nselected);
+        for (i = 0; i < nfields; ++i)
+          {
+            if (!cbor_field_p (val, i, params, fields_p))
+              continue;
+
+            cbor_head (out, PK_MI_CBOR_ARRAY, 3);
+            cbor_string_or_null (out, pk_struct_field_name (val, i));
+            cbor_uint (out,
+                       pk_uint_value (pk_struct_field_boffset (val, i)));
+            cbor_val_1 (out, pk_struct_field_value (val, i),
+                        params, level + 1, 0);
+          }
+
+        cbor_mapping (out, val);
+        if (elided_p)
+          cbor_simple (out, PK_MI_CBOR_TRUE);
+        break;
+      }
+    case PK_ARRAY:
+      {
+        int elided_p = pk_mi_val_params_elided_p (params, level);
+        uint64_t i, from, to;
+
+        cbor_head (out, PK_MI_CBOR_ARRAY, 3 + elided_p);
+        cbor_uint (out, PK_MI_CBOR_VAL_ARRAY);
+
+        pk_mi_val_params_range (params, level,
+                                (elided_p
+                                 ? 0 : pk_uint_value (pk_array_nelem (val))),
+                                &from, &to);
+        cbor_head (out, PK_MI_CBOR_ARRAY, to - from);
+        for (i = from; i < to; ++i)
+          {
+            cbor_head (out, PK_MI_CBOR_ARRAY, 2);
+            cbor_uint (out, pk_uint_value (pk_array_elem_boffset (val, i)));
+            cbor_val_1 (out, pk_array_elem_val (val, i),
+                        params, level + 1, level == 0);
+          }
+
+        cbor_mapping (out, val);
+        if (elided_p)
+          cbor_simple (out, PK_MI_CBOR_TRUE);
+        break;
+      }
+    default:
+      cbor_simple (out, PK_MI_CBOR_UNDEFINED);
+      break;
+    }
+}
+
+void
+pk_mi_val_to_cbor (pk_val val, pk_mi_cbor_write_fn write, void *data)
+{
+  struct cbor_out out = { write, data };
+
+  cbor_val (&out, val);
+}
+
+/* The fields of struct pk_ios_stats, in the order they are
+   serialized.  */
+
+#define PK_MI_IOS_STATS_FIELDS                  \
+  PK_MI_IOS_STATS_FIELD (reads)                 \
+  PK_MI_IOS_STATS_FIELD (read_bytes)            \
+  PK_MI_IOS_STATS_FIELD (writes)                \
+  PK_MI_IOS_STATS_FIELD (written_bytes)         \
+  PK_MI_IOS_STATS_FIELD (dev_reads)             \
+  PK_MI_IOS_STATS_FIELD (dev_read_bytes)        \
+  PK_MI_IOS_STATS_FIELD (dev_writes)            \
+  PK_MI_IOS_STATS_FIELD (dev_written_bytes)     \
+  PK_MI_IOS_STATS_FIELD (dev_seeks)             \
+  PK_MI_IOS_STATS_FIELD (dev_nsecs)             \
+  PK_MI_IOS_STATS_FIELD (cache_hits)            \
+  PK_MI_IOS_STATS_FIELD (cache_misses)
+
+#define PK_MI_IOS_STATS_NFIELDS 12
+
+void
+pk_mi_msg_to_cbor (pk_mi_msg msg, pk_mi_cbor_write_fn write, void *data)
+{
+  struct cbor_out out = { write, data };
+  enum pk_mi_msg_type msg_type = pk_mi_msg_type (msg);
+
+  cbor_head (&out, PK_MI_CBOR_MAP, 3);
+  cbor_key_int (&out, "seq", pk_mi_msg_number (msg));
+  cbor_key_int (&out, "type", msg_type);
+  cbor_text (&out, "data");
+
+  switch (msg_type)
+    {
+    case PK_MI_MSG_REQUEST:
+      {
+        enum pk_mi_req_type req_type = pk_mi_msg_req_type (msg);
+
+        cbor_head (&out, PK_MI_CBOR_MAP, req_type == PK_MI_REQ_EXIT ? 1 : 2);
+        cbor_key_int (&out, "type", req_type);
+
+        switch (req_type)
+          {
+          case PK_MI_REQ_EXIT:
+            /* Request has no args.  */
+            break;
+          case PK_MI_REQ_IOS_STATS:
+            cbor_text (&out, "args");
+            cbor_head (&out, PK_MI_CBOR_MAP, 1);
+            cbor_key_int (&out, "ios", pk_mi_msg_req_ios_stats_ios (msg));
+            break;
+          case PK_MI_REQ_ENCODING:
+            cbor_text (&out, "args");
+            cbor_head (&out, PK_MI_CBOR_MAP, 1);
+            cbor_text (&out, "encoding");
+            cbor_text (&out, pk_mi_msg_req_encoding_encoding (msg));
+            break;
+          case PK_MI_REQ_VALUE:
+            {
+              const struct pk_mi_val_params *params
+                = pk_mi_msg_req_value_params (msg);
+              const char *p, *end;
+              uint64_t nfields = 0;
+
+              cbor_text (&out, "args");
+              cbor_head (&out, PK_MI_CBOR_MAP,
+                         1 + (params->from != 0)
+                         + (params->count != PK_MI_VAL_ALL)
+                         + (params->depth >= 0)
+                         + (params->fields != NULL));
+              cbor_text (&out, "expr");
+              cbor_text (&out, pk_mi_msg_req_value_expr (msg));
+              if (params->from != 0)
+                {
+                  cbor_text (&out, "from");
+                  cbor_uint (&out, params->from);
+                }
+              if (params->count != PK_MI_VAL_ALL)
+                {
+                  cbor_text (&out, "count");
+                  cbor_uint (&out, params->count);
+                }
+              if (params->depth >= 0)
+                cbor_key_int (&out, "depth", params->depth);
+              if (params->fields)
+                {
+                  /* The comma separated list of fields is sent as an
+                     array of text strings.  */
+                  cbor_text (&out, "fields");
+                  for (nfields = 1, p = params->fields; *p != '\0'; ++p)
+                    nfields += (*p == ',');
+                  cbor_head (&out, PK_MI_CBOR_ARRAY, nfields);
+                  for (p = params->fields; ; p = end + 1)
+                    {
+                      size_t len;
+
+                      end = strchr (p, ',');
+                      len = end ? end - p : strlen (p);
+                      cbor_head (&out, PK_MI_CBOR_TEXT, len);
+                      write (p, len, data);
+                      if (!end)
+                        break;
+                    }
+                }
+              break;
+            }
+          default:
+            assert (0);
+          }
+        break;
+      }
+    case PK_MI_MSG_RESPONSE:
+      {
+        enum pk_mi_resp_type resp_type = pk_mi_msg_resp_type (msg);
+        int success_p = pk_mi_msg_resp_success_p (msg);
+        const char *errmsg = pk_mi_msg_resp_errmsg (msg);
+        int result_p = (success_p
+                        && (resp_type == PK_MI_RESP_IOS_STATS
+                            || resp_type == PK_MI_RESP_VALUE));
+
+        cbor_head (&out, PK_MI_CBOR_MAP,
+                   3 + (errmsg != NULL) + result_p);
+        cbor_key_int (&out, "type", resp_type);
+        cbor_text (&out, "success_p");
+        cbor_simple (&out, success_p ? PK_MI_CBOR_TRUE : PK_MI_CBOR_FALSE);
+        cbor_key_int (&out, "req_number", pk_mi_msg_resp_req_number (msg));
+        if (errmsg)
+          {
+            cbor_text (&out, "errmsg");
+            cbor_text (&out, errmsg);
+          }
+
+        if (!result_p)
+          break;
+
+        cbor_text (&out, "result");
+        switch (resp_type)
+          {
+          case PK_MI_RESP_IOS_STATS:
+            {
+              const struct pk_ios_stats *stats
+                = pk_mi_msg_resp_ios_stats_stats (msg);
+
+              cbor_head (&out, PK_MI_CBOR_MAP, PK_MI_IOS_STATS_NFIELDS);
+#define PK_MI_IOS_STATS_FIELD(NAME)             \
+              cbor_text (&out, #NAME);          \
+              cbor_uint (&out, stats->NAME);
+
+              PK_MI_IOS_STATS_FIELDS
+#undef PK_MI_IOS_STATS_FIELD
+              break;
+            }
+          case PK_MI_RESP_VALUE:
+            {
+              pk_val val = pk_mi_msg_resp_value_val (msg);
+              int array_p = (val != PK_NULL
+                             && pk_type_code (pk_typeof (val)) == PK_ARRAY);
+
+              cbor_head (&out, PK_MI_CBOR_MAP, 1 + array_p);
+              cbor_text (&out, "value");
+              cbor_val_1 (&out, val, pk_mi_msg_resp_value_params (msg),
+                          0, 1);
+              if (array_p)
+                {
+                  cbor_text (&out, "nelem");
+                  cbor_uint (&out, pk_uint_value (pk_array_nelem (val)));
+                }
+              break;
+            }
+          default:
+            assert (0);
+          }
+        break;
+      }
+    case PK_MI_MSG_EVENT:
+      {
+        enum pk_mi_event_type event_type = pk_mi_msg_event_type (msg);
+
+        cbor_head (&out, PK_MI_CBOR_MAP, 2);
+        cbor_key_int (&out, "type", event_type);
+
+        switch (event_type)
+          {
+          case PK_MI_EVENT_INITIALIZED:
+            cbor_text (&out, "args");
+            cbor_head (&out, PK_MI_CBOR_MAP, 2);
+            cbor_key_int (&out, "mi_version",
+                          pk_mi_msg_event_initialized_mi_version (msg));
+            cbor_text (&out, "version");
+            cbor_text (&out, pk_mi_msg_event_initialized_version (msg));
+            break;
+          case PK_MI_EVENT_IOS_CHANGED:
+            {
+              const uint64_t *ranges
+                = pk_mi_msg_event_ios_changed_ranges (msg);
+              size_t i, nranges = pk_mi_msg_event_ios_changed_nranges (msg);
+
+              cbor_text (&out, "args");
+              cbor_head (&out, PK_MI_CBOR_MAP, 2);
+              cbor_key_int (&out, "ios",
+                            pk_mi_msg_event_ios_changed_ios (msg));
+              cbor_text (&out, "ranges");
+              cbor_head (&out, PK_MI_CBOR_ARRAY, nranges);
+              for (i = 0; i < nranges; ++i)
+                {
+                  cbor_head (&out, PK_MI_CBOR_ARRAY, 2);
+                  cbor_uint (&out, ranges[2 * i]);
+                  cbor_uint (&out, ranges[2 * i + 1]);
+                }
+              break;
+            }
+          default:
+            assert (0);
+          }
+        break;
+      }
+    default:
+      assert (0);
+    }
+}
+
+/*** Decoder.  ***/
+
+/* The decoder operates on a buffer.  P points to the next byte to
+   decode and END to the end of the buffer.  */
+
+struct cbor_in
+{
+  const unsigned char *p;
+  const unsigned char *end;
+};
+
+/* Decode the head of an item, storing its major type in *MAJOR and
+   its argument in *ARG.  Indefinite lengths are not supported.
+   Return 0 if there is no valid head in IN.  */
+
+static int
+cbor_read_head (struct cbor_in *in, int *major, uint64_t *arg)
+{
+  int info, len;
+
+  if (in->p == in->end)
+    return 0;
+
+  *major = *in->p >> 5;
+  info = *in->p++ & 0x1f;
+
+  if (info < 24)
+    {
+      *arg = info;
+      return 1;
+    }
+
+  if (info > 27)
+    return 0;
+
+  len = 1 << (info - 24);
+  if (in->end - in->p < len)
+    return 0;
+
+  for (*arg = 0; len > 0; --len)
+    *arg = *arg << 8 | *in->p++;
+
+  return 1;
+}
+
+/* Return the major type of the next item in IN, or -1 if there are
+   no more items.  */
+
+static int
+cbor_peek_major (struct cbor_in *in)
+{
+  return in->p == in->end ? -1 : *in->p >> 5;
+}
+
+/* Return whether the next item in IN is either null or undefined,
+   skipping it if so.  */
+
+static int
+cbor_read_null (struct cbor_in *in)
+{
+  if (in->p != in->end
+      && (*in->p == (PK_MI_CBOR_SIMPLE << 5 | PK_MI_CBOR_NULL)
+          || *in->p == (PK_MI_CBOR_SIMPLE << 5 | PK_MI_CBOR_UNDEFINED)))
+    {
+      in->p++;
+      return 1;
+    }
+
+  return 0;
+}
+
+static int
+cbor_skip (struct cbor_in *in, int depth)
+{
+  int major;
+  uint64_t arg, i;
+
+  if (depth > PK_MI_CBOR_MAX_DEPTH
+      || !cbor_read_head (in, &major, &arg))
+    return 0;
+
+  switch (major)
+    {
+    case PK_MI_CBOR_BYTES:
+    case PK_MI_CBOR_TEXT:
+      if ((uint64_t) (in->end - in->p) < arg)
+        return 0;
+      in->p += arg;
+      return 1;
+    case PK_MI_CBOR_MAP:
+      if (arg > UINT64_MAX / 2)
+        return 0;
+      arg *= 2;
+      /* Fallthrough.  */
+    case PK_MI_CBOR_ARRAY:
+      for (i = 0; i < arg; ++i)
+        if (!cbor_skip (in, depth + 1))
+          return 0;
+      return 1;
+    case PK_MI_CBOR_TAG:
+      return cbor_skip (in, depth + 1);
+    default:
+      return 1;
+    }
+}
+
+static int
+cbor_read_uint (struct cbor_in *in, uint64_t *value)
+{
+  int major;
+
+  return (cbor_read_head (in, &major, value)
+          && major == PK_MI_CBOR_UINT);
+}
+
+static int
+cbor_read_int (struct cbor_in *in, int64_t *value)
+{
+  int major;
+  uint64_t arg;
+
+  if (!cbor_read_head (in, &major, &arg))
+    return 0;
+
+  if (major == PK_MI_CBOR_UINT)
+    *value = (int64_t) arg;
+  else if (major == PK_MI_CBOR_NINT)
+    *value = -1 - (int64_t) arg;
+  else
+    return 0;
+
+  return 1;
+}
+
+static int
+cbor_read_bool (struct cbor_in *in, int *value)
+{
+  int major;
+  uint64_t arg;
+
+  if (!cbor_read_head (in, &major, &arg)
+      || major != PK_MI_CBOR_SIMPLE
+      || (arg != PK_MI_CBOR_TRUE && arg != PK_MI_CBOR_FALSE))
+    return 0;
+
+  *value = (arg == PK_MI_CBOR_TRUE);
+  return 1;
+}
+
+/* Decode a text string, and return a copy of it in *STR.  The copy
+   should be freed by the caller.  */
+
+static int
+cbor_read_text (struct cbor_in *in, char **str)
+{
+  int major;
+  uint64_t len;
+
+  if (!cbor_read_head (in, &major, &len)
+      || major != PK_MI_CBOR_TEXT
+      || (uint64_t) (in->end - in->p) < len)
+    return 0;
+
+  *str = xstrndup ((const char *) in->p, len);
+  in->p += len;
+  return 1;
+}
+
+/* Decode the head of an array having NELEM elements.  */
+
+static int
+cbor_read_array (struct cbor_in *in, uint64_t nelem)
+{
+  int major;
+  uint64_t arg;
+
+  return (cbor_read_head (in, &major, &arg)
+          && major == PK_MI_CBOR_ARRAY && arg == nelem);
+}
+
+/* Look for KEY in the map located at MAP.  If found, set VALUE to
+   the location of the associated value and return 1.  Return 0
+   otherwise.  */
+
+static int
+cbor_map_get (struct cbor_in map, const char *key, struct cbor_in *value)
+{
+  int major;
+  uint64_t npairs, i, len;
+  size_t key_len = strlen (key);
+
+  if (!cbor_read_head (&map, &major, &npairs)
+      || major != PK_MI_CBOR_MAP)
+    return 0;
+
+  for (i = 0; i < npairs; ++i)
+    {
+      if (!cbor_read_head (&map, &major, &len)
+          || major != PK_MI_CBOR_TEXT
+          || (uint64_t) (map.end - map.p) < len)
+        return 0;
+
+      if (len == key_len && memcmp (map.p, key, len) == 0)
+        {
+          map.p += len;
+          *value = map;
+          return 1;
+        }
+
+      map.p += len;
+      if (!cbor_skip (&map, 0))
+        return 0;
+    }
+
+  return 0;
+}
+
+static int
+cbor_map_get_int (struct cbor_in map, const char *key, int64_t *value)
+{
+  struct cbor_in in;
+
+  return (cbor_map_get (map, key, &in)
+          && cbor_read_int (&in, value));
+}
+
+static int
+cbor_map_get_text (struct cbor_in map, const char *key, char **str)
+{
+  struct cbor_in in;
+
+  return (cbor_map_get (map, key, &in)
+          && cbor_read_text (&in, str));
+}
+
+static int cbor_to_val (struct cbor_in *in, pk_val *val, int depth);
+
+static int
+cbor_to_string_or_null (struct cbor_in *in, pk_val *val)
+{
+  char *str;
+
+  if (cbor_read_null (in))
+    {
+      *val = PK_NULL;
+      return 1;
+    }
+
+  if (!cbor_read_text (in, &str))
+    return 0;
+
+  *val = pk_make_string (str);
+  free (str);
+  return 1;
+}
+
+/* Each field of a struct and each element of an array takes at least
+   three bytes of the input, so N elements can't be decoded from IN if
+   less than 3 * N bytes remain.  This is checked before allocating
+   the values, so a short message can't ask for a huge allocation.  */
+
+static int
+cbor_count_p (struct cbor_in *in, uint64_t n)
+{
+  return n <= (uint64_t) (in->end - in->p) / 3;
+}
+
+static int
+cbor_to_sct (struct cbor_in *in, pk_val *val, int depth)
+{
+  pk_val name, nfields, sct_type, sct, *fnames, *ftypes;
+  uint64_t i, n;
+  int major;
+
+  if (!cbor_to_string_or_null (in, &name)
+      || !cbor_read_head (in, &major, &n)
+      || major != PK_MI_CBOR_ARRAY
+      || !cbor_count_p (in, n))
+    return 0;
+
+  nfields = pk_make_uint (n, 64);
+  pk_allocate_struct_attrs (nfields, &fnames, &ftypes);
+  sct_type = pk_make_struct_type (nfields, name, fnames, ftypes);
+  sct = pk_make_struct (nfields, sct_type);
+
+  for (i = 0; i < n; ++i)
+    {
+      pk_val fname, fvalue;
+      uint64_t boffset;
+
+      if (!cbor_read_array (in, 3)
+          || !cbor_to_string_or_null (in, &fname)
+          || !cbor_read_uint (in, &boffset)
+          || !cbor_to_val (in, &fvalue, depth + 1))
+        return 0;
+
+      pk_struct_type_set_fname (sct_type, i, fname);
+      pk_struct_type_set_ftype (sct_type, i,
+                                fvalue == PK_NULL
+                                ? pk_make_any_type () : pk_typeof (fvalue));
+      pk_struct_set_field_boffset (sct, i, pk_make_uint (boffset, 64));
+      pk_struct_set_field_name (sct, i, fname);
+      pk_struct_set_field_value (sct, i, fvalue);
+    }
+
+  /* The mapping is ignored: the decoded value is not mapped.  */
+  if (!cbor_skip (in, depth))
+    return 0;
+
+  *val = sct;
+  return 1;
+}
+
+static int
+cbor_to_array (struct cbor_in *in, pk_val *val, int depth)
+{
+  pk_val array = PK_NULL;
+  uint64_t i, n;
+  int major;
+
+  if (!cbor_read_head (in, &major, &n)
+      || major != PK_MI_CBOR_ARRAY
+      || !cbor_count_p (in, n))
+    return 0;
+
+  if (n == 0)
+    array = pk_make_array (pk_make_uint (0, 64),
+                           pk_make_array_type (pk_make_any_type (),
+                                               PK_NULL));
+
+  for (i = 0; i < n; ++i)
+    {
+      pk_val elem;
+      uint64_t boffset;
+
+      if (!cbor_read_array (in, 2)
+          || !cbor_read_uint (in, &boffset)
+          || !cbor_to_val (in, &elem, depth + 1)
+          || elem == PK_NULL)
+        return 0;
+
+      /* The type of the array is the type of its first element.  */
+      if (i == 0)
+        array = pk_make_array (pk_make_uint (n, 64),
+                               pk_make_array_type (pk_typeof (elem),
+                                                   PK_NULL));
+      pk_array_insert_elem (array, i, elem);
+    }
+
+  /* The mapping is ignored: the decoded value is not mapped.  */
+  if (!cbor_skip (in, depth))
+    return 0;
+
+  *val = array;
+  return 1;
+}
+
+static int
+cbor_to_val (struct cbor_in *in, pk_val *val, int depth)
+{
+  uint64_t nelem, kind, size, arg;
+  int major;
+
+  if (depth > PK_MI_CBOR_MAX_DEPTH)
+    return 0;
+
+  if (cbor_read_null (in))
+    {
+      *val = PK_NULL;
+      return 1;
+    }
+
+  if (cbor_peek_major (in) == PK_MI_CBOR_TEXT)
+    return cbor_to_string_or_null (in, val);
+
+  if (!cbor_read_head (in, &major, &nelem)
+      || major != PK_MI_CBOR_ARRAY
+      || nelem < 3
+      || !cbor_read_uint (in, &kind))
+    return 0;
+
+  switch (kind)
+    {
+    case PK_MI_CBOR_VAL_INT:
+    case PK_MI_CBOR_VAL_UINT:
+      {
+        int64_t value;
+
+        if (nelem != 3
+            || !cbor_read_uint (in, &size) || size < 1 || size > 64)
+          return 0;
+
+        if (kind == PK_MI_CBOR_VAL_INT)
+          {
+            if (!cbor_read_int (in, &value))
+              return 0;
+            *val = pk_make_int (value, size);
+          }
+        else
+          {
+            if (!cbor_read_uint (in, &arg))
+              return 0;
+            *val = pk_make_uint (arg, size);
+          }
+        break;
+      }
+    case PK_MI_CBOR_VAL_OFFSET:
+      {
+        pk_val magnitude;
+        int code;
+
+        if (nelem != 3
+            || !cbor_to_val (in, &magnitude, depth + 1)
+            || magnitude == PK_NULL
+            || ((code = pk_type_code (pk_typeof (magnitude))) != PK_INT
+                && code != PK_UINT)
+            || !cbor_read_uint (in, &arg))
+          return 0;
+
+        *val = pk_make_offset (magnitude, pk_make_uint (arg, 64));
+        break;
+      }
+    case PK_MI_CBOR_VAL_STRUCT:
+    case PK_MI_CBOR_VAL_ARRAY:
+      {
+        /* Elided structs and arrays have an extra element.  */
+        uint64_t base = kind == PK_MI_CBOR_VAL_STRUCT ? 4 : 3;
+        int elided_p;
+
+        if ((nelem != base && nelem != base + 1)
+            || !(kind == PK_MI_CBOR_VAL_STRUCT
+                 ? cbor_to_sct (in, val, depth)
+                 : cbor_to_array (in, val, depth)))
+          return 0;
+
+        if (nelem == base + 1
+            && (!cbor_read_bool (in, &elided_p) || !elided_p))
+          return 0;
+        break;
+      }
+    default:
+      return 0;
+    }
+
+  return *val != PK_NULL;
+}
+
+int
+pk_mi_cbor_to_val (pk_val *value, const void *buf, size_t size)
+{
+  struct cbor_in in = { buf, (const unsigned char *) buf + size };
+
+  return cbor_to_val (&in, value, 0) && in.p == in.end;
+}
+
+static int
+cbor_to_ios_stats (struct cbor_in map, struct pk_ios_stats *stats)
+{
+  struct cbor_in in;
+
+#define PK_MI_IOS_STATS_FIELD(NAME)                     \
+  if (!cbor_map_get (map, #NAME, &in)                   \
+      || !cbor_read_uint (&in, &stats->NAME))           \
+    return 0;
+
+  PK_MI_IOS_STATS_FIELDS
+
+#undef PK_MI_IOS_STATS_FIELD
+
+  return 1;
+}
+
+/* Fill PARAMS with the value parameters in the map ARGS.  The list
+   of fields, if any, is allocated and should be freed by the
+   caller.  Return 0 if ARGS is not valid, 1 otherwise.  */
+
+static int
+cbor_to_val_params (struct cbor_in args, struct pk_mi_val_params *params)
+{
+  struct cbor_in in, names;
+  int64_t depth;
+  uint64_t nfields, i, len;
+  int major;
+  char *p;
+
+  params->from = 0;
+  params->count = PK_MI_VAL_ALL;
+  params->depth = -1;
+  params->fields = NULL;
+
+  if ((cbor_map_get (args, "from", &in)
+       && !cbor_read_uint (&in, &params->from))
+      || (cbor_map_get (args, "count", &in)
+          && !cbor_read_uint (&in, &params->count)))
+    return 0;
+
+  if (cbor_map_get_int (args, "depth", &depth))
+    params->depth = depth < 0 ? -1 : depth > INT_MAX ? INT_MAX : depth;
+
+  if (!cbor_map_get (args, "fields", &in))
+    return 1;
+
+  /* The fields are stored as a comma separated list.  Their total
+     length is computed first.  */
+  if (!cbor_read_head (&in, &major, &nfields)
+      || major != PK_MI_CBOR_ARRAY)
+    return 0;
+
+  names = in;
+  for (len = 0, i = 0; i < nfields; ++i)
+    {
+      uint64_t name_len;
+
+      if (!cbor_read_head (&in, &major, &name_len)
+          || major != PK_MI_CBOR_TEXT
+          || (uint64_t) (in.end - in.p) < name_len)
+        return 0;
+      in.p += name_len;
+      len += name_len + 1;
+    }
+
+  params->fields = p = malloc (len + 1);
+  if (!p)
+    return 0;
+  *p = '\0';
+
+  for (i = 0; i < nfields; ++i)
+    {
+      uint64_t name_len;
+
+      cbor_read_head (&names, &major, &name_len);
+      if (i > 0)
+        *p++ = ',';
+      memcpy (p, names.p, name_len);
+      p += name_len;
+      *p = '\0';
+      names.p += name_len;
+    }
+
+  return 1;
+}
+
+pk_mi_msg
+pk_mi_cbor_to_msg (const void *buf, size_t size)
+{
+  struct cbor_in json = { buf, (const unsigned char *) buf + size };
+  struct cbor_in data, args, obj;
+  int64_t number, msg_type, type;
+  pk_mi_msg msg = NULL;
+
+  if (!cbor_map_get_int (json, "seq", &number)
+      || !cbor_map_get_int (json, "type", &msg_type)
+      || !cbor_map_get (json, "data", &data)
+      || !cbor_map_get_int (data, "type", &type))
+    return NULL;
+
+  switch (msg_type)
+    {
+    case PK_MI_MSG_REQUEST:
+      switch (type)
+        {
+        case PK_MI_REQ_EXIT:
+          msg = pk_mi_make_req_exit ();
+          break;
+        case PK_MI_REQ_IOS_STATS:
+          {
+            int64_t ios;
+
+            if (!cbor_map_get (data, "args", &args)
+                || !cbor_map_get_int (args, "ios", &ios))
+              return NULL;
+
+            msg = pk_mi_make_req_ios_stats (ios);
+            break;
+          }
+        case PK_MI_REQ_ENCODING:
+        case PK_MI_REQ_VALUE:
+          {
+            char *str;
+
+            if (!cbor_map_get (data, "args", &args)
+                || !cbor_map_get_text (args,
+                                       (type == PK_MI_REQ_ENCODING
+                                        ? "encoding" : "expr"),
+                                       &str))
+              return NULL;
+
+            if (type == PK_MI_REQ_ENCODING)
+              msg = pk_mi_make_req_encoding (str);
+            else
+              {
+                struct pk_mi_val_params params;
+
+                if (cbor_to_val_params (args, &params))
+                  msg = pk_mi_make_req_value (str, &params);
+                free (params.fields);
+              }
+            free (str);
+            break;
+          }
+        default:
+          return NULL;
+        }
+      break;
+    case PK_MI_MSG_RESPONSE:
+      {
+        int64_t req_number;
+        int success_p;
+        char *errmsg = NULL;
+
+        if (!cbor_map_get_int (data, "req_number", &req_number)
+            || !cbor_map_get (data, "success_p", &obj)
+            || !cbor_read_bool (&obj, &success_p)
+            || (!success_p && !cbor_map_get_text (data, "errmsg", &errmsg)))
+          return NULL;
+
+        switch (type)
+          {
+          case PK_MI_RESP_EXIT:
+            msg = pk_mi_make_resp_exit (req_number, success_p, errmsg);
+            break;
+          case PK_MI_RESP_ENCODING:
+            msg = pk_mi_make_resp_encoding (req_number, success_p, errmsg);
+            break;
+          case PK_MI_RESP_IOS_STATS:
+            {
+              struct pk_ios_stats stats;
+
+              if (success_p
+                  && (!cbor_map_get (data, "result", &obj)
+                      || !cbor_to_ios_stats (obj, &stats)))
+                break;
+
+              msg = pk_mi_make_resp_ios_stats (req_number, success_p,
+                                               errmsg, &stats);
+              break;
+            }
+          case PK_MI_RESP_VALUE:
+            {
+              pk_val val = PK_NULL;
+
+              if (success_p
+                  && (!cbor_map_get (data, "result", &obj)
+                      || !cbor_map_get (obj, "value", &obj)
+                      || !cbor_to_val (&obj, &val, 0)))
+                break;
+
+              msg = pk_mi_make_resp_value (req_number, success_p,
+                                           errmsg, val, NULL);
+              break;
+            }
+          default:
+            break;
+          }
+
+        free (errmsg);
+        break;
+      }
+    case PK_MI_MSG_EVENT:
+      switch (type)
+        {
+        case PK_MI_EVENT_INITIALIZED:
+          {
+            char *version;
+
+            if (!cbor_map_get (data, "args", &args)
+                || !cbor_map_get_text (args, "version", &version))
+              return NULL;
+
+            msg = pk_mi_make_event_initialized (version);
+            free (version);
+            break;
+          }
+        case PK_MI_EVENT_IOS_CHANGED:
+          {
+            int64_t ios;
+            uint64_t i, nranges;
+            uint64_t *ranges;
+            int major;
+
+            if (!cbor_map_get (data, "args", &args)
+                || !cbor_map_get_int (args, "ios", &ios)
+                || !cbor_map_get (args, "ranges", &obj)
+                || !cbor_read_head (&obj, &major, &nranges)
+                || major != PK_MI_CBOR_ARRAY
+                || nranges > (uint64_t) (obj.end - obj.p))
+              return NULL;
+
+            ranges = malloc (2 * nranges * sizeof (uint64_t) + 1);
+            if (!ranges)
+              return NULL;
+
+            for (i = 0; i < nranges; ++i)
+              if (!cbor_read_array (&obj, 2)
+                  || !cbor_read_uint (&obj, &ranges[2 * i])
+                  || !cbor_read_uint (&obj, &ranges[2 * i + 1]))
+                {
+                  free (ranges);
+                  return NULL;
+                }
+
+            msg = pk_mi_make_event_ios_changed (ios, nranges, ranges);
+            free (ranges);
+            break;
+          }
+        default:
+          return NULL;
+        }
+      break;
+    default:
+      return NULL;
+    }
+
+  if (msg)
+    pk_mi_set_msg_number (msg, number);
+  return msg;
+}
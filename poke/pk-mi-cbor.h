@@ -0,0 +1,67 @@
+/* pk-mi-cbor.h - Machine Interface CBOR encoding */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PK_MI_CBOR
+#define PK_MI_CBOR
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "pk-mi-msg.h"
+#include "libpoke.h"
+
+/* The CBOR encoding of MI messages is a compact binary alternative to
+   the JSON encoding, described in RFC 8949.  It is selected by the
+   client with an ENCODING request.
+
+   The encoders below don't build the encoded message in memory.
+   Instead, they pass the encoded bytes to a WRITE function as they
+   are produced, along with the pointer DATA.  This allows sending big
+   values in several frame messages.  */
+
+typedef void (*pk_mi_cbor_write_fn) (const void *buf, size_t size,
+                                     void *data);
+
+/* Encode the MI message MSG.  */
+
+void pk_mi_msg_to_cbor (pk_mi_msg msg,
+                        pk_mi_cbor_write_fn write, void *data);
+
+/* Given a buffer BUF of SIZE bytes containing a CBOR message, decode
+   it and return a MI message.
+
+   In case of error return NULL.  */
+
+pk_mi_msg pk_mi_cbor_to_msg (const void *buf, size_t size);
+
+/* Encode the Poke value VAL.  Values that can't be represented in
+   MI messages, like closures, are encoded as the CBOR `undefined'
+   simple value.  */
+
+void pk_mi_val_to_cbor (pk_val val,
+                        pk_mi_cbor_write_fn write, void *data);
+
+/* Given a buffer BUF of SIZE bytes containing the CBOR encoding of a
+   Poke value, decode it and store the value in *VALUE.
+
+   Return 0 in case of error, 1 otherwise.  */
+
+int pk_mi_cbor_to_val (pk_val *value, const void *buf, size_t size);
+
+#endif /* ! PK_MI_CBOR */
@@ -55,10 +55,31 @@
    Request::
    {
      "type" : RequestType
-     "args"? : null
+     "args"? : ( RequestIosStatsArgs | RequestEncodingArgs
+                 | RequestValueArgs | null )
    }
 
-   RequestType:: ( 0 => REQ_EXIT )
+   RequestType:: ( 0 => REQ_EXIT | 1 => REQ_IOS_STATS
+                   | 2 => REQ_ENCODING | 3 => REQ_VALUE )
+
+   RequestIosStatsArgs::
+   {
+     "ios" : integer
+   }
+
+   RequestEncodingArgs::
+   {
+     "encoding" : string
+   }
+
+   RequestValueArgs::
+   {
+     "expr" : string
+     "from"? : uint64
+     "count"? : uint64
+     "depth"? : integer
+     "fields"? : [ string, ... ]
+   }
 
    Response::
    {
@@ -66,26 +87,258 @@
      "req_number" : uint32
      "success_p: : boolean
      "errmsg" : string
-     "result"? : null
+     "result"? : ( ResponseIosStatsResult | ResponseValueResult | null )
    }
 
-   ResponseType:: ( 0 => RESP_EXIT )
+   ResponseType:: ( 0 => RESP_EXIT | 1 => RESP_IOS_STATS
+                    | 2 => RESP_ENCODING | 3 => RESP_VALUE )
+
+   ResponseValueResult::
+   {
+     "value" : PokeValue
+     "nelem"? : uint64
+   }
+
+   The arguments FROM, COUNT, DEPTH and FIELDS of a VALUE request
+   select the part of the value that is sent in the response, as
+   described in pk-mi-msg.h.  NELEM is the total number of elements
+   of the value, if it is an array.  Structs and arrays whose contents
+   are elided have an additional "elided" attribute, set to true.
+
+   Where PokeValue is the representation of Poke values used by
+   pk_mi_val_to_json, below.
+
+   ResponseIosStatsResult::
+   {
+     "reads" : integer
+     "read_bytes" : integer
+     "writes" : integer
+     "written_bytes" : integer
+     "dev_reads" : integer
+     "dev_read_bytes" : integer
+     "dev_writes" : integer
+     "dev_written_bytes" : integer
+     "dev_seeks" : integer
+     "dev_nsecs" : integer
+     "cache_hits" : integer
+     "cache_misses" : integer
+   }
 
    Event::
    {
      "type" : EventType
-     "args" : ( EventInitializedArgs | null )
+     "args" : ( EventInitializedArgs | EventIosChangedArgs | null )
    }
 
-   EventType:: ( 0 => EVENT_INITIALIZED )
+   EventType:: ( 0 => EVENT_INITIALIZED | 1 => EVENT_IOS_CHANGED )
 
    EventInitializedArgs::
    {
      "version" : string
    }
 
+   EventIosChangedArgs::
+   {
+     "ios" : integer
+     "ranges" : [ [ integer, integer ]* ]
+   }
+
 */
 
+static json_object *pk_mi_val_to_json_1 (pk_val val,
+                                         const struct pk_mi_val_params *params,
+                                         int level, int fields_p,
+                                         char **errmsg);
+static int pk_mi_json_to_val_1 (pk_val *poke_value, json_object *obj,
+                                char **errmsg);
+
+/* The fields of struct pk_ios_stats, in the order they are
+   serialized.  */
+
+#define PK_MI_IOS_STATS_FIELDS                  \
+  PK_MI_IOS_STATS_FIELD (reads)                 \
+  PK_MI_IOS_STATS_FIELD (read_bytes)            \
+  PK_MI_IOS_STATS_FIELD (writes)                \
+  PK_MI_IOS_STATS_FIELD (written_bytes)         \
+  PK_MI_IOS_STATS_FIELD (dev_reads)             \
+  PK_MI_IOS_STATS_FIELD (dev_read_bytes)        \
+  PK_MI_IOS_STATS_FIELD (dev_writes)            \
+  PK_MI_IOS_STATS_FIELD (dev_written_bytes)     \
+  PK_MI_IOS_STATS_FIELD (dev_seeks)             \
+  PK_MI_IOS_STATS_FIELD (dev_nsecs)             \
+  PK_MI_IOS_STATS_FIELD (cache_hits)            \
+  PK_MI_IOS_STATS_FIELD (cache_misses)
+
+static json_object *
+pk_mi_ios_stats_to_json (const struct pk_ios_stats *stats)
+{
+  json_object *result = json_object_new_object ();
+  json_object *obj;
+
+  if (!result)
+    return NULL;
+
+#define PK_MI_IOS_STATS_FIELD(NAME)                             \
+  obj = json_object_new_int64 ((int64_t) stats->NAME);          \
+  if (!obj)                                                     \
+    return NULL;                                                \
+  json_object_object_add (result, #NAME, obj);
+
+  PK_MI_IOS_STATS_FIELDS
+
+#undef PK_MI_IOS_STATS_FIELD
+
+  return result;
+}
+
+static int
+pk_mi_json_to_ios_stats (json_object *result, struct pk_ios_stats *stats)
+{
+  json_object *obj;
+
+  if (!json_object_is_type (result, json_type_object))
+    return 0;
+
+#define PK_MI_IOS_STATS_FIELD(NAME)                             \
+  if (!json_object_object_get_ex (result, #NAME, &obj)          \
+      || !json_object_is_type (obj, json_type_int))             \
+    return 0;                                                   \
+  stats->NAME = (uint64_t) json_object_get_int64 (obj);
+
+  PK_MI_IOS_STATS_FIELDS
+
+#undef PK_MI_IOS_STATS_FIELD
+
+  return 1;
+}
+
+/* Add the attributes of the value parameters PARAMS to the JSON
+   object ARGS.  Only the parameters that differ from the defaults
+   are added.  Return 0 if there is not enough memory, 1 otherwise.  */
+
+static int
+pk_mi_val_params_to_json (json_object *args,
+                          const struct pk_mi_val_params *params)
+{
+  json_object *obj;
+
+  if (params->from != 0)
+    {
+      if (!(obj = json_object_new_int64 (params->from)))
+        return 0;
+      json_object_object_add (args, "from", obj);
+    }
+
+  if (params->count != PK_MI_VAL_ALL)
+    {
+      if (!(obj = json_object_new_int64 (params->count)))
+        return 0;
+      json_object_object_add (args, "count", obj);
+    }
+
+  if (params->depth >= 0)
+    {
+      if (!(obj = json_object_new_int (params->depth)))
+        return 0;
+      json_object_object_add (args, "depth", obj);
+    }
+
+  if (params->fields)
+    {
+      const char *p, *end;
+
+      if (!(obj = json_object_new_array ()))
+        return 0;
+      json_object_object_add (args, "fields", obj);
+
+      for (p = params->fields; ; p = end + 1)
+        {
+          json_object *name;
+
+          end = strchr (p, ',');
+          name = json_object_new_string_len (p, end ? end - p : strlen (p));
+          if (!name || json_object_array_add (obj, name) == -1)
+            return 0;
+          if (!end)
+            break;
+        }
+    }
+
+  return 1;
+}
+
+/* Fill PARAMS with the value parameters in the JSON object ARGS.
+   The list of fields, if any, is allocated and should be freed by
+   the caller.  Return 0 if ARGS is not valid, 1 otherwise.  */
+
+static int
+pk_mi_json_to_val_params (json_object *args,
+                          struct pk_mi_val_params *params)
+{
+  json_object *obj;
+
+  params->from = 0;
+  params->count = PK_MI_VAL_ALL;
+  params->depth = -1;
+  params->fields = NULL;
+
+  if (json_object_object_get_ex (args, "from", &obj))
+    {
+      if (!json_object_is_type (obj, json_type_int))
+        return 0;
+      params->from = json_object_get_int64 (obj);
+    }
+
+  if (json_object_object_get_ex (args, "count", &obj))
+    {
+      if (!json_object_is_type (obj, json_type_int))
+        return 0;
+      params->count = json_object_get_int64 (obj);
+    }
+
+  if (json_object_object_get_ex (args, "depth", &obj))
+    {
+      if (!json_object_is_type (obj, json_type_int))
+        return 0;
+      params->depth = json_object_get_int (obj);
+    }
+
+  if (json_object_object_get_ex (args, "fields", &obj))
+    {
+      size_t i, len = 0, nfields;
+      char *p;
+
+      if (!json_object_is_type (obj, json_type_array))
+        return 0;
+
+      /* The fields are stored as a comma separated list.  */
+      nfields = json_object_array_length (obj);
+      for (i = 0; i < nfields; ++i)
+        {
+          json_object *name = json_object_array_get_idx (obj, i);
+
+          if (!json_object_is_type (name, json_type_string))
+            return 0;
+          len += json_object_get_string_len (name) + 1;
+        }
+
+      params->fields = p = malloc (len + 1);
+      if (!p)
+        return 0;
+      *p = '\0';
+      for (i = 0; i < nfields; ++i)
+        {
+          json_object *name = json_object_array_get_idx (obj, i);
+
+          if (i > 0)
+            *p++ = ',';
+          p = stpcpy (p, json_object_get_string (name));
+        }
+    }
+
+  return 1;
+}
+
 static json_object *
 pk_mi_msg_to_json_object (pk_mi_msg msg)
 {
@@ -136,6 +389,54 @@ pk_mi_msg_to_json_object (pk_mi_msg msg)
         case PK_MI_REQ_EXIT:
           /* Request has no args.  */
           break;
+        case PK_MI_REQ_IOS_STATS:
+          {
+            json_object *args, *ios;
+
+            args = json_object_new_object ();
+            if (!args)
+              goto out_of_memory;
+
+            ios = json_object_new_int (pk_mi_msg_req_ios_stats_ios (msg));
+            if (!ios)
+              goto out_of_memory;
+            json_object_object_add (args, "ios", ios);
+
+            json_object_object_add (req, "args", args);
+            break;
+          }
+        case PK_MI_REQ_ENCODING:
+        case PK_MI_REQ_VALUE:
+          {
+            json_object *args, *str;
+
+            args = json_object_new_object ();
+            if (!args)
+              goto out_of_memory;
+
+            if (msg_req_type == PK_MI_REQ_ENCODING)
+              {
+                str = json_object_new_string
+                  (pk_mi_msg_req_encoding_encoding (msg));
+                if (!str)
+                  goto out_of_memory;
+                json_object_object_add (args, "encoding", str);
+              }
+            else
+              {
+                str = json_object_new_string (pk_mi_msg_req_value_expr (msg));
+                if (!str)
+                  goto out_of_memory;
+                json_object_object_add (args, "expr", str);
+
+                if (!pk_mi_val_params_to_json (args,
+                                               pk_mi_msg_req_value_params (msg)))
+                  goto out_of_memory;
+              }
+
+            json_object_object_add (req, "args", args);
+            break;
+          }
         default:
           assert (0);
         }
@@ -182,6 +483,57 @@ pk_mi_msg_to_json_object (pk_mi_msg msg)
         case PK_MI_RESP_EXIT:
           /* Response has no result.  */
           break;
+        case PK_MI_RESP_IOS_STATS:
+          {
+            json_object *result;
+
+            if (!pk_mi_msg_resp_success_p (msg))
+              break;
+
+            result
+              = pk_mi_ios_stats_to_json (pk_mi_msg_resp_ios_stats_stats (msg));
+            if (!result)
+              goto out_of_memory;
+            json_object_object_add (resp, "result", result);
+            break;
+          }
+        case PK_MI_RESP_ENCODING:
+          /* Response has no result.  */
+          break;
+        case PK_MI_RESP_VALUE:
+          {
+            json_object *result, *value, *nelem;
+            pk_val val;
+
+            if (!pk_mi_msg_resp_success_p (msg))
+              break;
+
+            result = json_object_new_object ();
+            if (!result)
+              goto out_of_memory;
+
+            val = pk_mi_msg_resp_value_val (msg);
+            value = pk_mi_val_to_json_1 (val,
+                                         pk_mi_msg_resp_value_params (msg),
+                                         0, 1, NULL);
+            if (!value)
+              goto out_of_memory;
+            json_object_object_add (result, "value", value);
+
+            /* The client needs the total number of elements of arrays
+               to request other ranges of them.  */
+            if (val != PK_NULL
+                && pk_type_code (pk_typeof (val)) == PK_ARRAY)
+              {
+                nelem
+                  = json_object_new_int64 (pk_uint_value (pk_array_nelem (val)));
+                if (!nelem)
+                  goto out_of_memory;
+                json_object_object_add (result, "nelem", nelem);
+              }
+            json_object_object_add (resp, "result", result);
+            break;
+          }
         default:
           assert (0);
         }
@@ -225,6 +577,42 @@ pk_mi_msg_to_json_object (pk_mi_msg msg)
               goto out_of_memory;
             json_object_object_add (args, "version", version);
 
+            json_object_object_add (event, "args", args);
+            break;
+          }
+        case PK_MI_EVENT_IOS_CHANGED:
+          {
+            json_object *args, *ios, *ranges;
+            const uint64_t *r = pk_mi_msg_event_ios_changed_ranges (msg);
+            size_t i, nranges = pk_mi_msg_event_ios_changed_nranges (msg);
+
+            args = json_object_new_object ();
+            if (!args)
+              goto out_of_memory;
+
+            ios = json_object_new_int (pk_mi_msg_event_ios_changed_ios (msg));
+            if (!ios)
+              goto out_of_memory;
+            json_object_object_add (args, "ios", ios);
+
+            ranges = json_object_new_array ();
+            if (!ranges)
+              goto out_of_memory;
+            for (i = 0; i < nranges; ++i)
+              {
+                json_object *range, *offset, *size;
+
+                range = json_object_new_array ();
+                offset = json_object_new_int64 ((int64_t) r[2 * i]);
+                size = json_object_new_int64 ((int64_t) r[2 * i + 1]);
+                if (!range || !offset || !size)
+                  goto out_of_memory;
+                json_object_array_add (range, offset);
+                json_object_array_add (range, size);
+                json_object_array_add (ranges, range);
+              }
+            json_object_object_add (args, "ranges", ranges);
+
             json_object_object_add (event, "args", args);
             break;
           }
@@ -290,7 +678,7 @@ pk_mi_json_object_to_msg (json_object *json)
           return NULL;
 
         /* Get the request type.  */
-        if (!json_object_object_get_ex (json, "type", &req_type))
+        if (!json_object_object_get_ex (req_json, "type", &req_type))
           return NULL;
         if (!json_object_is_type (req_type, json_type_int))
           return NULL;
@@ -301,6 +689,54 @@ pk_mi_json_object_to_msg (json_object *json)
           case PK_MI_REQ_EXIT:
             msg = pk_mi_make_req_exit ();
             break;
+          case PK_MI_REQ_IOS_STATS:
+            {
+              json_object *args_json, *obj;
+
+              if (!json_object_object_get_ex (req_json, "args", &args_json))
+                return NULL;
+              if (!json_object_is_type (args_json, json_type_object))
+                return NULL;
+
+              if (!json_object_object_get_ex (args_json, "ios", &obj))
+                return NULL;
+              if (!json_object_is_type (obj, json_type_int))
+                return NULL;
+
+              msg = pk_mi_make_req_ios_stats (json_object_get_int (obj));
+              break;
+            }
+          case PK_MI_REQ_ENCODING:
+          case PK_MI_REQ_VALUE:
+            {
+              json_object *args_json, *obj;
+              const char *arg_name = (msg_req_type == PK_MI_REQ_ENCODING
+                                      ? "encoding" : "expr");
+
+              if (!json_object_object_get_ex (req_json, "args", &args_json))
+                return NULL;
+              if (!json_object_is_type (args_json, json_type_object))
+                return NULL;
+
+              if (!json_object_object_get_ex (args_json, arg_name, &obj))
+                return NULL;
+              if (!json_object_is_type (obj, json_type_string))
+                return NULL;
+
+              if (msg_req_type == PK_MI_REQ_ENCODING)
+                msg = pk_mi_make_req_encoding (json_object_get_string (obj));
+              else
+                {
+                  struct pk_mi_val_params params;
+
+                  if (!pk_mi_json_to_val_params (args_json, &params))
+                    return NULL;
+                  msg = pk_mi_make_req_value (json_object_get_string (obj),
+                                              &params);
+                  free (params.fields);
+                }
+              break;
+            }
           default:
             return NULL;
           }
@@ -360,6 +796,43 @@ pk_mi_json_object_to_msg (json_object *json)
                                         success_p,
                                         errmsg);
             break;
+          case PK_MI_RESP_IOS_STATS:
+            {
+              struct pk_ios_stats stats;
+
+              if (success_p
+                  && (!json_object_object_get_ex (resp_json, "result", &obj)
+                      || !pk_mi_json_to_ios_stats (obj, &stats)))
+                return NULL;
+
+              msg = pk_mi_make_resp_ios_stats (req_number,
+                                               success_p,
+                                               errmsg,
+                                               &stats);
+              break;
+            }
+          case PK_MI_RESP_ENCODING:
+            msg = pk_mi_make_resp_encoding (req_number,
+                                            success_p,
+                                            errmsg);
+            break;
+          case PK_MI_RESP_VALUE:
+            {
+              json_object *value;
+              pk_val val = PK_NULL;
+
+              if (success_p
+                  && (!json_object_object_get_ex (resp_json, "result", &obj)
+                      || !json_object_object_get_ex (obj, "value", &value)
+                      || pk_mi_json_to_val_1 (&val, value, NULL) == -1))
+                return NULL;
+
+              msg = pk_mi_make_resp_value (req_number,
+                                           success_p,
+                                           errmsg,
+                                           val, NULL);
+              break;
+            }
           default:
             return NULL;
           }
@@ -406,6 +879,60 @@ pk_mi_json_object_to_msg (json_object *json)
               msg = pk_mi_make_event_initialized (version);
               break;
             }
+          case PK_MI_EVENT_IOS_CHANGED:
+            {
+              json_object *args_json, *obj, *ranges_json;
+              uint64_t *ranges;
+              size_t i, nranges;
+              int ios;
+
+              if (!json_object_object_get_ex (event_json, "args", &args_json))
+                return NULL;
+              if (!json_object_is_type (args_json, json_type_object))
+                return NULL;
+
+              if (!json_object_object_get_ex (args_json, "ios", &obj))
+                return NULL;
+              if (!json_object_is_type (obj, json_type_int))
+                return NULL;
+              ios = json_object_get_int (obj);
+
+              if (!json_object_object_get_ex (args_json, "ranges",
+                                              &ranges_json))
+                return NULL;
+              if (!json_object_is_type (ranges_json, json_type_array))
+                return NULL;
+
+              nranges = json_object_array_length (ranges_json);
+              ranges = malloc (2 * nranges * sizeof (uint64_t) + 1);
+              if (!ranges)
+                return NULL;
+
+              for (i = 0; i < nranges; ++i)
+                {
+                  json_object *range
+                    = json_object_array_get_idx (ranges_json, i);
+                  json_object *offset, *size;
+
+                  if (!json_object_is_type (range, json_type_array)
+                      || json_object_array_length (range) != 2
+                      || !(offset = json_object_array_get_idx (range, 0))
+                      || !(size = json_object_array_get_idx (range, 1))
+                      || !json_object_is_type (offset, json_type_int)
+                      || !json_object_is_type (size, json_type_int))
+                    {
+                      free (ranges);
+                      return NULL;
+                    }
+
+                  ranges[2 * i] = (uint64_t) json_object_get_int64 (offset);
+                  ranges[2 * i + 1] = (uint64_t) json_object_get_int64 (size);
+                }
+
+              msg = pk_mi_make_event_ios_changed (ios, nranges, ranges);
+              free (ranges);
+              break;
+            }
           default:
             return NULL;
           }
@@ -457,7 +984,6 @@ pk_mi_json_to_msg (const char *str)
 }
 
 /* Functions to convert pk_val to JSON Poke Value.  */
-static json_object *pk_mi_val_to_json_1 (pk_val val, char **errmsg);
 
 static json_object *
 pk_mi_int_to_json (pk_val pk_int, char **errmsg)
@@ -656,7 +1182,8 @@ pk_mi_null_to_json (char **errmsg)
 }
 
 static json_object *
-pk_mi_sct_to_json (pk_val pk_sct, char **errmsg)
+pk_mi_sct_to_json (pk_val pk_sct, const struct pk_mi_val_params *params,
+                   int level, int fields_p, char **errmsg)
 {
   json_object *pk_sct_object, *pk_sct_type_object;
   json_object *pk_sct_fields_object, *pk_sct_field_object;
@@ -665,7 +1192,7 @@ pk_mi_sct_to_json (pk_val pk_sct, char **errmsg)
   json_object *pk_sct_field_offset_object;
   json_object *pk_sct_field_name_object;
   pk_val tmp;
-  int err;
+  int err, elided_p;
 
   assert (pk_type_code (pk_typeof (pk_sct)) == PK_STRUCT);
 
@@ -684,11 +1211,24 @@ pk_mi_sct_to_json (pk_val pk_sct, char **errmsg)
   PK_MI_CHECK (errmsg, pk_sct_name_object != NULL,
                "json_object_new_object () failed");
 
-  /* Fill the array of struct fields.  */
+  /* Fill the array of struct fields, unless they are elided.  */
+  elided_p = pk_mi_val_params_elided_p (params, level);
   for (ssize_t i = 0 ; i < pk_uint_value (pk_struct_nfields (pk_sct)) ; i++)
     {
+      if (elided_p)
+        break;
+
+      tmp = pk_struct_field_name (pk_sct, i);
+      if (fields_p
+          && !pk_mi_val_params_field_p (params,
+                                        tmp == PK_NULL
+                                        ? NULL : pk_string_str (tmp)))
+        continue;
+
       tmp = pk_struct_field_value (pk_sct, i);
-      pk_sct_field_value_object = pk_mi_val_to_json_1 (tmp, errmsg);
+      pk_sct_field_value_object = pk_mi_val_to_json_1 (tmp, params,
+                                                       level + 1, 0,
+                                                       errmsg);
       tmp = pk_struct_field_boffset (pk_sct, i);
       pk_sct_field_offset_object = pk_mi_uint_to_json (tmp, errmsg);
       tmp = pk_struct_field_name (pk_sct, i);
@@ -729,6 +1269,9 @@ pk_mi_sct_to_json (pk_val pk_sct, char **errmsg)
   json_object_object_add (pk_sct_object, "name", pk_sct_name_object);
   json_object_object_add (pk_sct_object, "fields", pk_sct_fields_object);
   json_object_object_add (pk_sct_object, "mapping", pk_sct_mapping_object);
+  if (elided_p)
+    json_object_object_add (pk_sct_object, "elided",
+                            json_object_new_boolean (1));
 
   return pk_sct_object;
 
@@ -737,14 +1280,16 @@ pk_mi_sct_to_json (pk_val pk_sct, char **errmsg)
 }
 
 static json_object *
-pk_mi_array_to_json (pk_val pk_array, char **errmsg)
+pk_mi_array_to_json (pk_val pk_array, const struct pk_mi_val_params *params,
+                     int level, char **errmsg)
 {
   json_object *pk_array_object, *pk_array_type_object;
   json_object *pk_array_mapping_object, *pk_array_elements_object;
   json_object *pk_array_element_object, *pk_array_element_value_object;
   json_object *pk_array_element_offset_object;
   pk_val tmp;
-  int err;
+  uint64_t nelem, from, to;
+  int err, elided_p;
 
   assert (pk_type_code (pk_typeof (pk_array)) == PK_ARRAY);
 
@@ -762,13 +1307,19 @@ pk_mi_array_to_json (pk_val pk_array, char **errmsg)
   PK_MI_CHECK (errmsg, pk_array_elements_object != NULL,
                "json_object_new_object () failed");
 
-  /* Fill elements object.  */
-  for (size_t i = 0 ; i < pk_uint_value (pk_array_nelem (pk_array)) ; i++)
+  /* Fill elements object with the selected elements.  */
+  elided_p = pk_mi_val_params_elided_p (params, level);
+  nelem = elided_p ? 0 : pk_uint_value (pk_array_nelem (pk_array));
+  pk_mi_val_params_range (params, level, nelem, &from, &to);
+  for (uint64_t i = from ; i < to ; i++)
     {
       /* For every element on the array, get its value & offset and build
          the corresponding JSON objects.  */
       tmp = pk_array_elem_val (pk_array, i);
-      pk_array_element_value_object = pk_mi_val_to_json_1 (tmp, errmsg);
+      pk_array_element_value_object = pk_mi_val_to_json_1 (tmp, params,
+                                                           level + 1,
+                                                           level == 0,
+                                                           errmsg);
       tmp = pk_array_elem_boffset (pk_array, i);
       pk_array_element_offset_object = pk_mi_uint_to_json (tmp, errmsg);
 
@@ -798,6 +1349,9 @@ pk_mi_array_to_json (pk_val pk_array, char **errmsg)
   json_object_object_add (pk_array_object, "type", pk_array_type_object);
   json_object_object_add (pk_array_object, "elements", pk_array_elements_object);
   json_object_object_add (pk_array_object, "mapping", pk_array_mapping_object);
+  if (elided_p)
+    json_object_object_add (pk_array_object, "elided",
+                            json_object_new_boolean (1));
 
   return pk_array_object;
 
@@ -805,8 +1359,13 @@ pk_mi_array_to_json (pk_val pk_array, char **errmsg)
     return NULL;
 }
 
+/* Convert VAL, located at nesting level LEVEL, to JSON.  PARAMS
+   selects the parts of the value to convert.  FIELDS_P tells whether
+   the field selection of PARAMS applies to VAL.  */
+
 static json_object *
-pk_mi_val_to_json_1 (pk_val val, char **errmsg)
+pk_mi_val_to_json_1 (pk_val val, const struct pk_mi_val_params *params,
+                     int level, int fields_p, char **errmsg)
 {
   json_object *pk_val_object = NULL;
 
@@ -829,10 +1388,11 @@ pk_mi_val_to_json_1 (pk_val val, char **errmsg)
           pk_val_object = pk_mi_offset_to_json (val, errmsg);
           break;
         case PK_STRUCT:
-          pk_val_object = pk_mi_sct_to_json (val, errmsg);
+          pk_val_object = pk_mi_sct_to_json (val, params, level, fields_p,
+                                             errmsg);
           break;
         case PK_ARRAY:
-          pk_val_object = pk_mi_array_to_json (val, errmsg);
+          pk_val_object = pk_mi_array_to_json (val, params, level, errmsg);
           break;
         case PK_CLOSURE:
         case PK_ANY:
@@ -851,7 +1411,7 @@ pk_mi_val_to_json (pk_val val, char **errmsg)
 {
   json_object *pk_val_object, *pk_object;
 
-  pk_val_object = pk_mi_val_to_json_1 (val, errmsg);
+  pk_val_object = pk_mi_val_to_json_1 (val, NULL, 0, 0, errmsg);
 
   pk_object = json_object_new_object ();
   PK_MI_CHECK (errmsg, pk_object != NULL,
@@ -868,8 +1428,6 @@ pk_mi_val_to_json (pk_val val, char **errmsg)
 }
 
 /* Functions to convert JSON object to Poke value.  */
-static int pk_mi_json_to_val_1 (pk_val *poke_value, json_object *obj,
-                                char **errmsg);
 
 static const char *
 pk_mi_json_poke_value_type (json_object *obj)
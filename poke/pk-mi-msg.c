@@ -41,9 +41,33 @@
 
    The following request types are supported:
 
-   PK_MI_REQ_EXIT requests poke to finalize and exit.  */
+   PK_MI_REQ_EXIT requests poke to finalize and exit.
+
+   PK_MI_REQ_IOS_STATS requests the statistics about the accesses
+   performed in an IO space.  This request has the following
+   arguments:
+
+      IOS_STATS_IOS is the id of the IO space.
+
+   PK_MI_REQ_ENCODING requests poke to use some other encoding for the
+   messages that follow the response to the request.  This request has
+   the following arguments:
+
+      ENCODING_ENCODING is a string with the name of the encoding.
+
+   PK_MI_REQ_VALUE requests the value of a Poke expression.  This
+   request has the following arguments:
+
+      VALUE_EXPR is a string with the expression.
+
+      VALUE_PARAMS selects the part of the value to send in the
+      response.  */
 
 #define PK_MI_REQ_TYPE(REQ) ((REQ)->type)
+#define PK_MI_REQ_IOS_STATS_IOS(REQ) ((REQ)->args.ios_stats.ios)
+#define PK_MI_REQ_ENCODING_ENCODING(REQ) ((REQ)->args.encoding.encoding)
+#define PK_MI_REQ_VALUE_EXPR(REQ) ((REQ)->args.value.expr)
+#define PK_MI_REQ_VALUE_PARAMS(REQ) ((REQ)->args.value.params)
 
 struct pk_mi_req
 {
@@ -51,6 +75,21 @@ struct pk_mi_req
 
   union
   {
+    struct
+    {
+      int ios;
+    } ios_stats;
+
+    struct
+    {
+      char *encoding;
+    } encoding;
+
+    struct
+    {
+      char *expr;
+      struct pk_mi_val_params params;
+    } value;
   } args;
 };
 
@@ -75,12 +114,32 @@ typedef struct pk_mi_req *pk_mi_req;
 
    The following responses are supported:
 
-   PK_MI_RESP_EXIT is the response to a PK_MI_REQ_EXIT request.  */
+   PK_MI_RESP_EXIT is the response to a PK_MI_REQ_EXIT request.
+
+   PK_MI_RESP_IOS_STATS is the response to a PK_MI_REQ_IOS_STATS
+   request.  Its result is:
+
+      IOS_STATS_STATS with the statistics of the IO space.
+
+   PK_MI_RESP_ENCODING is the response to a PK_MI_REQ_ENCODING
+   request.  It is encoded with the encoding that was in use when the
+   request was received.
+
+   PK_MI_RESP_VALUE is the response to a PK_MI_REQ_VALUE request.  Its
+   result is:
+
+      VALUE_VAL with the value of the requested expression.
+
+      VALUE_PARAMS with the parameters of the request, selecting the
+      part of VALUE_VAL to encode.  */
 
 #define PK_MI_RESP_TYPE(RESP) ((RESP)->type)
 #define PK_MI_RESP_REQ_NUMBER(RESP) ((RESP)->req_number)
 #define PK_MI_RESP_SUCCESS_P(RESP) ((RESP)->success_p)
 #define PK_MI_RESP_ERRMSG(RESP) ((RESP)->errmsg)
+#define PK_MI_RESP_IOS_STATS_STATS(RESP) ((RESP)->result.ios_stats)
+#define PK_MI_RESP_VALUE_VAL(RESP) ((RESP)->result.value.val)
+#define PK_MI_RESP_VALUE_PARAMS(RESP) ((RESP)->result.value.params)
 
 struct pk_mi_msg;
 
@@ -93,6 +152,12 @@ struct pk_mi_resp
 
   union
   {
+    struct pk_ios_stats ios_stats;
+    struct
+    {
+      pk_val val;
+      struct pk_mi_val_params params;
+    } value;
   } result;
 };
 
@@ -118,11 +183,26 @@ typedef struct pk_mi_resp *pk_mi_resp;
 
       INITIALIZED_VERSION is a NULL-terminated string with the
       version of the poke program sending the event.
+
+   PK_MI_EVENT_IOS_CHANGED indicates the client that some data has
+   been written in an IO space while processing a request.  It is sent
+   before the response to the request.  This event has the following
+   arguments:
+
+      IOS_CHANGED_IOS is the id of the IO space.
+
+      IOS_CHANGED_NRANGES is the number of written ranges.
+
+      IOS_CHANGED_RANGES is an array with the byte offset and the size
+      of each written range.
 */
 
 #define PK_MI_EVENT_TYPE(EVENT) ((EVENT)->type)
 #define PK_MI_EVENT_INITIALIZED_MI_VERSION(EVENT) ((EVENT)->args.initialized.mi_version)
 #define PK_MI_EVENT_INITIALIZED_VERSION(EVENT) ((EVENT)->args.initialized.version)
+#define PK_MI_EVENT_IOS_CHANGED_IOS(EVENT) ((EVENT)->args.ios_changed.ios)
+#define PK_MI_EVENT_IOS_CHANGED_NRANGES(EVENT) ((EVENT)->args.ios_changed.nranges)
+#define PK_MI_EVENT_IOS_CHANGED_RANGES(EVENT) ((EVENT)->args.ios_changed.ranges)
 
 struct pk_mi_event
 {
@@ -137,6 +217,14 @@ struct pk_mi_event
       char *version;
     } initialized;
 
+    struct
+    {
+      int ios;
+      size_t nranges;
+      /* Offset and size of every range.  */
+      uint64_t *ranges;
+    } ios_changed;
+
   } args;
 };
 
@@ -169,6 +257,49 @@ typedef struct pk_mi_msg *pk_mi_msg;
 /* Global with the next available message sequence number.  */
 static pk_mi_seqnum next_seqnum;
 
+/* Set DST to a copy of PARAMS, or to the parameters selecting a whole
+   value if PARAMS is NULL.  Return 0 if there is not enough memory,
+   1 otherwise.  */
+
+static int
+pk_mi_val_params_copy (struct pk_mi_val_params *dst,
+                       const struct pk_mi_val_params *params)
+{
+  dst->from = params ? params->from : 0;
+  dst->count = params ? params->count : PK_MI_VAL_ALL;
+  dst->depth = params ? params->depth : -1;
+  dst->fields = NULL;
+
+  if (params && params->fields)
+    {
+      dst->fields = strdup (params->fields);
+      if (!dst->fields)
+        return 0;
+    }
+
+  return 1;
+}
+
+/* Set the ranges of the IOS_CHANGED event EVENT to a copy of the
+   NRANGES ranges in RANGES.  Return 0 if there is not enough memory,
+   1 otherwise.  */
+
+static int
+pk_mi_ranges_copy (pk_mi_event event, size_t nranges,
+                   const uint64_t *ranges)
+{
+  size_t size = 2 * nranges * sizeof (uint64_t);
+
+  PK_MI_EVENT_IOS_CHANGED_NRANGES (event) = nranges;
+  PK_MI_EVENT_IOS_CHANGED_RANGES (event) = malloc (size ? size : 1);
+  if (!PK_MI_EVENT_IOS_CHANGED_RANGES (event))
+    return 0;
+
+  if (size)
+    memcpy (PK_MI_EVENT_IOS_CHANGED_RANGES (event), ranges, size);
+  return 1;
+}
+
 static pk_mi_req
 pk_mi_make_req (enum pk_mi_req_type type)
 {
@@ -205,6 +336,9 @@ pk_mi_make_event (enum pk_mi_event_type type)
         case PK_MI_EVENT_INITIALIZED:
           PK_MI_EVENT_INITIALIZED_VERSION (event) = NULL;
           break;
+        case PK_MI_EVENT_IOS_CHANGED:
+          PK_MI_EVENT_IOS_CHANGED_RANGES (event) = NULL;
+          break;
         default:
           assert (0);
         }
@@ -235,8 +369,16 @@ pk_mi_req_free (pk_mi_req req)
       switch (PK_MI_REQ_TYPE (req))
         {
         case PK_MI_REQ_EXIT:
+        case PK_MI_REQ_IOS_STATS:
           /* Nothing to do.  */
           break;
+        case PK_MI_REQ_ENCODING:
+          free (PK_MI_REQ_ENCODING_ENCODING (req));
+          break;
+        case PK_MI_REQ_VALUE:
+          free (PK_MI_REQ_VALUE_EXPR (req));
+          free (PK_MI_REQ_VALUE_PARAMS (req).fields);
+          break;
         default:
           assert (0);
         }
@@ -253,8 +395,13 @@ pk_mi_resp_free (pk_mi_resp resp)
       switch (PK_MI_RESP_TYPE (resp))
         {
         case PK_MI_RESP_EXIT:
+        case PK_MI_RESP_IOS_STATS:
+        case PK_MI_RESP_ENCODING:
           /* Nothing to do here.  */
           break;
+        case PK_MI_RESP_VALUE:
+          free (PK_MI_RESP_VALUE_PARAMS (resp).fields);
+          break;
         default:
           assert (0);
         }
@@ -274,6 +421,9 @@ pk_mi_event_free (pk_mi_event event)
         case PK_MI_EVENT_INITIALIZED:
           free (PK_MI_EVENT_INITIALIZED_VERSION (event));
           break;
+        case PK_MI_EVENT_IOS_CHANGED:
+          free (PK_MI_EVENT_IOS_CHANGED_RANGES (event));
+          break;
         default:
           assert (0);
         }
@@ -294,6 +444,33 @@ pk_mi_req_dup (pk_mi_req req)
         case PK_MI_REQ_EXIT:
           /* Nothing to do.  */
           break;
+        case PK_MI_REQ_IOS_STATS:
+          PK_MI_REQ_IOS_STATS_IOS (new) = PK_MI_REQ_IOS_STATS_IOS (req);
+          break;
+        case PK_MI_REQ_ENCODING:
+          PK_MI_REQ_ENCODING_ENCODING (new)
+            = strdup (PK_MI_REQ_ENCODING_ENCODING (req));
+          if (!PK_MI_REQ_ENCODING_ENCODING (new))
+            {
+              free (new);
+              return NULL;
+            }
+          break;
+        case PK_MI_REQ_VALUE:
+          PK_MI_REQ_VALUE_EXPR (new) = strdup (PK_MI_REQ_VALUE_EXPR (req));
+          if (!PK_MI_REQ_VALUE_EXPR (new))
+            {
+              free (new);
+              return NULL;
+            }
+          if (!pk_mi_val_params_copy (&PK_MI_REQ_VALUE_PARAMS (new),
+                                      &PK_MI_REQ_VALUE_PARAMS (req)))
+            {
+              free (PK_MI_REQ_VALUE_EXPR (new));
+              free (new);
+              return NULL;
+            }
+          break;
         default:
           assert (0);
         }
@@ -314,6 +491,22 @@ pk_mi_resp_dup (pk_mi_resp resp)
         case PK_MI_RESP_EXIT:
           /* Nothing to do here.  */
           break;
+        case PK_MI_RESP_IOS_STATS:
+          PK_MI_RESP_IOS_STATS_STATS (new)
+            = PK_MI_RESP_IOS_STATS_STATS (resp);
+          break;
+        case PK_MI_RESP_ENCODING:
+          /* Nothing to do here.  */
+          break;
+        case PK_MI_RESP_VALUE:
+          PK_MI_RESP_VALUE_VAL (new) = PK_MI_RESP_VALUE_VAL (resp);
+          if (!pk_mi_val_params_copy (&PK_MI_RESP_VALUE_PARAMS (new),
+                                      &PK_MI_RESP_VALUE_PARAMS (resp)))
+            {
+              free (new);
+              return NULL;
+            }
+          break;
         default:
           assert (0);
         }
@@ -351,6 +544,17 @@ pk_mi_event_dup (pk_mi_event event)
               return NULL;
             }
           break;
+        case PK_MI_EVENT_IOS_CHANGED:
+          PK_MI_EVENT_IOS_CHANGED_IOS (new)
+            = PK_MI_EVENT_IOS_CHANGED_IOS (event);
+          if (!pk_mi_ranges_copy (new,
+                                  PK_MI_EVENT_IOS_CHANGED_NRANGES (event),
+                                  PK_MI_EVENT_IOS_CHANGED_RANGES (event)))
+            {
+              free (new);
+              return NULL;
+            }
+          break;
         default:
           assert (0);
         }
@@ -426,13 +630,110 @@ pk_mi_make_req_exit (void)
   return msg;
 }
 
-pk_mi_msg pk_mi_make_resp_exit (pk_mi_seqnum req_seqnum,
-                                int success_p, const char *errmsg)
+pk_mi_msg
+pk_mi_make_req_ios_stats (int ios)
+{
+  pk_mi_req req;
+  pk_mi_msg msg;
+
+  req = pk_mi_make_req (PK_MI_REQ_IOS_STATS);
+  if (!req)
+    return NULL;
+
+  PK_MI_REQ_IOS_STATS_IOS (req) = ios;
+
+  msg = pk_mi_make_msg (PK_MI_MSG_REQUEST);
+  if (!msg)
+    {
+      free (req);
+      return NULL;
+    }
+
+  PK_MI_MSG_REQUEST (msg) = req;
+  return msg;
+}
+
+/* Build a request message of type TYPE, whose only argument is a
+   copy of the string ARG.  Return the message and store the copy of
+   ARG in *ARGP.  */
+
+static pk_mi_msg
+pk_mi_make_req_msg_str (enum pk_mi_req_type type, const char *arg,
+                        char **argp)
+{
+  pk_mi_req req;
+  pk_mi_msg msg;
+
+  req = pk_mi_make_req (type);
+  if (!req)
+    return NULL;
+
+  *argp = strdup (arg);
+  if (!*argp)
+    {
+      free (req);
+      return NULL;
+    }
+
+  msg = pk_mi_make_msg (PK_MI_MSG_REQUEST);
+  if (!msg)
+    {
+      free (*argp);
+      free (req);
+      return NULL;
+    }
+
+  PK_MI_MSG_REQUEST (msg) = req;
+  return msg;
+}
+
+pk_mi_msg
+pk_mi_make_req_encoding (const char *encoding)
+{
+  char *arg;
+  pk_mi_msg msg
+    = pk_mi_make_req_msg_str (PK_MI_REQ_ENCODING, encoding, &arg);
+
+  if (msg)
+    PK_MI_REQ_ENCODING_ENCODING (PK_MI_MSG_REQUEST (msg)) = arg;
+  return msg;
+}
+
+pk_mi_msg
+pk_mi_make_req_value (const char *expr,
+                      const struct pk_mi_val_params *params)
+{
+  char *arg;
+  pk_mi_msg msg = pk_mi_make_req_msg_str (PK_MI_REQ_VALUE, expr, &arg);
+  pk_mi_req req;
+
+  if (!msg)
+    return NULL;
+
+  req = PK_MI_MSG_REQUEST (msg);
+  PK_MI_REQ_VALUE_EXPR (req) = arg;
+  if (!pk_mi_val_params_copy (&PK_MI_REQ_VALUE_PARAMS (req), params))
+    {
+      pk_mi_msg_free (msg);
+      return NULL;
+    }
+
+  return msg;
+}
+
+/* Build a response message of type TYPE, with the arguments common
+   to all the responses.  If RESPP is not NULL, set it to the
+   response in the message.  */
+
+static pk_mi_msg
+pk_mi_make_resp_msg (enum pk_mi_resp_type type, pk_mi_seqnum req_seqnum,
+                     int success_p, const char *errmsg,
+                     pk_mi_resp *respp)
 {
   pk_mi_resp resp;
   pk_mi_msg msg;
 
-  resp = pk_mi_make_resp (PK_MI_RESP_EXIT);
+  resp = pk_mi_make_resp (type);
   if (!resp)
     return NULL;
 
@@ -453,11 +754,74 @@ pk_mi_msg pk_mi_make_resp_exit (pk_mi_seqnum req_seqnum,
   msg = pk_mi_make_msg (PK_MI_MSG_RESPONSE);
   if (!msg)
     {
+      free (PK_MI_RESP_ERRMSG (resp));
       free (resp);
       return NULL;
     }
 
   PK_MI_MSG_RESPONSE (msg) = resp;
+  if (respp)
+    *respp = resp;
+  return msg;
+}
+
+pk_mi_msg pk_mi_make_resp_exit (pk_mi_seqnum req_seqnum,
+                                int success_p, const char *errmsg)
+{
+  return pk_mi_make_resp_msg (PK_MI_RESP_EXIT, req_seqnum,
+                              success_p, errmsg, NULL);
+}
+
+pk_mi_msg
+pk_mi_make_resp_ios_stats (pk_mi_seqnum req_seqnum,
+                           int success_p, const char *errmsg,
+                           const struct pk_ios_stats *stats)
+{
+  pk_mi_resp resp;
+  pk_mi_msg msg;
+
+  msg = pk_mi_make_resp_msg (PK_MI_RESP_IOS_STATS, req_seqnum,
+                             success_p, errmsg, &resp);
+  if (!msg)
+    return NULL;
+
+  if (success_p)
+    PK_MI_RESP_IOS_STATS_STATS (resp) = *stats;
+  else
+    memset (&PK_MI_RESP_IOS_STATS_STATS (resp), 0,
+            sizeof (struct pk_ios_stats));
+  return msg;
+}
+
+pk_mi_msg
+pk_mi_make_resp_encoding (pk_mi_seqnum req_seqnum,
+                          int success_p, const char *errmsg)
+{
+  return pk_mi_make_resp_msg (PK_MI_RESP_ENCODING, req_seqnum,
+                              success_p, errmsg, NULL);
+}
+
+pk_mi_msg
+pk_mi_make_resp_value (pk_mi_seqnum req_seqnum,
+                       int success_p, const char *errmsg,
+                       pk_val val,
+                       const struct pk_mi_val_params *params)
+{
+  pk_mi_resp resp;
+  pk_mi_msg msg;
+
+  msg = pk_mi_make_resp_msg (PK_MI_RESP_VALUE, req_seqnum,
+                             success_p, errmsg, &resp);
+  if (!msg)
+    return NULL;
+
+  PK_MI_RESP_VALUE_VAL (resp) = success_p ? val : PK_NULL;
+  if (!pk_mi_val_params_copy (&PK_MI_RESP_VALUE_PARAMS (resp), params))
+    {
+      pk_mi_msg_free (msg);
+      return NULL;
+    }
+
   return msg;
 }
 
@@ -490,6 +854,35 @@ pk_mi_make_event_initialized (const char *version)
   return msg;
 }
 
+pk_mi_msg
+pk_mi_make_event_ios_changed (int ios, size_t nranges,
+                              const uint64_t *ranges)
+{
+  pk_mi_event event;
+  pk_mi_msg msg;
+
+  event = pk_mi_make_event (PK_MI_EVENT_IOS_CHANGED);
+  if (!event)
+    return NULL;
+
+  PK_MI_EVENT_IOS_CHANGED_IOS (event) = ios;
+  if (!pk_mi_ranges_copy (event, nranges, ranges))
+    {
+      free (event);
+      return NULL;
+    }
+
+  msg = pk_mi_make_msg (PK_MI_MSG_EVENT);
+  if (!msg)
+    {
+      pk_mi_event_free (event);
+      return NULL;
+    }
+
+  PK_MI_MSG_EVENT (msg) = event;
+  return msg;
+}
+
 void
 pk_mi_msg_free (pk_mi_msg msg)
 {
@@ -538,6 +931,30 @@ pk_mi_msg_req_type (pk_mi_msg msg)
   return PK_MI_REQ_TYPE (PK_MI_MSG_REQUEST (msg));
 }
 
+int
+pk_mi_msg_req_ios_stats_ios (pk_mi_msg msg)
+{
+  return PK_MI_REQ_IOS_STATS_IOS (PK_MI_MSG_REQUEST (msg));
+}
+
+const char *
+pk_mi_msg_req_encoding_encoding (pk_mi_msg msg)
+{
+  return PK_MI_REQ_ENCODING_ENCODING (PK_MI_MSG_REQUEST (msg));
+}
+
+const char *
+pk_mi_msg_req_value_expr (pk_mi_msg msg)
+{
+  return PK_MI_REQ_VALUE_EXPR (PK_MI_MSG_REQUEST (msg));
+}
+
+const struct pk_mi_val_params *
+pk_mi_msg_req_value_params (pk_mi_msg msg)
+{
+  return &PK_MI_REQ_VALUE_PARAMS (PK_MI_MSG_REQUEST (msg));
+}
+
 enum pk_mi_resp_type
 pk_mi_msg_resp_type (pk_mi_msg msg)
 {
@@ -562,6 +979,24 @@ pk_mi_msg_resp_errmsg (pk_mi_msg msg)
   return PK_MI_RESP_ERRMSG (PK_MI_MSG_RESPONSE (msg));
 }
 
+const struct pk_ios_stats *
+pk_mi_msg_resp_ios_stats_stats (pk_mi_msg msg)
+{
+  return &PK_MI_RESP_IOS_STATS_STATS (PK_MI_MSG_RESPONSE (msg));
+}
+
+pk_val
+pk_mi_msg_resp_value_val (pk_mi_msg msg)
+{
+  return PK_MI_RESP_VALUE_VAL (PK_MI_MSG_RESPONSE (msg));
+}
+
+const struct pk_mi_val_params *
+pk_mi_msg_resp_value_params (pk_mi_msg msg)
+{
+  return &PK_MI_RESP_VALUE_PARAMS (PK_MI_MSG_RESPONSE (msg));
+}
+
 enum pk_mi_event_type
 pk_mi_msg_event_type (pk_mi_msg msg)
 {
@@ -579,3 +1014,72 @@ pk_mi_msg_event_initialized_mi_version (pk_mi_msg msg)
 {
   return PK_MI_EVENT_INITIALIZED_MI_VERSION (PK_MI_MSG_EVENT (msg));
 }
+
+int
+pk_mi_msg_event_ios_changed_ios (pk_mi_msg msg)
+{
+  return PK_MI_EVENT_IOS_CHANGED_IOS (PK_MI_MSG_EVENT (msg));
+}
+
+size_t
+pk_mi_msg_event_ios_changed_nranges (pk_mi_msg msg)
+{
+  return PK_MI_EVENT_IOS_CHANGED_NRANGES (PK_MI_MSG_EVENT (msg));
+}
+
+const uint64_t *
+pk_mi_msg_event_ios_changed_ranges (pk_mi_msg msg)
+{
+  return PK_MI_EVENT_IOS_CHANGED_RANGES (PK_MI_MSG_EVENT (msg));
+}
+
+int
+pk_mi_val_params_elided_p (const struct pk_mi_val_params *params,
+                           int level)
+{
+  return params && params->depth >= 0 && level > params->depth;
+}
+
+void
+pk_mi_val_params_range (const struct pk_mi_val_params *params,
+                        int level, uint64_t nelem,
+                        uint64_t *from, uint64_t *to)
+{
+  *from = 0;
+  *to = nelem;
+
+  /* Ranges only apply to the requested value.  */
+  if (!params || level != 0)
+    return;
+
+  *from = params->from < nelem ? params->from : nelem;
+  if (params->count < nelem - *from)
+    *to = *from + params->count;
+}
+
+int
+pk_mi_val_params_field_p (const struct pk_mi_val_params *params,
+                          const char *name)
+{
+  const char *p, *end;
+  size_t len;
+
+  if (!params || !params->fields)
+    return 1;
+  if (!name)
+    return 0;
+
+  len = strlen (name);
+  for (p = params->fields; ; p = end + 1)
+    {
+      size_t field_len;
+
+      end = strchr (p, ',');
+      field_len = end ? end - p : strlen (p);
+
+      if (field_len == len && strncmp (p, name, len) == 0)
+        return 1;
+      if (!end)
+        return 0;
+    }
+}
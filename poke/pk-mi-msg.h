@@ -22,6 +22,8 @@
 #include <config.h>
 #include <stdint.h>
 
+#include "libpoke.h"
+
 /* Each MI message contains a "sequence number".  The protocol uses
    this number to univocally identify certain messages.  */
 
@@ -39,16 +41,49 @@ enum pk_mi_msg_type
 enum pk_mi_req_type
 {
   PK_MI_REQ_EXIT,
+  PK_MI_REQ_IOS_STATS,
+  PK_MI_REQ_ENCODING,
+  PK_MI_REQ_VALUE,
 };
 
 enum pk_mi_resp_type
 {
   PK_MI_RESP_EXIT,
+  PK_MI_RESP_IOS_STATS,
+  PK_MI_RESP_ENCODING,
+  PK_MI_RESP_VALUE,
 };
 
 enum pk_mi_event_type
 {
   PK_MI_EVENT_INITIALIZED,
+  PK_MI_EVENT_IOS_CHANGED,
+};
+
+/* Parameters selecting the part of a Poke value that is sent in a
+   VALUE response.
+
+   FROM and COUNT select a range of elements if the value is an array.
+   COUNT is PK_MI_VAL_ALL to select all the elements starting at FROM.
+
+   DEPTH is the maximum nesting level of the structs and arrays whose
+   contents are sent, the value itself being at level 0.  Deeper
+   structs and arrays are sent without fields or elements, and marked
+   as elided.  A negative DEPTH means there is no limit.
+
+   FIELDS is either NULL, or a NULL-terminated string with a comma
+   separated list of field names.  In the latter case only these fields
+   are sent of the value, if it is a struct, or of its elements, if it
+   is an array of structs.  */
+
+#define PK_MI_VAL_ALL UINT64_MAX
+
+struct pk_mi_val_params
+{
+  uint64_t from;
+  uint64_t count;
+  int depth;
+  char *fields;
 };
 
 /* The opaque pk_mi_msg type is fully defined in pk-mi-msg.c */
@@ -67,6 +102,30 @@ typedef struct pk_mi_msg *pk_mi_msg;
 
 pk_mi_msg pk_mi_make_req_exit (void);
 
+/* Build and return an IOS_STATS request.
+
+   IOS is the id of the IO space whose statistics are requested.  */
+
+pk_mi_msg pk_mi_make_req_ios_stats (int ios);
+
+/* Build and return an ENCODING request.
+
+   ENCODING is a NULL-terminated string with the name of the encoding
+   to use in the messages following the response to this request.  */
+
+pk_mi_msg pk_mi_make_req_encoding (const char *encoding);
+
+/* Build and return a VALUE request.
+
+   EXPR is a NULL-terminated string with the Poke expression whose
+   value is requested.
+
+   PARAMS selects the part of the value to send in the response.  If
+   it is NULL the whole value is sent.  */
+
+pk_mi_msg pk_mi_make_req_value (const char *expr,
+                                const struct pk_mi_val_params *params);
+
 /* Responses.
 
    The response constructors below get some arguments which are common
@@ -93,6 +152,35 @@ pk_mi_msg pk_mi_make_req_exit (void);
 pk_mi_msg pk_mi_make_resp_exit (pk_mi_seqnum req_seqnum,
                                 int success_p, const char *errmsg);
 
+/* Build and return an IOS_STATS response.
+
+   STATS are the statistics of the requested IO space.  It is ignored
+   if SUCCESS_P is 0.  */
+
+pk_mi_msg pk_mi_make_resp_ios_stats (pk_mi_seqnum req_seqnum,
+                                     int success_p, const char *errmsg,
+                                     const struct pk_ios_stats *stats);
+
+/* Build and return an ENCODING response.  */
+
+pk_mi_msg pk_mi_make_resp_encoding (pk_mi_seqnum req_seqnum,
+                                    int success_p, const char *errmsg);
+
+/* Build and return a VALUE response.
+
+   VAL is the value of the requested expression.  It is ignored if
+   SUCCESS_P is 0.  Note that the message is not traced by the
+   garbage collector, so VAL should be kept alive by the caller for
+   as long as the message is used.
+
+   PARAMS selects the part of VAL that is encoded in the message.  If
+   it is NULL the whole value is encoded.  */
+
+pk_mi_msg pk_mi_make_resp_value (pk_mi_seqnum req_seqnum,
+                                 int success_p, const char *errmsg,
+                                 pk_val val,
+                                 const struct pk_mi_val_params *params);
+
 /* Events.
 
    The arguments accepted by specific event constructors are described
@@ -108,21 +196,41 @@ pk_mi_msg pk_mi_make_resp_exit (pk_mi_seqnum req_seqnum,
 
 pk_mi_msg pk_mi_make_event_initialized (const char *version);
 
+/* Build and return an IOS_CHANGED event.
+
+   IOS is the id of the IO space that has been written.
+
+   RANGES is an array of 2 * NRANGES elements with the byte offset
+   and the size of each of the written ranges.  It is copied.  */
+
+pk_mi_msg pk_mi_make_event_ios_changed (int ios, size_t nranges,
+                                        const uint64_t *ranges);
+
 /*** API for getting properties of messages.   */
 
 enum pk_mi_msg_type pk_mi_msg_type (pk_mi_msg msg);
 pk_mi_seqnum pk_mi_msg_number (pk_mi_msg msg);
 
 enum pk_mi_req_type pk_mi_msg_req_type (pk_mi_msg msg);
+int pk_mi_msg_req_ios_stats_ios (pk_mi_msg msg);
+const char *pk_mi_msg_req_encoding_encoding (pk_mi_msg msg);
+const char *pk_mi_msg_req_value_expr (pk_mi_msg msg);
+const struct pk_mi_val_params *pk_mi_msg_req_value_params (pk_mi_msg msg);
 
 enum pk_mi_resp_type pk_mi_msg_resp_type (pk_mi_msg msg);
 pk_mi_seqnum pk_mi_msg_resp_req_number (pk_mi_msg msg);
 int pk_mi_msg_resp_success_p (pk_mi_msg msg);
 const char *pk_mi_msg_resp_errmsg (pk_mi_msg msg);
+const struct pk_ios_stats *pk_mi_msg_resp_ios_stats_stats (pk_mi_msg msg);
+pk_val pk_mi_msg_resp_value_val (pk_mi_msg msg);
+const struct pk_mi_val_params *pk_mi_msg_resp_value_params (pk_mi_msg msg);
 
 enum pk_mi_event_type pk_mi_msg_event_type (pk_mi_msg msg);
 const char *pk_mi_msg_event_initialized_version (pk_mi_msg msg);
 int pk_mi_msg_event_initialized_mi_version (pk_mi_msg msg);
+int pk_mi_msg_event_ios_changed_ios (pk_mi_msg msg);
+size_t pk_mi_msg_event_ios_changed_nranges (pk_mi_msg msg);
+const uint64_t *pk_mi_msg_event_ios_changed_ranges (pk_mi_msg msg);
 
 /*** Other operations on messages.  ***/
 
@@ -130,6 +238,31 @@ int pk_mi_msg_event_initialized_mi_version (pk_mi_msg msg);
 
 void pk_mi_set_msg_number (pk_mi_msg msg, pk_mi_seqnum number);
 
+/*** Operations on value parameters.  ***/
+
+/* The functions below are used by the encoders to apply the
+   parameters PARAMS, which may be NULL, to the parts of a value
+   located at nesting level LEVEL.  */
+
+/* Return whether the contents of a struct or array have to be
+   elided.  */
+
+int pk_mi_val_params_elided_p (const struct pk_mi_val_params *params,
+                               int level);
+
+/* Set *FROM and *TO to the range of elements to encode of an array
+   having NELEM elements.  */
+
+void pk_mi_val_params_range (const struct pk_mi_val_params *params,
+                             int level, uint64_t nelem,
+                             uint64_t *from, uint64_t *to);
+
+/* Return whether the struct field named NAME, which is NULL for
+   anonymous fields, has to be encoded.  */
+
+int pk_mi_val_params_field_p (const struct pk_mi_val_params *params,
+                              const char *name);
+
 /* Free the resources used by the given message MSG.  */
 
 void pk_mi_msg_free (pk_mi_msg msg);
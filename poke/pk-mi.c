@@ -28,9 +28,11 @@
 #include <errno.h>
 
 #include "poke.h"
+#include "pk-cmd.h"
 
 #include "pk-mi-msg.h"
 #include "pk-mi-json.h"
+#include "pk-mi-cbor.h"
 
 /* Transport Layer.
 
@@ -42,21 +44,50 @@
    type PMI_FrameMessage =
     struct
     {
-       big uint<4> size : size <= 2048;
+       big uint<1> more_p;
+       big uint<31> size : size <= 2048;
        byte[size] payload;
     }
 
    Where SIZE is the length of the payload, measured in bytes.  The
-   maximum lenght of a frame message payload is two kilobytes.  */
+   maximum lenght of a frame message payload is two kilobytes.
+
+   Messages whose encoding doesn't fit in a single frame message are
+   split in several frames.  All of them but the last have MORE_P set
+   to 1.  The payloads of the frames are concatenated by the receiver
+   and processed once the last frame is received, up to a total of
+   MAXMSG_TOTAL bytes.  */
 
 #define MAXMSG 2048
+#define MAXMSG_TOTAL (16 * 1024 * 1024)
+#define MORE_P 0x80000000U
+
+/* Encoding of the messages.  JSON is used until the client requests
+   another encoding with an ENCODING request.  */
+
+enum pk_mi_encoding
+{
+  PK_MI_ENCODING_JSON,
+  PK_MI_ENCODING_CBOR
+};
+
+static enum pk_mi_encoding pk_mi_encoding = PK_MI_ENCODING_JSON;
+
+/* Stream where the frame messages are written.  This is the standard
+   output at the time the MI is started, see pk_mi below.  */
+static FILE *pk_mi_out;
 
 static void pk_mi_dispatch_msg (pk_mi_msg msg);
 
 static void
 pk_mi_process_frame_msg (int size, char *frame_msg)
 {
-  pk_mi_msg msg = pk_mi_json_to_msg (frame_msg);
+  pk_mi_msg msg;
+
+  if (pk_mi_encoding == PK_MI_ENCODING_CBOR)
+    msg = pk_mi_cbor_to_msg (frame_msg, size);
+  else
+    msg = pk_mi_json_to_msg (frame_msg);
 
   if (!msg)
     /* Bad message.  Ignore it.  */
@@ -69,11 +100,14 @@ pk_mi_process_frame_msg (int size, char *frame_msg)
 static int
 pk_mi_read_from_client (int filedes)
 {
-  static char in_msg_size[4];
-  static char in_msg[MAXMSG];
+  static unsigned char in_msg_size[4];
+  static char *in_msg = NULL;
+  static size_t in_msg_alloc = 0;
+  static size_t in_msg_len = 0;
   static unsigned int in_msg_size_bytes_read = 0;
   static unsigned int in_msg_bytes_read = 0;
   static unsigned int msg_size = 0;
+  static int more_p = 0;
 
   char buffer[MAXMSG];
   ssize_t i, nbytes;
@@ -95,17 +129,34 @@ pk_mi_read_from_client (int filedes)
           in_msg_size[in_msg_size_bytes_read] = buffer[i];
           in_msg_size_bytes_read++;
         }
-    }
-  else
-    {
-      msg_size = ((unsigned int) in_msg_size[0] << 24
-                  | (unsigned int) in_msg_size[1] << 16
-                  | (unsigned int) in_msg_size[2] << 8
-                  | (unsigned int) in_msg_size[3]);
 
-      if (msg_size > MAXMSG)
+      if (in_msg_size_bytes_read < 4)
+        return 0;
+
+      msg_size = ((uint32_t) in_msg_size[0] << 24
+                  | (uint32_t) in_msg_size[1] << 16
+                  | (uint32_t) in_msg_size[2] << 8
+                  | (uint32_t) in_msg_size[3]);
+      more_p = (msg_size & MORE_P) != 0;
+      msg_size &= ~MORE_P;
+
+      if (msg_size > MAXMSG
+          || in_msg_len + msg_size > MAXMSG_TOTAL)
         goto protocol_error;
 
+      /* Make room for the payload plus a NUL terminator.  */
+      if (in_msg_len + msg_size + 1 > in_msg_alloc)
+        {
+          in_msg_alloc = in_msg_len + msg_size + 1;
+          if (in_msg_alloc < 2 * MAXMSG)
+            in_msg_alloc = 2 * MAXMSG;
+          in_msg = realloc (in_msg, in_msg_alloc);
+          if (!in_msg)
+            goto fatal;
+        }
+    }
+  else if (in_msg_bytes_read < msg_size)
+    {
       nbytes = read (filedes, buffer,
                      msg_size - in_msg_bytes_read);
       if (nbytes < 0)
@@ -116,20 +167,24 @@ pk_mi_read_from_client (int filedes)
       else if (nbytes == 0)
         goto end_of_file;
 
-      for (i = 0; i < nbytes; ++i)
-        {
-          in_msg[in_msg_bytes_read] = buffer[i];
-          in_msg_bytes_read++;
-        }
+      memcpy (in_msg + in_msg_len + in_msg_bytes_read, buffer, nbytes);
+      in_msg_bytes_read += nbytes;
     }
 
-  if (in_msg_bytes_read != 0
+  if (in_msg_size_bytes_read == 4
       && in_msg_bytes_read == msg_size)
     {
-      /* A framed message is ready.  Process it.  */
-      pk_mi_process_frame_msg (in_msg_bytes_read, in_msg);
+      in_msg_len += msg_size;
+
+      if (!more_p)
+        {
+          /* A message is ready.  Process it.  */
+          in_msg[in_msg_len] = '\0';
+          pk_mi_process_frame_msg (in_msg_len, in_msg);
+          in_msg_len = 0;
+        }
 
-      /* Prepare to receive another message.  */
+      /* Prepare to receive another frame message.  */
       in_msg_size_bytes_read = 0;
       in_msg_bytes_read = 0;
       msg_size = 0;
@@ -148,19 +203,59 @@ pk_mi_read_from_client (int filedes)
   return -1;
 }
 
+/* The encoded messages are written to a frame writer, which sends a
+   frame message every time MAXMSG bytes are accumulated.  */
+
+struct pk_mi_frame_writer
+{
+  char payload[MAXMSG];
+  uint32_t size;
+};
+
 static void
-pk_mi_send_frame_msg (const char *payload)
+pk_mi_send_frame_msg (const char *payload, uint32_t size, int more_p)
 {
-  uint32_t size = strlen (payload) + 1 /* the newline */;
+  uint32_t word = size | (more_p ? MORE_P : 0);
 
-  fputc ((size >> 24 & 0xff), stdout);
-  fputc ((size >> 16 & 0xff), stdout);
-  fputc ((size >> 8 & 0xff), stdout);
-  fputc ((size >> 0 & 0xff), stdout);
-  fputs (payload, stdout);
-  fputc ('\n', stdout); /* To ease debugging, logging, etc.  */
+  fputc ((word >> 24 & 0xff), pk_mi_out);
+  fputc ((word >> 16 & 0xff), pk_mi_out);
+  fputc ((word >> 8 & 0xff), pk_mi_out);
+  fputc ((word >> 0 & 0xff), pk_mi_out);
+  fwrite (payload, 1, size, pk_mi_out);
+}
 
-  fflush (stdout);
+static void
+pk_mi_frame_write (const void *buf, size_t size, void *data)
+{
+  struct pk_mi_frame_writer *writer = data;
+  const char *p = buf;
+
+  while (size > 0)
+    {
+      size_t chunk;
+
+      if (writer->size == MAXMSG)
+        {
+          pk_mi_send_frame_msg (writer->payload, writer->size,
+                                1 /* more_p */);
+          writer->size = 0;
+        }
+
+      chunk = MAXMSG - writer->size;
+      if (chunk > size)
+        chunk = size;
+      memcpy (writer->payload + writer->size, p, chunk);
+      writer->size += chunk;
+      p += chunk;
+      size -= chunk;
+    }
+}
+
+static void
+pk_mi_frame_finish (struct pk_mi_frame_writer *writer)
+{
+  pk_mi_send_frame_msg (writer->payload, writer->size, 0 /* more_p */);
+  fflush (pk_mi_out);
 }
 
 /* Set fd to non-blocking and return old flags or -1 on error. */
@@ -193,6 +288,33 @@ static void pk_mi_fd_restore_blocking (int fd, int flags)
 /* This global is used to finalize the MI loop.  */
 static int pk_mi_exit_p;
 
+static void pk_mi_record_ios_generations (void);
+static void pk_mi_notify_ios_changes (void);
+
+/* The MI loop also waits for the files of the IO spaces to be
+   modified by other programs, and then sends IOS_CHANGED events for
+   them.  */
+
+static void
+pk_mi_watch_ios (pk_ios io, void *data)
+{
+  fd_set *set = data;
+  int fd = pk_ios_change_fd (io);
+
+  if (fd != -1 && fd < FD_SETSIZE)
+    FD_SET (fd, set);
+}
+
+static void
+pk_mi_refresh_ios (pk_ios io, void *data)
+{
+  fd_set *set = data;
+  int fd = pk_ios_change_fd (io);
+
+  if (fd != -1 && fd < FD_SETSIZE && FD_ISSET (fd, set))
+    pk_ios_refresh (poke_compiler, io);
+}
+
 static int
 pk_mi_loop (int fd)
 {
@@ -214,6 +336,7 @@ pk_mi_loop (int fd)
   while (1)
     {
       read_fd_set = active_fd_set;
+      pk_ios_map (poke_compiler, pk_mi_watch_ios, &read_fd_set);
       if (select (FD_SETSIZE, &read_fd_set, NULL, NULL,
                   NULL /* timeout */) < 0)
         {
@@ -223,6 +346,10 @@ pk_mi_loop (int fd)
           pk_fatal (NULL);
         }
 
+      pk_mi_record_ios_generations ();
+      pk_ios_map (poke_compiler, pk_mi_refresh_ios, &read_fd_set);
+      pk_mi_notify_ios_changes ();
+
       if (FD_ISSET (fd, &read_fd_set))
         {
           ret = pk_mi_read_from_client (fd);
@@ -258,12 +385,131 @@ pk_mi_loop (int fd)
 static void
 pk_mi_send (pk_mi_msg msg)
 {
-  const char *payload = pk_mi_msg_to_json (msg);
+  struct pk_mi_frame_writer writer;
+
+  writer.size = 0;
+  if (pk_mi_encoding == PK_MI_ENCODING_CBOR)
+    pk_mi_msg_to_cbor (msg, pk_mi_frame_write, &writer);
+  else
+    {
+      const char *payload = pk_mi_msg_to_json (msg);
 
-  if (!payload)
-    pk_fatal ("converting MI msg to json");
+      if (!payload)
+        pk_fatal ("converting MI msg to json");
 
-  pk_mi_send_frame_msg (payload);
+      pk_mi_frame_write (payload, strlen (payload), &writer);
+      /* To ease debugging, logging, etc.  */
+      pk_mi_frame_write ("\n", 1, &writer);
+    }
+
+  pk_mi_frame_finish (&writer);
+}
+
+/* Change notifications.
+
+   Before processing a request that may write to the IO spaces, the
+   generation of every IO space is recorded.  After processing it, an
+   IOS_CHANGED event is sent for every IO space written in the
+   meanwhile, with the ranges written since the recorded
+   generation.  */
+
+struct pk_mi_ios_gen
+{
+  int ios;
+  uint64_t generation;
+};
+
+static struct pk_mi_ios_gen *pk_mi_ios_gens;
+static size_t pk_mi_ios_ngens;
+static size_t pk_mi_ios_gens_size;
+
+static void
+pk_mi_record_ios (pk_ios io, void *data)
+{
+  if (pk_mi_ios_ngens == pk_mi_ios_gens_size)
+    {
+      pk_mi_ios_gens_size = pk_mi_ios_gens_size ? pk_mi_ios_gens_size * 2 : 8;
+      pk_mi_ios_gens = realloc (pk_mi_ios_gens,
+                                (pk_mi_ios_gens_size
+                                 * sizeof (struct pk_mi_ios_gen)));
+      if (!pk_mi_ios_gens)
+        pk_fatal ("recording IO spaces generations");
+    }
+
+  pk_mi_ios_gens[pk_mi_ios_ngens].ios = pk_ios_get_id (io);
+  pk_mi_ios_gens[pk_mi_ios_ngens].generation = pk_ios_generation (io);
+  pk_mi_ios_ngens++;
+}
+
+struct pk_mi_ranges
+{
+  uint64_t *ranges;
+  size_t nranges;
+  size_t size;
+};
+
+static void
+pk_mi_add_range (uint64_t offset, uint64_t size, void *data)
+{
+  struct pk_mi_ranges *r = data;
+
+  if (r->nranges == r->size)
+    {
+      r->size = r->size ? r->size * 2 : 8;
+      r->ranges = realloc (r->ranges, 2 * r->size * sizeof (uint64_t));
+      if (!r->ranges)
+        pk_fatal ("collecting written ranges");
+    }
+
+  r->ranges[2 * r->nranges] = offset;
+  r->ranges[2 * r->nranges + 1] = size;
+  r->nranges++;
+}
+
+static void
+pk_mi_notify_ios (pk_ios io, void *data)
+{
+  struct pk_mi_ranges r = { NULL, 0, 0 };
+  uint64_t generation = 0;
+  int id = pk_ios_get_id (io);
+  pk_mi_msg event;
+  size_t i;
+
+  /* IO spaces opened while processing the request have no recorded
+     generation, and all their ranges are sent.  */
+  for (i = 0; i < pk_mi_ios_ngens; ++i)
+    if (pk_mi_ios_gens[i].ios == id)
+      {
+        generation = pk_mi_ios_gens[i].generation;
+        break;
+      }
+
+  if (generation == pk_ios_generation (io))
+    return;
+
+  pk_ios_dirty_ranges (io, generation, pk_mi_add_range, &r);
+  if (r.nranges > 0)
+    {
+      event = pk_mi_make_event_ios_changed (id, r.nranges, r.ranges);
+      if (!event)
+        pk_fatal ("building MI event");
+      pk_mi_send (event);
+      pk_mi_msg_free (event);
+    }
+  free (r.ranges);
+}
+
+static void
+pk_mi_record_ios_generations (void)
+{
+  pk_mi_ios_ngens = 0;
+  pk_ios_map (poke_compiler, pk_mi_record_ios, NULL);
+}
+
+static void
+pk_mi_notify_ios_changes (void)
+{
+  pk_ios_map (poke_compiler, pk_mi_notify_ios, NULL);
 }
 
 /* Message dispatcher.  */
@@ -286,6 +532,80 @@ pk_mi_dispatch_msg (pk_mi_msg msg)
             pk_mi_exit_p = 1;
             break;
           }
+        case PK_MI_REQ_IOS_STATS:
+          {
+            pk_ios io
+              = pk_ios_search_by_id (poke_compiler,
+                                     pk_mi_msg_req_ios_stats_ios (msg));
+            struct pk_ios_stats stats;
+            pk_mi_msg resp;
+
+            if (io)
+              pk_ios_stats (io, &stats);
+            resp = pk_mi_make_resp_ios_stats (pk_mi_msg_number (msg),
+                                              io != NULL /* success_p */,
+                                              io ? NULL : "no such IO space",
+                                              &stats);
+            if (!resp)
+              pk_fatal ("building MI response");
+            pk_mi_send (resp);
+            pk_mi_msg_free (resp);
+            break;
+          }
+        case PK_MI_REQ_ENCODING:
+          {
+            const char *name = pk_mi_msg_req_encoding_encoding (msg);
+            int json_p = (strcmp (name, "json") == 0);
+            int cbor_p = (strcmp (name, "cbor") == 0);
+            pk_mi_msg resp
+              = pk_mi_make_resp_encoding (pk_mi_msg_number (msg),
+                                          json_p || cbor_p /* success_p */,
+                                          (json_p || cbor_p
+                                           ? NULL : "unknown encoding"));
+
+            /* The response is sent using the old encoding.  */
+            if (!resp)
+              pk_fatal ("building MI response");
+            pk_mi_send (resp);
+            pk_mi_msg_free (resp);
+
+            if (json_p)
+              pk_mi_encoding = PK_MI_ENCODING_JSON;
+            else if (cbor_p)
+              pk_mi_encoding = PK_MI_ENCODING_CBOR;
+            break;
+          }
+        case PK_MI_REQ_VALUE:
+          {
+            /* VAL is kept in this frame so the collector sees it,
+               since the response message is not traced.  */
+            pk_val val = PK_NULL;
+            int success_p;
+            pk_mi_msg resp;
+
+            /* Evaluating the expression may write to the IO spaces.  */
+            pk_mi_record_ios_generations ();
+            pk_cmd_autoload (pk_mi_msg_req_value_expr (msg));
+            success_p = (pk_compile_expression (poke_compiler,
+                                                pk_mi_msg_req_value_expr (msg),
+                                                NULL, &val) == PK_OK);
+            pk_mi_notify_ios_changes ();
+
+            resp
+              = pk_mi_make_resp_value (pk_mi_msg_number (msg),
+                                       success_p,
+                                       (success_p
+                                        ? NULL
+                                        : "error evaluating expression"),
+                                       val,
+                                       pk_mi_msg_req_value_params (msg));
+
+            if (!resp)
+              pk_fatal ("building MI response");
+            pk_mi_send (resp);
+            pk_mi_msg_free (resp);
+            break;
+          }
         default:
           assert (0);
         }
@@ -307,9 +627,27 @@ pk_mi (void)
   pk_mi_msg initialized_msg
     = pk_mi_make_event_initialized (VERSION);
 
+  int out_fd;
+
   if (!initialized_msg)
     return 0;
 
+  /* The frame messages are written to the standard output, but the
+     terminal output of poke, like the output of `print' statements,
+     also goes there.  Write the frames to a copy of the standard output
+     and redirect the latter to the standard error, so the terminal
+     output doesn't get mixed with the frames.  */
+  out_fd = dup (STDOUT_FILENO);
+  if (out_fd == -1
+      || (pk_mi_out = fdopen (out_fd, "w")) == NULL)
+    {
+      perror ("dup");
+      return 0;
+    }
+  fflush (stdout);
+  if (dup2 (STDERR_FILENO, STDOUT_FILENO) == -1)
+    perror ("dup2");
+
   pk_mi_send (initialized_msg);
   return pk_mi_loop (STDIN_FILENO);
 }
@@ -58,6 +58,10 @@ static int volatile ctrlc_buf_valid;
 static char *
 poke_completion_function (const char *text, int state)
 {
+  /* Make the commands written in Poke available for completion.  */
+  if (state == 0)
+    pk_cmd_autoload_all ();
+
   /* First try to complete with "normal" commands.  */
   char *function_name = pk_completion_function (poke_compiler,
                                                 text, state);
@@ -146,6 +150,12 @@ poke_getc (FILE *stream)
          }
      }
 
+#if HAVE_HSERVER
+  /* Run the commands of the hyperlinks activated while waiting.  */
+  if (poke_hserver_p)
+    pk_hserver_wait (fileno (stream));
+#endif
+
   int c =  rl_getc (stream);
 
   /* Due to readline's apparent inability to change the word break
@@ -307,6 +317,12 @@ pk_prompt (void)
   return prompt;
 }
 
+static void
+pk_repl_refresh_ios (pk_ios io, void *data)
+{
+  pk_ios_refresh (poke_compiler, io);
+}
+
 void
 pk_repl (void)
 {
@@ -383,6 +399,9 @@ pk_repl (void)
           add_history (line);
 #endif
 
+          /* Account for the modifications made by other programs
+             to the files being poked while waiting for input.  */
+          pk_ios_map (poke_compiler, pk_repl_refresh_ios, NULL);
           pk_cmd_exec (line);
         }
       free (line);
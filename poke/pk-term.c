@@ -33,6 +33,141 @@
    emit contents to the terminal.  */
 static styled_ostream_t pk_ostream;
 
+/* Output buffer.
+
+   The text emitted by pk_puts and friends is accumulated in
+   pk_term_buf, and passed to pk_ostream in big chunks.  The buffer is
+   emptied when it gets full, when the styling changes, when the
+   terminal is flushed and, if the standard output is a terminal, at
+   the end of every line.  */
+
+#define PK_TERM_BUFSIZE 8192
+
+static char pk_term_buf[PK_TERM_BUFSIZE];
+static size_t pk_term_buf_len;
+static int pk_term_line_buffered_p;
+
+/* Styling classes are not passed to pk_ostream as they are begun and
+   ended.  Instead, they are queued in pending_classes and applied just
+   before the next piece of text is written.  This allows to drop the
+   spans of styled text that are empty, and to merge consecutive spans
+   of the same class, which are very common when printing values.
+
+   If no style file is in use the classes are not passed to pk_ostream
+   at all.  */
+
+struct pending_class
+{
+  int begin_p;
+  char *class;
+};
+
+static struct pending_class *pending_classes;
+static size_t pending_classes_num;
+static size_t pending_classes_size;
+static int pk_term_styled_p;
+
+static void
+pk_term_flush_buffer (void)
+{
+  if (pk_term_buf_len > 0)
+    {
+      ostream_write_mem (pk_ostream, pk_term_buf, pk_term_buf_len);
+      pk_term_buf_len = 0;
+    }
+}
+
+static void
+pk_term_queue_class (int begin_p, const char *class)
+{
+  struct pending_class *last
+    = (pending_classes_num > 0
+       ? &pending_classes[pending_classes_num - 1] : NULL);
+
+  if (!pk_term_styled_p)
+    return;
+
+  /* begin(C) end(C) is an empty span, and end(C) begin(C) joins two
+     adjacent spans.  In both cases the two operations cancel.  */
+  if (last && last->begin_p != begin_p && STREQ (last->class, class))
+    {
+      free (last->class);
+      pending_classes_num--;
+      return;
+    }
+
+  if (pending_classes_num == pending_classes_size)
+    {
+      pending_classes_size
+        = pending_classes_size ? 2 * pending_classes_size : 16;
+      pending_classes = xrealloc (pending_classes,
+                                  pending_classes_size
+                                  * sizeof (struct pending_class));
+    }
+
+  pending_classes[pending_classes_num].begin_p = begin_p;
+  pending_classes[pending_classes_num].class = xstrdup (class);
+  pending_classes_num++;
+}
+
+/* Pass the buffered text and the pending classes to pk_ostream.  This
+   should be done before any operation on pk_ostream other than
+   writing text.  */
+
+static void
+pk_term_sync (void)
+{
+  size_t i;
+
+  pk_term_flush_buffer ();
+
+  for (i = 0; i < pending_classes_num; ++i)
+    {
+      if (pending_classes[i].begin_p)
+        styled_ostream_begin_use_class (pk_ostream, pending_classes[i].class);
+      else
+        styled_ostream_end_use_class (pk_ostream, pending_classes[i].class);
+      free (pending_classes[i].class);
+    }
+  pending_classes_num = 0;
+}
+
+static void
+pk_term_write (const char *str, size_t len)
+{
+  if (pending_classes_num > 0)
+    pk_term_sync ();
+
+  if (pk_term_buf_len + len > PK_TERM_BUFSIZE)
+    {
+      pk_term_flush_buffer ();
+      if (len > PK_TERM_BUFSIZE)
+        {
+          ostream_write_mem (pk_ostream, str, len);
+          return;
+        }
+    }
+
+  memcpy (pk_term_buf + pk_term_buf_len, str, len);
+  pk_term_buf_len += len;
+
+  if (pk_term_line_buffered_p && memchr (str, '\n', len) != NULL)
+    pk_term_flush_buffer ();
+}
+
+/* Make sure no buffered output is lost if poke exits without calling
+   pk_term_shutdown.  */
+
+static void
+pk_term_atexit (void)
+{
+  if (pk_ostream)
+    {
+      pk_term_sync ();
+      ostream_flush (pk_ostream, FLUSH_THIS_STREAM);
+    }
+}
+
 /* Stack of active classes.  */
 
 struct class_entry
@@ -218,6 +353,12 @@ pk_term_init (int argc, char *argv[])
      : styled_ostream_create (STDOUT_FILENO, "(stdout)",
                               TTYCTL_AUTO, style_file_name));
 
+  pk_term_line_buffered_p = isatty (STDOUT_FILENO);
+#ifdef HAVE_LIBTEXTSTYLE
+  pk_term_styled_p = (style_file_name != NULL);
+#endif
+  atexit (pk_term_atexit);
+
   /* Initialize the default colors and register them associated to the
      RGB (-1,-1,-1).  */
 #if defined HAVE_TEXTSTYLE_ACCESSORS_SUPPORT
@@ -239,22 +380,26 @@ pk_term_init (int argc, char *argv[])
 void
 pk_term_shutdown ()
 {
+  pk_term_sync ();
   while (active_classes)
     pop_active_class (active_classes->class);
   dispose_color_registry ();
   styled_ostream_free (pk_ostream);
+  pk_ostream = NULL;
+  free (pending_classes);
 }
 
 void
 pk_term_flush ()
 {
+  pk_term_sync ();
   ostream_flush (pk_ostream, FLUSH_THIS_STREAM);
 }
 
 void
 pk_puts (const char *str)
 {
-  ostream_write_str (pk_ostream, str);
+  pk_term_write (str, strlen (str));
 }
 
 __attribute__ ((__format__ (__printf__, 1, 2)))
@@ -262,28 +407,43 @@ void
 pk_printf (const char *format, ...)
 {
   va_list ap;
-  char *str;
-  int r;
 
   va_start (ap, format);
-  r = vasprintf (&str, format, ap);
-  assert (r != -1);
+  pk_vprintf (format, ap);
   va_end (ap);
-
-  ostream_write_str (pk_ostream, str);
-  free (str);
 }
 
 void
 pk_vprintf (const char *format, va_list ap)
 {
+  va_list aq;
   char *str;
   int r;
 
+  if (pending_classes_num > 0)
+    pk_term_sync ();
+
+  /* Format directly into the buffer if the result fits in it.  */
+  va_copy (aq, ap);
+  r = vsnprintf (pk_term_buf + pk_term_buf_len,
+                 PK_TERM_BUFSIZE - pk_term_buf_len, format, aq);
+  va_end (aq);
+  assert (r >= 0);
+
+  if ((size_t) r < PK_TERM_BUFSIZE - pk_term_buf_len)
+    {
+      const char *str = pk_term_buf + pk_term_buf_len;
+
+      pk_term_buf_len += r;
+      if (pk_term_line_buffered_p && memchr (str, '\n', r) != NULL)
+        pk_term_flush_buffer ();
+      return;
+    }
+
   r = vasprintf (&str, format, ap);
   assert (r != -1);
 
-  ostream_write_str (pk_ostream, str);
+  pk_term_write (str, r);
   free (str);
 }
 
@@ -298,7 +458,7 @@ pk_term_indent (unsigned int lvl,
 void
 pk_term_class (const char *class)
 {
-  styled_ostream_begin_use_class (pk_ostream, class);
+  pk_term_queue_class (1 /* begin_p */, class);
   push_active_class (class);
 }
 
@@ -308,7 +468,7 @@ pk_term_end_class (const char *class)
   if (!pop_active_class (class))
     return 0;
 
-  styled_ostream_end_use_class (pk_ostream, class);
+  pk_term_queue_class (0 /* begin_p */, class);
   return 1;
 }
 
@@ -319,6 +479,7 @@ void
 pk_term_hyperlink (const char *url, const char *id)
 {
 #ifdef HAVE_TEXTSTYLE_HYPERLINK_SUPPORT
+  pk_term_sync ();
   styled_ostream_set_hyperlink (pk_ostream, url, id);
   hlcount += 1;
 #endif
@@ -331,6 +492,7 @@ pk_term_end_hyperlink (void)
   if (hlcount == 0)
     return 0;
 
+  pk_term_sync ();
   styled_ostream_set_hyperlink (pk_ostream, NULL, NULL);
   hlcount -= 1;
   return 1;
@@ -414,6 +576,7 @@ pk_term_set_color (struct pk_color color)
                               color.red, color.green, color.blue);
             }
 
+          pk_term_sync ();
           term_ostream_set_color (term_ostream, term_color);
         }
     }
@@ -443,6 +606,7 @@ pk_term_set_bgcolor (struct pk_color color)
                               color.red, color.green, color.blue);
             }
 
+          pk_term_sync ();
           term_ostream_set_bgcolor (term_ostream, term_color);
         }
     }
@@ -146,6 +146,7 @@ enum
   VERSION_ARG,
   QUIET_ARG,
   LOAD_ARG,
+  LOAD_ASYNC_ARG,
   LOAD_AND_EXIT_ARG,
   CMD_ARG,
   NO_INIT_FILE_ARG,
@@ -154,7 +155,8 @@ enum
   STYLE_ARG,
   MI_ARG,
   NO_AUTO_MAP_ARG,
-  NO_HSERVER_ARG
+  NO_HSERVER_ARG,
+  TIME_PASSES_ARG
 };
 
 static const struct option long_options[] =
@@ -163,6 +165,7 @@ static const struct option long_options[] =
   {"version", no_argument, NULL, VERSION_ARG},
   {"quiet", no_argument, NULL, QUIET_ARG},
   {"load", required_argument, NULL, LOAD_ARG},
+  {"load-async", required_argument, NULL, LOAD_ASYNC_ARG},
   {"command", required_argument, NULL, CMD_ARG},
   {"source", required_argument, NULL, SOURCE_ARG},
   {"no-init-file", no_argument, NULL, NO_INIT_FILE_ARG},
@@ -171,6 +174,7 @@ static const struct option long_options[] =
   {"mi", no_argument, NULL, MI_ARG},
   {"no-auto-map", no_argument, NULL, NO_AUTO_MAP_ARG},
   {"no-hserver", no_argument, NULL, NO_HSERVER_ARG},
+  {"time-passes", no_argument, NULL, TIME_PASSES_ARG},
   {NULL, 0, NULL, 0},
 };
 
@@ -190,6 +194,7 @@ print_help (void)
      no-wrap */
   pk_puts (_("  -l, --load=FILE                     load the given pickle at startup\n"));
   pk_puts (_("  -L FILE                             load the given pickle and exit\n"));
+  pk_puts (_("      --load-async=MODULE             load the given module in the background\n"));
 
   pk_puts ("\n");
 
@@ -217,6 +222,7 @@ print_help (void)
   pk_puts (_("      --no-hserver                    do not run the hyperlinks server\n"));
 #endif
   pk_puts (_("      --quiet                         be as terse as possible\n"));
+  pk_puts (_("      --time-passes                   report the time spent in compiler passes\n"));
   pk_puts (_("      --help                          print a help message and exit\n"));
   pk_puts (_("      --version                       show version and exit\n"));
 
@@ -278,6 +284,9 @@ There is NO WARRANTY, to the extent permitted by law.\n");
 
     pk_printf (_("\
 \nPowered by Jitter %s."), JITTER_VERSION);
+    if (!hand_p)
+      pk_printf (_(" PVM dispatch model: %s."),
+                 pk_vm_dispatch (poke_compiler));
 
     pk_puts (_("\
 \n\
@@ -416,12 +425,20 @@ parse_args_2 (int argc, char *argv[])
           poke_quiet_p = 1;
           pk_set_quiet_p (poke_compiler, 1);
           break;
+        case TIME_PASSES_ARG:
+          pk_set_time_passes_p (poke_compiler, 1);
+          break;
         case 'l':
         case LOAD_ARG:
+          pk_cmd_autoload_file (optarg);
           if (pk_compile_file (poke_compiler, optarg,
                                NULL /* exit_status */) != PK_OK)
             goto exit_success;
           break;
+        case LOAD_ASYNC_ARG:
+          if (pk_load_async (poke_compiler, optarg) != PK_OK)
+            goto exit_failure;
+          break;
         case 'c':
         case CMD_ARG:
           {
@@ -445,6 +462,7 @@ parse_args_2 (int argc, char *argv[])
                command-line arguments.  Then execute the script and
                return.  */
             set_script_args (argc, argv);
+            pk_cmd_autoload_file (optarg);
             if (pk_compile_file (poke_compiler, optarg, &exit_status) != PK_OK)
               goto exit_failure;
 
@@ -667,6 +685,7 @@ pk_fatal (const char *errmsg)
     pk_printf ("fatal error: %s\n", errmsg);
   pk_printf ("This is a bug. Please report it to %s\n",
              PACKAGE_BUGREPORT);
+  pk_term_flush ();
   abort ();
 }
 
@@ -21,7 +21,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <err.h>
+#include <dirent.h>
+#include <sys/wait.h>
 #include "read-file.h"
 #include "libpoke.h"
 
@@ -91,6 +94,705 @@ test_pk_compiler_new (void)
   return pkc;
 }
 
+#define BCACHE_DIR "api-bcache"
+
+/* Return the number of cache files in BCACHE_DIR.  If REMOVE_P is
+   set, remove them and BCACHE_DIR.  */
+
+static int
+bcache_files (int remove_p)
+{
+  DIR *directory = opendir (BCACHE_DIR);
+  struct dirent *dir;
+  int count = 0;
+
+  if (directory == NULL)
+    return 0;
+
+  while ((dir = readdir (directory)))
+    {
+      const char *ext = strrchr (dir->d_name, '.');
+      char path[512];
+
+      if (ext == NULL || strcmp (ext, ".pkbc") != 0)
+        continue;
+
+      count++;
+      if (remove_p)
+        {
+          snprintf (path, sizeof (path), "%s/%s", BCACHE_DIR, dir->d_name);
+          unlink (path);
+        }
+    }
+  closedir (directory);
+
+  if (remove_p)
+    rmdir (BCACHE_DIR);
+  return count;
+}
+
+static void
+test_pk_bytecode_cache (void)
+{
+  pk_compiler pkc;
+  pk_val val;
+  int i;
+
+  setenv ("POKECACHEDIR", BCACHE_DIR, 1);
+  bcache_files (1);
+
+  /* The first compiler writes the cache file, and the second one
+     uses it.  */
+  for (i = 0; i < 2; i++)
+    {
+      pkc = pk_compiler_new (&poke_term_if);
+      if (pkc == NULL)
+        {
+          fail ("pk_bytecode_cache_1");
+          break;
+        }
+
+      T ("pk_bytecode_cache_1", bcache_files (0) == 1);
+      T ("pk_bytecode_cache_2",
+         pk_compile_expression (pkc, "ltrim (\"  foo\")", NULL,
+                                &val) == PK_OK
+         && strcmp (pk_string_str (val), "foo") == 0);
+      T ("pk_bytecode_cache_3",
+         pk_compile_expression (pkc, "atoi (\"42\") + Exception {}.code",
+                                NULL, &val) == PK_OK
+         && pk_int_value (val) == 42);
+
+      pk_compiler_free (pkc);
+    }
+
+  bcache_files (1);
+  unsetenv ("POKECACHEDIR");
+}
+
+static void
+test_pk_compile_stats (pk_compiler pkc)
+{
+  struct pk_compile_stats stats;
+  pk_val val;
+
+  /* The run-time and the standard library have been compiled.  */
+  pk_compile_stats (pkc, &stats);
+  T ("pk_compile_stats_1", stats.compilations >= 2
+     && stats.ast_nodes > 0
+     && stats.routines > 0
+     && stats.insns >= stats.max_routine_insns
+     && stats.max_routine_insns > 0);
+
+  pk_reset_compile_stats (pkc);
+  pk_compile_stats (pkc, &stats);
+  T ("pk_compile_stats_2", stats.compilations == 0
+     && stats.ast_nodes == 0
+     && stats.routines == 0
+     && stats.insns == 0);
+
+  if (pk_compile_expression (pkc, "2 + 3", NULL, &val) != PK_OK)
+    fail ("pk_compile_stats_3");
+  pk_compile_stats (pkc, &stats);
+  T ("pk_compile_stats_3", stats.compilations == 1
+     && stats.ast_nodes > 0
+     && stats.routines == 1
+     && stats.insns > 0);
+}
+
+static void
+test_pk_call (pk_compiler pkc)
+{
+  struct pk_compile_stats stats;
+  pk_val cls, val;
+  int i, ok;
+
+  if (pk_compile_expression (pkc,
+                             "lambda (int a, int b) int: { return a - b; }",
+                             NULL, &cls) != PK_OK)
+    fail ("pk_call_1");
+
+  T ("pk_call_1",
+     pk_call (pkc, cls, &val, pk_make_int (5, 32), pk_make_int (3, 32),
+              PK_NULL) == PK_OK
+     && pk_int_value (val) == 2);
+
+  /* Further calls with the same number of arguments reuse the
+     trampoline, and compile nothing.  */
+  pk_reset_compile_stats (pkc);
+  ok = 1;
+  for (i = 0; i < 100; ++i)
+    ok = ok && (pk_call (pkc, cls, &val, pk_make_int (i, 32),
+                         pk_make_int (1, 32), PK_NULL) == PK_OK)
+         && pk_int_value (val) == i - 1;
+  pk_compile_stats (pkc, &stats);
+  T ("pk_call_2", ok && stats.routines == 0);
+
+  if (pk_compile_expression (pkc,
+                             "lambda (int a, int b, int c, int d, int e, "
+                             "int f, int g, int h, int i, int j) int: "
+                             "{ return a + b + c + d + e + f + g + h + i"
+                             " + j; }",
+                             NULL, &cls) != PK_OK)
+    fail ("pk_call_3");
+
+  T ("pk_call_3",
+     pk_call (pkc, cls, &val,
+              pk_make_int (1, 32), pk_make_int (2, 32), pk_make_int (3, 32),
+              pk_make_int (4, 32), pk_make_int (5, 32), pk_make_int (6, 32),
+              pk_make_int (7, 32), pk_make_int (8, 32), pk_make_int (9, 32),
+              pk_make_int (10, 32), PK_NULL) == PK_OK
+     && pk_int_value (val) == 55);
+
+  if (pk_compile_expression (pkc, "lambda int: { return 1 / 0; }",
+                             NULL, &cls) != PK_OK)
+    fail ("pk_call_4");
+  T ("pk_call_4", pk_call (pkc, cls, &val, PK_NULL) == PK_ERROR);
+}
+
+static void
+test_pk_prepared (pk_compiler pkc)
+{
+  pk_prepared prep;
+  pk_val val;
+
+  T ("pk_prepare_expression_1",
+     pk_prepare_expression (pkc, "int a, int b", "a * b + 1",
+                            &prep) == PK_OK);
+
+  T ("pk_run_prepared_1",
+     pk_run_prepared (prep, &val, pk_make_int (2, 32), pk_make_int (3, 32),
+                      PK_NULL) == PK_OK
+     && pk_int_value (val) == 7);
+  T ("pk_run_prepared_2",
+     pk_run_prepared (prep, &val, pk_make_int (5, 32), pk_make_int (5, 32),
+                      PK_NULL) == PK_OK
+     && pk_int_value (val) == 26);
+  pk_prepared_free (prep);
+
+  T ("pk_prepare_expression_2",
+     pk_prepare_expression (pkc, NULL, "40 + 2", &prep) == PK_OK);
+  T ("pk_run_prepared_3",
+     pk_run_prepared (prep, &val, PK_NULL) == PK_OK
+     && pk_int_value (val) == 42);
+  pk_prepared_free (prep);
+
+  T ("pk_prepare_expression_3",
+     pk_prepare_expression (pkc, "int a", "a +", &prep) == PK_ERROR);
+
+  T ("pk_prepare_expression_4",
+     pk_prepare_expression (pkc, "int a", "1 / a", &prep) == PK_OK);
+  T ("pk_run_prepared_4",
+     pk_run_prepared (prep, &val, pk_make_int (0, 32), PK_NULL) == PK_ERROR);
+  pk_prepared_free (prep);
+}
+
+static void
+test_pk_peephole (pk_compiler pkc)
+{
+  const char *exp = "[1, 2, 3] == [1, 2, 3] ? (2 > 1 ? 10 : 20) : 30";
+  pk_val val1, val2;
+
+  T ("pk_peephole_p_1", pk_peephole_p (pkc));
+
+  pk_set_peephole_p (pkc, 0);
+  T ("pk_peephole_p_2", !pk_peephole_p (pkc));
+  T ("pk_peephole_p_3",
+     pk_compile_expression (pkc, exp, NULL, &val1) == PK_OK);
+
+  pk_set_peephole_p (pkc, 1);
+  T ("pk_peephole_p_4",
+     pk_compile_expression (pkc, exp, NULL, &val2) == PK_OK
+     && pk_int_value (val1) == 10
+     && pk_int_value (val2) == 10);
+}
+
+static void
+test_pk_inline (pk_compiler pkc)
+{
+  const char *exp = "inline_twice (20) + 2";
+  pk_val val1, val2;
+
+  T ("pk_inline_threshold_1", pk_inline_threshold (pkc) > 0);
+  T ("pk_inline_threshold_2",
+     pk_compile_buffer (pkc,
+                        "fun inline_twice = (int i) int: { return i * 2; }",
+                        NULL) == PK_OK);
+
+  T ("pk_inline_threshold_3",
+     pk_set_inline_threshold (pkc, 0) == PK_OK
+     && pk_inline_threshold (pkc) == 0
+     && pk_compile_expression (pkc, exp, NULL, &val1) == PK_OK);
+
+  T ("pk_inline_threshold_4",
+     pk_set_inline_threshold (pkc, 16) == PK_OK
+     && pk_compile_expression (pkc, exp, NULL, &val2) == PK_OK
+     && pk_int_value (val1) == 42
+     && pk_int_value (val2) == 42);
+
+  T ("pk_inline_threshold_5",
+     pk_set_inline_threshold (pkc, -1) == PK_EINVAL
+     && pk_inline_threshold (pkc) == 16);
+}
+
+static void
+test_pk_gc (pk_compiler pkc)
+{
+  struct pk_gc_stats stats, stats2;
+  uint64_t divisor = pk_gc_free_space_divisor (pkc);
+
+  T ("pk_set_gc_free_space_divisor_1",
+     pk_set_gc_free_space_divisor (pkc, 0) == PK_EINVAL);
+  T ("pk_set_gc_free_space_divisor_2",
+     pk_set_gc_free_space_divisor (pkc, divisor + 1) == PK_OK
+     && pk_gc_free_space_divisor (pkc) == divisor + 1);
+  pk_set_gc_free_space_divisor (pkc, divisor);
+
+  pk_gc_stats (pkc, &stats);
+  T ("pk_gc_stats_1",
+     stats.heap_size > 0 && stats.total_bytes > 0);
+  T ("pk_gc_stats_2",
+     stats.live_bytes <= stats.heap_size - stats.free_bytes
+     && stats.max_pause_time <= stats.pause_time);
+  T ("pk_gc_stats_3",
+     pk_compile_buffer (pkc,
+                        "type GC_T = struct { string s; };"
+                        "var gc_v = [GC_T { s = \"x\" }];",
+                        NULL) == PK_OK);
+  pk_gc_stats (pkc, &stats2);
+  T ("pk_gc_stats_4",
+     stats2.arrays > stats.arrays && stats2.structs > stats.structs
+     && stats2.strings > stats.strings);
+}
+
+static void
+test_pk_profile (pk_compiler pkc)
+{
+  const char *src =
+    "fun fib = (int n) int: { return n < 2 ? n : fib (n - 1) + fib (n - 2); }";
+  pk_val val;
+
+  T ("pk_profile_functions_p_1", !pk_profile_functions_p (pkc));
+  T ("pk_profile_functions_p_2",
+     pk_compile_buffer (pkc, src, NULL) == PK_OK);
+
+  pk_set_profile_functions (pkc, 1);
+  T ("pk_profile_functions_p_3", pk_profile_functions_p (pkc));
+  T ("pk_profile_functions_p_4",
+     pk_compile_expression (pkc, "fib (15)", NULL, &val) == PK_OK
+     && pk_int_value (val) == 610);
+
+  pk_set_profile_functions (pkc, 0);
+  T ("pk_profile_functions_p_5", !pk_profile_functions_p (pkc));
+  pk_reset_profile (pkc);
+}
+
+/* PVM_DISPATCH is the dispatch model chosen at configure time, or
+   the empty string if the best one supported by Jitter is used.  */
+
+static void
+test_pk_vm_dispatch (pk_compiler pkc)
+{
+  const char *dispatch = pk_vm_dispatch (pkc);
+
+  if (PVM_DISPATCH[0] != '\0')
+    T ("pk_vm_dispatch_1", strcmp (dispatch, PVM_DISPATCH) == 0);
+  else
+    T ("pk_vm_dispatch_1",
+       strcmp (dispatch, "switch") == 0
+       || strcmp (dispatch, "direct-threading") == 0
+       || strcmp (dispatch, "minimal-threading") == 0
+       || strcmp (dispatch, "no-threading") == 0);
+}
+
+static void
+test_pk_ios_stats (pk_compiler pkc)
+{
+  struct pk_ios_stats stats;
+  pk_ios io;
+  pk_val val;
+
+  T ("pk_ios_stats_1", pk_ios_open (pkc, "*stats*", 0, 1) != PK_IOS_NOID);
+  io = pk_ios_cur (pkc);
+
+  pk_ios_stats (io, &stats);
+  T ("pk_ios_stats_2", stats.reads == 0 && stats.writes == 0);
+
+  T ("pk_ios_stats_3",
+     pk_compile_statement (pkc, "uint<32> @ 4#B = 42;", NULL, NULL) == PK_OK
+     && pk_compile_expression (pkc, "uint<32> @ 4#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 42);
+
+  pk_ios_stats (io, &stats);
+  T ("pk_ios_stats_4",
+     stats.reads >= 1 && stats.read_bytes >= 4
+     && stats.writes >= 1 && stats.written_bytes >= 4);
+
+  pk_ios_reset_stats (io);
+  pk_ios_stats (io, &stats);
+  T ("pk_ios_stats_5", stats.reads == 0 && stats.writes == 0);
+
+  T ("pk_ios_set_trace_1",
+     pk_ios_set_trace (pkc, "/nonexistent/dir/trace") == PK_ERROR);
+
+  pk_ios_close (pkc, io);
+}
+
+static void
+dirty_range_cb (uint64_t offset, uint64_t size, void *data)
+{
+  uint64_t *ranges = data;
+
+  if (ranges[0] < 4)
+    {
+      ranges[1 + ranges[0] * 2] = offset;
+      ranges[2 + ranges[0] * 2] = size;
+    }
+  ranges[0]++;
+}
+
+static void
+test_pk_ios_dirty_ranges (pk_compiler pkc)
+{
+  uint64_t ranges[9] = {0}, generation;
+  pk_ios io;
+
+  T ("pk_ios_dirty_ranges_1",
+     pk_ios_open (pkc, "*dirty*", 0, 1) != PK_IOS_NOID);
+  io = pk_ios_cur (pkc);
+
+  pk_ios_dirty_ranges (io, 0, dirty_range_cb, ranges);
+  T ("pk_ios_dirty_ranges_2", ranges[0] == 0);
+
+  T ("pk_ios_dirty_ranges_3",
+     pk_compile_statement (pkc, "uint<32> @ 4#B = 1;", NULL, NULL) == PK_OK
+     && pk_compile_statement (pkc, "uint<8> @ 8#B = 2;", NULL, NULL) == PK_OK
+     && pk_compile_statement (pkc, "uint<8> @ 20#B = 3;", NULL, NULL) == PK_OK);
+
+  pk_ios_dirty_ranges (io, 0, dirty_range_cb, ranges);
+  T ("pk_ios_dirty_ranges_4",
+     ranges[0] == 2
+     && ranges[1] == 4 && ranges[2] == 5
+     && ranges[3] == 20 && ranges[4] == 1);
+
+  generation = pk_ios_generation (io);
+  T ("pk_ios_dirty_ranges_5",
+     pk_compile_statement (pkc, "uint<8> @ 21#B = 4;", NULL, NULL) == PK_OK
+     && pk_ios_generation (io) > generation);
+
+  ranges[0] = 0;
+  pk_ios_dirty_ranges (io, generation, dirty_range_cb, ranges);
+  T ("pk_ios_dirty_ranges_6",
+     ranges[0] == 1 && ranges[1] == 20 && ranges[2] == 2);
+
+  pk_ios_clear_dirty (io);
+  ranges[0] = 0;
+  pk_ios_dirty_ranges (io, 0, dirty_range_cb, ranges);
+  T ("pk_ios_dirty_ranges_7", ranges[0] == 0);
+
+  pk_ios_close (pkc, io);
+}
+
+static void
+test_pk_ios_refresh (pk_compiler pkc)
+{
+  char filename[] = "refresh-XXXXXX";
+  uint64_t ranges[9] = {0}, generation;
+  int fd = mkstemp (filename);
+  pk_ios io;
+  pk_val val;
+
+  T ("pk_ios_refresh_1",
+     pk_ios_open (pkc, "*refresh*", 0, 1) != PK_IOS_NOID
+     && pk_ios_change_fd (pk_ios_cur (pkc)) == -1
+     && pk_ios_refresh (pkc, pk_ios_cur (pkc)) == PK_OK);
+  pk_ios_close (pkc, pk_ios_cur (pkc));
+
+  /* Empty files are handled by the FILE* device, which is watched
+     for modifications if the system supports it.  */
+  T ("pk_ios_refresh_2",
+     fd != -1 && pk_ios_open (pkc, filename, 0, 1) != PK_IOS_NOID);
+  io = pk_ios_cur (pkc);
+
+  if (io != NULL && pk_ios_change_fd (io) != -1)
+    {
+      generation = pk_ios_generation (io);
+      T ("pk_ios_refresh_3",
+         pk_ios_refresh (pkc, io) == PK_OK
+         && pk_ios_generation (io) == generation);
+
+      T ("pk_ios_refresh_4",
+         write (fd, "abcd", 4) == 4
+         && pk_ios_refresh (pkc, io) == PK_OK
+         && pk_ios_generation (io) > generation);
+
+      pk_ios_dirty_ranges (io, generation, dirty_range_cb, ranges);
+      T ("pk_ios_refresh_5",
+         ranges[0] == 1 && ranges[1] == 0 && ranges[2] == 4);
+
+      T ("pk_ios_refresh_6",
+         pk_compile_expression (pkc, "uint<8> @ 1#B", NULL, &val) == PK_OK
+         && pk_uint_value (val) == 'b');
+    }
+
+  if (io != NULL)
+    pk_ios_close (pkc, io);
+  if (fd != -1)
+    {
+      close (fd);
+      unlink (filename);
+    }
+}
+
+static void
+test_pk_array_bulk (pk_compiler pkc)
+{
+  uint64_t ubuf[4];
+  int64_t sbuf[4] = {-1, -2, 3, 4};
+  size_t elem_size = 0;
+  const uint16_t *data;
+  pk_val arr, val;
+  pk_ios io;
+
+  T ("pk_array_bulk_1",
+     pk_ios_open (pkc, "*bulk*", 0, 1) != PK_IOS_NOID);
+  io = pk_ios_cur (pkc);
+
+  T ("pk_array_bulk_2",
+     pk_compile_statement (pkc, "set_endian (ENDIAN_LITTLE);", NULL,
+                           NULL) == PK_OK
+     && pk_compile_statement (pkc,
+                              "uint<16>[4] @ 0#B = [1UH, 2UH, 3UH, 0xffffUH];",
+                              NULL, NULL) == PK_OK
+     && pk_compile_expression (pkc, "uint<16>[4] @ 0#B", NULL, &arr) == PK_OK);
+
+  T ("pk_array_get_uint64s_1",
+     pk_array_get_uint64s (arr, 1, 3, ubuf) == PK_OK
+     && ubuf[0] == 2 && ubuf[1] == 3 && ubuf[2] == 0xffff);
+  T ("pk_array_get_uint64s_2",
+     pk_array_get_uint64s (arr, 2, 3, ubuf) == PK_EINVAL);
+  T ("pk_array_get_uint64s_3",
+     pk_array_get_uint64s (arr, 4, 0, ubuf) == PK_OK);
+
+  /* Arrays of integral elements may not be stored contiguously.  */
+  data = pk_array_data (arr, &elem_size);
+  T ("pk_array_data_1",
+     data == NULL
+     || (elem_size == 2 && data[0] == 1 && data[3] == 0xffff));
+
+  T ("pk_array_set_uint64s_1",
+     pk_array_set_uint64s (arr, 0, 1, (uint64_t[]) {0x10005}) == PK_OK
+     && (val = pk_array_elem_val (arr, 0)) != PK_NULL
+     && pk_uint_value (val) == 5);
+
+  T ("pk_array_bulk_3",
+     pk_compile_expression (pkc, "[1, 2, 3, 4]", NULL, &arr) == PK_OK
+     && pk_array_set_int64s (arr, 0, 4, sbuf) == PK_OK
+     && pk_array_get_int64s (arr, 0, 4, sbuf) == PK_OK
+     && sbuf[0] == -1 && sbuf[1] == -2 && sbuf[3] == 4
+     && pk_int_value (pk_array_elem_val (arr, 1)) == -2);
+
+  T ("pk_array_bulk_4",
+     pk_compile_expression (pkc, "[\"a\", \"b\"]", NULL, &arr) == PK_OK
+     && pk_array_get_uint64s (arr, 0, 1, ubuf) == PK_EINVAL
+     && pk_array_data (arr, &elem_size) == NULL);
+
+  pk_ios_close (pkc, io);
+}
+
+static void
+test_pk_decl_handle (pk_compiler pkc)
+{
+  pk_decl_handle var, fun, undef;
+  pk_val val;
+
+  T ("pk_decl_handle_1",
+     pk_compile_buffer (pkc,
+                        "var handle_var = 10;"
+                        "fun handle_fun = (int a) int: { return a + 1; }",
+                        NULL) == PK_OK);
+
+  var = pk_decl_handle_new (pkc, "handle_var");
+  fun = pk_decl_handle_new (pkc, "handle_fun");
+  undef = pk_decl_handle_new (pkc, "handle_undef");
+  T ("pk_decl_handle_new_1", var != NULL && fun != NULL && undef != NULL);
+
+  T ("pk_decl_handle_val_1",
+     (val = pk_decl_handle_val (var)) != PK_NULL && pk_int_value (val) == 10);
+  T ("pk_decl_handle_val_2", pk_decl_handle_val (undef) == PK_NULL);
+
+  pk_decl_handle_set_val (var, pk_make_int (20, 32));
+  T ("pk_decl_handle_set_val_1",
+     pk_int_value (pk_decl_val (pkc, "handle_var")) == 20);
+
+  T ("pk_decl_handle_call_1",
+     pk_decl_handle_call (fun, &val, pk_make_int (2, 32), PK_NULL) == PK_OK
+     && pk_int_value (val) == 3);
+  T ("pk_decl_handle_call_2",
+     pk_decl_handle_call (var, &val, PK_NULL) == PK_EINVAL);
+
+  /* The handles follow the redefinitions.  */
+  T ("pk_decl_handle_2",
+     pk_compile_buffer (pkc,
+                        "var handle_var = \"x\";"
+                        "fun handle_fun = (int a) int: { return a * 5; }"
+                        "var handle_undef = 30;",
+                        NULL) == PK_OK);
+
+  T ("pk_decl_handle_val_3",
+     (val = pk_decl_handle_val (var)) != PK_NULL
+     && pk_type_code (pk_typeof (val)) == PK_STRING
+     && strcmp (pk_string_str (val), "x") == 0);
+  T ("pk_decl_handle_val_4",
+     (val = pk_decl_handle_val (undef)) != PK_NULL
+     && pk_int_value (val) == 30);
+  T ("pk_decl_handle_call_3",
+     pk_decl_handle_call (fun, &val, pk_make_int (2, 32), PK_NULL) == PK_OK
+     && pk_int_value (val) == 10);
+
+  pk_decl_handle_free (var);
+  pk_decl_handle_free (fun);
+  pk_decl_handle_free (undef);
+  pk_decl_handle_free (NULL);
+}
+
+/* Budget function that allows LIMIT renewals of the budget, and
+   then interrupts the execution.  */
+
+struct budget_data
+{
+  int calls;
+  int limit;
+  pk_compiler pkc;
+};
+
+static int
+budget_fn (void *data)
+{
+  struct budget_data *budget = data;
+
+  if (++budget->calls < budget->limit)
+    return 1;
+
+  if (budget->pkc)
+    {
+      pk_interrupt (budget->pkc);
+      return 1;
+    }
+
+  return 0;
+}
+
+static void
+test_pk_budget (pk_compiler pkc)
+{
+  struct budget_data budget = { 0, 1000, NULL };
+  pk_val loop, val;
+
+  T ("pk_budget_1",
+     pk_compile_expression (pkc,
+                            "lambda (int n) int: {"
+                            "  var i = 0; while (i < n) i++; return i; }",
+                            NULL, &loop) == PK_OK);
+
+  /* The execution continues while the budget function allows it.  */
+  pk_set_budget (pkc, 100, budget_fn, &budget);
+  T ("pk_budget_2",
+     pk_call (pkc, loop, &val, pk_make_int (10000, 32), PK_NULL) == PK_OK
+     && pk_int_value (val) == 10000
+     && budget.calls >= 10000 / 100);
+
+  /* Exhausting the budget interrupts the execution.  */
+  budget.calls = 0;
+  budget.limit = 5;
+  T ("pk_budget_3",
+     pk_call (pkc, loop, &val, pk_make_int (100000, 32), PK_NULL) == PK_ERROR
+     && budget.calls == 5);
+
+  /* The budget is renewed in every run.  */
+  budget.calls = 0;
+  T ("pk_budget_4",
+     pk_call (pkc, loop, &val, pk_make_int (250, 32), PK_NULL) == PK_OK
+     && pk_call (pkc, loop, &val, pk_make_int (250, 32), PK_NULL) == PK_OK
+     && budget.calls == 4);
+
+  /* Interrupting from the budget function.  */
+  budget.calls = 0;
+  budget.pkc = pkc;
+  T ("pk_interrupt_1",
+     pk_call (pkc, loop, &val, pk_make_int (100000, 32), PK_NULL) == PK_ERROR
+     && budget.calls == 5);
+
+  /* No budget.  */
+  pk_set_budget (pkc, 0, NULL, NULL);
+  T ("pk_budget_5",
+     pk_call (pkc, loop, &val, pk_make_int (100000, 32), PK_NULL) == PK_OK
+     && pk_int_value (val) == 100000);
+}
+
+static void
+test_pk_load_async (pk_compiler pkc)
+{
+  FILE *fp = fopen ("async_test.pk", "w");
+  pk_val val;
+
+  T ("pk_load_async_1",
+     fp != NULL
+     && fputs ("var async_test_var = 42;\n", fp) >= 0
+     && fclose (fp) == 0);
+
+  /* The failures are reported when waiting for the loads.  */
+  T ("pk_load_async_2",
+     pk_load_async (pkc, "async_test") == PK_OK
+     && pk_load_async (pkc, "async_test_nonexistent") == PK_OK
+     && pk_load_wait (pkc) == PK_ERROR
+     && pk_decl_p (pkc, "async_test_var", PK_DECL_KIND_VAR));
+
+  /* Using the compiler waits for the pending loads.  */
+  T ("pk_load_async_3",
+     pk_load_async (pkc, "async_test") == PK_OK
+     && pk_compile_expression (pkc, "async_test_var", NULL, &val) == PK_OK
+     && pk_int_value (val) == 42
+     && pk_load_wait (pkc) == PK_OK);
+
+  unlink ("async_test.pk");
+}
+
+static void
+test_pk_compiler_fork (pk_compiler pkc)
+{
+  pk_val val;
+  pid_t pid;
+  int status;
+
+  if (pk_compile_statement (pkc, "var fork_test_var = 40;", NULL,
+                            &val) != PK_OK)
+    fail ("pk_compiler_fork_1");
+
+  fflush (stdout);
+  pid = pk_compiler_fork (pkc);
+  if (pid == 0)
+    {
+      /* The child gets the declarations made in the parent.  */
+      int ok_p
+        = (pk_compile_expression (pkc, "fork_test_var + 2", NULL,
+                                  &val) == PK_OK
+           && pk_int_value (val) == 42);
+
+      _exit (ok_p ? 0 : 1);
+    }
+
+  T ("pk_compiler_fork_1",
+     pid > 0
+     && waitpid (pid, &status, 0) == pid
+     && WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+  /* The parent is not affected by the child.  */
+  T ("pk_compiler_fork_2",
+     pk_errno (pkc) == PK_OK
+     && pk_compile_expression (pkc, "fork_test_var", NULL, &val) == PK_OK
+     && pk_int_value (val) == 40);
+}
+
 static void
 test_pk_compiler_free (pk_compiler pkc)
 {
@@ -103,7 +805,27 @@ main ()
 {
   pk_compiler pkc;
 
+  test_pk_bytecode_cache ();
+
   pkc = test_pk_compiler_new ();
+  test_pk_compile_stats (pkc);
+  test_pk_call (pkc);
+  test_pk_prepared (pkc);
+  test_pk_peephole (pkc);
+  test_pk_inline (pkc);
+  test_pk_gc (pkc);
+  test_pk_profile (pkc);
+  test_pk_vm_dispatch (pkc);
+  test_pk_ios_stats (pkc);
+  test_pk_ios_dirty_ranges (pkc);
+  test_pk_ios_refresh (pkc);
+  test_pk_array_bulk (pkc);
+  test_pk_decl_handle (pkc);
+  test_pk_budget (pkc);
+  test_pk_load_async (pkc);
+#if HAVE_FORK
+  test_pk_compiler_fork (pkc);
+#endif
 
   test_pk_compiler_free (pkc);
 
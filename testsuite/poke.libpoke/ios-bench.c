@@ -0,0 +1,172 @@
+/* ios-bench.c -- Microbenchmark for reading integers from IO spaces */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program is linked with the IO subsystem of libpoke, which is
+   not part of the public API.  It checks that the integers read by
+   ios_read_int and ios_read_uint are correct, and reports the time
+   spent per read for byte-aligned integers of the sizes having
+   specialized kernels, and for integers handled by the generic
+   code.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "ios.h"
+
+/* DejaGnu should not use gnulib's vsnprintf replacement here.  */
+#undef vsnprintf
+#include <dejagnu.h>
+
+#define BENCH_SIZE (256 * 1024)
+#define BENCH_ROUNDS 8
+
+static uint8_t data[BENCH_SIZE];
+
+static double
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Decode the BITS bits integer stored at the bit OFFSET of DATA, one
+   bit at a time.  */
+
+static uint64_t
+bench_reference (uint64_t offset, int bits, enum ios_endian endian)
+{
+  uint64_t value = 0;
+  int i;
+
+  if (endian == IOS_ENDIAN_MSB || bits <= 8)
+    {
+      for (i = 0; i < bits; i++)
+        {
+          uint64_t bit = offset + i;
+          value = (value << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+        }
+    }
+  else
+    {
+      /* Little-endian integers having a size multiple of 8 bits
+         store their bytes in reverse order.  */
+      for (i = bits / 8 - 1; i >= 0; i--)
+        value = (value << 8) | bench_reference (offset + i * 8, 8,
+                                                IOS_ENDIAN_MSB);
+    }
+
+  return value;
+}
+
+static void
+bench_read (ios io, const char *name, int bits, int shift,
+            enum ios_endian endian)
+{
+  uint64_t offset, nreads = 0, sum = 0;
+  uint64_t limit = (uint64_t) BENCH_SIZE * 8 - bits - shift;
+  double start, elapsed;
+  char msg[128];
+  int round, ok = 1;
+
+  start = bench_now ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+    for (offset = shift; offset <= limit; offset += bits)
+      {
+        uint64_t uvalue;
+        int64_t ivalue;
+
+        if (ios_read_uint (io, offset, 0, bits, endian, &uvalue) != IOS_OK
+            || ios_read_int (io, offset, 0, bits, endian, IOS_NENC_2,
+                             &ivalue) != IOS_OK)
+          ok = 0;
+        sum += uvalue + ivalue;
+        nreads += 2;
+      }
+  elapsed = bench_now () - start;
+
+  /* Check a sample of the values.  */
+  for (offset = shift; offset <= limit; offset += 97 * bits)
+    {
+      uint64_t uvalue, expected = bench_reference (offset, bits, endian);
+      int64_t ivalue;
+
+      ios_read_uint (io, offset, 0, bits, endian, &uvalue);
+      ios_read_int (io, offset, 0, bits, endian, IOS_NENC_2, &ivalue);
+      if (uvalue != expected
+          || ivalue != (int64_t) (expected << (64 - bits)) >> (64 - bits))
+        ok = 0;
+    }
+
+  snprintf (msg, sizeof (msg), "%s %s", name,
+            endian == IOS_ENDIAN_MSB ? "big" : "little");
+  if (ok)
+    pass (msg);
+  else
+    fail (msg);
+
+  note ("%s: %.2f ns/read (checksum %llx)", msg, elapsed * 1e9 / nreads,
+        (unsigned long long) sum);
+}
+
+int
+main (int argc, char *argv[])
+{
+  ios io;
+  int id, endian;
+  uint64_t i;
+
+  srand (1);
+  for (i = 0; i < BENCH_SIZE; i++)
+    data[i] = rand ();
+
+  ios_init ();
+  id = ios_open ("*ios-bench*", 0, 1);
+  io = ios_search_by_id (id);
+  if (io == NULL)
+    {
+      fail ("ios_open");
+      totals ();
+      return 1;
+    }
+
+  for (i = 0; i < BENCH_SIZE; i++)
+    ios_write_uint (io, i * 8, 0, 8, IOS_ENDIAN_MSB, data[i]);
+
+  for (endian = IOS_ENDIAN_LSB; endian <= IOS_ENDIAN_MSB; endian++)
+    {
+      /* Specialized kernels.  */
+      bench_read (io, "aligned uint<8>", 8, 0, endian);
+      bench_read (io, "aligned uint<16>", 16, 0, endian);
+      bench_read (io, "aligned uint<32>", 32, 0, endian);
+      bench_read (io, "aligned uint<64>", 64, 0, endian);
+
+      /* Generic code.  */
+      bench_read (io, "aligned uint<24>", 24, 0, endian);
+      bench_read (io, "unaligned uint<32>", 32, 3, endian);
+    }
+
+  ios_shutdown ();
+  totals ();
+  return 0;
+}
@@ -0,0 +1,182 @@
+/* ios-stream.c -- Tests for the background reader of input streams */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program is linked with the IO subsystem of libpoke, which is
+   not part of the public API.  It replaces its standard input with a
+   pipe fed by a writer thread, and reads it through a stream IO space
+   having a background reader, flushing the data already read as it
+   goes.  The pipe holds less data than it is written, so both the
+   reader and the consumer have to wait for the data in turn.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+#include "ios.h"
+
+/* DejaGnu should not use gnulib's vsnprintf replacement here.  */
+#undef vsnprintf
+#include <dejagnu.h>
+
+#define STREAM_SIZE (256 * 1024)
+#define STREAM_READER_LOG 12
+#define STREAM_FLUSH_SIZE 4096
+
+static uint8_t
+stream_byte (uint64_t i)
+{
+  return (i * 7 + i / 256) & 0xff;
+}
+
+#if HAVE_PTHREAD
+
+static void *
+stream_writer (void *data)
+{
+  int fd = *(int *) data;
+  uint8_t buf[1000];
+  uint64_t i = 0;
+
+  while (i < STREAM_SIZE)
+    {
+      size_t n = STREAM_SIZE - i < sizeof (buf) ? STREAM_SIZE - i : sizeof (buf);
+      size_t j;
+      ssize_t written;
+
+      for (j = 0; j < n; j++)
+        buf[j] = stream_byte (i + j);
+      written = write (fd, buf, n);
+      if (written <= 0)
+        break;
+      i += written;
+    }
+
+  close (fd);
+  return NULL;
+}
+
+static void
+test_stream_reader (void)
+{
+  pthread_t writer;
+  int fds[2], id, ok = 1;
+  uint64_t value, i;
+  ios io;
+
+  if (pipe (fds) != 0 || dup2 (fds[0], STDIN_FILENO) == -1)
+    {
+      fail ("stream reader pipe");
+      return;
+    }
+  close (fds[0]);
+
+  if (pthread_create (&writer, NULL, stream_writer, &fds[1]) != 0)
+    {
+      fail ("stream reader writer");
+      return;
+    }
+
+  id = ios_open ("<stdin>",
+                 (uint64_t) STREAM_READER_LOG << IOS_F_STREAM_READER_SHIFT,
+                 0);
+  io = ios_search_by_id (id);
+  if (io == NULL)
+    {
+      fail ("stream reader open");
+      return;
+    }
+  pass ("stream reader open");
+
+  for (i = 0; i < STREAM_SIZE; i++)
+    {
+      if (ios_read_uint (io, i * 8, 0, 8, IOS_ENDIAN_MSB, &value) != IOS_OK
+          || value != stream_byte (i))
+        {
+          ok = 0;
+          break;
+        }
+
+      /* Make room in the buffer for the reader to continue.  */
+      if ((i + 1) % STREAM_FLUSH_SIZE == 0)
+        ios_flush (io, (i + 1) * 8);
+    }
+  if (ok)
+    pass ("stream reader read");
+  else
+    fail ("stream reader read");
+
+  if (ios_read_uint (io, 0, 0, 8, IOS_ENDIAN_MSB, &value) == IOS_EIOFF)
+    pass ("stream reader flushed");
+  else
+    fail ("stream reader flushed");
+
+  if (ios_read_uint (io, (uint64_t) STREAM_SIZE * 8, 0, 8, IOS_ENDIAN_MSB,
+                     &value) == IOS_EIOFF)
+    pass ("stream reader eof");
+  else
+    fail ("stream reader eof");
+
+  if (ios_close (io) == IOS_OK)
+    pass ("stream reader close");
+  else
+    fail ("stream reader close");
+
+  pthread_join (writer, NULL);
+}
+
+#endif /* HAVE_PTHREAD */
+
+int
+main (int argc, char *argv[])
+{
+  int id;
+
+  ios_init ();
+
+  /* The size of the buffer of the reader shall be within bounds.  */
+  id = ios_open ("<stdin>",
+                 (uint64_t) (IOS_STREAM_READER_LOG_MIN - 1)
+                 << IOS_F_STREAM_READER_SHIFT,
+                 0);
+  if (id == IOS_EFLAGS)
+    pass ("stream reader bad flags");
+  else
+    fail ("stream reader bad flags");
+
+#if HAVE_PTHREAD
+  test_stream_reader ();
+#else
+  /* Without POSIX threads there is no background reader.  */
+  id = ios_open ("<stdin>",
+                 (uint64_t) STREAM_READER_LOG << IOS_F_STREAM_READER_SHIFT,
+                 0);
+  if (id == IOS_EFLAGS)
+    pass ("stream reader unsupported");
+  else
+    fail ("stream reader unsupported");
+#endif
+
+  ios_shutdown ();
+  totals ();
+  return 0;
+}
@@ -0,0 +1,263 @@
+/* threads.c -- Tests for concurrent libpoke compilers and batches */
+
+/* Copyright (C) 2026 The poke authors */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+#include "libpoke.h"
+
+/* DejaGnu should not use gnulib's vsnprintf replacement here.  */
+#undef vsnprintf
+#include <dejagnu.h>
+
+#include "term-if.h"
+
+#define T(name, cond)                                                         \
+  do                                                                          \
+    {                                                                         \
+      if (cond)                                                               \
+        pass (name);                                                          \
+      else                                                                    \
+        fail (name);                                                          \
+    }                                                                         \
+  while (0)
+
+/* Every worker creates its own compiler and memory IO space, and
+   then repeatedly writes and reads back values that depend on the
+   worker number.  The IO spaces of the compilers are independent, so
+   all workers use the same handler and the same offsets.
+
+   All the calls to DejaGnu are done in the main thread, once the
+   workers are finished.  */
+
+#define NTHREADS 8
+#define NROUNDS 200
+
+struct worker
+{
+  int num;
+  int compiler_ok;
+  int ios_ok;
+  int ios_id;
+  int errors;
+  int rounds;
+};
+
+#if HAVE_PTHREAD
+
+static const char *worker_src =
+  "fun sum = (int n) int:\n"
+  "{\n"
+  "  var s = 0;\n"
+  "  for (var i = 0; i < n; i++)\n"
+  "    s += i;\n"
+  "  return s;\n"
+  "}\n";
+
+static void *
+worker_run (void *data)
+{
+  struct worker *w = data;
+  pk_compiler pkc;
+  pk_ios io;
+  int i;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  w->compiler_ok = (pkc != NULL);
+  if (!pkc)
+    return NULL;
+
+  w->ios_id = pk_ios_open (pkc, "*worker*", 0, 1);
+  io = pk_ios_cur (pkc);
+  w->ios_ok = (w->ios_id != PK_IOS_NOID && io != NULL
+               && strcmp (pk_ios_handler (io), "*worker*") == 0);
+
+  if (pk_compile_buffer (pkc, worker_src, NULL) != PK_OK)
+    w->errors++;
+
+  for (i = 0; i < NROUNDS; ++i)
+    {
+      char buf[128];
+      pk_val val;
+      uint32_t expected = w->num * 1000 + i;
+
+      snprintf (buf, sizeof (buf),
+                "uint<32> @ %d#B = %uU;", (i % 16) * 4,
+                (unsigned int) expected);
+      if (pk_compile_statement (pkc, buf, NULL, NULL) != PK_OK)
+        {
+          w->errors++;
+          continue;
+        }
+
+      snprintf (buf, sizeof (buf), "uint<32> @ %d#B", (i % 16) * 4);
+      if (pk_compile_expression (pkc, buf, NULL, &val) != PK_OK
+          || pk_uint_value (val) != expected)
+        w->errors++;
+
+      snprintf (buf, sizeof (buf), "sum (%d) + [%d, %d][1]",
+                w->num + i, i, w->num);
+      if (pk_compile_expression (pkc, buf, NULL, &val) != PK_OK
+          || (pk_int_value (val)
+              != (w->num + i) * (w->num + i - 1) / 2 + w->num))
+        w->errors++;
+
+      w->rounds++;
+    }
+
+  pk_compiler_free (pkc);
+  return NULL;
+}
+
+static void
+test_threads (void)
+{
+  pthread_t threads[NTHREADS];
+  struct worker workers[NTHREADS];
+  int i, ok;
+
+  memset (workers, 0, sizeof (workers));
+  for (i = 0; i < NTHREADS; ++i)
+    {
+      workers[i].num = i;
+      if (pthread_create (&threads[i], NULL, worker_run, &workers[i]) != 0)
+        {
+          fail ("threads_create");
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  for (i = 0; i < NTHREADS; ++i)
+    pthread_join (threads[i], NULL);
+
+  for (ok = 1, i = 0; i < NTHREADS; ++i)
+    ok &= workers[i].compiler_ok;
+  T ("threads_compiler_new", ok);
+
+  for (ok = 1, i = 0; i < NTHREADS; ++i)
+    ok &= workers[i].ios_ok;
+  T ("threads_ios_open", ok);
+
+  /* Every compiler has its own IO spaces, so all of them get the
+     first IOS id.  */
+  for (ok = 1, i = 1; i < NTHREADS; ++i)
+    ok &= (workers[i].ios_id == workers[0].ios_id);
+  T ("threads_ios_id", ok);
+
+  for (ok = 1, i = 0; i < NTHREADS; ++i)
+    ok &= (workers[i].rounds == NROUNDS && workers[i].errors == 0);
+  T ("threads_rounds", ok);
+}
+
+/* Run a batch of jobs, each one operating on its own memory IO
+   space, plus a job whose IO space can't be opened.  */
+
+#define NJOBS 100
+
+static const char *batch_src =
+  "fun job = (int<32> ios) uint<32>:\n"
+  "{\n"
+  "  uint<32> @ ios : 4#B = 42;\n"
+  "  return uint<32> @ ios : 4#B;\n"
+  "}\n"
+  "fun bad_job = (int<32> ios) int: { raise E_inval; }\n";
+
+static void
+test_batch (void)
+{
+  static char names[NJOBS][32];
+  const char *handlers[NJOBS];
+  struct pk_batch_result results[NJOBS];
+  pk_compiler pkc;
+  int i, ok;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (!pkc || pk_compile_buffer (pkc, batch_src, NULL) != PK_OK)
+    {
+      fail ("batch_compile");
+      return;
+    }
+
+  for (i = 0; i < NJOBS; ++i)
+    {
+      snprintf (names[i], sizeof (names[i]), "*job%d*", i);
+      handlers[i] = names[i];
+    }
+  handlers[NJOBS - 1] = "/nonexistent/dir/file";
+
+  T ("batch_run",
+     pk_batch_run (pkc, pk_decl_val (pkc, "job"), handlers, NJOBS, 4,
+                   results) == PK_OK);
+
+  for (ok = 1, i = 0; i < NJOBS - 1; ++i)
+    ok &= (results[i].status == PK_OK
+           && pk_uint_value (results[i].value) == 42
+           && results[i].exception == PK_NULL);
+  T ("batch_results", ok);
+  T ("batch_open_error",
+     results[NJOBS - 1].status != PK_OK
+     && results[NJOBS - 1].exception == PK_NULL);
+
+  T ("batch_exceptions",
+     pk_batch_run (pkc, pk_decl_val (pkc, "bad_job"), handlers, 2, 0,
+                   results) == PK_OK
+     && results[0].status == PK_ERROR
+     && results[0].exception != PK_NULL
+     && results[1].status == PK_ERROR);
+
+  /* The IO spaces of the jobs are not visible from the compiler.  */
+  T ("batch_ios", pk_ios_cur (pkc) == NULL);
+  pk_compiler_free (pkc);
+}
+
+#endif /* HAVE_PTHREAD */
+
+int
+main ()
+{
+#if HAVE_PTHREAD
+  pk_compiler pkc;
+
+  /* Run the workers while another compiler, created in the main
+     thread, is alive.  */
+  pkc = pk_compiler_new (&poke_term_if);
+  T ("threads_main_compiler_new", pkc != NULL);
+
+  test_threads ();
+
+  /* The compiler of the main thread is not affected by the
+     others.  */
+  T ("threads_main_ios", pk_ios_cur (pkc) == NULL);
+  pk_compiler_free (pkc);
+
+  /* Now do it again, with no other compilers around.  */
+  test_threads ();
+
+  test_batch ();
+#else
+  untested ("threads");
+#endif
+
+  totals ();
+  return 0;
+}
@@ -31,6 +31,7 @@
 
 #include "pk-mi-msg.h"
 #include "pk-mi-json.h"
+#include "pk-mi-cbor.h"
 #include "libpoke.h"
 #include "../poke.libpoke/term-if.h"
 
@@ -50,6 +51,221 @@ test_json_to_msg ()
     fail ("json_to_msg_1");
 }
 
+/* Buffer used to collect the output of the CBOR encoders.  */
+
+struct cbor_buffer
+{
+  char *data;
+  size_t size;
+};
+
+void
+cbor_buffer_write (const void *buf, size_t size, void *data)
+{
+  struct cbor_buffer *buffer = data;
+
+  buffer->data = realloc (buffer->data, buffer->size + size);
+  memcpy (buffer->data + buffer->size, buf, size);
+  buffer->size += size;
+}
+
+void
+test_cbor_to_msg ()
+{
+  struct cbor_buffer buffer = { NULL, 0 };
+  pk_mi_msg msg;
+
+  /* Truncated CBOR should result in NULL.  */
+  msg = pk_mi_cbor_to_msg ("\xa3\x63seq", 5);
+  if (msg == NULL)
+    pass ("cbor_to_msg_1");
+  else
+    fail ("cbor_to_msg_1");
+
+  /* Encode and decode an ENCODING request.  */
+  msg = pk_mi_make_req_encoding ("cbor");
+  pk_mi_set_msg_number (msg, 23);
+  pk_mi_msg_to_cbor (msg, cbor_buffer_write, &buffer);
+  pk_mi_msg_free (msg);
+
+  msg = pk_mi_cbor_to_msg (buffer.data, buffer.size);
+  if (msg
+      && pk_mi_msg_type (msg) == PK_MI_MSG_REQUEST
+      && pk_mi_msg_req_type (msg) == PK_MI_REQ_ENCODING
+      && pk_mi_msg_number (msg) == 23
+      && strcmp (pk_mi_msg_req_encoding_encoding (msg), "cbor") == 0)
+    pass ("cbor_to_msg_2");
+  else
+    fail ("cbor_to_msg_2");
+
+  if (msg)
+    pk_mi_msg_free (msg);
+  free (buffer.data);
+}
+
+void
+test_cbor_to_val ()
+{
+  pk_val val;
+
+  /* A struct claiming 2^40 fields, and an array claiming 2^64-1
+     elements, in a few bytes should be rejected without allocating
+     them.  */
+  if (!pk_mi_cbor_to_val (&val,
+                          "\x84\x03\xf6\x9b\x00\x00\x01\x00"
+                          "\x00\x00\x00\x00", 12))
+    pass ("cbor_to_val_1");
+  else
+    fail ("cbor_to_val_1");
+
+  if (!pk_mi_cbor_to_val (&val,
+                          "\x83\x04\x9b\xff\xff\xff\xff\xff"
+                          "\xff\xff\xff", 11))
+    pass ("cbor_to_val_2");
+  else
+    fail ("cbor_to_val_2");
+}
+
+/* Check that IOS_CHANGED events survive both encodings.  */
+
+int
+test_ios_changed_msg (pk_mi_msg msg)
+{
+  const uint64_t *ranges;
+
+  if (!msg
+      || pk_mi_msg_type (msg) != PK_MI_MSG_EVENT
+      || pk_mi_msg_event_type (msg) != PK_MI_EVENT_IOS_CHANGED
+      || pk_mi_msg_event_ios_changed_ios (msg) != 3
+      || pk_mi_msg_event_ios_changed_nranges (msg) != 2)
+    return FAIL;
+
+  ranges = pk_mi_msg_event_ios_changed_ranges (msg);
+  return (ranges[0] == 4 && ranges[1] == 2
+          && ranges[2] == 0x100000000 && ranges[3] == 1);
+}
+
+void
+test_ios_changed ()
+{
+  struct cbor_buffer buffer = { NULL, 0 };
+  uint64_t ranges[] = { 4, 2, 0x100000000, 1 };
+  const char *json;
+  pk_mi_msg msg, msg2;
+
+  msg = pk_mi_make_event_ios_changed (3, 2, ranges);
+
+  json = pk_mi_msg_to_json (msg);
+  msg2 = json ? pk_mi_json_to_msg (json) : NULL;
+  if (test_ios_changed_msg (msg2))
+    pass ("ios_changed_json");
+  else
+    fail ("ios_changed_json");
+  if (msg2)
+    pk_mi_msg_free (msg2);
+
+  pk_mi_msg_to_cbor (msg, cbor_buffer_write, &buffer);
+  msg2 = pk_mi_cbor_to_msg (buffer.data, buffer.size);
+  if (test_ios_changed_msg (msg2))
+    pass ("ios_changed_cbor");
+  else
+    fail ("ios_changed_cbor");
+  if (msg2)
+    pk_mi_msg_free (msg2);
+
+  pk_mi_msg_free (msg);
+  free (buffer.data);
+}
+
+/* Check that the parameters of VALUE requests survive both encodings,
+   and that they select the right part of the value.  */
+
+int
+test_value_params_val (pk_val val)
+{
+  pk_val elem;
+
+  /* Elements 1 and 2 of the array, with just the field B.  */
+  if (val == PK_NULL
+      || pk_type_code (pk_typeof (val)) != PK_ARRAY
+      || pk_uint_value (pk_array_nelem (val)) != 2)
+    return FAIL;
+
+  elem = pk_array_elem_val (val, 0);
+  if (pk_uint_value (pk_struct_nfields (elem)) != 1
+      || strcmp (pk_string_str (pk_struct_field_name (elem, 0)), "b") != 0
+      || pk_int_value (pk_struct_field_value (elem, 0)) != 11)
+    return FAIL;
+
+  return PASS;
+}
+
+void
+test_value_params ()
+{
+  struct pk_mi_val_params params = { 1, 2, -1, "c,b" };
+  struct cbor_buffer buffer = { NULL, 0 };
+  const struct pk_mi_val_params *p;
+  pk_compiler pkc;
+  pk_mi_msg msg, msg2;
+  pk_val val;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (!pkc
+      || pk_compile_buffer (pkc, "type T = struct { int a; int b; };",
+                            NULL) != PK_OK
+      || pk_compile_expression (pkc,
+                                "[T { a = 0, b = 10 }, T { a = 1, b = 11 },"
+                                " T { a = 2, b = 12 }, T { a = 3, b = 13 }]",
+                                NULL, &val) != PK_OK)
+    {
+      fail ("value_params_compile");
+      return;
+    }
+
+  msg = pk_mi_make_req_value ("foo", &params);
+  msg2 = pk_mi_json_to_msg (pk_mi_msg_to_json (msg));
+  p = msg2 ? pk_mi_msg_req_value_params (msg2) : NULL;
+  if (p && p->from == 1 && p->count == 2 && p->depth == -1
+      && strcmp (p->fields, "c,b") == 0)
+    pass ("value_params_json_req");
+  else
+    fail ("value_params_json_req");
+  pk_mi_msg_free (msg2);
+
+  pk_mi_msg_to_cbor (msg, cbor_buffer_write, &buffer);
+  msg2 = pk_mi_cbor_to_msg (buffer.data, buffer.size);
+  p = msg2 ? pk_mi_msg_req_value_params (msg2) : NULL;
+  if (p && p->from == 1 && p->count == 2 && p->depth == -1
+      && strcmp (p->fields, "c,b") == 0)
+    pass ("value_params_cbor_req");
+  else
+    fail ("value_params_cbor_req");
+  pk_mi_msg_free (msg2);
+  pk_mi_msg_free (msg);
+
+  msg = pk_mi_make_resp_value (0, 1, NULL, val, &params);
+  msg2 = pk_mi_json_to_msg (pk_mi_msg_to_json (msg));
+  if (msg2 && test_value_params_val (pk_mi_msg_resp_value_val (msg2)) == PASS)
+    pass ("value_params_json_resp");
+  else
+    fail ("value_params_json_resp");
+  pk_mi_msg_free (msg2);
+
+  buffer.size = 0;
+  pk_mi_msg_to_cbor (msg, cbor_buffer_write, &buffer);
+  msg2 = pk_mi_cbor_to_msg (buffer.data, buffer.size);
+  if (msg2 && test_value_params_val (pk_mi_msg_resp_value_val (msg2)) == PASS)
+    pass ("value_params_cbor_resp");
+  else
+    fail ("value_params_cbor_resp");
+  pk_mi_msg_free (msg2);
+  pk_mi_msg_free (msg);
+
+  free (buffer.data);
+  pk_compiler_free (pkc);
+}
+
 int
 parse_json_str_object (const char *json_str, json_object **pk_obj)
 {
@@ -554,6 +770,23 @@ test_val_to_json (const char *pk_obj_str, pk_val val)
   return PASS;
 }
 
+/* Check that VAL survives a trip through the CBOR encoding.  */
+
+int
+test_val_to_cbor (pk_val val)
+{
+  struct cbor_buffer buffer = { NULL, 0 };
+  pk_val pk_test_val;
+  int ok;
+
+  pk_mi_val_to_cbor (val, cbor_buffer_write, &buffer);
+  ok = (pk_mi_cbor_to_val (&pk_test_val, buffer.data, buffer.size)
+        && pk_val_equal_p (pk_test_val, val));
+  free (buffer.data);
+
+  return ok ? PASS : FAIL;
+}
+
 void
 test_json_file (const char *filename, FILE *ifp)
 {
@@ -581,6 +814,9 @@ test_json_file (const char *filename, FILE *ifp)
   if (test_val_to_json (json_obj_str, val) == FAIL)
     goto error;
 
+  if (test_val_to_cbor (val) == FAIL)
+    goto error;
+
   pass (filename);
   return;
 
@@ -638,6 +874,10 @@ int
 main (int argc, char *argv[])
 {
   test_json_to_msg ();
+  test_cbor_to_msg ();
+  test_cbor_to_val ();
+  test_ios_changed ();
+  test_value_params ();
   test_json_to_val_to_json ();
   totals ();
   return 0;